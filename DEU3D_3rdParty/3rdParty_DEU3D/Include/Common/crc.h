@@ -7,6 +7,9 @@
 namespace cmm
 {
     CM_EXPORT unsigned int createHashCRC32(const void *pBuffer, unsigned nLength);
+
+    // Castagnoli, with SSE4.2 when the CPU has it, nPartialCrc continues a former result
+    CM_EXPORT unsigned int createHashCRC32C(const void *pBuffer, unsigned nLength, unsigned nPartialCrc = 0u);
 }
 
 #endif
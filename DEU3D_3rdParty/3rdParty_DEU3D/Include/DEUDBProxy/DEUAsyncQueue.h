@@ -0,0 +1,96 @@
+#ifndef DEUDB_ASYNC_QUEUE_H_31E7DF4E_75AA_44E7_B885_0B75773461F2_INCLUDE
+#define DEUDB_ASYNC_QUEUE_H_31E7DF4E_75AA_44E7_B885_0B75773461F2_INCLUDE
+
+#include "DEUDefine.h"
+#include "IDEUDBProxy.h"
+#include <deque>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Block>
+
+namespace deudbProxy
+{
+	//The requests of the async calls of a proxy. A few threads carry them out
+	//through the blocking calls of the proxy and tell the callbacks, so the threads
+	//of the caller never wait for the server. A thread takes the reads or lookups at
+	//the head of the queue together and sends them in one batch. At most
+	//DEU_ASYNC_MAX_OUTSTANDING requests are queued or in flight, a push waits while
+	//there are more, so a fast caller cannot fill the memory. The threads are only
+	//started by the first request.
+	//
+	//A request leaves the count before its callback is told, so a callback may
+	//call the proxy again. On a thread of the queue a push does not wait for room,
+	//Wait carries out the queued requests itself rather than waiting for the
+	//other callbacks, and Close does not join the threads, the next Open or Close
+	//from another thread does.
+	class DEUAsyncQueue
+	{
+	public:
+		DEUAsyncQueue(void);
+		~DEUAsyncQueue(void);
+	public:
+		//take requests for pProxy, the threads left by a Close in a callback are joined first
+		void		Open(IDEUDBProxy* pProxy);
+		//refuse new requests, carry out those queued and stop the threads
+		void		Close();
+
+		//false when the queue is closed
+		bool		PushRead(const ID& id,unsigned nVersion,IReadCallback* pCallback);
+		bool		PushExist(const ID& id,IExistCallback* pCallback);
+		//wait until every request pushed has been answered, in a callback until
+		//every one has been carried out
+		void		Wait();
+
+	private:
+		enum AsyncType
+		{
+			AT_READ,
+			AT_READ_VERSION,		//a version is never read in a batch
+			AT_EXIST
+		};
+		struct AsyncRequest
+		{
+			AsyncType					m_eType;
+			ID							m_id;
+			unsigned					m_nVersion;
+			OpenSP::sp<IReadCallback>	m_pRead;
+			OpenSP::sp<IExistCallback>	m_pExist;
+			//the answer, kept until the callback is told
+			bool						m_bFound;
+			void*						m_pBuffer;
+			unsigned					m_nLength;
+		};
+
+		class AsyncThread : public OpenThreads::Thread
+		{
+		public:
+			explicit AsyncThread(DEUAsyncQueue* pQueue) : m_pQueue(pQueue){}
+		protected:
+			virtual void run(void);
+			DEUAsyncQueue*	m_pQueue;
+		};
+		friend class AsyncThread;
+
+		bool		Push(const AsyncRequest& request);
+		void		Work();
+		bool		IsQueueThread() const;
+		void		JoinThreads();
+		bool		TakeBatch(std::vector<AsyncRequest>& requestVec);
+		void		RunBatch(std::vector<AsyncRequest>& requestVec);
+		void		Read(std::vector<AsyncRequest>& requestVec);
+		void		Exist(std::vector<AsyncRequest>& requestVec);
+		void		Answer(const std::vector<AsyncRequest>& requestVec);
+
+	private:
+		IDEUDBProxy*				m_pProxy;
+		std::deque<AsyncRequest>	m_requestQueue;
+		unsigned					m_nOutstanding;		//queued or in flight, a push waits while there are too many
+		unsigned					m_nUnanswered;		//pushed and their callbacks not yet returned
+		bool						m_bClosed;
+		OpenThreads::Mutex			m_mtxQueue;
+		OpenThreads::Block			m_blockRequest;		//released when a request is queued or the queue is closed
+		OpenThreads::Block			m_blockDone;		//released when a request has been carried out or answered
+		std::vector<AsyncThread*>	m_threadVec;
+	};
+}
+#endif //_DEUASYNCQUEUE_H_
@@ -12,6 +12,11 @@
 namespace deudbProxy
 {
 	class DEUShareMem;
+	class DEUChannel;
+	class DEUShmRing;
+	class DEUSockChannel;
+	class DEUShmArena;
+	class DEUAsyncQueue;
 
     class DEUDBProxyPulseThread : public OpenThreads::Thread
     {
@@ -69,14 +74,34 @@ namespace deudbProxy
         virtual std::vector<unsigned> getVersion(const ID &id) const;
         // set clear code
         virtual bool  setClearFlag(bool bFlag);
+        // read many blocks
+        virtual unsigned readBlocks(const std::vector<ID> &vecIDs, std::vector<void *> &vecBuffers, std::vector<unsigned> &vecLengths, std::vector<bool> &vecFound);
+        // whether many blocks exist
+        virtual unsigned existBlocks(const std::vector<ID> &vecIDs, std::vector<bool> &vecExist);
+        // write many blocks
+        virtual bool  writeBlocks(const std::vector<ID> &vecIDs, const std::vector<const void *> &vecBuffers, const std::vector<unsigned> &vecLengths);
+        // read data in place
+        virtual bool  readSharedBlock(const ID &id, OpenSP::sp<ISharedBlock> &pBlock, unsigned nVersion = 0u);
+        // choose the transport
+        virtual bool  setTransport(DEUDBTransport eTransport);
+        // read data without waiting
+        virtual bool  readBlockAsync(const ID &id, IReadCallback *pCallback, unsigned nVersion = 0u);
+        virtual bool  readBlocksAsync(const std::vector<ID> &vecIDs, IReadCallback *pCallback);
+        // whether blocks exist without waiting
+        virtual bool  existAsync(const ID &id, IExistCallback *pCallback);
+        virtual bool  existBlocksAsync(const std::vector<ID> &vecIDs, IExistCallback *pCallback);
+        // wait for the async requests
+        virtual void  waitForAsync(void);
 
 	private:
-        unsigned __stdcall pulseProc(LPVOID lpParam);
 		bool	           regShm(unsigned nSize);         //register shm
 		bool	           writeRegInfo(const int& nType);
 		std::string	       getExePath();
 		bool		       openExistServer();
 		bool		       openNewServer(UINT_64 nReadBufferSize, UINT_64 nWriteBufferSize);
+		bool		       openSocket(const std::string& strDBPath);
+		bool		       sendBlock(int nType, const ID &id, const void *pBuffer, unsigned nBufLen);
+		char*		       setBatchRequest(int nSlot, int nType, const std::vector<ID> &vecIDs, unsigned nExtra);
 
 	private:
 		std::string		m_strShared;        // ͻ˹
@@ -91,7 +116,12 @@ namespace deudbProxy
         HANDLE          m_pulseSemHnd;      // ź
 		HANDLE		    m_startHnd;         // ƶź
 		HANDLE          m_partHnd;          // רź
-		DEUShareMem*	m_shm;              // ڴָ
+		DEUChannel*		m_ring;             // ֮ͨ
+		DEUShmRing*		m_shmRing;          // ڴе
+		DEUSockChannel*	m_sockChannel;      // unix׽ϵͨ
+		DEUDBTransport	m_eTransport;       // ֮Ĵ䷽ʽ
+		OpenSP::sp<DEUShmArena>	m_pArena;   // ˹ȵݿ
+		DEUAsyncQueue*	m_asyncQueue;       // 첽
 		DEUShareMem*	m_regShm;           // עṲڴָ
 		bool			m_bReg;
 		bool			m_bUnReg;
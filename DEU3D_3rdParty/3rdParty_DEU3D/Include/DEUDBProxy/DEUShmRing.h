@@ -0,0 +1,147 @@
+#ifndef DEUDB_SHM_RING_H_518E985D_4F51_41D1_B198_3090FB3F0237_INCLUDE
+#define DEUDB_SHM_RING_H_518E985D_4F51_41D1_B198_3090FB3F0237_INCLUDE
+
+#include "DEUChannel.h"
+
+namespace deudbProxy
+{
+	class DEUShareMem;
+
+	//the layout of the ring in the shared memory, it must be the same as in DEUDBServer
+	struct RingHeader
+	{
+		unsigned             m_nMagic;
+		unsigned             m_nSlotCount;
+		unsigned             m_nInlineSize;
+		volatile INT_32      m_nServerWaiting;  //the server sleeps on its semaphore
+		unsigned             m_nLeaseCount;     //the counts of the lease table behind the inline payloads
+		unsigned             m_nProcessID;      //the process of the client
+		unsigned             m_nServerProcessID;//the process of the server, set when it opens the ring
+		unsigned             m_nReserved;
+	};
+
+	struct RingSlot
+	{
+		volatile INT_32      m_nState;          //DEU_SLOT_*
+		volatile INT_32      m_nClientWaiting;  //the client sleeps on the semaphore of the slot
+		int                  m_nType;           //the opcode, DEU_FAIL or DEU_NEED_SPACE in a response
+		unsigned             m_nVersion;
+		UINT_64              m_nHighBit;
+		UINT_64              m_nMidBit;
+		UINT_64              m_nLowBit;
+		unsigned             m_nOffset;
+		unsigned             m_nCount;          //the count of a list, the clear flag
+		unsigned             m_nLength;         //the bytes in the payload, or the bytes needed
+		unsigned             m_nRegion;         //0 the inline payload, else the generation of the region of the slot
+		unsigned             m_nRegionSize;
+	};
+
+	//the client and the server may be built for other word sizes, the layout must not change with them
+	static_assert(sizeof(RingHeader) == 32,"RingHeader must be 32 bytes");
+	static_assert(sizeof(RingSlot) == 64,"RingSlot must be 64 bytes");
+
+	//ordered accesses to a word of the shared memory, the exchanges are full barriers
+	inline INT_32 RingLoad(volatile INT_32* pValue)
+	{
+#if defined (WIN32) || defined (WIN64)
+		return *pValue;
+#else
+		const INT_32 nValue = *pValue;
+		__sync_synchronize();
+		return nValue;
+#endif
+	}
+
+	inline INT_32 RingExchange(volatile INT_32* pValue,INT_32 nValue)
+	{
+#if defined (WIN32) || defined (WIN64)
+		return InterlockedExchange(pValue,nValue);
+#else
+		__sync_synchronize();
+		return __sync_lock_test_and_set(pValue,nValue);
+#endif
+	}
+
+	inline INT_32 RingIncrement(volatile INT_32* pValue)
+	{
+#if defined (WIN32) || defined (WIN64)
+		return InterlockedIncrement(pValue);
+#else
+		return __sync_add_and_fetch(pValue,1);
+#endif
+	}
+
+	inline INT_32 RingDecrement(volatile INT_32* pValue)
+	{
+#if defined (WIN32) || defined (WIN64)
+		return InterlockedDecrement(pValue);
+#else
+		return __sync_sub_and_fetch(pValue,1);
+#endif
+	}
+
+	inline INT_32 RingCompareExchange(volatile INT_32* pValue,INT_32 nValue,INT_32 nComparand)
+	{
+#if defined (WIN32) || defined (WIN64)
+		return InterlockedCompareExchange(pValue,nValue,nComparand);
+#else
+		return __sync_val_compare_and_swap(pValue,nComparand,nValue);
+#endif
+	}
+
+	//The requests of a client go through a ring of slots in the shared memory, so
+	//every thread of the client has its own request in flight. A thread takes a
+	//free slot without any lock, writes the request into it and hands it to the
+	//server, which answers in the same slot. A payload goes into the inline region
+	//of the slot, a bigger one into a region of the slot's own which the client
+	//creates and the server only maps, so a block is copied into the shared memory
+	//once and out of it once. Both sides spin a little before they sleep, and a
+	//semaphore is only released for a side which has said that it sleeps on it.
+	//The lease table behind the slots counts the blocks of the arena the client
+	//holds, the server gives them back when the ring goes without the client.
+	class DEUShmRing : public DEUChannel
+	{
+	public:
+		DEUShmRing(void);
+		virtual ~DEUShmRing(void);
+	public:
+		//create the ring strShared + "Shm" and the semaphores of its slots
+		bool				Create(const std::string& strShared,unsigned nSlotCount,unsigned nInlineSize);
+		virtual void		Destroy();
+		//one count for every entry of the arena
+		volatile INT_32*	GetLeases() const;
+
+		virtual RingSlot*	GetSlot(int nSlot) const;
+		virtual char*		ReservePayload(int nSlot,unsigned nLength,unsigned nKeep = 0);
+		virtual char*		GetPayload(int nSlot) const;
+
+		//hand the request to the server and wait for the response, a response which
+		//has not fitted is asked for again with a payload big enough. The slot is
+		//answered with DEU_FAIL when the server has gone
+		virtual void		Call(int nSlot,HANDLE svrHnd);
+		//the process of the server is still there, or it has not opened the ring yet
+		bool				IsServerAlive() const;
+
+	protected:
+		virtual unsigned	GetSlotCount() const;
+		virtual void		TrimSlot(int nSlot);
+
+	private:
+		void		Post(int nSlot,HANDLE svrHnd);
+		bool		Wait(int nSlot);
+		void		FreeRegion(int nSlot);
+
+	private:
+		std::string					m_strShared;
+		DEUShareMem*				m_shm;
+		RingHeader*					m_pHeader;
+		char*						m_pSlots;
+		char*						m_pInline;
+		std::vector<HANDLE>			m_slotHndVec;
+		std::vector<std::string>	m_slotSemVec;
+		std::vector<DEUShareMem*>	m_regionVec;
+		std::vector<unsigned>		m_regionGenVec;
+		volatile bool				m_bServerLost;
+	};
+}
+#endif //_DEUSHMRING_H_
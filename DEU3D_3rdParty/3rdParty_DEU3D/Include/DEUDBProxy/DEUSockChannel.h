@@ -0,0 +1,78 @@
+#ifndef DEUDB_SOCK_CHANNEL_H_111AEEB8_CA9B_440A_BE9E_70E2F02EA095_INCLUDE
+#define DEUDB_SOCK_CHANNEL_H_111AEEB8_CA9B_440A_BE9E_70E2F02EA095_INCLUDE
+
+#include "DEUChannel.h"
+#include "DEUShmRing.h"
+
+namespace deudbProxy
+{
+	//the head of every message on the socket, it must be the same as in DEUDBServer
+	struct SockHeader
+	{
+		unsigned             m_nMagic;
+		unsigned             m_nFlags;          //DEU_SOCK_MEMFD
+		int                  m_nType;
+		unsigned             m_nVersion;
+		UINT_64              m_nHighBit;
+		UINT_64              m_nMidBit;
+		UINT_64              m_nLowBit;
+		unsigned             m_nOffset;
+		unsigned             m_nCount;
+		unsigned             m_nLength;         //the bytes of the payload behind the head or in the memfd
+		unsigned             m_nReserved;
+	};
+
+	//The requests go to a server listening on the unix domain socket beside the
+	//database, so the client needs neither the shared memory nor the semaphores of
+	//the server and may run in another container. Both sides only talk to a peer
+	//of the same user or root. Every slot has a connection of its own, so the
+	//threads of the client do not wait for each other. A payload bigger than
+	//DEU_SOCK_INLINE_SIZE lives in a memfd which is passed along with the head, so
+	//it is not copied through the socket. A broken connection is made again, and
+	//the request is sent once more unless the server may have carried it out.
+	class DEUSockChannel : public DEUChannel
+	{
+	public:
+		DEUSockChannel(void);
+		virtual ~DEUSockChannel(void);
+	public:
+		//connect to the server on strSocket and make the slots
+		bool				Open(const std::string& strSocket,unsigned nSlotCount);
+		virtual void		Destroy();
+
+		virtual RingSlot*	GetSlot(int nSlot) const;
+		virtual char*		ReservePayload(int nSlot,unsigned nLength,unsigned nKeep = 0);
+		virtual char*		GetPayload(int nSlot) const;
+
+		//svrHnd is not used, the server is woken by the socket
+		virtual void		Call(int nSlot,HANDLE svrHnd);
+
+	protected:
+		virtual unsigned	GetSlotCount() const;
+		virtual void		TrimSlot(int nSlot);
+
+	private:
+		struct SockSlot
+		{
+			RingSlot			m_slot;
+			int					m_nSocket;		//-1 until the slot is used, or after its connection has broken
+			std::vector<char>	m_inlineVec;
+			int					m_nMemFd;		//the memfd of a bigger payload, -1 when there is none
+			char*				m_pMapped;
+			unsigned			m_nMappedSize;
+		};
+
+		int					Connect() const;
+		bool				Send(int nSlot);
+		//bRetry is cleared once the response has begun to come in
+		bool				Receive(int nSlot,bool& bRetry);
+		//the memfd becomes the payload of the slot
+		bool				MapPayload(int nSlot,int nMemFd);
+		void				FreePayload(int nSlot);
+
+	private:
+		std::string				m_strSocket;
+		std::vector<SockSlot*>	m_slotVec;
+	};
+}
+#endif //_DEUSOCKCHANNEL_H_
@@ -49,6 +49,7 @@ struct ResponseInfo
     char *ContentLen;        //ݳ
     char *ContentType;        //
     char *Transfer;            //룬ʽΪ chunked
+    char *Connection;        //ãΪcloseʱ˽ر
 };
 
 struct HttpRequest
@@ -147,6 +148,18 @@ private:
     //ݣɹ0ʧܷ-1
     int Send(const std::vector<char> &vecData);
 
+    //кڱӣͬһӳе
+    //ȵȸʹеޣٴӳȡӣû½ӣbReusedǷȡ˱ֵ
+    int  AcquireConnection(const char *pHost, unsigned short Port, bool &bReused);
+    //ӦѽҿԱʱŻӳأر
+    void ReleaseConnection(bool bKeepAlive);
+    bool IsKeepAlive();
+
+    //кڽӦݣ֧chunkedContent-Length
+    int  RecvFully(char *pBuf, long BufLen);
+    int  RecvLine(std::string &strLine);
+    int  RecvContent(std::vector<char> &vecContent, bool &bComplete);
+
     //кڸResponse
     void GetField(const char *Response, const char *pName, char **Val);
     void GetHttpVersion(const char *Response, char **Val);
@@ -165,6 +178,8 @@ private:
     unsigned short        Port_;
     char                *AgentHost_;
     unsigned short        AgentPort_;
+    std::string           PoolKey_;       //ռӳʹûռʱΪ
+    bool                  Written_;       //SendRequestǷд
 };
 
 #ifdef    __WINDOWS__
@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////
+// ļHttpConnectionPool.h
+// ܣHttpConnectionPool࣬NetworkExternalServiceSimpleHttpClient
+//       SOCKETclosesocketȡCSimpleHttpClient.hȰ
+
+#ifndef    __HTTP_CONNECTION_POOL_H__
+#define    __HTTP_CONNECTION_POOL_H__
+
+#include <map>
+#include <list>
+#include <string>
+#include <time.h>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+
+#define HTTP_IDLE_TIMEOUT               4       //ӱֵҪСڷ˵KeepAliveTimeout(apacheĬ5)
+#define HTTP_MAX_IDLE_PER_HOST          8       //ÿౣֵĿ
+#define HTTP_MAX_CONNECTIONS_PER_HOST   16      //ÿͬʱʹõٶȴӷŻ
+
+//////////////////////////////////////////////////////////////////////
+// : HttpConnectionPool
+// ܣֵĿӣSimpleHttpClientã
+//       ͬһһ½ӣ
+//       ÿͬʱʹõͻ󲻻
+//////////////////////////////////////////////////////////////////////
+class HttpConnectionPool
+{
+public:
+    HttpConnectionPool();
+    ~HttpConnectionPool();
+
+public:
+    //ȵʹеޣһʹеӣ
+    //һδʱҷδرյĿӣûзINVALID_SOCKETɵ½
+    SOCKET Take(const std::string &strHost);
+
+    //ŻһӦѽʹеӣʱرδõ
+    void Give(const std::string &strHost, SOCKET s);
+
+    //ʹеѹرջûнټʹе
+    void Drop(const std::string &strHost);
+
+    //ӳļ
+    static std::string GetKey(const char *pHost, unsigned short Port);
+
+private:
+    //еӿɶʾѹرӻ߷˶ݣ
+    static bool IsAlive(SOCKET s);
+
+    struct IdleConnection
+    {
+        SOCKET  s;
+        time_t  tIdle;      //Żӳصʱ
+    };
+    struct HostConnections
+    {
+        HostConnections() : nActive(0) {}
+
+        std::list<IdleConnection>   listIdle;
+        unsigned                    nActive;    //ʹе
+    };
+    std::map<std::string, HostConnections>  m_mapHosts;
+    OpenThreads::Mutex                      m_mtxHosts;
+    OpenThreads::Condition                  m_condHosts;    //ʹеӷŻػر
+#ifdef  __WINDOWS__
+    bool                                    SockInit_;
+#endif  //__WINDOWS__
+};
+
+//SimpleHttpClientõӳ
+extern HttpConnectionPool g_ConnectionPool;
+
+#endif    //__HTTP_CONNECTION_POOL_H__
@@ -0,0 +1,106 @@
+#ifndef TEST_RUNNER_H_375BBD2F_104B_4E8E_B919_1E06A06B75C1_INCLUDE
+#define TEST_RUNNER_H_375BBD2F_104B_4E8E_B919_1E06A06B75C1_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+// The runner of the test programs. A test is a function which returns whether it has passed,
+// a test program lists its tests in a table of TestCase and returns what runTests returns.
+
+// a failed check reports itself and fails the test it is in
+#define TEST_CHECK(cond)                                                            \
+    if(!(cond))                                                                     \
+    {                                                                               \
+        printf("    check failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__);       \
+        return false;                                                               \
+    }
+
+// a test which cannot run on this platform says why, it is counted as skipped rather than passed
+#define TEST_SKIP(reason)                                                           \
+    {                                                                               \
+        printf("    skipped: %s\n", reason);                                        \
+        cmm::isTestSkipped() = true;                                                \
+        return true;                                                                \
+    }
+
+namespace cmm
+{
+    inline void sleepMilliseconds(unsigned nMilliseconds)
+    {
+#if defined (WIN32) || defined (WIN64)
+        Sleep(nMilliseconds);
+#else
+        usleep(nMilliseconds * 1000u);
+#endif
+    }
+
+
+    // set by TEST_SKIP, runTests clears it before every test
+    inline bool &isTestSkipped(void)
+    {
+        static bool s_bSkipped = false;
+        return s_bSkipped;
+    }
+
+
+    inline double getSeconds(void)
+    {
+#if defined (WIN32) || defined (WIN64)
+        return GetTickCount() / 1000.0;
+#else
+        timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+    }
+
+
+    // TestFunc is bool (*)(void), or bool (*)(const std::string &) for the tests which need a work directory
+    template<typename TestFunc>
+    struct TestCase
+    {
+        const char *m_pName;
+        TestFunc    m_pTest;
+    };
+
+    inline bool runTest(bool (*pTest)(void), const std::string &)                        {   return pTest();         }
+    inline bool runTest(bool (*pTest)(const std::string &), const std::string &strDir)  {   return pTest(strDir);   }
+
+
+    // runs the tests in the order of the table, the number of the tests which have failed is returned
+    template<typename TestFunc, unsigned nCount>
+    int runTests(const TestCase<TestFunc> (&testCases)[nCount], const std::string &strDir = std::string())
+    {
+        int nFailed = 0;
+        unsigned nSkipped = 0u;
+        for(unsigned i = 0u; i < nCount; i++)
+        {
+            printf("%s\n", testCases[i].m_pName);
+            const double dblStart = getSeconds();
+            isTestSkipped() = false;
+            const bool bPassed = runTest(testCases[i].m_pTest, strDir);
+            const bool bSkipped = bPassed && isTestSkipped();
+            printf("    %s, %.1fs\n", bSkipped ? "skipped" : (bPassed ? "passed" : "FAILED"), getSeconds() - dblStart);
+            if(!bPassed)    ++nFailed;
+            if(bSkipped)    ++nSkipped;
+        }
+
+        if(nSkipped > 0u)
+        {
+            printf("%u tests, %d failed, %u skipped\n", nCount, nFailed, nSkipped);
+        }
+        else
+        {
+            printf("%u tests, %d failed\n", nCount, nFailed);
+        }
+        return nFailed;
+    }
+}
+
+#endif
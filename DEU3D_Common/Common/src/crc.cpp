@@ -1,5 +1,16 @@
 #include <crc.h>
 #include <stdio.h>
+#include <string.h>
+
+#if defined (_M_X64) || defined (_M_IX86) || defined (__x86_64__) || defined (__i386__)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#if defined (WIN32) || defined (WIN64)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 
 namespace cmm
 {
@@ -96,4 +107,231 @@ namespace cmm
         return crc32;
     }
 
+
+
+    // the operators over GF(2) which append zeros to a crc, so the crcs of neighbouring pieces can be joined
+    static unsigned Gf2MatrixTimes(const unsigned *Mat, unsigned Vec)
+    {
+        unsigned Sum = 0;
+        while(Vec)
+        {
+            if(Vec & 1)
+                Sum ^= *Mat;
+            Vec >>= 1;
+            Mat++;
+        }
+        return Sum;
+    }
+
+
+    static void Gf2MatrixSquare(unsigned *Square, const unsigned *Mat)
+    {
+        for(unsigned n = 0; n < 32; n++)
+        {
+            Square[n] = Gf2MatrixTimes(Mat, Mat[n]);
+        }
+    }
+
+
+    // nLength is a power of two
+    static void BuildZerosTable(unsigned Zeros[4][256], unsigned nLength)
+    {
+        unsigned Even[32], Odd[32];
+
+        // one zero bit, then two and four ones
+        Odd[0] = 0x82f63b78L;
+        unsigned Row = 1;
+        for(unsigned n = 1; n < 32; n++)
+        {
+            Odd[n] = Row;
+            Row <<= 1;
+        }
+        Gf2MatrixSquare(Even, Odd);
+        Gf2MatrixSquare(Odd, Even);
+
+        // the next square is one zero byte, every square after it doubles the bytes
+        const unsigned *Op = Even;
+        do
+        {
+            Gf2MatrixSquare(Even, Odd);
+            Op = Even;
+            nLength >>= 1;
+            if(nLength == 0)
+                break;
+            Gf2MatrixSquare(Odd, Even);
+            Op = Odd;
+            nLength >>= 1;
+        }while(nLength);
+
+        for(unsigned n = 0; n < 256; n++)
+        {
+            Zeros[0][n] = Gf2MatrixTimes(Op, n);
+            Zeros[1][n] = Gf2MatrixTimes(Op, n << 8);
+            Zeros[2][n] = Gf2MatrixTimes(Op, n << 16);
+            Zeros[3][n] = Gf2MatrixTimes(Op, n << 24);
+        }
+    }
+
+
+    // the hardware runs three crcs side by side over three pieces of these lengths
+    const static unsigned Crc32CLong  = 8192;
+    const static unsigned Crc32CShort = 256;
+
+    class Crc32CTable
+    {
+    public:
+        Crc32CTable(void)
+        {
+            //Poly = 0x82f63b78 Castagnoli Poly, the tables after the first one take 8 bytes at a time
+            for(unsigned i = 0; i < 256; i++)
+            {
+                unsigned Val = i;
+                for(unsigned k = 0; k < 8; k++)
+                {
+                    if(Val & 1)
+                        Val = 0x82f63b78L ^ (Val >> 1);
+                    else
+                        Val = Val >> 1;
+                }
+                m_Table[0][i] = Val;
+            }
+            for(unsigned i = 0; i < 256; i++)
+            {
+                for(unsigned t = 1; t < 8; t++)
+                {
+                    m_Table[t][i] = (m_Table[t - 1][i] >> 8) ^ m_Table[0][m_Table[t - 1][i] & 0xff];
+                }
+            }
+
+            BuildZerosTable(m_Long, Crc32CLong);
+            BuildZerosTable(m_Short, Crc32CShort);
+
+            m_bHardware = false;
+#if defined (CRC32C_SSE42)
+#if defined (WIN32) || defined (WIN64)
+            int CpuInfo[4];
+            __cpuid(CpuInfo, 1);
+            m_bHardware = (CpuInfo[2] & (1 << 20)) != 0;
+#else
+            unsigned a, b, c, d;
+            m_bHardware = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2) != 0;
+#endif
+#endif
+        }
+
+        unsigned    m_Table[8][256];
+        unsigned    m_Long[4][256];
+        unsigned    m_Short[4][256];
+        bool        m_bHardware;
+    };
+
+    // filled while the module is loaded, before any thread can ask for it
+    const static Crc32CTable Crc32CTables;
+
+
+    static unsigned ShiftCrc32C(const unsigned Zeros[4][256], unsigned crc)
+    {
+        return Zeros[0][crc & 0xff] ^ Zeros[1][(crc >> 8) & 0xff] ^ Zeros[2][(crc >> 16) & 0xff] ^ Zeros[3][crc >> 24];
+    }
+
+
+    static unsigned GenerateCrc32CSoftware(unsigned crc, const unsigned char *pByte, unsigned nLength)
+    {
+        const unsigned (*Table)[256] = Crc32CTables.m_Table;
+        while(nLength >= 8)
+        {
+            unsigned Low, High;
+            memcpy(&Low, pByte, 4);
+            memcpy(&High, pByte + 4, 4);
+            crc ^= Low;
+            crc = Table[7][crc & 0xff] ^ Table[6][(crc >> 8) & 0xff] ^ Table[5][(crc >> 16) & 0xff] ^ Table[4][crc >> 24]
+                ^ Table[3][High & 0xff] ^ Table[2][(High >> 8) & 0xff] ^ Table[1][(High >> 16) & 0xff] ^ Table[0][High >> 24];
+            pByte   += 8;
+            nLength -= 8;
+        }
+        for(unsigned i = 0; i < nLength; i++)
+        {
+            crc = Table[0][(crc ^ pByte[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+
+#if defined (CRC32C_SSE42)
+#if defined (__GNUC__)
+    __attribute__((target("sse4.2")))
+#endif
+    static unsigned GenerateCrc32CHardware(unsigned crc, const unsigned char *pByte, unsigned nLength)
+    {
+#if defined (_M_X64) || defined (__x86_64__)
+        unsigned long long crc64 = crc;
+
+        // one crc instruction waits for the one before, three independent ones keep the unit busy
+        const unsigned Pieces[2] = {Crc32CLong, Crc32CShort};
+        for(unsigned p = 0; p < 2; p++)
+        {
+            const unsigned nPiece = Pieces[p];
+            const unsigned (*Zeros)[256] = (p == 0) ? Crc32CTables.m_Long : Crc32CTables.m_Short;
+            while(nLength >= nPiece * 3)
+            {
+                unsigned long long crc1 = 0, crc2 = 0;
+                const unsigned char *pEnd = pByte + nPiece;
+                do
+                {
+                    unsigned long long Val0, Val1, Val2;
+                    memcpy(&Val0, pByte, 8);
+                    memcpy(&Val1, pByte + nPiece, 8);
+                    memcpy(&Val2, pByte + nPiece * 2, 8);
+                    crc64 = _mm_crc32_u64(crc64, Val0);
+                    crc1  = _mm_crc32_u64(crc1, Val1);
+                    crc2  = _mm_crc32_u64(crc2, Val2);
+                    pByte += 8;
+                }while(pByte < pEnd);
+                crc64 = ShiftCrc32C(Zeros, (unsigned)crc64) ^ (unsigned)crc1;
+                crc64 = ShiftCrc32C(Zeros, (unsigned)crc64) ^ (unsigned)crc2;
+                pByte   += nPiece * 2;
+                nLength -= nPiece * 3;
+            }
+        }
+
+        while(nLength >= 8)
+        {
+            unsigned long long Val;
+            memcpy(&Val, pByte, 8);
+            crc64 = _mm_crc32_u64(crc64, Val);
+            pByte   += 8;
+            nLength -= 8;
+        }
+        crc = (unsigned)crc64;
+#endif
+        while(nLength >= 4)
+        {
+            unsigned Val;
+            memcpy(&Val, pByte, 4);
+            crc = _mm_crc32_u32(crc, Val);
+            pByte   += 4;
+            nLength -= 4;
+        }
+        for(unsigned i = 0; i < nLength; i++)
+        {
+            crc = _mm_crc32_u8(crc, pByte[i]);
+        }
+        return crc;
+    }
+#endif
+
+
+    unsigned createHashCRC32C(const void *pBuffer, unsigned nLength, unsigned nPartialCrc)
+    {
+        const unsigned char *pByte = (const unsigned char *)pBuffer;
+        unsigned crc = nPartialCrc ^ 0xffffffffL;
+#if defined (CRC32C_SSE42)
+        if(Crc32CTables.m_bHardware)
+        {
+            return GenerateCrc32CHardware(crc, pByte, nLength) ^ 0xffffffffL;
+        }
+#endif
+        return GenerateCrc32CSoftware(crc, pByte, nLength) ^ 0xffffffffL;
+    }
+
 }
@@ -0,0 +1,49 @@
+#ifndef BLOCK_BUFFER_H_5E19A0C4_7B3D_4F82_A6E1_2C94D8B05F7A_INCLUDE
+#define BLOCK_BUFFER_H_5E19A0C4_7B3D_4F82_A6E1_2C94D8B05F7A_INCLUDE
+
+#include "IDEUDB.h"
+
+namespace deudb
+{
+    class BlockBuffer : public IBlockBuffer
+    {
+    public:
+        // takes over pMemory, it must come from malloc()
+        explicit BlockBuffer(void *pMemory, unsigned nLength);
+
+    protected:
+        virtual ~BlockBuffer(void);
+
+    public:
+        virtual const void *getData(void) const;
+        virtual unsigned    getLength(void) const;
+
+        static  BlockBuffer *copyFrom(const void *pData, unsigned nLength);
+
+    protected:
+        void       *m_pMemory;
+        unsigned    m_nLength;
+    };
+
+
+    // a part of another buffer, which lives as long as the slice
+    class BlockSlice : public IBlockBuffer
+    {
+    public:
+        explicit BlockSlice(IBlockBuffer *pParent, unsigned nOffset, unsigned nLength);
+
+    protected:
+        virtual ~BlockSlice(void);
+
+    public:
+        virtual const void *getData(void) const;
+        virtual unsigned    getLength(void) const;
+
+    protected:
+        OpenSP::sp<IBlockBuffer>    m_pParent;
+        const void *m_pData;
+        unsigned    m_nLength;
+    };
+}
+
+#endif
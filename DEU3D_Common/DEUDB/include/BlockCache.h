@@ -0,0 +1,103 @@
+#ifndef BLOCK_CACHE_H_8C2F5D19_E3A7_4B06_9D41_6F0B7A2E58C3_INCLUDE
+#define BLOCK_CACHE_H_8C2F5D19_E3A7_4B06_9D41_6F0B7A2E58C3_INCLUDE
+
+#include <vector>
+#include <OpenSP/Ref.h>
+#include <OpenSP/sp.h>
+#include <OpenThreads/Mutex>
+#include "IDEUDB.h"
+#include "DataStruct.h"
+
+namespace deudb
+{
+    // The memory cache of the latest version of the blocks. The IDs are spread
+    // over independent shards by their hash, so the readers of different tiles
+    // do not share a lock. Every shard is a hash table with a 2Q replacement:
+    // a block read once waits in a FIFO, and only a block read again after it
+    // has left the FIFO gets into the LRU, so a scan cannot flush the hot set.
+    //
+    // FileCache keeps the entries in step with the index: a writer replaces or
+    // erases the entry of an ID while it holds the index lock, and a reader only
+    // inserts what it has checked against the index under the same lock.
+    class BlockCache : public OpenSP::Ref
+    {
+    public:
+        explicit BlockCache(unsigned nShardCount = 16u);
+        virtual ~BlockCache(void);
+
+    public:
+        void        setCapacity(UINT_64 nCapacity);
+
+        // nVersion 0 accepts whatever version is cached, the buffer is shared, not copied
+        bool        read(const ID &id, unsigned nVersion, OpenSP::sp<IBlockBuffer> &pBuffer);
+
+        // a NULL buffer is a zero-length block
+        void        insert(const ID &id, unsigned nVersion, IBlockBuffer *pBuffer);
+        void        erase(const ID &id);
+        void        clear(void);
+
+        void        getStatistics(CacheStatistics &stat) const;
+
+    protected:
+        enum QueueType
+        {
+            QT_IN,          // read once, FIFO
+            QT_HOT,         // read again, LRU
+            QT_GHOST        // left QT_IN lately, only the ID is kept
+        };
+
+        struct Entry
+        {
+            ID          m_id;
+            unsigned    m_nVersion;
+            unsigned    m_nLength;
+            OpenSP::sp<IBlockBuffer>    m_pBuffer;
+            QueueType   m_eQueue;
+            Entry      *m_pPrev;
+            Entry      *m_pNext;
+            Entry      *m_pHashNext;
+        };
+
+        // a circular list with a sentinel, the newest entry is behind the sentinel
+        struct Queue
+        {
+            Entry       m_sentinel;
+            UINT_64     m_nBytes;
+            unsigned    m_nCount;
+        };
+
+        struct Shard
+        {
+            OpenThreads::Mutex      m_mtxShard;
+            std::vector<Entry *>    m_vecBuckets;
+            unsigned                m_nEntryCount;
+            Queue                   m_queues[3];
+            UINT_64                 m_nCapacity;
+
+            UINT_64                 m_nHits;
+            UINT_64                 m_nMisses;
+            UINT_64                 m_nEvictions;
+            UINT_64                 m_nLockAcquires;
+            UINT_64                 m_nLockWaits;
+        };
+
+        static UINT_64  hashID(const ID &id);
+        Shard          &getShard(UINT_64 nHash) const;
+        void            lockShard(Shard &shard) const;
+
+        static Entry   *findEntry(Shard &shard, const ID &id, UINT_64 nHash);
+        static void     addEntry(Shard &shard, Entry *pEntry, UINT_64 nHash);
+        static void     removeEntry(Shard &shard, Entry *pEntry, UINT_64 nHash);
+        static void     pushQueue(Shard &shard, Entry *pEntry, QueueType eQueue);
+        static void     popQueue(Shard &shard, Entry *pEntry);
+        static void     freeEntry(Entry *pEntry);
+        static void     evict(Shard &shard);
+        static void     clearShard(Shard &shard);
+
+    protected:
+        std::vector<Shard *>    m_vecShards;
+        unsigned                m_nShardBits;
+    };
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef BLOCK_CODEC_H_93D4E6A2_1F58_4C7B_B20E_7A6C3F19D845_INCLUDE
+#define BLOCK_CODEC_H_93D4E6A2_1F58_4C7B_B20E_7A6C3F19D845_INCLUDE
+
+#include <string>
+#include <vector>
+#include <OpenSP/Ref.h>
+#include <OpenSP/sp.h>
+#include <OpenThreads/Mutex>
+#include "IDEUDB.h"
+
+namespace deudb
+{
+    // Turns the blocks into what is stored in the data files and back. Every block
+    // is framed by a small header which carries the codec tag, the raw length and the
+    // CRC32C of the payload. The verbatim blocks of the old databases have no frame,
+    // they read as they are and cannot be verified.
+    //
+    // In the dictionary mode the first small blocks are collected as samples, the
+    // dictionary built from them is kept in its own file next to the index and never
+    // changes afterwards, because the blocks compressed with it need it to be read.
+    class BlockCodec : public OpenSP::Ref
+    {
+    public:
+        explicit BlockCodec(void);
+        virtual ~BlockCodec(void);
+
+    public:
+        bool            init(const std::string &strDictFile, BlockCompression eCompression);
+        void            setCompression(BlockCompression eCompression);
+
+        // both return the buffer itself when there is nothing to do, decode returns NULL for a broken block
+        IBlockBuffer   *encode(IBlockBuffer *pRaw);
+        IBlockBuffer   *decode(IBlockBuffer *pStored) const;
+
+        enum VerifyResult
+        {
+            VR_VALID,
+            VR_CORRUPT,
+            VR_UNCHECKED        // it was written without a checksum
+        };
+        VerifyResult    verify(const IBlockBuffer *pStored) const;
+
+    protected:
+        IBlockBuffer   *deflateBlock(const IBlockBuffer *pRaw, const IBlockBuffer *pDictionary) const;
+        void            addSample(const IBlockBuffer *pRaw);
+        OpenSP::sp<IBlockBuffer>    getDictionary(void) const;
+
+    protected:
+        std::string                 m_strDictFile;
+        volatile BlockCompression   m_eCompression;
+
+        OpenThreads::Mutex          m_mtxDictionary;
+        OpenSP::sp<IBlockBuffer>    m_pDictionary;
+        std::vector<unsigned char>  m_vecSamples;
+        bool                        m_bSampling;
+    };
+}
+
+#endif
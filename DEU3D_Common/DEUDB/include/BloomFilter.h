@@ -0,0 +1,55 @@
+#ifndef BLOOM_FILTER_H_5D1E8B47_C3A2_4F96_8E07_B94A61D2F3C8_INCLUDE
+#define BLOOM_FILTER_H_5D1E8B47_C3A2_4F96_8E07_B94A61D2F3C8_INCLUDE
+
+#include <string>
+#include <vector>
+#include <OpenSP/Ref.h>
+#include "DataStruct.h"
+
+namespace deudb
+{
+    // A blocked Bloom filter over the IDs of a database, it answers most of the
+    // lookups of absent IDs without the index lock. Every ID sets 8 bits in one
+    // block of 8 words, one bit in each word, so a lookup touches a single cache
+    // line. About 10 bits are kept for every ID, less than 1% of the absent IDs
+    // get through.
+    //
+    // There is one writer at a time, FileCache inserts under its index lock, the
+    // readers do not lock at all. The bits are set with an atomic or, so a reader
+    // never races a half written word. A removed ID keeps its bits until the filter is
+    // built again. It is saved next to the .idx when the database is closed and
+    // the file is stamped with the ID count and the .idx length, a stale file is
+    // not loaded.
+    class BloomFilter : public OpenSP::Ref
+    {
+    public:
+        explicit BloomFilter(UINT_64 nCapacity);
+        virtual ~BloomFilter(void);
+
+    public:
+        // the capacity for a database of nIDCount IDs, with room to grow
+        static UINT_64  getCapacityFor(UINT_64 nIDCount);
+
+        bool            mayContain(const ID &id) const;
+        void            insert(const ID &id);
+
+        // it has got more IDs than it was sized for, the false positives grow
+        bool            isFull(void) const          {   return (m_nInserted > m_nCapacity);    }
+        UINT_64         getCapacity(void) const     {   return m_nCapacity;     }
+
+        bool            save(const std::string &strFile, UINT_64 nIDCount, UINT_64 nIdxFileLength) const;
+        static BloomFilter *load(const std::string &strFile, UINT_64 nIDCount, UINT_64 nIdxFileLength);
+
+    protected:
+        static UINT_64  hashID(const ID &id);
+        const unsigned *getBlock(UINT_64 nHash) const;
+
+    protected:
+        std::vector<unsigned>   m_vecWords;
+        unsigned                m_nBlockCount;
+        UINT_64                 m_nCapacity;
+        UINT_64                 m_nInserted;
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef BULK_LOADER_H_43F598AC_31F9_4927_95C4_565B734542BE_INCLUDE
+#define BULK_LOADER_H_43F598AC_31F9_4927_95C4_565B734542BE_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <OpenSP/Ref.h>
+#include <OpenSP/sp.h>
+#include <OpenThreads/Mutex>
+#include "DataStruct.h"
+#include "DataBase.h"
+
+namespace deudb
+{
+    // The blocks of a bulk load go straight into data files of their own. A thread
+    // takes a segment for every block it writes and gives it back afterwards, so no
+    // two threads write into one segment and there are about as many segments as
+    // threads. A segment is appended to through a big stdio buffer without any seek
+    // or flush, its file is preallocated ahead of the writes and cut to its length
+    // when the load finishes. One failed write fails the whole load.
+    class BulkLoader : public OpenSP::Ref
+    {
+    public:
+        explicit BulkLoader(void);
+        virtual ~BulkLoader(void);
+
+    public:
+        void        init(DataBase *pDataBase);
+
+        // pData is already the way the codec stores it
+        bool        addBlock(const ID &id, const void *pData, unsigned nLength);
+
+        // wait for the writing threads, sync the files and hand the blocks over in ID order,
+        // of the blocks of one ID only the first is kept
+        bool        finish(std::vector<BlockInIdx> &vecBlocks);
+
+        // the files written so far, they are not in the database until DataBase::attachFile()
+        const std::vector<unsigned> &getDBFiles(void) const    {   return m_vecDBFiles;    }
+
+        // remove the files, nothing of the load is kept
+        void        cancel(void);
+
+    protected:
+        struct Segment
+        {
+            FILE                       *m_pFile;
+            unsigned                    m_nDBFile;
+            UINT_64                     m_nLength;
+            UINT_64                     m_nAllocated;
+            UINT_64                     m_nAllocStep;
+            std::vector<char>           m_vecBuffer;        // the stdio buffer of m_pFile
+            std::vector<BlockInIdx>     m_vecBlocks;
+        };
+
+        Segment    *takeSegment(void);
+        void        returnSegment(Segment *pSegment, bool bWritten);
+
+        bool        openSegmentFile(Segment *pSegment);
+        bool        closeSegmentFile(Segment *pSegment);
+        void        preallocate(Segment *pSegment, unsigned nLength);
+
+    protected:
+        OpenSP::sp<DataBase>        m_pDataBase;
+
+        std::vector<Segment *>      m_vecSegments;
+        std::vector<Segment *>      m_vecIdleSegments;
+        unsigned                    m_nBusySegments;
+        std::vector<unsigned>       m_vecDBFiles;
+        bool                        m_bFinishing;
+        bool                        m_bFailed;
+        OpenThreads::Mutex          m_mtxSegments;
+    };
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "DatabaseFile.h"
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <OpenThreads/Mutex>
@@ -20,18 +21,41 @@ namespace deudb
         virtual ~DataBase(void);
 
     public:
-        void    init(const std::string &strDatabase, const FILE_GAP_MAP &mapWhiteGap);
+        // mapGaps holds the living blocks of every file, or their free gaps if bFreeGaps is set
+        void    init(const std::string &strDatabase, const FILE_GAP_MAP &mapGaps, bool bMappedRead = false, bool bFreeGaps = false);
         void    closeDB(void);
 
         void   *readBlock(const DBBlockInfo &infoDBBlock);
-        bool    writeBlock(const DBBlockInfo &infoDBBlock, const void *pDataBlock);
+        bool    writeBlock(const DBBlockInfo &infoDBBlock, const void *pDataBlock, bool bFlush = true);
+        bool    flushFiles(bool bSync);
         bool    allocBlock(unsigned nLength, unsigned &nDBFile, UINT_64 &nPosition);
         void    releaseBlock(const DBBlockInfo &infoDBBlock);
+        void    getFreeGaps(FILE_GAP_MAP &mapFreeGaps);
+        UINT_64 getFileSize(void);
+
+        // the files which exist now get no new blocks until unsealFiles(), so the compaction can empty them
+        void    sealFiles(std::set<unsigned> &setSealed);
+        void    unsealFiles(void);
+        bool    removeFile(unsigned nDBFile);       // only a file without any living block
+        UINT_64 trimFiles(void);
+
+        // a file number for the bulk load, it is written outside and joins the others by attachFile()
+        bool    reserveFile(unsigned &nDBFile, std::string &strFilePath);
+        bool    attachFile(unsigned nDBFile, const std::vector<FileGap> &vecBlocks);
+        void    unreserveFile(unsigned nDBFile);        // and remove the file
+
+        static std::string  getDBFilePath(const std::string &strDatabase, unsigned nDBFile);
          
+    protected:
+        // the caller locks m_mtxDataBase
+        unsigned    findFreeFileIndex(void) const;
+
     protected:
         const static std::string    ms_strDBFileExt;
 
         std::map<unsigned, OpenSP::sp<DatabaseFile> >   m_mapDatabaseFiles;
+        std::set<unsigned>      m_setSealedFiles;
+        std::set<unsigned>      m_setReservedFiles;
         OpenThreads::Mutex      m_mtxDataBase;
         std::string             m_strDataBase;
 
@@ -1,7 +1,9 @@
 #ifndef DATA_STRUCT_H_B6615B1E_2E8A_4D16_B78A_4B9DE093F018_INCLUDE
 #define DATA_STRUCT_H_B6615B1E_2E8A_4D16_B78A_4B9DE093F018_INCLUDE
 
+#include <string.h>
 #include "IDProvider/ID.h"
+#include "IDEUDB.h"
 
 namespace deudb
 {
@@ -39,6 +41,16 @@ struct BlockInIdx_v2
 
 typedef struct BlockInIdx_v2    BlockInIdx;
 
+const unsigned char g_szIndexFileFlag[8] = {'D', 'E', 'U', 'D', 'B', '\0', '\0', '\0'};
+
+struct IdxFileHeader
+{
+    unsigned char   m_szFlag[8];        // must be "DEUDB\0\0\0"
+    unsigned char   m_szReserved[8];    // reserved
+    unsigned int    m_nVersionNumber;   // begin from 1
+    unsigned char   m_reserved[20];     // reserved
+};
+
 struct BlockInIdx_v1
 {
     unsigned m_nPosInIndex;
@@ -56,11 +68,19 @@ struct Routine
         RT_REMOVE
     };
 
+    Routine(void)
+    {
+        m_eRoutineType = RT_ADD;
+        m_nPosInIndex  = ~0u;
+        memset(&m_infoDBBlock, 0, sizeof(DBBlockInfo));
+        m_nVersion     = 0u;
+    }
+
     RoutineType     m_eRoutineType;
     unsigned        m_nPosInIndex;
     DBBlockInfo     m_infoDBBlock;
     unsigned        m_nVersion;
-    void           *m_pDataBlock;
+    OpenSP::sp<IBlockBuffer>    m_pDataBlock;     // shared with the cache, not a copy
 };
 
 class IDVersion
@@ -114,6 +134,9 @@ public:
         return !operator<(param);
     }
 
+    inline const ID &getID(void) const          {   return m_id;        }
+    inline unsigned  getVersion(void) const     {   return m_nVersion;  }
+
 private:
     ID m_id;
     unsigned m_nVersion;
@@ -12,6 +12,7 @@
 #include <IDProvider/ID.h>
 
 #include "DataStruct.h"
+#include "FreeSpaceMap.h"
 
 #pragma warning( disable : 4996 )
 
@@ -37,17 +38,29 @@ namespace deudb
         virtual ~DatabaseFile(void);
 
     public:
-        bool            init(const std::string &strFilePath, const std::vector<FileGap> &vecWhiteGap = std::vector<FileGap>());
+        bool            init(const std::string &strFilePath, const std::vector<FileGap> &vecGaps = std::vector<FileGap>(), bool bMappedRead = false, bool bFreeGaps = false);
         void           *readBlock(const FileGap &gap);
-        bool            writeBlock(const FileGap &gap, const void *pDataBlock);
+        bool            writeBlock(const FileGap &gap, const void *pDataBlock, bool bFlush = true);
+        bool            flushFile(bool bSync);
         UINT_64         allocBlock(unsigned nLength);
         void            releaseBlock(const FileGap &gap);
+        void            getFreeGaps(std::vector<FileGap> &vecFreeGaps);
+        UINT_64         getFileSize(void);
+        UINT_64         getUsedSize(void);
+        UINT_64         trimFile(void);
         void            closeFile(void);
         void            applyAction(const ActionItem &actionItem);
+
+        static UINT_64  getFileSizeLimit(void)      {   return m_nFileSizeLimited;  }
     private:
         UINT_64         getFileLength();
         bool            chFileSize(UINT_64 nSize);
 
+        // positional read handle, it is shared by all the reading threads without any lock
+        bool            openReadHandle(const std::string &strFilePath, bool bMappedRead);
+        void            closeReadHandle(void);
+        bool            readAt(UINT_64 nPosition, void *pBuffer, unsigned nLength) const;
+
     protected:
         const static UINT_64    m_nFileSizeLimited;
 
@@ -55,10 +68,19 @@ namespace deudb
         OpenThreads::Mutex      m_mtxFile;
         UINT_64                 m_nCurrentFileSize;
 
-        std::list<FileGap>      m_listBlackGap;
+        FreeSpaceMap            m_freeSpace;
         OpenThreads::Mutex      m_mtxBlackGap;
 
         UINT_64                 m_nAllocFileSize;
+
+#if defined (WIN32) || defined (WIN64)
+        void                   *m_hReadFile;
+        void                   *m_hMapping;
+#else
+        int                     m_nReadFile;
+#endif
+        const unsigned char    *m_pMappedView;
+        UINT_64                 m_nMappedSize;
     };
 
 }
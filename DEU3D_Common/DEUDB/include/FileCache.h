@@ -1,5 +1,7 @@
 #include <map>
+#include <set>
 #include <list>
+#include <deque>
 #include <stdio.h>
 #include <assert.h>
 #include <OpenThreads/Mutex>
@@ -10,6 +12,11 @@
 #include "DataStruct.h"
 #include "WorkingThreads.h"
 #include "RoutineManager.h"
+#include "SortedIndex.h"
+#include "BlockCache.h"
+#include "BlockCodec.h"
+#include "BloomFilter.h"
+#include "BulkLoader.h"
 
 namespace deudb
 {
@@ -32,10 +39,32 @@ namespace deudb
         virtual unsigned              getBlockCount(void) const;
         virtual void                  getIndices(std::vector<ID> &vecIndices, unsigned nOffset = 0u, unsigned nCount = ~0u) const;
         virtual std::vector<unsigned> getVersion(const ID &id) const;
+        virtual void                  setMappedRead(bool bMappedRead);
+        virtual void                  setCompression(BlockCompression eCompression);
+        virtual void                  getCacheStatistics(CacheStatistics &stat) const;
+        virtual bool                  readBlock(const ID &id, OpenSP::sp<IBlockBuffer> &pBuffer, unsigned nVersion = 0u);
+        virtual bool                  addBlock(const ID &id, IBlockBuffer *pBuffer);
+        virtual bool                  updateBlock(const ID &id, IBlockBuffer *pBuffer);
+        virtual bool                  replaceBlock(const ID &id, IBlockBuffer *pBuffer);
+        virtual unsigned              readBlocks(const std::vector<ID> &vecIDs, std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers, std::vector<bool> &vecFound);
+        virtual bool                  writeBlocks(const std::vector<ID> &vecIDs, const std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers);
+        virtual bool                  startCompaction(UINT_64 nBytesPerSecond = 0u, bool bDropOldVersions = false);
+        virtual void                  stopCompaction(void);
+        virtual void                  getCompactionStatus(CompactionStatus &status) const;
+        virtual void                  setVerification(BlockVerification eVerification);
+        virtual bool                  startScrub(UINT_64 nBytesPerSecond = 0u);
+        virtual void                  stopScrub(void);
+        virtual void                  getScrubStatus(ScrubStatus &status, std::vector<ID> &vecCorruptIDs) const;
+        virtual unsigned              createSnapshot(void);
+        virtual void                  releaseSnapshot(unsigned nSnapshot);
+        virtual void                  setVersionRetention(unsigned nMaxVersions);
+        virtual IIndexIterator       *scanIndices(const IDScanRange &range);
+        virtual bool                  beginBulkLoad(void);
+        virtual bool                  bulkAddBlock(const ID &id, const void *pBuffer, unsigned nBufLen);
+        virtual bool                  bulkAddBlock(const ID &id, IBlockBuffer *pBuffer);
+        virtual bool                  endBulkLoad(void);
 
     protected:
-        static      UINT_64 getRefTime(void);
-
         bool        createNewIndexFile(void) const;
         void        closeDataBase(void);
 
@@ -44,10 +73,32 @@ namespace deudb
         bool        readIndexFile_v2(const unsigned char *pIndexBuffer, unsigned nBufLen);
         bool        updateIndexFile(const std::vector<BlockInIdx_v1>& blockIdxVec);
 
+        bool        openSortedIndex(bool bTrustExisting);
+        // pLoaded are the records of a bulk load, in ID order and written to the .idx from nLoadedPos on
+        bool        writeSortedIndex(const std::vector<BlockInIdx> *pLoaded = NULL, unsigned nLoadedPos = 0u);
+        // hand the delta and a bulk load over to a new sorted index, the caller locks m_mtxDataBlocks
+        bool        rebaseLoadedIndex(const std::vector<BlockInIdx> &vecLoaded, unsigned nLoadedPos);
+        // The same in the middle of a session beside the writers: the new files are written from a copy
+        // of the delta, m_mtxDataBlocks is only taken to copy it and to swap the files, and the IDs changed
+        // meanwhile stay in the delta over the new sorted index. The caller does not lock m_mtxDataBlocks.
+        // A dense rebase rewrites the .idx as well, without a sorted index only a dense one builds it.
+        bool        rebaseIndex(bool bDense);
+
         void        resetInternalArgs(void);
 
-    public:
-        bool        restrictMemory(void);
+        // load the filter saved by the last closeDB, or build it from the index
+        void        openBloomFilter(void);
+        void        closeBloomFilter(void);
+        BloomFilter *buildBloomFilter(UINT_64 nCapacity) const;
+        // false when id is surely not in the database, it does not lock
+        bool        mayExist(const ID &id) const;
+        // the caller locks m_mtxDataBlocks
+        void        addToBloomFilter(const ID &id);
+        // the next batch of the IDs of the delta or of the base behind pAfter, the caller locks m_mtxDataBlocks
+        void        collectBloomIDs(bool bBase, const ID *pAfter, std::vector<ID> &vecIDs) const;
+        // a full filter is replaced by one of twice its capacity, which is built without m_mtxDataBlocks,
+        // the writers call it once they have let go of the lock
+        void        growBloomFilter(void);
 
     protected:
         std::string     m_strDB;
@@ -55,47 +106,196 @@ namespace deudb
         typedef struct tagDataBlock
         {
             DBBlockInfo m_infoDBBlock;
-            UINT_64     m_nLastRefTime;
             unsigned    m_nVersion;
             unsigned    m_nPosInIndex;
-            void       *m_pMemory;
+            bool        m_bInBase;          // it is still the same as its record in the sorted index
         }DataBlock;
 
-        class RestrictMemThread : public WorkingThread
+        // the records of pBase still valid, the delta and a bulk load, all in (ID, version) order,
+        // go into writer and, if pDenseFile is given, one after another into a new .idx
+        static bool mergeRecords(const SortedIndex *pBase, const std::map<IDVersion, DataBlock> &mapDataBlocks, const std::map<ID, VersionList> &mapVersion,
+                                 const std::set<ID> &setDetached, const std::vector<BlockInIdx> *pLoaded, unsigned nLoadedPos,
+                                 SortedIndex::Writer &writer, FILE *pDenseFile);
+
+        // what rebaseIndex takes under the lock, the base file stays as it is until the swap
+        struct IndexSnapshot
+        {
+            OpenSP::sp<SortedIndex>         m_pBase;
+            std::map<IDVersion, DataBlock>  m_mapDataBlocks;
+            std::map<ID, VersionList>       m_mapVersion;
+            std::set<ID>                    m_setDetached;
+            std::list<unsigned>             m_listGapsInIndex;
+            FILE_GAP_MAP                    m_mapFreeGaps;
+        };
+        // the records of id in the given maps, false when the base still holds them as they are
+        static bool getDeltaRecords(const std::map<IDVersion, DataBlock> &mapDataBlocks, const std::map<ID, VersionList> &mapVersion,
+                                    const std::set<ID> &setDetached, const ID &id, std::vector<DataBlock> &vecBlocks);
+        // the caller locks m_mtxDataBlocks for both of these
+        void        findChangedIDs(const IndexSnapshot &snapshot, std::set<ID> &setChanged) const;
+        // the dense records of the changed IDs are marked removed and their records in the delta appended,
+        // mapNewPos gets the slots of those, listStale the slots given up and nIndexEnd the new length
+        bool        patchDenseIndex(const std::string &strDenseFile, const std::set<ID> &setChanged, std::map<IDVersion, unsigned> &mapNewPos,
+                                    std::list<unsigned> &listStale, unsigned &nIndexEnd) const;
+
+        // the versions of id, its records are pulled out of the sorted index when it is touched first
+        std::map<ID, VersionList>::iterator findVersions(const ID &id);
+        bool        findBaseVersions(const ID &id, VersionList &vList) const;
+        void        detachBaseBlock(const ID &id);
+        void        trimMaterialized(void);
+
+        // the records of the next nMaxIDs IDs behind pAfter in (ID, version) order, the caller locks m_mtxDataBlocks
+        void        collectRecords(const ID *pAfter, unsigned nMaxIDs, std::vector<SortedIdxRecord> &vecRecords);
+
+        // the next batch of the IDs of range behind pAfter, idLastSeen is where it has stopped,
+        // false when the range has been walked through
+        bool        collectIndices(const IDScanRange &range, const ID *pAfter, std::vector<ID> &vecIDs, ID &idLastSeen);
+
+        class IndexIterator : public IIndexIterator
+        {
+        public:
+            IndexIterator(FileCache *pFileCache, const IDScanRange &range);
+            ~IndexIterator(void){}
+
+        public:
+            virtual bool next(ID &id);
+
+        protected:
+            OpenSP::sp<FileCache>   m_pFileCache;
+            IDScanRange             m_range;
+            std::vector<ID>         m_vecBatch;
+            size_t                  m_nNext;
+            ID                      m_idLastSeen;
+            bool                    m_bStarted;
+            bool                    m_bEnd;
+        };
+        friend class IndexIterator;
+
+        enum MoveResult
+        {
+            MR_SKIPPED,
+            MR_MOVED,
+            MR_DROPPED
+        };
+        void        compact(void);
+        bool        isVersionExpired(const VersionList &vList, unsigned nVersion) const;
+        MoveResult  moveBlock(const BlockInIdx &blockInIdx, const std::set<unsigned> &setSealed, UINT_64 &nMovedBytes);
+        void        dropVersion(std::map<ID, VersionList>::iterator itorVersion, std::map<IDVersion, DataBlock>::iterator itorBlock);
+
+        class CompactionThread : public WorkingThread
         {
         public:
-            explicit RestrictMemThread(FileCache *pFileCache)
-            {
-                m_pFileCache = pFileCache;
-            }
+            CompactionThread(FileCache *pFileCache) : m_pFileCache(pFileCache){}
+            ~CompactionThread(void){}
 
         protected:
             virtual void run(void);
+            FileCache          *m_pFileCache;
+        };
+        friend class CompactionThread;
+
+        // whether a block read from the data files may be used, a corrupt one is reported
+        bool        checkStoredBlock(const ID &id, bool bCorrupt);
+        void        reportCorruptBlock(const ID &id);
+        bool        isBlockInFiles(const BlockInIdx &blockInIdx);
+        // false when the block has been replaced, moved or removed meanwhile
+        bool        scrubBlock(const BlockInIdx &blockInIdx, BlockCodec::VerifyResult &eResult);
+        void        scrub(void);
+
+        class ScrubThread : public WorkingThread
+        {
+        public:
+            ScrubThread(FileCache *pFileCache) : m_pFileCache(pFileCache){}
+            ~ScrubThread(void){}
 
         protected:
-            FileCache *m_pFileCache;
+            virtual void run(void);
+            FileCache          *m_pFileCache;
+        };
+        friend class ScrubThread;
+
+        // a version given up while a snapshot can still see it, its data stays in the files
+        struct RetiredBlock
+        {
+            unsigned    m_nVersion;
+            unsigned    m_nNextVersion;     // the version which has replaced or removed it
+            DBBlockInfo m_infoDBBlock;
         };
 
+        // the caller locks m_mtxDataBlocks for all of these
+        unsigned    nextVersion(void);
+        bool        isSeenBySnapshot(unsigned nVersion, unsigned nNextVersion) const;
+        void        retireBlock(const ID &id, unsigned nVersion, unsigned nNextVersion, const DBBlockInfo &infoDBBlock);
+        bool        findRetiredBlock(const ID &id, unsigned nSnapshot, RetiredBlock &retired) const;
+        // it locks by itself, bFound tells whether the snapshot sees a retired version of id
+        bool        readRetiredBlock(const ID &id, unsigned nSnapshot, OpenSP::sp<IBlockBuffer> &pBuffer, bool &bFound);
+        void        releaseRetiredBlocks(bool bAll);
+        void        trimVersions(std::map<ID, VersionList>::iterator itorVersion);
+
         std::map<IDVersion, DataBlock>  m_mapDataBlocks;
         std::map<ID, VersionList>       m_mapVersion;
         OpenThreads::Mutex              m_mtxDataBlocks;
-        OpenThreads::Block              m_blockBuffer;
 
-        std::map<UINT_64, DataBlock *>  m_mapBlockBuffer;
-        UINT_64                         m_nBufferSizeLimited;
-        UINT_64                         m_nCurrentMemorySize;
+        // the block data lives only here, it has its own locks
+        OpenSP::sp<BlockCache>          m_pBlockCache;
+        OpenSP::sp<BlockCodec>          m_pBlockCodec;
 
         std::list<unsigned>             m_listGapsInIndex;
 
         OpenSP::sp<DataBase>            m_pDataBase;
 
-        WorkingThread                  *m_pRestrictMemThread;
-
         volatile bool                   m_bIsOpen;
+        bool                            m_bMappedRead;
+        BlockCompression                m_eCompression;
 
         OpenSP::sp<RoutineManager>      m_pRoutineManager;
 
         unsigned                        m_nCurPosInIndex;
+        unsigned                        m_nBlockCount;
+
+        // With a sorted index the maps above are only the delta: the blocks written
+        // since openDB and the blocks looked up lately. m_setDetached holds the IDs
+        // whose records in the sorted index are not valid any more.
+        OpenSP::sp<SortedIndex>         m_pSortedIndex;
+        std::set<ID>                    m_setDetached;
+        std::deque<ID>                  m_queueMaterialized;
+        bool                            m_bIndexDirty;
+
+        // the readers take the filter without any lock, so a filter which has been
+        // replaced by a bigger one stays alive in the vector until closeDB
+        OpenThreads::AtomicPtr          m_pBloomFilter;
+        std::vector<OpenSP::sp<BloomFilter> >   m_vecBloomFilters;
+        // while a bigger filter is built, the IDs added meanwhile are kept for it, both under m_mtxDataBlocks
+        bool                            m_bGrowingBloomFilter;
+        std::vector<ID>                 m_vecBloomPending;
+
+        // the compaction runs on its own thread, it takes m_mtxDataBlocks for every block it moves
+        CompactionThread               *m_pCompactionThread;
+        volatile bool                   m_bStopCompaction;
+        UINT_64                         m_nCompactionRate;
+        bool                            m_bDropOldVersions;
+        CompactionStatus                m_compactionStatus;
+        OpenThreads::Mutex              m_mtxCompaction;
+
+        // the reads of the data files since openDB, for getCacheStatistics
+        OpenThreads::Atomic             m_nFileReads;
+
+        volatile BlockVerification      m_eVerification;
+        ScrubThread                    *m_pScrubThread;
+        volatile bool                   m_bStopScrub;
+        UINT_64                         m_nScrubRate;
+        ScrubStatus                     m_scrubStatus;
+        std::set<ID>                    m_setCorruptIDs;
+        OpenThreads::Mutex              m_mtxScrub;
+
+        // every write takes the next version, they go on from the newest one in the index
+        unsigned                        m_nLastVersion;
+        std::multiset<unsigned>         m_setSnapshots;
+        std::map<ID, std::vector<RetiredBlock> >    m_mapRetired;
+        volatile unsigned               m_nRetainedVersions;
+
+        // the blocks of a bulk load stay out of the maps and the routine manager until endBulkLoad
+        OpenSP::sp<BulkLoader>          m_pBulkLoader;
+        OpenThreads::Mutex              m_mtxBulkLoad;
 
 
     };
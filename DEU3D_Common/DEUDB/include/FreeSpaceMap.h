@@ -0,0 +1,55 @@
+#ifndef FREE_SPACE_MAP_H_5D1C2A7E_93B4_4F0A_8E61_2C7B9F04D3A8_INCLUDE
+#define FREE_SPACE_MAP_H_5D1C2A7E_93B4_4F0A_8E61_2C7B9F04D3A8_INCLUDE
+
+#include <map>
+#include <set>
+#include <vector>
+#include "DataStruct.h"
+
+namespace deudb
+{
+    // The free gaps of one database file. Every gap is kept twice: once in an
+    // offset-ordered tree so that a released gap finds its neighbours in
+    // O(log n), and once in a segregated list by power-of-two size class so
+    // that allocation is a best fit in O(log n) instead of a linear scan.
+    class FreeSpaceMap
+    {
+    public:
+        explicit FreeSpaceMap(void);
+        ~FreeSpaceMap(void);
+
+    public:
+        void        clear(void);
+        bool        empty(void) const   {   return m_mapByOffset.empty();   }
+
+        bool        alloc(unsigned nLength, UINT_64 &nPosition);
+        void        release(UINT_64 nPosition, UINT_64 nLength);
+
+        // the length of the gap which ends exactly at nEnd, 0 if there is none
+        UINT_64     getGapEndsAt(UINT_64 nEnd) const;
+        // takes that gap out of the map, the file is going to be cut there
+        UINT_64     cutGapEndsAt(UINT_64 nEnd);
+
+        UINT_64     getFreeSize(void) const     {   return m_nFreeSize;                     }
+        unsigned    getGapCount(void) const     {   return (unsigned)m_mapByOffset.size();  }
+        UINT_64     getLargestGap(void) const;
+        void        getGaps(std::vector<FileGap> &vecGaps) const;
+
+    protected:
+        typedef std::map<UINT_64, UINT_64>              GapByOffset;
+        typedef std::set<std::pair<UINT_64, UINT_64> >  GapBySize;      // <length, position>
+        enum { SIZE_CLASS_COUNT = 64 };
+
+        static unsigned getSizeClass(UINT_64 nLength);
+        void        insertGap(UINT_64 nPosition, UINT_64 nLength);
+        void        eraseGap(GapByOffset::iterator itorGap);
+
+    protected:
+        GapByOffset     m_mapByOffset;
+        GapBySize       m_setBySize[SIZE_CLASS_COUNT];
+        UINT_64         m_nClassMask;
+        UINT_64         m_nFreeSize;
+    };
+}
+
+#endif
@@ -5,10 +5,92 @@
 #include <string>
 #include <vector>
 #include <OpenSP/Ref.h>
+#include <OpenSP/sp.h>
 #include <IDProvider/ID.h>
 
 namespace deudb
 {
+    struct CacheStatistics
+    {
+        UINT_64     m_nHits;
+        UINT_64     m_nMisses;
+        UINT_64     m_nEvictions;
+        UINT_64     m_nLockAcquires;
+        UINT_64     m_nLockWaits;       // the acquires which found the lock taken
+        UINT_64     m_nCachedBytes;
+        UINT_64     m_nCachedBlocks;
+        UINT_64     m_nFileReads;       // the reads of the data files, a run which readBlocks reads at once is one
+    };
+
+    struct CompactionStatus
+    {
+        bool        m_bRunning;
+        bool        m_bFinished;            // the last run went through, the lengths after are final
+        UINT_64     m_nBlocksMoved;
+        UINT_64     m_nBytesMoved;
+        UINT_64     m_nVersionsDropped;
+        UINT_64     m_nDataBytesBefore;     // the total length of the .db files
+        UINT_64     m_nDataBytesAfter;
+        UINT_64     m_nIndexBytesBefore;    // the length of the .idx file
+        UINT_64     m_nIndexBytesAfter;
+    };
+
+    struct ScrubStatus
+    {
+        bool        m_bRunning;
+        bool        m_bFinished;            // the last run went through every block
+        UINT_64     m_nBlocksChecked;
+        UINT_64     m_nBytesChecked;
+        UINT_64     m_nBlocksUnchecked;     // written before the blocks had checksums
+        UINT_64     m_nBlocksCorrupt;
+    };
+
+    // The IDs are ordered by m_nHighBit, m_nMidBit and m_nLowBit, a scan seeks m_idFirst and stops
+    // behind m_idLast. Of the IDs between only those whose bits under m_idMask equal the bits of
+    // m_idValue are returned. The fields of a TileID lie in the lower words, so they are selected by
+    // the mask, e.g. m_nDataSetCode, m_nType and m_nLevel for one level of a dataset.
+    struct IDScanRange
+    {
+        IDScanRange(void) : m_idFirst(0u, 0u, 0u), m_idMask(0u, 0u, 0u), m_idValue(0u, 0u, 0u){}
+
+        ID          m_idFirst;
+        ID          m_idLast;               // the last ID of all by default
+        ID          m_idMask;
+        ID          m_idValue;
+    };
+
+    enum BlockVerification
+    {
+        BV_NONE,            // the checksums are written but the reads do not check them
+        BV_WARN,            // a block which fails its checksum is reported and still read
+        BV_STRICT           // a block which fails its checksum is reported and cannot be read
+    };
+
+    enum BlockCompression
+    {
+        BC_NONE,            // the blocks are stored as they are
+        BC_DEFLATE,         // zlib, a block which does not shrink is stored as it is
+        BC_DEFLATE_DICT     // as BC_DEFLATE, the small blocks share a dictionary sampled from the database
+    };
+
+    // An immutable block which the cache, the write queue and the callers share
+    // rather than copy. The last one who holds it frees it.
+    class IBlockBuffer : public OpenSP::Ref
+    {
+    public:
+        virtual const void *getData(void) const = 0;
+        virtual unsigned    getLength(void) const = 0;
+    };
+
+    // The IDs of a scan in ID order. The index is read a batch at a time and not locked between the
+    // batches, so the blocks written or removed meanwhile may or may not be seen.
+    class IIndexIterator : public OpenSP::Ref
+    {
+    public:
+        // false when there is no more ID
+        virtual bool        next(ID &id) = 0;
+    };
+
     class IDEUDB : public OpenSP::Ref
     {
     public:
@@ -24,10 +106,73 @@ namespace deudb
         virtual unsigned    getBlockCount(void) const = 0;
         virtual void        getIndices(std::vector<ID> &vecIndices, unsigned nOffset = 0u, unsigned nCount = ~0u) const = 0;
         virtual std::vector<unsigned> getVersion(const ID &id) const = 0;
+
+        // the same as above without copying the data, a NULL buffer is a zero-length block
+        virtual bool        readBlock(const ID &id, OpenSP::sp<IBlockBuffer> &pBuffer, unsigned nVersion = 0u) = 0;
+        virtual bool        addBlock(const ID &id, IBlockBuffer *pBuffer) = 0;
+        virtual bool        updateBlock(const ID &id, IBlockBuffer *pBuffer) = 0;
+        virtual bool        replaceBlock(const ID &id, IBlockBuffer *pBuffer) = 0;
+
+        // Many blocks in one call. The reads which miss the cache are sorted by their place in the
+        // data files and the neighbouring ones share one I/O, vecFound tells which IDs exist and the
+        // count of them is returned. writeBlocks replaces every block and queues them as one batch.
+        virtual unsigned    readBlocks(const std::vector<ID> &vecIDs, std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers, std::vector<bool> &vecFound) = 0;
+        virtual bool        writeBlocks(const std::vector<ID> &vecIDs, const std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers) = 0;
+
+        // map the data files read-only on the next openDB, only works in 64-bit processes
+        virtual void        setMappedRead(bool bMappedRead) = 0;
+
+        // compress the blocks written from now on, the blocks are read back whatever codec they have
+        virtual void        setCompression(BlockCompression eCompression) = 0;
+
+        // the counters of the block cache and of the reads behind it since openDB
+        virtual void        getCacheStatistics(CacheStatistics &stat) const = 0;
+
+        // Move the living blocks out of the existing data files into new ones, in ID order and
+        // without gaps, delete the emptied files and rewrite the .idx densely. It runs on its own
+        // thread and the database stays readable and writable, nBytesPerSecond 0 does not limit
+        // the moving. bDropOldVersions removes every version but the latest of each ID.
+        virtual bool        startCompaction(UINT_64 nBytesPerSecond = 0u, bool bDropOldVersions = false) = 0;
+        virtual void        stopCompaction(void) = 0;
+        virtual void        getCompactionStatus(CompactionStatus &status) const = 0;
+
+        // Every block is written with a CRC32C, the reads from the data files check it as set here,
+        // BV_STRICT by default. The scrub reads all the blocks on a low-priority thread and checks
+        // them, vecCorruptIDs holds the IDs which have failed in it or in the reads since openDB.
+        virtual void        setVerification(BlockVerification eVerification) = 0;
+        virtual bool        startScrub(UINT_64 nBytesPerSecond = 0u) = 0;
+        virtual void        stopScrub(void) = 0;
+        virtual void        getScrubStatus(ScrubStatus &status, std::vector<ID> &vecCorruptIDs) const = 0;
+
+        // Every write gets a version above all the earlier ones, a batch of writeBlocks shares one.
+        // A snapshot is the version of the last write when it is taken, readBlock(id, pBuffer, nSnapshot)
+        // sees the blocks as they were then, even those replaced or removed since, until it is released.
+        // setVersionRetention keeps at most nMaxVersions versions of every ID, updateBlock and the
+        // compaction drop the older ones, 0 keeps all of them.
+        virtual unsigned    createSnapshot(void) = 0;
+        virtual void        releaseSnapshot(unsigned nSnapshot) = 0;
+        virtual void        setVersionRetention(unsigned nMaxVersions) = 0;
+
+        // Walks the IDs of range straight from the index, nothing is copied but the current batch.
+        // The caller releases the iterator, it returns no more IDs once the database is closed.
+        virtual IIndexIterator *scanIndices(const IDScanRange &range) = 0;
+
+        // Loading many new blocks at once. Between beginBulkLoad and endBulkLoad the blocks of
+        // bulkAddBlock go from any number of threads into data files of their own, past the write
+        // queue, the log and the cache. They are not seen until endBulkLoad syncs the files and
+        // writes their index in one go. bulkAddBlock refuses an ID which is in the database, if an
+        // ID is loaded twice or written the usual way meanwhile only one of its blocks is kept.
+        virtual bool        beginBulkLoad(void) = 0;
+        virtual bool        bulkAddBlock(const ID &id, const void *pBuffer, unsigned nBufLen) = 0;
+        virtual bool        bulkAddBlock(const ID &id, IBlockBuffer *pBuffer) = 0;
+        virtual bool        endBulkLoad(void) = 0;
     };
 
     DEUDB_EXPORT IDEUDB *createDEUDB(void);
     DEUDB_EXPORT void    freeMemory(void *pData);
+
+    // the data is copied once, the buffer must not be changed after it is handed over
+    DEUDB_EXPORT IBlockBuffer *createBlockBuffer(const void *pData, unsigned nLength);
 }
 
 #endif
@@ -2,17 +2,27 @@
 #define ROUTINE_MANAGER_H_92F59AEE_713E_4516_A5E9_331646AFF754_INCLUDE
 
 #include "OpenSP/Ref.h"
+#include "OpenSP/sp.h"
 #include "OpenThreads/Thread"
 #include "OpenThreads/Mutex"
 #include "OpenThreads/Block"
 #include "OpenThreads/Atomic"
 #include <list>
+#include <vector>
 #include "DataStruct.h"
 #include "WorkingThreads.h"
+#include "WriteAheadLog.h"
 
 namespace deudb
 {
     class DataBase;
+
+    // Queues the routines of the writers and applies them on its own thread, a batch at a time
+    // through the log. The log and the .idx are only touched under m_mtxFiles, whether by the
+    // routine thread, a checkpoint, a flush or the swap of the .idx, so those may be called from
+    // any thread. What stays with the caller: the slots in the .idx are chosen by the caller, so
+    // appendIndices must be given slots no queued routine uses, and replaceIndexFile refuses to
+    // swap the .idx while a routine is queued, the caller keeps the writers out to let it through.
     class RoutineManager : public OpenSP::Ref
     {
     public:
@@ -20,12 +30,26 @@ namespace deudb
         virtual ~RoutineManager(void);
 
     public:
-        bool    init(const std::string &strIndexFile, DataBase *pDataBase, UINT_64 nWriteBufferLimited);
+        bool    init(const std::string &strIndexFile, const std::string &strLogFile, DataBase *pDataBase, UINT_64 nWriteBufferLimited);
+        // wait while the queued routines are over the write buffer limit, the writers call it before they
+        // take their own locks, addRoutine and addRoutines themselves never wait
+        void    waitForRoom(void);
         bool    addRoutine(const ID &id, const Routine &routine);
-        void   *readRoutineBlock(const ID &id) const;
+        // queued together under one lock, in the order of the list
+        bool    addRoutines(const std::list<std::pair<ID, Routine> > &listRoutines);
+        OpenSP::sp<IBlockBuffer> readRoutineBlock(const ID &id, unsigned nVersion) const;
+
+        // wait until the routines queued so far are in the files, bCheckpoint syncs them and truncates the log
+        void    flush(bool bCheckpoint);
+        // swap the .idx for a rewritten one which holds every routine queued so far,
+        // false without touching the files if a routine is still queued or the log cannot be emptied
+        bool    replaceIndexFile(const std::string &strIndexFile, const std::string &strNewIndexFile);
+        // write the records of a bulk load into the .idx from nPosInIndex on in one go and sync it
+        bool    appendIndices(const std::vector<BlockInIdx> &vecIndices, unsigned nPosInIndex);
 
     protected:
         bool        doAction(void);
+        void        checkpoint(void);
 
     protected:
         class RoutineThread : public WorkingThread
@@ -45,8 +69,15 @@ namespace deudb
 
         typedef std::pair<ID, Routine>  RoutineTask;
         std::list<RoutineTask>      m_queueRoutines;
+        std::list<RoutineTask>      m_listInFlight;     // the batch being committed, still readable
         OpenThreads::Mutex          m_mtxRoutines;
 
+        const static UINT_64        ms_nMaxBatchSize;
+        const static UINT_64        ms_nCheckpointSize;
+        OpenSP::sp<WriteAheadLog>   m_pLog;
+        UINT_64                     m_nIndexFileEnd;
+        OpenThreads::Mutex          m_mtxFiles;         // m_pLog, m_pIndexFile and m_nIndexFileEnd, taken before m_mtxRoutines
+
         UINT_64                     m_nWriteBufferLimited;
         UINT_64                     m_nWriteBufferSize;
         OpenThreads::Block          m_blockWriteBuffer;
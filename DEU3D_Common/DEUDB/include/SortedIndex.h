@@ -0,0 +1,116 @@
+#ifndef SORTED_INDEX_H_3E7B90C4_5A2D_4F18_B6C3_91D8E02A47F5_INCLUDE
+#define SORTED_INDEX_H_3E7B90C4_5A2D_4F18_B6C3_91D8E02A47F5_INCLUDE
+
+#include <stdio.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <OpenSP/Ref.h>
+#include "DataStruct.h"
+#include "DataBase.h"
+
+namespace deudb
+{
+#pragma pack(push, 4)
+
+    struct SortedIdxRecord
+    {
+        BlockInIdx  m_blockInIdx;
+        unsigned    m_nPosInIndex;      // the slot of this record in the .idx file
+    };
+
+#pragma pack(pop)
+
+    // A read-only copy of the living records of the .idx file, sorted by
+    // (ID, version) and cut into pages. The first ID of every page is kept in
+    // a fence table at the end of the file, so a lookup is a binary search over
+    // the fences plus a scan of one page. The whole file is mapped and searched
+    // in place, opening it does not cost anything per record.
+    //
+    // The file is written when the database is closed and flagged as unclean
+    // while it is open, a crash makes the next openDB rebuild it from the .idx.
+    class SortedIndex : public OpenSP::Ref
+    {
+    public:
+        explicit SortedIndex(void);
+        virtual ~SortedIndex(void);
+
+    public:
+        bool        open(const std::string &strFile, UINT_64 nIdxFileLength);
+        void        close(void);
+        bool        isOpen(void) const          {   return (m_pMappedView != NULL);     }
+        bool        setClean(bool bClean);
+
+        bool        find(const ID &id, std::vector<SortedIdxRecord> &vecRecords) const;
+        UINT_64     lowerBound(const ID &id) const;
+        void        getRecord(UINT_64 nIndex, SortedIdxRecord &record) const;
+
+        UINT_64     getRecordCount(void) const  {   return m_nRecordCount;  }
+        UINT_64     getIDCount(void) const      {   return m_nIDCount;      }
+        unsigned    getMaxVersion(void) const   {   return m_nMaxVersion;   }
+
+        void        getIndexGaps(std::list<unsigned> &listGaps) const;
+        bool        getFreeGaps(FILE_GAP_MAP &mapFreeGaps) const;
+
+        // build the file straight from a v1 or v2 .idx file, a v1 file is upgraded in place
+        static bool convert(const std::string &strIndexFile, const std::string &strSortedFile);
+
+    public:
+        // streams records, in (ID, version) order, into a new sorted index file
+        class Writer
+        {
+        public:
+            explicit Writer(void);
+            ~Writer(void);
+
+        public:
+            bool    begin(const std::string &strFile);
+            bool    append(const SortedIdxRecord &record);
+            bool    finish(UINT_64 nIdxFileLength, const std::list<unsigned> &listIndexGaps, const FILE_GAP_MAP *pFreeGaps);
+            void    cancel(void);
+
+        protected:
+            bool    flushPage(void);
+
+        protected:
+            std::string                 m_strFile;
+            std::string                 m_strTempFile;
+            FILE                       *m_pFile;
+            std::vector<unsigned char>  m_vecPage;
+            unsigned                    m_nRecordsInPage;
+            std::vector<ID>             m_vecFences;
+            UINT_64                     m_nRecordCount;
+            UINT_64                     m_nIDCount;
+            ID                          m_idLast;
+            unsigned                    m_nMaxVersion;
+        };
+
+    protected:
+        void        getFence(unsigned nPage, ID &id) const;
+        const unsigned char *getRecordAddress(UINT_64 nIndex) const;
+
+    protected:
+        std::string             m_strFile;
+        UINT_64                 m_nMappedSize;
+        const unsigned char    *m_pMappedView;
+#if defined (WIN32) || defined (WIN64)
+        void                   *m_hFile;
+        void                   *m_hMapping;
+#else
+        int                     m_nFile;
+#endif
+
+        UINT_64                 m_nRecordCount;
+        UINT_64                 m_nIDCount;
+        unsigned                m_nPageCount;
+        unsigned                m_nRecordsPerPage;
+        UINT_64                 m_nFenceOffset;
+        UINT_64                 m_nSlotOffset;
+        unsigned                m_nSlotCount;
+        UINT_64                 m_nGapOffset;
+        unsigned                m_nGapCount;
+        unsigned                m_nMaxVersion;
+    };
+}
+
+#endif
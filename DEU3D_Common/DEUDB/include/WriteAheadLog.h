@@ -0,0 +1,60 @@
+#ifndef WRITE_AHEAD_LOG_H_6A0E43B1_2F7D_4C59_9B18_E47A53C0D912_INCLUDE
+#define WRITE_AHEAD_LOG_H_6A0E43B1_2F7D_4C59_9B18_E47A53C0D912_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <OpenSP/Ref.h>
+#include "DataStruct.h"
+
+namespace deudb
+{
+    // An append-only redo log in front of the data and index files.
+    // The routine thread writes a whole batch of routines into the log with
+    // one sequential write and one durability barrier (group commit), then
+    // applies them to the .db and .idx files without syncing them. The log
+    // is truncated at a checkpoint, after the data and index files have been
+    // synced. openDB replays every complete batch left in the log, and a torn
+    // batch at the end is discarded. A batch which fails to reach the log
+    // is cut off again at once, so the next batch follows the last intact one.
+    class WriteAheadLog : public OpenSP::Ref
+    {
+    public:
+        explicit WriteAheadLog(void);
+        virtual ~WriteAheadLog(void);
+
+    public:
+        struct Record
+        {
+            unsigned    m_nPosInIndex;
+            BlockInIdx  m_index;
+            const void *m_pData;        // NULL for remove or empty blocks
+        };
+
+        bool        open(const std::string &strLogFile);
+        void        close(void);
+
+        bool        commitBatch(const std::vector<Record> &vecRecords);
+        bool        reset(void);
+        UINT_64     getLogSize(void) const  {   return m_nLogSize;  }
+
+        static bool replay(const std::string &strLogFile, const std::string &strIndexFile, const std::string &strDataBase);
+        static bool syncFile(FILE *pFile);
+        // rename strSource over strTarget, the target is never missing in between
+        static bool replaceFile(const std::string &strSource, const std::string &strTarget);
+
+    protected:
+        static unsigned getDataLength(const Record &record);
+
+        bool        writeBatch(const std::vector<Record> &vecRecords, UINT_64 &nBatchLength);
+        // cut the log back to nSize, whatever stdio still holds beyond it is dropped
+        bool        truncate(UINT_64 nSize);
+
+    protected:
+        FILE       *m_pLogFile;
+        std::string m_strLogFile;
+        UINT_64     m_nLogSize;
+    };
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "BlockBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace deudb
+{
+
+IBlockBuffer *createBlockBuffer(const void *pData, unsigned nLength)
+{
+    return BlockBuffer::copyFrom(pData, nLength);
+}
+
+
+BlockBuffer::BlockBuffer(void *pMemory, unsigned nLength)
+{
+    m_pMemory = pMemory;
+    m_nLength = (pMemory != NULL) ? nLength : 0u;
+}
+
+
+BlockBuffer::~BlockBuffer(void)
+{
+    if(m_pMemory != NULL)
+    {
+        free(m_pMemory);
+        m_pMemory = NULL;
+    }
+}
+
+
+const void *BlockBuffer::getData(void) const
+{
+    return m_pMemory;
+}
+
+
+unsigned BlockBuffer::getLength(void) const
+{
+    return m_nLength;
+}
+
+
+BlockBuffer *BlockBuffer::copyFrom(const void *pData, unsigned nLength)
+{
+    if(NULL == pData || 0u == nLength)
+    {
+        return NULL;
+    }
+
+    void *pMemory = malloc(nLength);
+    if(NULL == pMemory)
+    {
+        return NULL;
+    }
+    memcpy(pMemory, pData, nLength);
+    return new BlockBuffer(pMemory, nLength);
+}
+
+
+
+BlockSlice::BlockSlice(IBlockBuffer *pParent, unsigned nOffset, unsigned nLength)
+{
+    m_pParent = pParent;
+    m_pData   = (const unsigned char *)pParent->getData() + nOffset;
+    m_nLength = nLength;
+}
+
+
+BlockSlice::~BlockSlice(void)
+{
+}
+
+
+const void *BlockSlice::getData(void) const
+{
+    return m_pData;
+}
+
+
+unsigned BlockSlice::getLength(void) const
+{
+    return m_nLength;
+}
+
+}
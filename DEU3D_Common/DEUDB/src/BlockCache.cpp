@@ -0,0 +1,360 @@
+#include "BlockCache.h"
+#include <string.h>
+#include <algorithm>
+#include <OpenThreads/ScopedLock>
+
+namespace deudb
+{
+
+const unsigned g_nInitBucketCount = 1024u;
+const unsigned g_nMinGhostCount   = 256u;
+
+
+BlockCache::BlockCache(unsigned nShardCount)
+{
+    // the shard count is rounded up to a power of 2
+    m_nShardBits = 0u;
+    while((1u << m_nShardBits) < nShardCount && m_nShardBits < 10u)
+    {
+        m_nShardBits++;
+    }
+
+    const unsigned nCount = 1u << m_nShardBits;
+    m_vecShards.resize(nCount);
+    for(unsigned n = 0u; n < nCount; n++)
+    {
+        Shard *pShard = new Shard;
+        pShard->m_vecBuckets.assign(g_nInitBucketCount, (Entry *)NULL);
+        pShard->m_nEntryCount   = 0u;
+        pShard->m_nCapacity     = 0u;
+        pShard->m_nHits         = 0u;
+        pShard->m_nMisses       = 0u;
+        pShard->m_nEvictions    = 0u;
+        pShard->m_nLockAcquires = 0u;
+        pShard->m_nLockWaits    = 0u;
+        for(unsigned q = 0u; q < 3u; q++)
+        {
+            Queue &queue = pShard->m_queues[q];
+            queue.m_sentinel.m_pPrev = &queue.m_sentinel;
+            queue.m_sentinel.m_pNext = &queue.m_sentinel;
+            queue.m_nBytes = 0u;
+            queue.m_nCount = 0u;
+        }
+        m_vecShards[n] = pShard;
+    }
+}
+
+
+BlockCache::~BlockCache(void)
+{
+    for(size_t n = 0u; n < m_vecShards.size(); n++)
+    {
+        clearShard(*m_vecShards[n]);
+        delete m_vecShards[n];
+    }
+    m_vecShards.clear();
+}
+
+
+UINT_64 BlockCache::hashID(const ID &id)
+{
+    UINT_64 nHash = id.m_nLowBit ^ (id.m_nMidBit * 0x9E3779B97F4A7C15uLL) ^ (id.m_nHighBit * 0xC2B2AE3D27D4EB4FuLL);
+    nHash ^= (nHash >> 33u);
+    nHash *= 0xFF51AFD7ED558CCDuLL;
+    nHash ^= (nHash >> 33u);
+    return nHash;
+}
+
+
+BlockCache::Shard &BlockCache::getShard(UINT_64 nHash) const
+{
+    // the high half picks the shard, the low half the bucket
+    const unsigned nShard = (unsigned)(nHash >> 32u) & ((1u << m_nShardBits) - 1u);
+    return *m_vecShards[nShard];
+}
+
+
+void BlockCache::lockShard(Shard &shard) const
+{
+    if(shard.m_mtxShard.trylock() != 0)
+    {
+        shard.m_mtxShard.lock();
+        shard.m_nLockWaits++;
+    }
+    shard.m_nLockAcquires++;
+}
+
+
+BlockCache::Entry *BlockCache::findEntry(Shard &shard, const ID &id, UINT_64 nHash)
+{
+    Entry *pEntry = shard.m_vecBuckets[nHash & (shard.m_vecBuckets.size() - 1u)];
+    while(pEntry != NULL && pEntry->m_id != id)
+    {
+        pEntry = pEntry->m_pHashNext;
+    }
+    return pEntry;
+}
+
+
+void BlockCache::addEntry(Shard &shard, Entry *pEntry, UINT_64 nHash)
+{
+    if(shard.m_nEntryCount >= shard.m_vecBuckets.size())
+    {
+        // keep the chains short, every entry goes to its bucket in the doubled table
+        std::vector<Entry *> vecBuckets(shard.m_vecBuckets.size() * 2u, (Entry *)NULL);
+        for(size_t n = 0u; n < shard.m_vecBuckets.size(); n++)
+        {
+            Entry *pItem = shard.m_vecBuckets[n];
+            while(pItem != NULL)
+            {
+                Entry *pNext = pItem->m_pHashNext;
+                const size_t nBucket = hashID(pItem->m_id) & (vecBuckets.size() - 1u);
+                pItem->m_pHashNext = vecBuckets[nBucket];
+                vecBuckets[nBucket] = pItem;
+                pItem = pNext;
+            }
+        }
+        shard.m_vecBuckets.swap(vecBuckets);
+    }
+
+    Entry *&pBucket = shard.m_vecBuckets[nHash & (shard.m_vecBuckets.size() - 1u)];
+    pEntry->m_pHashNext = pBucket;
+    pBucket = pEntry;
+    shard.m_nEntryCount++;
+}
+
+
+void BlockCache::removeEntry(Shard &shard, Entry *pEntry, UINT_64 nHash)
+{
+    Entry **ppItem = &shard.m_vecBuckets[nHash & (shard.m_vecBuckets.size() - 1u)];
+    while(*ppItem != NULL && *ppItem != pEntry)
+    {
+        ppItem = &(*ppItem)->m_pHashNext;
+    }
+    if(*ppItem != NULL)
+    {
+        *ppItem = pEntry->m_pHashNext;
+        shard.m_nEntryCount--;
+    }
+    popQueue(shard, pEntry);
+    freeEntry(pEntry);
+}
+
+
+void BlockCache::pushQueue(Shard &shard, Entry *pEntry, QueueType eQueue)
+{
+    Queue &queue = shard.m_queues[eQueue];
+    pEntry->m_eQueue = eQueue;
+    pEntry->m_pNext  = &queue.m_sentinel;
+    pEntry->m_pPrev  = queue.m_sentinel.m_pPrev;
+    queue.m_sentinel.m_pPrev->m_pNext = pEntry;
+    queue.m_sentinel.m_pPrev = pEntry;
+    queue.m_nBytes += pEntry->m_nLength;
+    queue.m_nCount++;
+}
+
+
+void BlockCache::popQueue(Shard &shard, Entry *pEntry)
+{
+    if(pEntry->m_pPrev == NULL) return;
+
+    Queue &queue = shard.m_queues[pEntry->m_eQueue];
+    pEntry->m_pPrev->m_pNext = pEntry->m_pNext;
+    pEntry->m_pNext->m_pPrev = pEntry->m_pPrev;
+    pEntry->m_pPrev = NULL;
+    pEntry->m_pNext = NULL;
+    queue.m_nBytes -= pEntry->m_nLength;
+    queue.m_nCount--;
+}
+
+
+void BlockCache::freeEntry(Entry *pEntry)
+{
+    // the buffer lives on while a reader or the write queue still holds it
+    delete pEntry;
+}
+
+
+void BlockCache::evict(Shard &shard)
+{
+    Queue &queueIn    = shard.m_queues[QT_IN];
+    Queue &queueHot   = shard.m_queues[QT_HOT];
+    Queue &queueGhost = shard.m_queues[QT_GHOST];
+
+    // a quarter of the shard is for the blocks read only once
+    const UINT_64 nInLimited = shard.m_nCapacity / 4u;
+    while(queueIn.m_nBytes + queueHot.m_nBytes > shard.m_nCapacity)
+    {
+        if(queueIn.m_nCount > 0u && (queueIn.m_nBytes > nInLimited || queueHot.m_nCount == 0u))
+        {
+            // the oldest one of the FIFO leaves its ID behind
+            Entry *pVictim = queueIn.m_sentinel.m_pNext;
+            popQueue(shard, pVictim);
+            pVictim->m_pBuffer = NULL;
+            pVictim->m_nLength = 0u;
+            pushQueue(shard, pVictim, QT_GHOST);
+        }
+        else
+        {
+            Entry *pVictim = queueHot.m_sentinel.m_pNext;
+            removeEntry(shard, pVictim, hashID(pVictim->m_id));
+        }
+        shard.m_nEvictions++;
+    }
+
+    const unsigned nGhostLimited = std::max(g_nMinGhostCount, queueIn.m_nCount + queueHot.m_nCount);
+    while(queueGhost.m_nCount > nGhostLimited)
+    {
+        Entry *pGhost = queueGhost.m_sentinel.m_pNext;
+        removeEntry(shard, pGhost, hashID(pGhost->m_id));
+    }
+}
+
+
+void BlockCache::clearShard(Shard &shard)
+{
+    for(size_t n = 0u; n < shard.m_vecBuckets.size(); n++)
+    {
+        Entry *pEntry = shard.m_vecBuckets[n];
+        while(pEntry != NULL)
+        {
+            Entry *pNext = pEntry->m_pHashNext;
+            freeEntry(pEntry);
+            pEntry = pNext;
+        }
+    }
+    shard.m_vecBuckets.assign(g_nInitBucketCount, (Entry *)NULL);
+    shard.m_nEntryCount = 0u;
+    for(unsigned q = 0u; q < 3u; q++)
+    {
+        Queue &queue = shard.m_queues[q];
+        queue.m_sentinel.m_pPrev = &queue.m_sentinel;
+        queue.m_sentinel.m_pNext = &queue.m_sentinel;
+        queue.m_nBytes = 0u;
+        queue.m_nCount = 0u;
+    }
+}
+
+
+void BlockCache::setCapacity(UINT_64 nCapacity)
+{
+    const UINT_64 nShardCapacity = nCapacity / m_vecShards.size();
+    for(size_t n = 0u; n < m_vecShards.size(); n++)
+    {
+        Shard &shard = *m_vecShards[n];
+        lockShard(shard);
+        shard.m_nCapacity = nShardCapacity;
+        evict(shard);
+        shard.m_mtxShard.unlock();
+    }
+}
+
+
+bool BlockCache::read(const ID &id, unsigned nVersion, OpenSP::sp<IBlockBuffer> &pBuffer)
+{
+    const UINT_64 nHash = hashID(id);
+    Shard &shard = getShard(nHash);
+    lockShard(shard);
+
+    Entry *pEntry = findEntry(shard, id, nHash);
+    if(pEntry == NULL || pEntry->m_eQueue == QT_GHOST || (nVersion != 0u && pEntry->m_nVersion != nVersion))
+    {
+        shard.m_nMisses++;
+        shard.m_mtxShard.unlock();
+        return false;
+    }
+
+    shard.m_nHits++;
+    if(pEntry->m_eQueue == QT_HOT)
+    {
+        popQueue(shard, pEntry);
+        pushQueue(shard, pEntry, QT_HOT);
+    }
+
+    pBuffer = pEntry->m_pBuffer;
+
+    shard.m_mtxShard.unlock();
+    return true;
+}
+
+
+void BlockCache::insert(const ID &id, unsigned nVersion, IBlockBuffer *pBuffer)
+{
+    const UINT_64 nHash = hashID(id);
+    Shard &shard = getShard(nHash);
+    lockShard(shard);
+
+    QueueType eQueue = QT_IN;
+    Entry *pEntry = findEntry(shard, id, nHash);
+    if(pEntry != NULL)
+    {
+        // a ghost has been asked for again, so it is hot now
+        eQueue = (pEntry->m_eQueue == QT_IN) ? QT_IN : QT_HOT;
+        popQueue(shard, pEntry);
+    }
+    else
+    {
+        pEntry = new Entry;
+        pEntry->m_id    = id;
+        pEntry->m_pPrev = NULL;
+        pEntry->m_pNext = NULL;
+        addEntry(shard, pEntry, nHash);
+    }
+
+    pEntry->m_nVersion = nVersion;
+    pEntry->m_pBuffer  = pBuffer;
+    pEntry->m_nLength  = (pBuffer != NULL) ? pBuffer->getLength() : 0u;
+    pushQueue(shard, pEntry, eQueue);
+
+    evict(shard);
+    shard.m_mtxShard.unlock();
+}
+
+
+void BlockCache::erase(const ID &id)
+{
+    const UINT_64 nHash = hashID(id);
+    Shard &shard = getShard(nHash);
+    lockShard(shard);
+
+    Entry *pEntry = findEntry(shard, id, nHash);
+    if(pEntry != NULL)
+    {
+        removeEntry(shard, pEntry, nHash);
+    }
+
+    shard.m_mtxShard.unlock();
+}
+
+
+void BlockCache::clear(void)
+{
+    for(size_t n = 0u; n < m_vecShards.size(); n++)
+    {
+        Shard &shard = *m_vecShards[n];
+        lockShard(shard);
+        clearShard(shard);
+        shard.m_mtxShard.unlock();
+    }
+}
+
+
+void BlockCache::getStatistics(CacheStatistics &stat) const
+{
+    memset(&stat, 0, sizeof(CacheStatistics));
+    for(size_t n = 0u; n < m_vecShards.size(); n++)
+    {
+        Shard &shard = *m_vecShards[n];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(shard.m_mtxShard);
+
+        stat.m_nHits         += shard.m_nHits;
+        stat.m_nMisses       += shard.m_nMisses;
+        stat.m_nEvictions    += shard.m_nEvictions;
+        stat.m_nLockAcquires += shard.m_nLockAcquires;
+        stat.m_nLockWaits    += shard.m_nLockWaits;
+        stat.m_nCachedBytes  += shard.m_queues[QT_IN].m_nBytes + shard.m_queues[QT_HOT].m_nBytes;
+        stat.m_nCachedBlocks += shard.m_queues[QT_IN].m_nCount + shard.m_queues[QT_HOT].m_nCount;
+    }
+}
+
+}
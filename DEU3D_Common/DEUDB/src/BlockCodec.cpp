@@ -0,0 +1,422 @@
+#include "BlockCodec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <zlib.h>
+#include <OpenThreads/ScopedLock>
+#include "Common/Common.h"
+#include "Common/crc.h"
+#include "BlockBuffer.h"
+#include "WriteAheadLog.h"
+
+namespace deudb
+{
+
+const unsigned char g_szCodecFlag[4]      = {'D', 'E', 'U', 'Z'};
+const unsigned char g_szDictionaryFlag[8] = {'D', 'E', 'U', 'D', 'I', 'C', 'T', '\0'};
+
+const unsigned  g_nMinCompressLength = 64u;         // the smaller blocks are not worth it
+const unsigned  g_nMaxDictBlockLength = 4096u;      // only the small blocks use the dictionary
+const unsigned  g_nDictionarySize = 32768u;         // zlib cannot look back any further
+const unsigned  g_nDictSampleSize = 16384u;         // the samples collected before the dictionary is built
+const int       g_nCompressLevel = Z_BEST_SPEED;
+
+enum CodecType
+{
+    CT_RAW          = 0,    // stored as it is, only framed for its checksum
+    CT_DEFLATE      = 1,
+    CT_DEFLATE_DICT = 2
+};
+
+enum CodecFlag
+{
+    CF_CHECKSUM     = 0x01  // the header is followed by the CRC32C of the payload
+};
+
+#pragma pack(push, 4)
+
+struct CodecHeader
+{
+    unsigned char   m_szFlag[4];        // must be "DEUZ"
+    unsigned char   m_nCodec;           // CodecType
+    unsigned char   m_nFlags;           // CodecFlag
+    unsigned char   m_reserved[2];
+    unsigned        m_nRawLength;
+    unsigned        m_nHeaderCRC;       // crc of this header while m_nHeaderCRC is 0
+};
+
+struct DictionaryHeader
+{
+    unsigned char   m_szFlag[8];        // must be "DEUDICT\0"
+    unsigned        m_nLength;
+    unsigned        m_nCRC;             // crc of the dictionary
+};
+
+#pragma pack(pop)
+
+const unsigned  g_nFrameLength = sizeof(CodecHeader) + sizeof(unsigned);
+
+
+static bool readCodecHeader(const IBlockBuffer *pStored, CodecHeader &header)
+{
+    if(pStored->getLength() < sizeof(CodecHeader))
+    {
+        return false;
+    }
+
+    memcpy(&header, pStored->getData(), sizeof(CodecHeader));
+    if(memcmp(header.m_szFlag, g_szCodecFlag, sizeof(g_szCodecFlag)) != 0)
+    {
+        return false;
+    }
+
+    // the verbatim blocks of the old databases must not be taken for a header
+    CodecHeader headerCheck = header;
+    headerCheck.m_nHeaderCRC = 0u;
+    if(header.m_nHeaderCRC != cmm::createHashCRC32(&headerCheck, sizeof(CodecHeader)))
+    {
+        return false;
+    }
+    return !(header.m_nFlags & CF_CHECKSUM) || pStored->getLength() >= g_nFrameLength;
+}
+
+
+static unsigned getPayloadOffset(const CodecHeader &header)
+{
+    return (header.m_nFlags & CF_CHECKSUM) ? g_nFrameLength : sizeof(CodecHeader);
+}
+
+
+// the payload goes behind the frame, sealFrame() adds its checksum when it is there
+static void *writeCodecHeader(CodecType eCodec, unsigned nRawLength, unsigned nPayloadLength)
+{
+    CodecHeader header;
+    memset(&header, 0, sizeof(CodecHeader));
+    memcpy(header.m_szFlag, g_szCodecFlag, sizeof(g_szCodecFlag));
+    header.m_nCodec     = (unsigned char)eCodec;
+    header.m_nFlags     = CF_CHECKSUM;
+    header.m_nRawLength = nRawLength;
+    header.m_nHeaderCRC = cmm::createHashCRC32(&header, sizeof(CodecHeader));
+
+    void *pMemory = malloc(g_nFrameLength + nPayloadLength);
+    if(pMemory != NULL)
+    {
+        memcpy(pMemory, &header, sizeof(CodecHeader));
+    }
+    return pMemory;
+}
+
+
+static IBlockBuffer *sealFrame(void *pMemory, unsigned nPayloadLength)
+{
+    unsigned char *pFrame = (unsigned char *)pMemory;
+    const unsigned nCRC = cmm::createHashCRC32C(pFrame + g_nFrameLength, nPayloadLength);
+    memcpy(pFrame + sizeof(CodecHeader), &nCRC, sizeof(unsigned));
+    return new BlockBuffer(pMemory, g_nFrameLength + nPayloadLength);
+}
+
+
+BlockCodec::BlockCodec(void)
+{
+    m_eCompression = BC_NONE;
+    m_bSampling    = false;
+}
+
+
+BlockCodec::~BlockCodec(void)
+{
+}
+
+
+bool BlockCodec::init(const std::string &strDictFile, BlockCompression eCompression)
+{
+    m_strDictFile  = strDictFile;
+    m_eCompression = eCompression;
+    m_pDictionary  = NULL;
+    m_vecSamples.clear();
+
+    // a dictionary which exists is never built again, the blocks written with it depend on it
+    m_bSampling = !cmm::isFileExist(m_strDictFile);
+    if(m_bSampling)
+    {
+        return true;
+    }
+
+    FILE *pFile = fopen(m_strDictFile.c_str(), "rb");
+    if(pFile == NULL)
+    {
+        return false;
+    }
+
+    bool bSucceed = false;
+    DictionaryHeader header;
+    if(fread(&header, sizeof(DictionaryHeader), 1, pFile) == 1
+        && memcmp(header.m_szFlag, g_szDictionaryFlag, sizeof(g_szDictionaryFlag)) == 0
+        && header.m_nLength > 0u && header.m_nLength <= g_nDictionarySize)
+    {
+        void *pMemory = malloc(header.m_nLength);
+        if(fread(pMemory, header.m_nLength, 1, pFile) == 1
+            && header.m_nCRC == cmm::createHashCRC32(pMemory, header.m_nLength))
+        {
+            m_pDictionary = new BlockBuffer(pMemory, header.m_nLength);
+            bSucceed = true;
+        }
+        else
+        {
+            free(pMemory);
+        }
+    }
+    fclose(pFile);
+
+    if(!bSucceed)
+    {
+        std::cout << "Warning: the compression dictionary is broken, the blocks compressed with it cannot be read." << std::endl;
+    }
+    return bSucceed;
+}
+
+
+void BlockCodec::setCompression(BlockCompression eCompression)
+{
+    m_eCompression = eCompression;
+}
+
+
+OpenSP::sp<IBlockBuffer> BlockCodec::getDictionary(void) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(const_cast<OpenThreads::Mutex &>(m_mtxDictionary));
+    return m_pDictionary;
+}
+
+
+void BlockCodec::addSample(const IBlockBuffer *pRaw)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDictionary);
+    if(!m_bSampling)
+    {
+        return;
+    }
+
+    const unsigned char *pData = (const unsigned char *)pRaw->getData();
+    m_vecSamples.insert(m_vecSamples.end(), pData, pData + pRaw->getLength());
+    if(m_vecSamples.size() < g_nDictSampleSize)
+    {
+        return;
+    }
+    m_bSampling = false;
+
+    // the samples written last are nearest to the data, so zlib finds them cheapest
+    const unsigned nLength = (unsigned)std::min(m_vecSamples.size(), (size_t)g_nDictionarySize);
+    const unsigned char *pDictionary = &m_vecSamples[m_vecSamples.size() - nLength];
+
+    DictionaryHeader header;
+    memcpy(header.m_szFlag, g_szDictionaryFlag, sizeof(g_szDictionaryFlag));
+    header.m_nLength = nLength;
+    header.m_nCRC    = cmm::createHashCRC32(pDictionary, nLength);
+
+    // the dictionary must be on the disk before the first block needs it
+    const std::string strTempFile = m_strDictFile + ".tmp";
+    FILE *pFile = fopen(strTempFile.c_str(), "wb");
+    bool bSucceed = (pFile != NULL);
+    if(bSucceed)
+    {
+        bSucceed = fwrite(&header, sizeof(DictionaryHeader), 1, pFile) == 1
+            && fwrite(pDictionary, nLength, 1, pFile) == 1
+            && WriteAheadLog::syncFile(pFile);
+        fclose(pFile);
+    }
+    if(bSucceed)
+    {
+        bSucceed = (rename(strTempFile.c_str(), m_strDictFile.c_str()) == 0);
+    }
+
+    if(bSucceed)
+    {
+        m_pDictionary = BlockBuffer::copyFrom(pDictionary, nLength);
+    }
+    else
+    {
+        remove(strTempFile.c_str());
+        std::cout << "Warning: failed to write the compression dictionary, the small blocks are compressed without it." << std::endl;
+    }
+    std::vector<unsigned char>().swap(m_vecSamples);
+}
+
+
+IBlockBuffer *BlockCodec::deflateBlock(const IBlockBuffer *pRaw, const IBlockBuffer *pDictionary) const
+{
+    const unsigned nRawLength = pRaw->getLength();
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(z_stream));
+    if(deflateInit(&stream, g_nCompressLevel) != Z_OK)
+    {
+        return NULL;
+    }
+    if(pDictionary != NULL)
+    {
+        deflateSetDictionary(&stream, (const Bytef *)pDictionary->getData(), pDictionary->getLength());
+    }
+
+    // it is only kept when it saves a sixteenth at least
+    const unsigned nMaxPayload = nRawLength - nRawLength / 16u - g_nFrameLength;
+    const unsigned nBound = (unsigned)deflateBound(&stream, nRawLength);
+    void *pMemory = writeCodecHeader(pDictionary != NULL ? CT_DEFLATE_DICT : CT_DEFLATE, nRawLength, nBound);
+    if(pMemory == NULL)
+    {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in   = (Bytef *)pRaw->getData();
+    stream.avail_in  = nRawLength;
+    stream.next_out  = (Bytef *)pMemory + g_nFrameLength;
+    stream.avail_out = nBound;
+    const int nRet = deflate(&stream, Z_FINISH);
+    const unsigned nPayload = (unsigned)stream.total_out;
+    deflateEnd(&stream);
+
+    if(nRet != Z_STREAM_END || nPayload > nMaxPayload)
+    {
+        free(pMemory);
+        return NULL;
+    }
+    return sealFrame(pMemory, nPayload);
+}
+
+
+IBlockBuffer *BlockCodec::encode(IBlockBuffer *pRaw)
+{
+    if(pRaw == NULL || pRaw->getLength() == 0u)
+    {
+        return pRaw;
+    }
+
+    const BlockCompression eCompression = m_eCompression;
+    if(eCompression != BC_NONE && pRaw->getLength() >= g_nMinCompressLength)
+    {
+        OpenSP::sp<IBlockBuffer> pDictionary;
+        if(eCompression == BC_DEFLATE_DICT && pRaw->getLength() <= g_nMaxDictBlockLength)
+        {
+            pDictionary = getDictionary();
+            if(!pDictionary.valid())
+            {
+                addSample(pRaw);
+            }
+        }
+
+        IBlockBuffer *pStored = deflateBlock(pRaw, pDictionary.get());
+        if(pStored != NULL)
+        {
+            return pStored;
+        }
+    }
+
+    // it is stored as it is behind the frame
+    void *pMemory = writeCodecHeader(CT_RAW, pRaw->getLength(), pRaw->getLength());
+    if(pMemory == NULL)
+    {
+        return NULL;
+    }
+    memcpy((unsigned char *)pMemory + g_nFrameLength, pRaw->getData(), pRaw->getLength());
+    return sealFrame(pMemory, pRaw->getLength());
+}
+
+
+IBlockBuffer *BlockCodec::decode(IBlockBuffer *pStored) const
+{
+    CodecHeader header;
+    if(pStored == NULL || !readCodecHeader(pStored, header))
+    {
+        return pStored;
+    }
+
+    const unsigned nOffset = getPayloadOffset(header);
+    const unsigned char *pPayload = (const unsigned char *)pStored->getData() + nOffset;
+    const unsigned nPayload = pStored->getLength() - nOffset;
+    if(header.m_nCodec == CT_RAW)
+    {
+        // the payload is handed out where it is, the frame stays behind it
+        return (header.m_nRawLength == nPayload) ? new BlockSlice(pStored, nOffset, nPayload) : NULL;
+    }
+    if(header.m_nCodec != CT_DEFLATE && header.m_nCodec != CT_DEFLATE_DICT)
+    {
+        std::cout << "Warning: unknown block codec " << (unsigned)header.m_nCodec << "." << std::endl;
+        return NULL;
+    }
+
+    OpenSP::sp<IBlockBuffer> pDictionary;
+    if(header.m_nCodec == CT_DEFLATE_DICT)
+    {
+        pDictionary = getDictionary();
+        if(!pDictionary.valid())
+        {
+            return NULL;
+        }
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(z_stream));
+    if(header.m_nRawLength == 0u || inflateInit(&stream) != Z_OK)
+    {
+        return NULL;
+    }
+
+    void *pMemory = malloc(header.m_nRawLength);
+    stream.next_in   = (Bytef *)pPayload;
+    stream.avail_in  = nPayload;
+    stream.next_out  = (Bytef *)pMemory;
+    stream.avail_out = header.m_nRawLength;
+
+    int nRet = inflate(&stream, Z_FINISH);
+    if(nRet == Z_NEED_DICT && pDictionary.valid())
+    {
+        inflateSetDictionary(&stream, (const Bytef *)pDictionary->getData(), pDictionary->getLength());
+        nRet = inflate(&stream, Z_FINISH);
+    }
+    const bool bSucceed = (nRet == Z_STREAM_END && stream.total_out == header.m_nRawLength);
+    inflateEnd(&stream);
+
+    if(!bSucceed)
+    {
+        free(pMemory);
+        return NULL;
+    }
+    return new BlockBuffer(pMemory, header.m_nRawLength);
+}
+
+
+BlockCodec::VerifyResult BlockCodec::verify(const IBlockBuffer *pStored) const
+{
+    if(pStored == NULL || pStored->getLength() < sizeof(CodecHeader))
+    {
+        return VR_UNCHECKED;
+    }
+
+    const unsigned char *pFrame = (const unsigned char *)pStored->getData();
+    if(memcmp(pFrame, g_szCodecFlag, sizeof(g_szCodecFlag)) != 0)
+    {
+        // a verbatim block of an old database
+        return VR_UNCHECKED;
+    }
+
+    // every block starting with the flag has been framed since the compression came, so its header is broken
+    CodecHeader header;
+    if(!readCodecHeader(pStored, header))
+    {
+        return VR_CORRUPT;
+    }
+    if(!(header.m_nFlags & CF_CHECKSUM))
+    {
+        return VR_UNCHECKED;
+    }
+
+    unsigned nCRC = 0u;
+    memcpy(&nCRC, pFrame + sizeof(CodecHeader), sizeof(unsigned));
+    const unsigned nPayload = pStored->getLength() - g_nFrameLength;
+    return (nCRC == cmm::createHashCRC32C(pFrame + g_nFrameLength, nPayload)) ? VR_VALID : VR_CORRUPT;
+}
+
+}
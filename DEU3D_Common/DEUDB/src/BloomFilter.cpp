@@ -0,0 +1,210 @@
+#include "BloomFilter.h"
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include "Common/Common.h"
+#include "Common/crc.h"
+#include "WriteAheadLog.h"
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#endif
+
+namespace deudb
+{
+
+const unsigned char g_szBloomFileFlag[8] = {'D', 'E', 'U', 'B', 'L', 'O', 'O', 'M'};
+const unsigned      g_nWordsPerBloomBlock = 8u;
+const unsigned      g_nBloomBitsPerID = 10u;
+const UINT_64       g_nMinBloomCapacity = 65536u;
+
+// every word of a block takes one bit of the ID, picked by the high bits of the hash times its salt
+const unsigned      g_nBloomSalts[g_nWordsPerBloomBlock] =
+{
+    0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du,
+    0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u
+};
+
+#pragma pack(push, 4)
+
+struct BloomFileHeader
+{
+    unsigned char   m_szFlag[8];        // must be "DEUBLOOM"
+    unsigned int    m_nVersionNumber;   // begin from 1
+    unsigned int    m_nBlockCount;
+    UINT_64         m_nCapacity;
+    UINT_64         m_nInserted;
+    UINT_64         m_nIDCount;         // the IDs of the database when it was written
+    UINT_64         m_nIdxFileLength;   // the length of the .idx file when it was written
+    unsigned int    m_nCRC;             // CRC32C of the words
+    unsigned int    m_reserved;
+};
+
+#pragma pack(pop)
+
+
+// sets the bits of nMask in a word the readers look at without the lock, as one locked operation
+inline void setWordBits(volatile unsigned *pWord, unsigned nMask)
+{
+#if defined (WIN32) || defined (WIN64)
+    InterlockedOr((volatile LONG *)pWord, (LONG)nMask);
+#else
+    __sync_fetch_and_or(pWord, nMask);
+#endif
+}
+
+
+BloomFilter::BloomFilter(UINT_64 nCapacity)
+{
+    if(nCapacity < g_nMinBloomCapacity)
+    {
+        nCapacity = g_nMinBloomCapacity;
+    }
+
+    const UINT_64 nBlockBits = g_nWordsPerBloomBlock * 32u;
+    m_nBlockCount = (unsigned)((nCapacity * g_nBloomBitsPerID + nBlockBits - 1u) / nBlockBits);
+    m_nCapacity   = nCapacity;
+    m_nInserted   = 0u;
+    m_vecWords.resize((size_t)m_nBlockCount * g_nWordsPerBloomBlock, 0u);
+}
+
+
+BloomFilter::~BloomFilter(void)
+{
+}
+
+
+UINT_64 BloomFilter::getCapacityFor(UINT_64 nIDCount)
+{
+    return nIDCount + nIDCount / 2u;
+}
+
+
+UINT_64 BloomFilter::hashID(const ID &id)
+{
+    // the same mix as BlockCache, with another seed so the two do not correlate
+    UINT_64 nHash = id.m_nLowBit ^ (id.m_nMidBit * 0xC2B2AE3D27D4EB4FuLL) ^ (id.m_nHighBit * 0x9E3779B97F4A7C15uLL);
+    nHash ^= (nHash >> 33u);
+    nHash *= 0xC4CEB9FE1A85EC53uLL;
+    nHash ^= (nHash >> 33u);
+    return nHash;
+}
+
+
+const unsigned *BloomFilter::getBlock(UINT_64 nHash) const
+{
+    // the low half of the hash scaled to the block count, no division
+    const UINT_64 nBlock = ((nHash & 0xFFFFFFFFu) * m_nBlockCount) >> 32u;
+    return &m_vecWords[(size_t)nBlock * g_nWordsPerBloomBlock];
+}
+
+
+bool BloomFilter::mayContain(const ID &id) const
+{
+    const UINT_64   nHash  = hashID(id);
+    const unsigned  nKey   = (unsigned)(nHash >> 32u);
+    const unsigned *pBlock = getBlock(nHash);
+
+    for(unsigned i = 0u; i < g_nWordsPerBloomBlock; i++)
+    {
+        const unsigned nBit = (nKey * g_nBloomSalts[i]) >> 27u;
+        if((pBlock[i] & (1u << nBit)) == 0u)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void BloomFilter::insert(const ID &id)
+{
+    const UINT_64   nHash  = hashID(id);
+    const unsigned  nKey   = (unsigned)(nHash >> 32u);
+    unsigned       *pBlock = const_cast<unsigned *>(getBlock(nHash));
+
+    // A reader in between sees some of the bits, it takes the ID as absent as it was before. The
+    // words are only ever or-ed, a word which has the bit already is left alone so the cache line
+    // is not written for nothing.
+    for(unsigned i = 0u; i < g_nWordsPerBloomBlock; i++)
+    {
+        const unsigned nMask = 1u << ((nKey * g_nBloomSalts[i]) >> 27u);
+        if((pBlock[i] & nMask) == 0u)
+        {
+            setWordBits(pBlock + i, nMask);
+        }
+    }
+    m_nInserted++;
+}
+
+
+bool BloomFilter::save(const std::string &strFile, UINT_64 nIDCount, UINT_64 nIdxFileLength) const
+{
+    BloomFileHeader header;
+    memset(&header, 0, sizeof(BloomFileHeader));
+    memcpy(header.m_szFlag, g_szBloomFileFlag, sizeof(g_szBloomFileFlag));
+    header.m_nVersionNumber = 1u;
+    header.m_nBlockCount    = m_nBlockCount;
+    header.m_nCapacity      = m_nCapacity;
+    header.m_nInserted      = m_nInserted;
+    header.m_nIDCount       = nIDCount;
+    header.m_nIdxFileLength = nIdxFileLength;
+    header.m_nCRC           = cmm::createHashCRC32C(&m_vecWords[0], (unsigned)(m_vecWords.size() * sizeof(unsigned)));
+
+    const std::string strTempFile = strFile + ".tmp";
+    FILE *pFile = fopen(strTempFile.c_str(), "wb");
+    bool bSucceed = (pFile != NULL);
+    if(bSucceed)
+    {
+        bSucceed = fwrite(&header, sizeof(BloomFileHeader), 1, pFile) == 1
+            && fwrite(&m_vecWords[0], sizeof(unsigned), m_vecWords.size(), pFile) == m_vecWords.size()
+            && WriteAheadLog::syncFile(pFile);
+        fclose(pFile);
+    }
+    if(bSucceed)
+    {
+        remove(strFile.c_str());
+        bSucceed = (rename(strTempFile.c_str(), strFile.c_str()) == 0);
+    }
+    if(!bSucceed)
+    {
+        remove(strTempFile.c_str());
+    }
+    return bSucceed;
+}
+
+
+BloomFilter *BloomFilter::load(const std::string &strFile, UINT_64 nIDCount, UINT_64 nIdxFileLength)
+{
+    FILE *pFile = fopen(strFile.c_str(), "rb");
+    if(pFile == NULL)
+    {
+        return NULL;
+    }
+
+    BloomFileHeader header;
+    if(fread(&header, sizeof(BloomFileHeader), 1, pFile) != 1
+        || memcmp(header.m_szFlag, g_szBloomFileFlag, sizeof(g_szBloomFileFlag)) != 0
+        || header.m_nVersionNumber != 1u
+        || header.m_nIDCount != nIDCount
+        || header.m_nIdxFileLength != nIdxFileLength)
+    {
+        fclose(pFile);
+        return NULL;
+    }
+
+    OpenSP::sp<BloomFilter> pFilter = new BloomFilter(header.m_nCapacity);
+    const bool bRead = (pFilter->m_nBlockCount == header.m_nBlockCount)
+        && fread(&pFilter->m_vecWords[0], sizeof(unsigned), pFilter->m_vecWords.size(), pFile) == pFilter->m_vecWords.size()
+        && header.m_nCRC == cmm::createHashCRC32C(&pFilter->m_vecWords[0], (unsigned)(pFilter->m_vecWords.size() * sizeof(unsigned)));
+    fclose(pFile);
+
+    if(!bRead)
+    {
+        std::cout << "Warning: the bloom filter file is broken, it will be built again." << std::endl;
+        return NULL;
+    }
+    pFilter->m_nInserted = header.m_nInserted;
+    return pFilter.release();
+}
+
+}
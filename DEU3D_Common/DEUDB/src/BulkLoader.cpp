@@ -0,0 +1,328 @@
+#include "BulkLoader.h"
+#include <algorithm>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+#if defined (WIN32) || defined (WIN64)
+#include <io.h>
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "DatabaseFile.h"
+#include "WriteAheadLog.h"
+
+#ifdef max
+    #undef max
+#endif
+#ifdef min
+    #undef min
+#endif
+
+namespace deudb
+{
+
+const unsigned  g_nBulkBufferSize     = 4u * 1024u * 1024u;
+const UINT_64   g_nMinBulkAllocStep   = 64u * 1024u * 1024u;
+const UINT_64   g_nMaxBulkAllocStep   = 1024u * 1024u * 1024u;
+
+
+static bool isBlockIDAhead(const BlockInIdx &left, const BlockInIdx &right)
+{
+    return left.m_id < right.m_id;
+}
+
+
+static bool isSameBlockID(const BlockInIdx &left, const BlockInIdx &right)
+{
+    return left.m_id == right.m_id;
+}
+
+
+BulkLoader::BulkLoader(void)
+{
+    m_nBusySegments = 0u;
+    m_bFinishing    = false;
+    m_bFailed       = false;
+}
+
+
+BulkLoader::~BulkLoader(void)
+{
+    std::vector<Segment *>::iterator itorSegment = m_vecSegments.begin();
+    for( ; itorSegment != m_vecSegments.end(); ++itorSegment)
+    {
+        Segment *pSegment = *itorSegment;
+        if(pSegment->m_pFile != NULL)
+        {
+            fclose(pSegment->m_pFile);
+        }
+        delete pSegment;
+    }
+}
+
+
+void BulkLoader::init(DataBase *pDataBase)
+{
+    m_pDataBase = pDataBase;
+}
+
+
+BulkLoader::Segment *BulkLoader::takeSegment(void)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxSegments);
+        if(m_bFinishing || m_bFailed)
+        {
+            return NULL;
+        }
+
+        m_nBusySegments++;
+        if(!m_vecIdleSegments.empty())
+        {
+            Segment *pSegment = m_vecIdleSegments.back();
+            m_vecIdleSegments.pop_back();
+            return pSegment;
+        }
+    }
+
+    // every thread more than the segments gets a new one, the file is opened outside the lock
+    Segment *pSegment = new Segment;
+    pSegment->m_pFile      = NULL;
+    pSegment->m_nDBFile    = 0u;
+    pSegment->m_nLength    = 0u;
+    pSegment->m_nAllocated = 0u;
+    pSegment->m_nAllocStep = g_nMinBulkAllocStep;
+    pSegment->m_vecBuffer.resize(g_nBulkBufferSize);
+
+    const bool bOpened = openSegmentFile(pSegment);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxSegments);
+    m_vecSegments.push_back(pSegment);
+    if(!bOpened)
+    {
+        m_bFailed = true;
+        m_vecIdleSegments.push_back(pSegment);
+        m_nBusySegments--;
+        return NULL;
+    }
+    return pSegment;
+}
+
+
+void BulkLoader::returnSegment(Segment *pSegment, bool bWritten)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxSegments);
+    if(!bWritten)
+    {
+        m_bFailed = true;
+    }
+    m_vecIdleSegments.push_back(pSegment);
+    m_nBusySegments--;
+}
+
+
+bool BulkLoader::openSegmentFile(Segment *pSegment)
+{
+    unsigned    nDBFile = 0u;
+    std::string strFilePath;
+    if(!m_pDataBase->reserveFile(nDBFile, strFilePath))
+    {
+        return false;
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxSegments);
+        m_vecDBFiles.push_back(nDBFile);
+    }
+
+    pSegment->m_pFile = fopen(strFilePath.c_str(), "wb");
+    if(pSegment->m_pFile == NULL)
+    {
+        return false;
+    }
+    setvbuf(pSegment->m_pFile, &pSegment->m_vecBuffer[0], _IOFBF, pSegment->m_vecBuffer.size());
+
+    pSegment->m_nDBFile    = nDBFile;
+    pSegment->m_nLength    = 0u;
+    pSegment->m_nAllocated = 0u;
+    return true;
+}
+
+
+bool BulkLoader::closeSegmentFile(Segment *pSegment)
+{
+    if(pSegment->m_pFile == NULL)
+    {
+        return true;
+    }
+
+    // the preallocated tail goes back before the file is synced
+    bool bClosed = (fflush(pSegment->m_pFile) == 0);
+    if(bClosed && pSegment->m_nAllocated > pSegment->m_nLength)
+    {
+#if defined (WIN32) || defined (WIN64)
+        bClosed = (_chsize_s(_fileno(pSegment->m_pFile), pSegment->m_nLength) == 0);
+#else
+        bClosed = (ftruncate(fileno(pSegment->m_pFile), (off_t)pSegment->m_nLength) == 0);
+#endif
+    }
+    bClosed = bClosed && WriteAheadLog::syncFile(pSegment->m_pFile);
+    fclose(pSegment->m_pFile);
+    pSegment->m_pFile = NULL;
+    return bClosed;
+}
+
+
+void BulkLoader::preallocate(Segment *pSegment, unsigned nLength)
+{
+    const UINT_64 nEnd = pSegment->m_nLength + nLength;
+    if(nEnd <= pSegment->m_nAllocated)
+    {
+        return;
+    }
+
+    UINT_64 nNewSize = std::max(nEnd, pSegment->m_nAllocated + pSegment->m_nAllocStep);
+    nNewSize = std::min(nNewSize, std::max(nEnd, DatabaseFile::getFileSizeLimit()));
+    if(pSegment->m_nAllocStep < g_nMaxBulkAllocStep)
+    {
+        pSegment->m_nAllocStep *= 2u;
+    }
+
+    // the space is taken without writing it, a file system which cannot do so grows the file by the writes
+#if defined (WIN32) || defined (WIN64)
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(pSegment->m_pFile));
+    LARGE_INTEGER nZero, nCurrent, nSize;
+    nZero.QuadPart = 0;
+    nSize.QuadPart = (LONGLONG)nNewSize;
+    if(SetFilePointerEx(hFile, nZero, &nCurrent, FILE_CURRENT))
+    {
+        // the stdio buffer is written at the file pointer, so it goes back where it was
+        if(SetFilePointerEx(hFile, nSize, NULL, FILE_BEGIN))
+        {
+            SetEndOfFile(hFile);
+        }
+        SetFilePointerEx(hFile, nCurrent, NULL, FILE_BEGIN);
+    }
+#else
+    fallocate(fileno(pSegment->m_pFile), 0, (off_t)pSegment->m_nAllocated, (off_t)(nNewSize - pSegment->m_nAllocated));
+#endif
+    pSegment->m_nAllocated = nNewSize;
+}
+
+
+bool BulkLoader::addBlock(const ID &id, const void *pData, unsigned nLength)
+{
+    Segment *pSegment = takeSegment();
+    if(pSegment == NULL)
+    {
+        return false;
+    }
+
+    BlockInIdx block;
+    block.m_id                            = id;
+    block.m_infoDBBlock.m_nDBFile         = 0u;
+    block.m_infoDBBlock.m_gap.m_nPosition = 0u;
+    block.m_infoDBBlock.m_gap.m_nLength   = 0u;
+    block.m_nVersion                      = 0u;
+    block.m_bRemove                       = 0u;
+
+    bool bWritten = true;
+    if(nLength > 0u)
+    {
+        if(pSegment->m_nLength + nLength > DatabaseFile::getFileSizeLimit())
+        {
+            // the segment goes on in a new file
+            bWritten = closeSegmentFile(pSegment) && openSegmentFile(pSegment);
+        }
+
+        if(bWritten)
+        {
+            preallocate(pSegment, nLength);
+            bWritten = (fwrite(pData, nLength, 1, pSegment->m_pFile) == 1u);
+
+            block.m_infoDBBlock.m_nDBFile         = pSegment->m_nDBFile;
+            block.m_infoDBBlock.m_gap.m_nPosition = pSegment->m_nLength;
+            block.m_infoDBBlock.m_gap.m_nLength   = nLength;
+            pSegment->m_nLength += nLength;
+        }
+    }
+
+    if(bWritten)
+    {
+        pSegment->m_vecBlocks.push_back(block);
+    }
+    returnSegment(pSegment, bWritten);
+    return bWritten;
+}
+
+
+bool BulkLoader::finish(std::vector<BlockInIdx> &vecBlocks)
+{
+    vecBlocks.clear();
+
+    // the threads which have taken a segment write their block before they leave
+    while(true)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxSegments);
+            m_bFinishing = true;
+            if(m_nBusySegments == 0u)
+            {
+                break;
+            }
+        }
+        OpenThreads::Thread::microSleep(1000u);
+    }
+
+    bool    bClosed     = !m_bFailed;
+    size_t  nBlockCount = 0u;
+    std::vector<Segment *>::iterator itorSegment = m_vecSegments.begin();
+    for( ; itorSegment != m_vecSegments.end(); ++itorSegment)
+    {
+        Segment *pSegment = *itorSegment;
+        bClosed = closeSegmentFile(pSegment) && bClosed;
+        nBlockCount += pSegment->m_vecBlocks.size();
+    }
+    if(!bClosed)
+    {
+        return false;
+    }
+
+    vecBlocks.reserve(nBlockCount);
+    for(itorSegment = m_vecSegments.begin(); itorSegment != m_vecSegments.end(); ++itorSegment)
+    {
+        std::vector<BlockInIdx> &vecSegmentBlocks = (*itorSegment)->m_vecBlocks;
+        vecBlocks.insert(vecBlocks.end(), vecSegmentBlocks.begin(), vecSegmentBlocks.end());
+        std::vector<BlockInIdx>().swap(vecSegmentBlocks);
+    }
+
+    std::stable_sort(vecBlocks.begin(), vecBlocks.end(), isBlockIDAhead);
+    vecBlocks.erase(std::unique(vecBlocks.begin(), vecBlocks.end(), isSameBlockID), vecBlocks.end());
+    return true;
+}
+
+
+void BulkLoader::cancel(void)
+{
+    std::vector<Segment *>::iterator itorSegment = m_vecSegments.begin();
+    for( ; itorSegment != m_vecSegments.end(); ++itorSegment)
+    {
+        Segment *pSegment = *itorSegment;
+        if(pSegment->m_pFile != NULL)
+        {
+            fclose(pSegment->m_pFile);
+            pSegment->m_pFile = NULL;
+        }
+        std::vector<BlockInIdx>().swap(pSegment->m_vecBlocks);
+    }
+
+    std::vector<unsigned>::const_iterator itorFile = m_vecDBFiles.begin();
+    for( ; itorFile != m_vecDBFiles.end(); ++itorFile)
+    {
+        m_pDataBase->unreserveFile(*itorFile);
+    }
+    m_vecDBFiles.clear();
+}
+
+}
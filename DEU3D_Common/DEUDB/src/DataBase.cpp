@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <sstream>
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 #include "Common/Common.h"
 #include "RoutineManager.h"
 
@@ -27,15 +28,13 @@ DataBase::~DataBase(void)
 }
 
 
-void DataBase::init(const std::string &strDatabase, const FILE_GAP_MAP &mapWhiteGap)
+void DataBase::init(const std::string &strDatabase, const FILE_GAP_MAP &mapGaps, bool bMappedRead, bool bFreeGaps)
 {
     m_strDataBase = strDatabase;
     std::replace(m_strDataBase.begin(), m_strDataBase.end(), '\\', '/');
     for(unsigned n = 0u; ; n++)
     {
-        std::stringstream ss;
-        ss << '_' << n << ms_strDBFileExt;
-        const std::string strDBFilePath = m_strDataBase + ss.str();
+        const std::string strDBFilePath = getDBFilePath(m_strDataBase, n);
         if(n > 0u && !cmm::isFileExist(strDBFilePath))
         {
             // I think I should improve the algorithm here
@@ -43,19 +42,35 @@ void DataBase::init(const std::string &strDatabase, const FILE_GAP_MAP &mapWhite
         }
 
         DatabaseFile *pFile = new DatabaseFile;
-        FILE_GAP_MAP::const_iterator itorGapList = mapWhiteGap.find(n);
-        if(itorGapList != mapWhiteGap.end())
+        FILE_GAP_MAP::const_iterator itorGapList = mapGaps.find(n);
+        if(itorGapList != mapGaps.end())
         {
             const std::vector<FileGap> &vecFileGaps = itorGapList->second;
-            pFile->init(strDBFilePath, vecFileGaps);
+            pFile->init(strDBFilePath, vecFileGaps, bMappedRead, bFreeGaps);
         }
         else
         {
-            pFile->init(strDBFilePath);
+            pFile->init(strDBFilePath, std::vector<FileGap>(), bMappedRead, bFreeGaps);
         }
 
         m_mapDatabaseFiles[n] = pFile;
     }
+
+    // the compaction leaves holes in the numbering, the files behind them are known by their gaps
+    FILE_GAP_MAP::const_iterator itorGapList = mapGaps.begin();
+    for( ; itorGapList != mapGaps.end(); ++itorGapList)
+    {
+        const unsigned nDBFile = itorGapList->first;
+        const std::string strDBFilePath = getDBFilePath(m_strDataBase, nDBFile);
+        if(m_mapDatabaseFiles.find(nDBFile) != m_mapDatabaseFiles.end() || !cmm::isFileExist(strDBFilePath))
+        {
+            continue;
+        }
+
+        DatabaseFile *pFile = new DatabaseFile;
+        pFile->init(strDBFilePath, itorGapList->second, bMappedRead, bFreeGaps);
+        m_mapDatabaseFiles[nDBFile] = pFile;
+    }
 }
 
 
@@ -72,7 +87,8 @@ void DataBase::closeDB(void)
 
 void *DataBase::readBlock(const DBBlockInfo &infoDBBlock)
 {
-    DatabaseFile *pFile = NULL;
+    // the file may be removed by the compaction meanwhile, it is closed when the last reader leaves
+    OpenSP::sp<DatabaseFile> pFile;
 
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> lockDB(m_mtxDataBase);
@@ -88,9 +104,20 @@ void *DataBase::readBlock(const DBBlockInfo &infoDBBlock)
 }
 
 
-bool DataBase::writeBlock(const DBBlockInfo &infoDBBlock, const void *pDataBlock)
+std::string DataBase::getDBFilePath(const std::string &strDatabase, unsigned nDBFile)
+{
+    std::string strDBFilePath = strDatabase;
+    std::replace(strDBFilePath.begin(), strDBFilePath.end(), '\\', '/');
+
+    std::stringstream ss;
+    ss << '_' << nDBFile << ms_strDBFileExt;
+    return strDBFilePath + ss.str();
+}
+
+
+bool DataBase::writeBlock(const DBBlockInfo &infoDBBlock, const void *pDataBlock, bool bFlush)
 {
-    DatabaseFile *pFile = NULL;
+    OpenSP::sp<DatabaseFile> pFile;
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
         std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.find(infoDBBlock.m_nDBFile);
@@ -100,12 +127,36 @@ bool DataBase::writeBlock(const DBBlockInfo &infoDBBlock, const void *pDataBlock
         }
     }
 
-    if(NULL == pFile)
+    if(!pFile.valid())
     {
         return false;
     }
 
-    return pFile->writeBlock(infoDBBlock.m_gap, pDataBlock);
+    return pFile->writeBlock(infoDBBlock.m_gap, pDataBlock, bFlush);
+}
+
+
+bool DataBase::flushFiles(bool bSync)
+{
+    std::vector<OpenSP::sp<DatabaseFile> > vecFiles;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+        std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
+        for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
+        {
+            vecFiles.push_back(itorFile->second);
+        }
+    }
+
+    bool bFlushed = true;
+    for(size_t i = 0u; i < vecFiles.size(); i++)
+    {
+        if(!vecFiles[i]->flushFile(bSync))
+        {
+            bFlushed = false;
+        }
+    }
+    return bFlushed;
 }
 
 
@@ -131,6 +182,11 @@ bool DataBase::allocBlock(unsigned nLength, unsigned &nDBFile, UINT_64 &nPositio
         std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
         for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
         {
+            if(m_setSealedFiles.find(itorFile->first) != m_setSealedFiles.end())
+            {
+                continue;
+            }
+
             DatabaseFile *pFile = itorFile->second;
             nExpectantPosition = pFile->allocBlock(nLength);
 
@@ -157,22 +213,9 @@ bool DataBase::allocBlock(unsigned nLength, unsigned &nDBFile, UINT_64 &nPositio
 
         // current database files cannot fit this memory block, so create an new database file now
 
-        unsigned nNewFileIndex = 0u;
-        for(itorFile = m_mapDatabaseFiles.begin(); itorFile != m_mapDatabaseFiles.end(); ++itorFile)
-        {
-            const unsigned &nFileIndex = itorFile->first;
-            if(nNewFileIndex != nFileIndex)
-            {
-                break;
-            }
-            nNewFileIndex++;
-        }
-
-        std::stringstream ss;
-        ss << '_' << nNewFileIndex << ms_strDBFileExt.c_str();
-
+        const unsigned nNewFileIndex = findFreeFileIndex();
         DatabaseFile *pNewFile = new DatabaseFile;
-        if(!pNewFile->init(m_strDataBase + ss.str()))
+        if(!pNewFile->init(getDBFilePath(m_strDataBase, nNewFileIndex)))
         {
             delete pNewFile;
             return false;
@@ -202,7 +245,7 @@ bool DataBase::allocBlock(unsigned nLength, unsigned &nDBFile, UINT_64 &nPositio
 
 void DataBase::releaseBlock(const DBBlockInfo &infoDBBlock)
 {
-    DatabaseFile *pFile = NULL;
+    OpenSP::sp<DatabaseFile> pFile;
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
         std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.find(infoDBBlock.m_nDBFile);
@@ -212,12 +255,160 @@ void DataBase::releaseBlock(const DBBlockInfo &infoDBBlock)
         }
     }
 
-    if(NULL != pFile)
+    if(pFile.valid())
     {
         pFile->releaseBlock(infoDBBlock.m_gap);
     }
 }
 
 
+void DataBase::getFreeGaps(FILE_GAP_MAP &mapFreeGaps)
+{
+    mapFreeGaps.clear();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
+    for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
+    {
+        DatabaseFile *pFile = itorFile->second;
+        pFile->getFreeGaps(mapFreeGaps[itorFile->first]);
+    }
+}
+
+
+UINT_64 DataBase::getFileSize(void)
+{
+    UINT_64 nFileSize = 0u;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
+    for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
+    {
+        nFileSize += itorFile->second->getFileSize();
+    }
+    return nFileSize;
+}
+
+
+void DataBase::sealFiles(std::set<unsigned> &setSealed)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
+    for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
+    {
+        m_setSealedFiles.insert(itorFile->first);
+    }
+    setSealed = m_setSealedFiles;
+}
+
+
+void DataBase::unsealFiles(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    m_setSealedFiles.clear();
+}
+
+
+bool DataBase::removeFile(unsigned nDBFile)
+{
+    OpenSP::sp<DatabaseFile> pFile;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+        std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.find(nDBFile);
+        if(itorFile == m_mapDatabaseFiles.end() || itorFile->second->getUsedSize() > 0u)
+        {
+            return false;
+        }
+
+        pFile = itorFile->second;
+        m_mapDatabaseFiles.erase(itorFile);
+        m_setSealedFiles.erase(nDBFile);
+    }
+
+    // nobody can find it any more, a reader which has found it before leaves in a moment
+    while(pFile->referenceCount() > 1)
+    {
+        OpenThreads::Thread::microSleep(1000u);
+    }
+    pFile->closeFile();
+    pFile = NULL;
+
+    return (remove(getDBFilePath(m_strDataBase, nDBFile).c_str()) == 0);
+}
+
+
+unsigned DataBase::findFreeFileIndex(void) const
+{
+    unsigned nNewFileIndex = 0u;
+    while(m_mapDatabaseFiles.find(nNewFileIndex) != m_mapDatabaseFiles.end()
+        || m_setReservedFiles.find(nNewFileIndex) != m_setReservedFiles.end())
+    {
+        nNewFileIndex++;
+    }
+    return nNewFileIndex;
+}
+
+
+bool DataBase::reserveFile(unsigned &nDBFile, std::string &strFilePath)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    nDBFile     = findFreeFileIndex();
+    strFilePath = getDBFilePath(m_strDataBase, nDBFile);
+    m_setReservedFiles.insert(nDBFile);
+    return true;
+}
+
+
+bool DataBase::attachFile(unsigned nDBFile, const std::vector<FileGap> &vecBlocks)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    if(m_setReservedFiles.find(nDBFile) == m_setReservedFiles.end())
+    {
+        return false;
+    }
+
+    // everything between the blocks is free space, as in a file opened by init()
+    OpenSP::sp<DatabaseFile> pFile = new DatabaseFile;
+    if(!pFile->init(getDBFilePath(m_strDataBase, nDBFile), vecBlocks))
+    {
+        return false;
+    }
+    m_mapDatabaseFiles[nDBFile] = pFile;
+    m_setReservedFiles.erase(nDBFile);
+    return true;
+}
+
+
+void DataBase::unreserveFile(unsigned nDBFile)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+    if(m_setReservedFiles.erase(nDBFile) > 0u)
+    {
+        remove(getDBFilePath(m_strDataBase, nDBFile).c_str());
+    }
+}
+
+
+UINT_64 DataBase::trimFiles(void)
+{
+    std::vector<OpenSP::sp<DatabaseFile> > vecFiles;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBase);
+        std::map<unsigned, OpenSP::sp<DatabaseFile> >::iterator itorFile = m_mapDatabaseFiles.begin();
+        for( ; itorFile != m_mapDatabaseFiles.end(); ++itorFile)
+        {
+            vecFiles.push_back(itorFile->second);
+        }
+    }
+
+    UINT_64 nTrimmed = 0u;
+    for(size_t i = 0u; i < vecFiles.size(); i++)
+    {
+        nTrimmed += vecFiles[i]->trimFile();
+    }
+    return nTrimmed;
+}
+
+
 }
 
@@ -2,12 +2,19 @@
 #include <OpenThreads/ScopedLock>
 #include <algorithm>
 #include <vector>
-#ifdef WIN32
+#if defined (WIN32) || defined (WIN64)
 #include <io.h>
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
 #endif
 #include "Common/Common.h"
 
 #include "WorkingThreads.h"
+#include "WriteAheadLog.h"
 
 #ifdef max
     #undef max
@@ -26,6 +33,14 @@ DatabaseFile::DatabaseFile(void)
 {
     m_pFile            = NULL;
     m_nCurrentFileSize = 0u;
+#if defined (WIN32) || defined (WIN64)
+    m_hReadFile        = INVALID_HANDLE_VALUE;
+    m_hMapping         = NULL;
+#else
+    m_nReadFile        = -1;
+#endif
+    m_pMappedView      = NULL;
+    m_nMappedSize      = 0u;
 #ifdef WIN32
     m_nAllocFileSize = 16*1024*1024i64;
 #else
@@ -78,7 +93,7 @@ UINT_64 DatabaseFile::getFileLength()
     return nLength;
 }
 
-bool DatabaseFile::init(const std::string &strFilePath, const std::vector<FileGap> &vecWhiteGap)
+bool DatabaseFile::init(const std::string &strFilePath, const std::vector<FileGap> &vecGaps, bool bMappedRead, bool bFreeGaps)
 {
     const bool bIsFileExist = cmm::isFileExist(strFilePath);
     if(bIsFileExist)
@@ -104,56 +119,169 @@ bool DatabaseFile::init(const std::string &strFilePath, const std::vector<FileGa
         return false;
     }
 
-    if(bIsFileExist && !vecWhiteGap.empty())
+    if(!openReadHandle(strFilePath, bMappedRead))
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return false;
+    }
+
+    if(bFreeGaps)
     {
-        std::vector<FileGap>  vecGaps(vecWhiteGap.begin(), vecWhiteGap.end());
-        std::sort(vecGaps.begin(), vecGaps.end(), GapSorter());
-        //listGaps.sort(GapSorter());
+        // the free gaps have been saved when the file was closed
+        std::vector<FileGap>::const_iterator itorGap = vecGaps.begin();
+        for( ; itorGap != vecGaps.end(); ++itorGap)
+        {
+            if(itorGap->m_nPosition >= m_nCurrentFileSize)  continue;
 
-        const FileGap &lastGap = vecGaps.back();
-        UINT_64 nLast = lastGap.m_nPosition + lastGap.m_nLength;
+            const UINT_64 nLength = std::min((UINT_64)itorGap->m_nLength, m_nCurrentFileSize - itorGap->m_nPosition);
+            m_freeSpace.release(itorGap->m_nPosition, nLength);
+        }
+        return true;
+    }
 
-        std::vector<FileGap>::const_iterator itorGap0 = vecGaps.begin();
-        std::vector<FileGap>::const_iterator itorGap1 = vecGaps.begin();
+    // everything between the living blocks is free
+    std::vector<FileGap>  vecWhiteGaps(vecGaps.begin(), vecGaps.end());
+    std::sort(vecWhiteGaps.begin(), vecWhiteGaps.end(), GapSorter());
 
-        if(itorGap0->m_nPosition != 0)
+    UINT_64 nUsedEnd = 0u;
+    std::vector<FileGap>::const_iterator itorGap = vecWhiteGaps.begin();
+    for( ; itorGap != vecWhiteGaps.end(); ++itorGap)
+    {
+        const FileGap &gap = *itorGap;
+        if(gap.m_nPosition > nUsedEnd)
         {
-            FileGap gap;
-            gap.m_nPosition = 0;
-            gap.m_nLength = itorGap0->m_nPosition;
-            m_listBlackGap.push_back(gap);
+            m_freeSpace.release(nUsedEnd, gap.m_nPosition - nUsedEnd);
         }
+        nUsedEnd = std::max(nUsedEnd, gap.m_nPosition + gap.m_nLength);
+    }
 
-        for(++itorGap1 ; itorGap1 != vecGaps.end(); ++itorGap0, ++itorGap1)
-        {
-            const FileGap &gap0 = *itorGap0;
-            const FileGap &gap1 = *itorGap1;
+    if(m_nCurrentFileSize > nUsedEnd)
+    {
+        m_freeSpace.release(nUsedEnd, m_nCurrentFileSize - nUsedEnd);
+    }
+
+    return true;
+}
 
-            const UINT_64 nEndPosition = gap0.m_nPosition + gap0.m_nLength;
-            if(nEndPosition >= gap1.m_nPosition)
+bool DatabaseFile::openReadHandle(const std::string &strFilePath, bool bMappedRead)
+{
+    // The view only covers the file as it is now, blocks allocated after that
+    // are read by position. A 32-bit process cannot map the 20GB segments at all.
+    const bool bCanMap = bMappedRead && (sizeof(void *) >= 8u) && (m_nCurrentFileSize > 0u);
+
+#if defined (WIN32) || defined (WIN64)
+    m_hReadFile = CreateFileA(strFilePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if(m_hReadFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    if(bCanMap)
+    {
+        m_hMapping = CreateFileMappingA(m_hReadFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(m_hMapping != NULL)
+        {
+            m_pMappedView = (const unsigned char *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+            if(m_pMappedView == NULL)
             {
-                continue;
+                CloseHandle(m_hMapping);
+                m_hMapping = NULL;
             }
-
-            FileGap gap;
-            gap.m_nPosition = nEndPosition;
-            gap.m_nLength   = unsigned(gap1.m_nPosition - nEndPosition);
-            m_listBlackGap.push_back(gap);
         }
+    }
+#else
+    m_nReadFile = open(strFilePath.c_str(), O_RDONLY);
+    if(m_nReadFile < 0)
+    {
+        return false;
+    }
 
-        if(m_nCurrentFileSize > nLast)
+    if(bCanMap)
+    {
+        void *pView = mmap(NULL, m_nCurrentFileSize, PROT_READ, MAP_SHARED, m_nReadFile, 0);
+        if(pView != MAP_FAILED)
         {
-            FileGap tempGap;
-            tempGap.m_nPosition = nLast;
-            tempGap.m_nLength = m_nCurrentFileSize - nLast;
-            m_listBlackGap.push_back(tempGap);
+            madvise(pView, m_nCurrentFileSize, MADV_RANDOM);
+            m_pMappedView = (const unsigned char *)pView;
         }
+    }
+#endif
 
+    m_nMappedSize = (m_pMappedView != NULL) ? m_nCurrentFileSize : 0u;
+    return true;
+}
+
+
+void DatabaseFile::closeReadHandle(void)
+{
+#if defined (WIN32) || defined (WIN64)
+    if(m_pMappedView != NULL)
+    {
+        UnmapViewOfFile(m_pMappedView);
+    }
+    if(m_hMapping != NULL)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = NULL;
+    }
+    if(m_hReadFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hReadFile);
+        m_hReadFile = INVALID_HANDLE_VALUE;
     }
+#else
+    if(m_pMappedView != NULL)
+    {
+        munmap((void *)m_pMappedView, m_nMappedSize);
+    }
+    if(m_nReadFile >= 0)
+    {
+        close(m_nReadFile);
+        m_nReadFile = -1;
+    }
+#endif
+    m_pMappedView = NULL;
+    m_nMappedSize = 0u;
+}
+
+
+bool DatabaseFile::readAt(UINT_64 nPosition, void *pBuffer, unsigned nLength) const
+{
+    unsigned char *pTarget = (unsigned char *)pBuffer;
+    while(nLength > 0u)
+    {
+#if defined (WIN32) || defined (WIN64)
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(OVERLAPPED));
+        overlapped.Offset     = (DWORD)(nPosition & 0xFFFFFFFFu);
+        overlapped.OffsetHigh = (DWORD)(nPosition >> 32u);
 
+        DWORD nRead = 0u;
+        if(!ReadFile((HANDLE)m_hReadFile, pTarget, nLength, &nRead, &overlapped) || nRead == 0u)
+        {
+            return false;
+        }
+#else
+        const ssize_t nRead = pread(m_nReadFile, pTarget, nLength, (off_t)nPosition);
+        if(nRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(nRead <= 0)
+        {
+            return false;
+        }
+#endif
+        pTarget   += nRead;
+        nPosition += nRead;
+        nLength   -= (unsigned)nRead;
+    }
     return true;
 }
 
+
 bool DatabaseFile::chFileSize(UINT_64 nSize)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxFile);
@@ -180,219 +308,128 @@ UINT_64 DatabaseFile::allocBlock(unsigned nLength)
         return 0u;
     }
 
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+
     UINT_64 nExpectantPosition = ULLONG_MAX;
+    if(m_freeSpace.alloc(nLength, nExpectantPosition))
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
-        std::list<FileGap>::iterator itorGap = m_listBlackGap.begin();
-        for( ; itorGap != m_listBlackGap.end(); ++itorGap)
+        return nExpectantPosition;
+    }
+
+    if(m_nCurrentFileSize + nLength > m_nFileSizeLimited)
+    {
+        // the memory block will not fit in this file
+        return ULLONG_MAX;
+    }
+    while(m_nAllocFileSize < nLength)
+    {
+        m_nAllocFileSize = m_nAllocFileSize*2;
+    }
+
+    if(m_nCurrentFileSize + m_nAllocFileSize > m_nFileSizeLimited)
+    {
+        m_nAllocFileSize = m_nFileSizeLimited - m_nCurrentFileSize;
+        if(m_nAllocFileSize < nLength)
         {
-            const FileGap &gap = *itorGap;
-            if(gap.m_nLength >= nLength)
-            {
-                break;
-            }
+            return ULLONG_MAX;
         }
+    }
 
-        if(itorGap == m_listBlackGap.end())
+    // the gap at the end of file grows together with the file
+    const UINT_64 nTailLength = m_freeSpace.getGapEndsAt(m_nCurrentFileSize);
+
+    //alloc memory
+    while((m_nAllocFileSize + nTailLength) >= nLength)
+    {
+        if(chFileSize(m_nCurrentFileSize + m_nAllocFileSize))
         {
-            if(m_nCurrentFileSize + nLength > m_nFileSizeLimited)
-            {
-                // the memory block will not fit in this file
-                return ULLONG_MAX;
-            }
-            while(m_nAllocFileSize < nLength)
-            {
-                m_nAllocFileSize = m_nAllocFileSize*2;
-            }
+            m_freeSpace.release(m_nCurrentFileSize, m_nAllocFileSize);
+            m_nCurrentFileSize += m_nAllocFileSize;
 
-            if(m_nCurrentFileSize + m_nAllocFileSize > m_nFileSizeLimited)
-            {
-                m_nAllocFileSize = m_nFileSizeLimited - m_nCurrentFileSize;
-                if(m_nAllocFileSize < nLength)
-                {
-                    return ULLONG_MAX;
-                }
-            }
+            if(m_nAllocFileSize < 1024*1024*1024)
+                m_nAllocFileSize = m_nAllocFileSize*2;
 
-            if(m_listBlackGap.empty())
-            {
-                //alloc memory
-                while(m_nAllocFileSize >= nLength)
-                {
-                    if(chFileSize(m_nCurrentFileSize + m_nAllocFileSize))
-                    {
-                        nExpectantPosition = m_nCurrentFileSize;
-                        m_nCurrentFileSize += m_nAllocFileSize;
-
-                        if((m_nAllocFileSize - nLength) > 0)
-                        {
-
-                            FileGap gapTarget;
-                            gapTarget.m_nPosition = nExpectantPosition + nLength;
-                            gapTarget.m_nLength = m_nAllocFileSize - nLength;
-                            m_listBlackGap.push_back(gapTarget);
-                        }
-
-                        if(m_nAllocFileSize < 1024*1024*1024)
-                            m_nAllocFileSize = m_nAllocFileSize*2;
-                        return nExpectantPosition;
-                    }
-                    else
-                    {
-                        m_nAllocFileSize = m_nAllocFileSize / 2;
-                        continue;
-                    }
-                }
-                return ULLONG_MAX-1;
-            }
-            else
+            if(!m_freeSpace.alloc(nLength, nExpectantPosition))
             {
-                FileGap& lastGap = m_listBlackGap.back();
-                UINT_64 nLastPos = lastGap.m_nPosition;
-                UINT_64 nLastLength = lastGap.m_nLength;
-
-                //alloc memory
-                if((nLastPos + nLastLength) == m_nCurrentFileSize)
-                {
-                    while((m_nAllocFileSize + nLastLength) >= nLength)
-                    {
-                        if(chFileSize(m_nCurrentFileSize + m_nAllocFileSize))
-                        {
-                            nExpectantPosition = nLastPos;
-                            m_nCurrentFileSize += m_nAllocFileSize;
-
-                            if((m_nAllocFileSize + nLastLength - nLength) > 0)
-                            {
-                                lastGap.m_nPosition = nExpectantPosition + nLength;
-                                lastGap.m_nLength = m_nAllocFileSize + nLastLength - nLength;
-                            }
-
-                            if(m_nAllocFileSize < 1024*1024*1024)
-                                m_nAllocFileSize = m_nAllocFileSize*2;
-                            return nExpectantPosition;
-                        }
-                        else
-                        {
-                            m_nAllocFileSize = m_nAllocFileSize / 2;
-                            continue;
-                        }
-                    }
-                }
-                else
-                {
-                    while(m_nAllocFileSize >= nLength)
-                    {
-                        if(chFileSize(m_nCurrentFileSize + m_nAllocFileSize))
-                        {
-                            nExpectantPosition = m_nCurrentFileSize;
-                            m_nCurrentFileSize += m_nAllocFileSize;
-
-                            if((m_nAllocFileSize - nLength) > 0)
-                            {
-
-                                FileGap gapTarget;
-                                gapTarget.m_nPosition = nExpectantPosition + nLength;
-                                gapTarget.m_nLength = m_nAllocFileSize - nLength;
-                                m_listBlackGap.push_back(gapTarget);
-                            }
-
-                            if(m_nAllocFileSize < 1024*1024*1024)
-                                m_nAllocFileSize = m_nAllocFileSize*2;
-                            return nExpectantPosition;
-                        }
-                        else
-                        {
-                            m_nAllocFileSize = m_nAllocFileSize / 2;
-                            continue;
-                        }
-                    }
-                }
                 return ULLONG_MAX-1;
             }
+            return nExpectantPosition;
         }
         else
         {
-            FileGap &gapTarget = *itorGap;
-
-            nExpectantPosition = gapTarget.m_nPosition;
-
-            if(gapTarget.m_nLength == nLength)
-            {
-                m_listBlackGap.erase(itorGap);
-            }
-            else
-            {
-                gapTarget.m_nPosition += nLength;
-                gapTarget.m_nLength   -= nLength;
-            }
+            m_nAllocFileSize = m_nAllocFileSize / 2;
+            continue;
         }
     }
-
-    return nExpectantPosition;
+    return ULLONG_MAX-1;
 }
 
 
 void DatabaseFile::releaseBlock(const FileGap &gap)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+    m_freeSpace.release(gap.m_nPosition, gap.m_nLength);
+}
+
+
+void DatabaseFile::getFreeGaps(std::vector<FileGap> &vecFreeGaps)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+    m_freeSpace.getGaps(vecFreeGaps);
+}
+
+
+UINT_64 DatabaseFile::getFileSize(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+    return m_nCurrentFileSize;
+}
+
+
+UINT_64 DatabaseFile::getUsedSize(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+    return m_nCurrentFileSize - m_freeSpace.getFreeSize();
+}
 
-    if(m_listBlackGap.empty())
+
+UINT_64 DatabaseFile::trimFile(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlack(m_mtxBlackGap);
+
+    // the free gap at the end of file goes back to the file system, but the mapped view keeps its pages
+    const UINT_64 nTailLength = m_freeSpace.getGapEndsAt(m_nCurrentFileSize);
+    const UINT_64 nUsedEnd    = m_nCurrentFileSize - nTailLength;
+    const UINT_64 nNewSize    = std::max(nUsedEnd, m_nMappedSize);
+    if(nTailLength == 0u || nNewSize >= m_nCurrentFileSize)
     {
-        m_listBlackGap.push_back(gap);
-        return;
+        return 0u;
     }
-    std::list<FileGap>::iterator itor0 = m_listBlackGap.begin();
-    while(itor0 != m_listBlackGap.end())
+
+    bool bCut = false;
     {
-        FileGap &gap0 = *itor0;
-        if((gap.m_nPosition + gap.m_nLength) < gap0.m_nPosition)
-        {
-            m_listBlackGap.insert(itor0,gap);
-            return;
-        }
-        else if((gap0.m_nPosition + gap0.m_nLength) < gap.m_nPosition)
-        {
-            itor0++;
-            continue;
-        }
-        else if((gap0.m_nPosition <= (gap.m_nPosition + gap.m_nLength)) && ((gap.m_nPosition + gap.m_nLength) <= (gap0.m_nPosition + gap0.m_nLength)))
-        {
-            gap0.m_nLength = (gap0.m_nPosition + gap0.m_nLength) - std::min(gap0.m_nPosition,gap.m_nPosition);
-            gap0.m_nPosition = std::min(gap0.m_nPosition,gap.m_nPosition);
-            return;
-        }
-        else if((gap.m_nPosition <= (gap0.m_nPosition + gap0.m_nLength)) && ((gap.m_nPosition + gap.m_nLength) >= (gap0.m_nPosition + gap0.m_nLength)))
-        {
-            std::list<FileGap>::iterator itor1 = ++itor0;
-            while(itor1 != m_listBlackGap.end())
-            {
-                FileGap &gap1 = *itor1;
-                if((gap.m_nPosition + gap.m_nLength) < gap1.m_nPosition)
-                {
-                    gap0.m_nPosition = std::min(gap0.m_nPosition,gap.m_nPosition);
-                    gap0.m_nLength = gap.m_nPosition + gap.m_nLength - gap0.m_nPosition;
-                    return;
-                }
-                else if(((gap.m_nPosition + gap.m_nLength) >=  gap1.m_nPosition) && ((gap.m_nPosition + gap.m_nLength) <= (gap1.m_nPosition + gap1.m_nLength)))
-                {
-                    gap0.m_nPosition = std::min(gap0.m_nPosition,gap.m_nPosition);
-                    gap0.m_nLength = gap1.m_nPosition + gap1.m_nLength - gap0.m_nPosition;
-                    m_listBlackGap.erase(itor1);
-                    return;
-                }
-                else
-                {
-                    itor1 = m_listBlackGap.erase(itor1);
-                    continue;
-                }
-            }
-            gap0.m_nPosition = std::min(gap0.m_nPosition,gap.m_nPosition);
-            gap0.m_nLength = gap.m_nPosition + gap.m_nLength - gap0.m_nPosition;
-            return;
-        }
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxFile);
+        fflush(m_pFile);
+#if defined (WIN32) || defined (WIN64)
+        bCut = (_chsize_s(_fileno(m_pFile), nNewSize) == 0);
+#else
+        bCut = (ftruncate(fileno(m_pFile), (off_t)nNewSize) == 0);
+#endif
+    }
+    if(!bCut)
+    {
+        return 0u;
     }
-    m_listBlackGap.push_back(gap);
-    return;
+
+    m_freeSpace.cutGapEndsAt(m_nCurrentFileSize);
+    if(nNewSize > nUsedEnd)
+    {
+        m_freeSpace.release(nUsedEnd, nNewSize - nUsedEnd);
+    }
+
+    const UINT_64 nTrimmed = m_nCurrentFileSize - nNewSize;
+    m_nCurrentFileSize = nNewSize;
+    return nTrimmed;
 }
 
 
@@ -403,43 +440,43 @@ void *DatabaseFile::readBlock(const FileGap &gap)
         return NULL;
     }
 
+    void *pMemory = malloc(gap.m_nLength);
+    if(pMemory == NULL)
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockFile(m_mtxFile);
-#if defined (WIN32) || defined (WIN64)
-        if(_fseeki64(m_pFile, gap.m_nPosition, SEEK_SET) != 0)
-#else
-        if(fseeko(m_pFile, gap.m_nPosition, SEEK_SET) != 0)
-#endif
-        {
-            return NULL;
-        }
+        return NULL;
+    }
 
-        void *pMemory = malloc(gap.m_nLength);
-        if(fread(pMemory, gap.m_nLength, 1, m_pFile) != 1)
-        {
-            free(pMemory);
-            return NULL;
-        }
+    // No lock here, the readers never share a file position
+    if(gap.m_nPosition + gap.m_nLength <= m_nMappedSize)
+    {
+        memcpy(pMemory, m_pMappedView + gap.m_nPosition, gap.m_nLength);
         return pMemory;
     }
 
-    return NULL;
+    if(!readAt(gap.m_nPosition, pMemory, gap.m_nLength))
+    {
+        free(pMemory);
+        return NULL;
+    }
+    return pMemory;
 }
 
 
 void DatabaseFile::closeFile(void)
 {
+    closeReadHandle();
+
     if(NULL != m_pFile)
     {
         fclose(m_pFile);
         m_pFile = NULL;
     }
 
-    m_listBlackGap.clear();
+    m_freeSpace.clear();
 }
 
 
-bool DatabaseFile::writeBlock(const FileGap &gap, const void *pDataBlock)
+bool DatabaseFile::writeBlock(const FileGap &gap, const void *pDataBlock, bool bFlush)
 {
     if(gap.m_nLength <= 0 || !pDataBlock)
     {
@@ -469,11 +506,31 @@ bool DatabaseFile::writeBlock(const FileGap &gap, const void *pDataBlock)
     }
 #endif
     const size_t nRet = fwrite(pDataBlock, gap.m_nLength, 1, m_pFile);
-#ifndef WIN32
-    fflush(m_pFile);
-#endif
+
+    // the readers go around the stdio buffer, so it must reach the file now,
+    // unless the writer keeps the block readable elsewhere until flushFile()
+    if(bFlush)
+    {
+        fflush(m_pFile);
+    }
     return (nRet == 1);
 }
 
 
+bool DatabaseFile::flushFile(bool bSync)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxFile);
+    if(NULL == m_pFile)
+    {
+        return false;
+    }
+
+    if(bSync)
+    {
+        return WriteAheadLog::syncFile(m_pFile);
+    }
+    return (fflush(m_pFile) == 0);
+}
+
+
 }
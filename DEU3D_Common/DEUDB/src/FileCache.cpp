@@ -11,24 +11,87 @@
 #include <OpenSP/sp.h>
 #include "Common/Common.h"
 #include "WorkingThreads.h"
+#include "BlockBuffer.h"
 
 
 namespace deudb
 {
 
 const std::string   g_strIndexFileExt = ".idx";
+const std::string   g_strLogFileExt = ".wal";
+const std::string   g_strSortedIndexFileExt = ".sidx";
+const std::string   g_strDictionaryFileExt = ".zdict";
+const std::string   g_strBloomFileExt = ".bloom";
+const size_t        g_nMaxMaterializedIDs = 262144u;
+const unsigned      g_nCompactionBatchIDs = 4096u;
+const unsigned      g_nMaxCoalescedGap = 65536u;         // readBlocks reads over a free span up to this length
+const unsigned      g_nMaxCoalescedRead = 4194304u;      // rather than starting another I/O, up to this length in all
+const unsigned      g_nScanBatchIDs = 4096u;
+const unsigned      g_nMaxScannedIDs = 65536u;          // a scan lets the writers in after so many IDs, matched or not
+const unsigned      g_nBloomBatchIDs = 16384u;          // a growing bloom filter takes so many IDs under the lock at a time
 const std::string   g_strMirroFix = "_bak";
-const unsigned char g_szIndexFileFlag[8] = {'D', 'E', 'U', 'D', 'B', '\0', '\0', '\0'};
+const UINT_64       g_nUnboundIdxFileLength = ~(UINT_64)0u;  // a sorted index written beside the writers, no .idx ever matches it
 
-struct IdxFileHeader
+
+static bool isSameBlockInfo(const DBBlockInfo &infoLeft, const DBBlockInfo &infoRight)
+{
+    return (infoLeft.m_nDBFile == infoRight.m_nDBFile
+        && infoLeft.m_gap.m_nPosition == infoRight.m_gap.m_nPosition
+        && infoLeft.m_gap.m_nLength == infoRight.m_gap.m_nLength);
+}
+
+
+static bool writeIndexFileHeader(FILE *pFile)
+{
+    IdxFileHeader header;
+    memset(&header, 0, sizeof(IdxFileHeader));
+    memcpy(header.m_szFlag, g_szIndexFileFlag, sizeof(g_szIndexFileFlag));
+    header.m_nVersionNumber = 2u;
+    return (fwrite(&header, sizeof(IdxFileHeader), 1, pFile) == 1u);
+}
+
+
+struct PendingRead
 {
-    unsigned char   m_szFlag[8];        // must be "DEUDB\0\0\0"
-    unsigned char   m_szReserved[8];    // reserved
-    unsigned int    m_nVersionNumber;   // begin from 1
-    unsigned char   m_reserved[20];     // reserved
+    unsigned        m_nIndex;       // in the IDs asked for
+    unsigned        m_nVersion;
+    DBBlockInfo     m_infoDBBlock;
+    OpenSP::sp<IBlockBuffer>    m_pBuffer;
+    bool            m_bRead;
+    bool            m_bCorrupt;
 };
 
 
+static bool isAheadInFile(const DBBlockInfo &infoLeft, const DBBlockInfo &infoRight)
+{
+    if(infoLeft.m_nDBFile != infoRight.m_nDBFile)
+    {
+        return infoLeft.m_nDBFile < infoRight.m_nDBFile;
+    }
+    return infoLeft.m_gap.m_nPosition < infoRight.m_gap.m_nPosition;
+}
+
+
+static bool isPendingAhead(const PendingRead &left, const PendingRead &right)
+{
+    return isAheadInFile(left.m_infoDBBlock, right.m_infoDBBlock);
+}
+
+
+static bool isRecordAhead(const SortedIdxRecord &left, const SortedIdxRecord &right)
+{
+    return isAheadInFile(left.m_blockInIdx.m_infoDBBlock, right.m_blockInIdx.m_infoDBBlock);
+}
+
+
+static bool isInScan(const IDScanRange &range, const ID &id)
+{
+    return ((id.m_nHighBit ^ range.m_idValue.m_nHighBit) & range.m_idMask.m_nHighBit) == 0u
+        && ((id.m_nMidBit  ^ range.m_idValue.m_nMidBit)  & range.m_idMask.m_nMidBit)  == 0u
+        && ((id.m_nLowBit  ^ range.m_idValue.m_nLowBit)  & range.m_idMask.m_nLowBit)  == 0u;
+}
+
+
 IDEUDB *createDEUDB(void)
 {
     OpenSP::sp<FileCache> pFileCache = new FileCache;
@@ -47,22 +110,33 @@ void freeMemory(void *pData)
 }
 
 
-void FileCache::RestrictMemThread::run(void)
+void FileCache::CompactionThread::run(void)
 {
-    while(0u == (unsigned)m_MissionFinished)
-    {
-        m_block.block();
-        const bool bTaskRunOut = m_pFileCache->restrictMemory();
-        if(bTaskRunOut)
-        {
-            suspend(true);
-        }
-    }
+    m_pFileCache->compact();
+}
+
+
+void FileCache::ScrubThread::run(void)
+{
+    m_pFileCache->scrub();
 }
 
 
 FileCache::FileCache(void)
 {
+    m_bMappedRead  = false;
+    m_eCompression = BC_NONE;
+    m_pCompactionThread = NULL;
+    m_bStopCompaction   = false;
+    m_nCompactionRate   = 0u;
+    m_bDropOldVersions  = false;
+    memset(&m_compactionStatus, 0, sizeof(CompactionStatus));
+    m_eVerification = BV_STRICT;
+    m_pScrubThread  = NULL;
+    m_bStopScrub    = false;
+    m_nScrubRate    = 0u;
+    memset(&m_scrubStatus, 0, sizeof(ScrubStatus));
+    m_nRetainedVersions = 0u;
     resetInternalArgs();
 }
 
@@ -75,50 +149,67 @@ FileCache::~FileCache(void)
 
 void FileCache::resetInternalArgs(void)
 {
-    m_nBufferSizeLimited = 256u * 1024u * 1024u;
-    m_nCurrentMemorySize = 0u;
-
-    m_pRestrictMemThread = NULL;
-    m_blockBuffer.release();
-
     m_strDB.clear();
 
     m_bIsOpen = false;
 
     m_nCurPosInIndex = ~0u;
-}
-
+    m_nBlockCount    = 0u;
+    m_bIndexDirty    = false;
+    m_nLastVersion   = 0u;
 
-UINT_64 FileCache::getRefTime(void)
-{
-    UINT_64 nUpdateTime = 0u;
-    cmm::genUniqueValue64(nUpdateTime);
-    return nUpdateTime;
+    m_bGrowingBloomFilter = false;
+    m_vecBloomPending.clear();
 }
 
 
 void FileCache::closeDataBase(void)
 {
     if(!isOpen())   return;
+    endBulkLoad();
+    stopCompaction();
+    stopScrub();
     m_bIsOpen = false;
 
-    m_pRestrictMemThread->finishMission();
-    m_pRestrictMemThread->join();
-    m_pRestrictMemThread = NULL;
-
     m_pRoutineManager = NULL;
 
-    m_pDataBase->closeDB();
-    m_pDataBase = NULL;
+    // the snapshots end with the session, the data they have held becomes free space again
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        m_setSnapshots.clear();
+        releaseRetiredBlocks(true);
+    }
 
-    for(std::map<UINT_64, DataBlock *>::iterator itor = m_mapBlockBuffer.begin(); itor != m_mapBlockBuffer.end(); ++itor)
+    // the delta goes into a new sorted index, so the next openDB does not load the .idx again
+    if(m_bIndexDirty || !m_pSortedIndex.valid())
+    {
+        if(!writeSortedIndex())
+        {
+            std::cout << "Warning: failed to write the sorted index, it will be rebuilt by the next openDB." << std::endl;
+        }
+    }
+    else
+    {
+        m_pSortedIndex->setClean(true);
+    }
+    if(m_pSortedIndex.valid())
     {
-        DataBlock *pBlock = itor->second;
-        free(pBlock->m_pMemory);
+        m_pSortedIndex->close();
+        m_pSortedIndex = NULL;
     }
+    closeBloomFilter();
+
+    m_pDataBase->closeDB();
+    m_pDataBase = NULL;
+
+    m_pBlockCache->clear();
+    m_pBlockCache = NULL;
+    m_pBlockCodec = NULL;
 
-    m_mapBlockBuffer.clear();
     m_mapDataBlocks.clear();
+    m_mapVersion.clear();
+    m_setDetached.clear();
+    m_queueMaterialized.clear();
     m_strDB.clear();
     m_listGapsInIndex.clear();
     resetInternalArgs();
@@ -144,30 +235,71 @@ bool FileCache::openDB(const std::string &strDB, UINT_64 nReadBufferSize, UINT_6
         }
     }
 
-    if(!readIndexFile())
+    // redo the routines that were committed to the log but may not have reached the files
+    const std::string   strLogFilePath = strDB + g_strLogFileExt;
+    const bool bLogPending = cmm::isFileExist(strLogFilePath) && (cmm::getFileLength(strLogFilePath) > 0u);
+    if(!WriteAheadLog::replay(strLogFilePath, strIndexFilePath, strDB))
     {
         return false;
     }
 
-    FILE_GAP_MAP mapWhiteGap;
-    std::map<IDVersion, DataBlock>::const_iterator itorBlock = m_mapDataBlocks.begin();
-    for( ; itorBlock != m_mapDataBlocks.end(); ++itorBlock)
+    FILE_GAP_MAP mapGaps;
+    bool bFreeGaps = false;
+    if(openSortedIndex(!bLogPending))
+    {
+        // only the free gaps are loaded, the records stay in the mapped file
+        bFreeGaps = m_pSortedIndex->getFreeGaps(mapGaps);
+        m_nLastVersion = m_pSortedIndex->getMaxVersion();
+        if(!bFreeGaps)
+        {
+            SortedIdxRecord record;
+            for(UINT_64 n = 0u; n < m_pSortedIndex->getRecordCount(); n++)
+            {
+                m_pSortedIndex->getRecord(n, record);
+                const DBBlockInfo &info = record.m_blockInIdx.m_infoDBBlock;
+                mapGaps[info.m_nDBFile].push_back(info.m_gap);
+            }
+        }
+    }
+    else
+    {
+        // the old loader, the whole .idx goes into the maps
+        if(!readIndexFile())
+        {
+            return false;
+        }
+        m_nBlockCount = m_mapVersion.size();
+
+        std::map<IDVersion, DataBlock>::const_iterator itorBlock = m_mapDataBlocks.begin();
+        for( ; itorBlock != m_mapDataBlocks.end(); ++itorBlock)
+        {
+            const DataBlock &block = itorBlock->second;
+            mapGaps[block.m_infoDBBlock.m_nDBFile].push_back(block.m_infoDBBlock.m_gap);
+            m_nLastVersion = std::max(m_nLastVersion, block.m_nVersion);
+        }
+    }
+
+    // the versions written in a busy second run ahead of the clock, the next ones go on from them
+    m_nLastVersion = std::max(m_nLastVersion, (unsigned)time(NULL));
+
+    m_pBlockCache = new BlockCache;
+    m_pBlockCache->setCapacity(nReadBufferSize);
+    m_nFileReads.exchange(0u);
+
+    m_pBlockCodec = new BlockCodec;
+    m_pBlockCodec->init(strDB + g_strDictionaryFileExt, m_eCompression);
     {
-        const DataBlock &block = itorBlock->second;
-        mapWhiteGap[block.m_infoDBBlock.m_nDBFile].push_back(block.m_infoDBBlock.m_gap);
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+        m_setCorruptIDs.clear();
     }
 
-    m_blockBuffer.release();
-    m_nBufferSizeLimited = nReadBufferSize;
+    openBloomFilter();
 
     m_pDataBase = new DataBase;
-    m_pDataBase->init(m_strDB, mapWhiteGap);
+    m_pDataBase->init(m_strDB, mapGaps, m_bMappedRead, bFreeGaps);
 
     m_pRoutineManager = new RoutineManager;
-    m_pRoutineManager->init(strIndexFilePath, m_pDataBase.get(), nWriteBufferSize);
-
-    m_pRestrictMemThread = new RestrictMemThread(this);
-    m_pRestrictMemThread->startThread();
+    m_pRoutineManager->init(strIndexFilePath, strLogFilePath, m_pDataBase.get(), nWriteBufferSize);
 
     m_bIsOpen = true;
 
@@ -175,6 +307,199 @@ bool FileCache::openDB(const std::string &strDB, UINT_64 nReadBufferSize, UINT_6
 }
 
 
+void FileCache::openBloomFilter(void)
+{
+    // the file only describes the database as it was closed, so it must not be left while it is open
+    const std::string strBloomFilePath = m_strDB + g_strBloomFileExt;
+    OpenSP::sp<BloomFilter> pFilter = BloomFilter::load(strBloomFilePath, m_nBlockCount, cmm::getFileLength(m_strDB + g_strIndexFileExt));
+    remove(strBloomFilePath.c_str());
+    if(!pFilter.valid())
+    {
+        pFilter = buildBloomFilter(BloomFilter::getCapacityFor(m_nBlockCount));
+    }
+
+    m_vecBloomFilters.push_back(pFilter);
+    m_pBloomFilter.assign(pFilter.get(), m_pBloomFilter.get());
+}
+
+
+void FileCache::closeBloomFilter(void)
+{
+    BloomFilter *pFilter = (BloomFilter *)m_pBloomFilter.get();
+    if(pFilter == NULL)
+    {
+        return;
+    }
+
+    // the routine manager is gone, the .idx does not change any more
+    if(!pFilter->save(m_strDB + g_strBloomFileExt, m_nBlockCount, cmm::getFileLength(m_strDB + g_strIndexFileExt)))
+    {
+        std::cout << "Warning: failed to write the bloom filter, it will be rebuilt by the next openDB." << std::endl;
+    }
+    m_pBloomFilter.assign(NULL, pFilter);
+    m_vecBloomFilters.clear();
+}
+
+
+BloomFilter *FileCache::buildBloomFilter(UINT_64 nCapacity) const
+{
+    OpenSP::sp<BloomFilter> pFilter = new BloomFilter(nCapacity);
+
+    // the base records of the IDs removed meanwhile get in as well, they only cost some false positives
+    if(m_pSortedIndex.valid())
+    {
+        SortedIdxRecord record;
+        ID              idLast;
+        for(UINT_64 n = 0u; n < m_pSortedIndex->getRecordCount(); n++)
+        {
+            m_pSortedIndex->getRecord(n, record);
+            if(n == 0u || record.m_blockInIdx.m_id != idLast)
+            {
+                idLast = record.m_blockInIdx.m_id;
+                pFilter->insert(idLast);
+            }
+        }
+    }
+
+    std::map<ID, VersionList>::const_iterator itorVersion = m_mapVersion.begin();
+    for( ; itorVersion != m_mapVersion.end(); ++itorVersion)
+    {
+        pFilter->insert(itorVersion->first);
+    }
+
+    // a snapshot may still read the IDs removed since it was taken
+    std::map<ID, std::vector<RetiredBlock> >::const_iterator itorRetired = m_mapRetired.begin();
+    for( ; itorRetired != m_mapRetired.end(); ++itorRetired)
+    {
+        pFilter->insert(itorRetired->first);
+    }
+    return pFilter.release();
+}
+
+
+bool FileCache::mayExist(const ID &id) const
+{
+    const BloomFilter *pFilter = (const BloomFilter *)m_pBloomFilter.get();
+    return (pFilter == NULL || pFilter->mayContain(id));
+}
+
+
+void FileCache::addToBloomFilter(const ID &id)
+{
+    BloomFilter *pFilter = (BloomFilter *)m_pBloomFilter.get();
+    pFilter->insert(id);
+    if(m_bGrowingBloomFilter)
+    {
+        m_vecBloomPending.push_back(id);
+    }
+}
+
+
+void FileCache::collectBloomIDs(bool bBase, const ID *pAfter, std::vector<ID> &vecIDs) const
+{
+    vecIDs.clear();
+    if(!bBase)
+    {
+        std::map<ID, VersionList>::const_iterator itorVersion = (pAfter != NULL) ? m_mapVersion.upper_bound(*pAfter) : m_mapVersion.begin();
+        for( ; itorVersion != m_mapVersion.end() && vecIDs.size() < g_nBloomBatchIDs; ++itorVersion)
+        {
+            vecIDs.push_back(itorVersion->first);
+        }
+        return;
+    }
+
+    // the records of the IDs removed meanwhile get in as well, they only cost some false positives
+    if(!m_pSortedIndex.valid())
+    {
+        return;
+    }
+    SortedIdxRecord record;
+    UINT_64 nRecord = (pAfter != NULL) ? m_pSortedIndex->lowerBound(*pAfter) : 0u;
+    for( ; nRecord < m_pSortedIndex->getRecordCount() && vecIDs.size() < g_nBloomBatchIDs; nRecord++)
+    {
+        m_pSortedIndex->getRecord(nRecord, record);
+        const ID &id = record.m_blockInIdx.m_id;
+        if((pAfter != NULL && !(*pAfter < id)) || (!vecIDs.empty() && vecIDs.back() == id))
+        {
+            continue;
+        }
+        vecIDs.push_back(id);
+    }
+}
+
+
+void FileCache::growBloomFilter(void)
+{
+    BloomFilter *pFull = (BloomFilter *)m_pBloomFilter.get();
+    if(pFull == NULL || !pFull->isFull())
+    {
+        return;
+    }
+
+    // the full filter stays in use meanwhile, it only lets some more absent IDs through
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        if(m_bGrowingBloomFilter || m_pBloomFilter.get() != pFull)
+        {
+            // another writer grows it
+            return;
+        }
+        m_bGrowingBloomFilter = true;
+        m_vecBloomPending.clear();
+    }
+    OpenSP::sp<BloomFilter> pBigger = new BloomFilter(pFull->getCapacity() * 2u);
+
+    // The delta goes first, an ID which a rebase moves out of it meanwhile is in the base read
+    // next. The IDs the writers add from now on are kept in m_vecBloomPending.
+    std::vector<ID> vecIDs;
+    for(unsigned nSource = 0u; nSource < 2u; nSource++)
+    {
+        ID   idLast;
+        bool bFirstBatch = true;
+        while(true)
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+                collectBloomIDs(nSource == 1u, bFirstBatch ? NULL : &idLast, vecIDs);
+            }
+            if(vecIDs.empty())
+            {
+                break;
+            }
+
+            for(size_t n = 0u; n < vecIDs.size(); n++)
+            {
+                pBigger->insert(vecIDs[n]);
+            }
+            idLast      = vecIDs.back();
+            bFirstBatch = false;
+        }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+    for(size_t n = 0u; n < m_vecBloomPending.size(); n++)
+    {
+        pBigger->insert(m_vecBloomPending[n]);
+    }
+
+    // a snapshot may still read the IDs removed since it was taken
+    std::map<ID, std::vector<RetiredBlock> >::const_iterator itorRetired = m_mapRetired.begin();
+    for( ; itorRetired != m_mapRetired.end(); ++itorRetired)
+    {
+        pBigger->insert(itorRetired->first);
+    }
+    m_vecBloomPending.clear();
+    m_bGrowingBloomFilter = false;
+
+    // the end of a bulk load may have put a filter of its own in place meanwhile
+    if(m_pBloomFilter.get() == pFull)
+    {
+        m_vecBloomFilters.push_back(pBigger);
+        m_pBloomFilter.assign(pBigger.get(), pFull);
+    }
+}
+
+
 bool FileCache::createNewIndexFile(void) const
 {
     if(m_strDB.empty()) return false;
@@ -324,10 +649,9 @@ bool FileCache::readIndexFile_v1(const unsigned char *pIndexBuffer, unsigned nBu
             //save datablock
             DataBlock blockItem;
             blockItem.m_infoDBBlock  = blockInIdx.m_infoDBBlock;
-            blockItem.m_pMemory      = NULL;
-            blockItem.m_nLastRefTime = 0u;
             blockItem.m_nPosInIndex  = nBufferPos + nInfoOffset;
             blockItem.m_nVersion     = blockInIdx.m_nVersion;
+            blockItem.m_bInBase      = false;
 
             IDVersion idVersion(blockInIdx.m_id,blockInIdx.m_nVersion);
             m_mapDataBlocks[idVersion] = blockItem;
@@ -393,10 +717,9 @@ bool FileCache::readIndexFile_v2(const unsigned char *pIndexBuffer, unsigned nBu
             //save datablock
             DataBlock blockItem;
             blockItem.m_infoDBBlock  = blockInIdx.m_infoDBBlock;
-            blockItem.m_pMemory      = NULL;
-            blockItem.m_nLastRefTime = 0u;
             blockItem.m_nPosInIndex  = nBufferPos + nInfoOffset;
             blockItem.m_nVersion     = blockInIdx.m_nVersion;
+            blockItem.m_bInBase      = false;
 
             IDVersion idVersion(blockInIdx.m_id,blockInIdx.m_nVersion);
             m_mapDataBlocks[idVersion] = blockItem;
@@ -416,677 +739,2573 @@ bool FileCache::readIndexFile_v2(const unsigned char *pIndexBuffer, unsigned nBu
     return true;
 }
 
-void FileCache::closeDB(void)
-{
-    closeDataBase();
-}
-
-
-bool FileCache::isOpen(void) const
-{
-    return m_bIsOpen;
-}
-
-
-bool FileCache::isExist(const ID &id) const
+bool FileCache::openSortedIndex(bool bTrustExisting)
 {
-    if(!isOpen())   return false;
+    const std::string   strIndexFilePath  = m_strDB + g_strIndexFileExt;
+    const std::string   strSortedFilePath = m_strDB + g_strSortedIndexFileExt;
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
-    std::map<ID, VersionList>::const_iterator itorFind = m_mapVersion.find(id);
-    if(itorFind == m_mapVersion.end())
+    OpenSP::sp<SortedIndex> pSortedIndex = new SortedIndex;
+    bool bOpened = bTrustExisting && pSortedIndex->open(strSortedFilePath, cmm::getFileLength(strIndexFilePath));
+    if(!bOpened)
     {
-        return false;
+        // it is missing or stale, so build it from the .idx without the maps
+        if(SortedIndex::convert(strIndexFilePath, strSortedFilePath))
+        {
+            bOpened = pSortedIndex->open(strSortedFilePath, cmm::getFileLength(strIndexFilePath));
+        }
     }
-    return true;
-}
-
-
-std::vector<unsigned> FileCache::getVersion(const ID &id) const
-{
-    VersionList vList;
-    if(!isOpen())   return vList;
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
-    std::map<ID, VersionList>::const_iterator itorFind = m_mapVersion.find(id);
-    if(itorFind == m_mapVersion.end())
+    if(!bOpened || !pSortedIndex->setClean(false))
     {
-        return vList;
+        // the old loader takes over, a file left behind would be stale after this session
+        pSortedIndex->close();
+        remove(strSortedFilePath.c_str());
+        return false;
     }
 
-    return itorFind->second;
+    m_pSortedIndex   = pSortedIndex;
+    m_nCurPosInIndex = cmm::getFileLength(strIndexFilePath);
+    m_nBlockCount    = (unsigned)pSortedIndex->getIDCount();
+    pSortedIndex->getIndexGaps(m_listGapsInIndex);
+    return true;
 }
 
 
-bool FileCache::readBlock(const ID &id, void *&pBuffer, unsigned &nLength,const unsigned& nVersion)
+bool FileCache::mergeRecords(const SortedIndex *pBase, const std::map<IDVersion, DataBlock> &mapDataBlocks, const std::map<ID, VersionList> &mapVersion,
+                             const std::set<ID> &setDetached, const std::vector<BlockInIdx> *pLoaded, unsigned nLoadedPos,
+                             SortedIndex::Writer &writer, FILE *pDenseFile)
 {
-    if(!isOpen())   return false;
-
-    m_blockBuffer.block();
-
+    // a dense .idx gets the records in the same order without any gap, the sorted index follows its slots
+    unsigned        nDensePos    = sizeof(IdxFileHeader);
+    const UINT_64   nBaseCount   = (pBase != NULL) ? pBase->getRecordCount() : 0u;
+    UINT_64         nBase        = 0u;
+    SortedIdxRecord recordBase;
+    bool            bBaseValid   = false;
+    const size_t    nLoadedCount = (pLoaded != NULL) ? pLoaded->size() : 0u;
+    size_t          nLoaded      = 0u;
+    std::map<IDVersion, DataBlock>::const_iterator itorBlock = mapDataBlocks.begin();
+    while(true)
     {
-        // 1. Check if such id cannot be found
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
-        std::map<ID, VersionList>::iterator itorVersion = m_mapVersion.find(id);
-        if(itorVersion == m_mapVersion.end())
+        while(!bBaseValid && nBase < nBaseCount)
         {
-            nLength = 0u;
-            pBuffer = NULL;
-            return false;
+            pBase->getRecord(nBase++, recordBase);
+            const ID &id = recordBase.m_blockInIdx.m_id;
+            bBaseValid = (mapVersion.find(id) == mapVersion.end() && setDetached.find(id) == setDetached.end());
         }
 
-        // 2. Get proper version
-        unsigned curVersion;
-        if(nVersion == 0)
+        const bool bDeltaValid  = (itorBlock != mapDataBlocks.end());
+        const bool bLoadedValid = (nLoaded < nLoadedCount);
+        if(!bBaseValid && !bDeltaValid && !bLoadedValid)
         {
-            curVersion = itorVersion->second[itorVersion->second.size()-1];
+            break;
         }
-        else
+
+        SortedIdxRecord record;
+        if(bLoadedValid && (!bBaseValid || (*pLoaded)[nLoaded].m_id < recordBase.m_blockInIdx.m_id)
+            && (!bDeltaValid || (*pLoaded)[nLoaded].m_id < itorBlock->first.getID()))
         {
-            VersionList vList = itorVersion->second;
-            if(nVersion < vList[0])
-            {
-                return false;
-            }
-            else if(nVersion >= vList[vList.size() - 1])
-            {
-                curVersion = vList[vList.size() - 1];
-            }
-            else
-            {
-                for(unsigned n = 0;n < vList.size() - 1;n++)
-                {
-                    if(vList[n] <= nVersion && nVersion < vList[n+1])
-                    {
-                        curVersion = vList[n];
-                    }
-                }
-            }
-            
+            // the IDs of a bulk load are in neither of the others, their records lie one after another in the .idx
+            record.m_blockInIdx  = (*pLoaded)[nLoaded];
+            record.m_nPosInIndex = nLoadedPos + (unsigned)(nLoaded * sizeof(BlockInIdx));
+            nLoaded++;
         }
-        IDVersion idVersion(id,curVersion);
-
-        // 3. Such id is found
-        std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(idVersion);
-        if(itorBlock == m_mapDataBlocks.end())
+        else if(bBaseValid && (!bDeltaValid || IDVersion(recordBase.m_blockInIdx.m_id, recordBase.m_blockInIdx.m_nVersion) < itorBlock->first))
         {
-            nLength = 0u;
-            pBuffer = NULL;
-            return false;
+            record     = recordBase;
+            bBaseValid = false;
         }
-        DataBlock &block = itorBlock->second;
-        if(block.m_infoDBBlock.m_gap.m_nLength == 0u)
+        else
         {
-            // it is an zero-length block, so it does not need to read
-            pBuffer = NULL;
-            nLength = 0u;
-            return true;
+            const DataBlock &block = itorBlock->second;
+            record.m_blockInIdx.m_id          = itorBlock->first.getID();
+            record.m_blockInIdx.m_infoDBBlock = block.m_infoDBBlock;
+            record.m_blockInIdx.m_nVersion    = block.m_nVersion;
+            record.m_blockInIdx.m_bRemove     = 0u;
+            record.m_nPosInIndex              = block.m_nPosInIndex;
+            ++itorBlock;
         }
 
-        // 4. It is not in the cache, so we must read it from db file or routine manager
-        if(!block.m_pMemory)
+        if(NULL != pDenseFile)
         {
-            // 3.1. read from routine manager
-            block.m_pMemory = m_pRoutineManager->readRoutineBlock(id);
-
-            // 3.2. read from db file
-            if(!block.m_pMemory)
+            record.m_nPosInIndex = nDensePos;
+            nDensePos += sizeof(BlockInIdx);
+            if(fwrite(&record.m_blockInIdx, sizeof(BlockInIdx), 1, pDenseFile) != 1u)
             {
-                block.m_pMemory = m_pDataBase->readBlock(block.m_infoDBBlock);
-                if(!block.m_pMemory)
-                {
-                    // so bad, disk error !!
-                    nLength = 0u;
-                    pBuffer = NULL;
-                    return false;
-                }
+                return false;
             }
         }
 
-        // 4. Update the reference-time
-        const bool bShouldErase = (block.m_nLastRefTime != 0u);
-        if(bShouldErase)
-        {
-            m_mapBlockBuffer.erase(block.m_nLastRefTime);
-        }
-        block.m_nLastRefTime = getRefTime();
-        m_mapBlockBuffer[block.m_nLastRefTime] = &block;
-
-        // 5. Alloc memory
-        pBuffer = malloc(block.m_infoDBBlock.m_gap.m_nLength);
-        memcpy(pBuffer, block.m_pMemory, block.m_infoDBBlock.m_gap.m_nLength);
-        nLength = block.m_infoDBBlock.m_gap.m_nLength;
-
-        if(!bShouldErase)
-        {
-            m_nCurrentMemorySize += nLength;
-        }
-
-        if(m_nCurrentMemorySize > m_nBufferSizeLimited)
+        if(!writer.append(record))
         {
-            m_blockBuffer.set(false);
-            m_pRestrictMemThread->suspend(false);
+            return false;
         }
     }
-
     return true;
 }
 
 
-bool FileCache::removeBlock(const ID &id)
+bool FileCache::writeSortedIndex(const std::vector<BlockInIdx> *pLoaded, unsigned nLoadedPos)
 {
-    if(!isOpen())   return false;
+    const std::string   strIndexFilePath  = m_strDB + g_strIndexFileExt;
+    const std::string   strSortedFilePath = m_strDB + g_strSortedIndexFileExt;
 
+    SortedIndex::Writer writer;
+    if(!writer.begin(strSortedFilePath))
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
-        std::map<ID,VersionList>::iterator itorVersion = m_mapVersion.find(id);
-        if(itorVersion == m_mapVersion.end())
-        {
-            return true;
-        }
-
-        VersionList vList = itorVersion->second;
-        
-        for(unsigned n = 0;n < vList.size();n++)
-        {
-            DBBlockInfo infoDBBlockOld;
-            void    *pMemDelete = NULL;
-            Routine routine;
-
-            IDVersion idVersion(id,vList[n]);
-
-            std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
-            if(itorFind == m_mapDataBlocks.end())
-            {
-                continue;
-            }
-
-            const DataBlock &block = itorFind->second;
-            infoDBBlockOld = block.m_infoDBBlock;
-            pMemDelete     = block.m_pMemory;
-
-            m_listGapsInIndex.push_back(block.m_nPosInIndex);
-            routine.m_nPosInIndex = block.m_nPosInIndex;
+        return false;
+    }
 
-            const size_t nOldSize  = m_mapBlockBuffer.size();
-            m_mapBlockBuffer.erase(block.m_nLastRefTime);
-            m_mapDataBlocks.erase(itorFind);
+    // merge the records still valid in the old file with the delta and the bulk load
+    if(!mergeRecords(m_pSortedIndex.get(), m_mapDataBlocks, m_mapVersion, m_setDetached, pLoaded, nLoadedPos, writer, NULL))
+    {
+        writer.cancel();
+        return false;
+    }
 
-            if(m_mapBlockBuffer.size() < nOldSize)
-            {
-                m_nCurrentMemorySize -= infoDBBlockOld.m_gap.m_nLength;
-                if(m_nCurrentMemorySize <= m_nBufferSizeLimited)
-                {
-                    m_blockBuffer.release();
-                }
-            }
-            routine.m_eRoutineType = Routine::RT_REMOVE;
-            routine.m_pDataBlock = NULL;
-            m_pRoutineManager->addRoutine(id, routine);
-            m_pDataBase->releaseBlock(infoDBBlockOld);
-            if(pMemDelete)
-            {
-                free(pMemDelete);
-            }
-        }
+    FILE_GAP_MAP mapFreeGaps;
+    m_pDataBase->getFreeGaps(mapFreeGaps);
 
-        m_mapVersion.erase(itorVersion);
+    if(m_pSortedIndex.valid())
+    {
+        m_pSortedIndex->close();
+        m_pSortedIndex = NULL;
     }
-
-    return true;
+    return writer.finish(cmm::getFileLength(strIndexFilePath), m_listGapsInIndex, &mapFreeGaps);
 }
 
 
-bool FileCache::addBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
+bool FileCache::rebaseLoadedIndex(const std::vector<BlockInIdx> &vecLoaded, unsigned nLoadedPos)
 {
-    if(!isOpen())   return false;
+    // the sorted index is checked against the length of the .idx, so every routine must be in it
+    m_pRoutineManager->flush(false);
 
-    unsigned curVersion = time(NULL);
-    if(curVersion == -1)
+    // a bulk load is only in the .idx, so even a failed write goes on to the reload below
+    const bool bWritten = writeSortedIndex(&vecLoaded, nLoadedPos);
+
+    m_mapDataBlocks.clear();
+    m_mapVersion.clear();
+    m_setDetached.clear();
+    m_queueMaterialized.clear();
+    m_listGapsInIndex.clear();
+    m_bIndexDirty = false;
+    if(bWritten && openSortedIndex(true))
     {
-        return false;
+        return true;
     }
 
-    Routine routine;
-    routine.m_eRoutineType = Routine::RT_ADD;
-    routine.m_nVersion = curVersion;
+    // the .idx holds everything after the flush, the old loader takes over
+    std::cout << "Warning: failed to reopen the sorted index, the whole index is loaded." << std::endl;
+    m_pSortedIndex = NULL;
+    m_bIndexDirty  = true;
+    readIndexFile();
+    m_nBlockCount = m_mapVersion.size();
+    return bWritten;
+}
+
 
-    m_blockBuffer.block();
+bool FileCache::rebaseIndex(bool bDense)
+{
+    const std::string   strIndexFilePath  = m_strDB + g_strIndexFileExt;
+    const std::string   strSortedFilePath = m_strDB + g_strSortedIndexFileExt;
+    const std::string   strNewSortedPath  = strSortedFilePath + ".new";
+    const std::string   strDenseFilePath  = strIndexFilePath + ".tmp";
 
+    // 1. copy the delta, the mapped base file does not change until it is swapped below
+    IndexSnapshot snapshot;
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
-
-        std::map<ID, VersionList>::const_iterator itorFind = m_mapVersion.find(id);
-        if(itorFind != m_mapVersion.end())
+        if(!bDense && !m_pSortedIndex.valid())
         {
-            // It already exist in data base
             return false;
         }
+        snapshot.m_pBase           = m_pSortedIndex;
+        snapshot.m_mapDataBlocks   = m_mapDataBlocks;
+        snapshot.m_mapVersion      = m_mapVersion;
+        snapshot.m_setDetached     = m_setDetached;
+        snapshot.m_listGapsInIndex = m_listGapsInIndex;
+        m_pDataBase->getFreeGaps(snapshot.m_mapFreeGaps);
+    }
 
-        unsigned  nDBFileIndex = 0u;
-        UINT_64   nPosition    = 0u;
-        const bool bEmptyBlock = (NULL == pBuffer || 0u == nBufLen);
-        if(!bEmptyBlock)
+    // 2. write the new files from the copy while the writers go on
+    SortedIndex::Writer writer;
+    if(!writer.begin(strNewSortedPath))
+    {
+        return false;
+    }
+
+    FILE *pDenseFile = NULL;
+    if(bDense)
+    {
+        pDenseFile = fopen(strDenseFilePath.c_str(), "wb");
+        if(NULL == pDenseFile || !writeIndexFileHeader(pDenseFile))
         {
-            if(!m_pDataBase->allocBlock(nBufLen, nDBFileIndex, nPosition))
+            if(NULL != pDenseFile)
             {
-                // Disk error, so bad !! unable to find a gap to fit the new block!!
-                return false;
+                fclose(pDenseFile);
+                remove(strDenseFilePath.c_str());
             }
+            writer.cancel();
+            return false;
         }
+    }
 
-        VersionList &vList = m_mapVersion[id];
-        vList.push_back(curVersion);
+    bool bWritten = mergeRecords(snapshot.m_pBase.get(), snapshot.m_mapDataBlocks, snapshot.m_mapVersion, snapshot.m_setDetached,
+                                 NULL, 0u, writer, pDenseFile);
+    if(NULL != pDenseFile)
+    {
+        bWritten = WriteAheadLog::syncFile(pDenseFile) && bWritten;
+        fclose(pDenseFile);
+    }
 
-        IDVersion idVersion(id,curVersion);
+    // the .idx changes under the writers meanwhile, so the file is not bound to any length of it, a crash
+    // makes the next openDB rebuild it and closeDB writes it once more
+    const std::list<unsigned> listNoGaps;
+    bWritten = bWritten && writer.finish(g_nUnboundIdxFileLength, bDense ? listNoGaps : snapshot.m_listGapsInIndex, &snapshot.m_mapFreeGaps);
+    if(!bWritten)
+    {
+        writer.cancel();
+        remove(strNewSortedPath.c_str());
+        remove(strDenseFilePath.c_str());
+        return false;
+    }
 
-        DataBlock &block                      = m_mapDataBlocks[idVersion];
-        block.m_nLastRefTime                  = getRefTime();
-        block.m_infoDBBlock.m_nDBFile         = nDBFileIndex;
-        block.m_infoDBBlock.m_gap.m_nPosition = nPosition;
-        block.m_nVersion                      = curVersion;
+    // 3. only the swap and the records changed meanwhile are left for under the lock
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
 
-        if(bEmptyBlock)
-        {
-            block.m_infoDBBlock.m_gap.m_nLength = 0u;
-            block.m_pMemory = NULL;
-        }
-        else
-        {
-            block.m_infoDBBlock.m_gap.m_nLength = nBufLen;
-            block.m_pMemory = malloc(nBufLen);
-            memcpy(block.m_pMemory, pBuffer, nBufLen);
-        }
-        if(m_listGapsInIndex.empty())
+    std::set<ID> setChanged;
+    findChangedIDs(snapshot, setChanged);
+
+    if(bDense)
+    {
+        // the routines queued meanwhile address the slots of the old .idx, they must be in it before it goes
+        m_pRoutineManager->flush(false);
+
+        std::map<IDVersion, unsigned>   mapNewPos;
+        std::list<unsigned>             listStale;
+        unsigned                        nIndexEnd = 0u;
+        if(!patchDenseIndex(strDenseFilePath, setChanged, mapNewPos, listStale, nIndexEnd)
+            || !m_pRoutineManager->replaceIndexFile(strIndexFilePath, strDenseFilePath))
         {
-            block.m_nPosInIndex = m_nCurPosInIndex;
-            m_nCurPosInIndex += sizeof(BlockInIdx);
+            remove(strDenseFilePath.c_str());
+            remove(strNewSortedPath.c_str());
+            return false;
         }
-        else
+
+        std::map<IDVersion, unsigned>::const_iterator itorPos = mapNewPos.begin();
+        for( ; itorPos != mapNewPos.end(); ++itorPos)
         {
-            block.m_nPosInIndex = m_listGapsInIndex.front();
-            m_listGapsInIndex.erase(m_listGapsInIndex.begin());
+            m_mapDataBlocks[itorPos->first].m_nPosInIndex = itorPos->second;
         }
+        m_listGapsInIndex = listStale;
+        m_nCurPosInIndex  = nIndexEnd;
+    }
 
-        m_mapBlockBuffer[block.m_nLastRefTime] = &block;
+    if(m_pSortedIndex.valid())
+    {
+        m_pSortedIndex->close();
+        m_pSortedIndex = NULL;
+    }
+    snapshot.m_pBase = NULL;
 
-        m_nCurrentMemorySize += block.m_infoDBBlock.m_gap.m_nLength;
-        if(m_nCurrentMemorySize > m_nBufferSizeLimited)
+    // the old file must not be mapped any more
+    remove(strSortedFilePath.c_str());
+    OpenSP::sp<SortedIndex> pSortedIndex = new SortedIndex;
+    if(rename(strNewSortedPath.c_str(), strSortedFilePath.c_str()) == 0
+        && pSortedIndex->open(strSortedFilePath, g_nUnboundIdxFileLength) && pSortedIndex->setClean(false))
+    {
+        // the unchanged IDs are in the new file as the maps have them, the changed ones stay in the delta over it
+        std::map<IDVersion, DataBlock>::iterator itorBlock = m_mapDataBlocks.begin();
+        while(itorBlock != m_mapDataBlocks.end())
         {
-            m_blockBuffer.set(false);
-            m_pRestrictMemThread->suspend(false);
+            if(setChanged.find(itorBlock->first.getID()) == setChanged.end())
+            {
+                m_mapDataBlocks.erase(itorBlock++);
+                continue;
+            }
+            itorBlock->second.m_bInBase = false;
+            ++itorBlock;
         }
 
-        routine.m_nPosInIndex = block.m_nPosInIndex;
-        routine.m_infoDBBlock.m_nDBFile = nDBFileIndex;
-        routine.m_infoDBBlock.m_gap     = block.m_infoDBBlock.m_gap;
-
-        if(NULL == pBuffer || 0u == nBufLen)
+        std::map<ID, VersionList>::iterator itorVersion = m_mapVersion.begin();
+        while(itorVersion != m_mapVersion.end())
         {
-            routine.m_pDataBlock = NULL;
+            if(setChanged.find(itorVersion->first) == setChanged.end())
+            {
+                m_mapVersion.erase(itorVersion++);
+                continue;
+            }
+            ++itorVersion;
         }
-        else
+
+        m_setDetached.swap(setChanged);
+        m_queueMaterialized.clear();
+        m_pSortedIndex = pSortedIndex;
+        m_bIndexDirty  = true;
+        if(m_setDetached.empty())
         {
-            routine.m_pDataBlock = malloc(nBufLen);
-            memcpy(routine.m_pDataBlock, pBuffer, nBufLen);
+            m_nBlockCount = (unsigned)pSortedIndex->getIDCount();
         }
+        return true;
     }
 
-    m_pRoutineManager->addRoutine(id, routine);
+    // the old loader takes over once the .idx holds every routine
+    std::cout << "Warning: failed to reopen the sorted index, the whole index is loaded." << std::endl;
+    pSortedIndex->close();
+    remove(strSortedFilePath.c_str());
+    remove(strNewSortedPath.c_str());
+    m_pRoutineManager->flush(false);
 
-    return 1;
+    m_mapDataBlocks.clear();
+    m_mapVersion.clear();
+    m_setDetached.clear();
+    m_queueMaterialized.clear();
+    m_listGapsInIndex.clear();
+    m_bIndexDirty = true;
+    readIndexFile();
+    m_nBlockCount = m_mapVersion.size();
+    return false;
 }
 
-bool FileCache::replaceBlock(const ID &id, const void *pNewBuffer, unsigned nNewBufLen)
-{
-    if(!isOpen())   return false;
 
-    unsigned curVersion = time(NULL);
-    if(curVersion == -1)
-    {
-        return false;
-    }
+bool FileCache::getDeltaRecords(const std::map<IDVersion, DataBlock> &mapDataBlocks, const std::map<ID, VersionList> &mapVersion,
+                                const std::set<ID> &setDetached, const ID &id, std::vector<DataBlock> &vecBlocks)
+{
+    vecBlocks.clear();
 
-    unsigned nDBFileForNew  = 0u;
-    UINT_64 nPositionForNew = 0u;
-    const bool bEmptyBlock  = (NULL == pNewBuffer || 0u == nNewBufLen);
-    if(!bEmptyBlock)
+    bool bInBase = true;
+    if(mapVersion.find(id) != mapVersion.end())
     {
-        if(!m_pDataBase->allocBlock(nNewBufLen, nDBFileForNew, nPositionForNew))
+        std::map<IDVersion, DataBlock>::const_iterator itorBlock = mapDataBlocks.lower_bound(IDVersion(id, 0u));
+        for( ; itorBlock != mapDataBlocks.end() && itorBlock->first.getID() == id; ++itorBlock)
         {
-            // Disk error, so bad !! unable to find a gap for the new data!!
-            return false;
+            vecBlocks.push_back(itorBlock->second);
+            bInBase = bInBase && itorBlock->second.m_bInBase;
         }
     }
 
-    void   *pMemoryNew = NULL;
-    Routine routine;
-    routine.m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
-    routine.m_infoDBBlock.m_gap.m_nLength   = nNewBufLen;
-    routine.m_infoDBBlock.m_nDBFile         = nDBFileForNew;
-    routine.m_eRoutineType = Routine::RT_UPDATE;
-    routine.m_nVersion     = curVersion;
-    routine.m_nPosInIndex  = ~0u;
-    if(bEmptyBlock)
+    // a removed ID has no records at all
+    return (!bInBase || setDetached.find(id) != setDetached.end());
+}
+
+
+void FileCache::findChangedIDs(const IndexSnapshot &snapshot, std::set<ID> &setChanged) const
+{
+    setChanged.clear();
+
+    // the detached IDs only grow within a session, so these name every ID either side has touched
+    std::set<ID> setTouched(m_setDetached);
+    std::map<ID, VersionList>::const_iterator itorVersion = m_mapVersion.begin();
+    for( ; itorVersion != m_mapVersion.end(); ++itorVersion)
     {
-        routine.m_pDataBlock  = NULL;
+        setTouched.insert(setTouched.end(), itorVersion->first);
     }
-    else
+    for(itorVersion = snapshot.m_mapVersion.begin(); itorVersion != snapshot.m_mapVersion.end(); ++itorVersion)
     {
-        pMemoryNew = malloc(nNewBufLen);
-        routine.m_pDataBlock  = malloc(nNewBufLen);
-        memcpy(routine.m_pDataBlock, pNewBuffer, nNewBufLen);
-        memcpy(pMemoryNew, pNewBuffer, nNewBufLen);
+        setTouched.insert(itorVersion->first);
     }
 
-    m_blockBuffer.block();
+    std::vector<DataBlock> vecBefore, vecNow;
+    std::set<ID>::const_iterator itorID = setTouched.begin();
+    for( ; itorID != setTouched.end(); ++itorID)
+    {
+        const bool bDeltaBefore = getDeltaRecords(snapshot.m_mapDataBlocks, snapshot.m_mapVersion, snapshot.m_setDetached, *itorID, vecBefore);
+        const bool bDeltaNow    = getDeltaRecords(m_mapDataBlocks, m_mapVersion, m_setDetached, *itorID, vecNow);
 
+        bool bSame = (bDeltaBefore == bDeltaNow);
+        if(bSame && bDeltaNow)
+        {
+            bSame = (vecBefore.size() == vecNow.size());
+            for(size_t n = 0u; bSame && n < vecNow.size(); n++)
+            {
+                bSame = (vecBefore[n].m_nVersion == vecNow[n].m_nVersion && vecBefore[n].m_nPosInIndex == vecNow[n].m_nPosInIndex
+                    && isSameBlockInfo(vecBefore[n].m_infoDBBlock, vecNow[n].m_infoDBBlock));
+            }
+        }
+        if(!bSame)
+        {
+            setChanged.insert(*itorID);
+        }
+    }
+}
 
-    {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
 
-        VersionList& vList = m_mapVersion[id];
+static bool readIndexRecord(FILE *pFile, unsigned nPos, BlockInIdx &block)
+{
+    fseek(pFile, nPos, SEEK_SET);
+    return (fread(&block, sizeof(BlockInIdx), 1, pFile) == 1u);
+}
 
-        for(unsigned n = 0;n < vList.size();n++)
-        {
-            DBBlockInfo infoDBBlockOld;
-            void    *pMemDelete = NULL;
-            Routine removeRoutine;
 
-            IDVersion idVersion(id,vList[n]);
+static bool writeIndexRecord(FILE *pFile, unsigned nPos, const BlockInIdx &block)
+{
+    fseek(pFile, nPos, SEEK_SET);
+    return (fwrite(&block, sizeof(BlockInIdx), 1, pFile) == 1u);
+}
 
-            std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
-            if(itorFind == m_mapDataBlocks.end())
-            {
-                continue;
-            }
 
-            const DataBlock &block = itorFind->second;
-            infoDBBlockOld = block.m_infoDBBlock;
-            pMemDelete     = block.m_pMemory;
+bool FileCache::patchDenseIndex(const std::string &strDenseFile, const std::set<ID> &setChanged, std::map<IDVersion, unsigned> &mapNewPos,
+                                std::list<unsigned> &listStale, unsigned &nIndexEnd) const
+{
+    FILE *pFile = fopen(strDenseFile.c_str(), "rb+");
+    if(NULL == pFile)   return false;
 
-            m_listGapsInIndex.push_back(block.m_nPosInIndex);
-            removeRoutine.m_nPosInIndex = block.m_nPosInIndex;
+    const unsigned nRecordCount = (cmm::getFileLength(pFile) - sizeof(IdxFileHeader)) / sizeof(BlockInIdx);
+    nIndexEnd = sizeof(IdxFileHeader) + nRecordCount * sizeof(BlockInIdx);
 
-            const size_t nOldSize  = m_mapBlockBuffer.size();
-            m_mapBlockBuffer.erase(block.m_nLastRefTime);
-            m_mapDataBlocks.erase(itorFind);
+    bool bWritten = true;
+    std::set<ID>::const_iterator itorID = setChanged.begin();
+    for( ; bWritten && itorID != setChanged.end(); ++itorID)
+    {
+        // the dense records are in (ID, version) order, so a binary search finds the stale ones of the ID
+        const ID   &id = *itorID;
+        BlockInIdx  block;
+        unsigned    nFirst = 0u, nLast = nRecordCount;
+        while(bWritten && nFirst < nLast)
+        {
+            const unsigned nMiddle = nFirst + (nLast - nFirst) / 2u;
+            bWritten = readIndexRecord(pFile, sizeof(IdxFileHeader) + nMiddle * sizeof(BlockInIdx), block);
+            if(block.m_id < id)     nFirst = nMiddle + 1u;
+            else                    nLast  = nMiddle;
+        }
 
-            if(m_mapBlockBuffer.size() < nOldSize)
-            {
-                m_nCurrentMemorySize -= infoDBBlockOld.m_gap.m_nLength;
-                if(m_nCurrentMemorySize <= m_nBufferSizeLimited)
-                {
-                    m_blockBuffer.release();
-                }
-            }
-            removeRoutine.m_eRoutineType = Routine::RT_REMOVE;
-            removeRoutine.m_pDataBlock = NULL;
-            m_pRoutineManager->addRoutine(id, removeRoutine);
-            m_pDataBase->releaseBlock(infoDBBlockOld);
-            if(pMemDelete)
+        for(unsigned n = nFirst; bWritten && n < nRecordCount; n++)
+        {
+            const unsigned nPos = sizeof(IdxFileHeader) + n * sizeof(BlockInIdx);
+            if(!readIndexRecord(pFile, nPos, block) || block.m_id != id)
             {
-                free(pMemDelete);
+                break;
             }
+            block.m_bRemove = 1u;
+            bWritten = writeIndexRecord(pFile, nPos, block);
+            listStale.push_back(nPos);
         }
-        vList.clear();
-        vList.push_back(curVersion);
-        IDVersion idVersion(id,curVersion);
-        if(m_listGapsInIndex.empty())
-        {
-            routine.m_nPosInIndex = m_nCurPosInIndex;
-            m_nCurPosInIndex += sizeof(BlockInIdx);
-        }
-        else
+
+        // the records of the delta go behind all of the others
+        std::map<IDVersion, DataBlock>::const_iterator itorBlock = m_mapDataBlocks.lower_bound(IDVersion(id, 0u));
+        for( ; bWritten && itorBlock != m_mapDataBlocks.end() && itorBlock->first.getID() == id; ++itorBlock)
         {
-            routine.m_nPosInIndex = m_listGapsInIndex.front();
-            m_listGapsInIndex.erase(m_listGapsInIndex.begin());
+            block.m_id          = id;
+            block.m_infoDBBlock = itorBlock->second.m_infoDBBlock;
+            block.m_nVersion    = itorBlock->second.m_nVersion;
+            block.m_bRemove     = 0u;
+            bWritten = writeIndexRecord(pFile, nIndexEnd, block);
+            mapNewPos[itorBlock->first] = nIndexEnd;
+            nIndexEnd += sizeof(BlockInIdx);
         }
-        routine.m_eRoutineType = Routine::RT_ADD;
+    }
 
-        DataBlock* pBlock = &m_mapDataBlocks[idVersion];
-        pBlock->m_nVersion     = routine.m_nVersion;
-        pBlock->m_nPosInIndex  = routine.m_nPosInIndex;
-        pBlock->m_pMemory      = pMemoryNew;
-        pBlock->m_nLastRefTime = 0u;
-        pBlock->m_infoDBBlock.m_nDBFile = nDBFileForNew;
-        pBlock->m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
-        pBlock->m_infoDBBlock.m_gap.m_nLength   = 0u;
+    bWritten = WriteAheadLog::syncFile(pFile) && bWritten;
+    fclose(pFile);
+    return bWritten;
+}
 
-        if(!bEmptyBlock)
+
+void FileCache::collectRecords(const ID *pAfter, unsigned nMaxIDs, std::vector<SortedIdxRecord> &vecRecords)
+{
+    vecRecords.clear();
+
+    // the same merge as writeSortedIndex(), it only begins behind pAfter
+    const UINT_64   nBaseCount = m_pSortedIndex.valid() ? m_pSortedIndex->getRecordCount() : 0u;
+    UINT_64         nBase      = (m_pSortedIndex.valid() && pAfter != NULL) ? m_pSortedIndex->lowerBound(*pAfter) : 0u;
+    SortedIdxRecord recordBase;
+    bool            bBaseValid = false;
+    unsigned        nIDCount   = 0u;
+    std::map<IDVersion, DataBlock>::const_iterator itorBlock = (pAfter != NULL) ? m_mapDataBlocks.upper_bound(IDVersion(*pAfter, ~0u)) : m_mapDataBlocks.begin();
+    while(true)
+    {
+        while(!bBaseValid && nBase < nBaseCount)
         {
-            pBlock->m_nLastRefTime = getRefTime();
+            m_pSortedIndex->getRecord(nBase++, recordBase);
+            const ID &id = recordBase.m_blockInIdx.m_id;
+            bBaseValid = (pAfter == NULL || *pAfter < id)
+                && (m_mapVersion.find(id) == m_mapVersion.end() && m_setDetached.find(id) == m_setDetached.end());
+        }
 
-            pBlock->m_infoDBBlock.m_gap.m_nLength    = nNewBufLen;
-            m_mapBlockBuffer[pBlock->m_nLastRefTime] = pBlock;
+        const bool bDeltaValid = (itorBlock != m_mapDataBlocks.end());
+        if(!bBaseValid && !bDeltaValid)
+        {
+            break;
+        }
 
-            m_nCurrentMemorySize  += pBlock->m_infoDBBlock.m_gap.m_nLength;
-            if(m_nCurrentMemorySize > m_nBufferSizeLimited)
+        const bool bTakeBase = bBaseValid && (!bDeltaValid || IDVersion(recordBase.m_blockInIdx.m_id, recordBase.m_blockInIdx.m_nVersion) < itorBlock->first);
+        const ID  &id        = bTakeBase ? recordBase.m_blockInIdx.m_id : itorBlock->first.getID();
+        if(vecRecords.empty() || vecRecords.back().m_blockInIdx.m_id != id)
+        {
+            // all the versions of an ID come in the same batch
+            if(nIDCount >= nMaxIDs)
             {
-                m_blockBuffer.set(false);
-                m_pRestrictMemThread->suspend(false);
+                break;
             }
+            nIDCount++;
         }
-        m_pRoutineManager->addRoutine(id, routine);
+
+        SortedIdxRecord record;
+        if(bTakeBase)
+        {
+            record     = recordBase;
+            bBaseValid = false;
+        }
+        else
+        {
+            const DataBlock &block = itorBlock->second;
+            record.m_blockInIdx.m_id          = itorBlock->first.getID();
+            record.m_blockInIdx.m_infoDBBlock = block.m_infoDBBlock;
+            record.m_blockInIdx.m_nVersion    = block.m_nVersion;
+            record.m_blockInIdx.m_bRemove     = 0u;
+            record.m_nPosInIndex              = block.m_nPosInIndex;
+            ++itorBlock;
+        }
+        vecRecords.push_back(record);
     }
-    return true;
 }
 
-bool FileCache::updateBlock(const ID &id, const void *pNewBuffer, unsigned nNewBufLen)
+
+std::map<ID, VersionList>::iterator FileCache::findVersions(const ID &id)
 {
-    if(!isOpen())   return false;
+    std::map<ID, VersionList>::iterator itorVersion = m_mapVersion.find(id);
+    if(itorVersion != m_mapVersion.end() || !m_pSortedIndex.valid())
+    {
+        return itorVersion;
+    }
+    if(m_setDetached.find(id) != m_setDetached.end())
+    {
+        return m_mapVersion.end();
+    }
 
-    unsigned curVersion = time(NULL);
-    if(curVersion == -1)
+    std::vector<SortedIdxRecord> vecRecords;
+    if(!m_pSortedIndex->find(id, vecRecords))
     {
-        return false;
+        return m_mapVersion.end();
     }
 
-    unsigned nDBFileForNew  = 0u;
-    UINT_64 nPositionForNew = 0u;
-    const bool bEmptyBlock  = (NULL == pNewBuffer || 0u == nNewBufLen);
-    if(!bEmptyBlock)
+    trimMaterialized();
+
+    // the records are sorted by version already
+    VersionList &vList = m_mapVersion[id];
+    std::vector<SortedIdxRecord>::const_iterator itorRecord = vecRecords.begin();
+    for( ; itorRecord != vecRecords.end(); ++itorRecord)
     {
-        if(!m_pDataBase->allocBlock(nNewBufLen, nDBFileForNew, nPositionForNew))
+        const BlockInIdx &blockInIdx = itorRecord->m_blockInIdx;
+
+        DataBlock blockItem;
+        blockItem.m_infoDBBlock  = blockInIdx.m_infoDBBlock;
+        blockItem.m_nPosInIndex  = itorRecord->m_nPosInIndex;
+        blockItem.m_nVersion     = blockInIdx.m_nVersion;
+        blockItem.m_bInBase      = true;
+        m_mapDataBlocks[IDVersion(id, blockInIdx.m_nVersion)] = blockItem;
+
+        if(vList.empty() || vList.back() != blockInIdx.m_nVersion)
         {
-            // Disk error, so bad !! unable to find a gap for the new data!!
-            return false;
+            vList.push_back(blockInIdx.m_nVersion);
         }
     }
+    m_queueMaterialized.push_back(id);
 
-    void   *pMemoryNew = NULL;
-    Routine routine;
-    routine.m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
-    routine.m_infoDBBlock.m_gap.m_nLength   = nNewBufLen;
-    routine.m_infoDBBlock.m_nDBFile         = nDBFileForNew;
-    routine.m_eRoutineType = Routine::RT_UPDATE;
-    routine.m_nVersion     = curVersion;
-    routine.m_nPosInIndex  = ~0u;
-    if(bEmptyBlock)
+    return m_mapVersion.find(id);
+}
+
+
+bool FileCache::findBaseVersions(const ID &id, VersionList &vList) const
+{
+    vList.clear();
+    if(!m_pSortedIndex.valid() || m_setDetached.find(id) != m_setDetached.end())
     {
-        routine.m_pDataBlock  = NULL;
+        return false;
     }
-    else
+
+    std::vector<SortedIdxRecord> vecRecords;
+    if(!m_pSortedIndex->find(id, vecRecords))
     {
-        pMemoryNew = malloc(nNewBufLen);
-        routine.m_pDataBlock  = malloc(nNewBufLen);
-        memcpy(routine.m_pDataBlock, pNewBuffer, nNewBufLen);
-        memcpy(pMemoryNew, pNewBuffer, nNewBufLen);
+        return false;
     }
 
-    DBBlockInfo infoOldDBBlock;
-    bool        bOldBlockExist = false;
-   
-    
-    m_blockBuffer.block();
-
-    
-    void *pMemDelete = NULL;
+    std::vector<SortedIdxRecord>::const_iterator itorRecord = vecRecords.begin();
+    for( ; itorRecord != vecRecords.end(); ++itorRecord)
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
-
+        if(vList.empty() || vList.back() != itorRecord->m_blockInIdx.m_nVersion)
+        {
+            vList.push_back(itorRecord->m_blockInIdx.m_nVersion);
+        }
+    }
+    return true;
+}
+
+
+void FileCache::detachBaseBlock(const ID &id)
+{
+    if(m_pSortedIndex.valid())
+    {
+        m_setDetached.insert(id);
+    }
+}
+
+
+void FileCache::trimMaterialized(void)
+{
+    // The IDs which have only been looked up leave the delta again, their blocks
+    // may stay in the block cache. The written ones stay until closeDB.
+    size_t nTrim = (m_queueMaterialized.size() >= g_nMaxMaterializedIDs) ? (m_queueMaterialized.size() - g_nMaxMaterializedIDs + 1u) : 0u;
+    for( ; nTrim > 0u; nTrim--)
+    {
+        const ID id = m_queueMaterialized.front();
+        m_queueMaterialized.pop_front();
+
+        std::map<ID, VersionList>::iterator itorVersion = m_mapVersion.find(id);
+        if(itorVersion == m_mapVersion.end())
+        {
+            continue;
+        }
+
+        bool bInBase = true;
+        const VersionList &vList = itorVersion->second;
+        for(unsigned n = 0u; n < vList.size(); n++)
+        {
+            std::map<IDVersion, DataBlock>::const_iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, vList[n]));
+            if(itorBlock == m_mapDataBlocks.end() || !itorBlock->second.m_bInBase)
+            {
+                bInBase = false;
+                break;
+            }
+        }
+
+        if(!bInBase)
+        {
+            continue;
+        }
+
+        for(unsigned n = 0u; n < vList.size(); n++)
+        {
+            m_mapDataBlocks.erase(IDVersion(id, vList[n]));
+        }
+        m_mapVersion.erase(itorVersion);
+    }
+}
+
+
+void FileCache::closeDB(void)
+{
+    closeDataBase();
+}
+
+
+void FileCache::setMappedRead(bool bMappedRead)
+{
+    m_bMappedRead = bMappedRead;
+}
+
+
+void FileCache::setCompression(BlockCompression eCompression)
+{
+    m_eCompression = eCompression;
+    if(isOpen())
+    {
+        m_pBlockCodec->setCompression(eCompression);
+    }
+}
+
+
+bool FileCache::isOpen(void) const
+{
+    return m_bIsOpen;
+}
+
+
+bool FileCache::isExist(const ID &id) const
+{
+    if(!isOpen())   return false;
+    if(!mayExist(id))   return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
+    std::map<ID, VersionList>::const_iterator itorFind = m_mapVersion.find(id);
+    if(itorFind == m_mapVersion.end())
+    {
+        VersionList vList;
+        return findBaseVersions(id, vList);
+    }
+    return true;
+}
+
+
+std::vector<unsigned> FileCache::getVersion(const ID &id) const
+{
+    VersionList vList;
+    if(!isOpen())   return vList;
+    if(!mayExist(id))   return vList;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
+    std::map<ID, VersionList>::const_iterator itorFind = m_mapVersion.find(id);
+    if(itorFind == m_mapVersion.end())
+    {
+        findBaseVersions(id, vList);
+        return vList;
+    }
+
+    return itorFind->second;
+}
+
+
+bool FileCache::readBlock(const ID &id, void *&pBuffer, unsigned &nLength,const unsigned& nVersion)
+{
+    pBuffer = NULL;
+    nLength = 0u;
+
+    OpenSP::sp<IBlockBuffer> pBlockBuffer;
+    if(!readBlock(id, pBlockBuffer, nVersion))
+    {
+        return false;
+    }
+    if(!pBlockBuffer.valid())
+    {
+        return true;
+    }
+
+    // the old interface hands out a copy which the caller frees
+    nLength = pBlockBuffer->getLength();
+    pBuffer = malloc(nLength);
+    memcpy(pBuffer, pBlockBuffer->getData(), nLength);
+    return true;
+}
+
+
+bool FileCache::readBlock(const ID &id, OpenSP::sp<IBlockBuffer> &pBuffer, unsigned nVersion)
+{
+    if(!isOpen())   return false;
+
+    // 1. The latest version is served by its shard of the cache, the index is not locked at all
+    pBuffer = NULL;
+    if(nVersion == 0 && m_pBlockCache->read(id, 0u, pBuffer))
+    {
+        return true;
+    }
+    if(!mayExist(id))
+    {
+        return false;
+    }
+
+    while(true)
+    {
+        // a snapshot may see a version which has been replaced or removed since it was taken
+        if(nVersion != 0u)
+        {
+            bool bRetired = false;
+            const bool bRead = readRetiredBlock(id, nVersion, pBuffer, bRetired);
+            if(bRetired)
+            {
+                return bRead;
+            }
+        }
+
+        DBBlockInfo infoDBBlock;
+        unsigned    curVersion = 0u;
+        {
+            // 2. Check if such id cannot be found
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
+            RetiredBlock retired;
+            if(nVersion != 0u && findRetiredBlock(id, nVersion, retired))
+            {
+                // a writer has just given it up
+                continue;
+            }
+            std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+            if(itorVersion == m_mapVersion.end())
+            {
+                return false;
+            }
+
+            // 3. Get proper version
+            if(nVersion == 0)
+            {
+                curVersion = itorVersion->second[itorVersion->second.size()-1];
+            }
+            else
+            {
+                VersionList vList = itorVersion->second;
+                if(nVersion < vList[0])
+                {
+                    return false;
+                }
+                else if(nVersion >= vList[vList.size() - 1])
+                {
+                    curVersion = vList[vList.size() - 1];
+                }
+                else
+                {
+                    for(unsigned n = 0;n < vList.size() - 1;n++)
+                    {
+                        if(vList[n] <= nVersion && nVersion < vList[n+1])
+                        {
+                            curVersion = vList[n];
+                        }
+                    }
+                }
+            }
+            const bool bLatest = (curVersion == itorVersion->second.back());
+            IDVersion idVersion(id,curVersion);
+
+            // 4. Such id is found
+            std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(idVersion);
+            if(itorBlock == m_mapDataBlocks.end())
+            {
+                return false;
+            }
+            const DataBlock &block = itorBlock->second;
+            if(block.m_infoDBBlock.m_gap.m_nLength == 0u)
+            {
+                // it is an zero-length block, so it does not need to read
+                return true;
+            }
+
+            if(m_pBlockCache->read(id, curVersion, pBuffer))
+            {
+                return true;
+            }
+
+            // 5. It is not in the cache, the routine manager may still hold it
+            OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pRoutineManager->readRoutineBlock(id, curVersion);
+            if(pStoredBuffer.valid())
+            {
+                pBuffer = m_pBlockCodec->decode(pStoredBuffer.get());
+                if(!pBuffer.valid())
+                {
+                    return false;
+                }
+                if(bLatest)
+                {
+                    m_pBlockCache->insert(id, curVersion, pBuffer.get());
+                }
+                return true;
+            }
+
+            infoDBBlock = block.m_infoDBBlock;
+        }
+
+        // 6. read from db file, the index is not locked while the disk is working
+        ++m_nFileReads;
+        void *pMemory = m_pDataBase->readBlock(infoDBBlock);
+        if(!pMemory)
+        {
+            // the compaction may have moved the block and removed its file meanwhile
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
+            if(findVersions(id) != m_mapVersion.end())
+            {
+                std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, curVersion));
+                if(itorBlock != m_mapDataBlocks.end() && !isSameBlockInfo(itorBlock->second.m_infoDBBlock, infoDBBlock))
+                {
+                    continue;
+                }
+            }
+
+            // so bad, disk error !!
+            return false;
+        }
+
+        OpenSP::sp<IBlockBuffer> pStoredBuffer = new BlockBuffer(pMemory, infoDBBlock.m_gap.m_nLength);
+        const bool bCorrupt = (m_eVerification != BV_NONE && m_pBlockCodec->verify(pStoredBuffer.get()) == BlockCodec::VR_CORRUPT);
+        OpenSP::sp<IBlockBuffer> pRawBuffer = m_pBlockCodec->decode(pStoredBuffer.get());
+        pStoredBuffer = NULL;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
+        std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
         IDVersion idVersion(id,curVersion);
-        std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
-        DataBlock *pBlock = NULL;
-        if(itorFind != m_mapDataBlocks.end())
+        std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(idVersion);
+        if(itorVersion == m_mapVersion.end()
+            || itorBlock == m_mapDataBlocks.end()
+            || !isSameBlockInfo(itorBlock->second.m_infoDBBlock, infoDBBlock))
         {
-            pBlock = &itorFind->second;
+            // the block has been replaced or removed while reading, its gap may be reused already
+            continue;
+        }
+
+        if(!checkStoredBlock(id, bCorrupt))
+        {
+            return false;
+        }
+        if(!pRawBuffer.valid())
+        {
+            std::cout << "Warning: a block cannot be decoded, it is broken or its dictionary is lost." << std::endl;
+            return false;
+        }
+        pBuffer = pRawBuffer;
+
+        // only the latest version is cached, a writer may have added a newer one meanwhile
+        if(curVersion == itorVersion->second.back())
+        {
+            m_pBlockCache->insert(id, curVersion, pBuffer.get());
+        }
+        return true;
+    }
+}
+
+
+void FileCache::getCacheStatistics(CacheStatistics &stat) const
+{
+    memset(&stat, 0, sizeof(CacheStatistics));
+    if(!isOpen())   return;
+
+    m_pBlockCache->getStatistics(stat);
+    stat.m_nFileReads = (unsigned)m_nFileReads;
+}
+
+
+bool FileCache::removeBlock(const ID &id)
+{
+    if(!isOpen())   return false;
+
+    m_pRoutineManager->waitForRoom();
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        std::map<ID,VersionList>::iterator itorVersion = findVersions(id);
+        if(itorVersion == m_mapVersion.end())
+        {
+            return true;
+        }
+
+        VersionList vList = itorVersion->second;
+        const unsigned nRemoveVersion = nextVersion();
+
+        for(unsigned n = 0;n < vList.size();n++)
+        {
+            DBBlockInfo infoDBBlockOld;
+            Routine routine;
+
+            IDVersion idVersion(id,vList[n]);
+
+            std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
+            if(itorFind == m_mapDataBlocks.end())
+            {
+                continue;
+            }
+
+            const DataBlock &block = itorFind->second;
+            infoDBBlockOld = block.m_infoDBBlock;
+
+            m_listGapsInIndex.push_back(block.m_nPosInIndex);
+            routine.m_nPosInIndex = block.m_nPosInIndex;
+
+            m_mapDataBlocks.erase(itorFind);
+
+            routine.m_eRoutineType = Routine::RT_REMOVE;
+            routine.m_pDataBlock = NULL;
+            m_pRoutineManager->addRoutine(id, routine);
+            retireBlock(id, vList[n], (n + 1u < vList.size()) ? vList[n + 1u] : nRemoveVersion, infoDBBlockOld);
+        }
+
+        m_pBlockCache->erase(id);
+        m_mapVersion.erase(itorVersion);
+        detachBaseBlock(id);
+        m_nBlockCount--;
+        m_bIndexDirty = true;
+    }
+
+    return true;
+}
+
+
+bool FileCache::addBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = BlockBuffer::copyFrom(pBuffer, nBufLen);
+    return addBlock(id, pBlockBuffer.get());
+}
+
+
+bool FileCache::addBlock(const ID &id, IBlockBuffer *pBuffer)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = pBuffer;
+    if(!isOpen())   return false;
+
+    // the cache keeps the block as it is, the data files get it the way the codec stores it
+    OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pBlockCodec->encode(pBlockBuffer.get());
+
+    Routine routine;
+    routine.m_eRoutineType = Routine::RT_ADD;
+
+    // the write buffer is waited for before the lock, so a full queue does not hold up the readers
+    m_pRoutineManager->waitForRoom();
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+
+        std::map<ID, VersionList>::const_iterator itorFind = findVersions(id);
+        if(itorFind != m_mapVersion.end())
+        {
+            // It already exist in data base
+            return false;
+        }
+
+        unsigned  nDBFileIndex = 0u;
+        UINT_64   nPosition    = 0u;
+        const unsigned nBufLen = pStoredBuffer.valid() ? pStoredBuffer->getLength() : 0u;
+        const bool bEmptyBlock = (0u == nBufLen);
+        if(!bEmptyBlock)
+        {
+            if(!m_pDataBase->allocBlock(nBufLen, nDBFileIndex, nPosition))
+            {
+                // Disk error, so bad !! unable to find a gap to fit the new block!!
+                return false;
+            }
+        }
+
+        // the version is taken under the lock, so a snapshot never sees a write of an older one after it
+        const unsigned curVersion = nextVersion();
+        routine.m_nVersion = curVersion;
+
+        VersionList &vList = m_mapVersion[id];
+        vList.push_back(curVersion);
+        addToBloomFilter(id);
+
+        IDVersion idVersion(id,curVersion);
+
+        DataBlock &block                      = m_mapDataBlocks[idVersion];
+        block.m_infoDBBlock.m_nDBFile         = nDBFileIndex;
+        block.m_infoDBBlock.m_gap.m_nPosition = nPosition;
+        block.m_nVersion                      = curVersion;
+        block.m_bInBase                       = false;
+        m_nBlockCount++;
+        m_bIndexDirty = true;
+
+        if(bEmptyBlock)
+        {
+            block.m_infoDBBlock.m_gap.m_nLength = 0u;
+        }
+        else
+        {
+            block.m_infoDBBlock.m_gap.m_nLength = nBufLen;
+            m_pBlockCache->insert(id, curVersion, pBlockBuffer.get());
+        }
+        if(m_listGapsInIndex.empty())
+        {
+            block.m_nPosInIndex = m_nCurPosInIndex;
+            m_nCurPosInIndex += sizeof(BlockInIdx);
+        }
+        else
+        {
+            block.m_nPosInIndex = m_listGapsInIndex.front();
+            m_listGapsInIndex.erase(m_listGapsInIndex.begin());
+        }
+
+        routine.m_nPosInIndex = block.m_nPosInIndex;
+        routine.m_infoDBBlock.m_nDBFile = nDBFileIndex;
+        routine.m_infoDBBlock.m_gap     = block.m_infoDBBlock.m_gap;
+
+        if(!bEmptyBlock)
+        {
+            routine.m_pDataBlock = pStoredBuffer;
+        }
+
+        // the routine is queued before the index is unlocked, so a reader which misses
+        // the cache finds the data in the routine manager rather than an unwritten gap
+        m_pRoutineManager->addRoutine(id, routine);
+    }
+
+    growBloomFilter();
+    return 1;
+}
+
+bool FileCache::replaceBlock(const ID &id, const void *pNewBuffer, unsigned nNewBufLen)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = BlockBuffer::copyFrom(pNewBuffer, nNewBufLen);
+    return replaceBlock(id, pBlockBuffer.get());
+}
+
+
+bool FileCache::replaceBlock(const ID &id, IBlockBuffer *pNewBuffer)
+{
+    std::vector<ID> vecIDs(1u, id);
+    std::vector<OpenSP::sp<IBlockBuffer> > vecBuffers(1u, pNewBuffer);
+    return writeBlocks(vecIDs, vecBuffers);
+}
+
+
+bool FileCache::writeBlocks(const std::vector<ID> &vecIDs, const std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers)
+{
+    if(!isOpen())   return false;
+    if(vecIDs.size() != vecBuffers.size())
+    {
+        return false;
+    }
+
+    // 1. Encode and place every block before the index is locked
+    std::vector<OpenSP::sp<IBlockBuffer> > vecStored(vecIDs.size());
+    std::vector<DBBlockInfo> vecInfo(vecIDs.size());
+    for(size_t i = 0u; i < vecIDs.size(); i++)
+    {
+        // the cache keeps the block as it is, the data files get it the way the codec stores it
+        vecStored[i] = m_pBlockCodec->encode(vecBuffers[i].get());
+
+        DBBlockInfo &info = vecInfo[i];
+        memset(&info, 0, sizeof(DBBlockInfo));
+        info.m_gap.m_nLength = vecStored[i].valid() ? vecStored[i]->getLength() : 0u;
+        if(info.m_gap.m_nLength == 0u)
+        {
+            continue;
+        }
+        if(!m_pDataBase->allocBlock(info.m_gap.m_nLength, info.m_nDBFile, info.m_gap.m_nPosition))
+        {
+            // Disk error, so bad !! unable to find a gap for the new data!!
+            for(size_t n = 0u; n < i; n++)
+            {
+                if(vecInfo[n].m_gap.m_nLength > 0u)
+                {
+                    m_pDataBase->releaseBlock(vecInfo[n]);
+                }
+            }
+            return false;
+        }
+    }
+
+    // 2. Replace them in the index, all the routines go to the writer at once
+    std::list<std::pair<ID, Routine> > listRoutines;
+    m_pRoutineManager->waitForRoom();
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+
+        // the whole batch has one version, a snapshot sees all of it or nothing of it
+        const unsigned curVersion = nextVersion();
+        for(size_t i = 0u; i < vecIDs.size(); i++)
+        {
+            const ID &id = vecIDs[i];
+            const DBBlockInfo &infoNew = vecInfo[i];
+            std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+            if(itorVersion == m_mapVersion.end())
+            {
+                itorVersion = m_mapVersion.insert(std::make_pair(id, VersionList())).first;
+                m_nBlockCount++;
+                addToBloomFilter(id);
+            }
+            VersionList& vList = itorVersion->second;
+            m_bIndexDirty = true;
+
+            for(unsigned n = 0;n < vList.size();n++)
+            {
+                DBBlockInfo infoDBBlockOld;
+                Routine removeRoutine;
+
+                IDVersion idVersion(id,vList[n]);
+
+                std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
+                if(itorFind == m_mapDataBlocks.end())
+                {
+                    continue;
+                }
+
+                const DataBlock &block = itorFind->second;
+                infoDBBlockOld = block.m_infoDBBlock;
+
+                m_listGapsInIndex.push_back(block.m_nPosInIndex);
+                removeRoutine.m_nPosInIndex = block.m_nPosInIndex;
+
+                m_mapDataBlocks.erase(itorFind);
+
+                removeRoutine.m_eRoutineType = Routine::RT_REMOVE;
+                removeRoutine.m_pDataBlock = NULL;
+                listRoutines.push_back(std::make_pair(id, removeRoutine));
+                retireBlock(id, vList[n], (n + 1u < vList.size()) ? vList[n + 1u] : curVersion, infoDBBlockOld);
+            }
+            vList.clear();
+            vList.push_back(curVersion);
+
+            Routine routine;
+            routine.m_eRoutineType = Routine::RT_ADD;
+            routine.m_nVersion     = curVersion;
+            routine.m_infoDBBlock  = infoNew;
+            if(infoNew.m_gap.m_nLength > 0u)
+            {
+                routine.m_pDataBlock = vecStored[i];
+            }
+            if(m_listGapsInIndex.empty())
+            {
+                routine.m_nPosInIndex = m_nCurPosInIndex;
+                m_nCurPosInIndex += sizeof(BlockInIdx);
+            }
+            else
+            {
+                routine.m_nPosInIndex = m_listGapsInIndex.front();
+                m_listGapsInIndex.erase(m_listGapsInIndex.begin());
+            }
+
+            IDVersion idVersion(id,curVersion);
+            DataBlock* pBlock = &m_mapDataBlocks[idVersion];
+            pBlock->m_bInBase      = false;
+            pBlock->m_nVersion     = curVersion;
+            pBlock->m_nPosInIndex  = routine.m_nPosInIndex;
+            pBlock->m_infoDBBlock  = infoNew;
+
+            m_pBlockCache->erase(id);
+            if(infoNew.m_gap.m_nLength > 0u)
+            {
+                m_pBlockCache->insert(id, curVersion, vecBuffers[i].get());
+            }
+            listRoutines.push_back(std::make_pair(id, routine));
+        }
+
+        // the routines are queued before the index is unlocked, so a reader which misses
+        // the cache finds the data in the routine manager rather than an unwritten gap
+        m_pRoutineManager->addRoutines(listRoutines);
+    }
+
+    growBloomFilter();
+    return true;
+}
+
+
+unsigned FileCache::readBlocks(const std::vector<ID> &vecIDs, std::vector<OpenSP::sp<IBlockBuffer> > &vecBuffers, std::vector<bool> &vecFound)
+{
+    vecBuffers.assign(vecIDs.size(), NULL);
+    vecFound.assign(vecIDs.size(), false);
+    if(!isOpen())   return 0u;
+
+    // 1. The cache serves what it holds without the index lock, the bloom filter drops most of the absent IDs
+    unsigned nFound = 0u;
+    std::vector<unsigned> vecMissed;
+    for(unsigned i = 0u; i < vecIDs.size(); i++)
+    {
+        if(m_pBlockCache->read(vecIDs[i], 0u, vecBuffers[i]))
+        {
+            vecFound[i] = true;
+            nFound++;
+        }
+        else if(mayExist(vecIDs[i]))
+        {
+            vecMissed.push_back(i);
+        }
+    }
+    if(vecMissed.empty())
+    {
+        return nFound;
+    }
+
+    // 2. The others are looked up under one lock, the routine manager may still hold some of them
+    std::vector<PendingRead> vecPending;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
+        for(std::vector<unsigned>::const_iterator itor = vecMissed.begin(); itor != vecMissed.end(); ++itor)
+        {
+            const unsigned i = *itor;
+            const ID &id = vecIDs[i];
+            std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+            if(itorVersion == m_mapVersion.end())
+            {
+                continue;
+            }
+
+            const unsigned curVersion = itorVersion->second.back();
+            std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, curVersion));
+            if(itorBlock == m_mapDataBlocks.end())
+            {
+                continue;
+            }
+            if(itorBlock->second.m_infoDBBlock.m_gap.m_nLength == 0u || m_pBlockCache->read(id, curVersion, vecBuffers[i]))
+            {
+                vecFound[i] = true;
+                nFound++;
+                continue;
+            }
+
+            OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pRoutineManager->readRoutineBlock(id, curVersion);
+            if(pStoredBuffer.valid())
+            {
+                vecBuffers[i] = m_pBlockCodec->decode(pStoredBuffer.get());
+                if(vecBuffers[i].valid())
+                {
+                    m_pBlockCache->insert(id, curVersion, vecBuffers[i].get());
+                    vecFound[i] = true;
+                    nFound++;
+                }
+                continue;
+            }
+
+            PendingRead pending;
+            pending.m_nIndex      = i;
+            pending.m_nVersion    = curVersion;
+            pending.m_infoDBBlock = itorBlock->second.m_infoDBBlock;
+            pending.m_bRead       = false;
+            pending.m_bCorrupt    = false;
+            vecPending.push_back(pending);
+        }
+    }
+
+    // 3. Read the files in order, the blocks close to each other are read at once without the lock
+    std::sort(vecPending.begin(), vecPending.end(), isPendingAhead);
+    size_t nRunFrom = 0u;
+    while(nRunFrom < vecPending.size())
+    {
+        const DBBlockInfo &infoFirst = vecPending[nRunFrom].m_infoDBBlock;
+        const UINT_64 nSpanStart = infoFirst.m_gap.m_nPosition;
+        UINT_64 nSpanEnd = nSpanStart + infoFirst.m_gap.m_nLength;
+
+        size_t nRunTo = nRunFrom + 1u;
+        for( ; nRunTo < vecPending.size(); nRunTo++)
+        {
+            const DBBlockInfo &infoNext = vecPending[nRunTo].m_infoDBBlock;
+            const UINT_64 nNextEnd = infoNext.m_gap.m_nPosition + infoNext.m_gap.m_nLength;
+            if(infoNext.m_nDBFile != infoFirst.m_nDBFile
+                || infoNext.m_gap.m_nPosition > nSpanEnd + g_nMaxCoalescedGap
+                || std::max(nSpanEnd, nNextEnd) - nSpanStart > g_nMaxCoalescedRead)
+            {
+                break;
+            }
+            nSpanEnd = std::max(nSpanEnd, nNextEnd);
+        }
+
+        DBBlockInfo infoRun = infoFirst;
+        infoRun.m_gap.m_nLength = (unsigned)(nSpanEnd - nSpanStart);
+        ++m_nFileReads;
+        unsigned char *pMemory = (unsigned char *)m_pDataBase->readBlock(infoRun);
+        if(NULL != pMemory)
+        {
+            for(size_t n = nRunFrom; n < nRunTo; n++)
+            {
+                PendingRead &pending = vecPending[n];
+                const FileGap &gap = pending.m_infoDBBlock.m_gap;
+                OpenSP::sp<IBlockBuffer> pStoredBuffer;
+                if(nRunTo - nRunFrom == 1u)
+                {
+                    pStoredBuffer = new BlockBuffer(pMemory, gap.m_nLength);
+                    pMemory = NULL;
+                }
+                else
+                {
+                    pStoredBuffer = BlockBuffer::copyFrom(pMemory + (gap.m_nPosition - nSpanStart), gap.m_nLength);
+                }
+                pending.m_bCorrupt = (m_eVerification != BV_NONE && m_pBlockCodec->verify(pStoredBuffer.get()) == BlockCodec::VR_CORRUPT);
+                pending.m_pBuffer  = m_pBlockCodec->decode(pStoredBuffer.get());
+                pending.m_bRead    = true;
+            }
+            free(pMemory);
+        }
+        nRunFrom = nRunTo;
+    }
+
+    // 4. Keep what is still in the index, the rest has been moved or replaced meanwhile and is read again
+    std::vector<unsigned> vecRetry;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockSlice(m_mtxDataBlocks);
+        for(std::vector<PendingRead>::const_iterator itor = vecPending.begin(); itor != vecPending.end(); ++itor)
+        {
+            const PendingRead &pending = *itor;
+            const ID &id = vecIDs[pending.m_nIndex];
+            std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+            std::map<IDVersion,DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, pending.m_nVersion));
+            if(!pending.m_bRead
+                || itorVersion == m_mapVersion.end()
+                || itorBlock == m_mapDataBlocks.end()
+                || !isSameBlockInfo(itorBlock->second.m_infoDBBlock, pending.m_infoDBBlock))
+            {
+                vecRetry.push_back(pending.m_nIndex);
+                continue;
+            }
+            if(!checkStoredBlock(id, pending.m_bCorrupt))
+            {
+                continue;
+            }
+            if(!pending.m_pBuffer.valid())
+            {
+                std::cout << "Warning: a block cannot be decoded, it is broken or its dictionary is lost." << std::endl;
+                continue;
+            }
+
+            vecBuffers[pending.m_nIndex] = pending.m_pBuffer;
+            vecFound[pending.m_nIndex] = true;
+            nFound++;
+            if(pending.m_nVersion == itorVersion->second.back())
+            {
+                m_pBlockCache->insert(id, pending.m_nVersion, pending.m_pBuffer.get());
+            }
+        }
+    }
+
+    for(std::vector<unsigned>::const_iterator itor = vecRetry.begin(); itor != vecRetry.end(); ++itor)
+    {
+        if(readBlock(vecIDs[*itor], vecBuffers[*itor]))
+        {
+            vecFound[*itor] = true;
+            nFound++;
+        }
+    }
+    return nFound;
+}
+
+bool FileCache::updateBlock(const ID &id, const void *pNewBuffer, unsigned nNewBufLen)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = BlockBuffer::copyFrom(pNewBuffer, nNewBufLen);
+    return updateBlock(id, pBlockBuffer.get());
+}
+
+
+bool FileCache::updateBlock(const ID &id, IBlockBuffer *pNewBuffer)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = pNewBuffer;
+    if(!isOpen())   return false;
+
+    // the cache keeps the block as it is, the data files get it the way the codec stores it
+    OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pBlockCodec->encode(pBlockBuffer.get());
+
+    unsigned nDBFileForNew  = 0u;
+    UINT_64 nPositionForNew = 0u;
+    const unsigned nNewBufLen = pStoredBuffer.valid() ? pStoredBuffer->getLength() : 0u;
+    const bool bEmptyBlock  = (0u == nNewBufLen);
+    if(!bEmptyBlock)
+    {
+        if(!m_pDataBase->allocBlock(nNewBufLen, nDBFileForNew, nPositionForNew))
+        {
+            // Disk error, so bad !! unable to find a gap for the new data!!
+            return false;
+        }
+    }
+
+    Routine routine;
+    routine.m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
+    routine.m_infoDBBlock.m_gap.m_nLength   = nNewBufLen;
+    routine.m_infoDBBlock.m_nDBFile         = nDBFileForNew;
+    routine.m_eRoutineType = Routine::RT_UPDATE;
+    routine.m_nPosInIndex  = ~0u;
+    if(!bEmptyBlock)
+    {
+        routine.m_pDataBlock  = pStoredBuffer;
+    }
+
+    DBBlockInfo infoOldDBBlock;
+    bool        bOldBlockExist = false;
+
+    m_pRoutineManager->waitForRoom();
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+
+        findVersions(id);
+        m_bIndexDirty = true;
+
+        const unsigned curVersion = nextVersion();
+        routine.m_nVersion = curVersion;
+
+        IDVersion idVersion(id,curVersion);
+        std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(idVersion);
+        DataBlock *pBlock = NULL;
+        if(itorFind != m_mapDataBlocks.end())
+        {
+            pBlock = &itorFind->second;
+
+            infoOldDBBlock = pBlock->m_infoDBBlock;
+            routine.m_nPosInIndex = pBlock->m_nPosInIndex;
+            bOldBlockExist = true;
+        }
+        else
+        {
+            if(m_listGapsInIndex.empty())
+            {
+                routine.m_nPosInIndex = m_nCurPosInIndex;
+                m_nCurPosInIndex += sizeof(BlockInIdx);
+            }
+            else
+            {
+                routine.m_nPosInIndex = m_listGapsInIndex.front();
+                m_listGapsInIndex.erase(m_listGapsInIndex.begin());
+            }
+            routine.m_eRoutineType = Routine::RT_ADD;
+        }
+
+        VersionList& vList = m_mapVersion[id];
+        if(vList.empty())
+        {
+            vList.push_back(curVersion);
+            m_nBlockCount++;
+            addToBloomFilter(id);
+        }
+        else
+        {
+            VersionList::iterator verItor = std::find(vList.begin(),vList.end(),curVersion);
+            if(verItor == vList.end())
+            {
+                vList.push_back(curVersion);
+                std::sort(vList.begin(),vList.end());
+            }
+        }
+
+        if(!pBlock)
+        {
+            pBlock = &m_mapDataBlocks[idVersion];
+        }
+
+        pBlock->m_bInBase      = false;
+        pBlock->m_nVersion     = routine.m_nVersion;
+        pBlock->m_nPosInIndex  = routine.m_nPosInIndex;
+        pBlock->m_infoDBBlock.m_nDBFile = nDBFileForNew;
+        pBlock->m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
+        pBlock->m_infoDBBlock.m_gap.m_nLength   = 0u;
+        if(!bEmptyBlock)
+        {
+            pBlock->m_infoDBBlock.m_gap.m_nLength = nNewBufLen;
+        }
+
+        // the cache keeps only the latest version of the id
+        if(curVersion == vList.back())
+        {
+            m_pBlockCache->erase(id);
+            if(!bEmptyBlock)
+            {
+                m_pBlockCache->insert(id, curVersion, pBlockBuffer.get());
+            }
+        }
+        m_pRoutineManager->addRoutine(id, routine);
+        trimVersions(m_mapVersion.find(id));
+    }
+
+    if(bOldBlockExist)
+    {
+        m_pDataBase->releaseBlock(infoOldDBBlock);
+    }
+
+    growBloomFilter();
+    return true;
+}
+
+
+unsigned FileCache::getBlockCount(void) const
+{
+    if(!isOpen())   return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
+    return m_nBlockCount;
+}
+
+
+void FileCache::getIndices(std::vector<ID> &vecIndices, unsigned nOffset/* = 0u*/, unsigned nCount/* = ~0u*/) const
+{
+    if(!isOpen())   return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
+
+    vecIndices.clear();
+    if(nCount == ~0u)
+    {
+        if(nOffset >= m_nBlockCount)
+        {
+            return;
+        }
+        vecIndices.reserve(m_nBlockCount - nOffset);
+    }
+    else if(nCount == 0u)
+    {
+        return;
+    }
+    else
+    {
+        vecIndices.reserve(nCount);
+    }
+
+    // merge the IDs of the sorted index with the delta, the delta wins on the same ID
+    const UINT_64   nBaseCount = m_pSortedIndex.valid() ? m_pSortedIndex->getRecordCount() : 0u;
+    UINT_64         nBase      = 0u;
+    ID              idBase, idLastBase;
+    bool            bBaseValid = false;
+    std::map<ID, VersionList>::const_iterator itorBlock = m_mapVersion.begin();
+    for(unsigned nIndex = 0u; vecIndices.size() < nCount; ++nIndex)
+    {
+        while(!bBaseValid && nBase < nBaseCount)
+        {
+            SortedIdxRecord record;
+            m_pSortedIndex->getRecord(nBase, record);
+            if(nBase++ > 0u && record.m_blockInIdx.m_id == idLastBase)
+            {
+                continue;
+            }
+            idLastBase = record.m_blockInIdx.m_id;
+            if(m_mapVersion.find(idLastBase) != m_mapVersion.end() || m_setDetached.find(idLastBase) != m_setDetached.end())
+            {
+                continue;
+            }
+            idBase     = idLastBase;
+            bBaseValid = true;
+        }
+
+        const bool bDeltaValid = (itorBlock != m_mapVersion.end());
+        if(!bBaseValid && !bDeltaValid)
+        {
+            break;
+        }
+
+        ID id;
+        if(bBaseValid && (!bDeltaValid || idBase < itorBlock->first))
+        {
+            id         = idBase;
+            bBaseValid = false;
+        }
+        else
+        {
+            id = itorBlock->first;
+            ++itorBlock;
+        }
+
+        if(nIndex >= nOffset)
+        {
+            vecIndices.push_back(id);
+        }
+    }
+}
+
+
+IIndexIterator *FileCache::scanIndices(const IDScanRange &range)
+{
+    if(!isOpen())   return NULL;
+
+    OpenSP::sp<IndexIterator> pIterator = new IndexIterator(this, range);
+    return pIterator.release();
+}
+
+
+FileCache::IndexIterator::IndexIterator(FileCache *pFileCache, const IDScanRange &range)
+    : m_pFileCache(pFileCache), m_range(range), m_nNext(0u), m_bStarted(false), m_bEnd(false)
+{
+    // the words wholly under the mask from the highest one down pin the IDs to one stretch,
+    // the scan seeks it rather than walking up to it
+    const UINT_64 nAll = ~(UINT_64)0u;
+    const ID &idMask  = range.m_idMask;
+    const ID &idValue = range.m_idValue;
+    ID idLow(0u, 0u, 0u), idHigh;
+    if(idMask.m_nHighBit == nAll)
+    {
+        idLow  = ID(idValue.m_nHighBit, 0u, 0u);
+        idHigh = ID(idValue.m_nHighBit, nAll, nAll);
+        if(idMask.m_nMidBit == nAll)
+        {
+            idLow  = ID(idValue.m_nHighBit, idValue.m_nMidBit, 0u);
+            idHigh = ID(idValue.m_nHighBit, idValue.m_nMidBit, nAll);
+            if(idMask.m_nLowBit == nAll)
+            {
+                idLow  = idValue;
+                idHigh = idValue;
+            }
+        }
+    }
+    if(m_range.m_idFirst < idLow)
+    {
+        m_range.m_idFirst = idLow;
+    }
+    if(idHigh < m_range.m_idLast)
+    {
+        m_range.m_idLast = idHigh;
+    }
+}
+
+
+bool FileCache::IndexIterator::next(ID &id)
+{
+    while(m_nNext >= m_vecBatch.size())
+    {
+        if(m_bEnd)
+        {
+            return false;
+        }
+        m_bEnd     = !m_pFileCache->collectIndices(m_range, m_bStarted ? &m_idLastSeen : NULL, m_vecBatch, m_idLastSeen);
+        m_bStarted = true;
+        m_nNext    = 0u;
+    }
+    id = m_vecBatch[m_nNext++];
+    return true;
+}
+
+
+bool FileCache::collectIndices(const IDScanRange &range, const ID *pAfter, std::vector<ID> &vecIDs, ID &idLastSeen)
+{
+    vecIDs.clear();
+    if(!isOpen() || range.m_idLast < range.m_idFirst)
+    {
+        return false;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+
+    // the same merge as getIndices(), both sides seek the beginning of the range
+    const ID       &idFrom     = (pAfter != NULL) ? *pAfter : range.m_idFirst;
+    const UINT_64   nBaseCount = m_pSortedIndex.valid() ? m_pSortedIndex->getRecordCount() : 0u;
+    UINT_64         nBase      = m_pSortedIndex.valid() ? m_pSortedIndex->lowerBound(idFrom) : 0u;
+    const UINT_64   nFirstBase = nBase;
+    ID              idBase, idLastBase;
+    bool            bBaseValid = false;
+    unsigned        nScanned   = 0u;
+    std::map<ID, VersionList>::const_iterator itorBlock = (pAfter != NULL) ? m_mapVersion.upper_bound(*pAfter) : m_mapVersion.lower_bound(range.m_idFirst);
+    while(true)
+    {
+        while(!bBaseValid && nBase < nBaseCount)
+        {
+            SortedIdxRecord record;
+            m_pSortedIndex->getRecord(nBase, record);
+            if(nBase++ > nFirstBase && record.m_blockInIdx.m_id == idLastBase)
+            {
+                continue;
+            }
+            idLastBase = record.m_blockInIdx.m_id;
+            if((pAfter != NULL && !(*pAfter < idLastBase))
+                || m_mapVersion.find(idLastBase) != m_mapVersion.end() || m_setDetached.find(idLastBase) != m_setDetached.end())
+            {
+                continue;
+            }
+            idBase     = idLastBase;
+            bBaseValid = true;
+        }
+
+        const bool bDeltaValid = (itorBlock != m_mapVersion.end());
+        if(!bBaseValid && !bDeltaValid)
+        {
+            return false;
+        }
+
+        ID id;
+        if(bBaseValid && (!bDeltaValid || idBase < itorBlock->first))
+        {
+            id         = idBase;
+            bBaseValid = false;
+        }
+        else
+        {
+            id = itorBlock->first;
+            ++itorBlock;
+        }
+
+        if(range.m_idLast < id)
+        {
+            return false;
+        }
+        idLastSeen = id;
+        if(isInScan(range, id))
+        {
+            vecIDs.push_back(id);
+        }
+        if(vecIDs.size() >= g_nScanBatchIDs || ++nScanned >= g_nMaxScannedIDs)
+        {
+            return true;
+        }
+    }
+}
+
+
+bool FileCache::beginBulkLoad(void)
+{
+    if(!isOpen())   return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockCompaction(m_mtxCompaction);
+    if(m_compactionStatus.m_bRunning)
+    {
+        return false;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBulkLoad);
+    if(m_pBulkLoader.valid())
+    {
+        return false;
+    }
+    m_pBulkLoader = new BulkLoader;
+    m_pBulkLoader->init(m_pDataBase.get());
+    return true;
+}
+
+
+bool FileCache::bulkAddBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = BlockBuffer::copyFrom(pBuffer, nBufLen);
+    return bulkAddBlock(id, pBlockBuffer.get());
+}
+
+
+bool FileCache::bulkAddBlock(const ID &id, IBlockBuffer *pBuffer)
+{
+    OpenSP::sp<IBlockBuffer> pBlockBuffer = pBuffer;
+    if(!isOpen())   return false;
+
+    OpenSP::sp<BulkLoader> pBulkLoader;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBulkLoad);
+        pBulkLoader = m_pBulkLoader;
+    }
+
+    // the bloom filter answers most of the new IDs without the index lock
+    if(!pBulkLoader.valid() || isExist(id))
+    {
+        return false;
+    }
+
+    OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pBlockCodec->encode(pBlockBuffer.get());
+    if(!pStoredBuffer.valid())
+    {
+        return pBulkLoader->addBlock(id, NULL, 0u);
+    }
+    return pBulkLoader->addBlock(id, pStoredBuffer->getData(), pStoredBuffer->getLength());
+}
+
+
+bool FileCache::endBulkLoad(void)
+{
+    if(!isOpen())   return false;
+
+    // no compaction starts before the files of the load are in the database
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockCompaction(m_mtxCompaction);
+
+    OpenSP::sp<BulkLoader> pBulkLoader;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBulkLoad);
+        pBulkLoader   = m_pBulkLoader;
+        m_pBulkLoader = NULL;
+    }
+    if(!pBulkLoader.valid())
+    {
+        return false;
+    }
+
+    std::vector<BlockInIdx> vecLoaded;
+    if(!pBulkLoader->finish(vecLoaded))
+    {
+        std::cout << "Warning: failed to write the bulk load, none of its blocks is kept." << std::endl;
+        pBulkLoader->cancel();
+        return false;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+
+    // the IDs written the usual way meanwhile keep those blocks, all the loaded ones share one version
+    const unsigned  nVersion = nextVersion();
+    FILE_GAP_MAP    mapBlocks;
+    VersionList     vList;
+    size_t          nKept = 0u;
+    for(size_t n = 0u; n < vecLoaded.size(); n++)
+    {
+        const ID &id = vecLoaded[n].m_id;
+        if(mayExist(id) && (m_mapVersion.find(id) != m_mapVersion.end() || findBaseVersions(id, vList)))
+        {
+            continue;
+        }
+
+        BlockInIdx &block = vecLoaded[nKept++];
+        block = vecLoaded[n];
+        block.m_nVersion = nVersion;
+        if(block.m_infoDBBlock.m_gap.m_nLength > 0u)
+        {
+            mapBlocks[block.m_infoDBBlock.m_nDBFile].push_back(block.m_infoDBBlock.m_gap);
+        }
+    }
+    vecLoaded.resize(nKept);
+
+    // the space of the blocks dropped above stays free in the files
+    const std::vector<unsigned> &vecDBFiles = pBulkLoader->getDBFiles();
+    for(size_t n = 0u; n < vecDBFiles.size(); n++)
+    {
+        if(!m_pDataBase->attachFile(vecDBFiles[n], mapBlocks[vecDBFiles[n]]))
+        {
+            std::cout << "Error: failed to open the data file " << DataBase::getDBFilePath(m_strDB, vecDBFiles[n]) << " of the bulk load." << std::endl;
+            return false;
+        }
+    }
+
+    // the .idx gets the records in ID order behind everything else, the sorted index takes them from memory
+    const unsigned nLoadedPos = m_nCurPosInIndex;
+    if(!m_pRoutineManager->appendIndices(vecLoaded, nLoadedPos))
+    {
+        std::cout << "Error: failed to write the index of the bulk load." << std::endl;
+        return false;
+    }
+    m_nCurPosInIndex = nLoadedPos + (unsigned)(vecLoaded.size() * sizeof(BlockInIdx));
+    m_bIndexDirty    = true;
+    rebaseLoadedIndex(vecLoaded, nLoadedPos);
+
+    // one filter for the grown database rather than doubling the old one over and over
+    OpenSP::sp<BloomFilter> pFilter = buildBloomFilter(BloomFilter::getCapacityFor(m_nBlockCount));
+    m_vecBloomFilters.push_back(pFilter);
+    m_pBloomFilter.assign(pFilter.get(), m_pBloomFilter.get());
+    return true;
+}
+
+
+bool FileCache::startCompaction(UINT_64 nBytesPerSecond, bool bDropOldVersions)
+{
+    if(!isOpen())   return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxCompaction);
+    if(m_compactionStatus.m_bRunning)
+    {
+        return false;
+    }
+    {
+        // the files of a bulk load are not in the database yet, so they would not be sealed
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBulkLoad(m_mtxBulkLoad);
+        if(m_pBulkLoader.valid())
+        {
+            return false;
+        }
+    }
+    if(m_pCompactionThread != NULL)
+    {
+        // the last run has finished by itself
+        m_pCompactionThread->join();
+        delete m_pCompactionThread;
+    }
+
+    memset(&m_compactionStatus, 0, sizeof(CompactionStatus));
+    m_compactionStatus.m_bRunning = true;
+    m_nCompactionRate  = nBytesPerSecond;
+    m_bDropOldVersions = bDropOldVersions;
+    m_bStopCompaction  = false;
+
+    m_pCompactionThread = new CompactionThread(this);
+    m_pCompactionThread->startThread();
+    return true;
+}
+
+
+void FileCache::stopCompaction(void)
+{
+    CompactionThread *pThread = NULL;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxCompaction);
+        pThread = m_pCompactionThread;
+        m_pCompactionThread = NULL;
+        m_bStopCompaction   = true;
+    }
+
+    if(pThread != NULL)
+    {
+        pThread->join();
+        delete pThread;
+    }
+}
+
+
+void FileCache::getCompactionStatus(CompactionStatus &status) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(const_cast<OpenThreads::Mutex &>(m_mtxCompaction));
+    status = m_compactionStatus;
+}
+
+
+void FileCache::compact(void)
+{
+    const std::string   strIndexFilePath = m_strDB + g_strIndexFileExt;
+
+    // 1. every block written from now on goes into new files, the sealed ones can only get emptier
+    std::set<unsigned> setSealed;
+    m_pDataBase->sealFiles(setSealed);
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxCompaction);
+        m_compactionStatus.m_nDataBytesBefore  = m_pDataBase->getFileSize();
+        m_compactionStatus.m_nIndexBytesBefore = cmm::getFileLength(strIndexFilePath);
+    }
+
+    // 2. move the living blocks of the sealed files in ID order, so the new files get them one after another
+    std::vector<SortedIdxRecord> vecRecords;
+    ID          idLast;
+    bool        bFirstBatch  = true;
+    UINT_64     nPacedBytes  = 0u;
+    size_t      nMovedBlocks = 0u;
+    while(!m_bStopCompaction)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+            collectRecords(bFirstBatch ? NULL : &idLast, g_nCompactionBatchIDs, vecRecords);
+        }
+        if(vecRecords.empty())
+        {
+            break;
+        }
+        bFirstBatch = false;
+        idLast      = vecRecords.back().m_blockInIdx.m_id;
+
+        std::vector<SortedIdxRecord>::const_iterator itorRecord = vecRecords.begin();
+        for( ; itorRecord != vecRecords.end() && !m_bStopCompaction; ++itorRecord)
+        {
+            const BlockInIdx &blockInIdx = itorRecord->m_blockInIdx;
+            if(!m_bDropOldVersions && m_nRetainedVersions == 0u && setSealed.find(blockInIdx.m_infoDBBlock.m_nDBFile) == setSealed.end())
+            {
+                continue;
+            }
+
+            UINT_64 nMovedBytes = 0u;
+            const MoveResult eResult = moveBlock(blockInIdx, setSealed, nMovedBytes);
+            if(eResult == MR_SKIPPED)
+            {
+                continue;
+            }
+
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxCompaction);
+                if(eResult == MR_MOVED)
+                {
+                    m_compactionStatus.m_nBlocksMoved++;
+                    m_compactionStatus.m_nBytesMoved += nMovedBytes;
+                }
+                else
+                {
+                    m_compactionStatus.m_nVersionsDropped++;
+                }
+            }
+            nMovedBlocks++;
+
+            // the sleeps alone would take the moved bytes at the given rate, so it never runs faster
+            nPacedBytes += nMovedBytes;
+            if(m_nCompactionRate > 0u && nPacedBytes >= m_nCompactionRate / 10u)
+            {
+                OpenThreads::Thread::microSleep((unsigned)(nPacedBytes * 1000000u / m_nCompactionRate));
+                nPacedBytes = 0u;
+            }
+        }
+
+        // the moved blocks stay in the delta, the sorted index takes them over from time to time
+        if(nMovedBlocks >= g_nMaxMaterializedIDs)
+        {
+            rebaseIndex(false);
+            nMovedBlocks = 0u;
+        }
+    }
+
+    // 3. the .idx is rewritten without its gaps, and the log is emptied before any file goes,
+    // the swap of the .idx has done that already, the routines queued since only address the new files
+    const bool bFinished = !m_bStopCompaction;
+    if(!bFinished || !rebaseIndex(true))
+    {
+        if(bFinished)
+        {
+            std::cout << "Warning: failed to rewrite the index file densely, it keeps its gaps." << std::endl;
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        m_pRoutineManager->flush(true);
+    }
+
+    // 4. the emptied files are deleted, a stopped run leaves some of them, the new files lose their free tails
+    std::set<unsigned>::const_iterator itorFile = setSealed.begin();
+    for( ; itorFile != setSealed.end(); ++itorFile)
+    {
+        m_pDataBase->removeFile(*itorFile);
+    }
+    m_pDataBase->unsealFiles();
+    m_pDataBase->trimFiles();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxCompaction);
+    m_compactionStatus.m_nDataBytesAfter  = m_pDataBase->getFileSize();
+    m_compactionStatus.m_nIndexBytesAfter = cmm::getFileLength(strIndexFilePath);
+    m_compactionStatus.m_bFinished        = bFinished;
+    m_compactionStatus.m_bRunning         = false;
+}
+
+
+bool FileCache::isVersionExpired(const VersionList &vList, unsigned nVersion) const
+{
+    if(nVersion == vList.back())
+    {
+        return false;
+    }
+    if(m_bDropOldVersions)
+    {
+        return true;
+    }
 
-            infoOldDBBlock = pBlock->m_infoDBBlock;
+    // only the newest m_nRetainedVersions are kept
+    const unsigned nRetained = m_nRetainedVersions;
+    return (nRetained > 0u && vList.size() > nRetained && nVersion < vList[vList.size() - nRetained]);
+}
 
-            std::map<UINT_64, DataBlock *>::iterator itorBuffer = m_mapBlockBuffer.find(pBlock->m_nLastRefTime);
-            if(itorBuffer != m_mapBlockBuffer.end())
-            {
-                pMemDelete = pBlock->m_pMemory;
-                m_mapBlockBuffer.erase(itorBuffer);
-                m_nCurrentMemorySize -= pBlock->m_infoDBBlock.m_gap.m_nLength;
-            }
-            routine.m_nPosInIndex = pBlock->m_nPosInIndex;
-            bOldBlockExist = true;
+
+FileCache::MoveResult FileCache::moveBlock(const BlockInIdx &blockInIdx, const std::set<unsigned> &setSealed, UINT_64 &nMovedBytes)
+{
+    const ID       &id       = blockInIdx.m_id;
+    const unsigned  nVersion = blockInIdx.m_nVersion;
+    nMovedBytes = 0u;
+
+    // 1. the block must still be where it was collected
+    DBBlockInfo infoOld;
+    OpenSP::sp<IBlockBuffer> pStoredBuffer;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+        if(itorVersion == m_mapVersion.end())
+        {
+            return MR_SKIPPED;
         }
-        else
+        std::map<IDVersion, DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, nVersion));
+        if(itorBlock == m_mapDataBlocks.end() || !isSameBlockInfo(itorBlock->second.m_infoDBBlock, blockInIdx.m_infoDBBlock))
         {
-            if(m_listGapsInIndex.empty())
-            {
-                routine.m_nPosInIndex = m_nCurPosInIndex;
-                m_nCurPosInIndex += sizeof(BlockInIdx);
-            }
-            else
-            {
-                routine.m_nPosInIndex = m_listGapsInIndex.front();
-                m_listGapsInIndex.erase(m_listGapsInIndex.begin());
-            }
-            routine.m_eRoutineType = Routine::RT_ADD;
+            return MR_SKIPPED;
         }
 
-        VersionList& vList = m_mapVersion[id];
-        if(vList.empty())
+        if(isVersionExpired(itorVersion->second, nVersion))
         {
-            vList.push_back(curVersion);
+            dropVersion(itorVersion, itorBlock);
+            return MR_DROPPED;
         }
-        else
+
+        infoOld = itorBlock->second.m_infoDBBlock;
+        if(infoOld.m_gap.m_nLength == 0u || setSealed.find(infoOld.m_nDBFile) == setSealed.end())
         {
-            VersionList::iterator verItor = std::find(vList.begin(),vList.end(),curVersion);
-            if(verItor == vList.end())
-            {
-                vList.push_back(curVersion);
-                std::sort(vList.begin(),vList.end());
-            }
+            return MR_SKIPPED;
         }
 
-        if(!pBlock)
+        // a writer may have got its gap just before the files were sealed, its data is still queued then
+        pStoredBuffer = m_pRoutineManager->readRoutineBlock(id, nVersion);
+    }
+
+    // 2. the block is copied as it is stored, it is neither decoded nor encoded again
+    if(!pStoredBuffer.valid())
+    {
+        void *pMemory = m_pDataBase->readBlock(infoOld);
+        if(!pMemory)
         {
-            pBlock = &m_mapDataBlocks[idVersion];
+            return MR_SKIPPED;
         }
+        pStoredBuffer = new BlockBuffer(pMemory, infoOld.m_gap.m_nLength);
+    }
 
-        pBlock->m_nVersion     = routine.m_nVersion;
-        pBlock->m_nPosInIndex  = routine.m_nPosInIndex;
-        pBlock->m_pMemory      = pMemoryNew;
-        pBlock->m_nLastRefTime = 0u;
-        pBlock->m_infoDBBlock.m_nDBFile = nDBFileForNew;
-        pBlock->m_infoDBBlock.m_gap.m_nPosition = nPositionForNew;
-        pBlock->m_infoDBBlock.m_gap.m_nLength   = 0u;
+    DBBlockInfo infoNew;
+    infoNew.m_gap.m_nLength = infoOld.m_gap.m_nLength;
+    if(!m_pDataBase->allocBlock(infoNew.m_gap.m_nLength, infoNew.m_nDBFile, infoNew.m_gap.m_nPosition))
+    {
+        return MR_SKIPPED;
+    }
 
-        if(!bEmptyBlock)
-        {
-            pBlock->m_nLastRefTime = getRefTime();
+    // 3. a writer may have replaced or removed it meanwhile, then the copy is thrown away
+    m_pRoutineManager->waitForRoom();
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+    std::map<ID, VersionList>::iterator itorVersion = findVersions(id);
+    std::map<IDVersion, DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, nVersion));
+    if(itorVersion == m_mapVersion.end() || itorBlock == m_mapDataBlocks.end() || !isSameBlockInfo(itorBlock->second.m_infoDBBlock, infoOld))
+    {
+        m_pDataBase->releaseBlock(infoNew);
+        return MR_SKIPPED;
+    }
 
-            pBlock->m_infoDBBlock.m_gap.m_nLength    = nNewBufLen;
-            m_mapBlockBuffer[pBlock->m_nLastRefTime] = pBlock;
+    // the record keeps its slot in the .idx, only its place in the data files changes
+    DataBlock &block = itorBlock->second;
+    Routine routine;
+    routine.m_eRoutineType = Routine::RT_UPDATE;
+    routine.m_nPosInIndex  = block.m_nPosInIndex;
+    routine.m_infoDBBlock  = infoNew;
+    routine.m_nVersion     = nVersion;
+    routine.m_pDataBlock   = pStoredBuffer;
+    m_pRoutineManager->addRoutine(id, routine);
 
-            m_nCurrentMemorySize  += pBlock->m_infoDBBlock.m_gap.m_nLength;
-            if(m_nCurrentMemorySize > m_nBufferSizeLimited)
-            {
-                m_blockBuffer.set(false);
-                m_pRestrictMemThread->suspend(false);
-            }
+    block.m_infoDBBlock = infoNew;
+    block.m_bInBase     = false;
+    m_bIndexDirty       = true;
+
+    // the sealed file never hands the gap out again, a reader which is still on it gets the old copy
+    m_pDataBase->releaseBlock(infoOld);
+
+    nMovedBytes = infoNew.m_gap.m_nLength;
+    return MR_MOVED;
+}
+
+
+void FileCache::dropVersion(std::map<ID, VersionList>::iterator itorVersion, std::map<IDVersion, DataBlock>::iterator itorBlock)
+{
+    const ID        id       = itorVersion->first;
+    const DataBlock block    = itorBlock->second;
+
+    m_listGapsInIndex.push_back(block.m_nPosInIndex);
+
+    Routine routine;
+    routine.m_eRoutineType = Routine::RT_REMOVE;
+    routine.m_nPosInIndex  = block.m_nPosInIndex;
+    m_pRoutineManager->addRoutine(id, routine);
+
+    m_mapDataBlocks.erase(itorBlock);
+    m_bIndexDirty = true;
+
+    // the other versions stay in the delta, the sorted index still has the dropped one
+    VersionList &vList = itorVersion->second;
+    VersionList::iterator itorDropped = std::find(vList.begin(), vList.end(), block.m_nVersion);
+    retireBlock(id, block.m_nVersion, *(itorDropped + 1), block.m_infoDBBlock);
+    vList.erase(itorDropped);
+    for(unsigned n = 0u; n < vList.size(); n++)
+    {
+        std::map<IDVersion, DataBlock>::iterator itorFind = m_mapDataBlocks.find(IDVersion(id, vList[n]));
+        if(itorFind != m_mapDataBlocks.end())
+        {
+            itorFind->second.m_bInBase = false;
         }
     }
+}
 
-    if(bOldBlockExist)
+
+void FileCache::setVerification(BlockVerification eVerification)
+{
+    m_eVerification = eVerification;
+}
+
+
+bool FileCache::checkStoredBlock(const ID &id, bool bCorrupt)
+{
+    if(!bCorrupt)
     {
-        m_pDataBase->releaseBlock(infoOldDBBlock);
+        return true;
+    }
+
+    reportCorruptBlock(id);
+    return m_eVerification != BV_STRICT;
+}
+
+
+void FileCache::reportCorruptBlock(const ID &id)
+{
+    std::cout << "Warning: the block " << id.toString() << " fails its checksum." << std::endl;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+    m_setCorruptIDs.insert(id);
+}
+
+
+bool FileCache::startScrub(UINT_64 nBytesPerSecond)
+{
+    if(!isOpen())   return false;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+    if(m_scrubStatus.m_bRunning)
+    {
+        return false;
     }
-    if(pMemDelete)
+    if(m_pScrubThread != NULL)
     {
-        free(pMemDelete);
+        // the last run has finished by itself
+        m_pScrubThread->join();
+        delete m_pScrubThread;
     }
 
-    m_pRoutineManager->addRoutine(id, routine);
+    memset(&m_scrubStatus, 0, sizeof(ScrubStatus));
+    m_scrubStatus.m_bRunning = true;
+    m_nScrubRate = nBytesPerSecond;
+    m_bStopScrub = false;
+
+    m_pScrubThread = new ScrubThread(this);
+    m_pScrubThread->setSchedulePriority(OpenThreads::Thread::THREAD_PRIORITY_LOW);
+    m_pScrubThread->startThread();
     return true;
 }
 
 
-unsigned FileCache::getBlockCount(void) const
+void FileCache::stopScrub(void)
 {
-    if(!isOpen())   return false;
+    ScrubThread *pThread = NULL;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+        pThread = m_pScrubThread;
+        m_pScrubThread = NULL;
+        m_bStopScrub   = true;
+    }
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
-    return m_mapVersion.size();
+    if(pThread != NULL)
+    {
+        pThread->join();
+        delete pThread;
+    }
 }
 
 
-void FileCache::getIndices(std::vector<ID> &vecIndices, unsigned nOffset/* = 0u*/, unsigned nCount/* = ~0u*/) const
+void FileCache::getScrubStatus(ScrubStatus &status, std::vector<ID> &vecCorruptIDs) const
 {
-    if(!isOpen())   return;
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(const_cast<OpenThreads::Mutex &>(m_mtxScrub));
+    status = m_scrubStatus;
+    vecCorruptIDs.assign(m_setCorruptIDs.begin(), m_setCorruptIDs.end());
+}
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(const_cast<OpenThreads::Mutex &>(m_mtxDataBlocks));
 
-    vecIndices.clear();
-    if(nCount == ~0u)
+bool FileCache::isBlockInFiles(const BlockInIdx &blockInIdx)
+{
+    const ID &id = blockInIdx.m_id;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+    if(findVersions(id) == m_mapVersion.end())
+    {
+        return false;
+    }
+    std::map<IDVersion, DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, blockInIdx.m_nVersion));
+    if(itorBlock == m_mapDataBlocks.end() || !isSameBlockInfo(itorBlock->second.m_infoDBBlock, blockInIdx.m_infoDBBlock))
+    {
+        return false;
+    }
+
+    // a queued block has its gap already, but not its data
+    return !m_pRoutineManager->readRoutineBlock(id, blockInIdx.m_nVersion).valid();
+}
+
+
+bool FileCache::scrubBlock(const BlockInIdx &blockInIdx, BlockCodec::VerifyResult &eResult)
+{
+    // a block which is not valid is read once more after it is known to be written and unchanged,
+    // the first read may have met a gap which was being reused or not written yet
+    for(unsigned nTry = 0u; ; nTry++)
     {
-        if(nOffset >= m_mapVersion.size())
+        eResult = BlockCodec::VR_CORRUPT;
+        void *pMemory = m_pDataBase->readBlock(blockInIdx.m_infoDBBlock);
+        if(pMemory != NULL)
         {
-            return;
+            OpenSP::sp<IBlockBuffer> pStoredBuffer = new BlockBuffer(pMemory, blockInIdx.m_infoDBBlock.m_gap.m_nLength);
+            eResult = m_pBlockCodec->verify(pStoredBuffer.get());
+        }
+        if(eResult == BlockCodec::VR_VALID)
+        {
+            return true;
+        }
+        if(!isBlockInFiles(blockInIdx))
+        {
+            return false;
+        }
+        if(nTry > 0u)
+        {
+            if(eResult == BlockCodec::VR_CORRUPT)
+            {
+                reportCorruptBlock(blockInIdx.m_id);
+            }
+            return true;
         }
-        vecIndices.reserve(m_mapVersion.size() - nOffset);
     }
-    else if(nCount == 0u)
+}
+
+
+void FileCache::scrub(void)
+{
+    std::vector<SortedIdxRecord> vecRecords;
+    ID          idLast;
+    bool        bFirstBatch = true;
+    UINT_64     nPacedBytes = 0u;
+    while(!m_bStopScrub)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+            collectRecords(bFirstBatch ? NULL : &idLast, g_nCompactionBatchIDs, vecRecords);
+        }
+        if(vecRecords.empty())
+        {
+            break;
+        }
+        bFirstBatch = false;
+        idLast      = vecRecords.back().m_blockInIdx.m_id;
+
+        // the batch is read in the order of the files, so the disk goes forward
+        std::sort(vecRecords.begin(), vecRecords.end(), isRecordAhead);
+
+        std::vector<SortedIdxRecord>::const_iterator itorRecord = vecRecords.begin();
+        for( ; itorRecord != vecRecords.end() && !m_bStopScrub; ++itorRecord)
+        {
+            const BlockInIdx &blockInIdx = itorRecord->m_blockInIdx;
+            const unsigned nLength = blockInIdx.m_infoDBBlock.m_gap.m_nLength;
+            BlockCodec::VerifyResult eResult;
+            if(nLength == 0u || !scrubBlock(blockInIdx, eResult))
+            {
+                continue;
+            }
+
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+                m_scrubStatus.m_nBlocksChecked++;
+                m_scrubStatus.m_nBytesChecked += nLength;
+                if(eResult == BlockCodec::VR_UNCHECKED)
+                {
+                    m_scrubStatus.m_nBlocksUnchecked++;
+                }
+                else if(eResult == BlockCodec::VR_CORRUPT)
+                {
+                    m_scrubStatus.m_nBlocksCorrupt++;
+                }
+            }
+
+            nPacedBytes += nLength;
+            if(m_nScrubRate > 0u && nPacedBytes >= m_nScrubRate / 10u)
+            {
+                OpenThreads::Thread::microSleep((unsigned)(nPacedBytes * 1000000u / m_nScrubRate));
+                nPacedBytes = 0u;
+            }
+        }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxScrub);
+    m_scrubStatus.m_bFinished = !m_bStopScrub;
+    m_scrubStatus.m_bRunning  = false;
+}
+
+
+unsigned FileCache::createSnapshot(void)
+{
+    if(!isOpen())   return 0u;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+    m_setSnapshots.insert(m_nLastVersion);
+    return m_nLastVersion;
+}
+
+
+void FileCache::releaseSnapshot(unsigned nSnapshot)
+{
+    if(!isOpen())   return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+    std::multiset<unsigned>::iterator itorSnapshot = m_setSnapshots.find(nSnapshot);
+    if(itorSnapshot == m_setSnapshots.end())
     {
         return;
     }
-    else
+    m_setSnapshots.erase(itorSnapshot);
+    releaseRetiredBlocks(false);
+}
+
+
+void FileCache::setVersionRetention(unsigned nMaxVersions)
+{
+    m_nRetainedVersions = nMaxVersions;
+}
+
+
+unsigned FileCache::nextVersion(void)
+{
+    // the clock for the versions read by time, one above the last for the writes within a second
+    const unsigned nNow = (unsigned)time(NULL);
+    m_nLastVersion = (nNow > m_nLastVersion) ? nNow : m_nLastVersion + 1u;
+    return m_nLastVersion;
+}
+
+
+bool FileCache::isSeenBySnapshot(unsigned nVersion, unsigned nNextVersion) const
+{
+    // a snapshot sees the newest version not above it
+    std::multiset<unsigned>::const_iterator itorSnapshot = m_setSnapshots.lower_bound(nVersion);
+    return (itorSnapshot != m_setSnapshots.end() && *itorSnapshot < nNextVersion);
+}
+
+
+void FileCache::retireBlock(const ID &id, unsigned nVersion, unsigned nNextVersion, const DBBlockInfo &infoDBBlock)
+{
+    if(!isSeenBySnapshot(nVersion, nNextVersion))
     {
-        vecIndices.reserve(nCount);
+        m_pDataBase->releaseBlock(infoDBBlock);
+        return;
     }
 
-    std::map<ID, VersionList>::const_iterator itorBlock = m_mapVersion.begin();
-    for(unsigned nIndex = 0u; itorBlock != m_mapVersion.end(); ++itorBlock, ++nIndex)
+    RetiredBlock retired;
+    retired.m_nVersion     = nVersion;
+    retired.m_nNextVersion = nNextVersion;
+    retired.m_infoDBBlock  = infoDBBlock;
+    m_mapRetired[id].push_back(retired);
+}
+
+
+bool FileCache::findRetiredBlock(const ID &id, unsigned nSnapshot, RetiredBlock &retired) const
+{
+    std::map<ID, std::vector<RetiredBlock> >::const_iterator itorRetired = m_mapRetired.find(id);
+    if(itorRetired == m_mapRetired.end())
     {
-        if(nIndex < nOffset)            continue;
-        if(vecIndices.size() >= nCount) break;
+        return false;
+    }
 
-        vecIndices.push_back(itorBlock->first);
+    // it was the one seen by the snapshot when it was given up, no version in the index can be newer
+    std::vector<RetiredBlock>::const_iterator itorBlock = itorRetired->second.begin();
+    for( ; itorBlock != itorRetired->second.end(); ++itorBlock)
+    {
+        if(itorBlock->m_nVersion <= nSnapshot && nSnapshot < itorBlock->m_nNextVersion)
+        {
+            retired = *itorBlock;
+            return true;
+        }
     }
+    return false;
 }
 
 
-bool FileCache::restrictMemory(void)
+bool FileCache::readRetiredBlock(const ID &id, unsigned nSnapshot, OpenSP::sp<IBlockBuffer> &pBuffer, bool &bFound)
 {
-    void *pMemDelete = NULL;
+    bFound = false;
+    while(true)
     {
-        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDataBlocks);
-        if(m_nCurrentMemorySize <= m_nBufferSizeLimited)
+        RetiredBlock retired;
         {
-            m_blockBuffer.release();
-            return true;
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+            if(!findRetiredBlock(id, nSnapshot, retired))
+            {
+                return false;
+            }
+            bFound = true;
+            if(retired.m_infoDBBlock.m_gap.m_nLength == 0u)
+            {
+                return true;
+            }
+
+            // it may have been given up before the writer got to it
+            OpenSP::sp<IBlockBuffer> pStoredBuffer = m_pRoutineManager->readRoutineBlock(id, retired.m_nVersion);
+            if(pStoredBuffer.valid())
+            {
+                pBuffer = m_pBlockCodec->decode(pStoredBuffer.get());
+                return pBuffer.valid();
+            }
+        }
+
+        // it is not in the cache, which only keeps the latest versions
+        void *pMemory = m_pDataBase->readBlock(retired.m_infoDBBlock);
+        bool bCorrupt = false;
+        OpenSP::sp<IBlockBuffer> pRawBuffer;
+        if(pMemory != NULL)
+        {
+            OpenSP::sp<IBlockBuffer> pStoredBuffer = new BlockBuffer(pMemory, retired.m_infoDBBlock.m_gap.m_nLength);
+            bCorrupt   = (m_eVerification != BV_NONE && m_pBlockCodec->verify(pStoredBuffer.get()) == BlockCodec::VR_CORRUPT);
+            pRawBuffer = m_pBlockCodec->decode(pStoredBuffer.get());
+        }
+
+        // the gap is free once the last snapshot which could see it is released
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lockBlock(m_mtxDataBlocks);
+        RetiredBlock retiredNow;
+        if(!findRetiredBlock(id, nSnapshot, retiredNow) || !isSameBlockInfo(retiredNow.m_infoDBBlock, retired.m_infoDBBlock))
+        {
+            bFound = false;
+            continue;
+        }
+        if(pMemory == NULL || !checkStoredBlock(id, bCorrupt))
+        {
+            return false;
         }
-        assert(!m_mapBlockBuffer.empty());
+        pBuffer = pRawBuffer;
+        return pBuffer.valid();
+    }
+}
 
-        DataBlock *pBlock      = m_mapBlockBuffer.begin()->second;
-        pMemDelete             = pBlock->m_pMemory;
-        pBlock->m_nLastRefTime = 0u;
-        pBlock->m_pMemory      = NULL;
 
-        assert(m_nCurrentMemorySize >= pBlock->m_infoDBBlock.m_gap.m_nLength);
+void FileCache::releaseRetiredBlocks(bool bAll)
+{
+    std::map<ID, std::vector<RetiredBlock> >::iterator itorRetired = m_mapRetired.begin();
+    while(itorRetired != m_mapRetired.end())
+    {
+        std::vector<RetiredBlock> &vecBlocks = itorRetired->second;
+        for(size_t n = 0u; n < vecBlocks.size(); )
+        {
+            if(!bAll && isSeenBySnapshot(vecBlocks[n].m_nVersion, vecBlocks[n].m_nNextVersion))
+            {
+                n++;
+                continue;
+            }
+            m_pDataBase->releaseBlock(vecBlocks[n].m_infoDBBlock);
+            vecBlocks[n] = vecBlocks.back();
+            vecBlocks.pop_back();
+        }
+
+        if(vecBlocks.empty())
+        {
+            m_mapRetired.erase(itorRetired++);
+        }
+        else
+        {
+            ++itorRetired;
+        }
+    }
+}
 
-        m_mapBlockBuffer.erase(m_mapBlockBuffer.begin());
 
-        m_nCurrentMemorySize -= pBlock->m_infoDBBlock.m_gap.m_nLength;
+void FileCache::trimVersions(std::map<ID, VersionList>::iterator itorVersion)
+{
+    const unsigned nRetained = m_nRetainedVersions;
+    if(nRetained == 0u || itorVersion == m_mapVersion.end())
+    {
+        return;
     }
 
-    free(pMemDelete);
-    return false;
+    const ID id = itorVersion->first;
+    while(itorVersion->second.size() > nRetained)
+    {
+        std::map<IDVersion, DataBlock>::iterator itorBlock = m_mapDataBlocks.find(IDVersion(id, itorVersion->second.front()));
+        if(itorBlock == m_mapDataBlocks.end())
+        {
+            break;
+        }
+        dropVersion(itorVersion, itorBlock);
+    }
 }
 
 }
@@ -0,0 +1,214 @@
+#include "FreeSpaceMap.h"
+#include <algorithm>
+
+namespace deudb
+{
+
+FreeSpaceMap::FreeSpaceMap(void)
+{
+    m_nClassMask = 0u;
+    m_nFreeSize  = 0u;
+}
+
+
+FreeSpaceMap::~FreeSpaceMap(void)
+{
+}
+
+
+void FreeSpaceMap::clear(void)
+{
+    m_mapByOffset.clear();
+    for(unsigned n = 0u; n < SIZE_CLASS_COUNT; n++)
+    {
+        m_setBySize[n].clear();
+    }
+    m_nClassMask = 0u;
+    m_nFreeSize  = 0u;
+}
+
+
+unsigned FreeSpaceMap::getSizeClass(UINT_64 nLength)
+{
+    unsigned nClass = 0u;
+    while(nLength > 1u)
+    {
+        nLength >>= 1u;
+        nClass++;
+    }
+    return nClass;
+}
+
+
+void FreeSpaceMap::insertGap(UINT_64 nPosition, UINT_64 nLength)
+{
+    m_mapByOffset[nPosition] = nLength;
+
+    const unsigned nClass = getSizeClass(nLength);
+    m_setBySize[nClass].insert(std::make_pair(nLength, nPosition));
+    m_nClassMask |= (UINT_64(1u) << nClass);
+
+    m_nFreeSize += nLength;
+}
+
+
+void FreeSpaceMap::eraseGap(GapByOffset::iterator itorGap)
+{
+    const UINT_64 nPosition = itorGap->first;
+    const UINT_64 nLength   = itorGap->second;
+
+    const unsigned nClass = getSizeClass(nLength);
+    m_setBySize[nClass].erase(std::make_pair(nLength, nPosition));
+    if(m_setBySize[nClass].empty())
+    {
+        m_nClassMask &= ~(UINT_64(1u) << nClass);
+    }
+
+    m_mapByOffset.erase(itorGap);
+    m_nFreeSize -= nLength;
+}
+
+
+bool FreeSpaceMap::alloc(unsigned nLength, UINT_64 &nPosition)
+{
+    if(nLength < 1u)    return false;
+
+    // 1. the best fit inside the own size class
+    unsigned nClass = getSizeClass(nLength);
+    GapBySize::const_iterator itorFit = m_setBySize[nClass].lower_bound(std::make_pair(UINT_64(nLength), UINT_64(0u)));
+    if(itorFit == m_setBySize[nClass].end())
+    {
+        // 2. the smallest gap of the next non-empty class, every gap there is big enough
+        const UINT_64 nUpper = (nClass + 1u < SIZE_CLASS_COUNT) ? (m_nClassMask >> (nClass + 1u)) : 0u;
+        if(nUpper == 0u)
+        {
+            return false;
+        }
+
+        nClass++;
+        for(UINT_64 nBits = nUpper; (nBits & 1u) == 0u; nBits >>= 1u)
+        {
+            nClass++;
+        }
+        itorFit = m_setBySize[nClass].begin();
+    }
+
+    const UINT_64 nGapLength   = itorFit->first;
+    const UINT_64 nGapPosition = itorFit->second;
+
+    eraseGap(m_mapByOffset.find(nGapPosition));
+    if(nGapLength > nLength)
+    {
+        insertGap(nGapPosition + nLength, nGapLength - nLength);
+    }
+
+    nPosition = nGapPosition;
+    return true;
+}
+
+
+void FreeSpaceMap::release(UINT_64 nPosition, UINT_64 nLength)
+{
+    if(nLength < 1u)    return;
+
+    UINT_64 nBegin = nPosition;
+    UINT_64 nEnd   = nPosition + nLength;
+
+    // 1. merge with the gaps before it, they may overlap or just touch it
+    GapByOffset::iterator itorNext = m_mapByOffset.upper_bound(nBegin);
+    while(itorNext != m_mapByOffset.begin())
+    {
+        GapByOffset::iterator itorPrev = itorNext;
+        --itorPrev;
+        if(itorPrev->first + itorPrev->second < nBegin)
+        {
+            break;
+        }
+
+        nBegin = itorPrev->first;
+        if(itorPrev->first + itorPrev->second > nEnd)
+        {
+            nEnd = itorPrev->first + itorPrev->second;
+        }
+        eraseGap(itorPrev);
+    }
+
+    // 2. merge with the gaps after it
+    itorNext = m_mapByOffset.lower_bound(nBegin);
+    while(itorNext != m_mapByOffset.end() && itorNext->first <= nEnd)
+    {
+        if(itorNext->first + itorNext->second > nEnd)
+        {
+            nEnd = itorNext->first + itorNext->second;
+        }
+        GapByOffset::iterator itorErase = itorNext++;
+        eraseGap(itorErase);
+    }
+
+    insertGap(nBegin, nEnd - nBegin);
+}
+
+
+UINT_64 FreeSpaceMap::getGapEndsAt(UINT_64 nEnd) const
+{
+    if(m_mapByOffset.empty())   return 0u;
+
+    GapByOffset::const_reverse_iterator itorLast = m_mapByOffset.rbegin();
+    if(itorLast->first + itorLast->second != nEnd)
+    {
+        return 0u;
+    }
+    return itorLast->second;
+}
+
+
+UINT_64 FreeSpaceMap::cutGapEndsAt(UINT_64 nEnd)
+{
+    const UINT_64 nLength = getGapEndsAt(nEnd);
+    if(nLength > 0u)
+    {
+        GapByOffset::iterator itorLast = m_mapByOffset.end();
+        eraseGap(--itorLast);
+    }
+    return nLength;
+}
+
+
+UINT_64 FreeSpaceMap::getLargestGap(void) const
+{
+    for(int nClass = SIZE_CLASS_COUNT - 1; nClass >= 0; nClass--)
+    {
+        if(!m_setBySize[nClass].empty())
+        {
+            return m_setBySize[nClass].rbegin()->first;
+        }
+    }
+    return 0u;
+}
+
+
+void FreeSpaceMap::getGaps(std::vector<FileGap> &vecGaps) const
+{
+    vecGaps.clear();
+    vecGaps.reserve(m_mapByOffset.size());
+
+    GapByOffset::const_iterator itorGap = m_mapByOffset.begin();
+    for( ; itorGap != m_mapByOffset.end(); ++itorGap)
+    {
+        // FileGap cannot describe 4GB, the big gaps are cut and merged again by release()
+        UINT_64 nPosition = itorGap->first;
+        UINT_64 nLength   = itorGap->second;
+        while(nLength > 0u)
+        {
+            FileGap gap;
+            gap.m_nPosition = nPosition;
+            gap.m_nLength   = (unsigned)std::min(nLength, (UINT_64)0x80000000u);
+            vecGaps.push_back(gap);
+
+            nPosition += gap.m_nLength;
+            nLength   -= gap.m_nLength;
+        }
+    }
+}
+
+}
@@ -2,10 +2,16 @@
 #include "DataBase.h"
 #include <assert.h>
 #include <map>
+#include <vector>
+#include <iostream>
 #include <algorithm>
+#include "Common/Common.h"
 
 namespace deudb
 {
+    const UINT_64 RoutineManager::ms_nMaxBatchSize   = 8u * 1024u * 1024u;
+    const UINT_64 RoutineManager::ms_nCheckpointSize = 64u * 1024u * 1024u;
+
     void RoutineManager::RoutineThread::run(void)
     {
         while((unsigned)m_MissionFinished == 0u)
@@ -29,6 +35,7 @@ namespace deudb
         m_nWriteBufferSize    = 0u;
         m_pRoutineThread      = NULL;
         m_pIndexFile          = NULL;
+        m_nIndexFileEnd       = 0u;
     }
 
 
@@ -37,11 +44,21 @@ namespace deudb
         m_pRoutineThread->finishMission();
         delete m_pRoutineThread;
 
+        // the thread may have seen the mission finished before it saw the last routines queued
+        while(!doAction())
+        {
+        }
+
+        // everything is applied now, so the log is not needed any more
+        OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxFiles);
+        checkpoint();
+        m_pLog = NULL;
+
         fclose(m_pIndexFile);
     }
 
 
-    bool RoutineManager::init(const std::string &strIndexFile, DataBase *pDataBase, UINT_64 nWriteBufferLimited)
+    bool RoutineManager::init(const std::string &strIndexFile, const std::string &strLogFile, DataBase *pDataBase, UINT_64 nWriteBufferLimited)
     {
         m_nWriteBufferLimited = nWriteBufferLimited;
         m_nWriteBufferSize    = 0u;
@@ -50,6 +67,14 @@ namespace deudb
 
         m_pIndexFile = fopen(strIndexFile.c_str(), "rb+");
         if(!m_pIndexFile)   return false;
+        m_nIndexFileEnd = cmm::getFileLength(m_pIndexFile);
+
+        m_pLog = new WriteAheadLog;
+        if(!m_pLog->open(strLogFile))
+        {
+            std::cout << "Warning: failed to open the log " << strLogFile << ", the writing is not crash safe." << std::endl;
+            m_pLog = NULL;
+        }
 
         m_pRoutineThread = new RoutineThread(this);
         m_pRoutineThread->startThread();
@@ -60,141 +85,230 @@ namespace deudb
     }
 
 
-    bool RoutineManager::doAction(void)
+    // the caller holds m_mtxFiles
+    void RoutineManager::checkpoint(void)
     {
+        if(!m_pLog.valid() || m_pLog->getLogSize() == 0u)
         {
-            OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
-            if(m_queueRoutines.empty())
-            {
-                return true;
-            }
+            return;
+        }
+
+        const bool bDataSynced  = m_pDataBase->flushFiles(true);
+        const bool bIndexSynced = WriteAheadLog::syncFile(m_pIndexFile);
+        if(bDataSynced && bIndexSynced)
+        {
+            m_pLog->reset();
         }
+    }
+
 
-        struct TaskEraser
+    void RoutineManager::flush(bool bCheckpoint)
+    {
+        while(true)
         {
-            RoutineManager     *m_pRoutineManager;
-            TaskEraser(RoutineManager *pRoutineManager) : m_pRoutineManager(pRoutineManager)
-            {}
-            ~TaskEraser(void)
             {
-                void *pMemFree = NULL;
+                OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
+                if(m_queueRoutines.empty() && m_listInFlight.empty())
                 {
-                    OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_pRoutineManager->m_mtxRoutines);
-                    std::list<RoutineTask>::iterator itorTask = m_pRoutineManager->m_queueRoutines.begin();
-                    const Routine &routine = itorTask->second;
-                    pMemFree = routine.m_pDataBlock;
-                    m_pRoutineManager->m_nWriteBufferSize -= routine.m_infoDBBlock.m_gap.m_nLength;
-                    if(m_pRoutineManager->m_nWriteBufferSize <= m_pRoutineManager->m_nWriteBufferLimited)
-                    {
-                        m_pRoutineManager->m_blockWriteBuffer.set(true);
-                    }
-                    m_pRoutineManager->m_queueRoutines.erase(itorTask);
+                    break;
                 }
-                if(pMemFree)    free(pMemFree);
             }
-        }eraser(this);
+            OpenThreads::Thread::microSleep(1000u);
+        }
 
-        ID &id = m_queueRoutines.front().first;
-        Routine &routine = m_queueRoutines.front().second;
+        if(bCheckpoint)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxFiles);
+            checkpoint();
+        }
+    }
+
+
+    bool RoutineManager::replaceIndexFile(const std::string &strIndexFile, const std::string &strNewIndexFile)
+    {
+        flush(false);
 
-        if(routine.m_eRoutineType == Routine::RT_ADD)
+        OpenThreads::ScopedLock<OpenThreads::Mutex> scopeFiles(m_mtxFiles);
         {
-            // 1. write data block to db file
-            if(routine.m_pDataBlock && routine.m_infoDBBlock.m_gap.m_nLength > 0u)
+            // a routine queued after the flush is not in the new file, and its slot may not be either
+            OpenThreads::ScopedLock<OpenThreads::Mutex> scopeRoutines(m_mtxRoutines);
+            if(!m_queueRoutines.empty() || !m_listInFlight.empty())
             {
-                const bool bWrite = m_pDataBase->writeBlock(routine.m_infoDBBlock, routine.m_pDataBlock);
-                if(!bWrite) return false;
+                return false;
             }
+        }
 
-            // 2. write index info to index file
-            BlockInIdx  index;
-            index.m_id          = id;
-            index.m_infoDBBlock = routine.m_infoDBBlock;
-            index.m_nVersion    = routine.m_nVersion;
-            index.m_bRemove      = false;
-            if(routine.m_nPosInIndex == ~0u)
+        // the log addresses the slots of the old file, so it must not be replayed on the new one
+        checkpoint();
+        if(m_pLog.valid() && m_pLog->getLogSize() > 0u)
+        {
+            return false;
+        }
+
+        fclose(m_pIndexFile);
+        const bool bReplaced = WriteAheadLog::replaceFile(strNewIndexFile, strIndexFile);
+
+        m_pIndexFile = fopen(strIndexFile.c_str(), "rb+");
+        if(!m_pIndexFile)
+        {
+            std::cout << "Error: failed to reopen the index file " << strIndexFile << "." << std::endl;
+            return false;
+        }
+        m_nIndexFileEnd = cmm::getFileLength(m_pIndexFile);
+        return bReplaced;
+    }
+
+
+    bool RoutineManager::appendIndices(const std::vector<BlockInIdx> &vecIndices, unsigned nPosInIndex)
+    {
+        if(vecIndices.empty())
+        {
+            return true;
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxFiles);
+        fseek(m_pIndexFile, nPosInIndex, SEEK_SET);
+        const bool bWritten = (fwrite(&vecIndices[0], sizeof(BlockInIdx), vecIndices.size(), m_pIndexFile) == vecIndices.size());
+        m_nIndexFileEnd = std::max(m_nIndexFileEnd, (UINT_64)nPosInIndex + vecIndices.size() * sizeof(BlockInIdx));
+        return WriteAheadLog::syncFile(m_pIndexFile) && bWritten;
+    }
+
+
+    bool RoutineManager::doAction(void)
+    {
+        // 1. take a batch out of the queue, it stays readable in the in-flight list
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
+            if(m_queueRoutines.empty())
             {
-                fseek(m_pIndexFile, 0, SEEK_END);
+                return true;
             }
-            else
+
+            UINT_64 nBatchSize = 0u;
+            std::list<RoutineTask>::iterator itorEnd = m_queueRoutines.begin();
+            while(itorEnd != m_queueRoutines.end())
             {
-                fseek(m_pIndexFile, routine.m_nPosInIndex, SEEK_SET);
+                if(nBatchSize > 0u && nBatchSize + itorEnd->second.m_infoDBBlock.m_gap.m_nLength > ms_nMaxBatchSize)
+                {
+                    break;
+                }
+                nBatchSize += itorEnd->second.m_infoDBBlock.m_gap.m_nLength;
+                ++itorEnd;
             }
-            fwrite(&index, sizeof(BlockInIdx), 1, m_pIndexFile);
-#ifndef WIN32
-            fflush(m_pIndexFile);
-#endif
+            m_listInFlight.splice(m_listInFlight.end(), m_queueRoutines, m_queueRoutines.begin(), itorEnd);
         }
-        else if(routine.m_eRoutineType == Routine::RT_UPDATE)
+
+        // 2. resolve the index slots, the appended ones get their absolute position here
+        OpenThreads::ScopedLock<OpenThreads::Mutex> scopeFiles(m_mtxFiles);
+        std::vector<WriteAheadLog::Record>  vecRecords;
+        std::list<RoutineTask>::iterator itorTask = m_listInFlight.begin();
+        for( ; itorTask != m_listInFlight.end(); ++itorTask)
         {
-            // 1. write data block to db file
-            const bool bWrite = m_pDataBase->writeBlock(routine.m_infoDBBlock, routine.m_pDataBlock);
-            if(!bWrite)
-            {
-                return false;
-            }
+            const ID &id = itorTask->first;
+            const Routine &routine = itorTask->second;
 
-            // 2. write index file to update block version
-            BlockInIdx  index;
-            index.m_id          = id;
-            index.m_infoDBBlock = routine.m_infoDBBlock;
-            index.m_nVersion    = routine.m_nVersion;
-            index.m_bRemove      = false;
+            WriteAheadLog::Record record;
+            record.m_index.m_id          = id;
+            record.m_index.m_infoDBBlock = routine.m_infoDBBlock;
+            record.m_index.m_nVersion    = routine.m_nVersion;
+            record.m_pData               = NULL;
 
-            if(routine.m_nPosInIndex == ~0u)
+            if(routine.m_eRoutineType == Routine::RT_ADD || routine.m_eRoutineType == Routine::RT_UPDATE)
+            {
+                record.m_index.m_bRemove = false;
+                if(routine.m_pDataBlock.valid() && routine.m_infoDBBlock.m_gap.m_nLength > 0u)
+                {
+                    record.m_pData = routine.m_pDataBlock->getData();
+                }
+            }
+            else if(routine.m_eRoutineType == Routine::RT_REMOVE)
             {
-                fseek(m_pIndexFile, 0, SEEK_END);
+                record.m_index.m_bRemove = true;
             }
             else
             {
-                fseek(m_pIndexFile, routine.m_nPosInIndex, SEEK_SET);
+                assert(false);
+                continue;
             }
-            fwrite(&index, sizeof(BlockInIdx), 1, m_pIndexFile);
-#ifndef WIN32
-            fflush(m_pIndexFile);
-#endif
-        }
-        else if(routine.m_eRoutineType == Routine::RT_REMOVE)
-        {
-            BlockInIdx  index;
-            index.m_id          = id;
-            index.m_infoDBBlock = routine.m_infoDBBlock;
-            index.m_nVersion    = routine.m_nVersion;
-            index.m_bRemove      = true;
+
             if(routine.m_nPosInIndex == ~0u)
             {
-                fseek(m_pIndexFile, 0, SEEK_END);
+                record.m_nPosInIndex = (unsigned)m_nIndexFileEnd;
+                m_nIndexFileEnd += sizeof(BlockInIdx);
             }
             else
             {
-                fseek(m_pIndexFile, routine.m_nPosInIndex, SEEK_SET);
+                record.m_nPosInIndex = routine.m_nPosInIndex;
+                m_nIndexFileEnd = std::max(m_nIndexFileEnd, (UINT_64)routine.m_nPosInIndex + sizeof(BlockInIdx));
+            }
+            vecRecords.push_back(record);
+        }
+
+        // 3. group commit, one sequential write and one sync for the whole batch
+        const bool bLogged = m_pLog.valid() && m_pLog->commitBatch(vecRecords);
+        if(m_pLog.valid() && !bLogged)
+        {
+            std::cout << "Warning: failed to write the log, " << vecRecords.size() << " routines are written without it." << std::endl;
+        }
+
+        // 4. apply the batch, the files are flushed once and synced only at the checkpoint
+        std::vector<WriteAheadLog::Record>::const_iterator itorRecord = vecRecords.begin();
+        for( ; itorRecord != vecRecords.end(); ++itorRecord)
+        {
+            const WriteAheadLog::Record &record = *itorRecord;
+            if(record.m_pData)
+            {
+                m_pDataBase->writeBlock(record.m_index.m_infoDBBlock, record.m_pData, false);
             }
-            fwrite(&index, sizeof(BlockInIdx), 1, m_pIndexFile);
-#ifndef WIN32
-            fflush(m_pIndexFile);
-#endif
+
+            fseek(m_pIndexFile, record.m_nPosInIndex, SEEK_SET);
+            fwrite(&record.m_index, sizeof(BlockInIdx), 1, m_pIndexFile);
+        }
+        m_pDataBase->flushFiles(false);
+        fflush(m_pIndexFile);
+
+        if(!bLogged)
+        {
+            // no log to fall back on, so the files themselves must be durable
+            m_pDataBase->flushFiles(true);
+            WriteAheadLog::syncFile(m_pIndexFile);
         }
-        else
+        else if(m_pLog->getLogSize() >= ms_nCheckpointSize)
         {
-            assert(false);
+            checkpoint();
         }
 
-        if(routine.m_pDataBlock)
+        // 5. the batch is on the disk, so it can leave the memory now
+        std::list<RoutineTask>  listFinished;
         {
-            free(routine.m_pDataBlock);
-            routine.m_pDataBlock = NULL;
+            OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
+            listFinished.swap(m_listInFlight);
+
+            for(itorTask = listFinished.begin(); itorTask != listFinished.end(); ++itorTask)
+            {
+                m_nWriteBufferSize -= itorTask->second.m_infoDBBlock.m_gap.m_nLength;
+            }
+            if(m_nWriteBufferSize <= m_nWriteBufferLimited)
+            {
+                m_blockWriteBuffer.set(true);
+            }
         }
 
+        // the blocks are only released here if the cache does not hold them any more
+        listFinished.clear();
+
         return false;
     }
 
 
-    bool RoutineManager::addRoutine(const ID &id, const Routine &routine)
+    void RoutineManager::waitForRoom(void)
     {
         m_blockWriteBuffer.block();
+    }
+
 
-        void *pOldDataBlock = NULL;
-        unsigned nOldDataBlockSize = 0u;
+    bool RoutineManager::addRoutine(const ID &id, const Routine &routine)
+    {
         OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
 
         m_queueRoutines.push_back(RoutineTask(id, routine));
@@ -211,34 +325,65 @@ namespace deudb
     }
 
 
-    void *RoutineManager::readRoutineBlock(const ID &id) const
+    bool RoutineManager::addRoutines(const std::list<RoutineTask> &listRoutines)
+    {
+        if(listRoutines.empty())
+        {
+            return true;
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(m_mtxRoutines);
+
+        std::list<RoutineTask>::const_iterator itorRoutine = listRoutines.begin();
+        for( ; itorRoutine != listRoutines.end(); ++itorRoutine)
+        {
+            m_queueRoutines.push_back(*itorRoutine);
+            m_nWriteBufferSize += itorRoutine->second.m_infoDBBlock.m_gap.m_nLength;
+        }
+        m_pRoutineThread->suspend(false);
+
+        if(m_nWriteBufferSize > m_nWriteBufferLimited)
+        {
+            m_blockWriteBuffer.set(false);
+        }
+
+        return true;
+    }
+
+
+    OpenSP::sp<IBlockBuffer> RoutineManager::readRoutineBlock(const ID &id, unsigned nVersion) const
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> scopeLock(const_cast<OpenThreads::Mutex &>(m_mtxRoutines));
 
+        // the queue holds the newer routines, the in-flight batch the older ones
+        const Routine *pRoutine = NULL;
         std::list<RoutineTask>::const_reverse_iterator itorFind = m_queueRoutines.rbegin();
         for( ; itorFind != m_queueRoutines.rend(); ++itorFind)
         {
             const RoutineTask &task = *itorFind;
-            if(task.first == id)
+            if(task.first == id && task.second.m_nVersion == nVersion)
             {
+                pRoutine = &task.second;
                 break;
             }
         }
-        if(itorFind == m_queueRoutines.rend())
+        if(NULL == pRoutine)
         {
-            return NULL;
+            for(itorFind = m_listInFlight.rbegin(); itorFind != m_listInFlight.rend(); ++itorFind)
+            {
+                const RoutineTask &task = *itorFind;
+                if(task.first == id && task.second.m_nVersion == nVersion)
+                {
+                    pRoutine = &task.second;
+                    break;
+                }
+            }
         }
-
-        const Routine &routine = itorFind->second;
-        void *pDataBlock = NULL;
-        if(routine.m_infoDBBlock.m_gap.m_nLength > 0u)
+        if(NULL == pRoutine || pRoutine->m_infoDBBlock.m_gap.m_nLength == 0u)
         {
-            pDataBlock = malloc(routine.m_infoDBBlock.m_gap.m_nLength);
-            memcpy(pDataBlock, routine.m_pDataBlock, routine.m_infoDBBlock.m_gap.m_nLength);
+            return NULL;
         }
-
-        return pDataBlock;
+        return pRoutine->m_pDataBlock;
     }
 
 };
-
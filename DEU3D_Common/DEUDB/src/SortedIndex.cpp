@@ -0,0 +1,629 @@
+#include "SortedIndex.h"
+#include <algorithm>
+#include <iostream>
+#include <stddef.h>
+#include <time.h>
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "Common/Common.h"
+#include "WriteAheadLog.h"
+
+namespace deudb
+{
+
+const unsigned      g_nSortedIdxPageSize = 4096u;
+const unsigned char g_szSortedIdxFlag[8] = {'D', 'E', 'U', 'S', 'I', 'D', 'X', '\0'};
+
+#pragma pack(push, 4)
+
+struct SortedIdxHeader
+{
+    unsigned char   m_szFlag[8];        // must be "DEUSIDX\0"
+    unsigned int    m_nVersionNumber;   // begin from 1
+    unsigned int    m_bClean;           // 0 while a process has the database open
+    UINT_64         m_nIdxFileLength;   // the length of the .idx file it describes
+    UINT_64         m_nRecordCount;
+    UINT_64         m_nIDCount;
+    unsigned int    m_nPageCount;
+    unsigned int    m_nRecordsPerPage;
+    UINT_64         m_nFenceOffset;     // m_nPageCount IDs, the first ID of every page
+    UINT_64         m_nSlotOffset;      // m_nSlotCount free slots of the .idx file
+    unsigned int    m_nSlotCount;
+    unsigned int    m_nGapCount;        // ~0u if the free gaps of the data files are unknown
+    UINT_64         m_nGapOffset;       // m_nGapCount DBBlockInfo
+    unsigned int    m_nMaxVersion;      // the newest version of all the records, 0 in the older files
+};
+
+#pragma pack(pop)
+
+
+struct SortedIdxRecordSorter
+{
+    bool operator()(const SortedIdxRecord &left, const SortedIdxRecord &right) const
+    {
+        if(left.m_blockInIdx.m_id < right.m_blockInIdx.m_id)            return true;
+        else if(left.m_blockInIdx.m_id > right.m_blockInIdx.m_id)       return false;
+
+        if(left.m_blockInIdx.m_nVersion < right.m_blockInIdx.m_nVersion)        return true;
+        else if(left.m_blockInIdx.m_nVersion > right.m_blockInIdx.m_nVersion)   return false;
+
+        return (left.m_nPosInIndex < right.m_nPosInIndex);
+    }
+};
+
+
+SortedIndex::SortedIndex(void)
+{
+    m_nMappedSize = 0u;
+    m_pMappedView = NULL;
+#if defined (WIN32) || defined (WIN64)
+    m_hFile       = INVALID_HANDLE_VALUE;
+    m_hMapping    = NULL;
+#else
+    m_nFile       = -1;
+#endif
+    m_nRecordCount    = 0u;
+    m_nIDCount        = 0u;
+    m_nPageCount      = 0u;
+    m_nRecordsPerPage = 0u;
+    m_nFenceOffset    = 0u;
+    m_nSlotOffset     = 0u;
+    m_nSlotCount      = 0u;
+    m_nGapOffset      = 0u;
+    m_nGapCount       = 0u;
+    m_nMaxVersion     = 0u;
+}
+
+
+SortedIndex::~SortedIndex(void)
+{
+    close();
+}
+
+
+bool SortedIndex::open(const std::string &strFile, UINT_64 nIdxFileLength)
+{
+    close();
+
+    // 1. the header tells whether the file may be trusted at all
+    FILE *pFile = fopen(strFile.c_str(), "rb");
+    if(NULL == pFile)   return false;
+
+    SortedIdxHeader header;
+    const size_t nRead = fread(&header, sizeof(SortedIdxHeader), 1, pFile);
+    fclose(pFile);
+    if(nRead != 1u)
+    {
+        return false;
+    }
+    if(memcmp(header.m_szFlag, g_szSortedIdxFlag, sizeof(g_szSortedIdxFlag)) != 0 || header.m_nVersionNumber != 1u)
+    {
+        return false;
+    }
+    if(!header.m_bClean || header.m_nIdxFileLength != nIdxFileLength)
+    {
+        // the .idx file has been changed without it
+        return false;
+    }
+    if(header.m_nRecordsPerPage != g_nSortedIdxPageSize / sizeof(SortedIdxRecord))
+    {
+        return false;
+    }
+
+    UINT_64 nFileLength = header.m_nSlotOffset + header.m_nSlotCount * sizeof(unsigned);
+    if(header.m_nGapCount != ~0u)
+    {
+        nFileLength = header.m_nGapOffset + header.m_nGapCount * sizeof(DBBlockInfo);
+    }
+
+    // 2. map the whole file, a 32-bit process may fail here and fall back to the old loader
+#if defined (WIN32) || defined (WIN64)
+    m_hFile = CreateFileA(strFile.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if(m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER nSize;
+    if(!GetFileSizeEx((HANDLE)m_hFile, &nSize) || (UINT_64)nSize.QuadPart < nFileLength)
+    {
+        close();
+        return false;
+    }
+
+    m_hMapping = CreateFileMappingA((HANDLE)m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(m_hMapping == NULL)
+    {
+        close();
+        return false;
+    }
+    m_pMappedView = (const unsigned char *)MapViewOfFile((HANDLE)m_hMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    m_nFile = ::open(strFile.c_str(), O_RDONLY);
+    if(m_nFile < 0)
+    {
+        return false;
+    }
+
+    const off_t nSize = lseek(m_nFile, 0, SEEK_END);
+    if(nSize < 0 || (UINT_64)nSize < nFileLength)
+    {
+        close();
+        return false;
+    }
+
+    void *pView = mmap(NULL, nFileLength, PROT_READ, MAP_SHARED, m_nFile, 0);
+    if(pView != MAP_FAILED)
+    {
+        madvise(pView, nFileLength, MADV_RANDOM);
+        m_pMappedView = (const unsigned char *)pView;
+    }
+#endif
+    if(m_pMappedView == NULL)
+    {
+        close();
+        return false;
+    }
+
+    m_strFile         = strFile;
+    m_nMappedSize     = nFileLength;
+    m_nRecordCount    = header.m_nRecordCount;
+    m_nIDCount        = header.m_nIDCount;
+    m_nPageCount      = header.m_nPageCount;
+    m_nRecordsPerPage = header.m_nRecordsPerPage;
+    m_nFenceOffset    = header.m_nFenceOffset;
+    m_nSlotOffset     = header.m_nSlotOffset;
+    m_nSlotCount      = header.m_nSlotCount;
+    m_nGapOffset      = header.m_nGapOffset;
+    m_nGapCount       = header.m_nGapCount;
+    m_nMaxVersion     = header.m_nMaxVersion;
+    return true;
+}
+
+
+void SortedIndex::close(void)
+{
+#if defined (WIN32) || defined (WIN64)
+    if(m_pMappedView != NULL)
+    {
+        UnmapViewOfFile(m_pMappedView);
+    }
+    if(m_hMapping != NULL)
+    {
+        CloseHandle((HANDLE)m_hMapping);
+        m_hMapping = NULL;
+    }
+    if(m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle((HANDLE)m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if(m_pMappedView != NULL)
+    {
+        munmap((void *)m_pMappedView, m_nMappedSize);
+    }
+    if(m_nFile >= 0)
+    {
+        ::close(m_nFile);
+        m_nFile = -1;
+    }
+#endif
+    m_pMappedView  = NULL;
+    m_nMappedSize  = 0u;
+    m_nRecordCount = 0u;
+    m_nIDCount     = 0u;
+    m_nPageCount   = 0u;
+    m_nMaxVersion  = 0u;
+}
+
+
+bool SortedIndex::setClean(bool bClean)
+{
+    if(m_strFile.empty())   return false;
+
+    FILE *pFile = fopen(m_strFile.c_str(), "rb+");
+    if(NULL == pFile)   return false;
+
+    const unsigned nClean = bClean ? 1u : 0u;
+    fseek(pFile, (long)offsetof(SortedIdxHeader, m_bClean), SEEK_SET);
+    bool bWrite = (fwrite(&nClean, sizeof(unsigned), 1, pFile) == 1u);
+    bWrite = WriteAheadLog::syncFile(pFile) && bWrite;
+    fclose(pFile);
+    return bWrite;
+}
+
+
+const unsigned char *SortedIndex::getRecordAddress(UINT_64 nIndex) const
+{
+    // the page 0 holds the header
+    const UINT_64 nPage = nIndex / m_nRecordsPerPage + 1u;
+    const UINT_64 nSlot = nIndex % m_nRecordsPerPage;
+    return m_pMappedView + nPage * g_nSortedIdxPageSize + nSlot * sizeof(SortedIdxRecord);
+}
+
+
+void SortedIndex::getRecord(UINT_64 nIndex, SortedIdxRecord &record) const
+{
+    record = *(const SortedIdxRecord *)getRecordAddress(nIndex);
+}
+
+
+void SortedIndex::getFence(unsigned nPage, ID &id) const
+{
+    id = *(const ID *)(m_pMappedView + m_nFenceOffset + (UINT_64)nPage * sizeof(ID));
+}
+
+
+UINT_64 SortedIndex::lowerBound(const ID &id) const
+{
+    if(m_nRecordCount == 0u)    return 0u;
+
+    // the first page whose fence is not below id, the records of id may begin on the page before it
+    unsigned nLow = 0u, nHigh = m_nPageCount;
+    while(nLow < nHigh)
+    {
+        const unsigned nMiddle = nLow + (nHigh - nLow) / 2u;
+        ID idFence;
+        getFence(nMiddle, idFence);
+        if(idFence < id)
+        {
+            nLow = nMiddle + 1u;
+        }
+        else
+        {
+            nHigh = nMiddle;
+        }
+    }
+
+    UINT_64 nIndex = (nLow > 0u) ? (UINT_64)(nLow - 1u) * m_nRecordsPerPage : 0u;
+    for( ; nIndex < m_nRecordCount; nIndex++)
+    {
+        const ID &idRecord = ((const SortedIdxRecord *)getRecordAddress(nIndex))->m_blockInIdx.m_id;
+        if(idRecord >= id)
+        {
+            break;
+        }
+    }
+    return nIndex;
+}
+
+
+bool SortedIndex::find(const ID &id, std::vector<SortedIdxRecord> &vecRecords) const
+{
+    vecRecords.clear();
+    if(!isOpen())   return false;
+
+    for(UINT_64 nIndex = lowerBound(id); nIndex < m_nRecordCount; nIndex++)
+    {
+        SortedIdxRecord record;
+        getRecord(nIndex, record);
+        if(record.m_blockInIdx.m_id != id)
+        {
+            break;
+        }
+        vecRecords.push_back(record);
+    }
+    return !vecRecords.empty();
+}
+
+
+void SortedIndex::getIndexGaps(std::list<unsigned> &listGaps) const
+{
+    listGaps.clear();
+    const unsigned char *pSlot = m_pMappedView + m_nSlotOffset;
+    for(unsigned n = 0u; n < m_nSlotCount; n++, pSlot += sizeof(unsigned))
+    {
+        unsigned nPosInIndex = 0u;
+        memcpy(&nPosInIndex, pSlot, sizeof(unsigned));
+        listGaps.push_back(nPosInIndex);
+    }
+}
+
+
+bool SortedIndex::getFreeGaps(FILE_GAP_MAP &mapFreeGaps) const
+{
+    mapFreeGaps.clear();
+    if(m_nGapCount == ~0u)  return false;
+
+    const unsigned char *pGap = m_pMappedView + m_nGapOffset;
+    for(unsigned n = 0u; n < m_nGapCount; n++, pGap += sizeof(DBBlockInfo))
+    {
+        DBBlockInfo info;
+        memcpy(&info, pGap, sizeof(DBBlockInfo));
+
+        // a file without any free gap still has to be listed
+        std::vector<FileGap> &vecGaps = mapFreeGaps[info.m_nDBFile];
+        if(info.m_gap.m_nLength > 0u)
+        {
+            vecGaps.push_back(info.m_gap);
+        }
+    }
+    return true;
+}
+
+
+bool SortedIndex::convert(const std::string &strIndexFile, const std::string &strSortedFile)
+{
+    FILE *pFile = fopen(strIndexFile.c_str(), "rb+");
+    if(NULL == pFile)   return false;
+
+    IdxFileHeader header;
+    if(fread(&header, sizeof(IdxFileHeader), 1, pFile) != 1u
+        || memcmp(header.m_szFlag, g_szIndexFileFlag, sizeof(g_szIndexFileFlag)) != 0
+        || (header.m_nVersionNumber != 1u && header.m_nVersionNumber != 2u))
+    {
+        fclose(pFile);
+        return false;
+    }
+
+    // 1. collect the living records, they are a lot smaller than the map nodes
+    const bool      bVersion1   = (header.m_nVersionNumber == 1u);
+    const unsigned  nVersion    = (unsigned)time(NULL);
+    const unsigned  nFileLength = cmm::getFileLength(pFile);
+    const unsigned  nBlockCount = (nFileLength - sizeof(IdxFileHeader)) / sizeof(BlockInIdx);
+
+    std::vector<SortedIdxRecord>    vecRecords;
+    std::list<unsigned>             listIndexGaps;
+    std::vector<BlockInIdx>         vecChunk(4096u);
+    vecRecords.reserve(nBlockCount);
+
+    unsigned nPosInIndex = sizeof(IdxFileHeader);
+    for(unsigned n = 0u; n < nBlockCount; )
+    {
+        const unsigned nChunk = std::min(nBlockCount - n, (unsigned)vecChunk.size());
+        fseek(pFile, nPosInIndex, SEEK_SET);
+        if(fread(&vecChunk[0], sizeof(BlockInIdx), nChunk, pFile) != nChunk)
+        {
+            fclose(pFile);
+            return false;
+        }
+
+        for(unsigned i = 0u; i < nChunk; i++)
+        {
+            BlockInIdx &blockInIdx = vecChunk[i];
+            const unsigned nPos = nPosInIndex + i * sizeof(BlockInIdx);
+            if(blockInIdx.m_bRemove)
+            {
+                listIndexGaps.push_back(nPos);
+                continue;
+            }
+
+            if(bVersion1)
+            {
+                // the v1 records have no version, they get the time of the upgrade
+                blockInIdx.m_nVersion = nVersion;
+            }
+
+            SortedIdxRecord record;
+            record.m_blockInIdx  = blockInIdx;
+            record.m_nPosInIndex = nPos;
+            vecRecords.push_back(record);
+        }
+
+        if(bVersion1)
+        {
+            fseek(pFile, nPosInIndex, SEEK_SET);
+            fwrite(&vecChunk[0], sizeof(BlockInIdx), nChunk, pFile);
+        }
+
+        n           += nChunk;
+        nPosInIndex += nChunk * sizeof(BlockInIdx);
+    }
+
+    if(bVersion1)
+    {
+        header.m_nVersionNumber = 2u;
+        fseek(pFile, 0, SEEK_SET);
+        fwrite(&header, sizeof(IdxFileHeader), 1, pFile);
+    }
+    fclose(pFile);
+
+    // 2. sort and write them, the free gaps are left to be computed by the first openDB
+    std::sort(vecRecords.begin(), vecRecords.end(), SortedIdxRecordSorter());
+
+    Writer writer;
+    if(!writer.begin(strSortedFile))
+    {
+        return false;
+    }
+
+    std::vector<SortedIdxRecord>::const_iterator itorRecord = vecRecords.begin();
+    for( ; itorRecord != vecRecords.end(); ++itorRecord)
+    {
+        if(!writer.append(*itorRecord))
+        {
+            writer.cancel();
+            return false;
+        }
+    }
+
+    return writer.finish(nFileLength, listIndexGaps, NULL);
+}
+
+
+SortedIndex::Writer::Writer(void)
+{
+    m_pFile          = NULL;
+    m_nRecordsInPage = 0u;
+    m_nRecordCount   = 0u;
+    m_nIDCount       = 0u;
+    m_nMaxVersion    = 0u;
+}
+
+
+SortedIndex::Writer::~Writer(void)
+{
+    cancel();
+}
+
+
+bool SortedIndex::Writer::begin(const std::string &strFile)
+{
+    cancel();
+
+    m_strFile     = strFile;
+    m_strTempFile = strFile + ".tmp";
+
+    m_pFile = fopen(m_strTempFile.c_str(), "wb");
+    if(NULL == m_pFile) return false;
+
+    // the header page is written at last
+    m_vecPage.assign(g_nSortedIdxPageSize, 0u);
+    if(fwrite(&m_vecPage[0], g_nSortedIdxPageSize, 1, m_pFile) != 1u)
+    {
+        cancel();
+        return false;
+    }
+
+    m_nRecordsInPage = 0u;
+    m_nRecordCount   = 0u;
+    m_nIDCount       = 0u;
+    m_nMaxVersion    = 0u;
+    m_vecFences.clear();
+    return true;
+}
+
+
+bool SortedIndex::Writer::flushPage(void)
+{
+    if(m_nRecordsInPage == 0u) return true;
+
+    const bool bWrite = (fwrite(&m_vecPage[0], g_nSortedIdxPageSize, 1, m_pFile) == 1u);
+    m_vecPage.assign(g_nSortedIdxPageSize, 0u);
+    m_nRecordsInPage = 0u;
+    return bWrite;
+}
+
+
+bool SortedIndex::Writer::append(const SortedIdxRecord &record)
+{
+    if(NULL == m_pFile) return false;
+
+    const unsigned nRecordsPerPage = g_nSortedIdxPageSize / sizeof(SortedIdxRecord);
+    if(m_nRecordsInPage >= nRecordsPerPage)
+    {
+        if(!flushPage())    return false;
+    }
+
+    const ID &id = record.m_blockInIdx.m_id;
+    if(m_nRecordsInPage == 0u)
+    {
+        m_vecFences.push_back(id);
+    }
+    if(m_nRecordCount == 0u || m_idLast != id)
+    {
+        m_nIDCount++;
+        m_idLast = id;
+    }
+    if(record.m_blockInIdx.m_nVersion > m_nMaxVersion)
+    {
+        m_nMaxVersion = record.m_blockInIdx.m_nVersion;
+    }
+
+    memcpy(&m_vecPage[m_nRecordsInPage * sizeof(SortedIdxRecord)], &record, sizeof(SortedIdxRecord));
+    m_nRecordsInPage++;
+    m_nRecordCount++;
+    return true;
+}
+
+
+bool SortedIndex::Writer::finish(UINT_64 nIdxFileLength, const std::list<unsigned> &listIndexGaps, const FILE_GAP_MAP *pFreeGaps)
+{
+    if(NULL == m_pFile) return false;
+    if(!flushPage())
+    {
+        cancel();
+        return false;
+    }
+
+    SortedIdxHeader header;
+    memset(&header, 0, sizeof(SortedIdxHeader));
+    memcpy(header.m_szFlag, g_szSortedIdxFlag, sizeof(g_szSortedIdxFlag));
+    header.m_nVersionNumber  = 1u;
+    header.m_bClean          = 1u;
+    header.m_nIdxFileLength  = nIdxFileLength;
+    header.m_nRecordCount    = m_nRecordCount;
+    header.m_nIDCount        = m_nIDCount;
+    header.m_nPageCount      = (unsigned)m_vecFences.size();
+    header.m_nRecordsPerPage = g_nSortedIdxPageSize / sizeof(SortedIdxRecord);
+    header.m_nFenceOffset    = (UINT_64)(header.m_nPageCount + 1u) * g_nSortedIdxPageSize;
+    header.m_nSlotOffset     = header.m_nFenceOffset + m_vecFences.size() * sizeof(ID);
+    header.m_nSlotCount      = (unsigned)listIndexGaps.size();
+    header.m_nGapOffset      = header.m_nSlotOffset + listIndexGaps.size() * sizeof(unsigned);
+    header.m_nGapCount       = ~0u;
+    header.m_nMaxVersion     = m_nMaxVersion;
+
+    bool bWrite = true;
+    if(!m_vecFences.empty())
+    {
+        bWrite = bWrite && (fwrite(&m_vecFences[0], sizeof(ID), m_vecFences.size(), m_pFile) == m_vecFences.size());
+    }
+
+    std::vector<unsigned> vecSlots(listIndexGaps.begin(), listIndexGaps.end());
+    if(!vecSlots.empty())
+    {
+        bWrite = bWrite && (fwrite(&vecSlots[0], sizeof(unsigned), vecSlots.size(), m_pFile) == vecSlots.size());
+    }
+
+    if(pFreeGaps != NULL)
+    {
+        std::vector<DBBlockInfo> vecGaps;
+        FILE_GAP_MAP::const_iterator itorFile = pFreeGaps->begin();
+        for( ; itorFile != pFreeGaps->end(); ++itorFile)
+        {
+            // an empty record keeps the files without free space
+            DBBlockInfo info;
+            memset(&info, 0, sizeof(DBBlockInfo));
+            info.m_nDBFile = itorFile->first;
+            vecGaps.push_back(info);
+
+            std::vector<FileGap>::const_iterator itorGap = itorFile->second.begin();
+            for( ; itorGap != itorFile->second.end(); ++itorGap)
+            {
+                info.m_gap = *itorGap;
+                vecGaps.push_back(info);
+            }
+        }
+        if(!vecGaps.empty())
+        {
+            bWrite = bWrite && (fwrite(&vecGaps[0], sizeof(DBBlockInfo), vecGaps.size(), m_pFile) == vecGaps.size());
+        }
+        header.m_nGapCount = (unsigned)vecGaps.size();
+    }
+
+    fseek(m_pFile, 0, SEEK_SET);
+    bWrite = bWrite && (fwrite(&header, sizeof(SortedIdxHeader), 1, m_pFile) == 1u);
+    bWrite = WriteAheadLog::syncFile(m_pFile) && bWrite;
+    fclose(m_pFile);
+    m_pFile = NULL;
+
+    if(!bWrite)
+    {
+        remove(m_strTempFile.c_str());
+        return false;
+    }
+
+    // the old file must not be mapped any more
+    remove(m_strFile.c_str());
+    return (rename(m_strTempFile.c_str(), m_strFile.c_str()) == 0);
+}
+
+
+void SortedIndex::Writer::cancel(void)
+{
+    if(NULL != m_pFile)
+    {
+        fclose(m_pFile);
+        m_pFile = NULL;
+        remove(m_strTempFile.c_str());
+    }
+}
+
+}
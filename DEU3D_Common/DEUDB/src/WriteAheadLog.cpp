@@ -0,0 +1,342 @@
+#include "WriteAheadLog.h"
+#include <map>
+#include <iostream>
+#include <string.h>
+#if defined (WIN32) || defined (WIN64)
+#include <io.h>
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "Common/Common.h"
+#include "Common/crc.h"
+#include "DataBase.h"
+
+namespace deudb
+{
+
+const unsigned g_nLogRecordFlag = 0x52574544u;    // "DEWR"
+const unsigned g_nLogCommitFlag = 0x43574544u;    // "DEWC"
+
+#pragma pack(push, 4)
+
+struct LogRecordHeader
+{
+    unsigned    m_nFlag;            // must be g_nLogRecordFlag
+    unsigned    m_nPosInIndex;
+    BlockInIdx  m_index;
+    unsigned    m_nDataLength;
+    unsigned    m_nDataCRC;
+    unsigned    m_nHeaderCRC;       // crc of this header while m_nHeaderCRC is 0
+};
+
+struct LogCommit
+{
+    unsigned    m_nFlag;            // must be g_nLogCommitFlag
+    unsigned    m_nRecordCount;
+    UINT_64     m_nBatchLength;     // bytes of the records in front of this commit
+    unsigned    m_nCommitCRC;       // crc of this commit while m_nCommitCRC is 0
+};
+
+#pragma pack(pop)
+
+
+WriteAheadLog::WriteAheadLog(void)
+{
+    m_pLogFile = NULL;
+    m_nLogSize = 0u;
+}
+
+
+WriteAheadLog::~WriteAheadLog(void)
+{
+    close();
+}
+
+
+bool WriteAheadLog::syncFile(FILE *pFile)
+{
+    if(NULL == pFile)           return false;
+    if(fflush(pFile) != 0)      return false;
+
+#if defined (WIN32) || defined (WIN64)
+    return (_commit(_fileno(pFile)) == 0);
+#else
+    return (fsync(fileno(pFile)) == 0);
+#endif
+}
+
+
+bool WriteAheadLog::replaceFile(const std::string &strSource, const std::string &strTarget)
+{
+#if defined (WIN32) || defined (WIN64)
+    return (MoveFileExA(strSource.c_str(), strTarget.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE);
+#else
+    return (rename(strSource.c_str(), strTarget.c_str()) == 0);
+#endif
+}
+
+
+bool WriteAheadLog::open(const std::string &strLogFile)
+{
+    close();
+
+    m_pLogFile = fopen(strLogFile.c_str(), "ab");
+    if(NULL == m_pLogFile)  return false;
+
+    // let the whole batch leave stdio in as few writes as possible
+    setvbuf(m_pLogFile, NULL, _IOFBF, 4u * 1024u * 1024u);
+
+    m_strLogFile = strLogFile;
+    m_nLogSize = cmm::getFileLength(strLogFile);
+    return true;
+}
+
+
+void WriteAheadLog::close(void)
+{
+    if(NULL != m_pLogFile)
+    {
+        fclose(m_pLogFile);
+        m_pLogFile = NULL;
+    }
+    m_strLogFile.clear();
+    m_nLogSize = 0u;
+}
+
+
+unsigned WriteAheadLog::getDataLength(const Record &record)
+{
+    if(record.m_pData == NULL || record.m_index.m_bRemove)
+    {
+        return 0u;
+    }
+    return record.m_index.m_infoDBBlock.m_gap.m_nLength;
+}
+
+
+bool WriteAheadLog::commitBatch(const std::vector<Record> &vecRecords)
+{
+    if(NULL == m_pLogFile)      return false;
+    if(vecRecords.empty())      return true;
+
+    // the only durability barrier of the batch is the sync after it
+    UINT_64 nBatchLength = 0u;
+    if(!writeBatch(vecRecords, nBatchLength) || !syncFile(m_pLogFile))
+    {
+        // replay stops at the first broken record, a torn batch left in the log would hide every later one
+        truncate(m_nLogSize);
+        return false;
+    }
+
+    m_nLogSize += nBatchLength + sizeof(LogCommit);
+    return true;
+}
+
+
+bool WriteAheadLog::writeBatch(const std::vector<Record> &vecRecords, UINT_64 &nBatchLength)
+{
+    nBatchLength = 0u;
+    std::vector<Record>::const_iterator itorRecord = vecRecords.begin();
+    for( ; itorRecord != vecRecords.end(); ++itorRecord)
+    {
+        const Record &record = *itorRecord;
+
+        LogRecordHeader header = LogRecordHeader();
+        header.m_nFlag       = g_nLogRecordFlag;
+        header.m_nPosInIndex = record.m_nPosInIndex;
+        header.m_index       = record.m_index;
+        header.m_nDataLength = getDataLength(record);
+        header.m_nDataCRC    = (header.m_nDataLength > 0u) ? cmm::createHashCRC32(record.m_pData, header.m_nDataLength) : 0u;
+        header.m_nHeaderCRC  = cmm::createHashCRC32(&header, sizeof(LogRecordHeader));
+
+        if(fwrite(&header, sizeof(LogRecordHeader), 1, m_pLogFile) != 1)
+        {
+            return false;
+        }
+        if(header.m_nDataLength > 0u && fwrite(record.m_pData, header.m_nDataLength, 1, m_pLogFile) != 1)
+        {
+            return false;
+        }
+        nBatchLength += sizeof(LogRecordHeader) + header.m_nDataLength;
+    }
+
+    LogCommit commit = LogCommit();
+    commit.m_nFlag        = g_nLogCommitFlag;
+    commit.m_nRecordCount = (unsigned)vecRecords.size();
+    commit.m_nBatchLength = nBatchLength;
+    commit.m_nCommitCRC   = cmm::createHashCRC32(&commit, sizeof(LogCommit));
+    return (fwrite(&commit, sizeof(LogCommit), 1, m_pLogFile) == 1);
+}
+
+
+bool WriteAheadLog::reset(void)
+{
+    if(NULL == m_pLogFile)  return false;
+
+    return truncate(0u);
+}
+
+
+bool WriteAheadLog::truncate(UINT_64 nSize)
+{
+    // 1. a stream whose write has failed may still hold a part of the batch, closing it drops that
+    //    part whether it reaches the file or not, the file is cut after it
+    fclose(m_pLogFile);
+    m_pLogFile = fopen(m_strLogFile.c_str(), "ab");
+    if(NULL == m_pLogFile)  return false;
+    setvbuf(m_pLogFile, NULL, _IOFBF, 4u * 1024u * 1024u);
+
+    // 2. the stream appends, so the next batch follows the cut
+#if defined (WIN32) || defined (WIN64)
+    const bool bTruncate = (_chsize_s(_fileno(m_pLogFile), (__int64)nSize) == 0);
+#else
+    const bool bTruncate = (ftruncate(fileno(m_pLogFile), (off_t)nSize) == 0);
+#endif
+    if(bTruncate)
+    {
+        m_nLogSize = nSize;
+    }
+    return bTruncate;
+}
+
+
+bool WriteAheadLog::replay(const std::string &strLogFile, const std::string &strIndexFile, const std::string &strDataBase)
+{
+    if(!cmm::isFileExist(strLogFile))   return true;
+
+    FILE *pLogFile = fopen(strLogFile.c_str(), "rb");
+    if(NULL == pLogFile)    return false;
+
+    const unsigned nLogLength = cmm::getFileLength(pLogFile);
+    std::vector<unsigned char>  vecLog(nLogLength + 1u);
+    vecLog.resize(nLogLength);
+    const unsigned char *pLog = &vecLog[0];
+    const bool bRead = (nLogLength == 0u || fread(&vecLog[0], nLogLength, 1, pLogFile) == 1);
+    fclose(pLogFile);
+    if(!bRead)  return false;
+
+    FILE *pIndexFile = fopen(strIndexFile.c_str(), "rb+");
+    if(NULL == pIndexFile)  return false;
+
+    std::map<unsigned, FILE *>  mapDataFiles;
+    bool bReplayed = true;
+
+    // 1. walk the batches, a batch is applied only when its commit is intact
+    size_t nBatchBegin = 0u;
+    while(nBatchBegin < vecLog.size())
+    {
+        std::vector<const LogRecordHeader *> vecBatch;
+        size_t nOffset = nBatchBegin;
+        bool   bCommitted = false;
+        while(nOffset + sizeof(unsigned) <= vecLog.size())
+        {
+            unsigned nFlag = 0u;
+            memcpy(&nFlag, pLog + nOffset, sizeof(unsigned));
+            if(nFlag == g_nLogCommitFlag)
+            {
+                if(nOffset + sizeof(LogCommit) > vecLog.size())     break;
+
+                LogCommit commit;
+                memcpy(&commit, pLog + nOffset, sizeof(LogCommit));
+                const unsigned nCRC = commit.m_nCommitCRC;
+                commit.m_nCommitCRC = 0u;
+                if(nCRC != cmm::createHashCRC32(&commit, sizeof(LogCommit)))    break;
+                if(commit.m_nRecordCount != vecBatch.size())                    break;
+                if(commit.m_nBatchLength != nOffset - nBatchBegin)              break;
+
+                nOffset += sizeof(LogCommit);
+                bCommitted = true;
+                break;
+            }
+            if(nFlag != g_nLogRecordFlag)                                   break;
+            if(nOffset + sizeof(LogRecordHeader) > vecLog.size())           break;
+
+            LogRecordHeader header = *(const LogRecordHeader *)(pLog + nOffset);
+            const unsigned nCRC = header.m_nHeaderCRC;
+            header.m_nHeaderCRC = 0u;
+            if(nCRC != cmm::createHashCRC32(&header, sizeof(LogRecordHeader)))  break;
+            if(nOffset + sizeof(LogRecordHeader) + header.m_nDataLength > vecLog.size())    break;
+
+            const unsigned char *pData = pLog + nOffset + sizeof(LogRecordHeader);
+            if(header.m_nDataLength > 0u && header.m_nDataCRC != cmm::createHashCRC32(pData, header.m_nDataLength))
+            {
+                break;
+            }
+
+            vecBatch.push_back((const LogRecordHeader *)(pLog + nOffset));
+            nOffset += sizeof(LogRecordHeader) + header.m_nDataLength;
+        }
+
+        if(!bCommitted)
+        {
+            if(nBatchBegin < vecLog.size())
+            {
+                std::cout << "Warning: a torn batch at the end of " << strLogFile << " is discarded." << std::endl;
+            }
+            break;
+        }
+
+        // 2. redo the batch, every record carries its absolute positions so it may be applied twice
+        std::vector<const LogRecordHeader *>::const_iterator itorRecord = vecBatch.begin();
+        for( ; itorRecord != vecBatch.end(); ++itorRecord)
+        {
+            const LogRecordHeader header = **itorRecord;
+
+            if(header.m_nDataLength > 0u)
+            {
+                const unsigned nDBFile = header.m_index.m_infoDBBlock.m_nDBFile;
+                FILE *&pDataFile = mapDataFiles[nDBFile];
+                if(NULL == pDataFile)
+                {
+                    const std::string strDBFile = DataBase::getDBFilePath(strDataBase, nDBFile);
+                    pDataFile = fopen(strDBFile.c_str(), cmm::isFileExist(strDBFile) ? "rb+" : "wb+");
+                }
+                if(NULL == pDataFile)
+                {
+                    bReplayed = false;
+                    continue;
+                }
+
+                const unsigned char *pData = (const unsigned char *)(*itorRecord) + sizeof(LogRecordHeader);
+#if defined (WIN32) || defined (WIN64)
+                _fseeki64(pDataFile, header.m_index.m_infoDBBlock.m_gap.m_nPosition, SEEK_SET);
+#else
+                fseeko(pDataFile, header.m_index.m_infoDBBlock.m_gap.m_nPosition, SEEK_SET);
+#endif
+                if(fwrite(pData, header.m_nDataLength, 1, pDataFile) != 1)
+                {
+                    bReplayed = false;
+                }
+            }
+
+            fseek(pIndexFile, header.m_nPosInIndex, SEEK_SET);
+            if(fwrite(&header.m_index, sizeof(BlockInIdx), 1, pIndexFile) != 1)
+            {
+                bReplayed = false;
+            }
+        }
+
+        nBatchBegin = nOffset;
+    }
+
+    // 3. the log may only be dropped after everything it carried is on the disk
+    std::map<unsigned, FILE *>::iterator itorFile = mapDataFiles.begin();
+    for( ; itorFile != mapDataFiles.end(); ++itorFile)
+    {
+        if(NULL == itorFile->second)    continue;
+        if(!syncFile(itorFile->second)) bReplayed = false;
+        fclose(itorFile->second);
+    }
+    if(!syncFile(pIndexFile))   bReplayed = false;
+    fclose(pIndexFile);
+
+    if(!bReplayed)  return false;
+
+    FILE *pTruncate = fopen(strLogFile.c_str(), "wb");
+    if(NULL == pTruncate)   return false;
+    fclose(pTruncate);
+    return true;
+}
+
+}
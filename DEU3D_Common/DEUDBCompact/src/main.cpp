@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <DEUDB/IDEUDB.h>
+
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+// Compacts a DEUDB in place: the live blocks are moved to the front of the data
+// files, the tails are cut and the index is rewritten densely. The database must
+// not be open in another process meanwhile.
+//
+//  DEUDBCompact <database> [-rate <bytes per second>] [-drop] [-bench]
+//      -rate   limits the bytes moved per second, 0 or none moves at full speed
+//      -drop   drops the versions older than the latest of each block
+//      -bench  reads all the blocks in ID order before and after the compaction
+
+static double getSeconds(void)
+{
+#if defined (WIN32) || defined (WIN64)
+    return GetTickCount() / 1000.0;
+#else
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+
+static void sleepSeconds(unsigned nSeconds)
+{
+#if defined (WIN32) || defined (WIN64)
+    Sleep(nSeconds * 1000u);
+#else
+    sleep(nSeconds);
+#endif
+}
+
+
+static double getMB(UINT_64 nBytes)
+{
+    return nBytes / 1048576.0;
+}
+
+
+// the throughput in MB/s of reading the latest version of every block in ID order
+static double readSequentially(deudb::IDEUDB *pDB)
+{
+    std::vector<ID> vecIndices;
+    pDB->getIndices(vecIndices);
+
+    UINT_64 nBytes = 0u;
+    const double dblStart = getSeconds();
+    for(std::vector<ID>::const_iterator itor = vecIndices.begin(); itor != vecIndices.end(); ++itor)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        if(!pDB->readBlock(*itor, pBuffer))  continue;
+        if(pBuffer.valid())
+        {
+            nBytes += pBuffer->getLength();
+        }
+    }
+    const double dblSeconds = getSeconds() - dblStart;
+    if(dblSeconds <= 0.0)   return 0.0;
+    return getMB(nBytes) / dblSeconds;
+}
+
+
+static void printUsage(void)
+{
+    printf("usage: DEUDBCompact <database> [-rate <bytes per second>] [-drop] [-bench]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return 1;
+    }
+
+    const std::string strDB = argv[1];
+    UINT_64 nRate = 0u;
+    bool bDropOldVersions = false;
+    bool bBench = false;
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+        {
+            nRate = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "-drop") == 0)
+        {
+            bDropOldVersions = true;
+        }
+        else if(strcmp(argv[i], "-bench") == 0)
+        {
+            bBench = true;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // no read buffer, the benchmark has to go to the files
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    if(!pDB->openDB(strDB, 0u))
+    {
+        printf("failed to open %s\n", strDB.c_str());
+        return 2;
+    }
+
+    if(bBench)
+    {
+        printf("sequential read before: %.2f MB/s\n", readSequentially(pDB.get()));
+    }
+
+    if(!pDB->startCompaction(nRate, bDropOldVersions))
+    {
+        printf("failed to start the compaction\n");
+        pDB->closeDB();
+        return 3;
+    }
+
+    deudb::CompactionStatus status;
+    while(true)
+    {
+        sleepSeconds(1u);
+        pDB->getCompactionStatus(status);
+        printf("moved %llu blocks, %.2f MB, dropped %llu versions\n",
+            (unsigned long long)status.m_nBlocksMoved, getMB(status.m_nBytesMoved), (unsigned long long)status.m_nVersionsDropped);
+        if(!status.m_bRunning)  break;
+    }
+
+    if(!status.m_bFinished)
+    {
+        printf("the compaction did not finish\n");
+        pDB->closeDB();
+        return 4;
+    }
+
+    printf("data files: %.2f MB -> %.2f MB\n", getMB(status.m_nDataBytesBefore), getMB(status.m_nDataBytesAfter));
+    printf("index file: %.2f MB -> %.2f MB\n", getMB(status.m_nIndexBytesBefore), getMB(status.m_nIndexBytesAfter));
+
+    if(bBench)
+    {
+        printf("sequential read after: %.2f MB/s\n", readSequentially(pDB.get()));
+    }
+
+    pDB->closeDB();
+    return 0;
+}
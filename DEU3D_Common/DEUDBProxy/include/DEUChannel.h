@@ -0,0 +1,51 @@
+#ifndef DEUDB_CHANNEL_H_38EC4714_172C_44EB_A3C5_7DCECEE7DD75_INCLUDE
+#define DEUDB_CHANNEL_H_38EC4714_172C_44EB_A3C5_7DCECEE7DD75_INCLUDE
+
+#include "DEUDefine.h"
+#include <OpenThreads/Atomic>
+
+namespace deudbProxy
+{
+	struct RingSlot;
+
+	//The way the requests of a client go to the server. A thread takes a free slot,
+	//writes its request into it and calls the server, the response comes back in
+	//the same slot. The slots taken are counted, so the channel can be closed while
+	//other threads still have requests in flight.
+	class DEUChannel
+	{
+	public:
+		DEUChannel(void);
+		virtual ~DEUChannel(void);
+	public:
+		virtual void		Destroy() = 0;
+		//refuse new requests and wait for those in flight
+		void				Close();
+
+		//take a free slot, -1 when the channel is closed
+		int					TakeSlot();
+		void				GiveSlot(int nSlot);
+		virtual RingSlot*	GetSlot(int nSlot) const = 0;
+		//fill in a request, the payload is left as it is
+		void				SetRequest(int nSlot,int nType,const ID& id,unsigned nVersion = 0);
+
+		//the payload of the slot, grown to at least nLength, NULL when it cannot grow,
+		//the first nKeep bytes are carried over into a grown payload
+		virtual char*		ReservePayload(int nSlot,unsigned nLength,unsigned nKeep = 0) = 0;
+		virtual char*		GetPayload(int nSlot) const = 0;
+
+		//hand the request to the server and wait for the response
+		virtual void		Call(int nSlot,HANDLE svrHnd) = 0;
+
+	protected:
+		virtual unsigned	GetSlotCount() const = 0;
+		//the slot is given back, a big payload is freed
+		virtual void		TrimSlot(int nSlot) = 0;
+
+	protected:
+		OpenThreads::Atomic	m_nNextSlot;
+		OpenThreads::Atomic	m_nInFlight;
+		volatile bool		m_bClosed;
+	};
+}
+#endif //_DEUCHANNEL_H_
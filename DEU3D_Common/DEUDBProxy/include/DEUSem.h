@@ -19,6 +19,8 @@ namespace deudbProxy
 		static void ReleaseSem(HANDLE hnd);
 		//wait semaphore
 		static void WaitSem(HANDLE hnd);
+		//wait semaphore at most nMilliseconds, false when it has not been released
+		static bool WaitSem(HANDLE hnd,unsigned nMilliseconds);
 		//close semaphore
 		static void CloseSem(HANDLE hnd,const std::string& strSemName);
 
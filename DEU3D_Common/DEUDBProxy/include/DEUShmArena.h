@@ -0,0 +1,92 @@
+#ifndef DEUDB_SHM_ARENA_H_7D0A6C3B_2E4F_4B8A_9C61_5F2B8E1D4A73_INCLUDE
+#define DEUDB_SHM_ARENA_H_7D0A6C3B_2E4F_4B8A_9C61_5F2B8E1D4A73_INCLUDE
+
+#include "DEUDefine.h"
+#include "IDEUDBProxy.h"
+#include <set>
+#include <OpenThreads/Mutex>
+
+namespace deudbProxy
+{
+	class DEUShareMem;
+	class ArenaBlock;
+
+	//the layout of the arena in the shared memory, it must be the same as in DEUDBServer
+	struct ArenaHeader
+	{
+		unsigned             m_nMagic;
+		unsigned             m_nEntryCount;
+		unsigned             m_nDataOffset;     //the blocks start here
+		unsigned             m_nDataSize;
+	};
+
+	struct ArenaEntry
+	{
+		volatile INT_32      m_nLeases;         //the server takes them, the clients give them back
+		unsigned             m_nOffset;         //the place of the block behind m_nDataOffset
+		unsigned             m_nLength;
+		unsigned             m_nReserved;
+	};
+
+	static_assert(sizeof(ArenaHeader) == 16,"ArenaHeader must be 16 bytes");
+	static_assert(sizeof(ArenaEntry) == 16,"ArenaEntry must be 16 bytes");
+
+	//The arena of hot blocks which the server shares with all its clients, mapped
+	//into the client. The server copies a block into it once and leases its entry
+	//to every client reading it, a leased block is never moved or overwritten, so
+	//the client reads it in place and gives the lease back without asking the server.
+	//The leases of the client are counted in the lease table of its ring as well, the
+	//server drops them when the ring goes, so the blocks still held when the database
+	//is closed are copied out of the arena first.
+	class DEUShmArena : public OpenSP::Ref
+	{
+	public:
+		DEUShmArena(void);
+		virtual ~DEUShmArena(void);
+	public:
+		//map the arena strArena, pLeases is the lease table of the ring of the client
+		bool		Open(const std::string& strArena,volatile INT_32* pLeases);
+		//the block of a leased entry
+		const char*	GetBlock(unsigned nEntry,unsigned& nLength) const;
+		void		Hold(ArenaBlock* pBlock);
+		//the lease of the block is given back unless it has been detached
+		void		Release(ArenaBlock* pBlock);
+		//copy the blocks still held out of the arena and give their leases back
+		void		DetachBlocks();
+
+	private:
+		void		ReleaseLease(unsigned nEntry);
+
+	private:
+		DEUShareMem*				m_shm;
+		ArenaHeader*				m_pHeader;
+		volatile INT_32*				m_pLeases;
+		std::set<ArenaBlock*>		m_blockSet;		//the blocks held in the arena
+		OpenThreads::Mutex			m_mtxBlocks;
+	};
+
+	//a block read by readSharedBlock, either leased in the arena or copied into a buffer of its own
+	class ArenaBlock : public ISharedBlock
+	{
+	public:
+		ArenaBlock(DEUShmArena* pArena,unsigned nEntry);
+		ArenaBlock(void* pBuffer,unsigned nLength);
+		virtual ~ArenaBlock(void);
+	public:
+		virtual const void*	getData(void) const		{ return m_pData; }
+		virtual unsigned	getLength(void) const	{ return m_nLength; }
+
+		//the leased entry, DEU_ARENA_NO_ENTRY for a block of its own
+		unsigned			GetEntry() const		{ return m_nEntry; }
+		//copy the block into a buffer of its own, the arena gives the lease back
+		void				Detach();
+
+	private:
+		OpenSP::sp<DEUShmArena>		m_pArena;		//the arena stays mapped while its blocks are held
+		unsigned					m_nEntry;
+		const void*					m_pData;
+		unsigned					m_nLength;
+		void*						m_pBuffer;
+	};
+}
+#endif //_DEUSHMARENA_H_
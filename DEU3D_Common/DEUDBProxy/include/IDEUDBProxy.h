@@ -5,10 +5,42 @@
 #include <string>
 #include <vector>
 #include <OpenSP/Ref.h>
+#include <OpenSP/sp.h>
 #include <IDProvider/ID.h>
 
 namespace deudbProxy
 {
+    // how a proxy talks to its server
+    enum DEUDBTransport
+    {
+        DT_SHARED_MEMORY,   // the first client on the machine starts the server, they share memory with it
+        DT_SOCKET           // the server has been started with the argument "socket", it listens on the unix
+                            // domain socket beside the database and may run in another container
+    };
+
+    // a block read by readSharedBlock, it does not change while it is held
+    class ISharedBlock : public OpenSP::Ref
+    {
+    public:
+        virtual const void *getData(void) const = 0;
+        virtual unsigned    getLength(void) const = 0;
+    };
+
+    // told the results of readBlockAsync and readBlocksAsync on a thread of the proxy,
+    // pBuffer is released by freeMemory, it is NULL when the block has not been found
+    class IReadCallback : public OpenSP::Ref
+    {
+    public:
+        virtual void onRead(const ID &id, bool bFound, void *pBuffer, unsigned nLength) = 0;
+    };
+
+    // told the results of existAsync and existBlocksAsync on a thread of the proxy
+    class IExistCallback : public OpenSP::Ref
+    {
+    public:
+        virtual void onExist(const ID &id, bool bExist) = 0;
+    };
+
     class IDEUDBProxy : public OpenSP::Ref
     {
     public:
@@ -29,6 +61,36 @@ namespace deudbProxy
         virtual void  getIndices(std::vector<ID> &vecIndices, unsigned nOffset = 0u, unsigned nCount = ~0u) const = 0;
         virtual std::vector<unsigned> getVersion(const ID &id) const = 0;
         virtual bool  setClearFlag(bool bFlag) = 0;
+
+        // Many IDs in one round trip to the server. readBlocks fills vecBuffers like readBlock, every
+        // buffer is released by freeMemory, vecFound tells which IDs exist and the count of them is
+        // returned. existBlocks returns the count of the IDs which exist. writeBlocks replaces every
+        // block, the blocks which do not exist yet are added.
+        virtual unsigned readBlocks(const std::vector<ID> &vecIDs, std::vector<void *> &vecBuffers, std::vector<unsigned> &vecLengths, std::vector<bool> &vecFound) = 0;
+        virtual unsigned existBlocks(const std::vector<ID> &vecIDs, std::vector<bool> &vecExist) = 0;
+        virtual bool  writeBlocks(const std::vector<ID> &vecIDs, const std::vector<const void *> &vecBuffers, const std::vector<unsigned> &vecLengths) = 0;
+
+        // Reads the block in place out of the arena which the server shares with all its clients, so the
+        // clients reading the same hot blocks share one copy of them. The block is leased until pBlock is
+        // released, a block which cannot be shared is handed over in a buffer of its own.
+        virtual bool  readSharedBlock(const ID &id, OpenSP::sp<ISharedBlock> &pBlock, unsigned nVersion = 0u) = 0;
+
+        // Chooses the transport for the next openDB, false while the database is open or when the
+        // transport is not supported on this platform. Blocks read over DT_SOCKET are never shared.
+        virtual bool  setTransport(DEUDBTransport eTransport) = 0;
+
+        // The requests are queued and return at once, a few threads of the proxy carry them out and
+        // tell the callback, the reads or lookups queued together go to the server in one batch. Only
+        // a bounded count of requests may be queued or in flight, a call waits while there are more.
+        // false when the database is not open. A callback may call the proxy again: a request it queues
+        // does not wait for room, waitForAsync in it returns once every request has been carried out,
+        // and closeDB in it leaves the threads to stop on their own.
+        // waitForAsync waits until every request queued has been answered, closeDB does the same.
+        virtual bool  readBlockAsync(const ID &id, IReadCallback *pCallback, unsigned nVersion = 0u) = 0;
+        virtual bool  readBlocksAsync(const std::vector<ID> &vecIDs, IReadCallback *pCallback) = 0;
+        virtual bool  existAsync(const ID &id, IExistCallback *pCallback) = 0;
+        virtual bool  existBlocksAsync(const std::vector<ID> &vecIDs, IExistCallback *pCallback) = 0;
+        virtual void  waitForAsync(void) = 0;
     };
 
     DEUDB_PROXY_EXPORT IDEUDBProxy *createDEUDBProxy(void);
@@ -0,0 +1,295 @@
+#include "DEUAsyncQueue.h"
+#include <OpenThreads/ScopedLock>
+
+namespace deudbProxy
+{
+	void DEUAsyncQueue::AsyncThread::run(void)
+	{
+		m_pQueue->Work();
+	}
+
+	DEUAsyncQueue::DEUAsyncQueue(void)
+	{
+		m_pProxy = NULL;
+		m_nOutstanding = 0;
+		m_nUnanswered = 0;
+		m_bClosed = true;
+	}
+
+
+	DEUAsyncQueue::~DEUAsyncQueue(void)
+	{
+		Close();
+	}
+
+	void DEUAsyncQueue::Open(IDEUDBProxy* pProxy)
+	{
+		//a Close in a callback has left the threads to stop on their own
+		JoinThreads();
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+		m_pProxy = pProxy;
+		m_bClosed = false;
+	}
+
+	//carry out the requests queued and stop the threads
+	void DEUAsyncQueue::Close()
+	{
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+			m_bClosed = true;
+			//the threads see it once the queue is empty, the pushes waiting for room give up
+			m_blockRequest.release();
+			m_blockDone.release();
+			//a callback cannot join its own thread
+			if(IsQueueThread())
+				return;
+		}
+		JoinThreads();
+	}
+
+	//the caller is one of the threads, a callback is being told. Called under the lock
+	bool DEUAsyncQueue::IsQueueThread() const
+	{
+		const OpenThreads::Thread* pCurrent = OpenThreads::Thread::CurrentThread();
+		for(size_t n = 0;n < m_threadVec.size();n++)
+		{
+			if(m_threadVec[n] == pCurrent)
+				return true;
+		}
+		return false;
+	}
+
+	//the queue is closed, no thread is started meanwhile
+	void DEUAsyncQueue::JoinThreads()
+	{
+		for(size_t n = 0;n < m_threadVec.size();n++)
+			m_threadVec[n]->join();
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+		for(size_t n = 0;n < m_threadVec.size();n++)
+			delete m_threadVec[n];
+		m_threadVec.clear();
+	}
+
+	bool DEUAsyncQueue::PushRead(const ID& id,unsigned nVersion,IReadCallback* pCallback)
+	{
+		AsyncRequest request;
+		request.m_eType = (nVersion == 0) ? AT_READ : AT_READ_VERSION;
+		request.m_id = id;
+		request.m_nVersion = nVersion;
+		request.m_pRead = pCallback;
+		request.m_bFound = false;
+		request.m_pBuffer = NULL;
+		request.m_nLength = 0;
+		return Push(request);
+	}
+
+	bool DEUAsyncQueue::PushExist(const ID& id,IExistCallback* pCallback)
+	{
+		AsyncRequest request;
+		request.m_eType = AT_EXIST;
+		request.m_id = id;
+		request.m_nVersion = 0;
+		request.m_pExist = pCallback;
+		request.m_bFound = false;
+		request.m_pBuffer = NULL;
+		request.m_nLength = 0;
+		return Push(request);
+	}
+
+	//wait until every request has been answered
+	void DEUAsyncQueue::Wait()
+	{
+		std::vector<AsyncRequest> requestVec;
+		while(1)
+		{
+			requestVec.clear();
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+				if(!IsQueueThread())
+				{
+					if(m_nUnanswered == 0)
+						return;
+				}
+				//a callback would wait for itself and the other callbacks, it only
+				//waits for the requests carried out by the other threads and takes
+				//those queued itself
+				else if(m_nOutstanding == 0)
+					return;
+				else
+					TakeBatch(requestVec);
+
+				if(requestVec.empty())
+					m_blockDone.reset();
+			}
+			if(!requestVec.empty())
+				RunBatch(requestVec);
+			else
+				m_blockDone.block();
+		}
+	}
+
+	//queue a request, wait while there are too many
+	bool DEUAsyncQueue::Push(const AsyncRequest& request)
+	{
+		while(1)
+		{
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+				if(m_bClosed)
+					return false;
+				//a callback does not wait for room, the threads which would make it may all be in callbacks
+				if(m_nOutstanding < DEU_ASYNC_MAX_OUTSTANDING || IsQueueThread())
+				{
+					//1. the threads are started by the first request
+					if(m_threadVec.empty())
+					{
+						for(unsigned n = 0;n < DEU_ASYNC_THREAD_COUNT;n++)
+						{
+							AsyncThread* pThread = new AsyncThread(this);
+							if(pThread->startThread() != 0)
+							{
+								delete pThread;
+								break;
+							}
+							m_threadVec.push_back(pThread);
+						}
+						if(m_threadVec.empty())
+							return false;
+					}
+
+					//2. queue it and wake the threads
+					m_requestQueue.push_back(request);
+					++m_nOutstanding;
+					++m_nUnanswered;
+					m_blockRequest.release();
+					return true;
+				}
+				//3. wait until a request has been carried out, the release comes under the lock
+				m_blockDone.reset();
+			}
+			m_blockDone.block();
+		}
+	}
+
+	//carry out the requests until the queue is closed and empty
+	void DEUAsyncQueue::Work()
+	{
+		std::vector<AsyncRequest> requestVec;
+		while(1)
+		{
+			requestVec.clear();
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+				if(!TakeBatch(requestVec))
+				{
+					if(m_bClosed)
+						break;
+					m_blockRequest.reset();
+				}
+			}
+			if(requestVec.empty())
+			{
+				m_blockRequest.block();
+				continue;
+			}
+			RunBatch(requestVec);
+		}
+	}
+
+	//take the requests of the same kind at the head of the queue, false when it is empty. Called under the lock
+	bool DEUAsyncQueue::TakeBatch(std::vector<AsyncRequest>& requestVec)
+	{
+		if(m_requestQueue.empty())
+			return false;
+
+		const AsyncType eType = m_requestQueue.front().m_eType;
+		const unsigned nMaxCount = (eType == AT_READ_VERSION) ? 1u : DEU_ASYNC_BATCH_COUNT;
+		while(!m_requestQueue.empty() && requestVec.size() < nMaxCount && m_requestQueue.front().m_eType == eType)
+		{
+			requestVec.push_back(m_requestQueue.front());
+			m_requestQueue.pop_front();
+		}
+		return true;
+	}
+
+	void DEUAsyncQueue::RunBatch(std::vector<AsyncRequest>& requestVec)
+	{
+		//1. carry them out
+		if(requestVec[0].m_eType == AT_EXIST)
+			Exist(requestVec);
+		else
+			Read(requestVec);
+
+		//2. make room for the next requests before the callbacks, which may push more
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+			m_nOutstanding -= (unsigned)requestVec.size();
+			m_blockDone.release();
+		}
+
+		//3. tell the callbacks
+		Answer(requestVec);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxQueue);
+		m_nUnanswered -= (unsigned)requestVec.size();
+		m_blockDone.release();
+	}
+
+	void DEUAsyncQueue::Read(std::vector<AsyncRequest>& requestVec)
+	{
+		//a single request, or one for a version, is a plain read
+		if(requestVec.size() == 1)
+		{
+			AsyncRequest& request = requestVec[0];
+			void* pBuffer = NULL;
+			unsigned nLength = 0;
+			request.m_bFound = m_pProxy->readBlock(request.m_id,pBuffer,nLength,request.m_nVersion);
+			request.m_pBuffer = request.m_bFound ? pBuffer : NULL;
+			request.m_nLength = request.m_bFound ? nLength : 0u;
+			return;
+		}
+
+		std::vector<ID> idVec(requestVec.size());
+		for(size_t n = 0;n < requestVec.size();n++)
+			idVec[n] = requestVec[n].m_id;
+		std::vector<void*> bufferVec;
+		std::vector<unsigned> lengthVec;
+		std::vector<bool> foundVec;
+		m_pProxy->readBlocks(idVec,bufferVec,lengthVec,foundVec);
+		for(size_t n = 0;n < requestVec.size();n++)
+		{
+			requestVec[n].m_bFound = foundVec[n];
+			requestVec[n].m_pBuffer = bufferVec[n];
+			requestVec[n].m_nLength = lengthVec[n];
+		}
+	}
+
+	void DEUAsyncQueue::Exist(std::vector<AsyncRequest>& requestVec)
+	{
+		if(requestVec.size() == 1)
+		{
+			requestVec[0].m_bFound = m_pProxy->isExist(requestVec[0].m_id);
+			return;
+		}
+
+		std::vector<ID> idVec(requestVec.size());
+		for(size_t n = 0;n < requestVec.size();n++)
+			idVec[n] = requestVec[n].m_id;
+		std::vector<bool> existVec;
+		m_pProxy->existBlocks(idVec,existVec);
+		for(size_t n = 0;n < requestVec.size();n++)
+			requestVec[n].m_bFound = existVec[n];
+	}
+
+	void DEUAsyncQueue::Answer(const std::vector<AsyncRequest>& requestVec)
+	{
+		for(size_t n = 0;n < requestVec.size();n++)
+		{
+			const AsyncRequest& request = requestVec[n];
+			if(request.m_eType == AT_EXIST)
+				request.m_pExist->onExist(request.m_id,request.m_bFound);
+			else
+				request.m_pRead->onRead(request.m_id,request.m_bFound,request.m_pBuffer,request.m_nLength);
+		}
+	}
+}
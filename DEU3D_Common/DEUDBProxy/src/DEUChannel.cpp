@@ -0,0 +1,74 @@
+#include "DEUChannel.h"
+#include "DEUShmRing.h"
+#include <OpenThreads/Thread>
+
+namespace deudbProxy
+{
+	DEUChannel::DEUChannel(void)
+	{
+		m_bClosed = true;
+	}
+
+
+	DEUChannel::~DEUChannel(void)
+	{
+	}
+
+	//refuse new requests and wait for those in flight
+	void DEUChannel::Close()
+	{
+		m_bClosed = true;
+		while((unsigned)m_nInFlight != 0u)
+			OpenThreads::Thread::microSleep(1000);
+	}
+
+	//take a free slot
+	int DEUChannel::TakeSlot()
+	{
+		++m_nInFlight;
+		if(m_bClosed)
+		{
+			--m_nInFlight;
+			return -1;
+		}
+
+		const unsigned nSlotCount = GetSlotCount();
+		unsigned nTry = 0;
+		while(1)
+		{
+			//every thread starts somewhere else, so they seldom try the same slot
+			const unsigned nStart = ++m_nNextSlot;
+			for(unsigned i = 0;i < nSlotCount;i++)
+			{
+				const int nSlot = (int)((nStart + i) % nSlotCount);
+				if(RingCompareExchange(&GetSlot(nSlot)->m_nState,DEU_SLOT_CLAIMED,DEU_SLOT_FREE) == DEU_SLOT_FREE)
+					return nSlot;
+			}
+			//all the slots are in flight
+			if(++nTry < DEU_RING_SPIN_COUNT)
+				OpenThreads::Thread::YieldCurrentThread();
+			else
+				OpenThreads::Thread::microSleep(100);
+		}
+	}
+
+	//give the slot back
+	void DEUChannel::GiveSlot(int nSlot)
+	{
+		TrimSlot(nSlot);
+		RingExchange(&GetSlot(nSlot)->m_nState,DEU_SLOT_FREE);
+		--m_nInFlight;
+	}
+
+	//fill in a request
+	void DEUChannel::SetRequest(int nSlot,int nType,const ID& id,unsigned nVersion)
+	{
+		RingSlot* pSlot = GetSlot(nSlot);
+		pSlot->m_nType = nType;
+		pSlot->m_nVersion = nVersion;
+		pSlot->m_nHighBit = id.m_nHighBit;
+		pSlot->m_nMidBit = id.m_nMidBit;
+		pSlot->m_nLowBit = id.m_nLowBit;
+		pSlot->m_nOffset = pSlot->m_nCount = pSlot->m_nLength = 0;
+	}
+}
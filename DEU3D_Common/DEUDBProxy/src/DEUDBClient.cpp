@@ -1,5 +1,9 @@
 #include "DEUDBClient.h"
 #include "DEUShareMem.h"
+#include "DEUShmRing.h"
+#include "DEUSockChannel.h"
+#include "DEUShmArena.h"
+#include "DEUAsyncQueue.h"
 #include <sstream>
 #include <algorithm>
 #include <OpenSP/sp.h>
@@ -41,7 +45,11 @@ namespace deudbProxy
 
 	DEUDBClient::DEUDBClient(void)
 	{
-		m_shm = new DEUShareMem();
+		m_shmRing = new DEUShmRing();
+		m_sockChannel = new DEUSockChannel();
+		m_ring = m_shmRing;
+		m_asyncQueue = new DEUAsyncQueue();
+		m_eTransport = DT_SHARED_MEMORY;
 		m_regShm = new DEUShareMem();
 		m_eventClientHnd = m_eventSvrHnd = m_regHnd = m_svrRegHnd = m_startHnd = m_multiHnd = m_partHnd = NULL;
         m_pulseThread = NULL;
@@ -54,8 +62,10 @@ namespace deudbProxy
 	{
 		closeDB();
 		//1. delete pointer
-		if(m_shm != NULL)
-			delete m_shm;
+		delete m_asyncQueue;
+		delete m_shmRing;
+		delete m_sockChannel;
+		m_ring = NULL;
 		if(m_regShm != NULL)
 			delete m_regShm;
 		if(m_pulseThread != NULL)
@@ -90,7 +100,7 @@ namespace deudbProxy
 	}
 #else
 #define DEU_MAX_PATH 1024
-	std::string DEUDBClient::GetExePath()
+	std::string DEUDBClient::getExePath()
 	{
 		std::string strPath  = "";
 		static  char path[DEU_MAX_PATH];
@@ -122,9 +132,9 @@ namespace deudbProxy
 		m_regHnd = DEUSem::OpenSem(m_strRegSem);
 		if(m_regHnd == NULL)
 		{
-			DEUSem::CloseSem(m_partHnd,m_strPartSem);//close server particular semaphore
+			DEUSem::CloseSem(m_partHnd,"");//close server particular semaphore
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_partHnd = m_startHnd =  NULL;
 			return false;
 		}
@@ -132,10 +142,10 @@ namespace deudbProxy
         m_pulseSemHnd = DEUSem::OpenSem(m_strPulseSem);
         if(m_pulseSemHnd == NULL)
         {
-            DEUSem::CloseSem(m_partHnd,m_strPartSem);//close server particular semaphore
-            DEUSem::CloseSem(m_regHnd,m_strRegSem);
+            DEUSem::CloseSem(m_partHnd,"");//close server particular semaphore
+            DEUSem::CloseSem(m_regHnd,"");
             DEUSem::ReleaseSem(m_startHnd);
-            DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+            DEUSem::CloseSem(m_startHnd,"");//close start semaphore
             m_partHnd = m_regHnd = m_startHnd =  NULL;
             return false;
         }
@@ -144,11 +154,11 @@ namespace deudbProxy
 		m_svrRegHnd = DEUSem::OpenSem(m_strSvrRegSem);
 		if(m_svrRegHnd == NULL)
 		{
-			DEUSem::CloseSem(m_partHnd,m_strPartSem);//close server particular semaphore
-			DEUSem::CloseSem(m_regHnd,m_strRegSem);
-            DEUSem::CloseSem(m_pulseSemHnd,m_strPulseSem);
+			DEUSem::CloseSem(m_partHnd,"");//close server particular semaphore
+			DEUSem::CloseSem(m_regHnd,"");
+            DEUSem::CloseSem(m_pulseSemHnd,"");
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_partHnd = m_startHnd = m_regHnd = m_pulseSemHnd = NULL;
 			return false;
 		}
@@ -156,12 +166,12 @@ namespace deudbProxy
 		//4.open reg shared memroy
 		if(!m_regShm->AtShm(strRegShm))
 		{
-			DEUSem::CloseSem(m_regHnd,m_strRegSem);
-			DEUSem::CloseSem(m_svrRegHnd,m_strSvrRegSem);
-			DEUSem::CloseSem(m_partHnd,m_strPartSem);//close server particular semaphore
-            DEUSem::CloseSem(m_pulseSemHnd,m_strPulseSem);
+			DEUSem::CloseSem(m_regHnd,"");
+			DEUSem::CloseSem(m_svrRegHnd,"");
+			DEUSem::CloseSem(m_partHnd,"");//close server particular semaphore
+            DEUSem::CloseSem(m_pulseSemHnd,"");
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd = m_partHnd = m_pulseSemHnd = NULL;
 			return false;
 		}
@@ -173,7 +183,7 @@ namespace deudbProxy
             m_pulseThread->startThread();
         }
         
-		DEUSem::CloseSem(m_partHnd,m_strPartSem);
+		DEUSem::CloseSem(m_partHnd,"");
 		//DEUSem::ReleaseSem(m_startHnd);
 		return true;
 	}
@@ -190,7 +200,7 @@ namespace deudbProxy
 		if(m_regHnd == NULL)
 		{
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);
+			DEUSem::CloseSem(m_startHnd,"");
 			m_startHnd =  NULL;
 			return false;
 		}
@@ -200,7 +210,7 @@ namespace deudbProxy
 		{
 			DEUSem::CloseSem(m_regHnd,m_strRegSem);
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd = NULL;
 			return false;
 		}
@@ -217,7 +227,7 @@ namespace deudbProxy
 			DEUSem::CloseSem(m_regHnd,m_strRegSem);
 			m_regShm->DestroyShm();
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd =  NULL;
 			return false;
 		}
@@ -229,7 +239,10 @@ namespace deudbProxy
 			pid_t pc = fork();
 			if(pc == 0)
 			{
-				int nInst = execl(strPath.c_str(),strPath.c_str(),m_strDBPath.c_str(),NULL);
+				std::ostringstream ossRead,ossWrite;
+				ossRead<<nReadBufferSize;
+				ossWrite<<nWriteBufferSize;
+				int nInst = execl(strPath.c_str(),strPath.c_str(),m_strDBPath.c_str(),ossRead.str().c_str(),ossWrite.str().c_str(),(char*)NULL);
 				if(nInst == -1)
 					exit(-1);
 				exit(1);
@@ -242,7 +255,7 @@ namespace deudbProxy
 			DEUSem::CloseSem(m_regHnd,m_strRegSem);
 			m_regShm->DestroyShm();
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd =  NULL;
 			return false;
 		}
@@ -257,7 +270,7 @@ namespace deudbProxy
             DEUSem::CloseSem(m_regHnd,m_strRegSem);
             m_regShm->DestroyShm();
             DEUSem::ReleaseSem(m_startHnd);
-            DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+            DEUSem::CloseSem(m_startHnd,"");//close start semaphore
             m_regHnd = m_startHnd =  NULL;
             return false;
         }
@@ -268,9 +281,9 @@ namespace deudbProxy
 		{
 			DEUSem::CloseSem(m_regHnd,m_strRegSem);
 			m_regShm->DestroyShm();
-            DEUSem::CloseSem(m_pulseSemHnd,m_strPulseSem);
+            DEUSem::CloseSem(m_pulseSemHnd,"");
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd =  m_pulseSemHnd = NULL;
 			return false;
 		}
@@ -280,18 +293,18 @@ namespace deudbProxy
 		if(m_partHnd == NULL)
 		{
 			DEUSem::CloseSem(m_regHnd,m_strRegSem);
-			DEUSem::CloseSem(m_svrRegHnd,m_strSvrRegSem);
+			DEUSem::CloseSem(m_svrRegHnd,"");
 			m_regShm->DestroyShm();
-            DEUSem::CloseSem(m_pulseSemHnd,m_strPulseSem);
+            DEUSem::CloseSem(m_pulseSemHnd,"");
 			DEUSem::ReleaseSem(m_startHnd);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);//close start semaphore
+			DEUSem::CloseSem(m_startHnd,"");//close start semaphore
 			m_regHnd = m_startHnd = m_svrRegHnd = m_pulseSemHnd = NULL;
 			return false;
 		}
         m_pulseThread = new DEUDBProxyPulseThread(m_nPulseSec,m_pulseSemHnd);
         m_pulseThread->startThread();
 		//7. close server paritculare semaphore and release start semaphore
-		DEUSem::CloseSem(m_partHnd,m_strPartSem);
+		DEUSem::CloseSem(m_partHnd,"");
 		//DEUSem::ReleaseSem(m_startHnd);
 		return true;
 	}
@@ -305,6 +318,12 @@ namespace deudbProxy
             return false;
         }
 
+		//the server on the socket is started by hand, no semaphore nor shared memory is used
+		if(m_eTransport == DT_SOCKET)
+		{
+			return openSocket(strDBPath);
+		}
+
 		//1.get varibles
 		m_strDBPath = strDBPath;
 #ifdef WIN32
@@ -349,6 +368,7 @@ namespace deudbProxy
             if(m_multiHnd != NULL)
             {
                 DEUSem::ReleaseSem(m_startHnd);
+                m_asyncQueue->Open(this);
                 return true;
             }
         }
@@ -371,12 +391,48 @@ namespace deudbProxy
             }
         }
 		
-        const unsigned nShareBufferSize = 4194304u;
-		bool bRes = regShm(nShareBufferSize);
+		bool bRes = regShm(DEU_RING_INLINE_SIZE);
+		if(bRes)
+		{
+			//map the arena of the server, without it the blocks are copied
+			OpenSP::sp<DEUShmArena> pArena = new DEUShmArena();
+			if(pArena->Open(m_strRegSem + "Arena",m_shmRing->GetLeases()))
+				m_pArena = pArena;
+			m_asyncQueue->Open(this);
+		}
         DEUSem::ReleaseSem(m_startHnd);
         return bRes;
 	}
 	
+	//connect to the server listening beside the database
+	bool DEUDBClient::openSocket(const std::string& strDBPath)
+	{
+		if(m_bReg && !m_bUnReg)
+			return true;
+		m_strDBPath = strDBPath;
+		if(!m_sockChannel->Open(m_strDBPath + DEU_SOCK_SUFFIX,DEU_RING_SLOT_COUNT))
+			return false;
+		m_bReg = true;
+		m_bUnReg = false;
+		m_asyncQueue->Open(this);
+		return true;
+	}
+
+	//choose the transport
+	bool DEUDBClient::setTransport(DEUDBTransport eTransport)
+	{
+		//it cannot change while the database is open
+		if(m_bReg && !m_bUnReg)
+			return false;
+#if defined (WIN32) || defined (WIN64)
+		if(eTransport == DT_SOCKET)
+			return false;
+#endif
+		m_eTransport = eTransport;
+		m_ring = (eTransport == DT_SOCKET) ? (DEUChannel*)m_sockChannel : (DEUChannel*)m_shmRing;
+		return true;
+	}
+
 	//register shm
 	bool DEUDBClient::regShm(unsigned nSize/* = 1024u*/)
 	{
@@ -411,9 +467,9 @@ namespace deudbProxy
 			return false;
 		}
 
-		//3. create shared memory
+		//3. create the request ring, nSize is the inline payload of a slot
 		m_nShmSize = nSize;
-		if(!m_shm->CreateShm(m_strShmName,m_nShmSize))
+		if(!m_shmRing->Create(m_strShared,DEU_RING_SLOT_COUNT,m_nShmSize))
 		{
 			DEUSem::CloseSem(m_eventClientHnd,m_strClientSem);
 			return false;
@@ -424,7 +480,7 @@ namespace deudbProxy
 		if(m_multiHnd == NULL)
 		{
 			DEUSem::CloseSem(m_eventClientHnd,m_strClientSem);
-			m_shm->DestroyShm();
+			m_ring->Destroy();
 			return false;
 		}
 
@@ -441,27 +497,48 @@ namespace deudbProxy
 	bool DEUDBClient::closeDB()
 	{
         std::cout<<"close:"<<m_strDBPath<<std::endl;
+		//the async requests queued are carried out while the server is still there
+		m_asyncQueue->Close();
 		//0. if reged and unreged,unreg
-		if(m_bReg && !m_bUnReg)
+		if(m_bReg && !m_bUnReg && m_eTransport == DT_SOCKET)
+		{
+			//wait for the requests in flight and close the connections
+			m_ring->Close();
+			m_ring->Destroy();
+			m_bUnReg = true;
+		}
+		else if(m_bReg && !m_bUnReg)
 		{
-			//1. wait multi-thread semaphore
+			//1. wait for the requests in flight
 			//   to make sure no other thread is working
+			m_ring->Close();
 			DEUSem::WaitSem(m_multiHnd);
+			//the blocks still held are copied out, their leases go with the ring
+			if(m_pArena.valid())
+				m_pArena->DetachBlocks();
+			m_pArena = NULL;
+			//a server which has died never answers the unreg
+			const bool bServerAlive = m_shmRing->IsServerAlive();
 
 			//2. close  all handle
 			DEUSem::CloseSem(m_eventClientHnd,m_strClientSem);
-			DEUSem::CloseSem(m_eventSvrHnd,m_strServerSem);
+			DEUSem::CloseSem(m_eventSvrHnd,"");     //the server removes it
 			DEUSem::CloseSem(m_multiHnd,m_strMultiSem);
-			m_shm->DestroyShm();
+			m_ring->Destroy();
 
-			//3. write unreg info
-			writeRegInfo(DEU_UNREG_SHM);
+			//3. write unreg info, no client looks for the server meanwhile
+			if(bServerAlive)
+			{
+				DEUSem::WaitSem(m_startHnd);
+				writeRegInfo(DEU_UNREG_SHM);
+				DEUSem::ReleaseSem(m_startHnd);
+			}
 
-			//4.close sem and destroy shm
-			DEUSem::CloseSem(m_regHnd,m_strRegSem);
-			DEUSem::CloseSem(m_svrRegHnd,m_strSvrRegSem);
-			DEUSem::CloseSem(m_startHnd,m_strStartSem);
-			m_regShm->DestroyShm();
+			//4.close sem and shm, the names belong to the server and go with it
+			DEUSem::CloseSem(m_regHnd,"");
+			DEUSem::CloseSem(m_svrRegHnd,"");
+			DEUSem::CloseSem(m_startHnd,"");
+			m_regShm->DtShm();
 			
 			m_bUnReg = true;
 
@@ -496,21 +573,21 @@ namespace deudbProxy
 		{
 			DEUSem::CloseSem(m_eventClientHnd,m_strClientSem);
 			DEUSem::CloseSem(m_multiHnd,m_strMultiSem);
-			m_shm->DestroyShm();
+			m_ring->Destroy();
 			//DEUSem::ReleaseSem(m_startHnd);
 			return false;
 		}
 		//5. if reg success,open server semaphore
 		if(nType == 1)
 		{
-			//open semaphore
-			m_strServerSem = m_strShared + "EventServer";
+			//open the semaphore the workers of the server sleep on, all the clients share it
+			m_strServerSem = m_strRegSem + "EventWork";
 			m_eventSvrHnd = DEUSem::OpenSem(m_strServerSem);
 			if(m_eventSvrHnd == NULL)
 			{
 				DEUSem::CloseSem(m_eventClientHnd,m_strClientSem);
 				DEUSem::CloseSem(m_multiHnd,m_strMultiSem);
-				m_shm->DestroyShm();
+				m_ring->Destroy();
 				//DEUSem::ReleaseSem(m_startHnd);
 				return false;		
 			}
@@ -521,402 +598,150 @@ namespace deudbProxy
     // get block count
     unsigned DEUDBClient::getBlockCount(void) const
     {
-        unsigned nCount = 0;
-        //1. make shared object 
-        ShareObj obj;
-        obj.m_nType = DEU_GET_COUNT;
-        obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-        obj.m_shmSize = m_nShmSize;
-        obj.m_nHighBit = obj.m_nMidBit = obj.m_nLowBit = 0;
-
-        //2. wait multi-thread semaphore and write shared info
-        DEUSem::WaitSem(m_multiHnd);
-        if(!m_shm->WriteInfo(m_strShmName,obj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return nCount;
-        }
-
-        //3. release server semaphore and wait client semaphore
-        DEUSem::ReleaseSem(m_eventSvrHnd);
-        DEUSem::WaitSem(m_eventClientHnd);
-
-        //4. read info
-        ShareObj outObj;
-        if(!m_shm->ReadInfo(m_strShmName,outObj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return nCount;
-        }
-        if(outObj.m_nType == -1)
+        //1. take a slot and write the request
+        const int nSlot = m_ring->TakeSlot();
+        if(nSlot < 0)
         {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return nCount;
+            return 0;
         }
+        m_ring->SetRequest(nSlot,DEU_GET_COUNT,ID());
 
-        //5. malloc memory to save data returned from server
-        nCount = outObj.m_nTotalLength;
+        //2. wait for the response
+        m_ring->Call(nSlot,m_eventSvrHnd);
+        RingSlot* pSlot = m_ring->GetSlot(nSlot);
+        const unsigned nCount = (pSlot->m_nType == DEU_FAIL) ? 0u : pSlot->m_nCount;
 
-        //7. release multi-thread semaphore
-        DEUSem::ReleaseSem(m_multiHnd);
+        //3. give the slot back
+        m_ring->GiveSlot(nSlot);
         return nCount;
     }
     // get indices
     void  DEUDBClient::getIndices(std::vector<ID> &vecIndices, unsigned nOffset, unsigned nCount) const
     {
         vecIndices.clear();
-        //1. make shared object 
-        ShareObj obj;
-        obj.m_nType = DEU_INDEX_INRANGE;
-        obj.m_nTotalLength = 0;
-        obj.m_startLength = nOffset;
-        obj.m_endLength = nCount;
-        obj.m_shmSize = m_nShmSize;
-        obj.m_nHighBit = obj.m_nMidBit = obj.m_nLowBit = 0;
-
-        //2. wait multi-thread semaphore and write shared info
-        DEUSem::WaitSem(m_multiHnd);
-        if(!m_shm->WriteInfo(m_strShmName,obj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return;
-        }
-        //3. release server semaphore and wait client semaphore
-        DEUSem::ReleaseSem(m_eventSvrHnd);
-        DEUSem::WaitSem(m_eventClientHnd);
-
-        //4. read info
-        ShareObj outObj;
-        if(!m_shm->ReadInfo(m_strShmName,outObj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return;
-        }
-        if(outObj.m_nType == -1)
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return;
-        }
-
-        //5. malloc memory to save data returned from server
-        unsigned nLength = outObj.m_nTotalLength;
-        if(nLength == 0)
+        //1. take a slot and write the request
+        const int nSlot = m_ring->TakeSlot();
+        if(nSlot < 0)
         {
-            DEUSem::ReleaseSem(m_multiHnd);
             return;
         }
-
-        ID* pBuffer = (ID*)outObj.m_pData;
-        for(unsigned i = 0; i < outObj.m_endLength - outObj.m_startLength + 1u;i++)
-        {
-            vecIndices.push_back(pBuffer[i]);
-        }
-        freeMemory(outObj.m_pData);
-
-        unsigned nTemp = outObj.m_endLength - outObj.m_startLength + 1u;
-
-        //6. read left data from server
-        while(nTemp < nLength)
+        m_ring->SetRequest(nSlot,DEU_INDEX_INRANGE,ID());
+        RingSlot* pSlot = m_ring->GetSlot(nSlot);
+        pSlot->m_nOffset = nOffset;
+        pSlot->m_nCount = nCount;
+
+        //2. wait for the response, the IDs come in one piece
+        m_ring->Call(nSlot,m_eventSvrHnd);
+        if(pSlot->m_nType != DEU_FAIL && pSlot->m_nLength >= sizeof(ID))
         {
-            DEUSem::ReleaseSem(m_eventSvrHnd);
-            DEUSem::WaitSem(m_eventClientHnd);
-            if(!m_shm->ReadInfo(m_strShmName,outObj))
-            {
-                freeMemory(pBuffer);
-                DEUSem::ReleaseSem(m_multiHnd);
-                return;
-            }
-            pBuffer = (ID*)outObj.m_pData;
-            const unsigned sz = outObj.m_endLength - outObj.m_startLength + 1;
-            for(unsigned i = 0; i < sz; i++)
-            {
-                vecIndices.push_back(pBuffer[i]);
-            }
-            freeMemory(outObj.m_pData);
-            nTemp += sz;
+            const ID* pIDs = (const ID*)m_ring->GetPayload(nSlot);
+            vecIndices.assign(pIDs,pIDs + pSlot->m_nLength / sizeof(ID));
         }
 
-        //7. release multi-thread semaphore
-        DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-        return;
+        //3. give the slot back
+        m_ring->GiveSlot(nSlot);
     }
     std::vector<unsigned> DEUDBClient::getVersion(const ID &id) const
     {
         std::vector<unsigned> vList;
-        //1. make shared object 
-        ShareObj obj;
-        obj.m_nType = DEU_GET_VERSION;
-        obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-        obj.m_shmSize = m_nShmSize;
-        obj.m_nHighBit = id.m_nHighBit;
-        obj.m_nMidBit = id.m_nMidBit;
-        obj.m_nLowBit = id.m_nLowBit;
-
-        //2. wait multi-thread semaphore and write shared info
-        DEUSem::WaitSem(m_multiHnd);
-        if(!m_shm->WriteInfo(m_strShmName,obj))
+        //1. take a slot and write the request
+        const int nSlot = m_ring->TakeSlot();
+        if(nSlot < 0)
         {
-            DEUSem::ReleaseSem(m_multiHnd);
             return vList;
         }
+        m_ring->SetRequest(nSlot,DEU_GET_VERSION,id);
 
-        //3. release server semaphore and wait client semaphore
-        DEUSem::ReleaseSem(m_eventSvrHnd);
-        DEUSem::WaitSem(m_eventClientHnd);
-
-        //4. read info
-        ShareObj outObj;
-        if(!m_shm->ReadInfo(m_strShmName,outObj))
+        //2. wait for the response
+        m_ring->Call(nSlot,m_eventSvrHnd);
+        RingSlot* pSlot = m_ring->GetSlot(nSlot);
+        if(pSlot->m_nType != DEU_FAIL && pSlot->m_nLength >= sizeof(unsigned))
         {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return vList;
-        }
-        if(outObj.m_nType == -1)
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return vList;
-        }
-
-        //5. malloc memory to save data returned from server
-        unsigned nLength = outObj.m_nTotalLength;
-        if(nLength == 0)
-        {
-            DEUSem::ReleaseSem(m_multiHnd);
-            return vList;
-        }
-
-        unsigned* pBuffer = (unsigned*)outObj.m_pData;
-        for(unsigned i = 0; i < outObj.m_endLength - outObj.m_startLength + 1u;i++)
-        {
-            vList.push_back(pBuffer[i]);
-        }
-        freeMemory(outObj.m_pData);
-
-        unsigned nCount = outObj.m_endLength - outObj.m_startLength + 1u;
-
-        //6. read left data from server
-        while(nCount < nLength)
-        {
-            DEUSem::ReleaseSem(m_eventSvrHnd);
-            DEUSem::WaitSem(m_eventClientHnd);
-            if(!m_shm->ReadInfo(m_strShmName,outObj))
-            {
-                freeMemory(pBuffer);
-                DEUSem::ReleaseSem(m_multiHnd);
-                return vList;
-            }
-            pBuffer = (unsigned*)outObj.m_pData;
-            const unsigned sz = outObj.m_endLength - outObj.m_startLength + 1;
-            for(unsigned i = 0; i < sz; i++)
-            {
-                vList.push_back(pBuffer[i]);
-            }
-            freeMemory(outObj.m_pData);
-            nCount += sz;
+            const unsigned* pVersions = (const unsigned*)m_ring->GetPayload(nSlot);
+            vList.assign(pVersions,pVersions + pSlot->m_nLength / sizeof(unsigned));
         }
 
-        //7. release multi-thread semaphore
-        DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
+        //3. give the slot back
+        m_ring->GiveSlot(nSlot);
         return vList;
     }
 
 	std::vector<ID> DEUDBClient::getAllIndices(void)
 	{
 		std::vector<ID> idVec;
-		//1. make shared object 
-		ShareObj obj;
-		obj.m_nType = DEU_ALL_INDEX;
-		obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-		obj.m_shmSize = m_nShmSize;
-		obj.m_nHighBit = obj.m_nMidBit = obj.m_nLowBit = 0;
-
-		//2. wait multi-thread semaphore and write shared info
-		DEUSem::WaitSem(m_multiHnd);
-		if(!m_shm->WriteInfo(m_strShmName,obj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return idVec;
-		}
-
-		//3. release server semaphore and wait client semaphore
-		DEUSem::ReleaseSem(m_eventSvrHnd);
-		DEUSem::WaitSem(m_eventClientHnd);
-
-		//4. read info
-		ShareObj outObj;
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return idVec;
-		}
-		if(outObj.m_nType == -1)
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+		//1. take a slot and write the request
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
 			return idVec;
-		}
+		m_ring->SetRequest(nSlot,DEU_ALL_INDEX,ID());
 
-		//5. malloc memory to save data returned from server
-		unsigned nLength = outObj.m_nTotalLength;
-		if(nLength == 0)
+		//2. wait for the response, the IDs come in one piece
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		if(pSlot->m_nType != DEU_FAIL && pSlot->m_nLength >= sizeof(ID))
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return idVec;
+			const ID* pIDs = (const ID*)m_ring->GetPayload(nSlot);
+			idVec.assign(pIDs,pIDs + pSlot->m_nLength / sizeof(ID));
 		}
 
-		ID* pBuffer = (ID*)outObj.m_pData;
-		for(unsigned i = 0; i < outObj.m_endLength - outObj.m_startLength + 1u;i++)
-        {
-			idVec.push_back(pBuffer[i]);
-        }
-		freeMemory(outObj.m_pData);
-
-		unsigned nCount = outObj.m_endLength - outObj.m_startLength + 1u;
-
-		//6. read left data from server
-		while(nCount < nLength)
-		{
-			DEUSem::ReleaseSem(m_eventSvrHnd);
-			DEUSem::WaitSem(m_eventClientHnd);
-			if(!m_shm->ReadInfo(m_strShmName,outObj))
-			{
-				freeMemory(pBuffer);
-				DEUSem::ReleaseSem(m_multiHnd);
-				return idVec;
-			}
-			pBuffer = (ID*)outObj.m_pData;
-			const unsigned sz = outObj.m_endLength - outObj.m_startLength + 1;
-			for(unsigned i = 0; i <= sz; i++)
-            {
-				idVec.push_back(pBuffer[i]);
-            }
-			freeMemory(outObj.m_pData);
-			nCount += sz;
-		}
-
-		//7. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
+		//3. give the slot back
+		m_ring->GiveSlot(nSlot);
 		return idVec;
-
 	}
 	//is exist
 	bool DEUDBClient::isExist(const ID &id)
 	{
-		//1. make shared object 
-		std::string strID = id.toString();
-		ShareObj obj;
-		obj.m_nType = DEU_IS_EXIST;
-		obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-		obj.m_shmSize = m_nShmSize;
-		obj.m_nHighBit = id.m_nHighBit;
-		obj.m_nMidBit = id.m_nMidBit;
-		obj.m_nLowBit = id.m_nLowBit;
-
-		//2. wait multi-thread semaphore and write shared info
-		DEUSem::WaitSem(m_multiHnd);
-		if(!m_shm->WriteInfo(m_strShmName,obj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+		//1. take a slot and write the request
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
 			return false;
-		}
-
-		//3. release server semaphore and wait client semaphore
-		DEUSem::ReleaseSem(m_eventSvrHnd);
-		DEUSem::WaitSem(m_eventClientHnd);
+		m_ring->SetRequest(nSlot,DEU_IS_EXIST,id);
 
-		//4. read shared info
-		ShareObj outObj;
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return false;
-		}
-		if(outObj.m_nType == -1)
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return false;
-		}
+		//2. wait for the response
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		const bool bRes = (m_ring->GetSlot(nSlot)->m_nType != DEU_FAIL);
 
-		//5. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);
-		return true;
+		//3. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return bRes;
 	}
 
 	//read data
 	bool DEUDBClient::readBlock(const ID &id, void *&pBuffer, unsigned &nLength,const unsigned& nVersion)
 	{
-		//1. make shared object
-		ShareObj obj;
-		obj.m_nType = DEU_READ_DATA;
-		obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-		obj.m_shmSize = m_nShmSize;
-        obj.m_nVersion = nVersion;
-		obj.m_nHighBit = id.m_nHighBit;
-		obj.m_nMidBit = id.m_nMidBit;
-		obj.m_nLowBit = id.m_nLowBit;
-
-		//2. wait multi-thread semaphore and write shared info
-		DEUSem::WaitSem(m_multiHnd);
-		if(!m_shm->WriteInfo(m_strShmName,obj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+		//1. take a slot and write the request
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
 			return false;
-		}
-
-		//3. release server semaphore and wait client semaphore
-		DEUSem::ReleaseSem(m_eventSvrHnd);
-		DEUSem::WaitSem(m_eventClientHnd);
+		m_ring->SetRequest(nSlot,DEU_READ_DATA,id,nVersion);
 
-		//4. read info
-		ShareObj outObj;
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
+		//2. wait for the response, a block bigger than the payload is asked for again
+		//   with a payload big enough, so it always comes in one piece
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		if(pSlot->m_nType == DEU_FAIL)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return false;
-		}
-		if(outObj.m_nType == -1)
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+			m_ring->GiveSlot(nSlot);
 			return false;
 		}
 
-		//5. malloc memory to save data returned from server
-		nLength = outObj.m_nTotalLength;
-		if(nLength == 0)
+		//3. malloc memory and copy the block out of the payload
+		nLength = pSlot->m_nLength;
+		pBuffer = NULL;
+		if(nLength > 0)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return true;
-		}
-		pBuffer = malloc(nLength);
-        if(!pBuffer)
-        {
-            nLength = 0u;
-            freeMemory(outObj.m_pData);
-            DEUSem::ReleaseSem(m_multiHnd);
-            return false;
-        }
-		memcpy((char*)pBuffer+outObj.m_startLength,outObj.m_pData,outObj.m_endLength - outObj.m_startLength + 1);
-		freeMemory(outObj.m_pData);
-		int nCount = nLength / m_nShmSize;
-
-		//6. read left data from server
-		unsigned sz = 0;
-		for(int i = 1;i <= nCount;i++)
-		{
-			DEUSem::ReleaseSem(m_eventSvrHnd);
-			DEUSem::WaitSem(m_eventClientHnd);
-			if(!m_shm->ReadInfo(m_strShmName,outObj))
+			pBuffer = malloc(nLength);
+			if(!pBuffer)
 			{
-				freeMemory(pBuffer);
-				DEUSem::ReleaseSem(m_multiHnd);
+				nLength = 0u;
+				m_ring->GiveSlot(nSlot);
 				return false;
 			}
-			sz = outObj.m_endLength - outObj.m_startLength + 1;
-			memcpy((char*)pBuffer+outObj.m_startLength,outObj.m_pData,sz);
-			freeMemory(outObj.m_pData);
+			memcpy(pBuffer,m_ring->GetPayload(nSlot),nLength);
 		}
 
-		//7. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);
+		//4. give the slot back
+		m_ring->GiveSlot(nSlot);
 		return true;
 	}
 
@@ -924,254 +749,347 @@ namespace deudbProxy
 	//remove data
 	bool DEUDBClient::removeBlock(const ID &id)
 	{
-		//1. make shared object 
-		std::string strID = id.toString();
-		ShareObj obj;
-		obj.m_nType = DEU_REMOVE_DATA;
-		obj.m_nTotalLength = obj.m_startLength = obj.m_endLength = 0;
-		obj.m_shmSize = m_nShmSize;
-		obj.m_nHighBit = id.m_nHighBit;
-		obj.m_nMidBit = id.m_nMidBit;
-		obj.m_nLowBit = id.m_nLowBit;
-
-		//2. wait multi-thread semaphore and write shared info
-		DEUSem::WaitSem(m_multiHnd);
-		if(!m_shm->WriteInfo(m_strShmName,obj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+		//1. take a slot and write the request
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
 			return false;
-		}
+		m_ring->SetRequest(nSlot,DEU_REMOVE_DATA,id);
 
-		//3. release server semaphore and wait client semaphore
-		DEUSem::ReleaseSem(m_eventSvrHnd);
-		DEUSem::WaitSem(m_eventClientHnd);
+		//2. wait for the response
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		const bool bRes = (m_ring->GetSlot(nSlot)->m_nType != DEU_FAIL);
 
-		//4. read shared info
-		ShareObj outObj;
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
-		{
-			DEUSem::ReleaseSem(m_multiHnd);
+		//3. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return bRes;
+	}
+
+	//write, update or replace data
+	bool DEUDBClient::sendBlock(int nType, const ID &id, const void *pBuffer, unsigned nBufLen)
+	{
+		//1. take a slot and copy the block into its payload
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
 			return false;
-		}
-		if(outObj.m_nType == -1)
+		char* pPayload = m_ring->ReservePayload(nSlot,nBufLen);
+		if(pPayload == NULL)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
+			m_ring->GiveSlot(nSlot);
 			return false;
 		}
-
-		//5. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);
-		return true;
+		m_ring->SetRequest(nSlot,nType,id);
+		if(nBufLen > 0)
+			memcpy(pPayload,pBuffer,nBufLen);
+		m_ring->GetSlot(nSlot)->m_nLength = nBufLen;
+
+		//2. wait for the response
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		const bool bRes = (m_ring->GetSlot(nSlot)->m_nType != DEU_FAIL);
+
+		//3. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return bRes;
 	}
 
 	//write data
 	bool DEUDBClient::addBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
 	{
-		unsigned nStart = 0,nEnd = 0;
-		int nCount = nBufLen / m_nShmSize;
-
-		//1. wait multi-thread semaphore
-		ShareObj outObj;
-		std::string strID = id.toString();
-		DEUSem::WaitSem(m_multiHnd);
+		return sendBlock(DEU_WRITE_DATA,id,pBuffer,nBufLen);
+	}
+	//update data
+	bool DEUDBClient::updateBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
+	{
+		return sendBlock(DEU_UPDATE_DATA,id,pBuffer,nBufLen);
+	}
+    //replace data
+    bool DEUDBClient::replaceBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
+    {
+        return sendBlock(DEU_REPLACE_DATA,id,pBuffer,nBufLen);
+    }
+    // set clear code
+    bool DEUDBClient::setClearFlag(bool bFlag)
+    {
+        //1. take a slot and write the request
+        const int nSlot = m_ring->TakeSlot();
+        if(nSlot < 0)
+        {
+            return false;
+        }
+        m_ring->SetRequest(nSlot,DEU_SET_CLEAR_FLAG,ID());
+        m_ring->GetSlot(nSlot)->m_nCount = bFlag ? 1u : 0u;
 
-		//2. loop to write data
-		for(int i = 0;i <= nCount;i++)
-		{
-			//2.1 make shared object
-			outObj.m_nType = DEU_WRITE_DATA;
-			outObj.m_nTotalLength = nBufLen;
-			nStart = i * m_nShmSize;
-			nEnd = nBufLen < (i+1)*m_nShmSize ? nBufLen-1 : (i+1)*m_nShmSize-1;
-			outObj.m_startLength = nStart;
-			outObj.m_endLength = nEnd;
-			outObj.m_shmSize = m_nShmSize;
-			outObj.m_nHighBit = id.m_nHighBit;
-			outObj.m_nMidBit = id.m_nMidBit;
-			outObj.m_nLowBit = id.m_nLowBit;
-			void*  pTemp = malloc(nEnd - nStart + 1);
-            if(!pTemp)
-            {
-                DEUSem::ReleaseSem(m_multiHnd);
-                return false;
-            }
-			memcpy(pTemp,(char*)pBuffer+nStart,nEnd-nStart+1);
-			outObj.m_pData = pTemp;
+        //2. wait for the response
+        m_ring->Call(nSlot,m_eventSvrHnd);
+        const bool bRes = (m_ring->GetSlot(nSlot)->m_nType != DEU_FAIL);
 
-			//2.2 write shared object
-			m_shm->WriteInfo(m_strShmName,outObj);
-			freeMemory(pTemp);//free memory
+        //3. give the slot back
+        m_ring->GiveSlot(nSlot);
+        return bRes;
+    }
 
-			//2.3 release server semaphore and wait server semaphore
-			DEUSem::ReleaseSem(m_eventSvrHnd);
-			DEUSem::WaitSem(m_eventClientHnd);
-		}
+	//fill in a request carrying the IDs and nExtra bytes behind them,
+	//the place behind the IDs is returned
+	char* DEUDBClient::setBatchRequest(int nSlot, int nType, const std::vector<ID> &vecIDs, unsigned nExtra)
+	{
+		const unsigned nIDLength = (unsigned)(vecIDs.size()*sizeof(ID));
+		char* pPayload = m_ring->ReservePayload(nSlot,nIDLength + nExtra);
+		if(pPayload == NULL)
+			return NULL;
+		m_ring->SetRequest(nSlot,nType,ID());
+		memcpy(pPayload,&vecIDs[0],nIDLength);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		pSlot->m_nCount = (unsigned)vecIDs.size();
+		pSlot->m_nLength = nIDLength + nExtra;
+		return pPayload + nIDLength;
+	}
 
-		//3. read shared info
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
+	//read many blocks
+	unsigned DEUDBClient::readBlocks(const std::vector<ID> &vecIDs, std::vector<void *> &vecBuffers, std::vector<unsigned> &vecLengths, std::vector<bool> &vecFound)
+	{
+		const unsigned nCount = (unsigned)vecIDs.size();
+		vecBuffers.assign(nCount,(void*)NULL);
+		vecLengths.assign(nCount,0u);
+		vecFound.assign(nCount,false);
+		if(nCount == 0)
+			return 0;
+
+		//1. take a slot and copy the IDs into its payload
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
+			return 0;
+		if(setBatchRequest(nSlot,DEU_READ_BATCH,vecIDs,0) == NULL)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return false;
+			m_ring->GiveSlot(nSlot);
+			return 0;
 		}
-		if(outObj.m_nType == -1)
+
+		//2. wait for the response, the lengths of all the IDs and then the blocks one behind another
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		unsigned nFound = 0;
+		if(pSlot->m_nType != DEU_FAIL && pSlot->m_nLength >= nCount*sizeof(unsigned))
 		{
-			DEUSem::ReleaseSem(m_multiHnd);
-			return false;
+			const unsigned* pLengths = (const unsigned*)m_ring->GetPayload(nSlot);
+			const char* pData = (const char*)(pLengths + nCount);
+			//the blocks must lie within the length the server has answered
+			unsigned nLeft = pSlot->m_nLength - nCount*sizeof(unsigned);
+			for(unsigned n = 0;n < nCount;n++)
+			{
+				if(pLengths[n] == DEU_BLOCK_MISSING)
+					continue;
+				if(pLengths[n] > nLeft)
+				{
+					//a broken response fails the whole batch
+					for(unsigned i = 0;i < n;i++)
+						free(vecBuffers[i]);
+					vecBuffers.assign(nCount,(void*)NULL);
+					vecLengths.assign(nCount,0u);
+					vecFound.assign(nCount,false);
+					nFound = 0;
+					break;
+				}
+				nLeft -= pLengths[n];
+
+				//3. malloc memory and copy the block out of the payload
+				if(pLengths[n] > 0)
+				{
+					vecBuffers[n] = malloc(pLengths[n]);
+					if(vecBuffers[n] == NULL)
+					{
+						pData += pLengths[n];
+						continue;
+					}
+					memcpy(vecBuffers[n],pData,pLengths[n]);
+					pData += pLengths[n];
+				}
+				vecLengths[n] = pLengths[n];
+				vecFound[n] = true;
+				nFound++;
+			}
 		}
 
-		//4. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);
-		return true;
+		//4. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return nFound;
 	}
-	//update data
-	bool DEUDBClient::updateBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
-	{
-		unsigned nStart = 0,nEnd = 0;
-		int nCount = nBufLen / m_nShmSize;
 
-		//1. wait multi-thread semaphore
-		ShareObj outObj;
-		std::string strID = id.toString();
-		DEUSem::WaitSem(m_multiHnd);//WaitForSingleObject(m_multiHnd,INFINITE);
+	//whether many blocks exist
+	unsigned DEUDBClient::existBlocks(const std::vector<ID> &vecIDs, std::vector<bool> &vecExist)
+	{
+		const unsigned nCount = (unsigned)vecIDs.size();
+		vecExist.assign(nCount,false);
+		if(nCount == 0)
+			return 0;
+
+		//1. take a slot and copy the IDs into its payload
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
+			return 0;
+		if(setBatchRequest(nSlot,DEU_EXIST_BATCH,vecIDs,0) == NULL)
+		{
+			m_ring->GiveSlot(nSlot);
+			return 0;
+		}
 
-		//2. loop to write data
-		for(int i = 0;i <= nCount;i++)
+		//2. wait for the response, a byte for every ID
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		unsigned nExist = 0;
+		if(pSlot->m_nType != DEU_FAIL && pSlot->m_nLength >= nCount)
 		{
-			//2.1 make shared object
-			outObj.m_nType = DEU_UPDATE_DATA;
-			outObj.m_nTotalLength = nBufLen;
-			nStart = i * m_nShmSize;
-			nEnd = nBufLen < (i+1)*m_nShmSize ? nBufLen -1 : (i+1)*m_nShmSize - 1;
-			outObj.m_startLength = nStart;
-			outObj.m_endLength = nEnd;
-			outObj.m_shmSize = m_nShmSize;
-			outObj.m_nHighBit = id.m_nHighBit;
-			outObj.m_nMidBit = id.m_nMidBit;
-			outObj.m_nLowBit = id.m_nLowBit;
-			void*  pTemp = malloc(nEnd - nStart + 1);
-            if(!pTemp)
-            {
-                DEUSem::ReleaseSem(m_multiHnd);
-                return false;
-            }
-			memcpy(pTemp,(char*)pBuffer+nStart,nEnd-nStart+1);
-			outObj.m_pData = pTemp;
+			const unsigned char* pFlags = (const unsigned char*)m_ring->GetPayload(nSlot);
+			for(unsigned n = 0;n < nCount;n++)
+			{
+				if(pFlags[n] == 0)
+					continue;
+				vecExist[n] = true;
+				nExist++;
+			}
+		}
 
-			//2.2 write shared object
-			m_shm->WriteInfo(m_strShmName,outObj);
-			freeMemory(pTemp);//free memory
+		//3. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return nExist;
+	}
 
-			//2.3 release server semaphore and wait server semaphore
-			DEUSem::ReleaseSem(m_eventSvrHnd);
-			DEUSem::WaitSem(m_eventClientHnd);
-		}
+	//write many blocks
+	bool DEUDBClient::writeBlocks(const std::vector<ID> &vecIDs, const std::vector<const void *> &vecBuffers, const std::vector<unsigned> &vecLengths)
+	{
+		const unsigned nCount = (unsigned)vecIDs.size();
+		if(vecBuffers.size() != nCount || vecLengths.size() != nCount)
+			return false;
+		if(nCount == 0)
+			return true;
+
+		//1. the lengths and the blocks go behind the IDs
+		UINT_64 nExtra = (UINT_64)nCount*sizeof(unsigned);
+		for(unsigned n = 0;n < nCount;n++)
+			nExtra += vecLengths[n];
+		if(nExtra + (UINT_64)nCount*sizeof(ID) >= 0x80000000u)
+			return false;
 
-		//3. read shared info
-		if(!m_shm->ReadInfo(m_strShmName,outObj))
+		//2. take a slot and copy everything into its payload
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
+			return false;
+		char* pExtra = setBatchRequest(nSlot,DEU_WRITE_BATCH,vecIDs,(unsigned)nExtra);
+		if(pExtra == NULL)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
+			m_ring->GiveSlot(nSlot);
 			return false;
 		}
-		if(outObj.m_nType == -1)
+		memcpy(pExtra,&vecLengths[0],nCount*sizeof(unsigned));
+		char* pData = pExtra + nCount*sizeof(unsigned);
+		for(unsigned n = 0;n < nCount;n++)
 		{
-			DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-			return false;
+			if(vecLengths[n] > 0)
+				memcpy(pData,vecBuffers[n],vecLengths[n]);
+			pData += vecLengths[n];
 		}
 
-		//4. release multi-thread semaphore
-		DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-		return true;
+		//3. wait for the response
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		const bool bRes = (m_ring->GetSlot(nSlot)->m_nType != DEU_FAIL);
+
+		//4. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return bRes;
 	}
-    //replace data
-    bool DEUDBClient::replaceBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
-    {
-        unsigned nStart = 0,nEnd = 0;
-        int nCount = nBufLen / m_nShmSize;
 
-        //1. wait multi-thread semaphore
-        ShareObj outObj;
-        std::string strID = id.toString();
-        DEUSem::WaitSem(m_multiHnd);//WaitForSingleObject(m_multiHnd,INFINITE);
+	//read data in place out of the arena of the server
+	bool DEUDBClient::readSharedBlock(const ID &id, OpenSP::sp<ISharedBlock> &pBlock, unsigned nVersion)
+	{
+		pBlock = NULL;
+		OpenSP::sp<DEUShmArena> pArena = m_pArena;
 
-        //2. loop to write data
-        for(int i = 0;i <= nCount;i++)
-        {
-            //2.1 make shared object
-            outObj.m_nType = DEU_REPLACE_DATA;
-            outObj.m_nTotalLength = nBufLen;
-            nStart = i * m_nShmSize;
-            nEnd = nBufLen < (i+1)*m_nShmSize ? nBufLen -1 : (i+1)*m_nShmSize - 1;
-            outObj.m_startLength = nStart;
-            outObj.m_endLength = nEnd;
-            outObj.m_shmSize = m_nShmSize;
-            outObj.m_nHighBit = id.m_nHighBit;
-            outObj.m_nMidBit = id.m_nMidBit;
-            outObj.m_nLowBit = id.m_nLowBit;
-            void*  pTemp = malloc(nEnd - nStart + 1);
-            if(!pTemp)
-            {
-                DEUSem::ReleaseSem(m_multiHnd);
-                return false;
-            }
-            memcpy(pTemp,(char*)pBuffer+nStart,nEnd-nStart+1);
-            outObj.m_pData = pTemp;
+		//1. take a slot and write the request, without the arena it is a plain read
+		const int nSlot = m_ring->TakeSlot();
+		if(nSlot < 0)
+			return false;
+		m_ring->SetRequest(nSlot,pArena.valid() ? DEU_READ_SHARED : DEU_READ_DATA,id,nVersion);
 
-            //2.2 write shared object
-            m_shm->WriteInfo(m_strShmName,outObj);
-            freeMemory(pTemp);//free memory
+		//2. wait for the response
+		m_ring->Call(nSlot,m_eventSvrHnd);
+		RingSlot* pSlot = m_ring->GetSlot(nSlot);
+		if(pSlot->m_nType == DEU_FAIL)
+		{
+			m_ring->GiveSlot(nSlot);
+			return false;
+		}
 
-            //2.3 release server semaphore and wait server semaphore
-            DEUSem::ReleaseSem(m_eventSvrHnd);
-            DEUSem::WaitSem(m_eventClientHnd);
-        }
+		//3. the server has leased an entry of the arena, the block is read where it is
+		if(pArena.valid() && pSlot->m_nOffset != DEU_ARENA_NO_ENTRY)
+		{
+			pBlock = new ArenaBlock(pArena.get(),pSlot->m_nOffset);
+			m_ring->GiveSlot(nSlot);
+			return true;
+		}
 
-        //3. read shared info
-        if(!m_shm->ReadInfo(m_strShmName,outObj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-            return false;
-        }
-        if(outObj.m_nType == -1)
-        {
-            DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-            return false;
-        }
+		//4. a block which cannot be shared is copied out of the payload
+		const unsigned nLength = pSlot->m_nLength;
+		void* pBuffer = NULL;
+		if(nLength > 0)
+		{
+			pBuffer = malloc(nLength);
+			if(!pBuffer)
+			{
+				m_ring->GiveSlot(nSlot);
+				return false;
+			}
+			memcpy(pBuffer,m_ring->GetPayload(nSlot),nLength);
+		}
+		pBlock = new ArenaBlock(pBuffer,nLength);
 
-        //4. release multi-thread semaphore
-        DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-        return true;
-    }
-    // set clear code
-    bool DEUDBClient::setClearFlag(bool bFlag)
-    {
-        //1. wait multi-thread semaphore
-        ShareObj outObj;
-        DEUSem::WaitSem(m_multiHnd);//WaitForSingleObject(m_multiHnd,INFINITE);
+		//5. give the slot back
+		m_ring->GiveSlot(nSlot);
+		return true;
+	}
 
-        //2 make shared object
-        outObj.m_nType = DEU_SET_CLEAR_FLAG;
-        outObj.m_nTotalLength = bFlag;
+	//queue a read, the callback is told on a thread of the queue
+	bool DEUDBClient::readBlockAsync(const ID &id, IReadCallback *pCallback, unsigned nVersion)
+	{
+		if(pCallback == NULL)
+			return false;
+		return m_asyncQueue->PushRead(id,nVersion,pCallback);
+	}
 
-        //3. write shared object
-        m_shm->WriteInfo(m_strShmName,outObj);
+	bool DEUDBClient::readBlocksAsync(const std::vector<ID> &vecIDs, IReadCallback *pCallback)
+	{
+		if(pCallback == NULL)
+			return false;
+		//the queue sends the reads of many ids in batches, the callback is held
+		//since the first answers may come before the last id is queued
+		OpenSP::sp<IReadCallback> pHold = pCallback;
+		for(size_t n = 0;n < vecIDs.size();n++)
+		{
+			if(!m_asyncQueue->PushRead(vecIDs[n],0u,pCallback))
+				return false;
+		}
+		return true;
+	}
 
-        //4. release server semaphore and wait server semaphore
-        DEUSem::ReleaseSem(m_eventSvrHnd);
-        DEUSem::WaitSem(m_eventClientHnd);
+	bool DEUDBClient::existAsync(const ID &id, IExistCallback *pCallback)
+	{
+		if(pCallback == NULL)
+			return false;
+		return m_asyncQueue->PushExist(id,pCallback);
+	}
 
-        //5. read shared info
-        if(!m_shm->ReadInfo(m_strShmName,outObj))
-        {
-            DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-            return false;
-        }
-        if(outObj.m_nType == -1)
-        {
-            DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-            return false;
-        }
-        //6. release multi-thread semaphore
-        DEUSem::ReleaseSem(m_multiHnd);//ReleaseSemaphore(m_multiHnd,1,NULL);
-        return true;
-    }
+	bool DEUDBClient::existBlocksAsync(const std::vector<ID> &vecIDs, IExistCallback *pCallback)
+	{
+		if(pCallback == NULL)
+			return false;
+		OpenSP::sp<IExistCallback> pHold = pCallback;
+		for(size_t n = 0;n < vecIDs.size();n++)
+		{
+			if(!m_asyncQueue->PushExist(vecIDs[n],pCallback))
+				return false;
+		}
+		return true;
+	}
+
+	void DEUDBClient::waitForAsync(void)
+	{
+		m_asyncQueue->Wait();
+	}
 }
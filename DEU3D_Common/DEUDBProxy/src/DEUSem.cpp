@@ -1,4 +1,8 @@
 #include "DEUSem.h"
+#if !defined (WIN32) && !defined (WIN64)
+#include <time.h>
+#include <errno.h>
+#endif
 
 namespace deudbProxy
 {
@@ -32,7 +36,7 @@ namespace deudbProxy
 #ifdef WIN32
 		hnd = OpenSemaphore(SEMAPHORE_ALL_ACCESS,FALSE,strSemName.c_str());
 #else
-		hnd = sem_open(strSemName.c_str(), O_RDWR|O_CREAT);
+		hnd = sem_open(strSemName.c_str(), 0);
 #endif
 		return hnd;
 	}
@@ -57,6 +61,31 @@ namespace deudbProxy
 #endif
 	}
 
+	//wait semaphore with a timeout
+	bool DEUSem::WaitSem(HANDLE hnd,unsigned nMilliseconds)
+	{
+#ifdef WIN32
+		return WaitForSingleObject(hnd,nMilliseconds) == WAIT_OBJECT_0;
+#else
+		//sem_timedwait takes the time of the clock, not a span
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME,&ts);
+		ts.tv_sec += nMilliseconds / 1000u;
+		ts.tv_nsec += (long)(nMilliseconds % 1000u) * 1000000L;
+		if(ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		while(sem_timedwait(hnd,&ts) != 0)
+		{
+			if(errno != EINTR)
+				return false;
+		}
+		return true;
+#endif
+	}
+
 	//close semaphore
 	void DEUSem::CloseSem(HANDLE hnd,const std::string& strSemName)
 	{
@@ -5,6 +5,9 @@ namespace deudbProxy
 {
 	DEUShareMem::DEUShareMem(void)
 	{
+		m_shmHandle = NULL;
+		m_nShmID = -1;
+		m_shmAddr = NULL;
 	}
 
 
@@ -56,6 +59,11 @@ namespace deudbProxy
 		//close handle
 		return (CloseHandle(m_shmHandle) != 0);
 	}
+	//dt shared memory
+	bool DEUShareMem::DtShm()
+	{
+		return DestroyShm();
+	}
 #else
 	//create shared memory
 	bool DEUShareMem::CreateShm(const std::string& strShmName,unsigned nSize)
@@ -111,155 +119,13 @@ namespace deudbProxy
 		remove(m_strShmName.c_str());
 		return true;
 	}
-#endif
-	//read info from shared memory
-	bool DEUShareMem::ReadInfo(const std::string& strShmName,ShareObj& outObj)
+	//dt shared memory
+	bool DEUShareMem::DtShm()
 	{
-		//if invalid address,return 
-		if(m_shmAddr == NULL)
-			return false;
-		//get int address
-		int* nAddr = (int*)m_shmAddr;
-		//get type
-		outObj.m_nType = nAddr[0];
-		switch(outObj.m_nType)
-		{
-		case DEU_WRITE_DATA:
-		case DEU_UPDATE_DATA:
-		case DEU_REMOVE_DATA:
-        case DEU_REPLACE_DATA:
-		case DEU_IS_EXIST:
-        case DEU_SET_CLEAR_FLAG:
-		case DEU_FAIL:
-			return true;
-        case DEU_GET_COUNT:
-            {
-                outObj.m_nTotalLength = nAddr[1];
-                return true;
-            }
-		case DEU_READ_DATA:
-			{
-				outObj.m_nTotalLength = nAddr[1];
-				outObj.m_startLength =  nAddr[2];
-				outObj.m_endLength = nAddr[3];
-				//get data address
-				UINT_64* tempAddr = (UINT_64*)(nAddr+6);
-				char* chAddr = (char*)(tempAddr+3);
-				//read data
-				size_t sz = outObj.m_endLength - outObj.m_startLength + 1;
-                char* newAddr = (char *)malloc(sz+1);
-                if(!newAddr)    return false;
-				memset(newAddr,'\0',sz+1);
-				memcpy(newAddr,chAddr,sz);
-				outObj.m_pData = newAddr;
-				return true;
-			}
-		case DEU_ALL_INDEX:
-        case DEU_INDEX_INRANGE:
-			{
-				outObj.m_nTotalLength = nAddr[1];
-				outObj.m_startLength =  nAddr[2];
-				outObj.m_endLength = nAddr[3];
-				//get data address
-				UINT_64* tempAddr = (UINT_64*)(nAddr+6);
-				char* chAddr = (char*)(tempAddr+3);
-				//read data
-				size_t sz = outObj.m_endLength - outObj.m_startLength + 1;
-                char* newAddr = (char *)malloc(sz*sizeof(ID)+1);
-                if(!newAddr)    return false;
-				memset(newAddr,'\0',sz*sizeof(ID)+1);
-				memcpy(newAddr,chAddr,sz*sizeof(ID));
-				outObj.m_pData = newAddr;
-				return true;
-			}
-        case DEU_GET_VERSION:
-            {
-                outObj.m_nTotalLength = nAddr[1];
-                outObj.m_startLength =  nAddr[2];
-                outObj.m_endLength = nAddr[3];
-                //get data address
-                UINT_64* tempAddr = (UINT_64*)(nAddr+6);
-                char* chAddr = (char*)(tempAddr+3);
-                //read data
-                size_t sz = outObj.m_endLength - outObj.m_startLength + 1;
-                char* newAddr = (char *)malloc(sz*sizeof(unsigned)+1);
-                if(!newAddr)    return false;
-                memset(newAddr,'\0',sz*sizeof(unsigned)+1);
-                memcpy(newAddr,chAddr,sz*sizeof(unsigned));
-                outObj.m_pData = newAddr;
-                return true;
-            }
-		}
-		return false;
-    }
-    //write info to shared memory
-    bool DEUShareMem::WriteInfo(const std::string& strShmName,const ShareObj& sobj)
-    {
-        if(m_shmAddr == NULL)
-            return false;
-        //write type
-        int* nAddr = (int*)m_shmAddr;
-        nAddr[0] = sobj.m_nType;
-        switch(sobj.m_nType)
-        {
-        case DEU_FAIL:
-            return true;
-        case DEU_SET_CLEAR_FLAG:
-            {
-                nAddr[1] = sobj.m_nTotalLength;
-                return true;
-            }
-        case DEU_ALL_INDEX:
-        case DEU_GET_COUNT:
-            {
-                nAddr[1] = nAddr[2] = nAddr[3] = 0;
-                nAddr[4] = sobj.m_shmSize;
-                return true;
-            }
-        case DEU_INDEX_INRANGE:
-            {
-                nAddr[1] = 0;
-                nAddr[2] = sobj.m_startLength;
-                nAddr[3] = sobj.m_endLength;
-                nAddr[4] = sobj.m_shmSize;
-                return true;
-            }
-        case DEU_IS_EXIST:
-        case DEU_READ_DATA:
-        case DEU_REMOVE_DATA:
-        case DEU_GET_VERSION:
-            {
-                nAddr[1] = nAddr[2] = nAddr[3] = 0;
-                nAddr[4] = sobj.m_shmSize;
-                nAddr[5] = sobj.m_nVersion;
-                //write id
-                UINT_64* lAddr = (UINT_64*)(nAddr+6);
-                lAddr[0] = sobj.m_nHighBit;
-                lAddr[1] = sobj.m_nMidBit;
-                lAddr[2] = sobj.m_nLowBit;
-                return true;
-            }
-        case DEU_WRITE_DATA:
-        case DEU_UPDATE_DATA:
-        case DEU_REPLACE_DATA:
-            {
-                nAddr[1] = sobj.m_nTotalLength;
-                nAddr[2] = sobj.m_startLength;
-                nAddr[3] = sobj.m_endLength;
-                nAddr[4] = sobj.m_shmSize;
-                //write id
-                UINT_64* lAddr = (UINT_64*)(nAddr+6);
-                lAddr[0] = sobj.m_nHighBit;
-                lAddr[1] = sobj.m_nMidBit;
-                lAddr[2] = sobj.m_nLowBit;
-                //copy data
-                char* chAddr = (char*)(lAddr+3);
-                memcpy(chAddr,sobj.m_pData,sobj.m_endLength - sobj.m_startLength + 1);
-                return true;
-            }
-		}
-		return false;
+		shmdt(m_shmAddr);
+		return true;
 	}
+#endif
 	//read reg info
 	bool DEUShareMem::ReadRegInfo(const int& nType,const std::string& strDB,const std::string& strShared)
 	{
@@ -0,0 +1,117 @@
+#include "DEUShmArena.h"
+#include "DEUShareMem.h"
+#include "DEUShmRing.h"
+#include <OpenThreads/ScopedLock>
+
+namespace deudbProxy
+{
+	DEUShmArena::DEUShmArena(void)
+	{
+		m_shm = new DEUShareMem();
+		m_pHeader = NULL;
+		m_pLeases = NULL;
+	}
+
+
+	DEUShmArena::~DEUShmArena(void)
+	{
+		//the server removes the arena
+		if(m_pHeader != NULL)
+			m_shm->DtShm();
+		delete m_shm;
+	}
+
+	//map the arena of the server
+	bool DEUShmArena::Open(const std::string& strArena,volatile INT_32* pLeases)
+	{
+		if(!m_shm->AtShm(strArena))
+			return false;
+		ArenaHeader* pHeader = (ArenaHeader*)m_shm->GetShmAddr();
+		if(pHeader->m_nMagic != DEU_ARENA_MAGIC)
+		{
+			m_shm->DtShm();
+			return false;
+		}
+		m_pHeader = pHeader;
+		m_pLeases = pLeases;
+		return true;
+	}
+
+	const char* DEUShmArena::GetBlock(unsigned nEntry,unsigned& nLength) const
+	{
+		const ArenaEntry* pEntry = (const ArenaEntry*)(m_pHeader + 1) + nEntry;
+		nLength = pEntry->m_nLength;
+		return (const char*)m_pHeader + m_pHeader->m_nDataOffset + pEntry->m_nOffset;
+	}
+
+	void DEUShmArena::Hold(ArenaBlock* pBlock)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBlocks);
+		m_blockSet.insert(pBlock);
+	}
+
+	void DEUShmArena::Release(ArenaBlock* pBlock)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBlocks);
+		if(m_blockSet.erase(pBlock) != 0 && pBlock->GetEntry() != DEU_ARENA_NO_ENTRY)
+			ReleaseLease(pBlock->GetEntry());
+	}
+
+	//the lease table goes with the ring, so no lease may be left when the database is closed
+	void DEUShmArena::DetachBlocks()
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxBlocks);
+		for(std::set<ArenaBlock*>::iterator itr = m_blockSet.begin();itr != m_blockSet.end();++itr)
+		{
+			const unsigned nEntry = (*itr)->GetEntry();
+			(*itr)->Detach();
+			ReleaseLease(nEntry);
+		}
+		m_blockSet.clear();
+	}
+
+	//give the lease back, the server may reuse the entry once nobody holds it
+	void DEUShmArena::ReleaseLease(unsigned nEntry)
+	{
+		ArenaEntry* pEntry = (ArenaEntry*)(m_pHeader + 1) + nEntry;
+		RingDecrement(&m_pLeases[nEntry]);
+		RingDecrement(&pEntry->m_nLeases);
+	}
+
+
+	ArenaBlock::ArenaBlock(DEUShmArena* pArena,unsigned nEntry)
+	{
+		m_pArena = pArena;
+		m_nEntry = nEntry;
+		m_pData = pArena->GetBlock(nEntry,m_nLength);
+		m_pBuffer = NULL;
+		pArena->Hold(this);
+	}
+
+	ArenaBlock::ArenaBlock(void* pBuffer,unsigned nLength)
+	{
+		m_nEntry = DEU_ARENA_NO_ENTRY;
+		m_pData = m_pBuffer = pBuffer;
+		m_nLength = nLength;
+	}
+
+	ArenaBlock::~ArenaBlock(void)
+	{
+		if(m_pArena.valid())
+			m_pArena->Release(this);
+		if(m_pBuffer != NULL)
+			free(m_pBuffer);
+	}
+
+	//without memory the block stays where it is, it may be overwritten once the lease is gone
+	void ArenaBlock::Detach()
+	{
+		void* pBuffer = (m_nLength > 0) ? malloc(m_nLength) : NULL;
+		if(pBuffer != NULL)
+		{
+			memcpy(pBuffer,m_pData,m_nLength);
+			m_pData = m_pBuffer = pBuffer;
+		}
+		m_nEntry = DEU_ARENA_NO_ENTRY;
+	}
+}
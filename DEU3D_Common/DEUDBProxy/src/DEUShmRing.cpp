@@ -0,0 +1,277 @@
+#include "DEUShmRing.h"
+#include "DEUShareMem.h"
+#include "DEUSem.h"
+#include <sstream>
+#include <OpenThreads/Thread>
+#if !defined (WIN32) && !defined (WIN64)
+#include <signal.h>
+#include <errno.h>
+#endif
+
+namespace deudbProxy
+{
+	//the slots start behind the header, every slot on a cache line of its own
+	const size_t g_nRingSlotOffset = 64u;
+
+	static size_t getSlotStride()
+	{
+		return (sizeof(RingSlot) + 63u) & ~(size_t)63u;
+	}
+
+	DEUShmRing::DEUShmRing(void)
+	{
+		m_shm = new DEUShareMem();
+		m_pHeader = NULL;
+		m_pSlots = m_pInline = NULL;
+		m_bServerLost = false;
+	}
+
+
+	DEUShmRing::~DEUShmRing(void)
+	{
+		Destroy();
+		delete m_shm;
+	}
+
+	//create the ring
+	bool DEUShmRing::Create(const std::string& strShared,unsigned nSlotCount,unsigned nInlineSize)
+	{
+		m_strShared = strShared;
+
+		//1. create the shared memory, the header, the slots, the inline payloads and then the lease table
+		const size_t nInlineOffset = g_nRingSlotOffset + nSlotCount*getSlotStride();
+		const size_t nLeaseOffset = nInlineOffset + (size_t)nSlotCount*nInlineSize;
+		const size_t nSize = nLeaseOffset + DEU_ARENA_ENTRY_COUNT*sizeof(INT_32);
+		if(!m_shm->CreateShm(m_strShared + "Shm",(unsigned)nSize))
+			return false;
+		char* pAddr = (char*)m_shm->GetShmAddr();
+		memset(pAddr,0,nSize);
+		m_pHeader = (RingHeader*)pAddr;
+		m_pSlots = pAddr + g_nRingSlotOffset;
+		m_pInline = pAddr + nInlineOffset;
+
+		//2. create the semaphores of the slots
+		for(unsigned n = 0;n < nSlotCount;n++)
+		{
+			std::ostringstream oss;
+			oss<<m_strShared<<"EventSlot"<<n;
+			HANDLE hnd = DEUSem::CreateSem(oss.str(),0);
+			if(hnd == NULL)
+			{
+				Destroy();
+				return false;
+			}
+			m_slotHndVec.push_back(hnd);
+			m_slotSemVec.push_back(oss.str());
+		}
+		m_regionVec.assign(nSlotCount,(DEUShareMem*)NULL);
+		m_regionGenVec.assign(nSlotCount,0u);
+
+		//3. the server checks the magic when it opens the ring
+		m_pHeader->m_nSlotCount = nSlotCount;
+		m_pHeader->m_nInlineSize = nInlineSize;
+		m_pHeader->m_nLeaseCount = DEU_ARENA_ENTRY_COUNT;
+#if defined (WIN32) || defined (WIN64)
+		m_pHeader->m_nProcessID = (unsigned)GetCurrentProcessId();
+#else
+		m_pHeader->m_nProcessID = (unsigned)getpid();
+#endif
+		m_pHeader->m_nMagic = DEU_RING_MAGIC;
+		m_bServerLost = false;
+		m_bClosed = false;
+		return true;
+	}
+
+	//destroy the ring
+	void DEUShmRing::Destroy()
+	{
+		m_bClosed = true;
+		for(size_t n = 0;n < m_regionVec.size();n++)
+			FreeRegion((int)n);
+		m_regionVec.clear();
+		m_regionGenVec.clear();
+
+		for(size_t n = 0;n < m_slotHndVec.size();n++)
+			DEUSem::CloseSem(m_slotHndVec[n],m_slotSemVec[n]);
+		m_slotHndVec.clear();
+		m_slotSemVec.clear();
+
+		if(m_pHeader != NULL)
+			m_shm->DestroyShm();
+		m_pHeader = NULL;
+		m_pSlots = m_pInline = NULL;
+	}
+
+	volatile INT_32* DEUShmRing::GetLeases() const
+	{
+		return (volatile INT_32*)(m_pInline + (size_t)m_pHeader->m_nSlotCount*m_pHeader->m_nInlineSize);
+	}
+
+	unsigned DEUShmRing::GetSlotCount() const
+	{
+		return m_pHeader->m_nSlotCount;
+	}
+
+	//a big region is not kept for the next request
+	void DEUShmRing::TrimSlot(int nSlot)
+	{
+		if(GetSlot(nSlot)->m_nRegionSize > DEU_RING_KEEP_SIZE)
+			FreeRegion(nSlot);
+	}
+
+	RingSlot* DEUShmRing::GetSlot(int nSlot) const
+	{
+		return (RingSlot*)(m_pSlots + nSlot*getSlotStride());
+	}
+
+	//get the payload, grow it when it is too small
+	char* DEUShmRing::ReservePayload(int nSlot,unsigned nLength,unsigned nKeep)
+	{
+		RingSlot* pSlot = GetSlot(nSlot);
+		if(pSlot->m_nRegion == 0 && nLength <= m_pHeader->m_nInlineSize)
+			return GetPayload(nSlot);
+		if(pSlot->m_nRegion != 0 && nLength <= pSlot->m_nRegionSize)
+			return GetPayload(nSlot);
+
+		//the region grows to a power of two, so a slot is seldom grown twice
+		unsigned nSize = m_pHeader->m_nInlineSize * 2u;
+		while(nSize < nLength && nSize < 0x80000000u)
+			nSize *= 2u;
+		if(nSize < nLength)
+			nSize = nLength;
+
+		//every region has a new name, the server maps it when it sees the generation change
+		const unsigned nGen = ++m_regionGenVec[nSlot];
+		std::ostringstream oss;
+		oss<<m_strShared<<"Region"<<nSlot<<"_"<<nGen;
+		DEUShareMem* pRegion = new DEUShareMem();
+		if(!pRegion->CreateShm(oss.str(),nSize))
+		{
+			delete pRegion;
+			return NULL;
+		}
+		if(nKeep > 0)
+			memcpy(pRegion->GetShmAddr(),GetPayload(nSlot),nKeep < nLength ? nKeep : nLength);
+		FreeRegion(nSlot);
+		m_regionVec[nSlot] = pRegion;
+		pSlot->m_nRegion = nGen;
+		pSlot->m_nRegionSize = nSize;
+		return (char*)pRegion->GetShmAddr();
+	}
+
+	char* DEUShmRing::GetPayload(int nSlot) const
+	{
+		if(GetSlot(nSlot)->m_nRegion != 0)
+			return (char*)m_regionVec[nSlot]->GetShmAddr();
+		return m_pInline + (size_t)nSlot*m_pHeader->m_nInlineSize;
+	}
+
+	//call the server
+	void DEUShmRing::Call(int nSlot,HANDLE svrHnd)
+	{
+		RingSlot* pSlot = GetSlot(nSlot);
+		const int nType = pSlot->m_nType;
+		const unsigned nRequestLength = pSlot->m_nLength;
+		while(1)
+		{
+			//a server which has gone never answers, the slot is not handed to it again
+			if(m_bServerLost)
+			{
+				pSlot->m_nType = DEU_FAIL;
+				return;
+			}
+			Post(nSlot,svrHnd);
+			if(!Wait(nSlot))
+			{
+				pSlot->m_nType = DEU_FAIL;
+				return;
+			}
+			if(pSlot->m_nType != DEU_NEED_SPACE)
+				return;
+
+			//the server has told how much it needs, the request goes again
+			//with what it has carried in the payload
+			if(ReservePayload(nSlot,pSlot->m_nLength,nRequestLength) == NULL)
+			{
+				pSlot->m_nType = DEU_FAIL;
+				return;
+			}
+			pSlot->m_nType = nType;
+			pSlot->m_nLength = nRequestLength;
+		}
+	}
+
+	void DEUShmRing::Post(int nSlot,HANDLE svrHnd)
+	{
+		RingExchange(&GetSlot(nSlot)->m_nState,DEU_SLOT_REQUEST);
+		//the server is only woken when it sleeps
+		if(RingExchange(&m_pHeader->m_nServerWaiting,0) != 0)
+			DEUSem::ReleaseSem(svrHnd);
+	}
+
+	//false when the server has gone before it answered
+	bool DEUShmRing::Wait(int nSlot)
+	{
+		RingSlot* pSlot = GetSlot(nSlot);
+		//most responses come while the thread spins
+		for(unsigned n = 0;n < DEU_RING_SPIN_COUNT;n++)
+		{
+			if(RingLoad(&pSlot->m_nState) == DEU_SLOT_RESPONSE)
+				return true;
+			OpenThreads::Thread::YieldCurrentThread();
+		}
+		while(RingLoad(&pSlot->m_nState) != DEU_SLOT_RESPONSE)
+		{
+			RingExchange(&pSlot->m_nClientWaiting,1);
+			//the response may have come before the server saw the flag,
+			//a release left on the semaphore only wakes the next wait once more
+			if(RingLoad(&pSlot->m_nState) == DEU_SLOT_RESPONSE)
+			{
+				RingExchange(&pSlot->m_nClientWaiting,0);
+				break;
+			}
+			if(DEUSem::WaitSem(m_slotHndVec[nSlot],DEU_RING_WAIT_TIMEOUT))
+				continue;
+
+			//a long request is still answered, a server which has died never
+			if(!IsServerAlive() && RingLoad(&pSlot->m_nState) != DEU_SLOT_RESPONSE)
+			{
+				m_bServerLost = true;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool DEUShmRing::IsServerAlive() const
+	{
+		const unsigned nProcessID = m_pHeader->m_nServerProcessID;
+		if(nProcessID == 0)
+			return true;
+#if defined (WIN32) || defined (WIN64)
+		HANDLE hnd = OpenProcess(SYNCHRONIZE,FALSE,nProcessID);
+		if(hnd == NULL)
+			return GetLastError() == ERROR_ACCESS_DENIED;
+		const bool bAlive = (WaitForSingleObject(hnd,0) == WAIT_TIMEOUT);
+		CloseHandle(hnd);
+		return bAlive;
+#else
+		return kill((pid_t)nProcessID,0) == 0 || errno == EPERM;
+#endif
+	}
+
+	void DEUShmRing::FreeRegion(int nSlot)
+	{
+		if(m_regionVec[nSlot] == NULL)
+			return;
+		m_regionVec[nSlot]->DestroyShm();
+		delete m_regionVec[nSlot];
+		m_regionVec[nSlot] = NULL;
+		if(m_pHeader != NULL)
+		{
+			RingSlot* pSlot = GetSlot(nSlot);
+			pSlot->m_nRegion = 0;
+			pSlot->m_nRegionSize = 0;
+		}
+	}
+}
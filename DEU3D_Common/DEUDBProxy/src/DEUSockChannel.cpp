@@ -0,0 +1,489 @@
+#include "DEUSockChannel.h"
+#include <OpenThreads/Thread>
+#if !defined (WIN32) && !defined (WIN64)
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS          1033
+#define F_GET_SEALS          1034
+#define F_SEAL_SHRINK        0x0002
+#endif
+#define DEU_MFD_CLOEXEC      0x0001u
+#define DEU_MFD_ALLOW_SEALING 0x0002u
+#endif
+
+namespace deudbProxy
+{
+#if defined (WIN32) || defined (WIN64)
+	//there is neither a unix domain socket nor a memfd, Open always fails
+	static int connectSocket(const std::string& strSocket)
+	{
+		return -1;
+	}
+
+	static void closeFd(int nFd)
+	{
+	}
+
+	static bool sendMessage(int nSocket,const SockHeader& head,const char* pPayload,int nMemFd)
+	{
+		return false;
+	}
+
+	static bool recvAll(int nSocket,void* pBuffer,size_t nSize,int& nMemFd)
+	{
+		return false;
+	}
+
+	static int createMemFd(unsigned nSize)
+	{
+		return -1;
+	}
+
+	static char* mapMemFd(int nMemFd,unsigned& nSize)
+	{
+		return NULL;
+	}
+
+	static void unmapMemFd(int nMemFd,char* pMapped,unsigned nSize)
+	{
+	}
+#else
+	//the server runs as the same user or as root
+	static bool checkPeer(int nSocket)
+	{
+		struct ucred cred;
+		socklen_t nSize = sizeof(cred);
+		if(getsockopt(nSocket,SOL_SOCKET,SO_PEERCRED,&cred,&nSize) != 0)
+			return false;
+		return cred.uid == getuid() || cred.uid == 0;
+	}
+
+	static int connectSocket(const std::string& strSocket)
+	{
+		struct sockaddr_un addr;
+		memset(&addr,0,sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(strSocket.length() >= sizeof(addr.sun_path))
+			return -1;
+		strcpy(addr.sun_path,strSocket.c_str());
+
+		const int nSocket = socket(AF_UNIX,SOCK_STREAM,0);
+		if(nSocket < 0)
+			return -1;
+		fcntl(nSocket,F_SETFD,FD_CLOEXEC);
+		if(connect(nSocket,(struct sockaddr*)&addr,sizeof(addr)) != 0 || !checkPeer(nSocket))
+		{
+			close(nSocket);
+			return -1;
+		}
+		return nSocket;
+	}
+
+	static void closeFd(int nFd)
+	{
+		close(nFd);
+	}
+
+	//send the head and the payload behind it, the memfd goes along with the first bytes
+	static bool sendMessage(int nSocket,const SockHeader& head,const char* pPayload,int nMemFd)
+	{
+		struct iovec iov[2];
+		iov[0].iov_base = (void*)&head;
+		iov[0].iov_len = sizeof(head);
+		iov[1].iov_base = (void*)pPayload;
+		iov[1].iov_len = (pPayload != NULL) ? head.m_nLength : 0;
+
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr msg;
+		memset(&msg,0,sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		if(nMemFd >= 0)
+		{
+			memset(control,0,sizeof(control));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+			pCmsg->cmsg_level = SOL_SOCKET;
+			pCmsg->cmsg_type = SCM_RIGHTS;
+			pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(pCmsg),&nMemFd,sizeof(int));
+		}
+
+		while(msg.msg_iovlen > 0)
+		{
+			const ssize_t nSent = sendmsg(nSocket,&msg,MSG_NOSIGNAL);
+			if(nSent < 0 && errno == EINTR)
+				continue;
+			if(nSent <= 0)
+				return false;
+
+			//the rest goes without the memfd
+			msg.msg_control = NULL;
+			msg.msg_controllen = 0;
+			size_t nLeft = (size_t)nSent;
+			while(msg.msg_iovlen > 0 && nLeft >= msg.msg_iov->iov_len)
+			{
+				nLeft -= msg.msg_iov->iov_len;
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			}
+			if(msg.msg_iovlen > 0)
+			{
+				msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + nLeft;
+				msg.msg_iov->iov_len -= nLeft;
+			}
+		}
+		return true;
+	}
+
+	//receive nSize bytes, a memfd passed along with them is handed out in nMemFd
+	static bool recvAll(int nSocket,void* pBuffer,size_t nSize,int& nMemFd)
+	{
+		char* pData = (char*)pBuffer;
+		while(nSize > 0)
+		{
+			struct iovec iov;
+			iov.iov_base = pData;
+			iov.iov_len = nSize;
+			char control[CMSG_SPACE(sizeof(int))];
+			struct msghdr msg;
+			memset(&msg,0,sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+
+			const ssize_t nRecv = recvmsg(nSocket,&msg,MSG_CMSG_CLOEXEC);
+			if(nRecv < 0 && errno == EINTR)
+				continue;
+			if(nRecv <= 0)
+				return false;
+
+			//only one memfd comes with a message, any other is closed
+			for(struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);pCmsg != NULL;pCmsg = CMSG_NXTHDR(&msg,pCmsg))
+			{
+				if(pCmsg->cmsg_level != SOL_SOCKET || pCmsg->cmsg_type != SCM_RIGHTS)
+					continue;
+				const size_t nFdCount = (pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				for(size_t n = 0;n < nFdCount;n++)
+				{
+					int nFd = -1;
+					memcpy(&nFd,CMSG_DATA(pCmsg) + n*sizeof(int),sizeof(int));
+					if(nMemFd >= 0)
+						close(nFd);
+					else
+						nMemFd = nFd;
+				}
+			}
+			pData += nRecv;
+			nSize -= (size_t)nRecv;
+		}
+		return true;
+	}
+
+	//the memfd cannot shrink, so the peer mapping it never faults
+	static int createMemFd(unsigned nSize)
+	{
+#ifdef SYS_memfd_create
+		const int nMemFd = (int)syscall(SYS_memfd_create,"deudb",DEU_MFD_CLOEXEC|DEU_MFD_ALLOW_SEALING);
+		if(nMemFd < 0)
+			return -1;
+		if(ftruncate(nMemFd,nSize) != 0 || fcntl(nMemFd,F_ADD_SEALS,F_SEAL_SHRINK) != 0)
+		{
+			close(nMemFd);
+			return -1;
+		}
+		return nMemFd;
+#else
+		return -1;
+#endif
+	}
+
+	//map the whole memfd, nSize is its size
+	static char* mapMemFd(int nMemFd,unsigned& nSize)
+	{
+		struct stat st;
+		if((fcntl(nMemFd,F_GET_SEALS) & F_SEAL_SHRINK) == 0 || fstat(nMemFd,&st) != 0)
+			return NULL;
+		if(st.st_size <= 0 || st.st_size >= 0x80000000LL)
+			return NULL;
+		void* pAddr = mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,nMemFd,0);
+		if(pAddr == MAP_FAILED)
+			return NULL;
+		nSize = (unsigned)st.st_size;
+		return (char*)pAddr;
+	}
+
+	static void unmapMemFd(int nMemFd,char* pMapped,unsigned nSize)
+	{
+		munmap(pMapped,nSize);
+		close(nMemFd);
+	}
+#endif
+
+	//whether the server may carry the request out twice
+	static bool isRepeatable(int nType)
+	{
+		return nType != DEU_WRITE_DATA && nType != DEU_REMOVE_DATA;
+	}
+
+	DEUSockChannel::DEUSockChannel(void)
+	{
+	}
+
+
+	DEUSockChannel::~DEUSockChannel(void)
+	{
+		Destroy();
+	}
+
+	//connect to the server
+	bool DEUSockChannel::Open(const std::string& strSocket,unsigned nSlotCount)
+	{
+		Destroy();
+		m_strSocket = strSocket;
+
+		//1. the first connection tells whether the server listens, the first slot keeps it
+		const int nSocket = connectSocket(m_strSocket);
+		if(nSocket < 0)
+			return false;
+
+		//2. make the slots, the others connect when they are first used
+		for(unsigned n = 0;n < nSlotCount;n++)
+		{
+			SockSlot* pSlot = new SockSlot();
+			memset(&pSlot->m_slot,0,sizeof(RingSlot));
+			pSlot->m_nSocket = (n == 0) ? nSocket : -1;
+			pSlot->m_inlineVec.resize(DEU_SOCK_INLINE_SIZE);
+			pSlot->m_nMemFd = -1;
+			pSlot->m_pMapped = NULL;
+			pSlot->m_nMappedSize = 0;
+			m_slotVec.push_back(pSlot);
+		}
+		m_bClosed = false;
+		return true;
+	}
+
+	//close the connections
+	void DEUSockChannel::Destroy()
+	{
+		m_bClosed = true;
+		for(size_t n = 0;n < m_slotVec.size();n++)
+		{
+			if(m_slotVec[n]->m_nSocket >= 0)
+				closeFd(m_slotVec[n]->m_nSocket);
+			FreePayload((int)n);
+			delete m_slotVec[n];
+		}
+		m_slotVec.clear();
+	}
+
+	unsigned DEUSockChannel::GetSlotCount() const
+	{
+		return (unsigned)m_slotVec.size();
+	}
+
+	//a big payload is not kept for the next request
+	void DEUSockChannel::TrimSlot(int nSlot)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		if(pSlot->m_nMappedSize > DEU_RING_KEEP_SIZE)
+			FreePayload(nSlot);
+		if(pSlot->m_inlineVec.size() > DEU_SOCK_INLINE_SIZE)
+			std::vector<char>(DEU_SOCK_INLINE_SIZE).swap(pSlot->m_inlineVec);
+	}
+
+	RingSlot* DEUSockChannel::GetSlot(int nSlot) const
+	{
+		return &m_slotVec[nSlot]->m_slot;
+	}
+
+	//get the payload, grow it when it is too small
+	char* DEUSockChannel::ReservePayload(int nSlot,unsigned nLength,unsigned nKeep)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		if(pSlot->m_pMapped == NULL && nLength <= pSlot->m_inlineVec.size())
+			return &pSlot->m_inlineVec[0];
+		if(pSlot->m_pMapped != NULL && nLength <= pSlot->m_nMappedSize)
+			return pSlot->m_pMapped;
+
+		//the memfd grows to a power of two, so a slot is seldom grown twice
+		unsigned nSize = DEU_SOCK_INLINE_SIZE * 2u;
+		while(nSize < nLength && nSize < 0x80000000u)
+			nSize *= 2u;
+		if(nSize < nLength)
+			nSize = nLength;
+
+		const int nMemFd = createMemFd(nSize);
+		if(nMemFd >= 0)
+		{
+			unsigned nMappedSize = 0;
+			char* pMapped = mapMemFd(nMemFd,nMappedSize);
+			if(pMapped == NULL)
+			{
+				closeFd(nMemFd);
+				return NULL;
+			}
+			if(nKeep > 0)
+				memcpy(pMapped,GetPayload(nSlot),nKeep < nLength ? nKeep : nLength);
+			FreePayload(nSlot);
+			pSlot->m_nMemFd = nMemFd;
+			pSlot->m_pMapped = pMapped;
+			pSlot->m_nMappedSize = nMappedSize;
+			return pMapped;
+		}
+
+		//without a memfd the payload grows on the heap and goes through the socket
+		if(pSlot->m_pMapped != NULL)
+			return NULL;
+		pSlot->m_inlineVec.resize(nSize);
+		return &pSlot->m_inlineVec[0];
+	}
+
+	char* DEUSockChannel::GetPayload(int nSlot) const
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		if(pSlot->m_pMapped != NULL)
+			return pSlot->m_pMapped;
+		return &pSlot->m_inlineVec[0];
+	}
+
+	//call the server
+	void DEUSockChannel::Call(int nSlot,HANDLE svrHnd)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		for(unsigned nTry = 0;nTry < DEU_SOCK_RETRY_COUNT;nTry++)
+		{
+			//1. the connection is made when the slot is first used or after it has broken,
+			//   a server which is starting again is given a little time
+			if(pSlot->m_nSocket < 0)
+			{
+				if(nTry > 1)
+					OpenThreads::Thread::microSleep(DEU_SOCK_RETRY_WAIT*(nTry - 1));
+				pSlot->m_nSocket = connectSocket(m_strSocket);
+				if(pSlot->m_nSocket < 0)
+					continue;
+			}
+
+			//2. send the request and wait for the response
+			bool bRetry = true;
+			const bool bSent = Send(nSlot);
+			if(bSent && Receive(nSlot,bRetry))
+				return;
+			closeFd(pSlot->m_nSocket);
+			pSlot->m_nSocket = -1;
+
+			//3. a request which has reached the server may have been carried out,
+			//   it is only sent again when that does no harm
+			if(!bRetry || (bSent && !isRepeatable(pSlot->m_slot.m_nType)))
+				break;
+		}
+		pSlot->m_slot.m_nType = DEU_FAIL;
+	}
+
+	bool DEUSockChannel::Send(int nSlot)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		const RingSlot& slot = pSlot->m_slot;
+		SockHeader head;
+		memset(&head,0,sizeof(head));
+		head.m_nMagic = DEU_SOCK_MAGIC;
+		head.m_nType = slot.m_nType;
+		head.m_nVersion = slot.m_nVersion;
+		head.m_nHighBit = slot.m_nHighBit;
+		head.m_nMidBit = slot.m_nMidBit;
+		head.m_nLowBit = slot.m_nLowBit;
+		head.m_nOffset = slot.m_nOffset;
+		head.m_nCount = slot.m_nCount;
+		head.m_nLength = slot.m_nLength;
+
+		//a payload bigger than the inline size goes in its memfd
+		if(head.m_nLength > DEU_SOCK_INLINE_SIZE && pSlot->m_pMapped != NULL)
+		{
+			head.m_nFlags = DEU_SOCK_MEMFD;
+			return sendMessage(pSlot->m_nSocket,head,NULL,pSlot->m_nMemFd);
+		}
+		return sendMessage(pSlot->m_nSocket,head,GetPayload(nSlot),-1);
+	}
+
+	bool DEUSockChannel::Receive(int nSlot,bool& bRetry)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+
+		//1. the head, it may come with the memfd of the response
+		SockHeader head;
+		int nMemFd = -1;
+		if(!recvAll(pSlot->m_nSocket,&head,sizeof(head),nMemFd) || head.m_nMagic != DEU_SOCK_MAGIC)
+		{
+			if(nMemFd >= 0)
+				closeFd(nMemFd);
+			return false;
+		}
+		//the server has carried the request out, the payload is written over from now on
+		bRetry = false;
+
+		//2. the payload, in the memfd or behind the head
+		if((head.m_nFlags & DEU_SOCK_MEMFD) != 0)
+		{
+			if(nMemFd < 0 || !MapPayload(nSlot,nMemFd) || head.m_nLength > pSlot->m_nMappedSize)
+				return false;
+		}
+		else
+		{
+			if(nMemFd >= 0)
+				closeFd(nMemFd);
+			char* pPayload = ReservePayload(nSlot,head.m_nLength);
+			int nExtraFd = -1;
+			if(pPayload == NULL || (head.m_nLength > 0 && !recvAll(pSlot->m_nSocket,pPayload,head.m_nLength,nExtraFd)))
+				return false;
+			if(nExtraFd >= 0)
+				closeFd(nExtraFd);
+		}
+
+		//3. the response goes into the slot as if it had come through the ring
+		RingSlot& slot = pSlot->m_slot;
+		slot.m_nType = head.m_nType;
+		slot.m_nOffset = head.m_nOffset;
+		slot.m_nCount = head.m_nCount;
+		slot.m_nLength = head.m_nLength;
+		return true;
+	}
+
+	bool DEUSockChannel::MapPayload(int nSlot,int nMemFd)
+	{
+		unsigned nSize = 0;
+		char* pMapped = mapMemFd(nMemFd,nSize);
+		if(pMapped == NULL)
+		{
+			closeFd(nMemFd);
+			return false;
+		}
+		FreePayload(nSlot);
+		SockSlot* pSlot = m_slotVec[nSlot];
+		pSlot->m_nMemFd = nMemFd;
+		pSlot->m_pMapped = pMapped;
+		pSlot->m_nMappedSize = nSize;
+		return true;
+	}
+
+	void DEUSockChannel::FreePayload(int nSlot)
+	{
+		SockSlot* pSlot = m_slotVec[nSlot];
+		if(pSlot->m_pMapped == NULL)
+			return;
+		unmapMemFd(pSlot->m_nMemFd,pSlot->m_pMapped,pSlot->m_nMappedSize);
+		pSlot->m_nMemFd = -1;
+		pSlot->m_pMapped = NULL;
+		pSlot->m_nMappedSize = 0;
+	}
+}
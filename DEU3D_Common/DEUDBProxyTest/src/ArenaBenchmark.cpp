@@ -0,0 +1,221 @@
+#include "DEUDBProxyTest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+namespace
+{
+    const unsigned g_nArenaTiles        = 2048u;    // twice what the arena holds, the hot ones stay in it
+    const unsigned g_nArenaTileLength   = 65536u;
+    const unsigned g_nArenaCheckEvery   = 16u;      // the reads whose every byte is checked
+
+#if defined (WIN32) || defined (WIN64)
+    typedef HANDLE  ReaderProcess;
+#else
+    typedef pid_t   ReaderProcess;
+#endif
+
+    // the tiles are asked for by a zipfian law, tile n as often as 1 / (n + 1) of the first
+    class ZipfTiles
+    {
+    public:
+        explicit ZipfTiles(unsigned nTiles) : m_vecSums(nTiles)
+        {
+            double dblSum = 0.0;
+            for(unsigned n = 0u; n < nTiles; n++)
+            {
+                dblSum += 1.0 / (n + 1u);
+                m_vecSums[n] = dblSum;
+            }
+        }
+
+        // the tile of a random number in [0, 1)
+        unsigned getTile(double dblRandom) const
+        {
+            const double dblAt = dblRandom * m_vecSums.back();
+            const size_t nTile = std::upper_bound(m_vecSums.begin(), m_vecSums.end(), dblAt) - m_vecSums.begin();
+            return (unsigned)std::min(nTile, m_vecSums.size() - 1u);
+        }
+
+    private:
+        std::vector<double>     m_vecSums;
+    };
+
+
+    // a process of this program running runArenaReader, false if it could not be started
+    bool startReader(const std::string &strDB, bool bShared, unsigned nReads, unsigned nSeed, ReaderProcess &process)
+    {
+        std::ostringstream ossReads, ossSeed;
+        ossReads << nReads;
+        ossSeed << nSeed;
+
+#if defined (WIN32) || defined (WIN64)
+        char szExe[MAX_PATH] = {0};
+        GetModuleFileNameA(NULL, szExe, MAX_PATH);
+        std::string strCommand = std::string("\"") + szExe + "\" -arena-reader \"" + strDB + "\" " +
+            (bShared ? "1 " : "0 ") + ossReads.str() + " " + ossSeed.str();
+
+        STARTUPINFOA si;
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+        PROCESS_INFORMATION pi;
+        if(!CreateProcessA(NULL, &strCommand[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+        {
+            return false;
+        }
+        CloseHandle(pi.hThread);
+        process = pi.hProcess;
+        return true;
+#else
+        char szExe[1024];
+        const ssize_t nCount = readlink("/proc/self/exe", szExe, sizeof(szExe) - 1u);
+        if(nCount <= 0)
+        {
+            return false;
+        }
+        szExe[nCount] = '\0';
+
+        process = fork();
+        if(process < 0)     return false;
+        if(process == 0)
+        {
+            execl(szExe, szExe, "-arena-reader", strDB.c_str(), bShared ? "1" : "0",
+                  ossReads.str().c_str(), ossSeed.str().c_str(), (char *)NULL);
+            _exit(1);
+        }
+        return true;
+#endif
+    }
+
+
+    // waits for the reader, false unless it has read every tile right
+    bool waitReader(ReaderProcess process)
+    {
+#if defined (WIN32) || defined (WIN64)
+        DWORD nExit = 1u;
+        WaitForSingleObject(process, INFINITE);
+        GetExitCodeProcess(process, &nExit);
+        CloseHandle(process);
+        return nExit == 0u;
+#else
+        int nStatus = 0;
+        return waitpid(process, &nStatus, 0) == process && WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0;
+#endif
+    }
+
+
+    // the seconds nProcesses readers take for nReads reads each, -1 if one of them has failed
+    double runReaders(const std::string &strDB, bool bShared, unsigned nProcesses, unsigned nReads)
+    {
+        const double dblStart = getSeconds();
+        std::vector<ReaderProcess> vecReaders;
+        bool bFailed = false;
+        for(unsigned i = 0u; i < nProcesses && !bFailed; i++)
+        {
+            ReaderProcess process;
+            bFailed = !startReader(strDB, bShared, nReads, i + 1u, process);
+            if(!bFailed)    vecReaders.push_back(process);
+        }
+        for(size_t i = 0u; i < vecReaders.size(); i++)
+        {
+            bFailed = !waitReader(vecReaders[i]) || bFailed;
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+        return bFailed ? -1.0 : dblSeconds;
+    }
+}
+
+
+int runArenaReader(const std::string &strDB, bool bShared, unsigned nReads, unsigned nSeed)
+{
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    if(!openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy))
+    {
+        return 1;
+    }
+
+    const ZipfTiles tiles(g_nArenaTiles);
+    bool bValid = true;
+    for(unsigned i = 0u; i < nReads && bValid; i++)
+    {
+        nSeed = nSeed * 1103515245u + 12345u;
+        const unsigned n = tiles.getTile((nSeed >> 8u) / 16777216.0);
+        const bool bCheck = (i % g_nArenaCheckEvery == 0u);
+        unsigned nRound = 0u;
+        if(bShared)
+        {
+            // read in place, every process shares the copy in the arena
+            OpenSP::sp<deudbProxy::ISharedBlock> pBlock;
+            bValid = pProxy->readSharedBlock(makeTestID(n), pBlock) && pBlock->getLength() == g_nArenaTileLength &&
+                (!bCheck || checkTestBlock(n, pBlock->getData(), pBlock->getLength(), nRound));
+        }
+        else
+        {
+            void *pBuffer = NULL;
+            unsigned nLength = 0u;
+            bValid = pProxy->readBlock(makeTestID(n), pBuffer, nLength) && nLength == g_nArenaTileLength &&
+                (!bCheck || checkTestBlock(n, pBuffer, nLength, nRound));
+            deudbProxy::freeMemory(pBuffer);
+        }
+    }
+    pProxy->closeDB();
+    return bValid ? 0 : 1;
+}
+
+
+int runArenaBenchmark(const std::string &strDir, unsigned nProcesses, unsigned nReads)
+{
+    printf("%u processes reading %u zipfian tiles %u times each\n", nProcesses, g_nArenaTiles, nReads);
+
+    // the proxy which writes the tiles stays open, so the server and its arena stay up between the runs
+    const std::string strDB = strDir + "/arena_bench";
+    removeDatabase(strDB);
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    bool bWritten = openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy);
+    for(unsigned n = 0u; n < g_nArenaTiles && bWritten; n++)
+    {
+        bWritten = writeTestBlock(pProxy.get(), n, 0u, g_nArenaTileLength);
+    }
+    if(!bWritten)
+    {
+        printf("    FAILED to write the tiles\n");
+        if(pProxy.valid())
+        {
+            pProxy->closeDB();
+        }
+        removeDatabase(strDB);
+        return 1;
+    }
+
+    // copied out of the payload of every request, then read in place out of the arena
+    int nFailed = 0;
+    for(unsigned nMode = 0u; nMode < 2u; nMode++)
+    {
+        const bool bShared = (nMode == 1u);
+        const double dblSeconds = runReaders(strDB, bShared, nProcesses, nReads);
+        if(dblSeconds < 0.0)
+        {
+            printf("    %-8s FAILED\n", bShared ? "shared" : "copied");
+            ++nFailed;
+            continue;
+        }
+
+        const double dblReads = (double)nProcesses * nReads;
+        printf("    %-8s %.0f reads/s, %.1f MB/s\n", bShared ? "shared" : "copied",
+               dblReads / dblSeconds, dblReads * g_nArenaTileLength / (1024.0 * 1024.0) / dblSeconds);
+    }
+    pProxy->closeDB();
+    pProxy = NULL;
+
+    removeDatabase(strDB);
+    return nFailed;
+}
@@ -0,0 +1,287 @@
+#include "DEUDBProxyTest.h"
+#include <DEUDBProxy/DEUDefine.h>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+namespace
+{
+    // more requests than may be outstanding, so the pushes wait for room
+    const unsigned g_nAsyncBlocks   = 3u * DEU_ASYNC_MAX_OUTSTANDING;
+    const unsigned g_nAsyncMissing  = 1000000u;     // the IDs from here on are never written
+    const unsigned g_nAsyncTimeout  = 60000u;
+
+    // the place of the answers of n, the written IDs come first and the missing ones behind them
+    unsigned getAnswerIndex(unsigned n)
+    {
+        return (n < g_nAsyncMissing) ? n : 2u * g_nAsyncBlocks + (n - g_nAsyncMissing);
+    }
+
+
+    // counts the answers of every ID, a block must be of m_nRound and a missing ID must not be found
+    class CountingReader : public deudbProxy::IReadCallback
+    {
+    public:
+        explicit CountingReader(unsigned nRound)
+            : m_nRound(nRound), m_vecAnswers(4u * g_nAsyncBlocks, 0u), m_nAnswered(0u), m_nWrong(0u), m_nDelay(0u){}
+
+    public:
+        virtual void onRead(const ID &id, bool bFound, void *pBuffer, unsigned nLength)
+        {
+            const unsigned n = (unsigned)id.m_nLowBit;
+            unsigned nRound = 0u;
+            const bool bRight = (n >= g_nAsyncMissing) ? (!bFound && pBuffer == NULL)
+                : (bFound && checkTestBlock(n, pBuffer, nLength, nRound) && nRound == m_nRound);
+            deudbProxy::freeMemory(pBuffer);
+
+            // a slow callback now and then, the requests behind it pile up
+            if(m_nDelay > 0u && n % 64u == 0u)
+            {
+                sleepMilliseconds(m_nDelay);
+            }
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxAnswers);
+            ++m_vecAnswers[getAnswerIndex(n)];
+            if(!bRight)     ++m_nWrong;
+            ++m_nAnswered;
+        }
+
+        // every one of the IDs from nFirst on has been answered nTimes
+        bool isAnswered(unsigned nFirst, unsigned nCount, unsigned nTimes)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxAnswers);
+            for(unsigned n = nFirst; n < nFirst + nCount; n++)
+            {
+                if(m_vecAnswers[getAnswerIndex(n)] != nTimes)   return false;
+            }
+            return true;
+        }
+
+        unsigned getAnswered(void)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxAnswers);
+            return m_nAnswered;
+        }
+
+    public:
+        unsigned                m_nRound;
+        OpenThreads::Mutex      m_mtxAnswers;
+        std::vector<unsigned>   m_vecAnswers;
+        unsigned                m_nAnswered;
+        unsigned                m_nWrong;
+        unsigned                m_nDelay;
+    };
+
+
+    class CountingExist : public deudbProxy::IExistCallback
+    {
+    public:
+        CountingExist(void) : m_nAnswered(0u), m_nWrong(0u){}
+
+    public:
+        virtual void onExist(const ID &id, bool bExist)
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxAnswers);
+            if(bExist != (id.m_nLowBit < g_nAsyncMissing))   ++m_nWrong;
+            ++m_nAnswered;
+        }
+
+    public:
+        OpenThreads::Mutex      m_mtxAnswers;
+        unsigned                m_nAnswered;
+        unsigned                m_nWrong;
+    };
+
+
+    // A read of the first g_nAsyncBlocks IDs queues the read of the ID as many behind it, which goes
+    // into a queue that is full, and every 50th of those waits for the queue in its callback.
+    class ChainReader : public CountingReader
+    {
+    public:
+        explicit ChainReader(deudbProxy::IDEUDBProxy *pProxy) : CountingReader(1u), m_pProxy(pProxy), m_nPushFailed(0u){}
+
+    public:
+        virtual void onRead(const ID &id, bool bFound, void *pBuffer, unsigned nLength)
+        {
+            CountingReader::onRead(id, bFound, pBuffer, nLength);
+            const unsigned n = (unsigned)id.m_nLowBit;
+            if(n < g_nAsyncBlocks)
+            {
+                if(!m_pProxy->readBlockAsync(makeTestID(n + g_nAsyncBlocks), this))
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxAnswers);
+                    ++m_nPushFailed;
+                }
+            }
+            else if(n % 50u == 0u)
+            {
+                m_pProxy->waitForAsync();
+            }
+        }
+
+    public:
+        deudbProxy::IDEUDBProxy    *m_pProxy;
+        unsigned                    m_nPushFailed;
+    };
+
+
+    // closes the database in its callback, a request queued after it is refused
+    class ClosingExist : public deudbProxy::IExistCallback
+    {
+    public:
+        explicit ClosingExist(deudbProxy::IDEUDBProxy *pProxy) : m_pProxy(pProxy), m_bClosed(false), m_bRefused(false){}
+
+    public:
+        virtual void onExist(const ID &id, bool bExist)
+        {
+            m_bClosed  = m_pProxy->closeDB();
+            m_bRefused = !m_pProxy->existAsync(id, this);
+        }
+
+    public:
+        deudbProxy::IDEUDBProxy    *m_pProxy;
+        volatile bool               m_bClosed;
+        volatile bool               m_bRefused;
+    };
+
+
+    bool writeAsyncBlocks(deudbProxy::IDEUDBProxy *pProxy, unsigned nCount, unsigned nRound)
+    {
+        for(unsigned n = 0u; n < nCount; n++)
+        {
+            TEST_CHECK(writeTestBlock(pProxy, n, nRound, (n % 16u == 0u) ? getBigBlockLength(n) : 0u));
+        }
+        return true;
+    }
+}
+
+
+// Reads and lookups queued in turn, more than may be outstanding, are each answered once with the
+// block as it was written before the request was queued. waitForAsync returns only after the last
+// callback has returned.
+bool testAsyncCompletion(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/async_completion";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeAsyncBlocks(pProxy.get(), g_nAsyncBlocks, 1u));
+
+    for(unsigned nRound = 1u; nRound <= 2u; nRound++)
+    {
+        // 1. a read, a lookup and a read of a missing ID in turn, the callbacks are slow now and then
+        OpenSP::sp<CountingReader> pReader = new CountingReader(nRound);
+        OpenSP::sp<CountingExist> pExist = new CountingExist;
+        pReader->m_nDelay = 2u;
+        for(unsigned n = 0u; n < g_nAsyncBlocks; n++)
+        {
+            TEST_CHECK(pProxy->readBlockAsync(makeTestID(n), pReader.get()));
+            TEST_CHECK(pProxy->existAsync(makeTestID((n % 2u == 0u) ? n : g_nAsyncMissing + n), pExist.get()));
+            TEST_CHECK(pProxy->readBlockAsync(makeTestID(g_nAsyncMissing + n), pReader.get()));
+        }
+
+        // 2. all of them have been answered by the time the wait returns
+        pProxy->waitForAsync();
+        TEST_CHECK(pReader->getAnswered() == 2u * g_nAsyncBlocks);
+        TEST_CHECK(pReader->isAnswered(0u, g_nAsyncBlocks, 1u));
+        TEST_CHECK(pReader->isAnswered(g_nAsyncMissing, g_nAsyncBlocks, 1u));
+        TEST_CHECK(pReader->m_nWrong == 0u);
+        TEST_CHECK(pExist->m_nAnswered == g_nAsyncBlocks && pExist->m_nWrong == 0u);
+
+        // 3. the next round is written before the reads are queued again
+        TEST_CHECK(writeAsyncBlocks(pProxy.get(), g_nAsyncBlocks, nRound + 1u));
+    }
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// closeDB with requests still queued and callbacks still running carries all of them out and
+// tells every callback before it returns, the requests after it are refused until the next openDB.
+bool testAsyncClosePending(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/async_close";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeAsyncBlocks(pProxy.get(), g_nAsyncBlocks, 1u));
+
+    // 1. closed at once behind the pushes
+    OpenSP::sp<CountingReader> pReader = new CountingReader(1u);
+    pReader->m_nDelay = 5u;
+    for(unsigned n = 0u; n < g_nAsyncBlocks; n++)
+    {
+        TEST_CHECK(pProxy->readBlockAsync(makeTestID(n), pReader.get()));
+    }
+    TEST_CHECK(pProxy->closeDB());
+    TEST_CHECK(pReader->getAnswered() == g_nAsyncBlocks);
+    TEST_CHECK(pReader->isAnswered(0u, g_nAsyncBlocks, 1u) && pReader->m_nWrong == 0u);
+
+    // 2. refused while closed
+    TEST_CHECK(!pProxy->readBlockAsync(makeTestID(0u), pReader.get()));
+    pProxy->waitForAsync();
+    TEST_CHECK(pReader->getAnswered() == g_nAsyncBlocks);
+
+    // 3. taken again once it is open
+    TEST_CHECK(pProxy->openDB(strDB));
+    TEST_CHECK(pProxy->readBlockAsync(makeTestID(1u), pReader.get()));
+    pProxy->waitForAsync();
+    TEST_CHECK(pReader->isAnswered(1u, 1u, 2u) && pReader->m_nWrong == 0u);
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// A callback may call the proxy again: queue another request into a full queue, wait for the
+// queue and close the database. None of them may wait for the thread it runs on.
+bool testAsyncReentrant(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/async_reentrant";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeAsyncBlocks(pProxy.get(), 2u * g_nAsyncBlocks, 1u));
+
+    // 1. every read of the first half queues one of the second half, a deadlock leaves them unanswered
+    OpenSP::sp<ChainReader> pReader = new ChainReader(pProxy.get());
+    for(unsigned n = 0u; n < g_nAsyncBlocks; n++)
+    {
+        TEST_CHECK(pProxy->readBlockAsync(makeTestID(n), pReader.get()));
+    }
+    for(unsigned nWaited = 0u; nWaited < g_nAsyncTimeout && pReader->getAnswered() < 2u * g_nAsyncBlocks; nWaited += 10u)
+    {
+        sleepMilliseconds(10u);
+    }
+    TEST_CHECK(pReader->getAnswered() == 2u * g_nAsyncBlocks);
+    pProxy->waitForAsync();
+    TEST_CHECK(pReader->isAnswered(0u, 2u * g_nAsyncBlocks, 1u));
+    TEST_CHECK(pReader->m_nWrong == 0u && pReader->m_nPushFailed == 0u);
+
+    // 2. closed in a callback
+    OpenSP::sp<ClosingExist> pClosing = new ClosingExist(pProxy.get());
+    TEST_CHECK(pProxy->existAsync(makeTestID(0u), pClosing.get()));
+    for(unsigned nWaited = 0u; nWaited < g_nAsyncTimeout && !pClosing->m_bRefused; nWaited += 10u)
+    {
+        sleepMilliseconds(10u);
+    }
+    TEST_CHECK(pClosing->m_bClosed && pClosing->m_bRefused);
+
+    // 3. opened again, the threads left by the close are gone and new ones answer
+    TEST_CHECK(pProxy->openDB(strDB));
+    OpenSP::sp<CountingReader> pAfter = new CountingReader(1u);
+    TEST_CHECK(pProxy->readBlockAsync(makeTestID(2u), pAfter.get()));
+    pProxy->waitForAsync();
+    TEST_CHECK(pAfter->isAnswered(2u, 1u, 1u) && pAfter->m_nWrong == 0u);
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,117 @@
+#include "DEUDBProxyTest.h"
+
+namespace
+{
+    const unsigned g_nBatchBenchBlocks  = 4096u;
+
+    void freeBuffers(std::vector<void *> &vecBuffers)
+    {
+        for(size_t n = 0u; n < vecBuffers.size(); n++)
+        {
+            deudbProxy::freeMemory(vecBuffers[n]);
+        }
+        vecBuffers.clear();
+    }
+
+
+    // nIDs IDs of the database in calls of nPerCall, one call of each kind after another:
+    // 0 readBlocks, 1 existBlocks, 2 writeBlocks. The seconds taken, -1 if a call has failed
+    double runBatches(deudbProxy::IDEUDBProxy *pProxy, unsigned nKind, unsigned nPerCall, unsigned nIDs)
+    {
+        std::vector<ID> vecIDs;
+        std::vector<void *> vecBuffers;
+        std::vector<unsigned> vecLengths;
+        std::vector<bool> vecFound;
+        std::vector<std::vector<char> > vecBlocks(nPerCall);
+        std::vector<const void *> vecWrite(nPerCall);
+
+        const double dblStart = getSeconds();
+        for(unsigned nFirst = 0u; nFirst + nPerCall <= nIDs; nFirst += nPerCall)
+        {
+            vecIDs.clear();
+            for(unsigned i = 0u; i < nPerCall; i++)
+            {
+                vecIDs.push_back(makeTestID((nFirst + i) % g_nBatchBenchBlocks));
+            }
+
+            bool bDone = false;
+            if(nKind == 0u)
+            {
+                bDone = (pProxy->readBlocks(vecIDs, vecBuffers, vecLengths, vecFound) == nPerCall);
+                freeBuffers(vecBuffers);
+            }
+            else if(nKind == 1u)
+            {
+                bDone = (pProxy->existBlocks(vecIDs, vecFound) == nPerCall);
+            }
+            else
+            {
+                vecLengths.resize(nPerCall);
+                for(unsigned i = 0u; i < nPerCall; i++)
+                {
+                    makeTestBlock((nFirst + i) % g_nBatchBenchBlocks, 0u, 0u, vecBlocks[i]);
+                    vecWrite[i] = &vecBlocks[i][0];
+                    vecLengths[i] = (unsigned)vecBlocks[i].size();
+                }
+                bDone = pProxy->writeBlocks(vecIDs, vecWrite, vecLengths);
+            }
+            if(!bDone)
+            {
+                return -1.0;
+            }
+        }
+        return getSeconds() - dblStart;
+    }
+}
+
+
+int runBatchBenchmark(const std::string &strDir, unsigned nIDs)
+{
+    printf("%u IDs read, looked up and written through the ring in batches\n", nIDs);
+
+    const std::string strDB = strDir + "/batch_bench";
+    removeDatabase(strDB);
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    bool bWritten = openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy);
+    for(unsigned n = 0u; n < g_nBatchBenchBlocks && bWritten; n++)
+    {
+        bWritten = writeTestBlock(pProxy.get(), n, 0u);
+    }
+    if(!bWritten)
+    {
+        printf("    FAILED to write the blocks\n");
+        if(pProxy.valid())
+        {
+            pProxy->closeDB();
+        }
+        removeDatabase(strDB);
+        return 1;
+    }
+
+    // a call of one ID pays the round trip for every ID, the batches share it
+    int nFailed = 0;
+    const char *szKinds[3] = { "read", "exist", "write" };
+    const unsigned nPerCalls[3] = { 1u, 16u, 256u };
+    for(unsigned nKind = 0u; nKind < 3u; nKind++)
+    {
+        for(unsigned i = 0u; i < 3u; i++)
+        {
+            const double dblSeconds = runBatches(pProxy.get(), nKind, nPerCalls[i], nIDs);
+            if(dblSeconds < 0.0)
+            {
+                printf("    %-6s %3u IDs a call FAILED\n", szKinds[nKind], nPerCalls[i]);
+                ++nFailed;
+                continue;
+            }
+
+            const unsigned nDone = (nIDs / nPerCalls[i]) * nPerCalls[i];
+            printf("    %-6s %3u IDs a call %.0f calls/s, %.0f IDs/s\n", szKinds[nKind], nPerCalls[i],
+                   nDone / nPerCalls[i] / dblSeconds, nDone / dblSeconds);
+        }
+    }
+    pProxy->closeDB();
+    pProxy = NULL;
+
+    removeDatabase(strDB);
+    return nFailed;
+}
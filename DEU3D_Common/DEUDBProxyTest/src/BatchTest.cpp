@@ -0,0 +1,422 @@
+#include "DEUDBProxyTest.h"
+#include <string.h>
+#include <algorithm>
+#include <DEUDBProxy/DEUDefine.h>
+#include <DEUDBProxy/DEUSockChannel.h>
+#include <OpenThreads/Thread>
+
+#if !defined (WIN32) && !defined (WIN64)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace
+{
+    const unsigned g_nBatchBlocks   = 96u;
+    const unsigned g_nBatchMissing  = 1000000u;     // the IDs from here on are never written
+    const unsigned g_nLargeBatch    = 4096u;        // the IDs alone are more than the inline payload of a slot
+
+    // every 8th block of a batch is a big one, so the answer does not fit in the slot
+    unsigned getBatchBlockLength(unsigned n)
+    {
+        return (n % 8u == 0u) ? getBigBlockLength(n) : 0u;
+    }
+
+    void freeBuffers(std::vector<void *> &vecBuffers)
+    {
+        for(size_t n = 0u; n < vecBuffers.size(); n++)
+        {
+            deudbProxy::freeMemory(vecBuffers[n]);
+        }
+        vecBuffers.clear();
+    }
+
+
+    // empty and broken batches, then one of g_nLargeBatch IDs written, read and looked up at once
+    bool runBatchLimits(deudbProxy::IDEUDBProxy *pProxy)
+    {
+        std::vector<ID> vecIDs;
+        std::vector<void *> vecBuffers;
+        std::vector<unsigned> vecLengths;
+        std::vector<bool> vecFound;
+        std::vector<const void *> vecWrite;
+
+        // 1. an empty batch needs no round trip and finds nothing
+        TEST_CHECK(pProxy->readBlocks(vecIDs, vecBuffers, vecLengths, vecFound) == 0u);
+        TEST_CHECK(vecBuffers.empty() && vecLengths.empty() && vecFound.empty());
+        TEST_CHECK(pProxy->existBlocks(vecIDs, vecFound) == 0u && vecFound.empty());
+        TEST_CHECK(pProxy->writeBlocks(vecIDs, vecWrite, vecLengths));
+
+        // 2. a buffer or a length missing, nothing of the batch is written
+        std::vector<std::vector<char> > vecBlocks(g_nLargeBatch);
+        for(unsigned n = 0u; n < g_nLargeBatch; n++)
+        {
+            makeTestBlock(n, 2u, 0u, vecBlocks[n]);
+            vecIDs.push_back(makeTestID(n));
+            vecWrite.push_back(&vecBlocks[n][0]);
+            vecLengths.push_back((unsigned)vecBlocks[n].size());
+        }
+        vecLengths.pop_back();
+        TEST_CHECK(!pProxy->writeBlocks(vecIDs, vecWrite, vecLengths));
+        TEST_CHECK(pProxy->existBlocks(vecIDs, vecFound) == 0u);
+        vecLengths.push_back((unsigned)vecBlocks.back().size());
+
+        // 3. the large batch, its answer goes through a region grown for it
+        TEST_CHECK(pProxy->writeBlocks(vecIDs, vecWrite, vecLengths));
+        TEST_CHECK(pProxy->readBlocks(vecIDs, vecBuffers, vecLengths, vecFound) == g_nLargeBatch);
+        bool bValid = (vecBuffers.size() == g_nLargeBatch);
+        for(unsigned n = 0u; n < g_nLargeBatch && bValid; n++)
+        {
+            unsigned nRound = 0u;
+            bValid = vecFound[n] && checkTestBlock(n, vecBuffers[n], vecLengths[n], nRound) && nRound == 2u;
+        }
+        freeBuffers(vecBuffers);
+        TEST_CHECK(bValid);
+        TEST_CHECK(pProxy->existBlocks(vecIDs, vecFound) == g_nLargeBatch);
+
+        // 4. the same ID twice in a batch is answered twice
+        std::vector<ID> vecTwice(2u, makeTestID(7u));
+        vecTwice.push_back(makeTestID(g_nBatchMissing));
+        vecTwice.push_back(makeTestID(7u));
+        TEST_CHECK(pProxy->readBlocks(vecTwice, vecBuffers, vecLengths, vecFound) == 3u);
+        unsigned nRound = 0u;
+        bValid = vecFound[0] && vecFound[1] && !vecFound[2] && vecFound[3] &&
+            checkTestBlock(7u, vecBuffers[0], vecLengths[0], nRound) && checkTestBlock(7u, vecBuffers[3], vecLengths[3], nRound) &&
+            vecBuffers[0] != vecBuffers[3];
+        freeBuffers(vecBuffers);
+        TEST_CHECK(bValid);
+        return true;
+    }
+
+
+#if !defined (WIN32) && !defined (WIN64)
+    // A server on the socket of a database which answers every DEU_READ_BATCH with the next of the
+    // responses it has been given, whatever IDs are asked for, and any other request with DEU_FAIL.
+    class FakeBatchServer : public OpenThreads::Thread
+    {
+    public:
+        struct Response
+        {
+            unsigned            m_nLength;      // the length in the head, it may lie about the payload
+            std::vector<char>   m_payload;
+        };
+
+    public:
+        FakeBatchServer(void) : m_nListen(-1), m_bStop(false), m_nRequests(0u){}
+        ~FakeBatchServer(void)
+        {
+            stop();
+        }
+
+    public:
+        bool listenOn(const std::string &strSocket)
+        {
+            struct sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if(strSocket.length() >= sizeof(addr.sun_path))
+            {
+                return false;
+            }
+            strcpy(addr.sun_path, strSocket.c_str());
+
+            m_strSocket = strSocket;
+            unlink(m_strSocket.c_str());
+            m_nListen = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(m_nListen < 0)
+            {
+                return false;
+            }
+            if(bind(m_nListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(m_nListen, 64) != 0)
+            {
+                close(m_nListen);
+                m_nListen = -1;
+                return false;
+            }
+            startThread();
+            return true;
+        }
+
+        void stop(void)
+        {
+            if(m_nListen < 0)
+            {
+                return;
+            }
+            m_bStop = true;
+            join();
+            close(m_nListen);
+            unlink(m_strSocket.c_str());
+            m_nListen = -1;
+        }
+
+        void addResponse(const std::vector<unsigned> &vecLengths, const std::string &strData, unsigned nLength)
+        {
+            Response response;
+            response.m_payload.resize(vecLengths.size() * sizeof(unsigned) + strData.length());
+            memcpy(&response.m_payload[0], &vecLengths[0], vecLengths.size() * sizeof(unsigned));
+            memcpy(&response.m_payload[0] + vecLengths.size() * sizeof(unsigned), strData.data(), strData.length());
+            response.m_nLength = nLength;
+            m_vecResponses.push_back(response);
+        }
+
+        unsigned getRequestCount(void) const
+        {
+            return m_nRequests;
+        }
+
+    public:
+        virtual void run(void)
+        {
+            std::vector<int> vecClients;
+            while(!m_bStop)
+            {
+                std::vector<struct pollfd> vecPoll(1u + vecClients.size());
+                vecPoll[0].fd = m_nListen;
+                vecPoll[0].events = POLLIN;
+                for(size_t n = 0u; n < vecClients.size(); n++)
+                {
+                    vecPoll[n + 1u].fd = vecClients[n];
+                    vecPoll[n + 1u].events = POLLIN;
+                }
+                if(poll(&vecPoll[0], vecPoll.size(), 50) <= 0)
+                {
+                    continue;
+                }
+
+                for(size_t n = vecClients.size(); n > 0u; n--)
+                {
+                    if(vecPoll[n].revents != 0 && !serve(vecClients[n - 1u]))
+                    {
+                        close(vecClients[n - 1u]);
+                        vecClients.erase(vecClients.begin() + (n - 1u));
+                    }
+                }
+                if((vecPoll[0].revents & POLLIN) != 0)
+                {
+                    const int nClient = accept(m_nListen, NULL, NULL);
+                    if(nClient >= 0)    vecClients.push_back(nClient);
+                }
+            }
+            for(size_t n = 0u; n < vecClients.size(); n++)
+            {
+                close(vecClients[n]);
+            }
+        }
+
+    private:
+        static bool recvAll(int nSocket, void *pBuffer, size_t nSize)
+        {
+            return nSize == 0u || recv(nSocket, pBuffer, nSize, MSG_WAITALL) == (ssize_t)nSize;
+        }
+
+        static bool sendAll(int nSocket, const void *pBuffer, size_t nSize)
+        {
+            return nSize == 0u || send(nSocket, pBuffer, nSize, MSG_NOSIGNAL) == (ssize_t)nSize;
+        }
+
+        // one request and its response, false when the connection is closed
+        bool serve(int nSocket)
+        {
+            deudbProxy::SockHeader head;
+            if(!recvAll(nSocket, &head, sizeof(head)) || head.m_nMagic != DEU_SOCK_MAGIC || (head.m_nFlags & DEU_SOCK_MEMFD) != 0)
+            {
+                return false;
+            }
+            std::vector<char> vecRequest(head.m_nLength);
+            if(!recvAll(nSocket, vecRequest.empty() ? NULL : &vecRequest[0], vecRequest.size()))
+            {
+                return false;
+            }
+
+            if(head.m_nType == DEU_READ_BATCH && m_nRequests < m_vecResponses.size())
+            {
+                // the payload is cut off at the length in the head
+                const Response &response = m_vecResponses[m_nRequests++];
+                head.m_nLength = response.m_nLength;
+                std::vector<char> vecSent(response.m_nLength, 0);
+                memcpy(&vecSent[0], &response.m_payload[0], std::min<size_t>(vecSent.size(), response.m_payload.size()));
+                return sendAll(nSocket, &head, sizeof(head)) && sendAll(nSocket, &vecSent[0], vecSent.size());
+            }
+
+            head.m_nType = DEU_FAIL;
+            head.m_nLength = 0u;
+            return sendAll(nSocket, &head, sizeof(head));
+        }
+
+    private:
+        std::string             m_strSocket;
+        int                     m_nListen;
+        volatile bool           m_bStop;
+        unsigned                m_nRequests;
+        std::vector<Response>   m_vecResponses;
+    };
+#endif
+}
+
+
+// A batch holds small and big blocks and IDs which do not exist, it is answered in one round trip
+// even when the answer needs a bigger payload than the slot has.
+bool testBatchReadWrite(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/batch_rw";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+
+    // 1. write the blocks in one batch
+    std::vector<std::vector<char> > vecBlocks(g_nBatchBlocks);
+    std::vector<ID> vecIDs;
+    std::vector<const void *> vecWrite;
+    std::vector<unsigned> vecWriteLengths;
+    for(unsigned n = 0u; n < g_nBatchBlocks; n++)
+    {
+        makeTestBlock(n, 1u, getBatchBlockLength(n), vecBlocks[n]);
+        vecIDs.push_back(makeTestID(n));
+        vecWrite.push_back(&vecBlocks[n][0]);
+        vecWriteLengths.push_back((unsigned)vecBlocks[n].size());
+    }
+    TEST_CHECK(pProxy->writeBlocks(vecIDs, vecWrite, vecWriteLengths));
+
+    // 2. read them back with a missing ID behind every fourth one
+    std::vector<ID> vecRead;
+    std::vector<unsigned> vecReadNs;
+    for(unsigned n = 0u; n < g_nBatchBlocks; n++)
+    {
+        vecReadNs.push_back(n);
+        if(n % 4u == 0u)    vecReadNs.push_back(g_nBatchMissing + n);
+    }
+    for(size_t n = 0u; n < vecReadNs.size(); n++)
+    {
+        vecRead.push_back(makeTestID(vecReadNs[n]));
+    }
+    std::vector<void *> vecBuffers;
+    std::vector<unsigned> vecLengths;
+    std::vector<bool> vecFound;
+    const unsigned nFound = pProxy->readBlocks(vecRead, vecBuffers, vecLengths, vecFound);
+    bool bValid = (nFound == g_nBatchBlocks && vecBuffers.size() == vecRead.size());
+    for(size_t n = 0u; n < vecRead.size() && bValid; n++)
+    {
+        const unsigned nID = vecReadNs[n];
+        unsigned nRound = 0u;
+        if(nID >= g_nBatchMissing)
+        {
+            bValid = !vecFound[n] && vecBuffers[n] == NULL;
+        }
+        else
+        {
+            bValid = vecFound[n] && checkTestBlock(nID, vecBuffers[n], vecLengths[n], nRound) && nRound == 1u;
+        }
+    }
+    freeBuffers(vecBuffers);
+    TEST_CHECK(bValid);
+
+    std::vector<bool> vecExist;
+    TEST_CHECK(pProxy->existBlocks(vecRead, vecExist) == g_nBatchBlocks);
+    TEST_CHECK(vecExist == vecFound);
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// The lengths in an answer to readBlocks must stay within the payload the server has sent, an
+// answer which runs past it fails the whole batch and hands out no buffer at all.
+bool testBatchBrokenResponse(const std::string &strDir)
+{
+#if defined (WIN32) || defined (WIN64)
+    TEST_SKIP("there is no socket transport to answer through");
+#else
+    const std::string strDB = strDir + "/batch_broken";
+    FakeBatchServer server;
+
+    std::vector<unsigned> vecLengths(3u);
+    // a good answer, the lengths add up to the payload exactly
+    vecLengths[0] = 8u;    vecLengths[1] = DEU_BLOCK_MISSING;    vecLengths[2] = 5u;
+    server.addResponse(vecLengths, "01234567abcde", 12u + 13u);
+    // the last block runs past the payload
+    vecLengths[0] = 8u;    vecLengths[1] = 8u;    vecLengths[2] = 1000u;
+    server.addResponse(vecLengths, "0123456701234567", 12u + 16u);
+    // a length which would wrap the place of the next block round
+    vecLengths[0] = 0xFFFFFFF0u;    vecLengths[1] = 8u;    vecLengths[2] = 8u;
+    server.addResponse(vecLengths, "0123456701234567", 12u + 16u);
+    // one byte short of the good answer
+    vecLengths[0] = 8u;    vecLengths[1] = DEU_BLOCK_MISSING;    vecLengths[2] = 5u;
+    server.addResponse(vecLengths, "01234567abcde", 12u + 12u);
+    // not even the lengths are there
+    server.addResponse(vecLengths, "", 8u);
+    TEST_CHECK(server.listenOn(strDB + DEU_SOCK_SUFFIX));
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SOCKET, pProxy));
+
+    std::vector<ID> vecIDs;
+    for(unsigned n = 0u; n < 3u; n++)
+    {
+        vecIDs.push_back(makeTestID(n));
+    }
+    std::vector<void *> vecBuffers;
+    std::vector<unsigned> vecRead;
+    std::vector<bool> vecFound;
+
+    // 1. the good answer
+    TEST_CHECK(pProxy->readBlocks(vecIDs, vecBuffers, vecRead, vecFound) == 2u);
+    const bool bGood = vecFound[0] && !vecFound[1] && vecFound[2] &&
+        vecRead[0] == 8u && memcmp(vecBuffers[0], "01234567", 8u) == 0 && vecBuffers[1] == NULL &&
+        vecRead[2] == 5u && memcmp(vecBuffers[2], "abcde", 5u) == 0;
+    freeBuffers(vecBuffers);
+    TEST_CHECK(bGood);
+
+    // 2. the broken ones
+    for(unsigned nBroken = 0u; nBroken < 4u; nBroken++)
+    {
+        TEST_CHECK(pProxy->readBlocks(vecIDs, vecBuffers, vecRead, vecFound) == 0u);
+        TEST_CHECK(vecBuffers.size() == 3u && vecRead.size() == 3u && vecFound.size() == 3u);
+        for(unsigned n = 0u; n < 3u; n++)
+        {
+            TEST_CHECK(vecBuffers[n] == NULL && vecRead[n] == 0u && !vecFound[n]);
+        }
+    }
+    TEST_CHECK(server.getRequestCount() == 5u);
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    server.stop();
+    return true;
+#endif
+}
+
+
+// The limits of a batch through either transport: an empty one, one whose buffers and lengths do
+// not match, one far bigger than a slot and one which asks for an ID twice.
+bool testBatchLimits(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/batch_limits";
+    removeDatabase(strDB);
+
+    // 1. through the ring
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(runBatchLimits(pProxy.get()));
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+
+#if !defined (WIN32) && !defined (WIN64)
+    // 2. through the socket, the large answer is handed over in a memfd
+    const int nServer = startSocketServer(strDB);
+    TEST_CHECK(nServer > 0);
+    bool bPassed = openTestProxy(strDB, deudbProxy::DT_SOCKET, pProxy) && runBatchLimits(pProxy.get());
+    bPassed = pProxy.valid() && pProxy->closeDB() && bPassed;
+    pProxy = NULL;
+    stopSocketServer(nServer);
+    removeDatabase(strDB);
+    TEST_CHECK(bPassed);
+#endif
+    return true;
+}
@@ -0,0 +1,165 @@
+#include "DEUDBProxyTest.h"
+#include <DEUDBProxy/DEUDefine.h>
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nClients       = 64u;      // eight times the workers the server has at most
+    const unsigned g_nSteadyClients = 8u;       // the others open and close their proxy every round
+    const unsigned g_nClientIDs     = 30u;      // the IDs of every client
+    const unsigned g_nClientRounds  = 6u;
+
+    // every 10th block of a client is a big one
+    unsigned getClientBlockLength(unsigned n)
+    {
+        return (n % 10u == 0u) ? getBigBlockLength(n) : 0u;
+    }
+
+
+    // client i writes the IDs i, i + g_nClients, ... round by round and reads them back one by one,
+    // then reads a batch of the blocks of the other clients, which may be of any round so far
+    class Client : public OpenThreads::Thread
+    {
+    public:
+        Client(const std::string &strDB, deudbProxy::DEUDBTransport eTransport, unsigned nClient)
+            : m_strDB(strDB), m_eTransport(eTransport), m_nClient(nClient), m_bFailed(false){}
+        ~Client(void){}
+
+    public:
+        virtual void run(void)
+        {
+            const bool bSteady = (m_nClient < g_nSteadyClients);
+            OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+            for(unsigned nRound = 1u; nRound <= g_nClientRounds && !m_bFailed; nRound++)
+            {
+                if(!pProxy.valid() && !openTestProxy(m_strDB, m_eTransport, pProxy))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_bFailed = !runRound(pProxy.get(), nRound);
+                if(!bSteady || nRound == g_nClientRounds)
+                {
+                    m_bFailed = !pProxy->closeDB() || m_bFailed;
+                    pProxy = NULL;
+                }
+            }
+        }
+
+    private:
+        bool runRound(deudbProxy::IDEUDBProxy *pProxy, unsigned nRound)
+        {
+            unsigned nReadRound = 0u;
+            for(unsigned i = 0u; i < g_nClientIDs; i++)
+            {
+                const unsigned n = m_nClient + i * g_nClients;
+                if(!writeTestBlock(pProxy, n, nRound, getClientBlockLength(n)) ||
+                    !readTestBlock(pProxy, n, nReadRound) || nReadRound != nRound)
+                {
+                    return false;
+                }
+            }
+
+            std::vector<ID> vecIDs;
+            std::vector<unsigned> vecNs;
+            for(unsigned i = 0u; i < g_nClientIDs; i++)
+            {
+                vecNs.push_back((m_nClient * 7u + nRound + i * 13u) % (g_nClients * g_nClientIDs));
+                vecIDs.push_back(makeTestID(vecNs.back()));
+            }
+            std::vector<void *> vecBuffers;
+            std::vector<unsigned> vecLengths;
+            std::vector<bool> vecFound;
+            const unsigned nFound = pProxy->readBlocks(vecIDs, vecBuffers, vecLengths, vecFound);
+            bool bValid = (nFound == vecIDs.size());
+            for(size_t n = 0u; n < vecBuffers.size(); n++)
+            {
+                bValid = bValid && checkTestBlock(vecNs[n], vecBuffers[n], vecLengths[n], nReadRound) && nReadRound <= g_nClientRounds;
+                deudbProxy::freeMemory(vecBuffers[n]);
+            }
+            return bValid;
+        }
+
+    public:
+        std::string                 m_strDB;
+        deudbProxy::DEUDBTransport  m_eTransport;
+        unsigned                    m_nClient;
+        volatile bool               m_bFailed;
+    };
+
+
+    // the first proxy writes round 0 of every block, then all the clients run at once and
+    // afterwards the database holds the last round of every block
+    bool runManyClients(const std::string &strDB, deudbProxy::DEUDBTransport eTransport)
+    {
+        const unsigned nBlocks = g_nClients * g_nClientIDs;
+
+        // 1. round 0
+        OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+        TEST_CHECK(openTestProxy(strDB, eTransport, pProxy));
+        for(unsigned n = 0u; n < nBlocks; n++)
+        {
+            TEST_CHECK(writeTestBlock(pProxy.get(), n, 0u, getClientBlockLength(n)));
+        }
+
+        // 2. all the clients at once
+        std::vector<Client *> vecClients;
+        for(unsigned i = 0u; i < g_nClients; i++)
+        {
+            vecClients.push_back(new Client(strDB, eTransport, i));
+            vecClients.back()->startThread();
+        }
+        bool bFailed = false;
+        for(unsigned i = 0u; i < g_nClients; i++)
+        {
+            vecClients[i]->join();
+            bFailed = bFailed || vecClients[i]->m_bFailed;
+            delete vecClients[i];
+        }
+        TEST_CHECK(!bFailed);
+
+        // 3. the last round of every block
+        for(unsigned n = 0u; n < nBlocks; n++)
+        {
+            unsigned nRound = 0u;
+            TEST_CHECK(readTestBlock(pProxy.get(), n, nRound));
+            TEST_CHECK(nRound == g_nClientRounds);
+        }
+        TEST_CHECK(pProxy->getBlockCount() == nBlocks);
+        TEST_CHECK(pProxy->closeDB());
+        return true;
+    }
+}
+
+
+// Many more clients than the server has workers, eight of them stay connected and the others
+// come and go every round, each of them registers its ring with the server. No client may wait
+// for ever or get a block of another request.
+bool testManyClients(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/many_clients";
+    removeDatabase(strDB);
+    const bool bPassed = runManyClients(strDB, deudbProxy::DT_SHARED_MEMORY);
+    removeDatabase(strDB);
+    return bPassed;
+}
+
+
+// The same clients on the socket of a server started by hand. Every slot a client uses has a
+// connection of its own and the workers serve each of them like a ring of one slot, so there
+// are many more connections than workers, and many of them are dropped every round.
+bool testManyClientsSocket(const std::string &strDir)
+{
+#if defined (WIN32) || defined (WIN64)
+    TEST_SKIP("there is no socket transport on windows");
+#else
+    const std::string strDB = strDir + "/many_clients_socket";
+    removeDatabase(strDB);
+    const int nServer = startSocketServer(strDB);
+    TEST_CHECK(nServer > 0);
+    const bool bPassed = runManyClients(strDB, deudbProxy::DT_SOCKET);
+    stopSocketServer(nServer);
+    removeDatabase(strDB);
+    return bPassed;
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef DEUDB_PROXY_TEST_H_F49633A1_314F_40F4_881D_90C11F09050F_INCLUDE
+#define DEUDB_PROXY_TEST_H_F49633A1_314F_40F4_881D_90C11F09050F_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <DEUDBProxy/IDEUDBProxy.h>
+#include <Common/TestRunner.h>
+
+// The test blocks tell by their content which ID and which round of writing they belong to, so a
+// block which is read back can be checked without remembering what was written. A length of 0
+// picks a small one, getBigBlockLength one beyond the inline payload of a slot.
+ID          makeTestID(unsigned n);
+void        makeTestBlock(unsigned n, unsigned nRound, unsigned nLength, std::vector<char> &vecBlock);
+bool        checkTestBlock(unsigned n, const void *pData, unsigned nLength, unsigned &nRound);
+unsigned    getBigBlockLength(unsigned n);
+
+// false if the block is missing, nRound is ~0u then, or if it is not the one of n
+bool        readTestBlock(deudbProxy::IDEUDBProxy *pProxy, unsigned n, unsigned &nRound);
+// replaces the block of n, it is added when it does not exist yet
+bool        writeTestBlock(deudbProxy::IDEUDBProxy *pProxy, unsigned n, unsigned nRound, unsigned nLength = 0u);
+
+// a proxy opened on strDB through eTransport, the first proxy of a database starts its server
+bool        openTestProxy(const std::string &strDB, deudbProxy::DEUDBTransport eTransport, OpenSP::sp<deudbProxy::IDEUDBProxy> &pProxy);
+
+// A server listening on the socket beside strDB, started from DEUDBServer beside this program,
+// -1 when it could not be started and always on Windows, where there is no socket transport.
+// stopSocketServer waits until it has closed the database.
+int         startSocketServer(const std::string &strDB);
+void        stopSocketServer(int nServer);
+
+// the files of a database: .idx, .wal, .sidx, .zdict, .bloom and the _N.db files
+void        removeDatabase(const std::string &strDB);
+
+using cmm::sleepMilliseconds;
+using cmm::getSeconds;
+
+// the tests, each of them creates its databases under strDir and removes them again
+bool        testRingManyThreads(const std::string &strDir);
+bool        testBatchReadWrite(const std::string &strDir);
+bool        testBatchBrokenResponse(const std::string &strDir);
+bool        testBatchLimits(const std::string &strDir);
+bool        testManyClients(const std::string &strDir);
+bool        testManyClientsSocket(const std::string &strDir);
+bool        testLeasesOnClose(const std::string &strDir);
+bool        testLeasesOfLostClient(const std::string &strDir);
+bool        testLeasesOfReplacedBlock(const std::string &strDir);
+bool        testAsyncCompletion(const std::string &strDir);
+bool        testAsyncClosePending(const std::string &strDir);
+bool        testAsyncReentrant(const std::string &strDir);
+
+// the client process which testLeasesOfLostClient starts, it holds blocks of the arena until it is killed
+int         runLeaseHolder(const std::string &strDB);
+// reads through the ring of one client from one thread and from nThreads, the exit code is the failed runs
+int         runRingBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads);
+// the same reads through the ring and through the socket, which carries the big blocks in memfds
+int         runSocketBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads);
+// nIDs IDs read, looked up and written in batches of 1, 16 and 256, the exit code is the failed runs
+int         runBatchBenchmark(const std::string &strDir, unsigned nIDs);
+// nProcesses processes read nReads zipfian tiles each, copied and then shared, the exit code is the failed runs
+int         runArenaBenchmark(const std::string &strDir, unsigned nProcesses, unsigned nReads);
+// the reader process which runArenaBenchmark starts, 0 if it has read every tile right
+int         runArenaReader(const std::string &strDB, bool bShared, unsigned nReads, unsigned nSeed);
+
+#endif
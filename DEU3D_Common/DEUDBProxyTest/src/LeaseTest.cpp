@@ -0,0 +1,298 @@
+#include "DEUDBProxyTest.h"
+#include <string.h>
+#include <DEUDBProxy/DEUDefine.h>
+
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+namespace
+{
+    // the big blocks fill the arena, the ones beyond it go through the payload
+    const unsigned g_nLeaseBlocks       = 20u;
+    const unsigned g_nLeaseBlockLength  = DEU_ARENA_MAX_BLOCK - 4096u;
+    const unsigned g_nProbeLength       = DEU_ARENA_MAX_BLOCK / 4u;
+    const unsigned g_nFirstProbe        = 100u;
+    const unsigned g_nSecondProbe       = 101u;
+
+    // the time the holder process is given to hold its blocks
+    const unsigned g_nHolderWait        = 30000u;
+
+    bool writeLeaseBlocks(deudbProxy::IDEUDBProxy *pProxy)
+    {
+        for(unsigned n = 0u; n < g_nLeaseBlocks; n++)
+        {
+            TEST_CHECK(writeTestBlock(pProxy, n, 0u, g_nLeaseBlockLength));
+        }
+        TEST_CHECK(writeTestBlock(pProxy, g_nFirstProbe, 0u, g_nProbeLength));
+        TEST_CHECK(writeTestBlock(pProxy, g_nSecondProbe, 0u, g_nProbeLength));
+        return true;
+    }
+
+
+    bool checkSharedBlock(unsigned n, const deudbProxy::ISharedBlock *pBlock, unsigned nExpected = 0u)
+    {
+        unsigned nRound = 0u;
+        return pBlock != NULL && checkTestBlock(n, pBlock->getData(), pBlock->getLength(), nRound) && nRound == nExpected;
+    }
+
+
+    // reads all the big blocks and holds them, as many as fit are leased in the arena
+    bool holdLeaseBlocks(deudbProxy::IDEUDBProxy *pProxy, std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > &vecBlocks)
+    {
+        vecBlocks.resize(g_nLeaseBlocks);
+        for(unsigned n = 0u; n < g_nLeaseBlocks; n++)
+        {
+            TEST_CHECK(pProxy->readSharedBlock(makeTestID(n), vecBlocks[n]));
+            TEST_CHECK(checkSharedBlock(n, vecBlocks[n].get()));
+        }
+        return true;
+    }
+
+
+    bool checkLeaseBlocks(const std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > &vecBlocks)
+    {
+        for(unsigned n = 0u; n < vecBlocks.size(); n++)
+        {
+            TEST_CHECK(checkSharedBlock(n, vecBlocks[n].get()));
+        }
+        return true;
+    }
+
+
+    // A block shared in the arena is read in place, so two reads held at once give the same data,
+    // a block copied out of the payload gives a buffer of its own each time.
+    bool isBlockShared(deudbProxy::IDEUDBProxy *pProxy, unsigned n, bool &bShared)
+    {
+        OpenSP::sp<deudbProxy::ISharedBlock> pFirst, pSecond;
+        TEST_CHECK(pProxy->readSharedBlock(makeTestID(n), pFirst));
+        TEST_CHECK(pProxy->readSharedBlock(makeTestID(n), pSecond));
+        TEST_CHECK(checkSharedBlock(n, pFirst.get()));
+        TEST_CHECK(checkSharedBlock(n, pSecond.get()));
+        bShared = (pFirst->getData() == pSecond->getData());
+        return true;
+    }
+
+
+    bool waitForFile(const std::string &strFile, unsigned nMilliseconds)
+    {
+        for(unsigned nWaited = 0u; nWaited < nMilliseconds; nWaited += 10u)
+        {
+            FILE *pFile = fopen(strFile.c_str(), "rb");
+            if(pFile != NULL)
+            {
+                fclose(pFile);
+                return true;
+            }
+            sleepMilliseconds(10u);
+        }
+        return false;
+    }
+
+
+    // runLeaseHolder in a process of its own, killed once it holds its blocks
+    bool runKilledHolder(const std::string &strDB)
+    {
+        const std::string strHeld = strDB + ".held";
+        remove(strHeld.c_str());
+
+#if defined (WIN32) || defined (WIN64)
+        char szExe[MAX_PATH] = {0};
+        GetModuleFileNameA(NULL, szExe, MAX_PATH);
+        std::string strCommand = std::string("\"") + szExe + "\" -lease-holder \"" + strDB + "\"";
+
+        STARTUPINFOA si;
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+        PROCESS_INFORMATION pi;
+        if(!CreateProcessA(NULL, &strCommand[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+        {
+            return false;
+        }
+
+        const bool bHeld = waitForFile(strHeld, g_nHolderWait);
+        TerminateProcess(pi.hProcess, 9u);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+#else
+        // the proxy of this process runs threads, so the holder starts afresh from the program
+        char szExe[1024];
+        const ssize_t nCount = readlink("/proc/self/exe", szExe, sizeof(szExe) - 1u);
+        if(nCount <= 0)
+        {
+            return false;
+        }
+        szExe[nCount] = '\0';
+
+        const pid_t pid = fork();
+        if(pid < 0)     return false;
+        if(pid == 0)
+        {
+            execl(szExe, szExe, "-lease-holder", strDB.c_str(), (char *)NULL);
+            _exit(1);
+        }
+
+        const bool bHeld = waitForFile(strHeld, g_nHolderWait);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+#endif
+        remove(strHeld.c_str());
+        return bHeld;
+    }
+}
+
+
+int runLeaseHolder(const std::string &strDB)
+{
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > vecBlocks;
+    if(!openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy) || !holdLeaseBlocks(pProxy.get(), vecBlocks))
+    {
+        return 1;
+    }
+
+    // tell the test and wait to be killed, a test which has gone does not leave it behind
+    FILE *pFile = fopen((strDB + ".held").c_str(), "wb");
+    if(pFile == NULL)
+    {
+        return 1;
+    }
+    fclose(pFile);
+    sleepMilliseconds(2u * g_nHolderWait);
+    return 0;
+}
+
+
+// A client which closes the database while it still holds blocks of the arena keeps them, copied
+// out of the arena, and the room they took is free for the other clients at once.
+bool testLeasesOnClose(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/leases_close";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeLeaseBlocks(pProxy.get()));
+
+    // 1. the holder fills the arena, so no other block can be shared
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pHolder;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pHolder));
+    std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > vecHeld;
+    TEST_CHECK(holdLeaseBlocks(pHolder.get(), vecHeld));
+    bool bShared = true;
+    TEST_CHECK(isBlockShared(pProxy.get(), g_nFirstProbe, bShared));
+    TEST_CHECK(!bShared);
+
+    // 2. it closes the database, its leases are gone and its blocks are still whole
+    TEST_CHECK(pHolder->closeDB());
+    pHolder = NULL;
+    TEST_CHECK(checkLeaseBlocks(vecHeld));
+    TEST_CHECK(isBlockShared(pProxy.get(), g_nSecondProbe, bShared));
+    TEST_CHECK(bShared);
+
+    // 3. the arena is filled anew, the blocks held have been copied out
+    std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > vecOwn;
+    TEST_CHECK(holdLeaseBlocks(pProxy.get(), vecOwn));
+    TEST_CHECK(checkLeaseBlocks(vecHeld));
+    vecHeld.clear();
+    vecOwn.clear();
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// The leases of a client killed while it holds blocks of the arena are given back by the server
+// when the next client registers, until then the arena stays full.
+bool testLeasesOfLostClient(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/leases_lost";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeLeaseBlocks(pProxy.get()));
+
+    // 1. the holder fills the arena and is killed
+    TEST_CHECK(runKilledHolder(strDB));
+    bool bShared = true;
+    TEST_CHECK(isBlockShared(pProxy.get(), g_nFirstProbe, bShared));
+    TEST_CHECK(!bShared);
+
+    // 2. the next client to register drops the ring of the holder and its leases
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pNext;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pNext));
+    TEST_CHECK(pNext->closeDB());
+    pNext = NULL;
+    TEST_CHECK(isBlockShared(pProxy.get(), g_nSecondProbe, bShared));
+    TEST_CHECK(bShared);
+
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// A block leased before it is replaced keeps its bytes in the arena, however many blocks go
+// through the arena after it, while the readers after the replacement get the new block. Once
+// both are let go their room is taken by the blocks which come after them.
+bool testLeasesOfReplacedBlock(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/leases_replaced";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    TEST_CHECK(writeLeaseBlocks(pProxy.get()));
+
+    // 1. the old block is leased, then replaced
+    OpenSP::sp<deudbProxy::ISharedBlock> pOld, pNew;
+    TEST_CHECK(pProxy->readSharedBlock(makeTestID(g_nFirstProbe), pOld));
+    TEST_CHECK(checkSharedBlock(g_nFirstProbe, pOld.get()));
+    TEST_CHECK(writeTestBlock(pProxy.get(), g_nFirstProbe, 1u, g_nProbeLength));
+    TEST_CHECK(pProxy->readSharedBlock(makeTestID(g_nFirstProbe), pNew));
+    TEST_CHECK(checkSharedBlock(g_nFirstProbe, pNew.get(), 1u));
+    TEST_CHECK(pOld->getData() != pNew->getData());
+
+    // 2. another client runs the big blocks through the arena more than once round, a block
+    //    nobody holds is dropped for them and a leased one is stepped over
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pOther;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pOther));
+    for(unsigned nPass = 0u; nPass < 3u; nPass++)
+    {
+        for(unsigned n = 0u; n < g_nLeaseBlocks; n++)
+        {
+            OpenSP::sp<deudbProxy::ISharedBlock> pBlock;
+            TEST_CHECK(pOther->readSharedBlock(makeTestID(n), pBlock));
+            TEST_CHECK(checkSharedBlock(n, pBlock.get()));
+        }
+    }
+    TEST_CHECK(checkSharedBlock(g_nFirstProbe, pOld.get()));
+    TEST_CHECK(checkSharedBlock(g_nFirstProbe, pNew.get(), 1u));
+
+    // 3. let go, the arena goes round again and the new block is read as before
+    pOld = NULL;
+    pNew = NULL;
+    std::vector<OpenSP::sp<deudbProxy::ISharedBlock> > vecHeld;
+    TEST_CHECK(holdLeaseBlocks(pOther.get(), vecHeld));
+    vecHeld.clear();
+    TEST_CHECK(pProxy->readSharedBlock(makeTestID(g_nFirstProbe), pNew));
+    TEST_CHECK(checkSharedBlock(g_nFirstProbe, pNew.get(), 1u));
+    pNew = NULL;
+
+    TEST_CHECK(pOther->closeDB());
+    pOther = NULL;
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+    removeDatabase(strDB);
+    return true;
+}
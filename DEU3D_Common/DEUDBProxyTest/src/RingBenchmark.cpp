@@ -0,0 +1,184 @@
+#include "DEUDBProxyTest.h"
+#include <DEUDBProxy/DEUDefine.h>
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nRingBenchBlocks   = 256u;     // of either size, the big ones lie in the regions of the slots
+
+    // reads m_nReads blocks from m_nFirst on in an order of its own and checks every one of them
+    class RingReader : public OpenThreads::Thread
+    {
+    public:
+        RingReader(deudbProxy::IDEUDBProxy *pProxy, unsigned nThread, unsigned nFirst, unsigned nReads)
+            : m_pProxy(pProxy), m_nThread(nThread), m_nFirst(nFirst), m_nReads(nReads), m_nBytes(0u), m_bFailed(false){}
+        ~RingReader(void){}
+
+    public:
+        virtual void run(void)
+        {
+            unsigned nSeed = m_nThread * 2654435761u + 1u;
+            for(unsigned i = 0u; i < m_nReads; i++)
+            {
+                nSeed = nSeed * 1103515245u + 12345u;
+                const unsigned n = m_nFirst + (nSeed >> 8u) % g_nRingBenchBlocks;
+                void *pBuffer = NULL;
+                unsigned nLength = 0u, nRound = 0u;
+                if(!m_pProxy->readBlock(makeTestID(n), pBuffer, nLength))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                const bool bValid = checkTestBlock(n, pBuffer, nLength, nRound);
+                deudbProxy::freeMemory(pBuffer);
+                if(!bValid)
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_nBytes += nLength;
+            }
+        }
+
+    public:
+        deudbProxy::IDEUDBProxy    *m_pProxy;
+        unsigned                    m_nThread;
+        unsigned                    m_nFirst;
+        unsigned                    m_nReads;
+        UINT_64                     m_nBytes;
+        bool                        m_bFailed;
+    };
+
+
+    // the seconds nThreads threads take for nReads reads in all, -1 if a read has failed
+    double runRingReads(deudbProxy::IDEUDBProxy *pProxy, unsigned nFirst, unsigned nThreads, unsigned nReads, UINT_64 &nBytes)
+    {
+        const double dblStart = getSeconds();
+        std::vector<RingReader *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads.push_back(new RingReader(pProxy, i, nFirst, nReads / nThreads));
+            vecThreads.back()->startThread();
+        }
+
+        bool bFailed = false;
+        nBytes = 0u;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            bFailed = bFailed || vecThreads[i]->m_bFailed;
+            nBytes += vecThreads[i]->m_nBytes;
+            delete vecThreads[i];
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+        return bFailed ? -1.0 : dblSeconds;
+    }
+
+
+    // writes the blocks through pProxy and reads them from one thread and from nThreads, the
+    // count of the runs which have failed
+    int runTransportReads(deudbProxy::IDEUDBProxy *pProxy, const char *szTransport, unsigned nThreads, unsigned nReads)
+    {
+        // the small blocks fit the inline payload of a slot, the big ones follow them
+        bool bWritten = true;
+        for(unsigned n = 0u; n < g_nRingBenchBlocks && bWritten; n++)
+        {
+            bWritten = writeTestBlock(pProxy, n, 0u) &&
+                       writeTestBlock(pProxy, g_nRingBenchBlocks + n, 0u, getBigBlockLength(n));
+        }
+        if(!bWritten)
+        {
+            printf("    %-6s FAILED to write the blocks\n", szTransport);
+            return 1;
+        }
+
+        // one thread and many, the threads take slots or connections of their own
+        int nFailed = 0;
+        const unsigned nThreadCounts[2] = { 1u, nThreads };
+        const char *szKinds[2] = { "small", "big" };
+        for(unsigned nKind = 0u; nKind < 2u; nKind++)
+        {
+            // the big blocks take longer, as many bytes as the small ones would be too long a run
+            const unsigned nKindReads = (nKind == 0u) ? nReads : nReads / 16u;
+            for(unsigned i = 0u; i < 2u; i++)
+            {
+                UINT_64 nBytes = 0u;
+                const double dblSeconds = runRingReads(pProxy, nKind * g_nRingBenchBlocks, nThreadCounts[i], nKindReads, nBytes);
+                if(dblSeconds < 0.0)
+                {
+                    printf("    %-6s %-6s %2u threads FAILED\n", szTransport, szKinds[nKind], nThreadCounts[i]);
+                    ++nFailed;
+                    continue;
+                }
+
+                const unsigned nDone = (nKindReads / nThreadCounts[i]) * nThreadCounts[i];
+                printf("    %-6s %-6s %2u threads %.0f requests/s, %.1f MB/s\n", szTransport, szKinds[nKind], nThreadCounts[i],
+                       nDone / dblSeconds, nBytes / (1024.0 * 1024.0) / dblSeconds);
+            }
+        }
+        return nFailed;
+    }
+
+
+    // the reads through the ring of a proxy of its own on strDB
+    int runRingReadsOn(const std::string &strDB, unsigned nThreads, unsigned nReads)
+    {
+        removeDatabase(strDB);
+        OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+        if(!openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy))
+        {
+            printf("    FAILED to open the database\n");
+            removeDatabase(strDB);
+            return 1;
+        }
+        const int nFailed = runTransportReads(pProxy.get(), "ring", nThreads, nReads);
+        pProxy->closeDB();
+        pProxy = NULL;
+        removeDatabase(strDB);
+        return nFailed;
+    }
+}
+
+
+int runRingBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads)
+{
+    printf("%u reads of small and big blocks through the ring of one client\n", nReads);
+    return runRingReadsOn(strDir + "/ring_bench", nThreads, nReads);
+}
+
+
+int runSocketBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads)
+{
+#if defined (WIN32) || defined (WIN64)
+    printf("there is no socket transport on windows\n");
+    return 0;
+#else
+    printf("%u reads of small and big blocks through the ring and through the socket\n", nReads);
+
+    // 1. the ring, the same blocks in a database of its own
+    int nFailed = runRingReadsOn(strDir + "/socket_bench_ring", nThreads, nReads);
+
+    // 2. the socket, a payload beyond DEU_SOCK_INLINE_SIZE goes in a memfd
+    const std::string strDB = strDir + "/socket_bench";
+    removeDatabase(strDB);
+    const int nServer = startSocketServer(strDB);
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    if(nServer <= 0 || !openTestProxy(strDB, deudbProxy::DT_SOCKET, pProxy))
+    {
+        printf("    FAILED to start the socket server\n");
+        ++nFailed;
+    }
+    else
+    {
+        nFailed += runTransportReads(pProxy.get(), "socket", nThreads, nReads);
+        pProxy->closeDB();
+        pProxy = NULL;
+    }
+    if(nServer > 0)
+    {
+        stopSocketServer(nServer);
+    }
+    removeDatabase(strDB);
+    return nFailed;
+#endif
+}
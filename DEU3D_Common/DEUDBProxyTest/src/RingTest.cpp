@@ -0,0 +1,107 @@
+#include "DEUDBProxyTest.h"
+#include <DEUDBProxy/DEUDefine.h>
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nRingThreads   = 48u;      // more than the slots of a ring
+    const unsigned g_nRingIDs       = 1920u;
+    const unsigned g_nRingRounds    = 4u;
+    const unsigned g_nHugeID        = g_nRingIDs;
+
+    // every 16th block goes beyond the inline payload of its slot
+    unsigned getRingBlockLength(unsigned n)
+    {
+        return (n % 16u == 0u) ? getBigBlockLength(n) : 0u;
+    }
+
+
+    // thread i rewrites the IDs i, i + g_nRingThreads, ... round by round, reads each of them back
+    // and reads a block of another thread beside it, which may be of any round written so far
+    class RingClient : public OpenThreads::Thread
+    {
+    public:
+        RingClient(deudbProxy::IDEUDBProxy *pProxy, unsigned nThread) : m_pProxy(pProxy), m_nThread(nThread), m_bFailed(false){}
+        ~RingClient(void){}
+
+    public:
+        virtual void run(void)
+        {
+            for(unsigned nRound = 1u; nRound <= g_nRingRounds; nRound++)
+            {
+                for(unsigned n = m_nThread; n < g_nRingIDs; n += g_nRingThreads)
+                {
+                    unsigned nReadRound = 0u;
+                    const unsigned nOther = (n * 7919u + nRound) % g_nRingIDs;
+                    if(!writeTestBlock(m_pProxy, n, nRound, getRingBlockLength(n)) ||
+                        !readTestBlock(m_pProxy, n, nReadRound) || nReadRound != nRound ||
+                        !readTestBlock(m_pProxy, nOther, nReadRound) || nReadRound > g_nRingRounds)
+                    {
+                        m_bFailed = true;
+                        return;
+                    }
+                }
+
+                // a payload beyond the size a slot keeps, its region is given back with the slot
+                unsigned nReadRound = 0u;
+                if(m_nThread == 0u && (!writeTestBlock(m_pProxy, g_nHugeID, nRound, DEU_RING_KEEP_SIZE + 4096u) ||
+                    !readTestBlock(m_pProxy, g_nHugeID, nReadRound) || nReadRound != nRound))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+            }
+        }
+
+    public:
+        deudbProxy::IDEUDBProxy    *m_pProxy;
+        unsigned                    m_nThread;
+        volatile bool               m_bFailed;
+    };
+}
+
+
+// More threads of one client than its ring has slots write and read at once, with payloads in
+// the slots, in regions grown for them and in regions too big to be kept. Every thread must get
+// back the block it has asked for, and afterwards the database holds the last round of each.
+bool testRingManyThreads(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/ring_threads";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudbProxy::IDEUDBProxy> pProxy;
+    TEST_CHECK(openTestProxy(strDB, deudbProxy::DT_SHARED_MEMORY, pProxy));
+    for(unsigned n = 0u; n < g_nRingIDs; n++)
+    {
+        TEST_CHECK(writeTestBlock(pProxy.get(), n, 0u, getRingBlockLength(n)));
+    }
+
+    std::vector<RingClient *> vecClients;
+    for(unsigned i = 0u; i < g_nRingThreads; i++)
+    {
+        vecClients.push_back(new RingClient(pProxy.get(), i));
+        vecClients.back()->startThread();
+    }
+    bool bFailed = false;
+    for(unsigned i = 0u; i < g_nRingThreads; i++)
+    {
+        vecClients[i]->join();
+        bFailed = bFailed || vecClients[i]->m_bFailed;
+        delete vecClients[i];
+    }
+    TEST_CHECK(!bFailed);
+
+    for(unsigned n = 0u; n <= g_nHugeID; n++)
+    {
+        unsigned nRound = 0u;
+        TEST_CHECK(readTestBlock(pProxy.get(), n, nRound));
+        TEST_CHECK(nRound == g_nRingRounds);
+    }
+    TEST_CHECK(pProxy->getBlockCount() == g_nRingIDs + 1u);
+    TEST_CHECK(pProxy->getAllIndices().size() == g_nRingIDs + 1u);
+    TEST_CHECK(pProxy->closeDB());
+    pProxy = NULL;
+
+    removeDatabase(strDB);
+    return true;
+}
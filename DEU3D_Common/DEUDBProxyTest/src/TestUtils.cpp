@@ -0,0 +1,214 @@
+#include "DEUDBProxyTest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <DEUDBProxy/DEUDefine.h>
+
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+namespace
+{
+    const char *g_pDatabaseExts[] = { ".idx", ".wal", ".sidx", ".zdict", ".bloom" };
+    const unsigned g_nDatabaseExtCount = sizeof(g_pDatabaseExts) / sizeof(g_pDatabaseExts[0]);
+
+    // the data files are numbered from 0 on, a few more than there are are cleared as well
+    const unsigned g_nMaxDBFiles = 64u;
+
+    const unsigned g_nHeaderLength = 3u * sizeof(unsigned);
+
+    // the time a socket server is given until it listens
+    const unsigned g_nServerStartWait = 10000u;
+
+    std::string getDBFilePath(const std::string &strDB, unsigned nDBFile)
+    {
+        std::ostringstream oss;
+        oss << strDB << '_' << nDBFile << ".db";
+        return oss.str();
+    }
+
+    unsigned char getTestByte(unsigned n, unsigned nRound, unsigned nOffset)
+    {
+        return (unsigned char)(n * 131u + nRound * 17u + nOffset);
+    }
+}
+
+
+ID makeTestID(unsigned n)
+{
+    return ID((UINT_64)0x7E57u, (UINT_64)0x0DB1u, (UINT_64)n);
+}
+
+
+void makeTestBlock(unsigned n, unsigned nRound, unsigned nLength, std::vector<char> &vecBlock)
+{
+    if(nLength == 0u)
+    {
+        nLength = g_nHeaderLength + 64u + (n * 37u + nRound * 11u) % 2048u;
+    }
+    vecBlock.resize(nLength);
+
+    const unsigned nHeader[3] = { n, nRound, nLength };
+    memcpy(&vecBlock[0], nHeader, g_nHeaderLength);
+    for(unsigned i = g_nHeaderLength; i < nLength; i++)
+    {
+        vecBlock[i] = (char)getTestByte(n, nRound, i);
+    }
+}
+
+
+bool checkTestBlock(unsigned n, const void *pData, unsigned nLength, unsigned &nRound)
+{
+    nRound = ~0u;
+    if(NULL == pData || nLength < g_nHeaderLength)
+    {
+        return false;
+    }
+
+    unsigned nHeader[3];
+    memcpy(nHeader, pData, g_nHeaderLength);
+    if(nHeader[0] != n || nHeader[2] != nLength)
+    {
+        return false;
+    }
+
+    const unsigned char *pBytes = (const unsigned char *)pData;
+    for(unsigned i = g_nHeaderLength; i < nLength; i++)
+    {
+        if(pBytes[i] != getTestByte(n, nHeader[1], i))
+        {
+            return false;
+        }
+    }
+    nRound = nHeader[1];
+    return true;
+}
+
+
+unsigned getBigBlockLength(unsigned n)
+{
+    return DEU_RING_INLINE_SIZE + 1u + (n * 4099u) % (3u * DEU_RING_INLINE_SIZE);
+}
+
+
+bool readTestBlock(deudbProxy::IDEUDBProxy *pProxy, unsigned n, unsigned &nRound)
+{
+    nRound = ~0u;
+
+    void *pBuffer = NULL;
+    unsigned nLength = 0u;
+    if(!pProxy->readBlock(makeTestID(n), pBuffer, nLength))
+    {
+        return false;
+    }
+    const bool bValid = checkTestBlock(n, pBuffer, nLength, nRound);
+    deudbProxy::freeMemory(pBuffer);
+    return bValid;
+}
+
+
+bool writeTestBlock(deudbProxy::IDEUDBProxy *pProxy, unsigned n, unsigned nRound, unsigned nLength)
+{
+    std::vector<char> vecBlock;
+    makeTestBlock(n, nRound, nLength, vecBlock);
+    return pProxy->replaceBlock(makeTestID(n), &vecBlock[0], (unsigned)vecBlock.size());
+}
+
+
+bool openTestProxy(const std::string &strDB, deudbProxy::DEUDBTransport eTransport, OpenSP::sp<deudbProxy::IDEUDBProxy> &pProxy)
+{
+    pProxy = deudbProxy::createDEUDBProxy();
+    if(!pProxy->setTransport(eTransport) || !pProxy->openDB(strDB))
+    {
+        pProxy = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+int startSocketServer(const std::string &strDB)
+{
+#if defined (WIN32) || defined (WIN64)
+    return -1;
+#else
+    // 1. the server lies beside this program
+    char path[1024];
+    const ssize_t nCount = readlink("/proc/self/exe", path, sizeof(path) - 1u);
+    if(nCount <= 0)
+    {
+        return -1;
+    }
+    path[nCount] = '\0';
+    std::string strServer = path;
+    strServer = strServer.substr(0u, strServer.rfind('/') + 1u);
+#ifdef _DEBUG
+    strServer += "DEUDBServerd";
+#else
+    strServer += "DEUDBServer";
+#endif
+
+    // 2. a socket left behind must not be taken for the new one
+    const std::string strSocket = strDB + DEU_SOCK_SUFFIX;
+    remove(strSocket.c_str());
+    const pid_t nServer = fork();
+    if(nServer < 0)
+    {
+        return -1;
+    }
+    if(nServer == 0)
+    {
+        execl(strServer.c_str(), strServer.c_str(), strDB.c_str(), "134217728", "4194304", "socket", (char *)NULL);
+        _exit(1);
+    }
+
+    // 3. wait until it listens
+    struct stat st;
+    for(unsigned nWait = 0u; nWait < g_nServerStartWait; nWait += 10u)
+    {
+        if(stat(strSocket.c_str(), &st) == 0)
+        {
+            return (int)nServer;
+        }
+        if(waitpid(nServer, NULL, WNOHANG) == nServer)
+        {
+            return -1;
+        }
+        sleepMilliseconds(10u);
+    }
+    stopSocketServer((int)nServer);
+    return -1;
+#endif
+}
+
+
+void stopSocketServer(int nServer)
+{
+#if !defined (WIN32) && !defined (WIN64)
+    if(nServer > 0)
+    {
+        kill((pid_t)nServer, SIGTERM);
+        waitpid((pid_t)nServer, NULL, 0);
+    }
+#endif
+}
+
+
+void removeDatabase(const std::string &strDB)
+{
+    for(unsigned i = 0u; i < g_nDatabaseExtCount; i++)
+    {
+        remove((strDB + g_pDatabaseExts[i]).c_str());
+    }
+    for(unsigned n = 0u; n < g_nMaxDBFiles; n++)
+    {
+        remove(getDBFilePath(strDB, n).c_str());
+    }
+}
+
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "DEUDBProxyTest.h"
+
+// Runs the tests of DEUDBProxy and DEUDBServer, the exit code is the number of tests which have failed.
+// DEUDBServer must lie beside DEUDBProxy, the first proxy of every test starts it.
+//
+//  DEUDBProxyTest [<work directory>]
+//      the databases of the tests are created in the work directory, the current one by default
+//  DEUDBProxyTest -lease-holder <database>
+//      the client process of LeasesOfLostClient
+//  DEUDBProxyTest -bench-ring <work directory> [<threads> [<reads>]]
+//      the requests and bytes a second of reads through the ring, 8 threads and 200000 reads by default
+//  DEUDBProxyTest -bench-socket <work directory> [<threads> [<reads>]]
+//      the same through the ring and through the socket with its memfd payloads, not on windows
+//  DEUDBProxyTest -bench-batch <work directory> [<IDs>]
+//      the calls and IDs a second of batches of 1, 16 and 256 IDs, 65536 IDs by default
+//  DEUDBProxyTest -bench-arena <work directory> [<processes> [<reads>]]
+//      the reads a second of processes sharing zipfian tiles, copied and in the arena, 4 processes
+//      and 20000 reads each by default
+//  DEUDBProxyTest -arena-reader <database> <shared> <reads> <seed>
+//      a reader process of -bench-arena
+
+static const cmm::TestCase<bool (*)(const std::string &)> g_testCases[] =
+{
+    { "RingManyThreads",       testRingManyThreads },
+    { "BatchReadWrite",        testBatchReadWrite },
+    { "BatchBrokenResponse",   testBatchBrokenResponse },
+    { "BatchLimits",           testBatchLimits },
+    { "ManyClients",           testManyClients },
+    { "ManyClientsSocket",     testManyClientsSocket },
+    { "LeasesOnClose",         testLeasesOnClose },
+    { "LeasesOfLostClient",    testLeasesOfLostClient },
+    { "LeasesOfReplacedBlock", testLeasesOfReplacedBlock },
+    { "AsyncCompletion",       testAsyncCompletion },
+    { "AsyncClosePending",     testAsyncClosePending },
+    { "AsyncReentrant",        testAsyncReentrant },
+};
+
+
+int main(int argc, char *argv[])
+{
+    // the client process which testLeasesOfLostClient starts and kills
+    if(argc == 3 && strcmp(argv[1], "-lease-holder") == 0)
+    {
+        return runLeaseHolder(argv[2]);
+    }
+    // a reader process which runArenaBenchmark starts
+    if(argc == 6 && strcmp(argv[1], "-arena-reader") == 0)
+    {
+        return runArenaReader(argv[2], atoi(argv[3]) != 0, (unsigned)atoi(argv[4]), (unsigned)atoi(argv[5]));
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-ring") == 0)
+    {
+        const unsigned nThreads = (argc > 3) ? (unsigned)atoi(argv[3]) : 8u;
+        const unsigned nReads = (argc > 4) ? (unsigned)atoi(argv[4]) : 200000u;
+        return runRingBenchmark(argv[2], nThreads > 0u ? nThreads : 1u, nReads);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-socket") == 0)
+    {
+        const unsigned nThreads = (argc > 3) ? (unsigned)atoi(argv[3]) : 8u;
+        const unsigned nReads = (argc > 4) ? (unsigned)atoi(argv[4]) : 200000u;
+        return runSocketBenchmark(argv[2], nThreads > 0u ? nThreads : 1u, nReads);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-batch") == 0)
+    {
+        const unsigned nIDs = (argc > 3) ? (unsigned)atoi(argv[3]) : 65536u;
+        return runBatchBenchmark(argv[2], nIDs);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-arena") == 0)
+    {
+        const unsigned nProcesses = (argc > 3) ? (unsigned)atoi(argv[3]) : 4u;
+        const unsigned nReads = (argc > 4) ? (unsigned)atoi(argv[4]) : 20000u;
+        return runArenaBenchmark(argv[2], nProcesses > 0u ? nProcesses : 1u, nReads);
+    }
+
+    const std::string strDir = (argc > 1) ? argv[1] : ".";
+
+    return cmm::runTests(g_testCases, strDir);
+}
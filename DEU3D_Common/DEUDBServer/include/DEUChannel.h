@@ -0,0 +1,31 @@
+#ifndef _DEUCHANNEL_H_
+#define _DEUCHANNEL_H_
+
+#include "DEUDefine.h"
+#include <OpenSP/Ref.h>
+
+struct RingSlot;
+
+//Where the requests of a client come from, the request ring in the shared memory
+//or a connection on the socket. The workers take a request out of a slot, carry
+//it out and hand the response back in the same slot.
+class DEUChannel : public OpenSP::Ref
+{
+public:
+	DEUChannel(void){}
+	virtual ~DEUChannel(void){}
+public:
+	//take the next slot with a request, -1 when there is none
+	virtual int			TakeRequest() = 0;
+	//the next request of the client wakes a sleeping worker
+	virtual void		SetServerWaiting() = 0;
+	virtual RingSlot*	GetSlot(int nSlot) const = 0;
+	//the payload of the slot and its size, NULL when it cannot be had
+	virtual char*		GetPayload(int nSlot,unsigned& nSize) = 0;
+	//hand the response to the client
+	virtual void		Respond(int nSlot) = 0;
+	//the leases of the client, one count for every entry of the arena, NULL when the
+	//client cannot hold a block of the arena
+	virtual volatile INT_32*	GetLeases()		{ return NULL; }
+};
+#endif //_DEUCHANNEL_H_
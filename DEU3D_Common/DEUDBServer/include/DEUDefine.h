@@ -23,6 +23,12 @@
 
 typedef sem_t* HANDLE;
 
+#endif
+
+#ifdef WIN32
+typedef long                INT_32;     //the words of the shared memory, LONG of the Interlocked calls
+#else
+typedef int                 INT_32;
 #endif
 //////////////////////////////////////////////////////////////////////////////
 
@@ -41,10 +47,47 @@ typedef sem_t* HANDLE;
 #define DEU_GET_VERSION              8
 #define DEU_REPLACE_DATA             9
 #define DEU_SET_CLEAR_FLAG           10
+#define DEU_READ_BATCH               11     //the payload holds m_nCount IDs, the response their lengths and then the blocks
+#define DEU_EXIST_BATCH              12     //the payload holds m_nCount IDs, the response a byte for every one
+#define DEU_WRITE_BATCH              13     //the payload holds m_nCount IDs, their lengths and then the blocks
+#define DEU_READ_SHARED              14     //the response leases an entry of the arena, or holds the block when it cannot be shared
 #define DEU_FAIL                     -1
+#define DEU_NEED_SPACE               -3     //the response does not fit in the payload of the slot
+#define DEU_BLOCK_MISSING            0xFFFFFFFFu    //the length of an ID which is not found by DEU_READ_BATCH
 #define DEU_END                      -2
 #define DEU_REG_SHM                  1
 #define DEU_UNREG_SHM                0
+
+//ring of request slots between a client and the server
+#define DEU_RING_MAGIC               0x474E4952u
+#define DEU_RING_SLOT_COUNT          32u
+#define DEU_RING_INLINE_SIZE         131072u    //inline payload of every slot
+#define DEU_RING_KEEP_SIZE           16777216u  //a bigger payload region is given back with its slot
+#define DEU_RING_SPIN_COUNT          256u
+
+#define DEU_SLOT_FREE                0
+#define DEU_SLOT_CLAIMED             1          //a client thread writes the request
+#define DEU_SLOT_REQUEST             2
+#define DEU_SLOT_BUSY                3          //the server works on it
+#define DEU_SLOT_RESPONSE            4
+
+//arena of the hot blocks which the server shares with all its clients
+#define DEU_ARENA_MAGIC              0x4E455241u
+#define DEU_ARENA_SIZE               67108864u
+#define DEU_ARENA_ENTRY_COUNT        8192u
+#define DEU_ARENA_MAX_BLOCK          4194304u   //a bigger block is never shared
+#define DEU_ARENA_NO_ENTRY           0xFFFFFFFFu
+
+//unix domain socket between a client and a server which may run in another container
+#define DEU_SOCK_SUFFIX              ".sock"    //the socket lives beside the database
+#define DEU_SOCK_MAGIC               0x4B434F53u
+#define DEU_SOCK_INLINE_SIZE         65536u     //a bigger payload goes in a memfd
+#define DEU_SOCK_MEMFD               1u         //the memfd of the payload is passed along with the head
+#define DEU_SOCK_BACKLOG             64
+#define DEU_SOCK_RECV_TIMEOUT        1          //seconds a request may take to come in once it has begun
+
+#define DEU_MIN_WORKER_COUNT         2u         //the workers serving the rings of all the clients
+#define DEU_MAX_WORKER_COUNT         8u
 #define DEU_READ_BUF                 134217728u
 #define DEU_WRITE_BUF                10u
 
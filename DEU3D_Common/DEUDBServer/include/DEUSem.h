@@ -19,6 +19,8 @@ public:
 	static void WaitSem(HANDLE hnd);
 	//close semaphore
 	static void CloseSem(HANDLE hnd,const std::string& strSemName);
+	//remove the name of a semaphore, the handles opened stay valid
+	static void RemoveSem(const std::string& strSemName);
 
 };
 #endif //_DEUSEM_H_
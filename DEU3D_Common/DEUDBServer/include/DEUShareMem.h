@@ -4,35 +4,6 @@
 #include <DEUDB/IDEUDB.h>
 #include "DEUDefine.h"
 
-struct ShareObj
-{
-public:
-	int                  m_nType;
-	unsigned             m_nTotalLength;
-	unsigned             m_startLength;
-	unsigned             m_endLength;
-	unsigned             m_shmSize;
-    unsigned             m_nVersion;
-	UINT_64              m_nLowBit;
-    UINT_64              m_nMidBit;
-    UINT_64              m_nHighBit;      
-
-	std::vector<unsigned char>	m_vecData;
-	ShareObj()
-	{
-		m_nType = m_nTotalLength = m_startLength = m_endLength = m_shmSize = -1;
-        m_nVersion = 0;
-		m_nLowBit = m_nMidBit = m_nHighBit = 0;
-	}
-
-	~ShareObj()
-	{
-		m_nType = m_nTotalLength = m_startLength = m_endLength = m_shmSize = -1;
-        m_nVersion = 0;
-		m_nLowBit = m_nMidBit = m_nHighBit = 0;
-	}
-};
-
 class DEUShareMem
 {
 public:
@@ -40,16 +11,19 @@ public:
 	~DEUShareMem(void);
 public:
 	//shm function
-	bool	CreateShm(unsigned nSize);
+	bool	CreateShm(const std::string& strShmName,unsigned nSize);
 	bool	DestroyShm();
 	bool	AtShm(const std::string& strShmName);
 	bool	DtShm(const std::string& strShmName);
+	//address of a mapped shm, NULL when it is not mapped
+	void*	GetShmAddr(const std::string& strShmName) const;
 	//////////////////////////////////////////////////////////////////////////
     //deudb function
     bool	openDB(const std::string &strDB,unsigned nReadBufferSize = 134217728u, unsigned nWriteBufferSize = 67108864u);
     void	closeDB(void);
     bool    isExist(const ID &id);
     bool    readBlock(const ID &id, void *&pBuffer, unsigned &nLength,const unsigned& nVersion);
+    bool    readBlock(const ID &id, OpenSP::sp<deudb::IBlockBuffer> &pBuffer, unsigned nVersion);
     bool	removeBlock(const ID &id);
     bool    removeBlock(const std::vector<int>& nCodeVec);
     bool	addBlock(const ID &id, const void *pBuffer, unsigned nBufLen);
@@ -59,21 +33,14 @@ public:
     unsigned getBlockCount(void) const; 
     void  getIndices(std::vector<ID> &vecIndices, unsigned nOffset = 0u, unsigned nCount = ~0u) const;
     std::vector<unsigned> getVersion(const ID &id) const;
+    unsigned readBlocks(const std::vector<ID> &vecIDs, std::vector<OpenSP::sp<deudb::IBlockBuffer> > &vecBuffers, std::vector<bool> &vecFound);
+    bool    writeBlocks(const std::vector<ID> &vecIDs, const std::vector<OpenSP::sp<deudb::IBlockBuffer> > &vecBuffers);
     // free memory
 	void    freeMemory(void *pData);
 	//////////////////////////////////////////////////////////////////////////
-	//read type
-	bool	ReadType(const std::string& strShmName,int& nType);
-	//read Info from shared memory
-	bool	ReadInfo(const std::string& strShmName,ShareObj& outObj);
-	//write info to shared memory
-	bool	WriteInfo(const std::string& strShmName,const ShareObj& sobj);
 	//read reg info
 	bool    ReadRegInfo(const std::string& strShmName,int& nType,std::string& strDB,std::string& strShared);
 	bool    WriteRegInfo(const std::string& strShmName,const int& nType,const std::string& strDB,const std::string& strShared);
-	//read share obj
-	bool	ReadShmObj(char* shmAddr,ShareObj& sobj);
-	bool    GetObj(const char* pBuffer,unsigned nTotal,unsigned nStart,unsigned nEnd,ShareObj& outObj);
 
 private:
 	//HANDLE						    m_shmHandle;//ڴַ
@@ -0,0 +1,81 @@
+#ifndef _DEUSHMARENA_H_
+#define _DEUSHMARENA_H_
+
+#include "DEUDefine.h"
+#include "DEUShareMem.h"
+#include <OpenThreads/Mutex>
+
+//the layout of the arena in the shared memory, it must be the same as in DEUDBProxy
+struct ArenaHeader
+{
+	unsigned             m_nMagic;
+	unsigned             m_nEntryCount;
+	unsigned             m_nDataOffset;     //the blocks start here
+	unsigned             m_nDataSize;
+};
+
+struct ArenaEntry
+{
+	volatile INT_32      m_nLeases;         //the server takes them, the clients give them back
+	unsigned             m_nOffset;         //the place of the block behind m_nDataOffset
+	unsigned             m_nLength;
+	unsigned             m_nReserved;
+};
+
+static_assert(sizeof(ArenaHeader) == 16,"ArenaHeader must be 16 bytes");
+static_assert(sizeof(ArenaEntry) == 16,"ArenaEntry must be 16 bytes");
+
+//The arena of hot blocks which the server shares with all its clients, see DEUDBProxy's
+//DEUShmArena. The blocks are laid one behind another round the arena and a new block
+//takes the place of the oldest ones nobody leases. A published block never changes, a
+//write to its ID only drops it from the index, so the clients still holding it go on
+//reading the old one until they give it back. Only the server takes leases, under the
+//lock, so a block found without leases under the lock can be dropped. Every lease is
+//counted in the lease table of the client too, so the leases of a client which has
+//gone are dropped with its ring.
+class DEUShmArena
+{
+public:
+	DEUShmArena(void);
+	~DEUShmArena(void);
+public:
+	//create the arena strArena with nSize bytes for the blocks
+	bool		Create(const std::string& strArena,unsigned nSize,unsigned nEntryCount);
+	void		Destroy();
+
+	//lease the entry of the block to the client of pLeases, -1 when it is not in the arena
+	//or the client cannot hold it
+	int			Lease(volatile INT_32* pLeases,const ID& id,unsigned nVersion);
+	//the count of the writes so far, it is taken before the block is read
+	unsigned	GetWriteCount();
+	//copy the block into the arena and lease it, -1 when it cannot be shared,
+	//a block whose ID has been written since nWriteCount is not indexed
+	int			Publish(volatile INT_32* pLeases,const ID& id,unsigned nVersion,const void* pData,unsigned nLength,unsigned nWriteCount);
+	//give back the leases of a client which has gone
+	void		DropLeases(volatile INT_32* pLeases);
+	//drop the blocks of id from the index
+	void		Invalidate(const ID& id);
+
+private:
+	ArenaEntry*	GetEntry(unsigned nEntry) const;
+	void		TakeLease(volatile INT_32* pLeases,unsigned nEntry);
+	bool		Allocate(unsigned nLength,unsigned& nOffset);
+	bool		EvictOldest();
+	void		Evict(unsigned nEntry);
+
+private:
+	typedef std::pair<ID,unsigned> BlockKey;
+	std::string						m_strArena;
+	DEUShareMem						m_shm;
+	ArenaHeader*					m_pHeader;
+	char*							m_pData;
+	std::map<BlockKey,unsigned>		m_indexMap;			//the entries of the published blocks
+	std::map<unsigned,unsigned>		m_extentMap;		//the offset of every entry in use to the entry
+	std::vector<BlockKey>			m_keyVec;
+	std::vector<bool>				m_indexedVec;
+	std::vector<unsigned>			m_freeVec;			//the free entries
+	unsigned						m_nHead;			//where the next block goes
+	unsigned						m_nWriteCount;
+	OpenThreads::Mutex				m_mtxArena;
+};
+#endif //_DEUSHMARENA_H_
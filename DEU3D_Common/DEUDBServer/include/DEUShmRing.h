@@ -0,0 +1,139 @@
+#ifndef _DEUSHMRING_H_
+#define _DEUSHMRING_H_
+
+#include "DEUDefine.h"
+#include "DEUShareMem.h"
+#include "DEUChannel.h"
+#include <OpenThreads/Mutex>
+
+class DEUShmArena;
+
+//the layout of the ring in the shared memory, it must be the same as in DEUDBProxy
+struct RingHeader
+{
+	unsigned             m_nMagic;
+	unsigned             m_nSlotCount;
+	unsigned             m_nInlineSize;
+	volatile INT_32      m_nServerWaiting;  //the server sleeps on its semaphore
+	unsigned             m_nLeaseCount;     //the counts of the lease table behind the inline payloads
+	unsigned             m_nProcessID;      //the process of the client
+	unsigned             m_nServerProcessID;//the process of the server, set when it opens the ring
+	unsigned             m_nReserved;
+};
+
+struct RingSlot
+{
+	volatile INT_32      m_nState;          //DEU_SLOT_*
+	volatile INT_32      m_nClientWaiting;  //the client sleeps on the semaphore of the slot
+	int                  m_nType;           //the opcode, DEU_FAIL or DEU_NEED_SPACE in a response
+	unsigned             m_nVersion;
+	UINT_64              m_nHighBit;
+	UINT_64              m_nMidBit;
+	UINT_64              m_nLowBit;
+	unsigned             m_nOffset;
+	unsigned             m_nCount;          //the count of a list, the clear flag
+	unsigned             m_nLength;         //the bytes in the payload, or the bytes needed
+	unsigned             m_nRegion;         //0 the inline payload, else the generation of the region of the slot
+	unsigned             m_nRegionSize;
+};
+
+//the client and the server may be built for other word sizes, the layout must not change with them
+static_assert(sizeof(RingHeader) == 32,"RingHeader must be 32 bytes");
+static_assert(sizeof(RingSlot) == 64,"RingSlot must be 64 bytes");
+
+//ordered accesses to a word of the shared memory, the exchanges are full barriers
+inline INT_32 RingLoad(volatile INT_32* pValue)
+{
+#if defined (WIN32) || defined (WIN64)
+	return *pValue;
+#else
+	const INT_32 nValue = *pValue;
+	__sync_synchronize();
+	return nValue;
+#endif
+}
+
+inline INT_32 RingExchange(volatile INT_32* pValue,INT_32 nValue)
+{
+#if defined (WIN32) || defined (WIN64)
+	return InterlockedExchange(pValue,nValue);
+#else
+	__sync_synchronize();
+	return __sync_lock_test_and_set(pValue,nValue);
+#endif
+}
+
+inline INT_32 RingIncrement(volatile INT_32* pValue)
+{
+#if defined (WIN32) || defined (WIN64)
+	return InterlockedIncrement(pValue);
+#else
+	return __sync_add_and_fetch(pValue,1);
+#endif
+}
+
+inline INT_32 RingDecrement(volatile INT_32* pValue)
+{
+#if defined (WIN32) || defined (WIN64)
+	return InterlockedDecrement(pValue);
+#else
+	return __sync_sub_and_fetch(pValue,1);
+#endif
+}
+
+inline INT_32 RingCompareExchange(volatile INT_32* pValue,INT_32 nValue,INT_32 nComparand)
+{
+#if defined (WIN32) || defined (WIN64)
+	return InterlockedCompareExchange(pValue,nValue,nComparand);
+#else
+	return __sync_val_compare_and_swap(pValue,nComparand,nValue);
+#endif
+}
+
+//The server side of the request ring of a client, see DEUDBProxy's DEUShmRing.
+//The server takes the slots which hold a request round the ring, so every thread
+//of the client is served in turn, and answers each one in place. It maps the
+//payload region of a slot when the client has grown it, it never creates one.
+//Several workers may serve the slots of one ring at the same time. The client counts
+//the blocks of the arena it holds in the lease table of its ring, so the leases it has
+//not given back are dropped when the ring is closed.
+class DEUShmRing : public DEUChannel
+{
+public:
+	DEUShmRing(void);
+	virtual ~DEUShmRing(void);
+public:
+	//open the ring strShared + "Shm" of a client and the semaphores of its slots,
+	//the blocks of pArena are leased to the client
+	bool		Open(const std::string& strShared,DEUShmArena* pArena);
+	void		Close();
+	//whether the process of the client is still there
+	bool		IsClientAlive() const;
+
+	virtual int			TakeRequest();
+	//the client releases the semaphore of the workers with its next request
+	virtual void		SetServerWaiting();
+	virtual RingSlot*	GetSlot(int nSlot) const;
+	//NULL when the region of the slot cannot be mapped
+	virtual char*		GetPayload(int nSlot,unsigned& nSize);
+	virtual void		Respond(int nSlot);
+	virtual volatile INT_32*	GetLeases()		{ return m_pLeases; }
+
+private:
+	std::string	GetRegionName(int nSlot,unsigned nGen) const;
+
+private:
+	std::string					m_strShared;
+	DEUShareMem					m_shm;				//maps the ring and the regions
+	RingHeader*					m_pHeader;
+	char*						m_pSlots;
+	char*						m_pInline;
+	volatile INT_32*				m_pLeases;
+	DEUShmArena*				m_pArena;
+	volatile unsigned			m_nCursor;			//only a hint where the next search starts
+	std::vector<HANDLE>			m_slotHndVec;
+	std::vector<unsigned>		m_regionGenVec;
+	std::vector<char*>			m_regionAddrVec;
+	OpenThreads::Mutex			m_mtxRegion;		//m_shm is shared by the slots
+};
+#endif //_DEUSHMRING_H_
@@ -0,0 +1,114 @@
+#ifndef _DEUSOCKSERVER_H_
+#define _DEUSOCKSERVER_H_
+
+#include "DEUDefine.h"
+#include "DEUShmRing.h"
+#include "DEUWorkerPool.h"
+#include <OpenThreads/Thread>
+
+//the head of every message on the socket, it must be the same as in DEUDBProxy
+struct SockHeader
+{
+	unsigned             m_nMagic;
+	unsigned             m_nFlags;          //DEU_SOCK_MEMFD
+	int                  m_nType;
+	unsigned             m_nVersion;
+	UINT_64              m_nHighBit;
+	UINT_64              m_nMidBit;
+	UINT_64              m_nLowBit;
+	unsigned             m_nOffset;
+	unsigned             m_nCount;
+	unsigned             m_nLength;         //the bytes of the payload behind the head or in the memfd
+	unsigned             m_nReserved;
+};
+
+class DEUSockServer;
+
+//A connection of a client on the socket, the workers serve it as a ring of one
+//slot. The socket server reads a request into the slot, a worker carries it out
+//and sends the response, and only then is the connection watched again. A payload
+//bigger than DEU_SOCK_INLINE_SIZE lives in a memfd which goes to and fro along
+//with the head, so the worker reads and writes it in place.
+class DEUSockConnection : public DEUChannel
+{
+public:
+	DEUSockConnection(DEUSockServer* pServer,int nSocket);
+	virtual ~DEUSockConnection(void);
+public:
+	int					GetSocket() const;
+	//read the next request into the slot, false when the client has gone
+	bool				Receive();
+
+	virtual int			TakeRequest();
+	//the socket server wakes a worker for every request it reads
+	virtual void		SetServerWaiting();
+	virtual RingSlot*	GetSlot(int nSlot) const;
+	virtual char*		GetPayload(int nSlot,unsigned& nSize);
+	//send the response, one which has not fitted is carried out again with a payload big enough
+	virtual void		Respond(int nSlot);
+
+private:
+	bool				Send();
+	//the payload grown to at least nLength, the first nKeep bytes are carried over
+	char*				ReservePayload(unsigned nLength,unsigned nKeep);
+	bool				MapPayload(int nMemFd);
+	void				FreePayload();
+
+private:
+	DEUSockServer*		m_pServer;
+	int					m_nSocket;
+	RingSlot			m_slot;
+	int					m_nRequestType;		//the request as it has come, for a response which has not fitted
+	unsigned			m_nRequestLength;
+	std::vector<char>	m_inlineVec;
+	int					m_nMemFd;			//the memfd of a bigger payload, -1 when there is none
+	char*				m_pMapped;
+	unsigned			m_nMappedSize;
+};
+
+//Serves the clients which connect to the unix domain socket beside the database,
+//they may run in other containers. Only a client of the same user or root is let
+//in. One thread accepts the connections and reads their requests, the workers of
+//the pool carry them out.
+class DEUSockServer
+{
+public:
+	DEUSockServer(void);
+	~DEUSockServer(void);
+public:
+	//listen on strSocket, a socket left behind by a server which has died is removed
+	bool		Start(const std::string& strSocket,DEUWorkerPool* pPool);
+	void		Stop();
+
+	//a request has been read from a connection
+	void		WakeWorker();
+	//the response has been sent, the next request of the connection is waited for
+	void		Watch(DEUSockConnection* pConnection);
+
+private:
+	class ListenThread : public OpenThreads::Thread
+	{
+	public:
+		explicit ListenThread(DEUSockServer* pServer) : m_pServer(pServer){}
+	protected:
+		virtual void run(void);
+		DEUSockServer*	m_pServer;
+	};
+	friend class ListenThread;
+
+	void		Listen();
+	void		Accept();
+	void		Drop(int nSocket);
+
+private:
+	typedef std::map<int,std::pair<std::string,OpenSP::sp<DEUSockConnection> > > ConnectionMap;
+	std::string					m_strSocket;
+	DEUWorkerPool*				m_pPool;
+	int							m_nListen;
+	int							m_nPoll;
+	ListenThread*				m_pThread;
+	volatile bool				m_bStop;
+	unsigned					m_nNextConnection;
+	ConnectionMap				m_connectionMap;	//only the listening thread touches it
+};
+#endif //_DEUSOCKSERVER_H_
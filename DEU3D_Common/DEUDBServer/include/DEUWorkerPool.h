@@ -0,0 +1,64 @@
+#ifndef _DEUWORKERPOOL_H_
+#define _DEUWORKERPOOL_H_
+
+#include "DEUDefine.h"
+#include "DEUChannel.h"
+#include <OpenSP/sp.h>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+
+//processes the request in a slot, the response is written into the same slot
+typedef void (*RequestProc)(DEUChannel* pRing,int nSlot);
+
+//A fixed count of workers serves the request rings of all the clients. A worker
+//goes round the rings from behind the one served last and takes one request of a
+//ring at a time, so a busy client cannot starve the others. Idle workers sleep on
+//one semaphore which the clients release when they find the flag of their ring set,
+//and a worker woken with requests to serve wakes the next one. The connections of
+//the socket are served as rings of one slot, the socket server wakes a worker.
+class DEUWorkerPool
+{
+public:
+	DEUWorkerPool(void);
+	~DEUWorkerPool(void);
+public:
+	//create the semaphore strWorkSem and start the workers
+	bool		Start(const std::string& strWorkSem,unsigned nWorkerCount,RequestProc pProc);
+	//stop the workers and drop all the rings
+	void		Stop();
+
+	void		AddRing(const std::string& strShared,DEUChannel* pRing);
+	//the ring is closed once the last worker serving it has done
+	void		RemoveRing(const std::string& strShared);
+	//wake a worker if they all sleep, a request has come which has not seen the flags
+	void		Wake();
+
+private:
+	class WorkerThread : public OpenThreads::Thread
+	{
+	public:
+		explicit WorkerThread(DEUWorkerPool* pPool) : m_pPool(pPool){}
+	protected:
+		virtual void run(void);
+		DEUWorkerPool*	m_pPool;
+	};
+	friend class WorkerThread;
+
+	void		Work();
+	bool		FindRequest(OpenSP::sp<DEUChannel>& pRing,int& nSlot);
+	void		SetServerWaiting();
+
+private:
+	typedef std::vector<std::pair<std::string,OpenSP::sp<DEUChannel> > > RingVec;
+	RingVec						m_ringVec;
+	unsigned					m_nNextRing;		//where the next search starts
+	OpenThreads::Mutex			m_mtxRing;
+	RequestProc					m_pProc;
+	std::vector<WorkerThread*>	m_workerVec;
+	std::string					m_strWorkSem;
+	HANDLE						m_workHnd;
+	OpenThreads::Atomic			m_nSleeping;
+	volatile bool				m_bStop;
+};
+#endif //_DEUWORKERPOOL_H_
@@ -31,7 +31,7 @@ HANDLE DEUSem::OpenSem(const std::string& strSemName)
 #ifdef WIN32
 	hnd = OpenSemaphore(SEMAPHORE_ALL_ACCESS,FALSE,strSemName.c_str());
 #else
-	hnd = sem_open(strSemName.c_str(), O_RDWR|O_CREAT);
+	hnd = sem_open(strSemName.c_str(), 0);
 #endif
 	return hnd;
 }
@@ -67,3 +67,11 @@ void DEUSem::CloseSem(HANDLE hnd,const std::string& strSemName)
 		sem_unlink(strSemName.c_str());
 #endif
 }
+
+//remove the name of a semaphore, a named object of windows goes with its last handle
+void DEUSem::RemoveSem(const std::string& strSemName)
+{
+#ifndef WIN32
+	sem_unlink(strSemName.c_str());
+#endif
+}
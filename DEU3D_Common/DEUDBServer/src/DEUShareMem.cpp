@@ -3,6 +3,7 @@
 
 DEUShareMem::DEUShareMem(void)
 {
+	m_pDB = NULL;
 }
 
 
@@ -10,6 +11,25 @@ DEUShareMem::~DEUShareMem(void)
 {
 }
 #if defined(WIN32) || defined(WIN64)
+//create shared memory, DtShm removes it
+bool DEUShareMem::CreateShm(const std::string& strShmName,unsigned nSize)
+{
+	//create share memory
+	HANDLE shmHnd = CreateFileMapping(INVALID_HANDLE_VALUE,NULL,PAGE_READWRITE,0,nSize,strShmName.c_str());
+	if(shmHnd == NULL)
+		return false;
+	//at shm
+	void* shmFile = MapViewOfFile(shmHnd,FILE_MAP_READ|FILE_MAP_WRITE,0,0,0);
+	if(shmFile == NULL)
+	{
+		CloseHandle(shmHnd);
+		return false;
+	}
+	//save
+	m_shmPtrMap[strShmName] = shmFile;
+	m_shmHndMap[strShmName] = shmHnd;
+	return true;
+}
 //at shared memory
 bool DEUShareMem::AtShm(const std::string& strShmName)
 {
@@ -50,6 +70,33 @@ bool DEUShareMem::DtShm(const std::string& strShmName)
 	return true;
 }
 #else
+//create shared memory, DtShm removes it
+bool DEUShareMem::CreateShm(const std::string& strShmName,unsigned nSize)
+{
+	std::string strTemp = "/dev/shm/" + strShmName;
+	FILE* pf = fopen(strTemp.c_str(),"w"); 
+	if(pf == NULL)
+		return false;
+	fclose(pf);
+	//create shm
+	key_t shmKey = ftok(strTemp.c_str(),10);
+	if(shmKey == -1)
+		return false;
+	int nShmID = shmget(shmKey,nSize,IPC_CREAT|0666);
+	if(nShmID == -1)
+		return false;
+	//at shm
+	void* shmFile = shmat(nShmID,0,0);
+	if(shmFile == NULL)
+	{
+		shmctl(nShmID,IPC_RMID,NULL);
+		return false;
+	}
+	//save 
+	m_shmIDMap[strShmName] = nShmID;
+	m_shmPtrMap[strShmName] = shmFile;
+	return true;
+}
 //at shared memory
 bool DEUShareMem::AtShm(const std::string& strShmName)
 {
@@ -96,6 +143,7 @@ bool DEUShareMem::DtShm(const std::string& strShmName)
 	//erase
 	m_shmPtrMap.erase(strShmName);
 	m_shmIDMap.erase(strShmName);
+	return true;
 }
 #endif
 bool DEUShareMem::ReadRegInfo(const std::string& strShmName,int& nType,std::string& strDB,std::string& strShared)
@@ -142,119 +190,13 @@ bool DEUShareMem::WriteRegInfo(const std::string& strShmName,const int& nType,co
 	memcpy(chTemp,strWrite.c_str(),strWrite.length());
 	return true;
 }
-//read type
-bool DEUShareMem::ReadType(const std::string& strShmName,int& nType)
+//get shm address
+void* DEUShareMem::GetShmAddr(const std::string& strShmName) const
 {
-	//get shm ptr
 	std::map<std::string,void*>::const_iterator itr = m_shmPtrMap.find(strShmName);
 	if(itr == m_shmPtrMap.end())
-		return false;
-	int* shmAddr = (int*)itr->second;
-	//get type
-	nType = shmAddr[0];
-	return true;
-}
-//read info from shared memory
-bool DEUShareMem::ReadInfo(const std::string& strShmName,ShareObj& outObj)
-{
-	//get shm ptr
-	std::map<std::string,void*>::const_iterator itr = m_shmPtrMap.find(strShmName);
-	if(itr == m_shmPtrMap.end())
-		return false;
-	int * shmAddr = (int *)(itr->second);
-	//get type
-	outObj.m_nType = shmAddr[0];
-	if(outObj.m_nType == DEU_WRITE_DATA || outObj.m_nType == DEU_UPDATE_DATA 
-       || outObj.m_nType == DEU_REPLACE_DATA || outObj.m_nType == DEU_INDEX_INRANGE
-       || outObj.m_nType == DEU_SET_CLEAR_FLAG)
-	{
-		outObj.m_nTotalLength = shmAddr[1];
-        outObj.m_startLength =  shmAddr[2];
-        outObj.m_endLength = shmAddr[3];
-    }
-    outObj.m_shmSize = shmAddr[4];
-    if(outObj.m_nType == DEU_READ_DATA)
-    {
-        outObj.m_nVersion = shmAddr[5];
-    }
-    //read id
-    UINT_64* lAddr = (UINT_64*)(shmAddr+6);
-    outObj.m_nHighBit = lAddr[0];
-    outObj.m_nMidBit = lAddr[1];
-    outObj.m_nLowBit = lAddr[2];
-    //read data
-    if(outObj.m_nType == DEU_WRITE_DATA || outObj.m_nType == DEU_UPDATE_DATA || outObj.m_nType == DEU_REPLACE_DATA)
-    {
-        //read data
-        size_t sz = outObj.m_endLength - outObj.m_startLength + 1;
-        char* tempAddr = (char*)(lAddr+3);
-        outObj.m_vecData.resize(sz);
-        memcpy(outObj.m_vecData.data(), tempAddr, sz);
-    }
-	return true;
-}
-//write info to shared memory
-bool DEUShareMem::WriteInfo(const std::string& strShmName,const ShareObj& sobj)
-{
-	//get shm ptr
-	std::map<std::string,void*>::const_iterator itr = m_shmPtrMap.find(strShmName);
-	if(itr == m_shmPtrMap.end())
-		return false;
-	int* shmAddr = (int*)itr->second;
-	shmAddr[0] = sobj.m_nType;
-	switch(sobj.m_nType)
-	{
-	case DEU_WRITE_DATA:
-	case DEU_UPDATE_DATA:
-    case DEU_REPLACE_DATA:
-	case DEU_REMOVE_DATA:
-	case DEU_FAIL:
-    case DEU_SET_CLEAR_FLAG:
-		return true;
-    case DEU_GET_COUNT:
-        {
-            shmAddr[1] = sobj.m_nTotalLength;
-            return true;
-        }
-	case DEU_READ_DATA:
-		{
-			//write length
-			shmAddr[1] = sobj.m_nTotalLength;
-			shmAddr[2] = sobj.m_startLength;
-			shmAddr[3] = sobj.m_endLength;
-			UINT_64* lAddr = (UINT_64*)(shmAddr+6);
-			char* tempAddr = (char*)(lAddr+3);
-			size_t sz = sobj.m_endLength - sobj.m_startLength + 1;
-			memcpy(tempAddr,(char*)sobj.m_vecData.data(),sz);
-			return true;
-		}
-	case DEU_ALL_INDEX:
-    case DEU_INDEX_INRANGE:
-		{
-			//write length
-			shmAddr[1] = sobj.m_nTotalLength;
-			shmAddr[2] = sobj.m_startLength;
-			shmAddr[3] = sobj.m_endLength;
-			UINT_64* lAddr = (UINT_64*)(shmAddr+6);
-			ID* tempAddr = (ID*)(lAddr+3);
-			size_t sz = sobj.m_endLength - sobj.m_startLength + 1;
-			memcpy(tempAddr,sobj.m_vecData.data(),sz*sizeof(ID));
-			return true;
-		}
-    case DEU_GET_VERSION:
-        {
-            //write length
-            shmAddr[1] = sobj.m_nTotalLength;
-            shmAddr[2] = sobj.m_startLength;
-            shmAddr[3] = sobj.m_endLength;
-            UINT_64* lAddr = (UINT_64*)(shmAddr+6);
-            ID* tempAddr = (ID*)(lAddr+3);
-            size_t sz = sobj.m_endLength - sobj.m_startLength + 1;
-            memcpy(tempAddr,sobj.m_vecData.data(),sz*sizeof(unsigned));
-            return true;
-        }
-	}
-	return false;
+		return NULL;
+	return itr->second;
 }
 
 //open db
@@ -262,6 +204,7 @@ bool  DEUShareMem::openDB(const std::string &strDB,unsigned nReadBufferSize, uns
 {
 	//open DEUDB
 	m_pDB = deudb::createDEUDB();
+	m_pDB->setMappedRead(true);
 	bool bRes = false;
 	if(m_pDB->openDB(strDB,nReadBufferSize,nWriteBufferSize))
 		return true;
@@ -308,6 +251,13 @@ bool DEUShareMem::readBlock(const ID &id, void *&pBuffer, unsigned &nLength,cons
 	//read block
 	return m_pDB->readBlock(id,pBuffer,nLength,nVersion);
 }
+//read block without copying it
+bool DEUShareMem::readBlock(const ID &id, OpenSP::sp<deudb::IBlockBuffer> &pBuffer, unsigned nVersion)
+{
+	if(m_pDB == NULL)
+		return false;
+	return m_pDB->readBlock(id,pBuffer,nVersion);
+}
 //add  block
 bool DEUShareMem::addBlock(const ID &id, const void *pBuffer, unsigned nBufLen)
 {
@@ -380,16 +330,21 @@ std::vector<unsigned> DEUShareMem::getVersion(const ID &id) const
         return versionVec;
     return m_pDB->getVersion(id);
 }
-//get  object
-bool DEUShareMem::GetObj(const char* pBuffer,unsigned nTotal,unsigned nStart,unsigned nEnd,ShareObj& outObj)
+
+unsigned DEUShareMem::readBlocks(const std::vector<ID> &vecIDs, std::vector<OpenSP::sp<deudb::IBlockBuffer> > &vecBuffers, std::vector<bool> &vecFound)
 {
-	outObj.m_nType = DEU_READ_DATA;
-	outObj.m_nTotalLength = nTotal;
-	outObj.m_startLength = nStart;
-	outObj.m_endLength = nEnd;
+    if(m_pDB == NULL)
+    {
+        vecBuffers.assign(vecIDs.size(),OpenSP::sp<deudb::IBlockBuffer>());
+        vecFound.assign(vecIDs.size(),false);
+        return 0;
+    }
+    return m_pDB->readBlocks(vecIDs,vecBuffers,vecFound);
+}
 
-	size_t sz = nEnd - nStart + 1;
-	outObj.m_vecData.resize(sz);
-	memcpy(&outObj.m_vecData[0],pBuffer+nStart,sz);
-	return true;
+bool DEUShareMem::writeBlocks(const std::vector<ID> &vecIDs, const std::vector<OpenSP::sp<deudb::IBlockBuffer> > &vecBuffers)
+{
+    if(m_pDB == NULL)
+        return false;
+    return m_pDB->writeBlocks(vecIDs,vecBuffers);
 }
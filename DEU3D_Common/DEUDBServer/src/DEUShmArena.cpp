@@ -0,0 +1,249 @@
+#include "DEUShmArena.h"
+#include "DEUShmRing.h"
+#include <OpenThreads/ScopedLock>
+#include <stdio.h>
+
+//a block always starts on a cache line
+static unsigned getExtentSize(unsigned nLength)
+{
+	return (nLength + 63u) & ~63u;
+}
+
+DEUShmArena::DEUShmArena(void)
+{
+	m_pHeader = NULL;
+	m_pData = NULL;
+	m_nHead = 0;
+	m_nWriteCount = 0;
+}
+
+
+DEUShmArena::~DEUShmArena(void)
+{
+	Destroy();
+}
+
+//create the arena
+bool DEUShmArena::Create(const std::string& strArena,unsigned nSize,unsigned nEntryCount)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	m_strArena = strArena;
+
+	//1. the header, the entries and then the blocks from the next page on
+	const unsigned nDataOffset = (unsigned)((sizeof(ArenaHeader) + nEntryCount*sizeof(ArenaEntry) + 4095u) & ~(size_t)4095u);
+	if(!m_shm.CreateShm(m_strArena,nDataOffset + nSize))
+		return false;
+	char* pAddr = (char*)m_shm.GetShmAddr(m_strArena);
+	memset(pAddr,0,nDataOffset);
+	ArenaHeader* pHeader = (ArenaHeader*)pAddr;
+	pHeader->m_nEntryCount = nEntryCount;
+	pHeader->m_nDataOffset = nDataOffset;
+	pHeader->m_nDataSize = nSize;
+
+	//2. all the entries are free
+	m_keyVec.assign(nEntryCount,BlockKey());
+	m_indexedVec.assign(nEntryCount,false);
+	m_freeVec.clear();
+	for(unsigned n = nEntryCount;n > 0;n--)
+		m_freeVec.push_back(n - 1);
+	m_nHead = 0;
+
+	//3. the clients check the magic when they map it
+	pHeader->m_nMagic = DEU_ARENA_MAGIC;
+	m_pHeader = pHeader;
+	m_pData = pAddr + nDataOffset;
+	return true;
+}
+
+//destroy the arena, the clients still holding blocks keep it mapped
+void DEUShmArena::Destroy()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	if(m_pHeader != NULL)
+	{
+		m_shm.DtShm(m_strArena);
+#if !defined (WIN32) && !defined (WIN64)
+		//the key file of the shared memory too
+		std::string strKeyFile = "/dev/shm/" + m_strArena;
+		remove(strKeyFile.c_str());
+#endif
+	}
+	m_pHeader = NULL;
+	m_pData = NULL;
+	m_indexMap.clear();
+	m_extentMap.clear();
+	m_keyVec.clear();
+	m_indexedVec.clear();
+	m_freeVec.clear();
+}
+
+//lease the entry of the block
+int DEUShmArena::Lease(volatile INT_32* pLeases,const ID& id,unsigned nVersion)
+{
+	if(pLeases == NULL)
+		return -1;
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	std::map<BlockKey,unsigned>::const_iterator itr = m_indexMap.find(BlockKey(id,nVersion));
+	if(itr == m_indexMap.end())
+		return -1;
+	TakeLease(pLeases,itr->second);
+	return (int)itr->second;
+}
+
+unsigned DEUShmArena::GetWriteCount()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	return m_nWriteCount;
+}
+
+//copy the block into the arena and lease it
+int DEUShmArena::Publish(volatile INT_32* pLeases,const ID& id,unsigned nVersion,const void* pData,unsigned nLength,unsigned nWriteCount)
+{
+	if(pLeases == NULL || nLength == 0 || nLength > DEU_ARENA_MAX_BLOCK)
+		return -1;
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	if(m_pHeader == NULL)
+		return -1;
+
+	//1. another worker may have published it meanwhile
+	const BlockKey key(id,nVersion);
+	const bool bIndexed = (nWriteCount == m_nWriteCount);
+	if(bIndexed)
+	{
+		std::map<BlockKey,unsigned>::const_iterator itr = m_indexMap.find(key);
+		if(itr != m_indexMap.end())
+		{
+			TakeLease(pLeases,itr->second);
+			return (int)itr->second;
+		}
+	}
+
+	//2. find an entry and the room for the block
+	if(m_freeVec.empty() && !EvictOldest())
+		return -1;
+	unsigned nOffset = 0;
+	if(!Allocate(nLength,nOffset))
+		return -1;
+	const unsigned nEntry = m_freeVec.back();
+	m_freeVec.pop_back();
+
+	//3. the block is written before the lease is taken, the exchange is a full barrier
+	memcpy(m_pData + nOffset,pData,nLength);
+	ArenaEntry* pEntry = GetEntry(nEntry);
+	pEntry->m_nOffset = nOffset;
+	pEntry->m_nLength = nLength;
+	RingIncrement(&pLeases[nEntry]);
+	RingExchange(&pEntry->m_nLeases,1);
+	m_extentMap[nOffset] = nEntry;
+	m_keyVec[nEntry] = key;
+	m_indexedVec[nEntry] = bIndexed;
+	if(bIndexed)
+		m_indexMap[key] = nEntry;
+	return (int)nEntry;
+}
+
+//drop the blocks of id from the index
+void DEUShmArena::Invalidate(const ID& id)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	m_nWriteCount++;
+	std::map<BlockKey,unsigned>::iterator itrBegin = m_indexMap.lower_bound(BlockKey(id,0u));
+	std::map<BlockKey,unsigned>::iterator itrEnd = m_indexMap.upper_bound(BlockKey(id,~0u));
+	for(std::map<BlockKey,unsigned>::iterator itr = itrBegin;itr != itrEnd;++itr)
+		m_indexedVec[itr->second] = false;
+	m_indexMap.erase(itrBegin,itrEnd);
+}
+
+//give back the leases of a client which has gone, it does not give back any more
+void DEUShmArena::DropLeases(volatile INT_32* pLeases)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxArena);
+	if(m_pHeader == NULL)
+		return;
+	for(unsigned n = 0;n < m_pHeader->m_nEntryCount;n++)
+	{
+		for(INT_32 nLeases = RingExchange(&pLeases[n],0);nLeases > 0;nLeases--)
+			RingDecrement(&GetEntry(n)->m_nLeases);
+	}
+}
+
+ArenaEntry* DEUShmArena::GetEntry(unsigned nEntry) const
+{
+	return (ArenaEntry*)(m_pHeader + 1) + nEntry;
+}
+
+//the lease is counted for the client and for the entry
+void DEUShmArena::TakeLease(volatile INT_32* pLeases,unsigned nEntry)
+{
+	RingIncrement(&pLeases[nEntry]);
+	RingIncrement(&GetEntry(nEntry)->m_nLeases);
+}
+
+//room for nLength bytes at the head, the blocks in the way are dropped
+//and a leased one is stepped over
+bool DEUShmArena::Allocate(unsigned nLength,unsigned& nOffset)
+{
+	const unsigned nSize = getExtentSize(nLength);
+	for(unsigned nTry = 0;nTry < 4u;nTry++)
+	{
+		if(m_nHead + nSize > m_pHeader->m_nDataSize)
+			m_nHead = 0;
+
+		std::map<unsigned,unsigned>::iterator itr = m_extentMap.lower_bound(m_nHead);
+		if(itr != m_extentMap.begin())
+		{
+			std::map<unsigned,unsigned>::iterator itrPrev = itr;
+			--itrPrev;
+			if(itrPrev->first + getExtentSize(GetEntry(itrPrev->second)->m_nLength) > m_nHead)
+				itr = itrPrev;
+		}
+
+		bool bBlocked = false;
+		while(itr != m_extentMap.end() && itr->first < m_nHead + nSize)
+		{
+			const unsigned nEntry = itr->second;
+			ArenaEntry* pEntry = GetEntry(nEntry);
+			if(RingLoad(&pEntry->m_nLeases) != 0)
+			{
+				m_nHead = itr->first + getExtentSize(pEntry->m_nLength);
+				bBlocked = true;
+				break;
+			}
+			++itr;
+			Evict(nEntry);
+		}
+		if(!bBlocked)
+		{
+			nOffset = m_nHead;
+			m_nHead += nSize;
+			return true;
+		}
+	}
+	return false;
+}
+
+//free the entry of the oldest block nobody leases
+bool DEUShmArena::EvictOldest()
+{
+	std::map<unsigned,unsigned>::iterator itr = m_extentMap.lower_bound(m_nHead);
+	for(size_t n = 0;n < m_extentMap.size();n++,++itr)
+	{
+		if(itr == m_extentMap.end())
+			itr = m_extentMap.begin();
+		if(RingLoad(&GetEntry(itr->second)->m_nLeases) == 0)
+		{
+			Evict(itr->second);
+			return true;
+		}
+	}
+	return false;
+}
+
+void DEUShmArena::Evict(unsigned nEntry)
+{
+	m_extentMap.erase(GetEntry(nEntry)->m_nOffset);
+	if(m_indexedVec[nEntry])
+		m_indexMap.erase(m_keyVec[nEntry]);
+	m_indexedVec[nEntry] = false;
+	m_freeVec.push_back(nEntry);
+}
@@ -0,0 +1,207 @@
+#include "DEUShmRing.h"
+#include "DEUShmArena.h"
+#include "DEUSem.h"
+#include <sstream>
+#include <OpenThreads/ScopedLock>
+#if !defined (WIN32) && !defined (WIN64)
+#include <signal.h>
+#include <errno.h>
+#endif
+
+//the slots start behind the header, every slot on a cache line of its own
+const size_t g_nRingSlotOffset = 64u;
+
+static size_t getSlotStride()
+{
+	return (sizeof(RingSlot) + 63u) & ~(size_t)63u;
+}
+
+DEUShmRing::DEUShmRing(void)
+{
+	m_pHeader = NULL;
+	m_pSlots = m_pInline = NULL;
+	m_pLeases = NULL;
+	m_pArena = NULL;
+	m_nCursor = 0;
+}
+
+
+DEUShmRing::~DEUShmRing(void)
+{
+	Close();
+}
+
+//open the ring of a client
+bool DEUShmRing::Open(const std::string& strShared,DEUShmArena* pArena)
+{
+	m_strShared = strShared;
+
+	//1. map the ring, the client has written the magic last
+	if(!m_shm.AtShm(m_strShared + "Shm"))
+		return false;
+	char* pAddr = (char*)m_shm.GetShmAddr(m_strShared + "Shm");
+	m_pHeader = (RingHeader*)pAddr;
+	if(m_pHeader->m_nMagic != DEU_RING_MAGIC || m_pHeader->m_nSlotCount == 0)
+	{
+		Close();
+		return false;
+	}
+	m_pSlots = pAddr + g_nRingSlotOffset;
+	m_pInline = m_pSlots + m_pHeader->m_nSlotCount*getSlotStride();
+	//the lease table lies behind the inline payloads, a client without one is never leased a block
+	if(pArena != NULL && m_pHeader->m_nLeaseCount == DEU_ARENA_ENTRY_COUNT)
+	{
+		m_pLeases = (volatile INT_32*)(m_pInline + (size_t)m_pHeader->m_nSlotCount*m_pHeader->m_nInlineSize);
+		m_pArena = pArena;
+	}
+
+	//2. open the semaphores of the slots
+	for(unsigned n = 0;n < m_pHeader->m_nSlotCount;n++)
+	{
+		std::ostringstream oss;
+		oss<<m_strShared<<"EventSlot"<<n;
+		HANDLE hnd = DEUSem::OpenSem(oss.str());
+		if(hnd == NULL)
+		{
+			Close();
+			return false;
+		}
+		m_slotHndVec.push_back(hnd);
+	}
+	m_regionGenVec.assign(m_pHeader->m_nSlotCount,0u);
+	m_regionAddrVec.assign(m_pHeader->m_nSlotCount,(char*)NULL);
+
+	//3. the client looks for the server when a response is long in coming
+#if defined (WIN32) || defined (WIN64)
+	m_pHeader->m_nServerProcessID = (unsigned)GetCurrentProcessId();
+#else
+	m_pHeader->m_nServerProcessID = (unsigned)getpid();
+#endif
+	return true;
+}
+
+//close the ring, the client removes the semaphores and the shared memory
+void DEUShmRing::Close()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRegion);
+	//the leases the client has not given back go with the ring
+	if(m_pLeases != NULL)
+		m_pArena->DropLeases(m_pLeases);
+	m_pLeases = NULL;
+	m_pArena = NULL;
+
+	for(size_t n = 0;n < m_slotHndVec.size();n++)
+		DEUSem::CloseSem(m_slotHndVec[n],"");
+	m_slotHndVec.clear();
+
+	for(size_t n = 0;n < m_regionGenVec.size();n++)
+	{
+		if(m_regionGenVec[n] != 0)
+			m_shm.DtShm(GetRegionName((int)n,m_regionGenVec[n]));
+	}
+	m_regionGenVec.clear();
+	m_regionAddrVec.clear();
+
+	if(m_pHeader != NULL)
+		m_shm.DtShm(m_strShared + "Shm");
+	m_pHeader = NULL;
+	m_pSlots = m_pInline = NULL;
+}
+
+//whether the process of the client is still there
+bool DEUShmRing::IsClientAlive() const
+{
+	const unsigned nProcessID = m_pHeader->m_nProcessID;
+	if(nProcessID == 0)
+		return true;
+#if defined (WIN32) || defined (WIN64)
+	HANDLE hnd = OpenProcess(SYNCHRONIZE,FALSE,nProcessID);
+	if(hnd == NULL)
+		return GetLastError() == ERROR_ACCESS_DENIED;
+	const bool bAlive = (WaitForSingleObject(hnd,0) == WAIT_TIMEOUT);
+	CloseHandle(hnd);
+	return bAlive;
+#else
+	return kill((pid_t)nProcessID,0) == 0 || errno == EPERM;
+#endif
+}
+
+//take the next slot with a request
+int DEUShmRing::TakeRequest()
+{
+	const unsigned nSlotCount = m_pHeader->m_nSlotCount;
+	const unsigned nCursor = m_nCursor;
+	for(unsigned i = 0;i < nSlotCount;i++)
+	{
+		const int nSlot = (int)((nCursor + i) % nSlotCount);
+		if(RingCompareExchange(&GetSlot(nSlot)->m_nState,DEU_SLOT_BUSY,DEU_SLOT_REQUEST) == DEU_SLOT_REQUEST)
+		{
+			//the next search starts behind it, so no slot waits for another twice
+			m_nCursor = (unsigned)nSlot + 1;
+			return nSlot;
+		}
+	}
+	return -1;
+}
+
+void DEUShmRing::SetServerWaiting()
+{
+	RingExchange(&m_pHeader->m_nServerWaiting,1);
+}
+
+RingSlot* DEUShmRing::GetSlot(int nSlot) const
+{
+	return (RingSlot*)(m_pSlots + nSlot*getSlotStride());
+}
+
+//get the payload
+char* DEUShmRing::GetPayload(int nSlot,unsigned& nSize)
+{
+	RingSlot* pSlot = GetSlot(nSlot);
+	const unsigned nGen = pSlot->m_nRegion;
+	if(nGen != m_regionGenVec[nSlot])
+	{
+		//the client has grown or given back the region, the old one is not used any more
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRegion);
+		if(m_regionGenVec[nSlot] != 0)
+			m_shm.DtShm(GetRegionName(nSlot,m_regionGenVec[nSlot]));
+		m_regionGenVec[nSlot] = 0;
+		m_regionAddrVec[nSlot] = NULL;
+		if(nGen != 0)
+		{
+			const std::string strRegion = GetRegionName(nSlot,nGen);
+			if(!m_shm.AtShm(strRegion))
+			{
+				nSize = 0;
+				return NULL;
+			}
+			m_regionGenVec[nSlot] = nGen;
+			m_regionAddrVec[nSlot] = (char*)m_shm.GetShmAddr(strRegion);
+		}
+	}
+
+	if(nGen == 0)
+	{
+		nSize = m_pHeader->m_nInlineSize;
+		return m_pInline + (size_t)nSlot*nSize;
+	}
+	nSize = pSlot->m_nRegionSize;
+	return m_regionAddrVec[nSlot];
+}
+
+//hand the response to the client
+void DEUShmRing::Respond(int nSlot)
+{
+	RingSlot* pSlot = GetSlot(nSlot);
+	RingExchange(&pSlot->m_nState,DEU_SLOT_RESPONSE);
+	//the client is only woken when it sleeps
+	if(RingExchange(&pSlot->m_nClientWaiting,0) != 0)
+		DEUSem::ReleaseSem(m_slotHndVec[nSlot]);
+}
+
+std::string DEUShmRing::GetRegionName(int nSlot,unsigned nGen) const
+{
+	std::ostringstream oss;
+	oss<<m_strShared<<"Region"<<nSlot<<"_"<<nGen;
+	return oss.str();
+}
@@ -0,0 +1,683 @@
+#include "DEUSockServer.h"
+#include <sstream>
+#if !defined (WIN32) && !defined (WIN64)
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS          1033
+#define F_GET_SEALS          1034
+#define F_SEAL_SHRINK        0x0002
+#endif
+#define DEU_MFD_CLOEXEC      0x0001u
+#define DEU_MFD_ALLOW_SEALING 0x0002u
+#endif
+
+#if defined (WIN32) || defined (WIN64)
+//there is neither a unix domain socket nor a memfd, Start always fails
+static void closeFd(int nFd)
+{
+}
+
+static void shutdownSocket(int nSocket)
+{
+}
+
+static bool sendMessage(int nSocket,const SockHeader& head,const char* pPayload,int nMemFd)
+{
+	return false;
+}
+
+static bool recvAll(int nSocket,void* pBuffer,size_t nSize,int& nMemFd)
+{
+	return false;
+}
+
+static int createMemFd(unsigned nSize)
+{
+	return -1;
+}
+
+static char* mapMemFd(int nMemFd,unsigned& nSize)
+{
+	return NULL;
+}
+
+static void unmapMemFd(int nMemFd,char* pMapped,unsigned nSize)
+{
+}
+#else
+//the client runs as the same user or as root
+static bool checkPeer(int nSocket)
+{
+	struct ucred cred;
+	socklen_t nSize = sizeof(cred);
+	if(getsockopt(nSocket,SOL_SOCKET,SO_PEERCRED,&cred,&nSize) != 0)
+		return false;
+	return cred.uid == getuid() || cred.uid == 0;
+}
+
+static void closeFd(int nFd)
+{
+	close(nFd);
+}
+
+//the listening thread sees the connection break and drops it
+static void shutdownSocket(int nSocket)
+{
+	shutdown(nSocket,SHUT_RDWR);
+}
+
+//send the head and the payload behind it, the memfd goes along with the first bytes
+static bool sendMessage(int nSocket,const SockHeader& head,const char* pPayload,int nMemFd)
+{
+	struct iovec iov[2];
+	iov[0].iov_base = (void*)&head;
+	iov[0].iov_len = sizeof(head);
+	iov[1].iov_base = (void*)pPayload;
+	iov[1].iov_len = (pPayload != NULL) ? head.m_nLength : 0;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	if(nMemFd >= 0)
+	{
+		memset(control,0,sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);
+		pCmsg->cmsg_level = SOL_SOCKET;
+		pCmsg->cmsg_type = SCM_RIGHTS;
+		pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(pCmsg),&nMemFd,sizeof(int));
+	}
+
+	while(msg.msg_iovlen > 0)
+	{
+		const ssize_t nSent = sendmsg(nSocket,&msg,MSG_NOSIGNAL);
+		if(nSent < 0 && errno == EINTR)
+			continue;
+		if(nSent <= 0)
+			return false;
+
+		//the rest goes without the memfd
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+		size_t nLeft = (size_t)nSent;
+		while(msg.msg_iovlen > 0 && nLeft >= msg.msg_iov->iov_len)
+		{
+			nLeft -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if(msg.msg_iovlen > 0)
+		{
+			msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + nLeft;
+			msg.msg_iov->iov_len -= nLeft;
+		}
+	}
+	return true;
+}
+
+//receive nSize bytes, a memfd passed along with them is handed out in nMemFd
+static bool recvAll(int nSocket,void* pBuffer,size_t nSize,int& nMemFd)
+{
+	char* pData = (char*)pBuffer;
+	while(nSize > 0)
+	{
+		struct iovec iov;
+		iov.iov_base = pData;
+		iov.iov_len = nSize;
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr msg;
+		memset(&msg,0,sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		const ssize_t nRecv = recvmsg(nSocket,&msg,MSG_CMSG_CLOEXEC);
+		if(nRecv < 0 && errno == EINTR)
+			continue;
+		if(nRecv <= 0)
+			return false;
+
+		//only one memfd comes with a message, any other is closed
+		for(struct cmsghdr* pCmsg = CMSG_FIRSTHDR(&msg);pCmsg != NULL;pCmsg = CMSG_NXTHDR(&msg,pCmsg))
+		{
+			if(pCmsg->cmsg_level != SOL_SOCKET || pCmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			const size_t nFdCount = (pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for(size_t n = 0;n < nFdCount;n++)
+			{
+				int nFd = -1;
+				memcpy(&nFd,CMSG_DATA(pCmsg) + n*sizeof(int),sizeof(int));
+				if(nMemFd >= 0)
+					close(nFd);
+				else
+					nMemFd = nFd;
+			}
+		}
+		pData += nRecv;
+		nSize -= (size_t)nRecv;
+	}
+	return true;
+}
+
+//the memfd cannot shrink, so the peer mapping it never faults
+static int createMemFd(unsigned nSize)
+{
+#ifdef SYS_memfd_create
+	const int nMemFd = (int)syscall(SYS_memfd_create,"deudb",DEU_MFD_CLOEXEC|DEU_MFD_ALLOW_SEALING);
+	if(nMemFd < 0)
+		return -1;
+	if(ftruncate(nMemFd,nSize) != 0 || fcntl(nMemFd,F_ADD_SEALS,F_SEAL_SHRINK) != 0)
+	{
+		close(nMemFd);
+		return -1;
+	}
+	return nMemFd;
+#else
+	return -1;
+#endif
+}
+
+//map the whole memfd, nSize is its size, a memfd which a client could shrink is refused
+static char* mapMemFd(int nMemFd,unsigned& nSize)
+{
+	struct stat st;
+	if((fcntl(nMemFd,F_GET_SEALS) & F_SEAL_SHRINK) == 0 || fstat(nMemFd,&st) != 0)
+		return NULL;
+	if(st.st_size <= 0 || st.st_size >= 0x80000000LL)
+		return NULL;
+	void* pAddr = mmap(NULL,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,nMemFd,0);
+	if(pAddr == MAP_FAILED)
+		return NULL;
+	nSize = (unsigned)st.st_size;
+	return (char*)pAddr;
+}
+
+static void unmapMemFd(int nMemFd,char* pMapped,unsigned nSize)
+{
+	munmap(pMapped,nSize);
+	close(nMemFd);
+}
+
+static bool makeAddress(const std::string& strSocket,struct sockaddr_un& addr)
+{
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strSocket.length() >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path,strSocket.c_str());
+	return true;
+}
+
+//whether a server still listens on the socket
+static bool isListening(const struct sockaddr_un& addr)
+{
+	const int nSocket = socket(AF_UNIX,SOCK_STREAM,0);
+	if(nSocket < 0)
+		return false;
+	const bool bListening = (connect(nSocket,(const struct sockaddr*)&addr,sizeof(addr)) == 0);
+	close(nSocket);
+	return bListening;
+}
+#endif
+
+//the writes do not send the block back
+static bool hasResponsePayload(int nRequestType)
+{
+	return nRequestType != DEU_UPDATE_DATA && nRequestType != DEU_WRITE_DATA &&
+		nRequestType != DEU_REPLACE_DATA && nRequestType != DEU_WRITE_BATCH;
+}
+
+DEUSockConnection::DEUSockConnection(DEUSockServer* pServer,int nSocket)
+{
+	m_pServer = pServer;
+	m_nSocket = nSocket;
+	memset(&m_slot,0,sizeof(m_slot));
+	m_nRequestType = DEU_FAIL;
+	m_nRequestLength = 0;
+	m_inlineVec.resize(DEU_SOCK_INLINE_SIZE);
+	m_nMemFd = -1;
+	m_pMapped = NULL;
+	m_nMappedSize = 0;
+}
+
+
+DEUSockConnection::~DEUSockConnection(void)
+{
+	FreePayload();
+	closeFd(m_nSocket);
+}
+
+int DEUSockConnection::GetSocket() const
+{
+	return m_nSocket;
+}
+
+//read the next request
+bool DEUSockConnection::Receive()
+{
+	//1. the head, it may come with the memfd of the payload
+	SockHeader head;
+	int nMemFd = -1;
+	if(!recvAll(m_nSocket,&head,sizeof(head),nMemFd) || head.m_nMagic != DEU_SOCK_MAGIC || head.m_nLength >= 0x80000000u)
+	{
+		if(nMemFd >= 0)
+			closeFd(nMemFd);
+		return false;
+	}
+
+	//2. the payload, in the memfd or behind the head
+	if((head.m_nFlags & DEU_SOCK_MEMFD) != 0)
+	{
+		if(nMemFd < 0 || !MapPayload(nMemFd) || head.m_nLength > m_nMappedSize)
+			return false;
+	}
+	else
+	{
+		if(nMemFd >= 0)
+			closeFd(nMemFd);
+		char* pPayload = ReservePayload(head.m_nLength,0);
+		int nExtraFd = -1;
+		if(pPayload == NULL || (head.m_nLength > 0 && !recvAll(m_nSocket,pPayload,head.m_nLength,nExtraFd)))
+			return false;
+		if(nExtraFd >= 0)
+			closeFd(nExtraFd);
+	}
+
+	//3. the request goes into the slot as if it had come through a ring
+	m_slot.m_nType = m_nRequestType = head.m_nType;
+	m_slot.m_nVersion = head.m_nVersion;
+	m_slot.m_nHighBit = head.m_nHighBit;
+	m_slot.m_nMidBit = head.m_nMidBit;
+	m_slot.m_nLowBit = head.m_nLowBit;
+	m_slot.m_nOffset = head.m_nOffset;
+	m_slot.m_nCount = head.m_nCount;
+	m_slot.m_nLength = m_nRequestLength = head.m_nLength;
+	RingExchange(&m_slot.m_nState,DEU_SLOT_REQUEST);
+	return true;
+}
+
+int DEUSockConnection::TakeRequest()
+{
+	if(RingCompareExchange(&m_slot.m_nState,DEU_SLOT_BUSY,DEU_SLOT_REQUEST) == DEU_SLOT_REQUEST)
+		return 0;
+	return -1;
+}
+
+void DEUSockConnection::SetServerWaiting()
+{
+}
+
+RingSlot* DEUSockConnection::GetSlot(int nSlot) const
+{
+	return (RingSlot*)&m_slot;
+}
+
+char* DEUSockConnection::GetPayload(int nSlot,unsigned& nSize)
+{
+	if(m_pMapped != NULL)
+	{
+		nSize = m_nMappedSize;
+		return m_pMapped;
+	}
+	nSize = (unsigned)m_inlineVec.size();
+	return &m_inlineVec[0];
+}
+
+//hand the response to the client
+void DEUSockConnection::Respond(int nSlot)
+{
+	//1. the response has not fitted, the request is carried out again with a payload
+	//   big enough, the worker finds it once more before it sleeps
+	if(m_slot.m_nType == DEU_NEED_SPACE)
+	{
+		if(ReservePayload(m_slot.m_nLength,m_nRequestLength) != NULL)
+		{
+			m_slot.m_nType = m_nRequestType;
+			m_slot.m_nLength = m_nRequestLength;
+			RingExchange(&m_slot.m_nState,DEU_SLOT_REQUEST);
+			return;
+		}
+		m_slot.m_nType = DEU_FAIL;
+		m_slot.m_nLength = 0;
+	}
+
+	//2. send the response, a client which has gone is dropped by the listening thread
+	if(!Send())
+		shutdownSocket(m_nSocket);
+
+	//3. a big payload is not kept for the next request
+	if(m_nMappedSize > DEU_RING_KEEP_SIZE)
+		FreePayload();
+	if(m_inlineVec.size() > DEU_SOCK_INLINE_SIZE)
+		std::vector<char>(DEU_SOCK_INLINE_SIZE).swap(m_inlineVec);
+
+	RingExchange(&m_slot.m_nState,DEU_SLOT_FREE);
+	m_pServer->Watch(this);
+}
+
+bool DEUSockConnection::Send()
+{
+	SockHeader head;
+	memset(&head,0,sizeof(head));
+	head.m_nMagic = DEU_SOCK_MAGIC;
+	head.m_nType = m_slot.m_nType;
+	head.m_nVersion = m_slot.m_nVersion;
+	head.m_nHighBit = m_slot.m_nHighBit;
+	head.m_nMidBit = m_slot.m_nMidBit;
+	head.m_nLowBit = m_slot.m_nLowBit;
+	head.m_nOffset = m_slot.m_nOffset;
+	head.m_nCount = m_slot.m_nCount;
+	head.m_nLength = hasResponsePayload(m_nRequestType) ? m_slot.m_nLength : 0u;
+
+	unsigned nSize = 0;
+	const char* pPayload = GetPayload(0,nSize);
+	if(head.m_nLength > nSize)
+	{
+		head.m_nType = DEU_FAIL;
+		head.m_nLength = 0;
+	}
+
+	//a payload bigger than the inline size goes in its memfd
+	if(head.m_nLength > DEU_SOCK_INLINE_SIZE && m_pMapped != NULL)
+	{
+		head.m_nFlags = DEU_SOCK_MEMFD;
+		return sendMessage(m_nSocket,head,NULL,m_nMemFd);
+	}
+	return sendMessage(m_nSocket,head,pPayload,-1);
+}
+
+//get the payload, grow it when it is too small
+char* DEUSockConnection::ReservePayload(unsigned nLength,unsigned nKeep)
+{
+	if(m_pMapped == NULL && nLength <= m_inlineVec.size())
+		return &m_inlineVec[0];
+	if(m_pMapped != NULL && nLength <= m_nMappedSize)
+		return m_pMapped;
+
+	//the memfd grows to a power of two, so a connection is seldom grown twice
+	unsigned nSize = DEU_SOCK_INLINE_SIZE * 2u;
+	while(nSize < nLength && nSize < 0x80000000u)
+		nSize *= 2u;
+	if(nSize < nLength)
+		nSize = nLength;
+
+	unsigned nOldSize = 0;
+	char* pOld = GetPayload(0,nOldSize);
+	const int nMemFd = createMemFd(nSize);
+	if(nMemFd >= 0)
+	{
+		unsigned nMappedSize = 0;
+		char* pMapped = mapMemFd(nMemFd,nMappedSize);
+		if(pMapped == NULL)
+		{
+			closeFd(nMemFd);
+			return NULL;
+		}
+		if(nKeep > 0)
+			memcpy(pMapped,pOld,nKeep < nOldSize ? nKeep : nOldSize);
+		FreePayload();
+		m_nMemFd = nMemFd;
+		m_pMapped = pMapped;
+		m_nMappedSize = nMappedSize;
+		return pMapped;
+	}
+
+	//without a memfd the payload grows on the heap and goes through the socket
+	if(m_pMapped != NULL)
+		return NULL;
+	m_inlineVec.resize(nSize);
+	return &m_inlineVec[0];
+}
+
+//the memfd of the client becomes the payload
+bool DEUSockConnection::MapPayload(int nMemFd)
+{
+	unsigned nSize = 0;
+	char* pMapped = mapMemFd(nMemFd,nSize);
+	if(pMapped == NULL)
+	{
+		closeFd(nMemFd);
+		return false;
+	}
+	FreePayload();
+	m_nMemFd = nMemFd;
+	m_pMapped = pMapped;
+	m_nMappedSize = nSize;
+	return true;
+}
+
+void DEUSockConnection::FreePayload()
+{
+	if(m_pMapped == NULL)
+		return;
+	unmapMemFd(m_nMemFd,m_pMapped,m_nMappedSize);
+	m_nMemFd = -1;
+	m_pMapped = NULL;
+	m_nMappedSize = 0;
+}
+
+void DEUSockServer::ListenThread::run(void)
+{
+	m_pServer->Listen();
+}
+
+DEUSockServer::DEUSockServer(void)
+{
+	m_pPool = NULL;
+	m_nListen = m_nPoll = -1;
+	m_pThread = NULL;
+	m_bStop = true;
+	m_nNextConnection = 0;
+}
+
+
+DEUSockServer::~DEUSockServer(void)
+{
+	Stop();
+}
+
+void DEUSockServer::WakeWorker()
+{
+	m_pPool->Wake();
+}
+
+#if defined (WIN32) || defined (WIN64)
+bool DEUSockServer::Start(const std::string& strSocket,DEUWorkerPool* pPool)
+{
+	return false;
+}
+
+void DEUSockServer::Stop()
+{
+}
+
+void DEUSockServer::Watch(DEUSockConnection* pConnection)
+{
+}
+
+void DEUSockServer::Listen()
+{
+}
+
+void DEUSockServer::Accept()
+{
+}
+
+void DEUSockServer::Drop(int nSocket)
+{
+}
+#else
+//listen on the socket
+bool DEUSockServer::Start(const std::string& strSocket,DEUWorkerPool* pPool)
+{
+	m_strSocket = strSocket;
+	m_pPool = pPool;
+	struct sockaddr_un addr;
+	if(!makeAddress(m_strSocket,addr))
+		return false;
+
+	//1. bind the socket, one left behind by a server which has died is removed,
+	//   one on which a server still listens is not
+	m_nListen = socket(AF_UNIX,SOCK_STREAM,0);
+	if(m_nListen < 0)
+		return false;
+	fcntl(m_nListen,F_SETFD,FD_CLOEXEC);
+	if(bind(m_nListen,(struct sockaddr*)&addr,sizeof(addr)) != 0)
+	{
+		if(errno != EADDRINUSE || isListening(addr) || unlink(m_strSocket.c_str()) != 0 ||
+			bind(m_nListen,(struct sockaddr*)&addr,sizeof(addr)) != 0)
+		{
+			closeFd(m_nListen);
+			m_nListen = -1;
+			return false;
+		}
+	}
+	chmod(m_strSocket.c_str(),S_IRUSR|S_IWUSR);
+
+	//2. listen and watch it
+	m_nPoll = epoll_create(DEU_SOCK_BACKLOG);
+	struct epoll_event ev;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = m_nListen;
+	if(listen(m_nListen,DEU_SOCK_BACKLOG) != 0 || m_nPoll < 0 || epoll_ctl(m_nPoll,EPOLL_CTL_ADD,m_nListen,&ev) != 0)
+	{
+		Stop();
+		return false;
+	}
+	fcntl(m_nPoll,F_SETFD,FD_CLOEXEC);
+
+	//3. start the thread which accepts the connections and reads the requests
+	m_bStop = false;
+	m_pThread = new ListenThread(this);
+	if(m_pThread->startThread() != 0)
+	{
+		delete m_pThread;
+		m_pThread = NULL;
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+//stop listening and drop all the connections
+void DEUSockServer::Stop()
+{
+	m_bStop = true;
+	if(m_pThread != NULL)
+	{
+		m_pThread->join();
+		delete m_pThread;
+		m_pThread = NULL;
+	}
+
+	while(!m_connectionMap.empty())
+		Drop(m_connectionMap.begin()->first);
+
+	if(m_nListen >= 0)
+	{
+		closeFd(m_nListen);
+		unlink(m_strSocket.c_str());
+	}
+	if(m_nPoll >= 0)
+		closeFd(m_nPoll);
+	m_nListen = m_nPoll = -1;
+}
+
+//watch the connection for its next request
+void DEUSockServer::Watch(DEUSockConnection* pConnection)
+{
+	struct epoll_event ev;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN|EPOLLONESHOT;
+	ev.data.fd = pConnection->GetSocket();
+	epoll_ctl(m_nPoll,EPOLL_CTL_MOD,pConnection->GetSocket(),&ev);
+}
+
+//accept the connections and read their requests until the server stops
+void DEUSockServer::Listen()
+{
+	struct epoll_event eventVec[DEU_SOCK_BACKLOG];
+	while(!m_bStop)
+	{
+		const int nCount = epoll_wait(m_nPoll,eventVec,DEU_SOCK_BACKLOG,200);
+		for(int n = 0;n < nCount;n++)
+		{
+			const int nSocket = eventVec[n].data.fd;
+			if(nSocket == m_nListen)
+			{
+				Accept();
+				continue;
+			}
+			if(m_connectionMap.find(nSocket) == m_connectionMap.end())
+				continue;
+
+			//the connection is not watched again until its response has been sent
+			if(!m_connectionMap[nSocket].second->Receive())
+			{
+				Drop(nSocket);
+				continue;
+			}
+			WakeWorker();
+		}
+	}
+}
+
+void DEUSockServer::Accept()
+{
+	const int nSocket = accept(m_nListen,NULL,NULL);
+	if(nSocket < 0)
+		return;
+	fcntl(nSocket,F_SETFD,FD_CLOEXEC);
+	if(!checkPeer(nSocket))
+	{
+		closeFd(nSocket);
+		return;
+	}
+
+	//a request which has begun comes in soon, a client which stops in the middle is dropped
+	struct timeval tv;
+	tv.tv_sec = DEU_SOCK_RECV_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(nSocket,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	setsockopt(nSocket,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+
+	//the workers serve the connection before its first request can be read
+	std::ostringstream oss;
+	oss<<"Sock"<<m_nNextConnection++;
+	OpenSP::sp<DEUSockConnection> pConnection = new DEUSockConnection(this,nSocket);
+	m_connectionMap[nSocket] = std::make_pair(oss.str(),pConnection);
+	m_pPool->AddRing(oss.str(),pConnection.get());
+
+	struct epoll_event ev;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN|EPOLLONESHOT;
+	ev.data.fd = nSocket;
+	if(epoll_ctl(m_nPoll,EPOLL_CTL_ADD,nSocket,&ev) != 0)
+		Drop(nSocket);
+}
+
+//a worker still serving the connection keeps it until it has done
+void DEUSockServer::Drop(int nSocket)
+{
+	ConnectionMap::iterator itr = m_connectionMap.find(nSocket);
+	if(itr == m_connectionMap.end())
+		return;
+	epoll_ctl(m_nPoll,EPOLL_CTL_DEL,nSocket,NULL);
+	m_pPool->RemoveRing(itr->second.first);
+	m_connectionMap.erase(itr);
+}
+#endif
@@ -0,0 +1,175 @@
+#include "DEUWorkerPool.h"
+#include "DEUSem.h"
+#include <OpenThreads/ScopedLock>
+
+void DEUWorkerPool::WorkerThread::run(void)
+{
+	m_pPool->Work();
+}
+
+DEUWorkerPool::DEUWorkerPool(void)
+{
+	m_nNextRing = 0;
+	m_pProc = NULL;
+	m_workHnd = NULL;
+	m_bStop = true;
+}
+
+
+DEUWorkerPool::~DEUWorkerPool(void)
+{
+	Stop();
+}
+
+//start the workers
+bool DEUWorkerPool::Start(const std::string& strWorkSem,unsigned nWorkerCount,RequestProc pProc)
+{
+	//1. create the semaphore, the clients open it when they register
+	m_strWorkSem = strWorkSem;
+	m_workHnd = DEUSem::CreateSem(m_strWorkSem,0);
+	if(m_workHnd == NULL)
+		return false;
+
+	//2. start the workers
+	m_pProc = pProc;
+	m_bStop = false;
+	for(unsigned n = 0;n < nWorkerCount;n++)
+	{
+		WorkerThread* pWorker = new WorkerThread(this);
+		if(pWorker->startThread() != 0)
+		{
+			delete pWorker;
+			break;
+		}
+		m_workerVec.push_back(pWorker);
+	}
+	if(m_workerVec.empty())
+	{
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+//stop the workers
+void DEUWorkerPool::Stop()
+{
+	//the semaphore only counts one wake, every worker wakes the next one on its way out
+	m_bStop = true;
+	if(!m_workerVec.empty())
+		DEUSem::ReleaseSem(m_workHnd);
+	for(size_t n = 0;n < m_workerVec.size();n++)
+	{
+		m_workerVec[n]->join();
+		delete m_workerVec[n];
+	}
+	m_workerVec.clear();
+
+	if(m_workHnd != NULL)
+		DEUSem::CloseSem(m_workHnd,m_strWorkSem);
+	m_workHnd = NULL;
+
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRing);
+	m_ringVec.clear();
+}
+
+void DEUWorkerPool::AddRing(const std::string& strShared,DEUChannel* pRing)
+{
+	//the first request of the client wakes a worker
+	pRing->SetServerWaiting();
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRing);
+	m_ringVec.push_back(std::make_pair(strShared,OpenSP::sp<DEUChannel>(pRing)));
+}
+
+void DEUWorkerPool::RemoveRing(const std::string& strShared)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRing);
+	for(RingVec::iterator itr = m_ringVec.begin();itr != m_ringVec.end();++itr)
+	{
+		if(itr->first == strShared)
+		{
+			m_ringVec.erase(itr);
+			break;
+		}
+	}
+}
+
+//wake a worker
+void DEUWorkerPool::Wake()
+{
+	//a worker counts itself before it looks for a request the last time
+	if((unsigned)m_nSleeping != 0u)
+		DEUSem::ReleaseSem(m_workHnd);
+}
+
+//serve the requests until the pool stops
+void DEUWorkerPool::Work()
+{
+	unsigned nIdle = 0;
+	bool bWoken = false;
+	while(!m_bStop)
+	{
+		OpenSP::sp<DEUChannel> pRing;
+		int nSlot = -1;
+		if(!FindRequest(pRing,nSlot))
+		{
+			//the requests of busy clients come while the worker spins
+			if(++nIdle < DEU_RING_SPIN_COUNT)
+			{
+				OpenThreads::Thread::YieldCurrentThread();
+				continue;
+			}
+
+			//say that it sleeps and look once more, a request posted before
+			//the client could see the flag would not wake it
+			nIdle = 0;
+			++m_nSleeping;
+			SetServerWaiting();
+			if(!FindRequest(pRing,nSlot))
+			{
+				DEUSem::WaitSem(m_workHnd);
+				--m_nSleeping;
+				bWoken = true;
+				continue;
+			}
+			--m_nSleeping;
+		}
+
+		//the wake of many requests is counted once, so the next worker is woken too
+		nIdle = 0;
+		if(bWoken && (unsigned)m_nSleeping != 0u)
+			DEUSem::ReleaseSem(m_workHnd);
+		bWoken = false;
+
+		m_pProc(pRing.get(),nSlot);
+		pRing->Respond(nSlot);
+	}
+	DEUSem::ReleaseSem(m_workHnd);
+}
+
+//take one request of the next ring which has one
+bool DEUWorkerPool::FindRequest(OpenSP::sp<DEUChannel>& pRing,int& nSlot)
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRing);
+	const unsigned nRingCount = (unsigned)m_ringVec.size();
+	for(unsigned i = 0;i < nRingCount;i++)
+	{
+		const unsigned nRing = (m_nNextRing + i) % nRingCount;
+		nSlot = m_ringVec[nRing].second->TakeRequest();
+		if(nSlot >= 0)
+		{
+			//the next search starts at the ring behind it
+			m_nNextRing = nRing + 1;
+			pRing = m_ringVec[nRing].second;
+			return true;
+		}
+	}
+	return false;
+}
+
+void DEUWorkerPool::SetServerWaiting()
+{
+	OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRing);
+	for(size_t n = 0;n < m_ringVec.size();n++)
+		m_ringVec[n].second->SetServerWaiting();
+}
@@ -1,399 +1,314 @@
 #include <algorithm>
 #include "DEUShareMem.h"
 #include "DEUSem.h"
+#include "DEUShmRing.h"
+#include "DEUWorkerPool.h"
+#include "DEUShmArena.h"
+#include "DEUSockServer.h"
 #include "Common/crc.h"
 #include <sstream>
+#ifndef WIN32
+#include <signal.h>
+#endif
 
 DEUShareMem					 g_shm;                   //DEUShareMem object
 std::vector<std::string>	 g_shmVec;                //shared memory vector
 std::map<std::string,HANDLE> g_eventClientMap;        //client semaphore map
-std::map<std::string,HANDLE> g_eventSvrMap;           //server semaphore map
-std::map<std::string,HANDLE> g_threadMap;             //thread handle map
+DEUWorkerPool                g_workerPool;            //serves the request rings of all the clients
+DEUShmArena                  g_arena;                 //the hot blocks shared with all the clients
+std::map<std::string,OpenSP::sp<DEUShmRing> > g_clientRingMap; //the rings of the clients, they go before the arena
+DEUSockServer                g_sockServer;            //serves the clients on the socket beside the database
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::string                  g_strShmName    = "";    //shared memory name
 std::string					 g_strDBPath     = "";    //DEUDB path
 std::string					 g_strRegShmName = "";    //reg and unreg shared memory name
 std::string                  g_strRegSem     = "";    //reg sem name
 std::string                  g_strSvrRegSem  = "";    //server reg sem name
+std::string                  g_strWorkSem    = "";    //the workers sleep on it, the clients release it
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 HANDLE						 g_regHnd        = NULL;  //reg and unreg handle
 HANDLE	                     g_partiHnd      = NULL;  //particular semaphore to get whether server is started for client
 HANDLE	                     g_svrRegHnd     = NULL;
 bool                         g_bClearFlag    = false; //clear deudb flag
 
-//thread function
-#ifdef WIN32
-unsigned __stdcall ThreadProc(LPVOID lpParam)
-#else
-void* ThreadProc(void* lpParam)
-#endif
+//copy a response into the payload of the slot, DEU_NEED_SPACE tells the client how much it needs
+static void WriteResponse(DEUChannel* pRing,int nSlot,const void* pData,unsigned nLength)
 {
-	if(lpParam == NULL)
-		exit(0);
-	//1. get variables
-	std::string strShared = (char*)lpParam;
-	std::string strShm = strShared + "Shm";
-	std::string strClient = strShared + "EventClient";
-	std::string strSvr = strShared + "EventServer";
-	//2. get client semaphore
-	std::map<std::string,HANDLE>::iterator itr = g_eventClientMap.find(strClient);
-	if(itr == g_eventClientMap.end())
-		exit(0);
-	HANDLE clientHnd = itr->second;
-	//3. get server semaphore
-	itr = g_eventSvrMap.find(strSvr);
-	if(itr == g_eventSvrMap.end())
-		exit(0);
-	HANDLE serverHnd = itr->second;
-	//4. make error shared object
-	ShareObj errObj;
-	errObj.m_nType = -1;
-	//5. at shm and wait server semaphore
-	g_shm.AtShm(strShm);
-	DEUSem::WaitSem(serverHnd);
-	//6. loop to process data
-	while(1)
+	RingSlot* pSlot = pRing->GetSlot(nSlot);
+	unsigned nSize = 0;
+	char* pPayload = pRing->GetPayload(nSlot,nSize);
+	if(pPayload == NULL)
+	{
+		pSlot->m_nType = DEU_FAIL;
+		return;
+	}
+	pSlot->m_nLength = nLength;
+	if(nLength > nSize)
+	{
+		pSlot->m_nType = DEU_NEED_SPACE;
+		return;
+	}
+	if(nLength > 0)
+		memcpy(pPayload,pData,nLength);
+}
+
+//the IDs at the head of the payload of a batch request, the place behind them is returned
+static const char* ReadBatchIDs(DEUChannel* pRing,int nSlot,std::vector<ID>& idVec)
+{
+	RingSlot* pSlot = pRing->GetSlot(nSlot);
+	unsigned nSize = 0;
+	const char* pPayload = pRing->GetPayload(nSlot,nSize);
+	const UINT_64 nIDLength = (UINT_64)pSlot->m_nCount*sizeof(ID);
+	if(pPayload == NULL || pSlot->m_nLength > nSize || nIDLength > pSlot->m_nLength)
+		return NULL;
+	const ID* pIDs = (const ID*)pPayload;
+	idVec.assign(pIDs,pIDs + pSlot->m_nCount);
+	return pPayload + nIDLength;
+}
+
+//copy the lengths of all the IDs and then the blocks found into the payload of the slot
+static void WriteBlocksResponse(DEUChannel* pRing,int nSlot,const std::vector<OpenSP::sp<deudb::IBlockBuffer> >& bufferVec,const std::vector<bool>& foundVec)
+{
+	RingSlot* pSlot = pRing->GetSlot(nSlot);
+	const unsigned nCount = (unsigned)foundVec.size();
+	UINT_64 nLength = (UINT_64)nCount*sizeof(unsigned);
+	for(unsigned n = 0;n < nCount;n++)
+	{
+		if(foundVec[n] && bufferVec[n].valid())
+			nLength += bufferVec[n]->getLength();
+	}
+	unsigned nSize = 0;
+	char* pPayload = pRing->GetPayload(nSlot,nSize);
+	if(pPayload == NULL || nLength >= 0x80000000u)
+	{
+		pSlot->m_nType = DEU_FAIL;
+		return;
+	}
+	pSlot->m_nLength = (unsigned)nLength;
+	if(nLength > nSize)
+	{
+		pSlot->m_nType = DEU_NEED_SPACE;
+		return;
+	}
+
+	unsigned* pLengths = (unsigned*)pPayload;
+	char* pData = (char*)(pLengths + nCount);
+	unsigned nFound = 0;
+	for(unsigned n = 0;n < nCount;n++)
 	{
-		std::vector<std::string>::iterator itr = find(g_shmVec.begin(),g_shmVec.end(),strShared);
-		if(itr == g_shmVec.end())
+		if(!foundVec[n])
 		{
-			DEUSem::CloseSem(clientHnd,strClient);
-			g_eventClientMap.erase(strClient);
-			DEUSem::CloseSem(serverHnd,strSvr);
-			g_eventClientMap.erase(strSvr);
-#ifdef WIN32
-			std::map<std::string,HANDLE>::iterator itrThread = g_threadMap.find(strShared);
-			if(itrThread != g_threadMap.end())
-				CloseHandle(itrThread->second);
-			return 1;
-#else
-			return (void*)1;
-#endif
+			pLengths[n] = DEU_BLOCK_MISSING;
+			continue;
 		}
-		//share objs
-		ShareObj readObj;
-		//read shared memory
-		if(!g_shm.ReadInfo(strShm,readObj))
+		const unsigned nBlock = bufferVec[n].valid() ? bufferVec[n]->getLength() : 0u;
+		pLengths[n] = nBlock;
+		if(nBlock > 0)
+			memcpy(pData,bufferVec[n]->getData(),nBlock);
+		pData += nBlock;
+		nFound++;
+	}
+	pSlot->m_nCount = nFound;
+}
+
+//process the request in a slot, the response is written into the same slot
+static void ProcessRequest(DEUChannel* pRing,int nSlot)
+{
+	RingSlot* pSlot = pRing->GetSlot(nSlot);
+	const ID id(pSlot->m_nHighBit,pSlot->m_nMidBit,pSlot->m_nLowBit);
+	switch(pSlot->m_nType)
+	{
+	case DEU_READ_DATA://read data
 		{
-			g_shm.WriteInfo(strShm,errObj);
-			DEUSem::ReleaseSem(clientHnd);
+			//the block is shared with the cache of DEUDB, it is only copied into the payload
+			OpenSP::sp<deudb::IBlockBuffer> pBlock;
+			if(!g_shm.readBlock(id,pBlock,pSlot->m_nVersion))
+				pSlot->m_nType = DEU_FAIL;
+			else if(!pBlock.valid())
+				WriteResponse(pRing,nSlot,NULL,0);
+			else
+				WriteResponse(pRing,nSlot,pBlock->getData(),pBlock->getLength());
 		}
-		else
+		break;
+	case DEU_READ_SHARED://read data in place
 		{
-			switch(readObj.m_nType)
+			//a block in the arena is leased to the client, it reads it where it is
+			const int nEntry = g_arena.Lease(pRing->GetLeases(),id,pSlot->m_nVersion);
+			if(nEntry >= 0)
 			{
-			case DEU_READ_DATA://read data
-				{
-					//read block
-					void* pBuffer = NULL;
-					unsigned nLength = -1;
-					if(!g_shm.readBlock(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit),pBuffer,nLength,readObj.m_nVersion))
-						g_shm.WriteInfo(strShm,errObj);
-					else if(pBuffer && nLength > 0u)
-					{
-						//loop
-						unsigned nStart = 0,nEnd = 0;
-						int nCount = nLength / readObj.m_shmSize;
-						//write shared info
-						for(int i = 0;i <= nCount;i++)
-						{
-							//write shared memory
-							nStart = i*readObj.m_shmSize;
-							nEnd = nLength < (i+1)*readObj.m_shmSize ? nLength : (i+1)*readObj.m_shmSize;
-							ShareObj outObj;
-							g_shm.GetObj((char*)pBuffer,nLength,nStart,nEnd - 1,outObj);
-							g_shm.WriteInfo(strShm,outObj);
-
-							if(i < nCount)
-							{
-								DEUSem::ReleaseSem(clientHnd);
-								DEUSem::WaitSem(serverHnd);
-							}
-						}
-						g_shm.freeMemory(pBuffer);
-					}
-				}
+				pSlot->m_nOffset = (unsigned)nEntry;
 				break;
-			case DEU_UPDATE_DATA://update data
-				{
-					std::vector<unsigned char> vecBuf(readObj.m_nTotalLength);
-
-                    if(readObj.m_nTotalLength > 0)
-					{
-						//copy memory
-						size_t sz = readObj.m_endLength - readObj.m_startLength + 1;
-						memcpy(vecBuf.data(),readObj.m_vecData.data(),sz);
-						int nCount = readObj.m_nTotalLength / readObj.m_shmSize;
-						//get other data
-						for(int i = 1;i <= nCount;i++)
-						{
-							DEUSem::ReleaseSem(clientHnd);
-							DEUSem::WaitSem(serverHnd);
-							if(!g_shm.ReadInfo(strShm,readObj))
-							{
-								g_shm.WriteInfo(strShm,errObj);
-								break;
-							}
-							sz = readObj.m_endLength - readObj.m_startLength + 1;
-							memcpy(vecBuf.data()+readObj.m_startLength,readObj.m_vecData.data(),sz);
-						}
-					}
-					//update block
-					if(!g_shm.updateBlock(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit),vecBuf.data(),vecBuf.size()))
-						g_shm.WriteInfo(strShm,errObj);
-				}
+			}
+			const unsigned nWriteCount = g_arena.GetWriteCount();
+			OpenSP::sp<deudb::IBlockBuffer> pBlock;
+			if(!g_shm.readBlock(id,pBlock,pSlot->m_nVersion))
+			{
+				pSlot->m_nType = DEU_FAIL;
 				break;
-            case DEU_REPLACE_DATA://replace data
-                {
-                    std::vector<unsigned char> vecBuf(readObj.m_nTotalLength);
-
-                    if(readObj.m_nTotalLength > 0)
-                    {
-                        //copy memory
-                        size_t sz = readObj.m_endLength - readObj.m_startLength + 1;
-                        memcpy(vecBuf.data(),readObj.m_vecData.data(),sz);
-                        int nCount = readObj.m_nTotalLength / readObj.m_shmSize;
-                        //get other data
-                        for(int i = 1;i <= nCount;i++)
-                        {
-                            DEUSem::ReleaseSem(clientHnd);
-                            DEUSem::WaitSem(serverHnd);
-                            if(!g_shm.ReadInfo(strShm,readObj))
-                            {
-                                g_shm.WriteInfo(strShm,errObj);
-                                break;
-                            }
-                            sz = readObj.m_endLength - readObj.m_startLength + 1;
-                            memcpy(vecBuf.data()+readObj.m_startLength,readObj.m_vecData.data(),sz);
-                        }
-                    }
-                    //update block
-                    if(!g_shm.replaceBlock(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit),vecBuf.data(),vecBuf.size()))
-                        g_shm.WriteInfo(strShm,errObj);
-                }
-                break;
-			case DEU_WRITE_DATA://write data
-				{
-					std::vector<unsigned char> vecBuf(readObj.m_nTotalLength);
-					//copy memory
-					size_t sz = readObj.m_endLength - readObj.m_startLength+1;
-					memcpy(vecBuf.data(),readObj.m_vecData.data(),sz);
-					int nCount = readObj.m_nTotalLength / readObj.m_shmSize;
-					//get other data
-					for(int i = 1;i <= nCount;i++)
-					{
-						DEUSem::ReleaseSem(clientHnd);
-						DEUSem::WaitSem(serverHnd);
-						if(!g_shm.ReadInfo(strShm,readObj))
-						{
-							g_shm.WriteInfo(strShm,errObj);
-							break;
-						}
-						sz = readObj.m_endLength - readObj.m_startLength + 1;
-						memcpy(vecBuf.data()+readObj.m_startLength,readObj.m_vecData.data(),sz);
-						
-					}
-					//update block
-					if(!g_shm.addBlock(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit),vecBuf.data(),vecBuf.size()))
-						g_shm.WriteInfo(strShm,errObj);
-				}
+			}
+			const unsigned nLength = pBlock.valid() ? pBlock->getLength() : 0u;
+			const int nNewEntry = g_arena.Publish(pRing->GetLeases(),id,pSlot->m_nVersion,nLength > 0 ? pBlock->getData() : NULL,nLength,nWriteCount);
+			if(nNewEntry >= 0)
+			{
+				pSlot->m_nOffset = (unsigned)nNewEntry;
 				break;
-            case DEU_SET_CLEAR_FLAG:
-                {
-                    g_bClearFlag = (readObj.m_nTotalLength != 0);
-                }
-                break;
-			case DEU_REMOVE_DATA://remove data
-				{
-					//remove block
-					if(!g_shm.removeBlock(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit)))
-						g_shm.WriteInfo(strShm,errObj);
-				}
+			}
+			//it cannot be shared, it goes through the payload
+			pSlot->m_nOffset = DEU_ARENA_NO_ENTRY;
+			WriteResponse(pRing,nSlot,nLength > 0 ? pBlock->getData() : NULL,nLength);
+		}
+		break;
+	case DEU_UPDATE_DATA://update data
+		{
+			unsigned nSize = 0;
+			const char* pPayload = pRing->GetPayload(nSlot,nSize);
+			if(pPayload == NULL || pSlot->m_nLength > nSize || !g_shm.updateBlock(id,pPayload,pSlot->m_nLength))
+				pSlot->m_nType = DEU_FAIL;
+			g_arena.Invalidate(id);
+		}
+		break;
+	case DEU_REPLACE_DATA://replace data
+		{
+			unsigned nSize = 0;
+			const char* pPayload = pRing->GetPayload(nSlot,nSize);
+			if(pPayload == NULL || pSlot->m_nLength > nSize || !g_shm.replaceBlock(id,pPayload,pSlot->m_nLength))
+				pSlot->m_nType = DEU_FAIL;
+			g_arena.Invalidate(id);
+		}
+		break;
+	case DEU_WRITE_DATA://write data
+		{
+			unsigned nSize = 0;
+			const char* pPayload = pRing->GetPayload(nSlot,nSize);
+			if(pPayload == NULL || pSlot->m_nLength > nSize || !g_shm.addBlock(id,pPayload,pSlot->m_nLength))
+				pSlot->m_nType = DEU_FAIL;
+			g_arena.Invalidate(id);
+		}
+		break;
+	case DEU_SET_CLEAR_FLAG:
+		{
+			g_bClearFlag = (pSlot->m_nCount != 0);
+		}
+		break;
+	case DEU_REMOVE_DATA://remove data
+		{
+			if(!g_shm.removeBlock(id))
+				pSlot->m_nType = DEU_FAIL;
+			g_arena.Invalidate(id);
+		}
+		break;
+	case DEU_IS_EXIST:
+		{
+			if(!g_shm.isExist(id))
+				pSlot->m_nType = DEU_FAIL;
+		}
+		break;
+	case DEU_ALL_INDEX:
+		{
+			std::vector<ID> idVec = g_shm.getAllIndices();
+			WriteResponse(pRing,nSlot,idVec.empty() ? NULL : &idVec[0],(unsigned)(idVec.size()*sizeof(ID)));
+		}
+		break;
+	case DEU_GET_COUNT:
+		{
+			pSlot->m_nCount = g_shm.getBlockCount();
+		}
+		break;
+	case DEU_GET_VERSION:
+		{
+			std::vector<unsigned> vList = g_shm.getVersion(id);
+			WriteResponse(pRing,nSlot,vList.empty() ? NULL : &vList[0],(unsigned)(vList.size()*sizeof(unsigned)));
+		}
+		break;
+	case DEU_INDEX_INRANGE:
+		{
+			std::vector<ID> idVec;
+			g_shm.getIndices(idVec,pSlot->m_nOffset,pSlot->m_nCount);
+			WriteResponse(pRing,nSlot,idVec.empty() ? NULL : &idVec[0],(unsigned)(idVec.size()*sizeof(ID)));
+		}
+		break;
+	case DEU_READ_BATCH://read many blocks
+		{
+			//the IDs are taken out first, the response is written over them
+			std::vector<ID> idVec;
+			if(ReadBatchIDs(pRing,nSlot,idVec) == NULL)
+			{
+				pSlot->m_nType = DEU_FAIL;
 				break;
-			case DEU_IS_EXIST:
-				{
-					if(!g_shm.isExist(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit)))
-						g_shm.WriteInfo(strShm,errObj);
-				}
+			}
+			std::vector<OpenSP::sp<deudb::IBlockBuffer> > bufferVec;
+			std::vector<bool> foundVec;
+			g_shm.readBlocks(idVec,bufferVec,foundVec);
+			WriteBlocksResponse(pRing,nSlot,bufferVec,foundVec);
+		}
+		break;
+	case DEU_EXIST_BATCH://whether many blocks exist
+		{
+			std::vector<ID> idVec;
+			if(ReadBatchIDs(pRing,nSlot,idVec) == NULL)
+			{
+				pSlot->m_nType = DEU_FAIL;
+				break;
+			}
+			unsigned nSize = 0;
+			unsigned char* pFlags = (unsigned char*)pRing->GetPayload(nSlot,nSize);
+			unsigned nExist = 0;
+			for(size_t n = 0;n < idVec.size();n++)
+			{
+				pFlags[n] = g_shm.isExist(idVec[n]) ? 1 : 0;
+				nExist += pFlags[n];
+			}
+			pSlot->m_nLength = (unsigned)idVec.size();
+			pSlot->m_nCount = nExist;
+		}
+		break;
+	case DEU_WRITE_BATCH://write many blocks
+		{
+			//the IDs, their lengths and then the blocks
+			std::vector<ID> idVec;
+			const char* pExtra = ReadBatchIDs(pRing,nSlot,idVec);
+			const unsigned nCount = (unsigned)idVec.size();
+			if(pExtra == NULL || nCount == 0 || (UINT_64)nCount*sizeof(unsigned) > pSlot->m_nLength - nCount*sizeof(ID))
+			{
+				pSlot->m_nType = DEU_FAIL;
 				break;
-			case DEU_ALL_INDEX:
+			}
+			const unsigned* pLengths = (const unsigned*)pExtra;
+			const char* pData = (const char*)(pLengths + nCount);
+			const char* pEnd = pExtra + (pSlot->m_nLength - nCount*sizeof(ID));
+			std::vector<OpenSP::sp<deudb::IBlockBuffer> > bufferVec(nCount);
+			bool bRes = true;
+			for(unsigned n = 0;n < nCount;n++)
+			{
+				if(pLengths[n] > (UINT_64)(pEnd - pData))
 				{
-					if(readObj.m_shmSize < sizeof(ID))
-						g_shm.WriteInfo(strShm,errObj);
-					else
-					{
-						//get add indices
-						std::vector<ID> idVec = g_shm.getAllIndices();
-						if(idVec.empty())
-							g_shm.WriteInfo(strShm,errObj);
-						else
-						{
-							//loop
-							const unsigned nLength = idVec.size();
-							unsigned nStart = 0,nEnd = 0;
-							const unsigned nNum = readObj.m_shmSize / sizeof(ID);
-							const unsigned nCount = nLength / nNum;
-							//write shared info
-							for(unsigned i = 0;i <= nCount;i++)
-							{
-								//write shared memory
-								nStart  = i*nNum;
-								nEnd = nLength < (i+1)*nNum ? nLength : (i+1)*nNum;
-								ShareObj outObj;
-								outObj.m_nType = readObj.m_nType;
-								outObj.m_nTotalLength = nLength;
-								outObj.m_startLength = nStart;
-								outObj.m_endLength = nEnd - 1;
-								outObj.m_vecData.resize((nEnd - nStart)*sizeof(ID));
-								memcpy(&outObj.m_vecData[0],&*(idVec.begin() + nStart),(nEnd - nStart)*sizeof(ID));
-								g_shm.WriteInfo(strShm,outObj);
-
-								if(i < nCount)
-								{
-									DEUSem::ReleaseSem(clientHnd);
-									DEUSem::WaitSem(serverHnd);
-								}
-							}
-						}
-					}
-
+					bRes = false;
+					break;
 				}
-				break;
-            case DEU_GET_COUNT:
-                {
-                    unsigned nCount = g_shm.getBlockCount();
-                    ShareObj outObj;
-                    outObj.m_nType = readObj.m_nType;
-                    outObj.m_nTotalLength = nCount;
-                    g_shm.WriteInfo(strShm,outObj);
-                }
-                break;
-            case DEU_GET_VERSION:
-                {
-                    if(readObj.m_shmSize < sizeof(unsigned))
-                    {
-                        g_shm.WriteInfo(strShm,errObj);
-                    }
-                    else
-                    {
-                        std::vector<unsigned> vList = g_shm.getVersion(ID(readObj.m_nHighBit,readObj.m_nMidBit,readObj.m_nLowBit));
-                        if(vList.empty())
-                        {
-                            g_shm.WriteInfo(strShm,errObj);
-                        }
-                        else
-                        {
-                            //loop
-                            const unsigned nLength = vList.size();
-                            unsigned nStart = 0,nEnd = 0;
-                            const unsigned nNum = readObj.m_shmSize / sizeof(unsigned);
-                            const unsigned nCount = nLength / nNum;
-                            //write shared info
-                            for(unsigned i = 0;i <= nCount;i++)
-                            {
-                                //write shared memory
-                                nStart  = i*nNum;
-                                nEnd = nLength < (i+1)*nNum ? nLength : (i+1)*nNum;
-                                ShareObj outObj;
-                                outObj.m_nType = readObj.m_nType;
-                                outObj.m_nTotalLength = nLength;
-                                outObj.m_startLength = nStart;
-                                outObj.m_endLength = nEnd - 1;
-                                outObj.m_vecData.resize((nEnd - nStart)*sizeof(unsigned));
-                                memcpy(&outObj.m_vecData[0],&*(vList.begin() + nStart),(nEnd - nStart)*sizeof(unsigned));
-                                g_shm.WriteInfo(strShm,outObj);
-
-                                if(i < nCount)
-                                {
-                                    DEUSem::ReleaseSem(clientHnd);
-                                    DEUSem::WaitSem(serverHnd);
-                                }
-                            }
-                        }
-                    }
-                }  
-                break;
-            case DEU_INDEX_INRANGE:
-                {
-                    if(readObj.m_shmSize < sizeof(ID))
-                    {
-                        g_shm.WriteInfo(strShm,errObj);
-                    }
-                    else
-                    {
-                        std::vector<ID> idVec;
-                        g_shm.getIndices(idVec,readObj.m_startLength,readObj.m_endLength);
-                        if(idVec.empty())
-                        {
-                            g_shm.WriteInfo(strShm,errObj);
-                        }
-                        else
-                        {
-                            //loop
-                            const unsigned nLength = idVec.size();
-                            unsigned nStart = 0,nEnd = 0;
-                            const unsigned nNum = readObj.m_shmSize / sizeof(ID);
-                            const unsigned nCount = nLength / nNum;
-                            //write shared info
-                            for(unsigned i = 0;i <= nCount;i++)
-                            {
-                                //write shared memory
-                                nStart  = i*nNum;
-                                nEnd = nLength < (i+1)*nNum ? nLength : (i+1)*nNum;
-                                ShareObj outObj;
-                                outObj.m_nType = readObj.m_nType;
-                                outObj.m_nTotalLength = nLength;
-                                outObj.m_startLength = nStart;
-                                outObj.m_endLength = nEnd - 1;
-                                outObj.m_vecData.resize((nEnd - nStart)*sizeof(ID));
-                                memcpy(&outObj.m_vecData[0],&*(idVec.begin() + nStart),(nEnd - nStart)*sizeof(ID));
-                                g_shm.WriteInfo(strShm,outObj);
-
-                                if(i < nCount)
-                                {
-                                    DEUSem::ReleaseSem(clientHnd);
-                                    DEUSem::WaitSem(serverHnd);
-                                }
-                            }
-                        }
-                    }
-                }
-                break;
-			default:
-				g_shm.WriteInfo(strShm,errObj);
+				if(pLengths[n] > 0)
+					bufferVec[n] = deudb::createBlockBuffer(pData,pLengths[n]);
+				pData += pLengths[n];
 			}
+			if(!bRes || !g_shm.writeBlocks(idVec,bufferVec))
+				pSlot->m_nType = DEU_FAIL;
+			for(unsigned n = 0;n < nCount;n++)
+				g_arena.Invalidate(idVec[n]);
 		}
-		//reset event
-		DEUSem::ReleaseSem(clientHnd);
-		DEUSem::WaitSem(serverHnd);
+		break;
+	default:
+		pSlot->m_nType = DEU_FAIL;
 	}
-#ifdef WIN32
-	return 1;
-#else
-	return (void*)1;
-#endif
 }
 
 //register shared memory
-bool RegShm(const std::string& strShmName)
+bool RegShm(const std::string& strShmName,DEUShmRing* pRing)
 {
 	//1. if strShmName already exists,return true
 	std::vector<std::string>::iterator itr = find(g_shmVec.begin(),g_shmVec.end(),strShmName);
 	if(itr != g_shmVec.end())
 		return true;
-	//2. create thread
-	g_strShmName = strShmName;
-#ifdef WIN32
-	HANDLE hnd = (HANDLE)_beginthreadex(NULL,0,ThreadProc,(void*)g_strShmName.c_str(),0,NULL);
-	if(hnd == NULL)
-		return false;
-	g_threadMap[g_strShmName] = hnd;
-#else
-	pthread_t tid;
-    int nRes = pthread_create(&tid,NULL,ThreadProc,(void*)g_strShmName.c_str());
-	if(nRes != 0)
-		return false;
-#endif
+	//2. hand the ring to the workers
+	g_workerPool.AddRing(strShmName,pRing);
+	g_clientRingMap[strShmName] = pRing;
 	//3. save strShmName and return
 	g_shmVec.push_back(strShmName);
 	return true;
@@ -401,24 +316,54 @@ bool RegShm(const std::string& strShmName)
 
 bool UnRegShm(const std::string& strShmName)
 {
-	std::string strShm = strShmName + "Shm";
-	std::string strSvr = strShmName + "EventServer";
 	std::string strClient = strShmName + "EventClient";
-	g_shm.DtShm(strShm);
 	std::vector<std::string>::iterator itr = find(g_shmVec.begin(),g_shmVec.end(),strShmName);
 	if(itr != g_shmVec.end())
 	{
 		g_shmVec.erase(itr);
 	}
-	//release and close sem
-	std::map<std::string,HANDLE>::const_iterator itr1 = g_eventSvrMap.find(strSvr);
-	if(itr1 != g_eventSvrMap.end())
+	//the client has waited for its requests, the workers drop the ring
+	//and the leases it still holds go with it
+	g_workerPool.RemoveRing(strShmName);
+	g_clientRingMap.erase(strShmName);
+	//close sem
+	std::map<std::string,HANDLE>::iterator itr1 = g_eventClientMap.find(strClient);
+	if(itr1 != g_eventClientMap.end())
 	{
-		DEUSem::ReleaseSem(itr1->second);
+		DEUSem::CloseSem(itr1->second,strClient);
+		g_eventClientMap.erase(itr1);
 	}
 	return true;
 }
 
+//unregister the clients whose process has gone, the blocks they held are free again
+static void DropLostClients()
+{
+	std::vector<std::string> lostVec;
+	std::map<std::string,OpenSP::sp<DEUShmRing> >::const_iterator itr = g_clientRingMap.begin();
+	for(;itr != g_clientRingMap.end();++itr)
+	{
+		if(!itr->second->IsClientAlive())
+			lostVec.push_back(itr->first);
+	}
+	for(size_t n = 0;n < lostVec.size();n++)
+		UnRegShm(lostVec[n]);
+}
+
+#ifndef WIN32
+//remove the semaphores and the reg shared memory of the database
+static void RemoveRegNames()
+{
+	DEUSem::RemoveSem(g_strRegSem);
+	DEUSem::RemoveSem(g_strRegSem + "ParticularSem");
+	DEUSem::RemoveSem(g_strSvrRegSem);
+	DEUSem::RemoveSem(g_strRegSem + "PulseSem");
+	g_shm.DtShm(g_strRegShmName);
+	std::string strRegShmFile = "/dev/shm/" + g_strRegShmName;
+	remove(strRegShmFile.c_str());
+}
+#endif
+
 //register and unregister thread funciton
 #ifdef WIN32
 unsigned __stdcall RegShmProc(LPVOID lpParam)
@@ -448,6 +393,8 @@ void* RegShmProc(void* lpParam)
 			DEUSem::ReleaseSem(g_regHnd);
 			break;
 		}
+		//a client may have died without unregistering
+		DropLostClients();
 		switch(nType)
 		{
 		case DEU_REG_SHM:
@@ -461,7 +408,6 @@ void* RegShmProc(void* lpParam)
 				}
 				//open event
 				std::string strClient = strShared + "EventClient";
-				std::string strServer = strShared + "EventServer";
 				//open mutex
 				HANDLE hnd = DEUSem::OpenSem(strClient);
 				if(hnd == NULL)
@@ -470,9 +416,9 @@ void* RegShmProc(void* lpParam)
 					DEUSem::ReleaseSem(g_regHnd);
 					break;
 				}
-				//create semaphore
-				HANDLE svrHnd = DEUSem::CreateSem(strServer,0);
-				if(svrHnd == NULL)
+				//open the request ring of the client
+				OpenSP::sp<DEUShmRing> pRing = new DEUShmRing();
+				if(!pRing->Open(strShared,&g_arena))
 				{
 					DEUSem::CloseSem(hnd,strClient);
 					g_shm.WriteRegInfo(g_strRegShmName,DEU_FAIL,strPath,strShared);
@@ -480,17 +426,8 @@ void* RegShmProc(void* lpParam)
 					break;
 				}
 				g_eventClientMap[strClient] = hnd;
-				g_eventSvrMap[strServer] = svrHnd;
-				if(!RegShm(strShared))
-				{
-					DEUSem::CloseSem(hnd,strClient);
-					DEUSem::CloseSem(svrHnd,strServer);
-					g_eventClientMap.erase(strClient);
-					g_eventSvrMap.erase(strServer);
-					g_shm.WriteRegInfo(g_strRegShmName,DEU_FAIL,strPath,strShared);
-				}
-				else
-					g_shm.WriteRegInfo(g_strRegShmName,DEU_REG_SUCCESS,strPath,strShared);
+				RegShm(strShared,pRing.get());
+				g_shm.WriteRegInfo(g_strRegShmName,DEU_REG_SUCCESS,strPath,strShared);
 				DEUSem::ReleaseSem(g_regHnd);
 			}
 			break;
@@ -500,11 +437,22 @@ void* RegShmProc(void* lpParam)
 				UnRegShm(strShared);
 				if(g_shmVec.empty())
 				{
-                    //close deudb
+                    //stop the workers and close deudb
+					g_workerPool.Stop();
+					g_arena.Destroy();
 					g_shm.closeDB();
 					g_shm.WriteRegInfo(g_strRegShmName,DEU_UNREG_SUCCESS,strPath,strShared);
+#ifndef WIN32
+					//the names go before the last client goes on, the next client starts a new
+					//server and must neither find them nor lose its own ones to this server
+					RemoveRegNames();
+					DEUSem::ReleaseSem(g_regHnd);
+					DEUSem::CloseSem(g_regHnd,"");
+					g_regHnd = NULL;
+#else
 					DEUSem::ReleaseSem(g_regHnd);
 					DEUSem::CloseSem(g_regHnd,g_strRegSem);
+#endif
 #ifdef WIN32
 					return 1;
 #else
@@ -530,11 +478,78 @@ void* RegShmProc(void* lpParam)
 #endif
 }
 
+//the workers serving all the clients, one for every processor within bounds
+static unsigned GetWorkerCount()
+{
+	unsigned nWorkerCount = (unsigned)OpenThreads::GetNumberOfProcessors();
+	if(nWorkerCount < DEU_MIN_WORKER_COUNT)
+		nWorkerCount = DEU_MIN_WORKER_COUNT;
+	if(nWorkerCount > DEU_MAX_WORKER_COUNT)
+		nWorkerCount = DEU_MAX_WORKER_COUNT;
+	return nWorkerCount;
+}
+
+#ifndef WIN32
+volatile sig_atomic_t g_bStopSocketServer = 0;
+
+static void StopSocketServer(int nSignal)
+{
+	g_bStopSocketServer = 1;
+}
+
+//A server started by hand with the argument "socket" only serves the clients on the
+//socket beside the database, they may run in other containers. It needs neither the
+//semaphores nor the shared memory of the clients and runs until it is told to stop.
+static int RunSocketServer(UINT_64 nReadBuf,UINT_64 nWriteBuf)
+{
+	//1. open db
+	if(!g_shm.openDB(g_strDBPath,nReadBuf,nWriteBuf))
+		return 0;
+
+	//2. start the workers and listen on the socket
+	unsigned nReg = cmm::createHashCRC32(g_strDBPath.c_str(),g_strDBPath.length());
+	std::ostringstream oss;
+	oss<<nReg<<"EventWork";
+	g_strWorkSem = oss.str();
+	if(!g_workerPool.Start(g_strWorkSem,GetWorkerCount(),ProcessRequest))
+	{
+		g_shm.closeDB();
+		return 0;
+	}
+	if(!g_sockServer.Start(g_strDBPath + DEU_SOCK_SUFFIX,&g_workerPool))
+	{
+		g_workerPool.Stop();
+		g_shm.closeDB();
+		return 0;
+	}
+
+	//3. wait for SIGTERM or SIGINT
+	signal(SIGTERM,StopSocketServer);
+	signal(SIGINT,StopSocketServer);
+	while(!g_bStopSocketServer)
+		OpenThreads::Thread::microSleep(200000);
+
+	//4. stop listening before the workers stop, then close deudb
+	g_sockServer.Stop();
+	g_workerPool.Stop();
+	g_shm.closeDB();
+	if(g_bClearFlag)
+	{
+		std::string strFileName = g_strDBPath + std::string( ".idx");
+		std::string strFileName2 = g_strDBPath + std::string( "_0.db");
+		remove(strFileName.c_str());
+		remove(strFileName2.c_str());
+	}
+	return 1;
+}
+#endif
+
 unsigned long g_nPulse = 0;
 unsigned long g_nPulseCount = 0;
 std::string   g_strPulseSem = "";
 HANDLE        g_pulseSemHnd = NULL;
 
+#ifdef WIN32
 unsigned __stdcall PulseProc(LPVOID lpParam)
 {
     unsigned long nTime = 0;
@@ -554,6 +569,7 @@ unsigned __stdcall PulseProc(LPVOID lpParam)
     }
     
 }
+#endif
 //main
 #ifdef WIN32
 int WINAPI WinMain(HINSTANCE hInstance,   HINSTANCE hPrevInstance,   LPSTR lpCmdLine,   int nShowCmd )
@@ -571,13 +587,14 @@ int WINAPI WinMain(HINSTANCE hInstance,   HINSTANCE hPrevInstance,   LPSTR lpCmd
 #else
 int main(int argc,char** argv)
 {
-	sleep(30);
 	//get args
 	if(argc < 4)
 		return 0;
 	g_strDBPath = argv[1];
-	UINT64 nReadBuf = atoll(__argv[2]);
-	UINT64 nWriteBuf = atoll(__argv[3]);
+	UINT_64 nReadBuf = atoll(argv[2]);
+	UINT_64 nWriteBuf = atoll(argv[3]);
+	if(argc > 4 && std::string(argv[4]) == "socket")
+		return RunSocketServer(nReadBuf,nWriteBuf);
 #endif
 	//open start semaphore
     unsigned nReg = cmm::createHashCRC32(g_strDBPath.c_str(),g_strDBPath.length());
@@ -643,11 +660,30 @@ int main(int argc,char** argv)
         return 0;
     }
 
+    //create the arena of the hot blocks, without it the clients copy every block
+    g_arena.Create(g_strRegSem + "Arena",DEU_ARENA_SIZE,DEU_ARENA_ENTRY_COUNT);
+
+    //start the workers, a fixed count of them serves all the clients
+    g_strWorkSem = g_strRegSem + "EventWork";
+    if(!g_workerPool.Start(g_strWorkSem,GetWorkerCount(),ProcessRequest))
+    {
+        g_arena.Destroy();
+        g_shm.closeDB();
+        DEUSem::CloseSem(g_partiHnd,strPart);
+        DEUSem::CloseSem(g_svrRegHnd,g_strSvrRegSem);
+        DEUSem::CloseSem(g_pulseSemHnd,g_strPulseSem);
+        DEUSem::ReleaseSem(g_regHnd);
+        DEUSem::CloseSem(g_regHnd,g_strRegSem);
+        return 0;
+    }
+
 #ifdef WIN32
 	//create register thread
 	HANDLE hnd = (HANDLE)_beginthreadex(NULL,0,RegShmProc,NULL,0,NULL);
 	if(hnd == NULL)
 	{
+		g_workerPool.Stop();
+		g_arena.Destroy();
 		g_shm.closeDB();
 		DEUSem::CloseSem(g_partiHnd,strPart);
 		DEUSem::CloseSem(g_svrRegHnd,g_strSvrRegSem);
@@ -659,24 +695,11 @@ int main(int argc,char** argv)
 
 	//wait thread
 	//WaitForSingleObject(hnd,INFINITE);
-#else
-	pthread_t tid;
-    int nRes = pthread_create(&tid,NULL,RegShmProc,NULL);
-	if(nRes != 0)
-	{
-		g_shm.closeDB();
-		DEUSem::CloseSem(g_partiHnd,strPart);
-		DEUSem::CloseSem(g_svrRegHnd,g_strSvrRegSem);
-		DEUSem::ReleaseSem(g_regHnd);
-		DEUSem::CloseSem(g_regHnd,g_strRegSem);
-		return 0;
-	}
-	//wait thread
-	pthread_join(tid,NULL);
-#endif
     HANDLE pulseHnd = (HANDLE)_beginthreadex(NULL,0,PulseProc,NULL,0,NULL);
     if(pulseHnd == NULL)
     {
+        g_workerPool.Stop();
+        g_arena.Destroy();
         g_shm.closeDB();
         DEUSem::CloseSem(g_partiHnd,strPart);
         DEUSem::CloseSem(g_svrRegHnd,g_strSvrRegSem);
@@ -711,6 +734,8 @@ int main(int argc,char** argv)
     }
     else if(dwState == WAIT_OBJECT_0 + 1)
     {
+        g_workerPool.Stop();
+        g_arena.Destroy();
         g_shm.closeDB();
         DEUSem::CloseSem(g_pulseSemHnd,g_strPulseSem);
         DEUSem::CloseSem(g_partiHnd,strPart);
@@ -729,6 +754,39 @@ int main(int argc,char** argv)
         return 1;
     }
     return 1;
-	
+#else
+	pthread_t tid;
+    int nRes = pthread_create(&tid,NULL,RegShmProc,NULL);
+	if(nRes != 0)
+	{
+		g_workerPool.Stop();
+		g_arena.Destroy();
+		g_shm.closeDB();
+		DEUSem::CloseSem(g_partiHnd,strPart);
+		DEUSem::CloseSem(g_svrRegHnd,g_strSvrRegSem);
+		DEUSem::ReleaseSem(g_regHnd);
+		DEUSem::CloseSem(g_regHnd,g_strRegSem);
+		return 0;
+	}
+	//the register thread ends when the last client has gone, it has closed deudb
+	pthread_join(tid,NULL);
+	if(g_regHnd != NULL)
+	{
+		//the register thread has failed, the names are still there
+		RemoveRegNames();
+		DEUSem::CloseSem(g_regHnd,"");
+	}
+	DEUSem::CloseSem(g_pulseSemHnd,"");
+	DEUSem::CloseSem(g_partiHnd,"");
+	DEUSem::CloseSem(g_svrRegHnd,"");
+	//delete files
+	if(g_bClearFlag)
+	{
+		std::string strFileName = g_strDBPath + std::string( ".idx");
+		std::string strFileName2 = g_strDBPath + std::string( "_0.db");
+		remove(strFileName.c_str());
+		remove(strFileName2.c_str());
+	}
+	return 1;
+#endif
 }
-
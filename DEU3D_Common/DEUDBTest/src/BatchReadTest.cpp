@@ -0,0 +1,160 @@
+#include "DEUDBTest.h"
+#include <string.h>
+
+namespace
+{
+    const unsigned g_nBatchBlocks   = 300u;
+    const unsigned g_nBigLength     = 256u * 1024u;     // far beyond the gap readBlocks reads over
+
+    UINT_64 getFileReads(deudb::IDEUDB *pDB)
+    {
+        deudb::CacheStatistics stat;
+        pDB->getCacheStatistics(stat);
+        return stat.m_nFileReads;
+    }
+
+
+    // the blocks of a new database lie one after the other in the order of the batch
+    bool createBatchDatabase(const std::string &strDB)
+    {
+        removeDatabase(strDB);
+        OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+        TEST_CHECK(pDB->openDB(strDB));
+        TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nBatchBlocks, 0u));
+        pDB->closeDB();
+        return true;
+    }
+
+
+    bool isSameBuffer(const OpenSP::sp<deudb::IBlockBuffer> &pLeft, const OpenSP::sp<deudb::IBlockBuffer> &pRight)
+    {
+        if(!pLeft.valid() || !pRight.valid())
+        {
+            return pLeft.valid() == pRight.valid();
+        }
+        return pLeft->getLength() == pRight->getLength()
+            && memcmp(pLeft->getData(), pRight->getData(), pLeft->getLength()) == 0;
+    }
+}
+
+
+// The neighbouring blocks which miss the cache are read from the file at once: a batch of all the
+// blocks of a database, asked for backwards with absent IDs between them, takes one read where
+// readBlock takes one for each, and both give the same bytes.
+bool testReadBlocksCoalesced(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/batch_read";
+    TEST_CHECK(createBatchDatabase(strDB));
+
+    std::vector<unsigned> vecNumbers;
+    std::vector<ID> vecIDs;
+    for(unsigned n = g_nBatchBlocks; n > 0u; n--)
+    {
+        vecNumbers.push_back(n - 1u);
+        if(n % 7u == 0u)
+        {
+            vecNumbers.push_back(g_nBatchBlocks + n);
+        }
+    }
+    for(size_t i = 0u; i < vecNumbers.size(); i++)
+    {
+        vecIDs.push_back(makeTestID(vecNumbers[i]));
+    }
+
+    // 1. the whole batch in one read
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecBuffers;
+    std::vector<bool> vecFound;
+    TEST_CHECK(pDB->readBlocks(vecIDs, vecBuffers, vecFound) == g_nBatchBlocks);
+    TEST_CHECK(getFileReads(pDB.get()) == 1u);
+    for(size_t i = 0u; i < vecIDs.size(); i++)
+    {
+        const unsigned n = vecNumbers[i];
+        unsigned nRound = 0u;
+        TEST_CHECK(vecFound[i] == (n < g_nBatchBlocks));
+        TEST_CHECK(!vecFound[i] || checkTestBlock(n, vecBuffers[i]->getData(), vecBuffers[i]->getLength(), nRound));
+    }
+
+    // 2. the cache holds them now, a second batch does not read at all
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecCached;
+    TEST_CHECK(pDB->readBlocks(vecIDs, vecCached, vecFound) == g_nBatchBlocks);
+    TEST_CHECK(getFileReads(pDB.get()) == 1u);
+    pDB->closeDB();
+
+    // 3. one by one from the file, each block as the batch has read it
+    TEST_CHECK(pDB->openDB(strDB));
+    for(size_t i = 0u; i < vecIDs.size(); i++)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        TEST_CHECK(pDB->readBlock(vecIDs[i], pBuffer) == vecFound[i]);
+        TEST_CHECK(isSameBuffer(pBuffer, vecBuffers[i]));
+        TEST_CHECK(isSameBuffer(vecCached[i], vecBuffers[i]));
+    }
+    TEST_CHECK(getFileReads(pDB.get()) == g_nBatchBlocks);
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// The blocks removed from between the asked ones leave free spans, a short one is read over and a
+// long one splits the batch into two reads.
+bool testReadBlocksGaps(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/batch_gaps";
+    removeDatabase(strDB);
+
+    // every tenth test block is asked for, a big block lies between the two halves of them
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nBatchBlocks / 2u, 0u));
+    std::vector<char> vecBig(g_nBigLength, 'x');
+    TEST_CHECK(pDB->addBlock(makeTestID(2u * g_nBatchBlocks), &vecBig[0], (unsigned)vecBig.size()));
+    TEST_CHECK(writeTestBlocks(pDB.get(), g_nBatchBlocks / 2u, g_nBatchBlocks / 2u, 0u));
+    pDB->closeDB();
+
+    std::vector<ID> vecIDs;
+    for(unsigned n = 0u; n < g_nBatchBlocks; n += 10u)
+    {
+        vecIDs.push_back(makeTestID(n));
+    }
+
+    // 1. the spans between them are short, the big block splits them
+    TEST_CHECK(pDB->openDB(strDB));
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecBuffers;
+    std::vector<bool> vecFound;
+    TEST_CHECK(pDB->readBlocks(vecIDs, vecBuffers, vecFound) == vecIDs.size());
+    TEST_CHECK(getFileReads(pDB.get()) == 2u);
+    for(size_t i = 0u; i < vecIDs.size(); i++)
+    {
+        unsigned nRound = 0u;
+        TEST_CHECK(checkTestBlock(10u * (unsigned)i, vecBuffers[i]->getData(), vecBuffers[i]->getLength(), nRound));
+    }
+    pDB->closeDB();
+
+    // 2. the blocks between them removed, the spans are free and still read over
+    TEST_CHECK(pDB->openDB(strDB));
+    for(unsigned n = 0u; n < g_nBatchBlocks; n++)
+    {
+        if(n % 10u != 0u)
+        {
+            TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+        }
+    }
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecAfter;
+    TEST_CHECK(pDB->readBlocks(vecIDs, vecAfter, vecFound) == vecIDs.size());
+    TEST_CHECK(getFileReads(pDB.get()) == 2u);
+    for(size_t i = 0u; i < vecIDs.size(); i++)
+    {
+        TEST_CHECK(isSameBuffer(vecAfter[i], vecBuffers[i]));
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
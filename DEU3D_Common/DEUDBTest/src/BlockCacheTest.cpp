@@ -0,0 +1,321 @@
+#include "DEUDBTest.h"
+#include <string.h>
+#include <OpenThreads/Thread>
+#include "BlockCache.h"
+
+namespace
+{
+    const unsigned g_nCacheBlockSize    = 1000u;
+    const unsigned g_nCacheBlocks       = 100u;     // the capacity of the caches of the tests, in blocks
+    const unsigned g_nShardCount        = 16u;
+
+    // the shards of a cache, which the tests must see to tell them apart
+    class TestBlockCache : public deudb::BlockCache
+    {
+    public:
+        explicit TestBlockCache(unsigned nShardCount) : deudb::BlockCache(nShardCount){}
+
+    public:
+        unsigned getShardOf(const ID &id) const
+        {
+            const Shard *pShard = &getShard(hashID(id));
+            for(unsigned n = 0u; n < m_vecShards.size(); n++)
+            {
+                if(m_vecShards[n] == pShard)    return n;
+            }
+            return ~0u;
+        }
+
+        UINT_64 getShardBytes(unsigned nShard) const
+        {
+            const Shard &shard = *m_vecShards[nShard];
+            return shard.m_queues[QT_IN].m_nBytes + shard.m_queues[QT_HOT].m_nBytes;
+        }
+
+        UINT_64 getShardCapacity(unsigned nShard) const
+        {
+            return m_vecShards[nShard]->m_nCapacity;
+        }
+
+        UINT_64 getShardEvictions(unsigned nShard) const
+        {
+            return m_vecShards[nShard]->m_nEvictions;
+        }
+    };
+
+
+    OpenSP::sp<deudb::IBlockBuffer> makeCacheBlock(unsigned n, unsigned nLength = g_nCacheBlockSize)
+    {
+        std::vector<char> vecBlock;
+        makeTestBlock(n, 0u, vecBlock);
+        vecBlock.resize(nLength, (char)n);
+        return deudb::createBlockBuffer(&vecBlock[0], nLength);
+    }
+
+
+    // what FileCache does: a miss is read from the file and inserted
+    bool readThrough(deudb::BlockCache &cache, unsigned n, unsigned nLength = g_nCacheBlockSize)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        if(cache.read(makeTestID(n), 0u, pBuffer))
+        {
+            return true;
+        }
+        pBuffer = makeCacheBlock(n, nLength);
+        cache.insert(makeTestID(n), 1u, pBuffer.get());
+        return false;
+    }
+
+
+    bool isCached(deudb::BlockCache &cache, unsigned n)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        return cache.read(makeTestID(n), 0u, pBuffer);
+    }
+
+
+    // the blocks from nFirst on, each read once
+    void scanCache(deudb::BlockCache &cache, unsigned nFirst, unsigned nCount)
+    {
+        for(unsigned n = nFirst; n < nFirst + nCount; n++)
+        {
+            readThrough(cache, n);
+        }
+    }
+
+
+    // a reader of the cache benchmark, it reads the hot set mostly and now and then scans
+    class CacheReader : public OpenThreads::Thread
+    {
+    public:
+        CacheReader(deudb::BlockCache *pCache, unsigned nSeed, unsigned nReads, unsigned nHotBlocks, bool bScans)
+            : m_pCache(pCache), m_nSeed(nSeed), m_nReads(nReads), m_nHotBlocks(nHotBlocks), m_bScans(bScans), m_nHits(0u){}
+        ~CacheReader(void){}
+
+    public:
+        virtual void run(void)
+        {
+            unsigned nScan = 0u;
+            for(unsigned i = 0u; i < m_nReads; i++)
+            {
+                // a linear congruential generator, the same for every run
+                m_nSeed = m_nSeed * 1103515245u + 12345u;
+                const unsigned nRandom = (m_nSeed >> 8u);
+                unsigned n = 0u;
+                if(m_bScans && nRandom % 4u == 0u)
+                {
+                    // a quarter of the reads walk blocks which are never read again
+                    n = 0x10000000u + (m_nSeed & 0xFFu) * 0x100000u + nScan++;
+                }
+                else if(nRandom % 10u < 8u)
+                {
+                    n = (nRandom >> 4u) % (m_nHotBlocks / 5u);      // 80% of the reads go to 20% of the blocks
+                }
+                else
+                {
+                    n = (nRandom >> 4u) % m_nHotBlocks;
+                }
+                if(readThrough(*m_pCache, n))   ++m_nHits;
+            }
+        }
+
+    public:
+        deudb::BlockCache  *m_pCache;
+        unsigned            m_nSeed;
+        unsigned            m_nReads;
+        unsigned            m_nHotBlocks;
+        bool                m_bScans;
+        unsigned            m_nHits;
+    };
+}
+
+
+// A block read once waits in the FIFO, a second read while it is there does not promote it. Only a
+// block read again after it has left the FIFO, while its ghost is kept, gets into the LRU, and there
+// it outlives any number of blocks read once.
+bool testCachePromotion(const std::string &strDir)
+{
+    TestBlockCache cache(1u);
+    cache.setCapacity(g_nCacheBlocks * g_nCacheBlockSize);
+
+    // 1. the hot set and a block read twice in a row, both in the FIFO
+    const unsigned nHot = 10u, nTwice = 20u;
+    scanCache(cache, 0u, nHot);
+    TEST_CHECK(!readThrough(cache, nTwice));
+    TEST_CHECK(readThrough(cache, nTwice));
+    for(unsigned n = 0u; n < nHot; n++)
+    {
+        TEST_CHECK(isCached(cache, n));
+    }
+
+    // 2. a scan pushes all of them out of the FIFO, the hot set is read again while its ghosts are kept
+    scanCache(cache, 1000u, 2u * g_nCacheBlocks);
+    TEST_CHECK(!isCached(cache, nTwice));
+    for(unsigned n = 0u; n < nHot; n++)
+    {
+        TEST_CHECK(!readThrough(cache, n));
+    }
+
+    // 3. the hot set is in the LRU now, a scan of many times the capacity does not touch it
+    scanCache(cache, 2000u, 10u * g_nCacheBlocks);
+    for(unsigned n = 0u; n < nHot; n++)
+    {
+        TEST_CHECK(isCached(cache, n));
+    }
+    TEST_CHECK(!isCached(cache, nTwice));
+
+    // 4. while the FIFO keeps its quarter, the LRU gives way to new hot blocks oldest first
+    for(unsigned n = 100u; n < 100u + g_nCacheBlocks; n++)
+    {
+        readThrough(cache, n);
+    }
+    scanCache(cache, 3000u, g_nCacheBlocks);
+    for(unsigned n = 100u; n < 100u + g_nCacheBlocks; n++)
+    {
+        readThrough(cache, n);
+    }
+    for(unsigned n = 0u; n < nHot; n++)
+    {
+        TEST_CHECK(!isCached(cache, n));
+    }
+    TEST_CHECK(isCached(cache, 100u + g_nCacheBlocks - 1u));
+    return true;
+}
+
+
+// Whatever is read, the cached bytes never exceed the capacity, neither in the whole cache nor in
+// one shard, and a smaller capacity evicts at once. The blocks which are cached are read intact.
+bool testCacheBudget(const std::string &strDir)
+{
+    TestBlockCache cache(g_nShardCount);
+    const UINT_64 nCapacity = g_nShardCount * g_nCacheBlocks * g_nCacheBlockSize;
+    cache.setCapacity(nCapacity);
+
+    unsigned nSeed = 1u;
+    deudb::CacheStatistics stat;
+    for(unsigned i = 0u; i < 20000u; i++)
+    {
+        // blocks of 1 to 8000 bytes, some of them read over and over
+        nSeed = nSeed * 1103515245u + 12345u;
+        const unsigned n = (nSeed >> 8u) % 5000u;
+        readThrough(cache, n, 1u + (n * 2654435761u) % 8000u);
+
+        if(i % 1000u == 0u)
+        {
+            cache.getStatistics(stat);
+            TEST_CHECK(stat.m_nCachedBytes <= nCapacity);
+            for(unsigned nShard = 0u; nShard < g_nShardCount; nShard++)
+            {
+                TEST_CHECK(cache.getShardBytes(nShard) <= cache.getShardCapacity(nShard));
+            }
+        }
+    }
+    cache.getStatistics(stat);
+    TEST_CHECK(stat.m_nEvictions > 0u);
+    TEST_CHECK(stat.m_nCachedBytes > nCapacity / 2u);
+
+    for(unsigned n = 0u; n < 5000u; n++)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        if(cache.read(makeTestID(n), 0u, pBuffer))
+        {
+            TEST_CHECK(pBuffer.valid() && pBuffer->getLength() == 1u + (n * 2654435761u) % 8000u);
+            const OpenSP::sp<deudb::IBlockBuffer> pExpected = makeCacheBlock(n, pBuffer->getLength());
+            TEST_CHECK(memcmp(pBuffer->getData(), pExpected->getData(), pBuffer->getLength()) == 0);
+        }
+    }
+
+    cache.setCapacity(nCapacity / 10u);
+    cache.getStatistics(stat);
+    TEST_CHECK(stat.m_nCachedBytes <= nCapacity / 10u);
+
+    cache.clear();
+    cache.getStatistics(stat);
+    TEST_CHECK(stat.m_nCachedBytes == 0u && stat.m_nCachedBlocks == 0u);
+    return true;
+}
+
+
+// Every shard evicts only its own blocks: a scan whose IDs all fall into one shard leaves the
+// blocks of the other shards where they are.
+bool testCacheShards(const std::string &strDir)
+{
+    TestBlockCache cache(g_nShardCount);
+    cache.setCapacity(g_nShardCount * g_nCacheBlocks * g_nCacheBlockSize);
+
+    // 1. a few blocks in every shard but shard 0
+    std::vector<unsigned> vecOthers;
+    for(unsigned n = 0u; vecOthers.size() < 5u * (g_nShardCount - 1u); n++)
+    {
+        if(cache.getShardOf(makeTestID(n)) != 0u)
+        {
+            TEST_CHECK(!readThrough(cache, n));
+            vecOthers.push_back(n);
+        }
+    }
+
+    // 2. a scan of ten times the capacity of a shard through shard 0
+    unsigned nScanned = 0u;
+    for(unsigned n = 100000u; nScanned < 10u * g_nCacheBlocks; n++)
+    {
+        const unsigned nShard = cache.getShardOf(makeTestID(n));
+        TEST_CHECK(nShard < g_nShardCount);
+        if(nShard == 0u)
+        {
+            TEST_CHECK(!readThrough(cache, n));
+            ++nScanned;
+        }
+    }
+
+    TEST_CHECK(cache.getShardEvictions(0u) >= 9u * g_nCacheBlocks);
+    for(unsigned nShard = 1u; nShard < g_nShardCount; nShard++)
+    {
+        TEST_CHECK(cache.getShardEvictions(nShard) == 0u);
+    }
+    for(size_t i = 0u; i < vecOthers.size(); i++)
+    {
+        TEST_CHECK(isCached(cache, vecOthers[i]));
+    }
+    return true;
+}
+
+
+int runCacheBenchmark(unsigned nThreads, unsigned nReads)
+{
+    printf("block cache, %u reads from %u threads, hot set of 4 times the capacity\n", nReads, nThreads);
+
+    const unsigned nHotBlocks = 4u * g_nShardCount * g_nCacheBlocks;
+    for(unsigned nMode = 0u; nMode < 4u; nMode++)
+    {
+        const bool     bScans      = (nMode % 2u == 1u);
+        const unsigned nShardCount = (nMode < 2u) ? 1u : g_nShardCount;
+        deudb::BlockCache cache(nShardCount);
+        cache.setCapacity(g_nShardCount * g_nCacheBlocks * g_nCacheBlockSize);
+
+        const double dblStart = getSeconds();
+        std::vector<CacheReader *> vecReaders;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecReaders.push_back(new CacheReader(&cache, i + 1u, nReads / nThreads, nHotBlocks, bScans));
+            vecReaders.back()->startThread();
+        }
+
+        UINT_64 nHits = 0u;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecReaders[i]->join();
+            nHits += vecReaders[i]->m_nHits;
+            delete vecReaders[i];
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+
+        deudb::CacheStatistics stat;
+        cache.getStatistics(stat);
+        const unsigned nRead = nReads / nThreads * nThreads;
+        printf("    %2u shard(s), %-13s hit rate %.1f%%, %.0f reads/s, %.1f%% lock waits\n",
+               nShardCount, bScans ? "with scans," : "hot set only,", 100.0 * nHits / nRead,
+               (dblSeconds > 0.0) ? nRead / dblSeconds : 0.0,
+               (stat.m_nLockAcquires > 0u) ? 100.0 * stat.m_nLockWaits / stat.m_nLockAcquires : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "DEUDBTest.h"
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nBloomBenchBlocks  = 100000u;
+    const unsigned g_nBloomBenchBatch   = 1000u;
+
+    // looks m_nLookups IDs up from m_nFirst on, every one of them must be there or not as m_bExist says
+    class LookupThread : public OpenThreads::Thread
+    {
+    public:
+        LookupThread(deudb::IDEUDB *pDB, unsigned nFirst, unsigned nLookups, bool bExist)
+            : m_pDB(pDB), m_nFirst(nFirst), m_nLookups(nLookups), m_bExist(bExist), m_bFailed(false){}
+        ~LookupThread(void){}
+
+    public:
+        virtual void run(void)
+        {
+            for(unsigned i = 0u; i < m_nLookups; i++)
+            {
+                const unsigned n = m_bExist ? (m_nFirst + i) % g_nBloomBenchBlocks : m_nFirst + i;
+                if(m_pDB->isExist(makeTestID(n)) != m_bExist)
+                {
+                    m_bFailed = true;
+                    return;
+                }
+            }
+        }
+
+    public:
+        deudb::IDEUDB  *m_pDB;
+        unsigned        m_nFirst;
+        unsigned        m_nLookups;
+        bool            m_bExist;
+        bool            m_bFailed;
+    };
+
+
+    // adds blocks behind those of the lookups until it is stopped, every ID sets bits in the filter
+    // while the lookups read it
+    class BloomBenchWriter : public OpenThreads::Thread
+    {
+    public:
+        explicit BloomBenchWriter(deudb::IDEUDB *pDB) : m_pDB(pDB), m_bStop(false), m_bFailed(false), m_nWritten(0u){}
+        ~BloomBenchWriter(void){}
+
+    public:
+        virtual void run(void)
+        {
+            const unsigned nFirst = 0x40000000u;
+            while(!m_bStop)
+            {
+                if(!writeTestBlocks(m_pDB, nFirst + m_nWritten, 100u, 0u))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_nWritten += 100u;
+            }
+        }
+
+        void stop(void)
+        {
+            m_bStop = true;
+            join();
+        }
+
+    public:
+        deudb::IDEUDB          *m_pDB;
+        volatile bool           m_bStop;
+        volatile bool           m_bFailed;
+        volatile unsigned       m_nWritten;
+    };
+
+
+    // the seconds nThreads threads take for nLookups lookups in all, -1 if one has been answered wrong
+    double runLookups(deudb::IDEUDB *pDB, bool bExist, unsigned nThreads, unsigned nLookups)
+    {
+        const unsigned nPerThread = nLookups / nThreads;
+        const double dblStart = getSeconds();
+        std::vector<LookupThread *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            // the absent IDs follow those of the database, each thread has its own
+            const unsigned nFirst = bExist ? i * 7919u : g_nBloomBenchBlocks + i * nPerThread;
+            vecThreads.push_back(new LookupThread(pDB, nFirst, nPerThread, bExist));
+            vecThreads.back()->startThread();
+        }
+
+        bool bFailed = false;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            bFailed = bFailed || vecThreads[i]->m_bFailed;
+            delete vecThreads[i];
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+        return bFailed ? -1.0 : dblSeconds;
+    }
+}
+
+
+int runBloomBenchmark(const std::string &strDir, unsigned nThreads, unsigned nLookups)
+{
+    printf("%u lookups of %u blocks through the bloom filter\n", nLookups, g_nBloomBenchBlocks);
+
+    const std::string strDB = strDir + "/bloom_bench";
+    removeDatabase(strDB);
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    bool bWritten = pDB->openDB(strDB);
+    for(unsigned n = 0u; n < g_nBloomBenchBlocks && bWritten; n += g_nBloomBenchBatch)
+    {
+        bWritten = writeTestBlocks(pDB.get(), n, g_nBloomBenchBatch, 0u);
+    }
+    pDB->closeDB();
+    if(!bWritten || !pDB->openDB(strDB))
+    {
+        printf("    FAILED to write the blocks\n");
+        removeDatabase(strDB);
+        return 1;
+    }
+
+    // 1. the misses end in the filter, the hits go on to the index
+    int nFailed = 0;
+    const char *szKinds[2] = { "misses", "hits" };
+    for(unsigned nKind = 0u; nKind < 2u; nKind++)
+    {
+        const double dblSeconds = runLookups(pDB.get(), nKind == 1u, nThreads, nLookups);
+        if(dblSeconds < 0.0)
+        {
+            printf("    %-16s FAILED\n", szKinds[nKind]);
+            ++nFailed;
+            continue;
+        }
+        printf("    %-16s %.0f lookups/s\n", szKinds[nKind], (nLookups / nThreads) * nThreads / dblSeconds);
+    }
+
+    // 2. the misses while a writer sets bits in the words they read, none of them may be taken for a hit
+    BloomBenchWriter writer(pDB.get());
+    writer.startThread();
+    const double dblSeconds = runLookups(pDB.get(), false, nThreads, nLookups);
+    writer.stop();
+    if(dblSeconds < 0.0 || writer.m_bFailed)
+    {
+        printf("    %-16s FAILED\n", "misses, writing");
+        ++nFailed;
+    }
+    else
+    {
+        printf("    %-16s %.0f lookups/s, %.0f blocks/s written\n", "misses, writing",
+               (nLookups / nThreads) * nThreads / dblSeconds, writer.m_nWritten / dblSeconds);
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return nFailed;
+}
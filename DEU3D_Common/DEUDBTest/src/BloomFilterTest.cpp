@@ -0,0 +1,114 @@
+#include "DEUDBTest.h"
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nBloomWriters      = 4u;
+    const unsigned g_nBloomIDsPerWriter = 40000u;
+    const unsigned g_nBloomBatch        = 250u;
+
+    // the IDs of writer i are i, i + g_nBloomWriters, ... and m_nWritten of them are in the database
+    class BloomWriter : public OpenThreads::Thread
+    {
+    public:
+        BloomWriter(deudb::IDEUDB *pDB, unsigned nWriter) : m_pDB(pDB), m_nWriter(nWriter), m_nWritten(0u), m_bFailed(false){}
+        ~BloomWriter(void){}
+
+    public:
+        virtual void run(void)
+        {
+            const char szBlock[16] = "bloom";
+            std::vector<ID> vecIDs;
+            std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecBuffers;
+            for(unsigned nFirst = 0u; nFirst < g_nBloomIDsPerWriter; nFirst += g_nBloomBatch)
+            {
+                vecIDs.clear();
+                vecBuffers.clear();
+                for(unsigned n = nFirst; n < nFirst + g_nBloomBatch; n++)
+                {
+                    vecIDs.push_back(makeTestID(n * g_nBloomWriters + m_nWriter));
+                    vecBuffers.push_back(deudb::createBlockBuffer(szBlock, sizeof(szBlock)));
+                }
+                if(!m_pDB->writeBlocks(vecIDs, vecBuffers))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_nWritten = nFirst + g_nBloomBatch;
+            }
+        }
+
+    public:
+        deudb::IDEUDB          *m_pDB;
+        unsigned                m_nWriter;
+        volatile unsigned       m_nWritten;
+        volatile bool           m_bFailed;
+    };
+}
+
+
+// New IDs come from several writers until the filter has grown twice, and meanwhile every ID a writer
+// has got through must be found. The growing filter is built beside the writers, so any ID it misses
+// would be reported absent once it is put in place.
+bool testBloomFilterGrowth(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/bloom_growth";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+
+    std::vector<BloomWriter *> vecWriters;
+    for(unsigned i = 0u; i < g_nBloomWriters; i++)
+    {
+        vecWriters.push_back(new BloomWriter(pDB.get(), i));
+        vecWriters.back()->startThread();
+    }
+
+    bool bAllFound = true;
+    bool bRunning  = true;
+    for(unsigned nCheck = 0u; bRunning && bAllFound; nCheck++)
+    {
+        bRunning = false;
+        for(unsigned i = 0u; i < g_nBloomWriters; i++)
+        {
+            const unsigned nWritten = vecWriters[i]->m_nWritten;
+            bRunning = bRunning || (nWritten < g_nBloomIDsPerWriter && !vecWriters[i]->m_bFailed);
+            if(nWritten > 0u)
+            {
+                const unsigned n = (nCheck * 7919u) % nWritten;
+                bAllFound = pDB->isExist(makeTestID(n * g_nBloomWriters + i));
+            }
+            if(!bAllFound)  break;
+        }
+    }
+
+    bool bFailed = false;
+    for(unsigned i = 0u; i < g_nBloomWriters; i++)
+    {
+        vecWriters[i]->join();
+        bFailed = bFailed || vecWriters[i]->m_bFailed;
+        delete vecWriters[i];
+    }
+    TEST_CHECK(!bFailed);
+    TEST_CHECK(bAllFound);
+
+    const unsigned nTotal = g_nBloomWriters * g_nBloomIDsPerWriter;
+    for(unsigned n = 0u; n < nTotal; n++)
+    {
+        TEST_CHECK(pDB->isExist(makeTestID(n)));
+    }
+    TEST_CHECK(pDB->getBlockCount() == nTotal);
+    pDB->closeDB();
+
+    // the saved filter is the grown one
+    TEST_CHECK(pDB->openDB(strDB));
+    for(unsigned n = 0u; n < nTotal; n++)
+    {
+        TEST_CHECK(pDB->isExist(makeTestID(n)));
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,153 @@
+#include "DEUDBTest.h"
+#include <string.h>
+#include <OpenThreads/Atomic>
+
+namespace
+{
+    OpenThreads::Atomic g_nLiveBuffers;
+
+    // a block of the caller's own, which counts how many of them are alive
+    class TestBuffer : public deudb::IBlockBuffer
+    {
+    public:
+        explicit TestBuffer(unsigned n) {   makeTestBlock(n, 0u, m_vecData);   ++g_nLiveBuffers;   }
+
+    protected:
+        virtual ~TestBuffer(void)       {   --g_nLiveBuffers;   }
+
+    public:
+        virtual const void *getData(void) const     {   return &m_vecData[0];               }
+        virtual unsigned    getLength(void) const   {   return (unsigned)m_vecData.size();  }
+
+    protected:
+        std::vector<char>   m_vecData;
+    };
+
+
+    bool isTestBuffer(const OpenSP::sp<deudb::IBlockBuffer> &pBuffer, unsigned n)
+    {
+        unsigned nRound = 0u;
+        TEST_CHECK(pBuffer.valid());
+        TEST_CHECK(checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound) && nRound == 0u);
+        return true;
+    }
+}
+
+
+// The cache shares the buffer of the caller rather than copying it, a read hands out that very
+// buffer. Each holder keeps it alive on its own: the caller who wrote it, the cache, a reader after
+// the block has been replaced and after the database has gone, and the last one frees it once.
+bool testBufferLifetime(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/buffers";
+    removeDatabase(strDB);
+    TEST_CHECK((unsigned)g_nLiveBuffers == 0u);
+
+    // 1. written, the caller's buffer is what the cache holds and what a read gets
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    OpenSP::sp<deudb::IBlockBuffer> pWritten = new TestBuffer(1u);
+    TEST_CHECK(pDB->addBlock(makeTestID(1u), pWritten.get()));
+    TEST_CHECK(pWritten->referenceCount() > 1);
+    OpenSP::sp<deudb::IBlockBuffer> pRead;
+    TEST_CHECK(pDB->readBlock(makeTestID(1u), pRead));
+    TEST_CHECK(pRead.get() == pWritten.get());
+
+    // 2. the writer and the reader let it go, the cache keeps it
+    pWritten = NULL;
+    pRead = NULL;
+    TEST_CHECK((unsigned)g_nLiveBuffers == 1u);
+    TEST_CHECK(pDB->readBlock(makeTestID(1u), pRead) && isTestBuffer(pRead, 1u));
+
+    // 3. a reader holds it over the block being replaced and the database being closed and released
+    OpenSP::sp<deudb::IBlockBuffer> pReplacement = new TestBuffer(1u);
+    TEST_CHECK(pDB->replaceBlock(makeTestID(1u), pReplacement.get()));
+    pReplacement = NULL;
+    pDB->closeDB();
+    pDB = NULL;
+    TEST_CHECK((unsigned)g_nLiveBuffers == 1u);
+    TEST_CHECK(isTestBuffer(pRead, 1u));
+    pRead = NULL;
+    TEST_CHECK((unsigned)g_nLiveBuffers == 0u);
+
+    // 4. read from the file, the block holds the stored frame it lies in until the reader lets it go
+    pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(pDB->readBlock(makeTestID(1u), pRead));
+    pDB->closeDB();
+    pDB = NULL;
+    TEST_CHECK(isTestBuffer(pRead, 1u));
+    pRead = NULL;
+
+    // 5. a NULL buffer is a block of no bytes
+    pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(pDB->addBlock(makeTestID(2u), (deudb::IBlockBuffer *)NULL));
+    pRead = new TestBuffer(2u);
+    TEST_CHECK(pDB->readBlock(makeTestID(2u), pRead) && !pRead.valid());
+    TEST_CHECK((unsigned)g_nLiveBuffers == 0u);
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// Many blocks written, read and dropped in every order: once the database is closed the buffers of
+// the caller are all freed, none of them twice.
+bool testBufferRelease(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/buffers_release";
+    removeDatabase(strDB);
+    TEST_CHECK((unsigned)g_nLiveBuffers == 0u);
+
+    const unsigned nBlocks = 1000u;
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecHeld;
+    for(unsigned n = 0u; n < nBlocks; n++)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer = new TestBuffer(n);
+        TEST_CHECK((n % 2u == 0u) ? pDB->addBlock(makeTestID(n), pBuffer.get()) : pDB->replaceBlock(makeTestID(n), pBuffer.get()));
+        if(n % 3u == 0u)
+        {
+            vecHeld.push_back(pBuffer);
+        }
+    }
+
+    // every fifth is replaced by a copy and every seventh removed, some of those are still held
+    for(unsigned n = 0u; n < nBlocks; n += 5u)
+    {
+        TEST_CHECK(writeTestBlocks(pDB.get(), n, 1u, 0u));
+    }
+    for(unsigned n = 0u; n < nBlocks; n += 7u)
+    {
+        TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+    }
+    for(unsigned n = 1u; n < nBlocks; n += 7u)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        TEST_CHECK(pDB->readBlock(makeTestID(n), pBuffer) && isTestBuffer(pBuffer, n));
+        vecHeld.push_back(pBuffer);
+    }
+    pDB->closeDB();
+
+    for(size_t i = 0u; i < vecHeld.size(); i++)
+    {
+        TEST_CHECK(vecHeld[i].valid() && vecHeld[i]->getLength() > 0u);
+    }
+    vecHeld.clear();
+    TEST_CHECK((unsigned)g_nLiveBuffers == 0u);
+
+    // and what has been written from them is in the files
+    TEST_CHECK(pDB->openDB(strDB));
+    for(unsigned n = 0u; n < nBlocks; n++)
+    {
+        unsigned nRound = 0u;
+        TEST_CHECK(readTestBlock(pDB.get(), n, nRound) == (n % 7u != 0u));
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
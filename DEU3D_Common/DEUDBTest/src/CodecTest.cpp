@@ -0,0 +1,269 @@
+#include "DEUDBTest.h"
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+    const unsigned  g_nCodecBlocks      = 400u;
+    const unsigned  g_nRandomLength     = 4096u;
+    const unsigned  g_nFrameLength      = 20u;      // the header of BlockCodec and the CRC32C of the payload
+    const char      g_szCodecFlag[4]    = {'D', 'E', 'U', 'Z'};
+    const unsigned  g_nCodecOffset      = 4u;       // where the codec tag lies in the frame
+    const unsigned  g_nRawLengthOffset  = 8u;       // where the length of the block lies in the frame
+    const unsigned char g_nCodecRaw     = 0u;
+    const unsigned char g_nCodecDict    = 2u;
+
+    // the test blocks are ramps, from this length on they repeat enough for deflate to shrink them
+    const unsigned  g_nShrinkLength     = 512u;
+
+    // bytes no compression gets smaller, the same for every n
+    void makeRandomBlock(unsigned n, std::vector<char> &vecBlock)
+    {
+        vecBlock.resize(g_nRandomLength);
+        unsigned nSeed = n * 2654435761u + 1u;
+        for(unsigned i = 0u; i < g_nRandomLength; i++)
+        {
+            nSeed = nSeed * 1103515245u + 12345u;
+            vecBlock[i] = (char)(nSeed >> 16u);
+        }
+    }
+
+
+    // the IDs from g_nCodecBlocks on hold random blocks
+    bool writeRandomBlocks(deudb::IDEUDB *pDB, unsigned nFirst, unsigned nCount)
+    {
+        std::vector<char> vecBlock;
+        for(unsigned n = nFirst; n < nFirst + nCount; n++)
+        {
+            makeRandomBlock(n, vecBlock);
+            TEST_CHECK(pDB->replaceBlock(makeTestID(n), &vecBlock[0], (unsigned)vecBlock.size()));
+        }
+        return true;
+    }
+
+
+    bool checkRandomBlock(deudb::IDEUDB *pDB, unsigned n)
+    {
+        std::vector<char> vecBlock;
+        makeRandomBlock(n, vecBlock);
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        TEST_CHECK(pDB->readBlock(makeTestID(n), pBuffer) && pBuffer.valid());
+        TEST_CHECK(pBuffer->getLength() == vecBlock.size());
+        TEST_CHECK(memcmp(pBuffer->getData(), &vecBlock[0], vecBlock.size()) == 0);
+        return true;
+    }
+
+
+    bool checkCodecBlocks(deudb::IDEUDB *pDB, unsigned nRandomBlocks)
+    {
+        unsigned nRound = 0u;
+        for(unsigned n = 0u; n < g_nCodecBlocks; n++)
+        {
+            TEST_CHECK(readTestBlock(pDB, n, nRound) && nRound == 0u);
+        }
+        for(unsigned n = g_nCodecBlocks; n < g_nCodecBlocks + nRandomBlocks; n++)
+        {
+            TEST_CHECK(checkRandomBlock(pDB, n));
+        }
+        return true;
+    }
+
+
+    // the offsets of the frames in a data file, which is preallocated and has zeros behind the blocks
+    void findFrames(const std::vector<char> &vecFile, std::vector<size_t> &vecFrames)
+    {
+        vecFrames.clear();
+        for(size_t i = 0u; i + g_nFrameLength <= vecFile.size(); i++)
+        {
+            if(memcmp(&vecFile[i], g_szCodecFlag, sizeof(g_szCodecFlag)) == 0)
+            {
+                vecFrames.push_back(i);
+            }
+        }
+    }
+
+
+    unsigned char getFrameCodec(const std::vector<char> &vecFile, size_t nFrame)
+    {
+        return (unsigned char)vecFile[nFrame + g_nCodecOffset];
+    }
+
+
+    unsigned getFrameRawLength(const std::vector<char> &vecFile, size_t nFrame)
+    {
+        unsigned nRawLength = 0u;
+        memcpy(&nRawLength, &vecFile[nFrame + g_nRawLengthOffset], sizeof(unsigned));
+        return nRawLength;
+    }
+}
+
+
+// Blocks written with every compression read back as they were written, in the same session and
+// after a reopen, which sets no compression and has to decode them by their frames. The deflated
+// data files are smaller than the blocks in them, the dictionary is kept for the reopen.
+bool testCodecRoundTrip(const std::string &strDir)
+{
+    const deudb::BlockCompression eCompressions[] = { deudb::BC_NONE, deudb::BC_DEFLATE, deudb::BC_DEFLATE_DICT };
+    for(unsigned nMode = 0u; nMode < sizeof(eCompressions) / sizeof(eCompressions[0]); nMode++)
+    {
+        const std::string strDB = strDir + "/codec";
+        removeDatabase(strDB);
+
+        OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+        TEST_CHECK(pDB->openDB(strDB));
+        pDB->setCompression(eCompressions[nMode]);
+
+        UINT_64 nRawBytes = 0u;
+        std::vector<char> vecBlock;
+        for(unsigned n = 0u; n < g_nCodecBlocks; n++)
+        {
+            makeTestBlock(n, 0u, vecBlock);
+            TEST_CHECK(pDB->addBlock(makeTestID(n), &vecBlock[0], (unsigned)vecBlock.size()));
+            nRawBytes += vecBlock.size();
+        }
+        TEST_CHECK(writeRandomBlocks(pDB.get(), g_nCodecBlocks, 10u));
+        TEST_CHECK(checkCodecBlocks(pDB.get(), 10u));
+        pDB->closeDB();
+
+        TEST_CHECK(pDB->openDB(strDB));
+        TEST_CHECK(checkCodecBlocks(pDB.get(), 10u));
+        pDB->closeDB();
+
+        // the blocks of a new database are appended in the order of the writes, so the test blocks
+        // take what lies before the frame of the first random block
+        std::vector<char> vecFile;
+        std::vector<size_t> vecFrames;
+        TEST_CHECK(readFileBytes(getDBFilePath(strDB, 0u), vecFile));
+        findFrames(vecFile, vecFrames);
+        TEST_CHECK(vecFrames.size() == g_nCodecBlocks + 10u);
+        const UINT_64 nStoredBytes = vecFrames[g_nCodecBlocks] - vecFrames[0];
+        unsigned nDictFrames = 0u;
+        for(unsigned n = 0u; n < g_nCodecBlocks; n++)
+        {
+            if(getFrameCodec(vecFile, vecFrames[n]) == g_nCodecDict)    ++nDictFrames;
+        }
+        if(eCompressions[nMode] == deudb::BC_NONE)
+        {
+            TEST_CHECK(nStoredBytes >= nRawBytes);
+        }
+        else
+        {
+            TEST_CHECK(nStoredBytes < nRawBytes / 2u);
+        }
+        TEST_CHECK((nDictFrames > 0u) == (eCompressions[nMode] == deudb::BC_DEFLATE_DICT));
+        TEST_CHECK((getFileSize(strDB + ".zdict") > 0u) == (eCompressions[nMode] == deudb::BC_DEFLATE_DICT));
+
+        removeDatabase(strDB);
+    }
+    return true;
+}
+
+
+// A frame whose payload or header has been changed on the disk is not decoded into a wrong block,
+// the read of its ID fails and reports it, the other blocks are read as usual.
+bool testCodecCorruptFrame(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/codec_corrupt";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    pDB->setCompression(deudb::BC_DEFLATE);
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nCodecBlocks, 0u));
+    pDB->closeDB();
+
+    // 1. a byte of the payload of one frame and a byte of the raw length in the header of another
+    const std::string strDataFile = getDBFilePath(strDB, 0u);
+    std::vector<char> vecFile;
+    std::vector<size_t> vecFrames;
+    TEST_CHECK(readFileBytes(strDataFile, vecFile));
+    findFrames(vecFile, vecFrames);
+    TEST_CHECK(vecFrames.size() == g_nCodecBlocks);
+    TEST_CHECK(flipFileByte(strDataFile, vecFrames[10] + g_nFrameLength + 4u));
+    TEST_CHECK(flipFileByte(strDataFile, vecFrames[20] + 8u));
+
+    // 2. the blocks of exactly two IDs are gone
+    TEST_CHECK(pDB->openDB(strDB));
+    std::vector<unsigned> vecBroken;
+    for(unsigned n = 0u; n < g_nCodecBlocks; n++)
+    {
+        unsigned nRound = 0u;
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        if(!pDB->readBlock(makeTestID(n), pBuffer))
+        {
+            vecBroken.push_back(n);
+            continue;
+        }
+        TEST_CHECK(pBuffer.valid() && checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound));
+    }
+    TEST_CHECK(vecBroken.size() == 2u);
+
+    deudb::ScrubStatus status;
+    std::vector<ID> vecCorruptIDs;
+    pDB->getScrubStatus(status, vecCorruptIDs);
+    TEST_CHECK(vecCorruptIDs.size() == 2u);
+    for(size_t i = 0u; i < vecBroken.size(); i++)
+    {
+        TEST_CHECK(std::find(vecCorruptIDs.begin(), vecCorruptIDs.end(), makeTestID(vecBroken[i])) != vecCorruptIDs.end());
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// A block which deflate cannot shrink by a sixteenth is stored as it is behind a raw frame, the
+// random blocks and the shortest test blocks, the longer test blocks are deflated.
+bool testCodecIncompressible(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/codec_raw";
+    removeDatabase(strDB);
+
+    const unsigned nRandomBlocks = 50u;
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    pDB->setCompression(deudb::BC_DEFLATE);
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nCodecBlocks, 0u));
+    TEST_CHECK(writeRandomBlocks(pDB.get(), g_nCodecBlocks, nRandomBlocks));
+    pDB->closeDB();
+
+    std::vector<char> vecFile;
+    std::vector<size_t> vecFrames;
+    TEST_CHECK(readFileBytes(getDBFilePath(strDB, 0u), vecFile));
+    findFrames(vecFile, vecFrames);
+    TEST_CHECK(vecFrames.size() == g_nCodecBlocks + nRandomBlocks);
+
+    // every random block lies verbatim behind a raw frame, the test blocks are shorter than them
+    unsigned nRandomFrames = 0u;
+    std::vector<char> vecBlock;
+    for(size_t i = 0u; i < vecFrames.size(); i++)
+    {
+        const unsigned nRawLength = getFrameRawLength(vecFile, vecFrames[i]);
+        if(nRawLength != g_nRandomLength)
+        {
+            TEST_CHECK(nRawLength < g_nShrinkLength || getFrameCodec(vecFile, vecFrames[i]) != g_nCodecRaw);
+            continue;
+        }
+
+        TEST_CHECK(getFrameCodec(vecFile, vecFrames[i]) == g_nCodecRaw);
+        TEST_CHECK(vecFrames[i] + g_nFrameLength + g_nRandomLength <= vecFile.size());
+        const char *pPayload = &vecFile[vecFrames[i] + g_nFrameLength];
+        unsigned n = g_nCodecBlocks;
+        for( ; n < g_nCodecBlocks + nRandomBlocks; n++)
+        {
+            makeRandomBlock(n, vecBlock);
+            if(memcmp(pPayload, &vecBlock[0], g_nRandomLength) == 0)    break;
+        }
+        TEST_CHECK(n < g_nCodecBlocks + nRandomBlocks);
+        ++nRandomFrames;
+    }
+    TEST_CHECK(nRandomFrames == nRandomBlocks);
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkCodecBlocks(pDB.get(), nRandomBlocks));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
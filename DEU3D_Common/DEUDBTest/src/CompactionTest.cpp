@@ -0,0 +1,158 @@
+#include "DEUDBTest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nCompactionIDs = 20000u;
+
+    // rewrites and removes blocks until it is stopped, m_vecRounds tells what each ID must hold then
+    class CompactionWriter : public OpenThreads::Thread
+    {
+    public:
+        CompactionWriter(deudb::IDEUDB *pDB, const std::vector<unsigned> &vecRounds)
+            : m_pDB(pDB), m_vecRounds(vecRounds), m_bStop(false), m_bFailed(false), m_nBatches(0u){}
+        ~CompactionWriter(void){}
+
+    public:
+        virtual void run(void)
+        {
+            const unsigned nCount = (unsigned)m_vecRounds.size();
+            for(unsigned nRound = 1u; !m_bStop; nRound++)
+            {
+                const unsigned nFirst = (nRound * 613u) % (nCount - 32u);
+                if(!writeTestBlocks(m_pDB, nFirst, 32u, nRound))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                for(unsigned n = nFirst; n < nFirst + 32u; n++)
+                {
+                    m_vecRounds[n] = nRound;
+                }
+
+                const unsigned nRemoved = (nRound * 7919u) % nCount;
+                if(nRound % 3u == 0u && m_vecRounds[nRemoved] != ~0u)
+                {
+                    if(!m_pDB->removeBlock(makeTestID(nRemoved)))
+                    {
+                        m_bFailed = true;
+                        return;
+                    }
+                    m_vecRounds[nRemoved] = ~0u;
+                }
+                ++m_nBatches;
+            }
+        }
+
+        void stop(void)
+        {
+            m_bStop = true;
+            join();
+        }
+
+    public:
+        deudb::IDEUDB          *m_pDB;
+        std::vector<unsigned>   m_vecRounds;
+        volatile bool           m_bStop;
+        volatile bool           m_bFailed;
+        volatile unsigned       m_nBatches;
+    };
+
+
+    // ~0u is a removed ID
+    bool checkCompactedState(deudb::IDEUDB *pDB, const std::vector<unsigned> &vecRounds)
+    {
+        unsigned nAlive = 0u;
+        for(unsigned n = 0u; n < vecRounds.size(); n++)
+        {
+            if(vecRounds[n] == ~0u)
+            {
+                TEST_CHECK(!pDB->isExist(makeTestID(n)));
+                continue;
+            }
+
+            unsigned nRound = 0u;
+            TEST_CHECK(readTestBlock(pDB, n, nRound));
+            TEST_CHECK(nRound == vecRounds[n]);
+            ++nAlive;
+        }
+
+        std::vector<ID> vecIndices;
+        pDB->getIndices(vecIndices);
+        TEST_CHECK(vecIndices.size() == nAlive);
+        TEST_CHECK(pDB->getBlockCount() == nAlive);
+        return true;
+    }
+}
+
+
+// A compaction runs while a writer rewrites and removes blocks and a reader reads them. Every read
+// must get a whole block of its ID, and afterwards, also once reopened from the sorted index and once
+// from the rewritten .idx alone, the database must hold exactly what the writer has left.
+bool testCompactionUnderWrites(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/compaction";
+    removeDatabase(strDB);
+
+    // every other block goes, so the sealed files have something to give back
+    std::vector<unsigned> vecRounds(g_nCompactionIDs, 0u);
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nCompactionIDs, 0u));
+    for(unsigned n = 1u; n < g_nCompactionIDs; n += 2u)
+    {
+        TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+        vecRounds[n] = ~0u;
+    }
+    pDB->closeDB();
+    TEST_CHECK(pDB->openDB(strDB));
+
+    CompactionWriter writer(pDB.get(), vecRounds);
+    writer.startThread();
+    const bool bStarted = pDB->startCompaction();
+
+    bool bReadsValid = true;
+    deudb::CompactionStatus status;
+    memset(&status, 0, sizeof(status));
+    for(unsigned nRead = 0u; bStarted && bReadsValid; nRead++)
+    {
+        pDB->getCompactionStatus(status);
+        if(!status.m_bRunning)  break;
+
+        const unsigned n = (nRead * 7u) % g_nCompactionIDs;
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        unsigned nRound = 0u;
+        if(pDB->readBlock(makeTestID(n), pBuffer) && pBuffer.valid())
+        {
+            bReadsValid = checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound);
+        }
+    }
+
+    // some writes over the new index before the writer stops
+    sleepMilliseconds(200u);
+    writer.stop();
+
+    TEST_CHECK(bStarted);
+    TEST_CHECK(bReadsValid);
+    TEST_CHECK(!writer.m_bFailed);
+    TEST_CHECK(status.m_bFinished);
+    TEST_CHECK(status.m_nBlocksMoved > 0u);
+    TEST_CHECK(writer.m_nBatches > 0u);
+    TEST_CHECK(checkCompactedState(pDB.get(), writer.m_vecRounds));
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkCompactedState(pDB.get(), writer.m_vecRounds));
+    pDB->closeDB();
+
+    // without the sorted index the .idx is all there is
+    remove((strDB + ".sidx").c_str());
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkCompactedState(pDB.get(), writer.m_vecRounds));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef DEUDB_TEST_H_5B0C7E2A_91D4_4F3B_8C6E_2D7A14F0B953_INCLUDE
+#define DEUDB_TEST_H_5B0C7E2A_91D4_4F3B_8C6E_2D7A14F0B953_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <DEUDB/IDEUDB.h>
+#include <Common/TestRunner.h>
+
+// The test blocks tell by their content which ID and which round of writing they belong to,
+// so a block which is read back can be checked without remembering what was written.
+ID          makeTestID(unsigned n);
+void        makeTestBlock(unsigned n, unsigned nRound, std::vector<char> &vecBlock);
+bool        checkTestBlock(unsigned n, const void *pData, unsigned nLength, unsigned &nRound);
+
+// false if the block is missing, nRound is ~0u then, or if it is not the one of n
+bool        readTestBlock(deudb::IDEUDB *pDB, unsigned n, unsigned &nRound);
+bool        writeTestBlocks(deudb::IDEUDB *pDB, unsigned nFirst, unsigned nCount, unsigned nRound);
+
+// the files of a database: .idx, .wal, .sidx, .zdict, .bloom and the _N.db files
+std::string getDBFilePath(const std::string &strDB, unsigned nDBFile);
+void        removeDatabase(const std::string &strDB);
+bool        copyDatabase(const std::string &strSource, const std::string &strTarget);
+// nLength cuts the copy short
+bool        copyFile(const std::string &strSource, const std::string &strTarget, UINT_64 nLength = ~(UINT_64)0u);
+UINT_64     getFileSize(const std::string &strFile);
+bool        readFileBytes(const std::string &strFile, std::vector<char> &vecBytes);
+// inverts the byte at nOffset, as a bad sector or a stray write would change it
+bool        flipFileByte(const std::string &strFile, UINT_64 nOffset);
+// wait until the file has grown beyond nSize and stopped growing, false if it has not after nTimeout ms
+bool        waitForFileToSettle(const std::string &strFile, UINT_64 nSize, unsigned nTimeout);
+
+using cmm::sleepMilliseconds;
+using cmm::getSeconds;
+
+// the tests, each of them creates its databases under strDir and removes them again
+bool        testWalReplay(const std::string &strDir);
+bool        testWalCrash(const std::string &strDir);
+bool        testCompactionUnderWrites(const std::string &strDir);
+bool        testBloomFilterGrowth(const std::string &strDir);
+bool        testSnapshotVisibility(const std::string &strDir);
+bool        testVersionRetention(const std::string &strDir);
+bool        testSortedIndexLookup(const std::string &strDir);
+bool        testSortedIndexRebuild(const std::string &strDir);
+bool        testCachePromotion(const std::string &strDir);
+bool        testCacheBudget(const std::string &strDir);
+bool        testCacheShards(const std::string &strDir);
+bool        testCodecRoundTrip(const std::string &strDir);
+bool        testCodecCorruptFrame(const std::string &strDir);
+bool        testCodecIncompressible(const std::string &strDir);
+bool        testReadBlocksCoalesced(const std::string &strDir);
+bool        testReadBlocksGaps(const std::string &strDir);
+bool        testScrubCorruption(const std::string &strDir);
+bool        testScrubUnderWrites(const std::string &strDir);
+bool        testScanRanges(const std::string &strDir);
+bool        testScanUnderWrites(const std::string &strDir);
+bool        testFreeSpaceAlloc(const std::string &strDir);
+bool        testFreeSpaceCoalesce(const std::string &strDir);
+bool        testFreeSpaceRandom(const std::string &strDir);
+bool        testBufferLifetime(const std::string &strDir);
+bool        testBufferRelease(const std::string &strDir);
+
+// the writer process of testWalCrash, it writes until it is killed
+int         runCrashWriter(const std::string &strDB);
+
+// the MB/s of addBlock and of a bulk load from nThreads threads, the number of failed runs is returned
+int         runIngestBenchmark(const std::string &strDir, unsigned nThreads, unsigned nBlocks);
+
+// the time openDB takes with and without the sorted index, and the lookups per second through it
+int         runIndexBenchmark(const std::string &strDir, unsigned nBlocks);
+
+// the hit rate of the block cache under a skewed load with and without scans, with one and with many shards
+int         runCacheBenchmark(unsigned nThreads, unsigned nReads);
+
+// the reads per second past the cache from one thread and from nThreads, positioned and mapped
+int         runReadBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads);
+
+// the lookups per second of absent and present IDs, and of absent ones while a writer fills the bloom filter
+int         runBloomBenchmark(const std::string &strDir, unsigned nThreads, unsigned nLookups);
+
+#endif
@@ -0,0 +1,188 @@
+#include "DEUDBTest.h"
+#include <algorithm>
+#include "FreeSpaceMap.h"
+
+namespace
+{
+    const unsigned g_nModelLength   = 65536u;       // the file of the random test, one flag for every byte
+    const unsigned g_nModelSteps    = 20000u;
+
+    // the free bytes of the map are exactly those the model flags, in the same runs
+    bool checkAgainstModel(const deudb::FreeSpaceMap &spaceMap, const std::vector<bool> &vecFree)
+    {
+        UINT_64 nFree = 0u, nLargest = 0u, nRun = 0u;
+        unsigned nRuns = 0u;
+        for(unsigned i = 0u; i <= vecFree.size(); i++)
+        {
+            if(i < vecFree.size() && vecFree[i])
+            {
+                ++nFree;
+                if(++nRun == 1u)    ++nRuns;
+                continue;
+            }
+            nLargest = std::max(nLargest, nRun);
+            nRun = 0u;
+        }
+        TEST_CHECK(spaceMap.getFreeSize() == nFree);
+        TEST_CHECK(spaceMap.getGapCount() == nRuns);
+        TEST_CHECK(spaceMap.getLargestGap() == nLargest);
+
+        std::vector<deudb::FileGap> vecGaps;
+        spaceMap.getGaps(vecGaps);
+        for(size_t i = 0u; i < vecGaps.size(); i++)
+        {
+            const UINT_64 nEnd = vecGaps[i].m_nPosition + vecGaps[i].m_nLength;
+            TEST_CHECK(nEnd <= vecFree.size());
+            TEST_CHECK(vecGaps[i].m_nPosition == 0u || !vecFree[(size_t)vecGaps[i].m_nPosition - 1u]);
+            TEST_CHECK(nEnd == vecFree.size() || !vecFree[(size_t)nEnd]);
+        }
+        return true;
+    }
+
+
+    bool allocAt(deudb::FreeSpaceMap &spaceMap, unsigned nLength, UINT_64 nExpected)
+    {
+        UINT_64 nPosition = ~(UINT_64)0u;
+        TEST_CHECK(spaceMap.alloc(nLength, nPosition));
+        TEST_CHECK(nPosition == nExpected);
+        return true;
+    }
+}
+
+
+// The allocation takes the best fit of the size class of the length, else the smallest gap of the
+// next class which has any, and gives the rest of the gap back as a gap of its own.
+bool testFreeSpaceAlloc(const std::string &strDir)
+{
+    deudb::FreeSpaceMap spaceMap;
+    UINT_64 nPosition = 0u;
+    TEST_CHECK(!spaceMap.alloc(1u, nPosition));
+
+    spaceMap.release(0u, 100u);
+    spaceMap.release(1000u, 300u);
+    spaceMap.release(2000u, 130u);
+    spaceMap.release(3000u, 70u);
+    spaceMap.release(10000u, 5000u);
+    TEST_CHECK(spaceMap.getGapCount() == 5u && spaceMap.getFreeSize() == 5600u);
+    TEST_CHECK(spaceMap.getLargestGap() == 5000u);
+
+    // 1. within the class [64, 128): the exact one and the smallest which holds the length
+    TEST_CHECK(allocAt(spaceMap, 100u, 0u));
+    TEST_CHECK(allocAt(spaceMap, 64u, 3000u));
+    TEST_CHECK(spaceMap.getGapCount() == 4u && spaceMap.getFreeSize() == 5436u);
+
+    // 2. nothing in [64, 128) holds 120, the smallest of [128, 256) does, its rest stays free behind it
+    TEST_CHECK(allocAt(spaceMap, 120u, 2000u));
+    TEST_CHECK(allocAt(spaceMap, 10u, 2120u));
+
+    // 3. [128, 256) is empty now, so the 300 of [256, 512) is split rather than the 5000
+    TEST_CHECK(allocAt(spaceMap, 200u, 1000u));
+    TEST_CHECK(allocAt(spaceMap, 100u, 1200u));
+    TEST_CHECK(allocAt(spaceMap, 6u, 3064u));
+    TEST_CHECK(spaceMap.getGapCount() == 1u && spaceMap.getFreeSize() == 5000u);
+
+    // 4. too long for every gap, or nothing at all
+    TEST_CHECK(!spaceMap.alloc(5001u, nPosition));
+    TEST_CHECK(!spaceMap.alloc(0u, nPosition));
+    TEST_CHECK(allocAt(spaceMap, 5000u, 10000u));
+    TEST_CHECK(spaceMap.empty() && spaceMap.getFreeSize() == 0u);
+    return true;
+}
+
+
+// A released span merges with the gaps it touches or overlaps on both sides, whatever order the
+// spans come in. The gap at the end of the file is cut off as a whole, a gap beyond what FileGap
+// can hold is listed in pieces which merge again.
+bool testFreeSpaceCoalesce(const std::string &strDir)
+{
+    deudb::FreeSpaceMap spaceMap;
+
+    // 1. ten neighbours released out of order become one gap
+    const unsigned nOrder[10] = { 3u, 7u, 0u, 9u, 5u, 1u, 8u, 2u, 6u, 4u };
+    for(unsigned i = 0u; i < 10u; i++)
+    {
+        spaceMap.release(nOrder[i] * 100u, 100u);
+    }
+    TEST_CHECK(spaceMap.getGapCount() == 1u && spaceMap.getFreeSize() == 1000u);
+
+    // 2. a span over a gap and one which bridges two
+    spaceMap.release(200u, 300u);
+    TEST_CHECK(spaceMap.getGapCount() == 1u && spaceMap.getFreeSize() == 1000u);
+    spaceMap.release(2000u, 100u);
+    spaceMap.release(950u, 1100u);
+    TEST_CHECK(spaceMap.getGapCount() == 1u && spaceMap.getFreeSize() == 2100u);
+
+    // 3. the gap at the end
+    spaceMap.release(3000u, 500u);
+    TEST_CHECK(spaceMap.getGapEndsAt(3400u) == 0u);
+    TEST_CHECK(spaceMap.getGapEndsAt(3500u) == 500u);
+    TEST_CHECK(spaceMap.cutGapEndsAt(3500u) == 500u);
+    TEST_CHECK(spaceMap.getGapCount() == 1u && spaceMap.getFreeSize() == 2100u);
+    TEST_CHECK(spaceMap.cutGapEndsAt(3500u) == 0u);
+
+    // 4. a gap of 5GB
+    const UINT_64 nHuge = (UINT_64)5u << 30u;
+    spaceMap.clear();
+    spaceMap.release(4096u, nHuge);
+    std::vector<deudb::FileGap> vecGaps;
+    spaceMap.getGaps(vecGaps);
+    TEST_CHECK(vecGaps.size() == 3u);
+    deudb::FreeSpaceMap spaceMapCopy;
+    for(size_t i = 0u; i < vecGaps.size(); i++)
+    {
+        spaceMapCopy.release(vecGaps[i].m_nPosition, vecGaps[i].m_nLength);
+    }
+    TEST_CHECK(spaceMapCopy.getGapCount() == 1u && spaceMapCopy.getFreeSize() == nHuge);
+    TEST_CHECK(spaceMapCopy.getGapEndsAt(4096u + nHuge) == nHuge);
+    return true;
+}
+
+
+// Random allocations and releases against a flag for every byte: an allocation lies wholly in free
+// bytes, fails only when no run is long enough, and the gaps are always the maximal free runs.
+bool testFreeSpaceRandom(const std::string &strDir)
+{
+    deudb::FreeSpaceMap spaceMap;
+    std::vector<bool> vecFree(g_nModelLength, true);
+    spaceMap.release(0u, g_nModelLength);
+
+    unsigned nSeed = 12345u;
+    for(unsigned nStep = 0u; nStep < g_nModelSteps; nStep++)
+    {
+        nSeed = nSeed * 1103515245u + 12345u;
+        const unsigned nRandom = nSeed >> 8u;
+        const unsigned nLength = 1u + ((nRandom & 0x100u) ? (nRandom % 2000u) : (nRandom % 64u));
+        if(nStep % 3u != 2u)
+        {
+            UINT_64 nPosition = 0u;
+            if(!spaceMap.alloc(nLength, nPosition))
+            {
+                TEST_CHECK(spaceMap.getLargestGap() < nLength);
+                continue;
+            }
+            TEST_CHECK(nPosition + nLength <= g_nModelLength);
+            for(unsigned i = 0u; i < nLength; i++)
+            {
+                TEST_CHECK(vecFree[(size_t)nPosition + i]);
+                vecFree[(size_t)nPosition + i] = false;
+            }
+        }
+        else
+        {
+            // a span which may overlap free bytes, as a block and the gap beside it
+            const unsigned nPosition = (nRandom * 7u) % (g_nModelLength - nLength);
+            spaceMap.release(nPosition, nLength);
+            for(unsigned i = 0u; i < nLength; i++)
+            {
+                vecFree[nPosition + i] = true;
+            }
+        }
+
+        if(nStep % 100u == 0u)
+        {
+            TEST_CHECK(checkAgainstModel(spaceMap, vecFree));
+        }
+    }
+    TEST_CHECK(checkAgainstModel(spaceMap, vecFree));
+    return true;
+}
@@ -0,0 +1,120 @@
+#include "DEUDBTest.h"
+#include <OpenThreads/Thread>
+
+namespace
+{
+    // thread i of nThreads writes the IDs i, i + nThreads, ... below nBlocks
+    class IngestThread : public OpenThreads::Thread
+    {
+    public:
+        IngestThread(deudb::IDEUDB *pDB, bool bBulk, unsigned nThread, unsigned nThreads, unsigned nBlocks)
+            : m_pDB(pDB), m_bBulk(bBulk), m_nThread(nThread), m_nThreads(nThreads), m_nBlocks(nBlocks), m_nBytes(0u), m_bFailed(false){}
+        ~IngestThread(void){}
+
+    public:
+        virtual void run(void)
+        {
+            std::vector<char> vecBlock;
+            for(unsigned n = m_nThread; n < m_nBlocks; n += m_nThreads)
+            {
+                makeTestBlock(n, 0u, vecBlock);
+                OpenSP::sp<deudb::IBlockBuffer> pBuffer = deudb::createBlockBuffer(&vecBlock[0], (unsigned)vecBlock.size());
+                const bool bAdded = m_bBulk ? m_pDB->bulkAddBlock(makeTestID(n), pBuffer.get()) : m_pDB->addBlock(makeTestID(n), pBuffer.get());
+                if(!bAdded)
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_nBytes += vecBlock.size();
+            }
+        }
+
+    public:
+        deudb::IDEUDB  *m_pDB;
+        bool            m_bBulk;
+        unsigned        m_nThread;
+        unsigned        m_nThreads;
+        unsigned        m_nBlocks;
+        UINT_64         m_nBytes;
+        bool            m_bFailed;
+    };
+
+
+    // the time from the first write until the blocks are in the files, -1 if a write has failed
+    double runIngest(const std::string &strDB, bool bBulk, unsigned nThreads, unsigned nBlocks, UINT_64 &nBytes)
+    {
+        removeDatabase(strDB);
+        OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+        if(!pDB->openDB(strDB))
+        {
+            return -1.0;
+        }
+
+        const double dblStart = getSeconds();
+        if(bBulk && !pDB->beginBulkLoad())
+        {
+            return -1.0;
+        }
+
+        std::vector<IngestThread *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads.push_back(new IngestThread(pDB.get(), bBulk, i, nThreads, nBlocks));
+            vecThreads.back()->startThread();
+        }
+
+        bool bFailed = false;
+        nBytes = 0u;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            bFailed = bFailed || vecThreads[i]->m_bFailed;
+            nBytes += vecThreads[i]->m_nBytes;
+            delete vecThreads[i];
+        }
+        if(bBulk && !pDB->endBulkLoad())
+        {
+            bFailed = true;
+        }
+        pDB->closeDB();
+        const double dblSeconds = getSeconds() - dblStart;
+
+        // every block must be back as it was written
+        if(!bFailed && pDB->openDB(strDB))
+        {
+            unsigned nRound = 0u;
+            for(unsigned n = 0u; n < nBlocks && !bFailed; n++)
+            {
+                bFailed = !readTestBlock(pDB.get(), n, nRound) || nRound != 0u;
+            }
+            bFailed = bFailed || (pDB->getBlockCount() != nBlocks);
+            pDB->closeDB();
+        }
+        removeDatabase(strDB);
+        return bFailed ? -1.0 : dblSeconds;
+    }
+}
+
+
+int runIngestBenchmark(const std::string &strDir, unsigned nThreads, unsigned nBlocks)
+{
+    printf("ingest of %u blocks from %u threads\n", nBlocks, nThreads);
+
+    int nFailed = 0;
+    for(unsigned nMode = 0u; nMode < 2u; nMode++)
+    {
+        const bool bBulk = (nMode == 1u);
+        UINT_64 nBytes = 0u;
+        const double dblSeconds = runIngest(strDir + "/ingest_bench", bBulk, nThreads, nBlocks, nBytes);
+        if(dblSeconds < 0.0)
+        {
+            printf("    %-10s FAILED\n", bBulk ? "bulk load" : "addBlock");
+            ++nFailed;
+            continue;
+        }
+
+        const double dblMB = nBytes / (1024.0 * 1024.0);
+        printf("    %-10s %.1f MB in %.2fs, %.1f MB/s\n", bBulk ? "bulk load" : "addBlock", dblMB, dblSeconds, dblMB / dblSeconds);
+    }
+    return nFailed;
+}
@@ -0,0 +1,126 @@
+#include "DEUDBTest.h"
+#include <OpenThreads/Thread>
+
+namespace
+{
+    // reads m_nReads blocks of IDs below m_nBlocks in an order of its own, the cache is off so every
+    // read goes to the file
+    class ReadThread : public OpenThreads::Thread
+    {
+    public:
+        ReadThread(deudb::IDEUDB *pDB, unsigned nThread, unsigned nBlocks, unsigned nReads)
+            : m_pDB(pDB), m_nThread(nThread), m_nBlocks(nBlocks), m_nReads(nReads), m_nBytes(0u), m_bFailed(false){}
+        ~ReadThread(void){}
+
+    public:
+        virtual void run(void)
+        {
+            unsigned nSeed = m_nThread * 2654435761u + 1u;
+            for(unsigned i = 0u; i < m_nReads; i++)
+            {
+                nSeed = nSeed * 1103515245u + 12345u;
+                const unsigned n = (nSeed >> 8u) % m_nBlocks;
+                OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+                unsigned nRound = 0u;
+                if(!m_pDB->readBlock(makeTestID(n), pBuffer) || !pBuffer.valid()
+                    || !checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                m_nBytes += pBuffer->getLength();
+            }
+        }
+
+    public:
+        deudb::IDEUDB  *m_pDB;
+        unsigned        m_nThread;
+        unsigned        m_nBlocks;
+        unsigned        m_nReads;
+        UINT_64         m_nBytes;
+        bool            m_bFailed;
+    };
+
+
+    // the seconds nThreads threads take for nReads reads in all, -1 if a read has failed
+    double runReads(const std::string &strDB, bool bMapped, unsigned nThreads, unsigned nBlocks, unsigned nReads, UINT_64 &nBytes)
+    {
+        OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+        pDB->setMappedRead(bMapped);
+        if(!pDB->openDB(strDB, 0u))
+        {
+            return -1.0;
+        }
+
+        const double dblStart = getSeconds();
+        std::vector<ReadThread *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads.push_back(new ReadThread(pDB.get(), i, nBlocks, nReads / nThreads));
+            vecThreads.back()->startThread();
+        }
+
+        bool bFailed = false;
+        nBytes = 0u;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            bFailed = bFailed || vecThreads[i]->m_bFailed;
+            nBytes += vecThreads[i]->m_nBytes;
+            delete vecThreads[i];
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+        pDB->closeDB();
+        return bFailed ? -1.0 : dblSeconds;
+    }
+}
+
+
+int runReadBenchmark(const std::string &strDir, unsigned nThreads, unsigned nReads)
+{
+    const unsigned nBlocks = 50000u;
+    printf("%u random reads of %u blocks past the cache\n", nReads, nBlocks);
+
+    const std::string strDB = strDir + "/read_bench";
+    removeDatabase(strDB);
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    bool bWritten = pDB->openDB(strDB);
+    const unsigned nBatch = 1000u;
+    for(unsigned n = 0u; n < nBlocks && bWritten; n += nBatch)
+    {
+        bWritten = writeTestBlocks(pDB.get(), n, nBatch, 0u);
+    }
+    pDB->closeDB();
+    if(!bWritten)
+    {
+        printf("    FAILED to write the blocks\n");
+        removeDatabase(strDB);
+        return 1;
+    }
+
+    // one thread and many, the positioned reads do not wait for each other as a shared file pointer would
+    int nFailed = 0;
+    const unsigned nThreadCounts[2] = { 1u, nThreads };
+    for(unsigned nMode = 0u; nMode < 2u; nMode++)
+    {
+        const bool bMapped = (nMode == 1u);
+        for(unsigned i = 0u; i < 2u; i++)
+        {
+            UINT_64 nBytes = 0u;
+            const double dblSeconds = runReads(strDB, bMapped, nThreadCounts[i], nBlocks, nReads, nBytes);
+            if(dblSeconds < 0.0)
+            {
+                printf("    %-8s %2u threads FAILED\n", bMapped ? "mapped" : "pread", nThreadCounts[i]);
+                ++nFailed;
+                continue;
+            }
+
+            const unsigned nDone = (nReads / nThreadCounts[i]) * nThreadCounts[i];
+            printf("    %-8s %2u threads %.0f reads/s, %.1f MB/s\n", bMapped ? "mapped" : "pread", nThreadCounts[i],
+                   nDone / dblSeconds, nBytes / (1024.0 * 1024.0) / dblSeconds);
+        }
+    }
+
+    removeDatabase(strDB);
+    return nFailed;
+}
@@ -0,0 +1,275 @@
+#include "DEUDBTest.h"
+#include <set>
+#include <iterator>
+
+namespace
+{
+    // the IDs of the scans spread over three high words and two middle ones, more of them than one batch
+    const unsigned g_nScanHighs     = 3u;
+    const unsigned g_nScanMids      = 2u;
+    const unsigned g_nScanLows      = 1500u;
+
+    const char     g_szScanBlock[]  = "scan";
+
+    // a scan takes so many IDs from the index at a time, as FileCache does, and hands them out as
+    // they were then
+    const unsigned g_nScanBatch     = 4096u;
+    const unsigned g_nWriteScanLows = 6000u;
+
+    ID makeScanID(unsigned nHigh, unsigned nMid, unsigned nLow)
+    {
+        return ID((UINT_64)nHigh + 1u, (UINT_64)(nMid + 1u) * 10u, (UINT_64)nLow);
+    }
+
+
+    bool addScanBlock(deudb::IDEUDB *pDB, const ID &id, std::set<ID> &setIDs)
+    {
+        TEST_CHECK(pDB->addBlock(id, g_szScanBlock, sizeof(g_szScanBlock)));
+        setIDs.insert(id);
+        return true;
+    }
+
+
+    bool isInRange(const deudb::IDScanRange &range, const ID &id)
+    {
+        return !(id < range.m_idFirst) && !(range.m_idLast < id)
+            && ((id.m_nHighBit ^ range.m_idValue.m_nHighBit) & range.m_idMask.m_nHighBit) == 0u
+            && ((id.m_nMidBit  ^ range.m_idValue.m_nMidBit)  & range.m_idMask.m_nMidBit)  == 0u
+            && ((id.m_nLowBit  ^ range.m_idValue.m_nLowBit)  & range.m_idMask.m_nLowBit)  == 0u;
+    }
+
+
+    // the scan gives the IDs of the set in range, in order and each once
+    bool checkScan(deudb::IDEUDB *pDB, const deudb::IDScanRange &range, const std::set<ID> &setIDs)
+    {
+        std::vector<ID> vecExpected;
+        for(std::set<ID>::const_iterator itor = setIDs.begin(); itor != setIDs.end(); ++itor)
+        {
+            if(isInRange(range, *itor))     vecExpected.push_back(*itor);
+        }
+
+        OpenSP::sp<deudb::IIndexIterator> pIterator = pDB->scanIndices(range);
+        TEST_CHECK(pIterator.valid());
+        std::vector<ID> vecScanned;
+        ID id;
+        while(pIterator->next(id))
+        {
+            vecScanned.push_back(id);
+        }
+        TEST_CHECK(vecScanned == vecExpected);
+        return true;
+    }
+
+
+    // the ranges of the test: the bounds alone, the masks alone and both
+    bool checkScanRanges(deudb::IDEUDB *pDB, const std::set<ID> &setIDs)
+    {
+        const UINT_64 nAll = ~(UINT_64)0u;
+        deudb::IDScanRange range;
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+
+        // the bounds are inclusive, they need not be IDs of the database
+        range.m_idFirst = makeScanID(1u, 0u, 100u);
+        range.m_idLast  = makeScanID(2u, 0u, 50u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        range.m_idFirst = ID(1u, 15u, 0u);
+        range.m_idLast  = ID(3u, 0u, 0u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        range.m_idFirst = makeScanID(1u, 1u, 7u);
+        range.m_idLast  = range.m_idFirst;
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+
+        // the last before the first is empty
+        range.m_idFirst = makeScanID(2u, 0u, 0u);
+        range.m_idLast  = makeScanID(1u, 0u, 0u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+
+        // whole words under the mask seek their stretch, a partial one filters
+        range = deudb::IDScanRange();
+        range.m_idMask  = ID(nAll, 0u, 0u);
+        range.m_idValue = makeScanID(1u, 0u, 0u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        range.m_idMask  = ID(nAll, nAll, 0u);
+        range.m_idValue = makeScanID(2u, 1u, 0u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        range.m_idMask  = ID(nAll, nAll, nAll);
+        range.m_idValue = makeScanID(0u, 1u, 1234u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        range.m_idMask  = ID(0u, nAll, 0xFu);
+        range.m_idValue = ID(0u, 20u, 3u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+
+        // the mask and bounds which cut its stretch
+        range.m_idMask  = ID(nAll, 0u, 1u);
+        range.m_idValue = makeScanID(1u, 0u, 1u);
+        range.m_idFirst = makeScanID(1u, 0u, 500u);
+        range.m_idLast  = makeScanID(1u, 1u, 500u);
+        TEST_CHECK(checkScan(pDB, range, setIDs));
+        return true;
+    }
+}
+
+
+// The scans give the IDs within their bounds and under their mask in ascending order, each once,
+// whether the IDs lie in the sorted index, in the blocks written since openDB or in both, with some
+// of the sorted ones removed again.
+bool testScanRanges(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/scan";
+    removeDatabase(strDB);
+
+    // the even low words go into the sorted index, the odd ones stay in memory
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    std::set<ID> setIDs;
+    for(unsigned nHigh = 0u; nHigh < g_nScanHighs; nHigh++)
+    {
+        for(unsigned nMid = 0u; nMid < g_nScanMids; nMid++)
+        {
+            for(unsigned nLow = 0u; nLow < g_nScanLows; nLow += 2u)
+            {
+                TEST_CHECK(addScanBlock(pDB.get(), makeScanID(nHigh, nMid, nLow), setIDs));
+            }
+        }
+    }
+    TEST_CHECK(checkScanRanges(pDB.get(), setIDs));
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkScanRanges(pDB.get(), setIDs));
+    for(unsigned nHigh = 0u; nHigh < g_nScanHighs; nHigh++)
+    {
+        for(unsigned nMid = 0u; nMid < g_nScanMids; nMid++)
+        {
+            for(unsigned nLow = 1u; nLow < g_nScanLows; nLow += 2u)
+            {
+                TEST_CHECK(addScanBlock(pDB.get(), makeScanID(nHigh, nMid, nLow), setIDs));
+            }
+            for(unsigned nLow = 0u; nLow < g_nScanLows; nLow += 6u)
+            {
+                TEST_CHECK(pDB->removeBlock(makeScanID(nHigh, nMid, nLow)));
+                setIDs.erase(makeScanID(nHigh, nMid, nLow));
+            }
+        }
+    }
+    TEST_CHECK(checkScanRanges(pDB.get(), setIDs));
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkScanRanges(pDB.get(), setIDs));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// The index changes while a scan is half way. The scan goes on behind the last ID of its batch, so
+// it still gives its IDs in order and each once, every ID which has been there all along and none
+// added behind it. Beyond the batch in hand it sees the index as it is: the IDs added there and
+// not those removed. Once the database is closed the scan ends after the batch it holds.
+bool testScanUnderWrites(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/scan_writes";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    std::set<ID> setIDs;
+    for(unsigned nHigh = 0u; nHigh < g_nScanHighs; nHigh++)
+    {
+        for(unsigned nLow = 0u; nLow < g_nWriteScanLows; nLow += 2u)
+        {
+            TEST_CHECK(addScanBlock(pDB.get(), makeScanID(nHigh, 0u, nLow), setIDs));
+        }
+    }
+    pDB->closeDB();
+    TEST_CHECK(pDB->openDB(strDB));
+
+    // 1. the first half of the IDs, the batch in hand reaches a batch beyond the first one
+    OpenSP::sp<deudb::IIndexIterator> pIterator = pDB->scanIndices(deudb::IDScanRange());
+    TEST_CHECK(pIterator.valid());
+    std::vector<ID> vecScanned;
+    ID id;
+    while(vecScanned.size() < setIDs.size() / 2u && pIterator->next(id))
+    {
+        vecScanned.push_back(id);
+    }
+    TEST_CHECK(vecScanned.size() == setIDs.size() / 2u);
+    const ID idCursor = vecScanned.back();
+    std::set<ID>::const_iterator itorBatchEnd = setIDs.begin();
+    std::advance(itorBatchEnd, (vecScanned.size() / g_nScanBatch + 1u) * g_nScanBatch - 1u);
+    const ID idBatchEnd = *itorBatchEnd;
+
+    // 2. odd IDs added and even ones removed all over
+    std::set<ID> setAddedAhead, setAddedBehind, setRemoved;
+    for(unsigned nHigh = 0u; nHigh < g_nScanHighs; nHigh++)
+    {
+        for(unsigned nLow = 1u; nLow < g_nWriteScanLows; nLow += 10u)
+        {
+            const ID idAdded = makeScanID(nHigh, 0u, nLow);
+            if(idCursor < idAdded)
+            {
+                TEST_CHECK(addScanBlock(pDB.get(), idAdded, setAddedAhead));
+            }
+            else
+            {
+                TEST_CHECK(addScanBlock(pDB.get(), idAdded, setAddedBehind));
+            }
+
+            const ID idRemoved = makeScanID(nHigh, 0u, nLow + 3u);
+            TEST_CHECK(pDB->removeBlock(idRemoved));
+            setRemoved.insert(idRemoved);
+        }
+    }
+
+    TEST_CHECK(!setAddedBehind.empty() && idBatchEnd < *setAddedAhead.rbegin() && idBatchEnd < *setRemoved.rbegin());
+
+    // 3. the rest
+    while(pIterator->next(id))
+    {
+        vecScanned.push_back(id);
+    }
+    for(size_t i = 1u; i < vecScanned.size(); i++)
+    {
+        TEST_CHECK(vecScanned[i - 1u] < vecScanned[i]);
+    }
+
+    const std::set<ID> setScanned(vecScanned.begin(), vecScanned.end());
+    TEST_CHECK(setScanned.size() == vecScanned.size());
+    for(std::set<ID>::const_iterator itor = setIDs.begin(); itor != setIDs.end(); ++itor)
+    {
+        const bool bScanned = (setScanned.find(*itor) != setScanned.end());
+        if(setRemoved.find(*itor) == setRemoved.end())
+        {
+            TEST_CHECK(bScanned);
+        }
+        else if(idBatchEnd < *itor)
+        {
+            TEST_CHECK(!bScanned);
+        }
+    }
+    for(std::set<ID>::const_iterator itor = setAddedAhead.begin(); itor != setAddedAhead.end(); ++itor)
+    {
+        TEST_CHECK(!(idBatchEnd < *itor) || setScanned.find(*itor) != setScanned.end());
+    }
+    for(std::set<ID>::const_iterator itor = setAddedBehind.begin(); itor != setAddedBehind.end(); ++itor)
+    {
+        TEST_CHECK(setScanned.find(*itor) == setScanned.end());
+    }
+
+    // 4. closed under a scan, which gives no more than the batch it holds
+    pIterator = pDB->scanIndices(deudb::IDScanRange());
+    TEST_CHECK(pIterator.valid() && pIterator->next(id));
+    pDB->closeDB();
+    unsigned nAfterClose = 0u;
+    while(pIterator->next(id))
+    {
+        ++nAfterClose;
+    }
+    TEST_CHECK(nAfterClose < setIDs.size());
+    pIterator = NULL;
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,224 @@
+#include "DEUDBTest.h"
+#include <string.h>
+#include <algorithm>
+#include <OpenThreads/Thread>
+
+namespace
+{
+    const unsigned g_nScrubIDs          = 2000u;
+    const unsigned g_nScrubTimeout      = 60000u;
+    const unsigned g_nFlippedByte       = 40u;      // behind the header of a test block, all of them are longer
+    const unsigned g_nCorruptIDs[]      = { 3u, 777u, 1999u };
+    const unsigned g_nCorruptCount      = sizeof(g_nCorruptIDs) / sizeof(g_nCorruptIDs[0]);
+
+    // the offset of test block n of round 0 in a data file, the block is stored as it is without compression
+    bool findTestBlock(const std::vector<char> &vecFile, unsigned n, UINT_64 &nOffset)
+    {
+        std::vector<char> vecBlock;
+        makeTestBlock(n, 0u, vecBlock);
+        const std::vector<char>::const_iterator itor = std::search(vecFile.begin(), vecFile.end(), vecBlock.begin(), vecBlock.end());
+        if(itor == vecFile.end())
+        {
+            return false;
+        }
+        nOffset = (UINT_64)(itor - vecFile.begin());
+        return true;
+    }
+
+
+    bool corruptTestBlocks(const std::string &strDB)
+    {
+        const std::string strDataFile = getDBFilePath(strDB, 0u);
+        std::vector<char> vecFile;
+        TEST_CHECK(readFileBytes(strDataFile, vecFile));
+        for(unsigned i = 0u; i < g_nCorruptCount; i++)
+        {
+            UINT_64 nOffset = 0u;
+            TEST_CHECK(findTestBlock(vecFile, g_nCorruptIDs[i], nOffset));
+            TEST_CHECK(flipFileByte(strDataFile, nOffset + g_nFlippedByte));
+        }
+        return true;
+    }
+
+
+    bool isCorruptID(unsigned n)
+    {
+        return std::find(g_nCorruptIDs, g_nCorruptIDs + g_nCorruptCount, n) != g_nCorruptIDs + g_nCorruptCount;
+    }
+
+
+    // starts a scrub and waits for it to go through
+    bool runScrub(deudb::IDEUDB *pDB, deudb::ScrubStatus &status, std::vector<ID> &vecCorruptIDs)
+    {
+        TEST_CHECK(pDB->startScrub());
+        for(unsigned nWaited = 0u; nWaited < g_nScrubTimeout; nWaited += 20u)
+        {
+            pDB->getScrubStatus(status, vecCorruptIDs);
+            if(!status.m_bRunning)  break;
+            sleepMilliseconds(20u);
+        }
+        TEST_CHECK(!status.m_bRunning && status.m_bFinished);
+        return true;
+    }
+
+
+    bool isSameIDs(std::vector<ID> vecIDs, const unsigned *pNumbers, unsigned nCount)
+    {
+        std::vector<ID> vecExpected;
+        for(unsigned i = 0u; i < nCount; i++)
+        {
+            vecExpected.push_back(makeTestID(pNumbers[i]));
+        }
+        std::sort(vecIDs.begin(), vecIDs.end());
+        std::sort(vecExpected.begin(), vecExpected.end());
+        return vecIDs == vecExpected;
+    }
+
+
+    // rewrites blocks until it is stopped, the scrub meets gaps which are freed and reused meanwhile
+    class ScrubWriter : public OpenThreads::Thread
+    {
+    public:
+        explicit ScrubWriter(deudb::IDEUDB *pDB) : m_pDB(pDB), m_bStop(false), m_bFailed(false), m_nBatches(0u){}
+        ~ScrubWriter(void){}
+
+    public:
+        virtual void run(void)
+        {
+            for(unsigned nRound = 1u; !m_bStop; nRound++)
+            {
+                const unsigned nFirst = (nRound * 613u) % (g_nScrubIDs - 32u);
+                if(!writeTestBlocks(m_pDB, nFirst, 32u, nRound))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+                ++m_nBatches;
+            }
+        }
+
+        void stop(void)
+        {
+            m_bStop = true;
+            join();
+        }
+
+    public:
+        deudb::IDEUDB          *m_pDB;
+        volatile bool           m_bStop;
+        volatile bool           m_bFailed;
+        volatile unsigned       m_nBatches;
+    };
+}
+
+
+// A byte flipped on the disk in some blocks is found by the scrub, which checks every block and
+// reports exactly those, and by the reads, which refuse them under BV_STRICT, hand them out under
+// BV_WARN and do not check them under BV_NONE. Rewriting the blocks repairs them for the next scrub.
+bool testScrubCorruption(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/scrub";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nScrubIDs, 0u));
+    pDB->closeDB();
+    TEST_CHECK(corruptTestBlocks(strDB));
+
+    // 1. the scrub finds them without any read
+    deudb::ScrubStatus status;
+    std::vector<ID> vecCorruptIDs;
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(runScrub(pDB.get(), status, vecCorruptIDs));
+    TEST_CHECK(status.m_nBlocksChecked == g_nScrubIDs);
+    TEST_CHECK(status.m_nBlocksUnchecked == 0u);
+    TEST_CHECK(status.m_nBlocksCorrupt == g_nCorruptCount);
+    TEST_CHECK(isSameIDs(vecCorruptIDs, g_nCorruptIDs, g_nCorruptCount));
+
+    // 2. BV_STRICT, the default, refuses them and reads the others
+    unsigned nRound = 0u;
+    for(unsigned n = 0u; n < g_nScrubIDs; n++)
+    {
+        TEST_CHECK(readTestBlock(pDB.get(), n, nRound) == !isCorruptID(n));
+    }
+    pDB->closeDB();
+
+    // 3. BV_WARN reads them as they are on the disk and reports them, BV_NONE does not look
+    TEST_CHECK(pDB->openDB(strDB));
+    pDB->setVerification(deudb::BV_WARN);
+    for(unsigned i = 0u; i < g_nCorruptCount; i++)
+    {
+        std::vector<char> vecBlock;
+        makeTestBlock(g_nCorruptIDs[i], 0u, vecBlock);
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        TEST_CHECK(pDB->readBlock(makeTestID(g_nCorruptIDs[i]), pBuffer) && pBuffer.valid());
+        TEST_CHECK(pBuffer->getLength() == vecBlock.size());
+        TEST_CHECK(((const char *)pBuffer->getData())[g_nFlippedByte] == (char)~vecBlock[g_nFlippedByte]);
+    }
+    pDB->getScrubStatus(status, vecCorruptIDs);
+    TEST_CHECK(isSameIDs(vecCorruptIDs, g_nCorruptIDs, g_nCorruptCount));
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    pDB->setVerification(deudb::BV_NONE);
+    OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+    TEST_CHECK(pDB->readBlock(makeTestID(g_nCorruptIDs[0]), pBuffer) && pBuffer.valid());
+    pDB->getScrubStatus(status, vecCorruptIDs);
+    TEST_CHECK(vecCorruptIDs.empty());
+
+    // 4. rewritten, they pass the next scrub and the reads
+    pDB->setVerification(deudb::BV_STRICT);
+    for(unsigned i = 0u; i < g_nCorruptCount; i++)
+    {
+        TEST_CHECK(writeTestBlocks(pDB.get(), g_nCorruptIDs[i], 1u, 1u));
+    }
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(runScrub(pDB.get(), status, vecCorruptIDs));
+    TEST_CHECK(status.m_nBlocksCorrupt == 0u && vecCorruptIDs.empty());
+    for(unsigned n = 0u; n < g_nScrubIDs; n++)
+    {
+        TEST_CHECK(readTestBlock(pDB.get(), n, nRound));
+        TEST_CHECK(nRound == (isCorruptID(n) ? 1u : 0u));
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// A scrub while a writer rewrites blocks meets gaps which are freed and reused under it, it must not
+// take any of them for a corrupt block.
+bool testScrubUnderWrites(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/scrub_writes";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, g_nScrubIDs, 0u));
+    pDB->closeDB();
+    TEST_CHECK(pDB->openDB(strDB));
+
+    ScrubWriter writer(pDB.get());
+    writer.startThread();
+    deudb::ScrubStatus status;
+    std::vector<ID> vecCorruptIDs;
+    bool bScrubbed = true;
+    for(unsigned nRun = 0u; nRun < 5u && bScrubbed; nRun++)
+    {
+        bScrubbed = runScrub(pDB.get(), status, vecCorruptIDs) && status.m_nBlocksCorrupt == 0u;
+    }
+    writer.stop();
+
+    TEST_CHECK(bScrubbed);
+    TEST_CHECK(!writer.m_bFailed && writer.m_nBatches > 0u);
+    TEST_CHECK(vecCorruptIDs.empty());
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,123 @@
+#include "DEUDBTest.h"
+
+namespace
+{
+    // nRound ~0u means that the snapshot must not see n at all
+    bool checkSnapshotRead(deudb::IDEUDB *pDB, unsigned n, unsigned nSnapshot, unsigned nRound)
+    {
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+        const bool bRead = pDB->readBlock(makeTestID(n), pBuffer, nSnapshot);
+        if(nRound == ~0u)
+        {
+            TEST_CHECK(!bRead);
+            return true;
+        }
+
+        unsigned nReadRound = 0u;
+        TEST_CHECK(bRead && pBuffer.valid());
+        TEST_CHECK(checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nReadRound));
+        TEST_CHECK(nReadRound == nRound);
+        return true;
+    }
+
+
+    bool updateTestBlock(deudb::IDEUDB *pDB, unsigned n, unsigned nRound)
+    {
+        std::vector<char> vecBlock;
+        makeTestBlock(n, nRound, vecBlock);
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer = deudb::createBlockBuffer(&vecBlock[0], (unsigned)vecBlock.size());
+        return pDB->updateBlock(makeTestID(n), pBuffer.get());
+    }
+}
+
+
+// A snapshot sees the blocks as they were when it was taken: not the writes after it, and still the
+// blocks replaced or removed since. Two snapshots see each its own state, and the latest state is
+// read as usual beside them.
+bool testSnapshotVisibility(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/snapshot";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 100u, 0u));
+    const unsigned nFirst = pDB->createSnapshot();
+
+    // 0 to 49 replaced, 50 to 59 removed and 100 to 109 new
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 50u, 1u));
+    for(unsigned n = 50u; n < 60u; n++)
+    {
+        TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+    }
+    TEST_CHECK(writeTestBlocks(pDB.get(), 100u, 10u, 1u));
+    const unsigned nSecond = pDB->createSnapshot();
+    TEST_CHECK(nSecond > nFirst);
+
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 10u, 2u));
+
+    for(unsigned n = 0u; n < 110u; n++)
+    {
+        const unsigned nInFirst  = (n < 100u) ? 0u : ~0u;
+        const unsigned nInSecond = (n < 50u || n >= 100u) ? 1u : (n < 60u ? ~0u : 0u);
+        const unsigned nLatest   = (n < 10u) ? 2u : nInSecond;
+        TEST_CHECK(checkSnapshotRead(pDB.get(), n, nFirst, nInFirst));
+        TEST_CHECK(checkSnapshotRead(pDB.get(), n, nSecond, nInSecond));
+        TEST_CHECK(checkSnapshotRead(pDB.get(), n, 0u, nLatest));
+        TEST_CHECK(pDB->isExist(makeTestID(n)) == (nLatest != ~0u));
+    }
+    TEST_CHECK(pDB->getBlockCount() == 100u);
+
+    // the removed blocks are gone for the latest state once no snapshot holds them any more
+    pDB->releaseSnapshot(nFirst);
+    pDB->releaseSnapshot(nSecond);
+    for(unsigned n = 0u; n < 110u; n++)
+    {
+        const unsigned nLatest = (n < 10u) ? 2u : ((n < 50u || n >= 100u) ? 1u : (n < 60u ? ~0u : 0u));
+        TEST_CHECK(checkSnapshotRead(pDB.get(), n, 0u, nLatest));
+    }
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// With a retention of 2 an ID keeps its 2 newest versions, each of them readable by its version,
+// and a snapshot still sees the version it was taken on after the retention has dropped it.
+bool testVersionRetention(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/retention";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    pDB->setVersionRetention(2u);
+
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 1u, 0u));
+    TEST_CHECK(updateTestBlock(pDB.get(), 0u, 1u));
+    const unsigned nSnapshot = pDB->createSnapshot();
+    for(unsigned nRound = 2u; nRound < 6u; nRound++)
+    {
+        TEST_CHECK(updateTestBlock(pDB.get(), 0u, nRound));
+    }
+
+    const std::vector<unsigned> vecVersions = pDB->getVersion(makeTestID(0u));
+    TEST_CHECK(vecVersions.size() == 2u);
+    TEST_CHECK(vecVersions[0] < vecVersions[1]);
+    TEST_CHECK(checkSnapshotRead(pDB.get(), 0u, vecVersions[0], 4u));
+    TEST_CHECK(checkSnapshotRead(pDB.get(), 0u, vecVersions[1], 5u));
+    TEST_CHECK(checkSnapshotRead(pDB.get(), 0u, 0u, 5u));
+    TEST_CHECK(checkSnapshotRead(pDB.get(), 0u, nSnapshot, 1u));
+    pDB->releaseSnapshot(nSnapshot);
+
+    // the retention holds over a reopen as well
+    pDB->closeDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(pDB->getVersion(makeTestID(0u)) == vecVersions);
+    TEST_CHECK(checkSnapshotRead(pDB.get(), 0u, 0u, 5u));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,260 @@
+#include "DEUDBTest.h"
+#include <map>
+
+namespace
+{
+    // enough records for the sorted index to have some dozens of pages
+    const unsigned g_nIndexIDs = 3000u;
+
+    // the rounds of the versions of every living ID, the oldest first
+    typedef std::map<unsigned, std::vector<unsigned> >  RoundMap;
+
+    bool updateTestBlock(deudb::IDEUDB *pDB, unsigned n, unsigned nRound)
+    {
+        std::vector<char> vecBlock;
+        makeTestBlock(n, nRound, vecBlock);
+        OpenSP::sp<deudb::IBlockBuffer> pBuffer = deudb::createBlockBuffer(&vecBlock[0], (unsigned)vecBlock.size());
+        return pDB->updateBlock(makeTestID(n), pBuffer.get());
+    }
+
+
+    // Only the even IDs below 2 * g_nIndexIDs are written, so every lookup of an odd one falls between
+    // two records. Every third ID gets a second version, every fifth is removed again.
+    bool writeIndexTestBlocks(deudb::IDEUDB *pDB, RoundMap &mapRounds)
+    {
+        for(unsigned n = 0u; n < 2u * g_nIndexIDs; n += 2u)
+        {
+            TEST_CHECK(writeTestBlocks(pDB, n, 1u, 0u));
+            mapRounds[n].push_back(0u);
+        }
+        for(unsigned n = 0u; n < 2u * g_nIndexIDs; n += 6u)
+        {
+            TEST_CHECK(updateTestBlock(pDB, n, 1u));
+            mapRounds[n].push_back(1u);
+        }
+        for(unsigned n = 0u; n < 2u * g_nIndexIDs; n += 10u)
+        {
+            TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+            mapRounds.erase(n);
+        }
+        return true;
+    }
+
+
+    // every ID from before the first to beyond the last one is found as the map has it
+    bool checkIndexLookups(deudb::IDEUDB *pDB, const RoundMap &mapRounds)
+    {
+        for(unsigned n = 0u; n < 2u * g_nIndexIDs + 2u; n++)
+        {
+            const RoundMap::const_iterator itorRounds = mapRounds.find(n);
+            const bool bLiving = (itorRounds != mapRounds.end());
+            unsigned nRound = 0u;
+            TEST_CHECK(pDB->isExist(makeTestID(n)) == bLiving);
+            TEST_CHECK(readTestBlock(pDB, n, nRound) == bLiving);
+            if(!bLiving)    continue;
+
+            TEST_CHECK(nRound == itorRounds->second.back());
+
+            // each version is still read by its own number
+            const std::vector<unsigned> vecVersions = pDB->getVersion(makeTestID(n));
+            TEST_CHECK(vecVersions.size() == itorRounds->second.size());
+            for(size_t i = 0u; i < vecVersions.size(); i++)
+            {
+                OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+                TEST_CHECK(pDB->readBlock(makeTestID(n), pBuffer, vecVersions[i]) && pBuffer.valid());
+                TEST_CHECK(checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound));
+                TEST_CHECK(nRound == itorRounds->second[i]);
+            }
+        }
+        TEST_CHECK(pDB->getBlockCount() == mapRounds.size());
+
+        std::vector<ID> vecIndices;
+        pDB->getIndices(vecIndices);
+        TEST_CHECK(vecIndices.size() == mapRounds.size());
+        return true;
+    }
+
+
+    // the seconds of openDB, -1 if it has failed
+    double timeOpen(deudb::IDEUDB *pDB, const std::string &strDB)
+    {
+        const double dblStart = getSeconds();
+        return pDB->openDB(strDB) ? getSeconds() - dblStart : -1.0;
+    }
+}
+
+
+// The lookups through the sorted index give what a map of the writes gives: the latest version of
+// every living ID, each older version by its number, and nothing for the removed IDs or for those
+// between, before and beyond the records. It holds while the writes are in memory and after a reopen,
+// when they are read from the sorted index alone.
+bool testSortedIndexLookup(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/sorted_index";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    RoundMap mapRounds;
+    TEST_CHECK(writeIndexTestBlocks(pDB.get(), mapRounds));
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    TEST_CHECK(getFileSize(strDB + ".sidx") > 0u);
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    return true;
+}
+
+
+// A sorted index which does not belong to the .idx is not trusted, openDB converts the .idx again
+// over it: one flagged unclean as a crash leaves it, one from before the .idx has grown, one cut
+// short and one missing.
+bool testSortedIndexRebuild(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/sorted_rebuild";
+    const std::string strSorted = strDB + ".sidx";
+    const std::string strStale = strDir + "/sorted_rebuild_stale.sidx";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    RoundMap mapRounds;
+    TEST_CHECK(writeIndexTestBlocks(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    // 1. the copy taken while the database is open, the new IDs take the slots of the removed ones
+    //    so the .idx keeps its length
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(copyFile(strSorted, strStale));
+    const UINT_64 nIndexLength = getFileSize(strDB + ".idx");
+    for(unsigned n = 2u; n < 2u * g_nIndexIDs; n += 10u)
+    {
+        if(mapRounds.find(n) != mapRounds.end())
+        {
+            TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+            mapRounds.erase(n);
+        }
+        TEST_CHECK(writeTestBlocks(pDB.get(), n + 1u, 1u, 2u));
+        mapRounds[n + 1u].push_back(2u);
+    }
+    pDB->closeDB();
+    TEST_CHECK(getFileSize(strDB + ".idx") == nIndexLength);
+
+    TEST_CHECK(copyFile(strStale, strSorted));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    // 2. the copy of a clean index, the .idx grows by the IDs written after it, there are more of
+    //    them than the slots freed above
+    TEST_CHECK(copyFile(strSorted, strStale));
+    TEST_CHECK(pDB->openDB(strDB));
+    for(unsigned n = 5u; n < 2u * g_nIndexIDs; n += 2u)
+    {
+        if(n % 10u != 1u && n % 10u != 3u)
+        {
+            TEST_CHECK(writeTestBlocks(pDB.get(), n, 1u, 3u));
+            mapRounds[n].push_back(3u);
+        }
+    }
+    pDB->closeDB();
+    TEST_CHECK(getFileSize(strDB + ".idx") > nIndexLength);
+
+    TEST_CHECK(copyFile(strStale, strSorted));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    // 3. cut short and missing
+    TEST_CHECK(copyFile(strStale, strSorted, getFileSize(strStale) / 2u));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    remove(strSorted.c_str());
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(getFileSize(strSorted) > 0u);
+    TEST_CHECK(checkIndexLookups(pDB.get(), mapRounds));
+    pDB->closeDB();
+
+    remove(strStale.c_str());
+    removeDatabase(strDB);
+    return true;
+}
+
+
+int runIndexBenchmark(const std::string &strDir, unsigned nBlocks)
+{
+    printf("index of %u blocks\n", nBlocks);
+
+    const std::string strDB = strDir + "/index_bench";
+    removeDatabase(strDB);
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    bool bWritten = pDB->openDB(strDB);
+    const unsigned nBatch = 1000u;
+    for(unsigned n = 0u; n < nBlocks && bWritten; n += nBatch)
+    {
+        bWritten = writeTestBlocks(pDB.get(), n, (nBlocks - n < nBatch) ? nBlocks - n : nBatch, 0u);
+    }
+    pDB->closeDB();
+    if(!bWritten)
+    {
+        printf("    FAILED to write the blocks\n");
+        removeDatabase(strDB);
+        return 1;
+    }
+
+    int nFailed = 0;
+
+    // 1. opening with the sorted index costs nothing per record, without it the .idx is converted
+    const double dblOpen = timeOpen(pDB.get(), strDB);
+    pDB->closeDB();
+    remove((strDB + ".sidx").c_str());
+    const double dblConvert = timeOpen(pDB.get(), strDB);
+    if(dblOpen < 0.0 || dblConvert < 0.0)
+    {
+        printf("    FAILED to open the database\n");
+        removeDatabase(strDB);
+        return 1;
+    }
+    printf("    %-16s %.3fs\n", "open", dblOpen);
+    printf("    %-16s %.3fs\n", "open, converted", dblConvert);
+
+    // 2. the lookups of the IDs which are there and of as many which are not
+    double dblStart = getSeconds();
+    unsigned nFound = 0u;
+    for(unsigned n = 0u; n < 2u * nBlocks; n++)
+    {
+        if(pDB->isExist(makeTestID(n)))     ++nFound;
+    }
+    const double dblExist = getSeconds() - dblStart;
+    if(nFound != nBlocks)
+    {
+        printf("    FAILED, %u of %u blocks found\n", nFound, nBlocks);
+        ++nFailed;
+    }
+    printf("    %-16s %.0f lookups/s\n", "isExist", 2.0 * nBlocks / dblExist);
+
+    dblStart = getSeconds();
+    unsigned nRound = 0u;
+    nFound = 0u;
+    for(unsigned n = 0u; n < nBlocks; n++)
+    {
+        if(readTestBlock(pDB.get(), n, nRound))     ++nFound;
+    }
+    const double dblRead = getSeconds() - dblStart;
+    if(nFound != nBlocks)
+    {
+        printf("    FAILED, %u of %u blocks read\n", nFound, nBlocks);
+        ++nFailed;
+    }
+    printf("    %-16s %.0f reads/s\n", "readBlock", nBlocks / dblRead);
+
+    pDB->closeDB();
+    removeDatabase(strDB);
+    return nFailed;
+}
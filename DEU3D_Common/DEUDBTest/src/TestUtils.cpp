@@ -0,0 +1,251 @@
+#include "DEUDBTest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+
+namespace
+{
+    const char *g_pDatabaseExts[] = { ".idx", ".wal", ".sidx", ".zdict", ".bloom" };
+    const unsigned g_nDatabaseExtCount = sizeof(g_pDatabaseExts) / sizeof(g_pDatabaseExts[0]);
+
+    // the data files are numbered from 0 on, a few more than there are are cleared as well
+    const unsigned g_nMaxDBFiles = 64u;
+
+    const unsigned g_nHeaderLength = 3u * sizeof(unsigned);
+
+    bool isFileExist(const std::string &strFile)
+    {
+        FILE *pFile = fopen(strFile.c_str(), "rb");
+        if(NULL == pFile)   return false;
+        fclose(pFile);
+        return true;
+    }
+
+    unsigned char getTestByte(unsigned n, unsigned nRound, unsigned nOffset)
+    {
+        return (unsigned char)(n * 131u + nRound * 17u + nOffset);
+    }
+}
+
+
+std::string getDBFilePath(const std::string &strDB, unsigned nDBFile)
+{
+    std::ostringstream oss;
+    oss << strDB << '_' << nDBFile << ".db";
+    return oss.str();
+}
+
+
+ID makeTestID(unsigned n)
+{
+    return ID((UINT_64)0x7E57u, (UINT_64)0x0DB0u, (UINT_64)n);
+}
+
+
+void makeTestBlock(unsigned n, unsigned nRound, std::vector<char> &vecBlock)
+{
+    const unsigned nLength = g_nHeaderLength + 64u + (n * 37u + nRound * 11u) % 2048u;
+    vecBlock.resize(nLength);
+
+    const unsigned nHeader[3] = { n, nRound, nLength };
+    memcpy(&vecBlock[0], nHeader, g_nHeaderLength);
+    for(unsigned i = g_nHeaderLength; i < nLength; i++)
+    {
+        vecBlock[i] = (char)getTestByte(n, nRound, i);
+    }
+}
+
+
+bool checkTestBlock(unsigned n, const void *pData, unsigned nLength, unsigned &nRound)
+{
+    nRound = ~0u;
+    if(NULL == pData || nLength < g_nHeaderLength)
+    {
+        return false;
+    }
+
+    unsigned nHeader[3];
+    memcpy(nHeader, pData, g_nHeaderLength);
+    if(nHeader[0] != n || nHeader[2] != nLength)
+    {
+        return false;
+    }
+
+    const unsigned char *pBytes = (const unsigned char *)pData;
+    for(unsigned i = g_nHeaderLength; i < nLength; i++)
+    {
+        if(pBytes[i] != getTestByte(n, nHeader[1], i))
+        {
+            return false;
+        }
+    }
+    nRound = nHeader[1];
+    return true;
+}
+
+
+bool readTestBlock(deudb::IDEUDB *pDB, unsigned n, unsigned &nRound)
+{
+    nRound = ~0u;
+
+    OpenSP::sp<deudb::IBlockBuffer> pBuffer;
+    if(!pDB->readBlock(makeTestID(n), pBuffer) || !pBuffer.valid())
+    {
+        return false;
+    }
+    return checkTestBlock(n, pBuffer->getData(), pBuffer->getLength(), nRound);
+}
+
+
+bool writeTestBlocks(deudb::IDEUDB *pDB, unsigned nFirst, unsigned nCount, unsigned nRound)
+{
+    std::vector<ID> vecIDs;
+    std::vector<OpenSP::sp<deudb::IBlockBuffer> > vecBuffers;
+    std::vector<char> vecBlock;
+    for(unsigned n = nFirst; n < nFirst + nCount; n++)
+    {
+        makeTestBlock(n, nRound, vecBlock);
+        vecIDs.push_back(makeTestID(n));
+        vecBuffers.push_back(deudb::createBlockBuffer(&vecBlock[0], (unsigned)vecBlock.size()));
+    }
+    return pDB->writeBlocks(vecIDs, vecBuffers);
+}
+
+
+void removeDatabase(const std::string &strDB)
+{
+    for(unsigned i = 0u; i < g_nDatabaseExtCount; i++)
+    {
+        remove((strDB + g_pDatabaseExts[i]).c_str());
+    }
+    for(unsigned n = 0u; n < g_nMaxDBFiles; n++)
+    {
+        remove(getDBFilePath(strDB, n).c_str());
+    }
+}
+
+
+bool copyDatabase(const std::string &strSource, const std::string &strTarget)
+{
+    // the target gets exactly the files of the source, a file the source lacks is not left behind
+    removeDatabase(strTarget);
+
+    for(unsigned i = 0u; i < g_nDatabaseExtCount; i++)
+    {
+        const std::string strFile = strSource + g_pDatabaseExts[i];
+        if(isFileExist(strFile) && !copyFile(strFile, strTarget + g_pDatabaseExts[i]))
+        {
+            return false;
+        }
+    }
+    for(unsigned n = 0u; n < g_nMaxDBFiles; n++)
+    {
+        const std::string strFile = getDBFilePath(strSource, n);
+        if(isFileExist(strFile) && !copyFile(strFile, getDBFilePath(strTarget, n)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool copyFile(const std::string &strSource, const std::string &strTarget, UINT_64 nLength)
+{
+    FILE *pSource = fopen(strSource.c_str(), "rb");
+    if(NULL == pSource)     return false;
+
+    FILE *pTarget = fopen(strTarget.c_str(), "wb");
+    if(NULL == pTarget)
+    {
+        fclose(pSource);
+        return false;
+    }
+
+    bool bCopied = true;
+    char szBuffer[65536];
+    while(nLength > 0u)
+    {
+        const size_t nWanted = (nLength < sizeof(szBuffer)) ? (size_t)nLength : sizeof(szBuffer);
+        const size_t nRead = fread(szBuffer, 1u, nWanted, pSource);
+        if(nRead == 0u)     break;
+        if(fwrite(szBuffer, 1u, nRead, pTarget) != nRead)
+        {
+            bCopied = false;
+            break;
+        }
+        nLength -= nRead;
+    }
+
+    fclose(pSource);
+    if(fclose(pTarget) != 0)    bCopied = false;
+    return bCopied;
+}
+
+
+UINT_64 getFileSize(const std::string &strFile)
+{
+    FILE *pFile = fopen(strFile.c_str(), "rb");
+    if(NULL == pFile)   return 0u;
+
+    fseek(pFile, 0, SEEK_END);
+    const long nSize = ftell(pFile);
+    fclose(pFile);
+    return (nSize > 0) ? (UINT_64)nSize : 0u;
+}
+
+
+bool readFileBytes(const std::string &strFile, std::vector<char> &vecBytes)
+{
+    vecBytes.clear();
+    FILE *pFile = fopen(strFile.c_str(), "rb");
+    if(NULL == pFile)   return false;
+
+    char szBuffer[65536];
+    size_t nRead = 0u;
+    while((nRead = fread(szBuffer, 1u, sizeof(szBuffer), pFile)) > 0u)
+    {
+        vecBytes.insert(vecBytes.end(), szBuffer, szBuffer + nRead);
+    }
+    const bool bRead = (ferror(pFile) == 0);
+    fclose(pFile);
+    return bRead;
+}
+
+
+bool flipFileByte(const std::string &strFile, UINT_64 nOffset)
+{
+    FILE *pFile = fopen(strFile.c_str(), "rb+");
+    if(NULL == pFile)   return false;
+
+    unsigned char nByte = 0u;
+    bool bFlipped = (fseek(pFile, (long)nOffset, SEEK_SET) == 0 && fread(&nByte, 1u, 1u, pFile) == 1u);
+    nByte ^= 0xFFu;
+    bFlipped = bFlipped && (fseek(pFile, (long)nOffset, SEEK_SET) == 0 && fwrite(&nByte, 1u, 1u, pFile) == 1u);
+    if(fclose(pFile) != 0)  bFlipped = false;
+    return bFlipped;
+}
+
+
+bool waitForFileToSettle(const std::string &strFile, UINT_64 nSize, unsigned nTimeout)
+{
+    UINT_64 nLastSize = nSize;
+    unsigned nSteady = 0u;
+    for(unsigned nWaited = 0u; nWaited < nTimeout; nWaited += 20u)
+    {
+        const UINT_64 nNewSize = getFileSize(strFile);
+        if(nNewSize > nSize && nNewSize == nLastSize)
+        {
+            // a batch takes one write and one sync, so some still polls mean it is through
+            if(++nSteady >= 10u)    return true;
+        }
+        else
+        {
+            nSteady = 0u;
+        }
+        nLastSize = nNewSize;
+        sleepMilliseconds(20u);
+    }
+    return false;
+}
+
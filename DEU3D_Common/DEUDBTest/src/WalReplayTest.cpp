@@ -0,0 +1,224 @@
+#include "DEUDBTest.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (WIN32) || defined (WIN64)
+#include <Windows.h>
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+namespace
+{
+    // 0 to 49 of round 0, 50 to 149 of round 1 and, once the removes are replayed, 0 to 9 gone
+    bool checkReplayedState(deudb::IDEUDB *pDB, bool bRemoved)
+    {
+        for(unsigned n = 0u; n < 160u; n++)
+        {
+            if(n >= 150u || (bRemoved && n < 10u))
+            {
+                TEST_CHECK(!pDB->isExist(makeTestID(n)));
+                continue;
+            }
+
+            unsigned nRound = 0u;
+            TEST_CHECK(readTestBlock(pDB, n, nRound));
+            TEST_CHECK(nRound == (n < 50u ? 0u : 1u));
+        }
+        TEST_CHECK(pDB->getBlockCount() == (bRemoved ? 140u : 150u));
+        return true;
+    }
+
+
+    bool waitForFirstCommit(const std::string &strLog)
+    {
+        for(unsigned nWaited = 0u; nWaited < 10000u; nWaited += 5u)
+        {
+            if(getFileSize(strLog) > 0u)    return true;
+            sleepMilliseconds(5u);
+        }
+        return false;
+    }
+
+
+    // start runCrashWriter in a process of its own and kill it nDelay ms after its first commit
+    bool runKilledWriter(const std::string &strDB, unsigned nDelay)
+    {
+        const std::string strLog = strDB + ".wal";
+
+#if defined (WIN32) || defined (WIN64)
+        char szExe[MAX_PATH] = {0};
+        GetModuleFileNameA(NULL, szExe, MAX_PATH);
+        std::string strCommand = std::string("\"") + szExe + "\" -crash-writer \"" + strDB + "\"";
+
+        STARTUPINFOA si;
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+        PROCESS_INFORMATION pi;
+        if(!CreateProcessA(NULL, &strCommand[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+        {
+            return false;
+        }
+
+        const bool bCommitted = waitForFirstCommit(strLog);
+        sleepMilliseconds(nDelay);
+        TerminateProcess(pi.hProcess, 9u);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+        CloseHandle(pi.hThread);
+        CloseHandle(pi.hProcess);
+        return bCommitted;
+#else
+        const pid_t pid = fork();
+        if(pid < 0)     return false;
+        if(pid == 0)
+        {
+            _exit(runCrashWriter(strDB));
+        }
+
+        const bool bCommitted = waitForFirstCommit(strLog);
+        sleepMilliseconds(nDelay);
+        kill(pid, SIGKILL);
+
+        int nStatus = 0;
+        waitpid(pid, &nStatus, 0);
+        return bCommitted && WIFSIGNALED(nStatus);
+#endif
+    }
+}
+
+
+int runCrashWriter(const std::string &strDB)
+{
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    if(!pDB->openDB(strDB))
+    {
+        return 1;
+    }
+
+    // batches of neighbouring IDs and now and then a remove, until the process is killed
+    for(unsigned nRound = 1u; nRound < 1000000u; nRound++)
+    {
+        const unsigned nFirst = (nRound * 389u) % (1000u - 64u);
+        writeTestBlocks(pDB.get(), nFirst, 64u, nRound);
+        if(nRound % 4u == 0u)
+        {
+            pDB->removeBlock(makeTestID((nRound * 17u) % 1000u));
+        }
+    }
+    return 0;
+}
+
+
+// The log of a crash is taken while the database is still open: the files as they were before it
+// and the log cut in its second batch must give the first batch only, the whole log must give both,
+// and the log replayed again over the files which already hold it must change nothing.
+bool testWalReplay(const std::string &strDir)
+{
+    const std::string strDB       = strDir + "/wal_replay";
+    const std::string strClean    = strDB + "_clean";
+    const std::string strLog      = strDB + ".wal";
+    const std::string strSavedLog = strDB + "_saved.wal";
+    removeDatabase(strDB);
+    removeDatabase(strClean);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 100u, 0u));
+    pDB->closeDB();
+    TEST_CHECK(getFileSize(strLog) == 0u);
+    TEST_CHECK(copyDatabase(strDB, strClean));
+
+    // the writes after the clean close, one batch of writeBlocks and then the removes
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 50u, 100u, 1u));
+    TEST_CHECK(waitForFileToSettle(strLog, 0u, 10000u));
+    const UINT_64 nFirstBatchEnd = getFileSize(strLog);
+    for(unsigned n = 0u; n < 10u; n++)
+    {
+        TEST_CHECK(pDB->removeBlock(makeTestID(n)));
+    }
+    TEST_CHECK(waitForFileToSettle(strLog, nFirstBatchEnd, 10000u));
+    const UINT_64 nLogEnd = getFileSize(strLog);
+    TEST_CHECK(copyFile(strLog, strSavedLog));
+    pDB->closeDB();
+
+    // torn, the second batch has lost its commit
+    TEST_CHECK(copyDatabase(strClean, strDB));
+    TEST_CHECK(copyFile(strSavedLog, strLog, nFirstBatchEnd + (nLogEnd - nFirstBatchEnd) / 2u));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(getFileSize(strLog) == 0u);
+    TEST_CHECK(checkReplayedState(pDB.get(), false));
+    pDB->closeDB();
+
+    // redone, none of the log has reached the files
+    TEST_CHECK(copyDatabase(strClean, strDB));
+    TEST_CHECK(copyFile(strSavedLog, strLog));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkReplayedState(pDB.get(), true));
+    pDB->closeDB();
+
+    // redone once more, all of the log has reached the files
+    TEST_CHECK(copyFile(strSavedLog, strLog));
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkReplayedState(pDB.get(), true));
+    pDB->closeDB();
+
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(checkReplayedState(pDB.get(), true));
+    pDB->closeDB();
+
+    removeDatabase(strDB);
+    removeDatabase(strClean);
+    remove(strSavedLog.c_str());
+    return true;
+}
+
+
+// A writer process is killed in the middle of its batches a few times over. Every reopen must find
+// each block either whole, of some round, or missing, and the index must agree with the blocks.
+bool testWalCrash(const std::string &strDir)
+{
+    const std::string strDB = strDir + "/wal_crash";
+    removeDatabase(strDB);
+
+    OpenSP::sp<deudb::IDEUDB> pDB = deudb::createDEUDB();
+    TEST_CHECK(pDB->openDB(strDB));
+    TEST_CHECK(writeTestBlocks(pDB.get(), 0u, 1000u, 0u));
+    pDB->closeDB();
+
+    unsigned nRewritten = 0u;
+    for(unsigned nRun = 0u; nRun < 5u; nRun++)
+    {
+        TEST_CHECK(runKilledWriter(strDB, 50u + nRun * 37u));
+
+        TEST_CHECK(pDB->openDB(strDB));
+        unsigned nFound = 0u;
+        for(unsigned n = 0u; n < 1000u; n++)
+        {
+            if(!pDB->isExist(makeTestID(n)))
+            {
+                continue;
+            }
+
+            unsigned nRound = 0u;
+            TEST_CHECK(readTestBlock(pDB.get(), n, nRound));
+            ++nFound;
+            if(nRound > 0u)     ++nRewritten;
+        }
+
+        std::vector<ID> vecIndices;
+        pDB->getIndices(vecIndices);
+        TEST_CHECK(vecIndices.size() == nFound);
+        TEST_CHECK(pDB->getBlockCount() == nFound);
+        pDB->closeDB();
+    }
+
+    // the writers have got at least a batch through before they were killed
+    TEST_CHECK(nRewritten > 0u);
+
+    removeDatabase(strDB);
+    return true;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "DEUDBTest.h"
+
+// Runs the tests of DEUDB, the exit code is the number of tests which have failed.
+//
+//  DEUDBTest [<work directory>]
+//      the databases of the tests are created in the work directory, the current one by default
+//  DEUDBTest -bench-ingest <work directory> [<threads> [<blocks>]]
+//      times addBlock against a bulk load, 8 threads and 200000 blocks by default
+//  DEUDBTest -bench-index <work directory> [<blocks>]
+//      times openDB and the lookups through the sorted index, 100000 blocks by default
+//  DEUDBTest -bench-cache [<threads> [<reads>]]
+//      the hit rate and the reads per second of the block cache, 4 threads and 4000000 reads by default
+//  DEUDBTest -bench-read <work directory> [<threads> [<reads>]]
+//      the reads per second from the data files with pread and mapped, 8 threads and 400000 reads by default
+//  DEUDBTest -bench-bloom <work directory> [<threads> [<lookups>]]
+//      the lookups per second of absent IDs, alone and beside a writer, 4 threads and 4000000 lookups by default
+
+static const cmm::TestCase<bool (*)(const std::string &)> g_testCases[] =
+{
+    { "WalReplay",      testWalReplay   },
+    { "WalCrash",       testWalCrash    },
+    { "Compaction",     testCompactionUnderWrites   },
+    { "BloomGrowth",    testBloomFilterGrowth       },
+    { "Snapshot",       testSnapshotVisibility      },
+    { "Retention",      testVersionRetention        },
+    { "SortedLookup",   testSortedIndexLookup       },
+    { "SortedRebuild",  testSortedIndexRebuild      },
+    { "CachePromotion", testCachePromotion          },
+    { "CacheBudget",    testCacheBudget             },
+    { "CacheShards",    testCacheShards             },
+    { "CodecRoundTrip", testCodecRoundTrip          },
+    { "CodecCorrupt",   testCodecCorruptFrame       },
+    { "CodecRaw",       testCodecIncompressible     },
+    { "BatchRead",      testReadBlocksCoalesced     },
+    { "BatchReadGaps",  testReadBlocksGaps          },
+    { "ScrubCorrupt",   testScrubCorruption         },
+    { "ScrubWrites",    testScrubUnderWrites        },
+    { "ScanRanges",     testScanRanges              },
+    { "ScanWrites",     testScanUnderWrites         },
+    { "SpaceAlloc",     testFreeSpaceAlloc          },
+    { "SpaceMerge",     testFreeSpaceCoalesce       },
+    { "SpaceRandom",    testFreeSpaceRandom         },
+    { "BufferLifetime", testBufferLifetime          },
+    { "BufferRelease",  testBufferRelease           },
+};
+
+
+int main(int argc, char *argv[])
+{
+    // the writer process which testWalCrash starts and kills
+    if(argc == 3 && strcmp(argv[1], "-crash-writer") == 0)
+    {
+        return runCrashWriter(argv[2]);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-ingest") == 0)
+    {
+        const unsigned nThreads = (argc > 3) ? (unsigned)atoi(argv[3]) : 8u;
+        const unsigned nBlocks  = (argc > 4) ? (unsigned)atoi(argv[4]) : 200000u;
+        return runIngestBenchmark(argv[2], (nThreads > 0u) ? nThreads : 1u, nBlocks);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-index") == 0)
+    {
+        const unsigned nBlocks = (argc > 3) ? (unsigned)atoi(argv[3]) : 100000u;
+        return runIndexBenchmark(argv[2], (nBlocks > 0u) ? nBlocks : 1u);
+    }
+    if(argc >= 2 && strcmp(argv[1], "-bench-cache") == 0)
+    {
+        const unsigned nThreads = (argc > 2) ? (unsigned)atoi(argv[2]) : 4u;
+        const unsigned nReads   = (argc > 3) ? (unsigned)atoi(argv[3]) : 4000000u;
+        return runCacheBenchmark((nThreads > 0u) ? nThreads : 1u, nReads);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-read") == 0)
+    {
+        const unsigned nThreads = (argc > 3) ? (unsigned)atoi(argv[3]) : 8u;
+        const unsigned nReads   = (argc > 4) ? (unsigned)atoi(argv[4]) : 400000u;
+        return runReadBenchmark(argv[2], (nThreads > 0u) ? nThreads : 1u, nReads);
+    }
+    if(argc >= 3 && strcmp(argv[1], "-bench-bloom") == 0)
+    {
+        const unsigned nThreads = (argc > 3) ? (unsigned)atoi(argv[3]) : 4u;
+        const unsigned nLookups = (argc > 4) ? (unsigned)atoi(argv[4]) : 4000000u;
+        return runBloomBenchmark(argv[2], (nThreads > 0u) ? nThreads : 1u, nLookups);
+    }
+
+    const std::string strDir = (argc > 1) ? argv[1] : ".";
+
+    return cmm::runTests(g_testCases, strDir);
+}
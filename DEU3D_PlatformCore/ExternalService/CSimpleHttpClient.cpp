@@ -26,11 +26,31 @@
 #include "memory.h"
 #include "stdlib.h"
 #include "CSimpleHttpClient.h"
+#include "../Network/HttpConnectionPool.h"
 #include "string.h"
+#include <ctype.h>
+#ifdef	__LINUX__
+	#include <unistd.h>
+#endif	//__LINUX__
 
 #define BUFLEN (1024*1024)
 #define SOCKINITFAIL -1
 
+//ӦͷֶǷִֵָСд
+static bool HasToken(const char *pField, const char *pToken)
+{
+	if (NULL == pField)
+	{
+		return false;
+	}
+	std::string strField(pField);
+	for (size_t i = 0; i < strField.size(); i++)
+	{
+		strField[i] = (char)tolower((unsigned char)strField[i]);
+	}
+	return strField.find(pToken) != std::string::npos;
+}
+
 int RecvData(SOCKET s, char *pBuf, long BufLen);
 
 HttpRequest::HttpRequest()
@@ -77,6 +97,7 @@ SimpleHttpClient::SimpleHttpClient()
 	, Port_(0)
 	, AgentHost_(NULL)
 	, AgentPort_(0)
+	, Written_(false)
 {
 #ifdef	__WINDOWS__
 	WORD wVersionRequested;
@@ -99,11 +120,7 @@ SimpleHttpClient::SimpleHttpClient()
 
 SimpleHttpClient::~SimpleHttpClient()
 {
-	if (INVALID_SOCKET != s_)
-	{
-		::closesocket(s_);
-		s_ = INVALID_SOCKET;
-	}
+	ReleaseConnection(false);
 #ifdef	__WINDOWS__
 	if (SockInit_ == 0)
 	{
@@ -134,6 +151,7 @@ void SimpleHttpClient::SafeReleaseInfo()
 	if (NULL != ResponseInfo_.ContentLen)		delete []ResponseInfo_.ContentLen;		//ݳ
 	if (NULL != ResponseInfo_.ContentType)		delete []ResponseInfo_.ContentType;		//
 	if (NULL != ResponseInfo_.Transfer)		delete []ResponseInfo_.Transfer;		//룬ʽΪchunked
+	if (NULL != ResponseInfo_.Connection)		delete []ResponseInfo_.Connection;		//ãΪcloseʱ˽ر
 
 	memset(&ResponseInfo_, '\0', sizeof(ResponseInfo_));
 }
@@ -256,6 +274,7 @@ int	SimpleHttpClient::OpenConnection(const char *pHost, unsigned short Port)
 //-4ʾResponseʧ
 int SimpleHttpClient::SendRequest(HTTPMethod Method, const char *pObj, void *pPostData, long DataLen)
 {
+	Written_ = false;
 	if (s_ == -1 || Host_ == NULL)
 	{
 		return -1;
@@ -408,6 +427,7 @@ int SimpleHttpClient::SendRequest(HTTPMethod Method, const char *pObj, void *pPo
 	GetField(Response.c_str(), "Content-Length", &ResponseInfo_.ContentLen);
 	GetField(Response.c_str(), "Content-Type", &ResponseInfo_.ContentType);
 	GetField(Response.c_str(), "Transfer-Encoding", &ResponseInfo_.Transfer);
+	GetField(Response.c_str(), "Connection", &ResponseInfo_.Connection);
 
 	GetHttpVersion(Response.c_str(), &ResponseInfo_.HttpVersion);
 	GetResponseState(Response.c_str(), &ResponseInfo_.ResponseState);
@@ -431,6 +451,7 @@ int SimpleHttpClient::Send(void *pSendData, long DataLen)
 		{
 			return -1;
 		}
+		Written_ = true;
 		sum += num;
 	}
 	return 0;
@@ -546,6 +567,7 @@ void SimpleHttpClient::GetResponseInfo(ResponseInfo &Info)
 	Info.ResponseState	= ResponseInfo_.ResponseState;
 	Info.ServerType		= ResponseInfo_.ServerType;
 	Info.Transfer		= ResponseInfo_.Transfer;
+	Info.Connection		= ResponseInfo_.Connection;
 }
 
 //ڷ(SendRequest)ɹ,ø÷÷ص(ҳ,ͼƬ,ļ)
@@ -1067,6 +1089,168 @@ void SimpleHttpClient::SetProxyServer(const char *pProxySvr, unsigned short Prox
 	}
 }
 
+//ȴӳиʹеޣȡֵĿӣû½
+//bReusedǷȡ˱ֵӣɹ0ʧͬOpenConnection
+int SimpleHttpClient::AcquireConnection(const char *pHost, unsigned short Port, bool &bReused)
+{
+	bReused = false;
+	ReleaseConnection(false);
+	if (NULL == AgentHost_)
+	{   //Ӳ
+		PoolKey_ = HttpConnectionPool::GetKey(pHost, Port);
+		SOCKET s = g_ConnectionPool.Take(PoolKey_);
+		if (s != INVALID_SOCKET)
+		{
+			if (NULL != Host_)
+			{
+				delete Host_;
+			}
+			s_ = s;
+			Host_ = new char[strlen(pHost) + 1];
+			strcpy(Host_, pHost);
+			Port_ = Port;
+			bReused = true;
+			return 0;
+		}
+	}
+	const int err = OpenConnection(pHost, Port);
+	if (err < 0)
+	{
+		ReleaseConnection(false);
+	}
+	return err;
+}
+
+//ӦѽҿԱʱŻӳأرӣʹе֮
+void SimpleHttpClient::ReleaseConnection(bool bKeepAlive)
+{
+	if (s_ != -1 && bKeepAlive && !PoolKey_.empty())
+	{
+		g_ConnectionPool.Give(PoolKey_, s_);
+	}
+	else
+	{
+		if (s_ != -1)
+		{
+			::closesocket(s_);
+		}
+		if (!PoolKey_.empty())
+		{
+			g_ConnectionPool.Drop(PoolKey_);
+		}
+	}
+	s_ = -1;
+	PoolKey_.clear();
+}
+
+//Ƿ񱣳ӣHTTP/1.1Ĭϱ֣HTTP/1.0ָKeep-Alive
+bool SimpleHttpClient::IsKeepAlive()
+{
+	if (HasToken(ResponseInfo_.Connection, "close"))
+	{
+		return false;
+	}
+	if (NULL != ResponseInfo_.HttpVersion && strcmp(ResponseInfo_.HttpVersion, "HTTP/1.1") == 0)
+	{
+		return true;
+	}
+	return HasToken(ResponseInfo_.Connection, "keep-alive");
+}
+
+//һ,ݲ\r\n,ɹ0,ʧܷ-1
+int SimpleHttpClient::RecvLine(string &strLine)
+{
+	strLine.clear();
+	char c = 0;
+	while (true)
+	{
+		if (RecvData(&c, 1) <= 0)
+		{
+			return -1;
+		}
+		if (c == '\n')
+		{
+			break;
+		}
+		strLine += c;
+	}
+	if (!strLine.empty() && strLine[strLine.size() - 1] == '\r')
+	{
+		strLine.erase(strLine.size() - 1);
+	}
+	return 0;
+}
+
+//SendRequestɹӦ,chunkedContent-Length,ݺһ0
+//bCompleteӦǷѽ,ʱûʣ,ԷŻӳ
+//ɹ0,ûݳȷ6,ʧܷ7
+int SimpleHttpClient::RecvContent(std::vector<char> &vecContent, bool &bComplete)
+{
+	vecContent.clear();
+	bComplete = false;
+
+	if (HasToken(ResponseInfo_.Transfer, "chunked"))
+	{
+		//ÿʮƵĳпʼ,\r\n,Ϊ0ĿǿѡβֶκͿ
+		string strLine;
+		while (true)
+		{
+			if (RecvLine(strLine) < 0)
+			{
+				return 7;
+			}
+			const long blocklen = strtol(strLine.c_str(), NULL, 16);
+			if (blocklen < 0)
+			{
+				return 7;
+			}
+			if (blocklen == 0)
+			{
+				break;
+			}
+			const size_t datalen = vecContent.size();
+			vecContent.resize(datalen + blocklen);
+			if (::RecvData(s_, &vecContent[datalen], blocklen) < blocklen)
+			{
+				return 7;
+			}
+			if (RecvLine(strLine) < 0 || !strLine.empty())
+			{
+				return 7;
+			}
+		}
+		do
+		{
+			if (RecvLine(strLine) < 0)
+			{
+				return 7;
+			}
+		} while (!strLine.empty());
+		vecContent.push_back('\0');
+		bComplete = true;
+		return 0;
+	}
+
+	long len = 0;
+	if (NULL != ResponseInfo_.ContentLen)
+	{
+		len = atol(ResponseInfo_.ContentLen);
+	}
+	if (len <= 0)
+	{   //ûʱҲûʣ,ûгʱֻɷ˹ر
+		bComplete = (NULL != ResponseInfo_.ContentLen && 0 == len);
+		return (0 == len && NULL == ResponseInfo_.Transfer) ? 6 : 7;
+	}
+
+	vecContent.resize(len + 1);
+	if (::RecvData(s_, &vecContent[0], len) < len)
+	{
+		return 7;
+	}
+	bComplete = true;
+	return 0;
+}
+
 //ָURL󣬲õϢ
 //÷ڲԶӣȻõؽֹOpenConnection
 //Method : GetPost󣬾μSendRequest˵
@@ -1103,61 +1287,56 @@ int SimpleHttpClient::Request(HTTPMethod Method, const char *pURL, char **pRespo
     {
     	return 3;
     }
-    if (sc.OpenConnection(hr.pHost, hr.Port) < 0)
-    {
-        return 4;
-    }
-    if (sc.SendRequest(Method, hr.pObject, pData, DataLen) < 0)
-    {
-        return 5;
-    }
-	ResponseInfo Info;
-	sc.GetResponseInfo(Info);
 
-    if(Info.ResponseState != NULL)
-    {
-        long nState = atol(Info.ResponseState);
-        if( nState >= 300)
-        {
-            return 8;
-        }
-    }
-
-    long len = 0;
-    if (NULL != Info.ContentLen)
-    {
-        len = atol(Info.ContentLen);
-    }
-    if (0 == len && NULL == Info.Transfer)
-    {
-    	return 6;
-    }
-    
-	char *pbuf = NULL;
-	if (len > 0)
+	//ֵӿѱ˹ر,Ӧͷʧʱһ
+	//POSTݵȵ,Ѿдʱ˿Ѵ,ֻһֽڶûдط
+	bool bReused = false;
+	if (sc.AcquireConnection(hr.pHost, hr.Port, bReused) < 0)
 	{
-		pbuf = new char[len+1];
-		int recvlen = 0;
-		while (len >recvlen)
+		return 4;
+	}
+	int err = sc.SendRequest(Method, hr.pObject, pData, DataLen);
+	if (err < 0 && bReused && (Method == GetMethod || !sc.Written_))
+	{
+		if (sc.OpenConnection(hr.pHost, hr.Port) < 0)
 		{
-			recvlen += sc.RecvData(pbuf+recvlen, len - recvlen);
+			sc.ReleaseConnection(false);
+			return 4;
 		}
-		if (recvlen <len)	
-		{
-			delete []pbuf;
-			return 7;
-		}
-		pbuf[len] = 0;
-		*pResponseData = pbuf;
-		*pResponseLen = len;
+		err = sc.SendRequest(Method, hr.pObject, pData, DataLen);
+	}
+	if (err < 0)
+	{
+		sc.ReleaseConnection(false);
+		return 5;
 	}
-	else if (len == 0)
+
+	//״̬ӦҲ,Ӳܼʹ
+	std::vector<char> vecContent;
+	bool bComplete = false;
+	const int nRecv = sc.RecvContent(vecContent, bComplete);
+	sc.ReleaseConnection(bComplete && sc.IsKeepAlive());
+
+	ResponseInfo Info;
+	sc.GetResponseInfo(Info);
+	if(Info.ResponseState != NULL)
 	{
-		if (sc.RecvStreamData(pResponseData, pResponseLen) < 0 )
+		long nState = atol(Info.ResponseState);
+		if( nState >= 300)
 		{
-			return 7;
+			return 8;
 		}
 	}
+	if (nRecv != 0)
+	{
+		return nRecv;
+	}
+
+	//ݺŵ0볤
+	char *pbuf = new char[vecContent.size()];
+	memcpy(pbuf, &vecContent[0], vecContent.size());
+	*pResponseData = pbuf;
+	*pResponseLen = (long)vecContent.size() - 1;
 
 	return 0;
 }
@@ -63,6 +63,8 @@
 
 //#define	__LINUX__
 #include "stdio.h"
+#include <vector>
+#include <string>
 
 #pragma warning( disable : 4996 )
 
@@ -118,6 +120,7 @@ struct ResponseInfo
 	char *ContentLen;		//ݳ
 	char *ContentType;		//
 	char *Transfer;			//룬ʽΪ chunked
+	char *Connection;		//ãΪcloseʱ˽ر
 };
 
 struct SIMPHTTPEXP HttpRequest
@@ -252,6 +255,17 @@ private:
 	//ݣɹ0ʧܷ-1
 	int Send(void *pSendData, long DataLen);
 
+	//кڱӣͬһӳе
+	//ȵȸʹеޣٴӳȡӣû½ӣbReusedǷȡ˱ֵ
+	int  AcquireConnection(const char *pHost, unsigned short Port, bool &bReused);
+	//ӦѽҿԱʱŻӳأر
+	void ReleaseConnection(bool bKeepAlive);
+	bool IsKeepAlive();
+
+	//кڽӦݣ֧chunkedContent-Length
+	int  RecvLine(std::string &strLine);
+	int  RecvContent(std::vector<char> &vecContent, bool &bComplete);
+
 	//кڸResponse
 	void GetField(const char *Response, const char *pName, char **Val);
 	void GetHttpVersion(const char *Response, char **Val);
@@ -270,6 +284,8 @@ private:
 	unsigned short		Port_;
 	char				*AgentHost_;
 	unsigned short		AgentPort_;
+	std::string			PoolKey_;		//ռӳʹûռʱΪ
+	bool				Written_;		//SendRequestǷд
 };
 
 #ifdef	__WINDOWS__
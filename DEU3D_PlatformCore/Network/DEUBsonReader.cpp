@@ -0,0 +1,148 @@
+#include "DEUBsonReader.h"
+#include <common/DEUBson.h>
+#include <string.h>
+
+namespace deunw
+{
+    DEUBsonReader::DEUBsonReader(const void *pBuffer, unsigned nBufLen)
+    {
+        m_pBuffer  = (const char *)pBuffer;
+        m_nBufLen  = 0u;
+        m_nPos     = 0u;
+        m_bBroken  = true;
+        m_nType    = 0;
+        m_pName    = NULL;
+        m_pData    = NULL;
+        m_nDataLen = 0u;
+
+        // ĵ4ֽڵܳȿͷ0β
+        unsigned nDocLen = 0u;
+        if(m_pBuffer == NULL || nBufLen < sizeof(nDocLen) + 1u)
+        {
+            return;
+        }
+        memcpy(&nDocLen, m_pBuffer, sizeof(nDocLen));
+        if(nDocLen < sizeof(nDocLen) + 1u || nDocLen > nBufLen)
+        {
+            return;
+        }
+
+        m_nBufLen = nDocLen;
+        m_nPos    = sizeof(nDocLen);
+        m_bBroken = false;
+    }
+
+    DEUBsonReader::~DEUBsonReader(void)
+    {
+    }
+
+    bool DEUBsonReader::next(void)
+    {
+        m_nType    = 0;
+        m_pName    = NULL;
+        m_pData    = NULL;
+        m_nDataLen = 0u;
+        if(m_bBroken || m_nPos >= m_nBufLen)
+        {
+            return false;
+        }
+
+        // Ԫͣ0ʾĵ
+        const int nType = (unsigned char)m_pBuffer[m_nPos];
+        if(nType == 0)
+        {
+            m_nPos = m_nBufLen;
+            return false;
+        }
+        ++m_nPos;
+
+        // Ԫ
+        const char *pName = m_pBuffer + m_nPos;
+        const char *pNameEnd = (const char *)memchr(pName, 0, m_nBufLen - m_nPos);
+        if(pNameEnd == NULL)
+        {
+            m_bBroken = true;
+            return false;
+        }
+        m_nPos += unsigned(pNameEnd - pName) + 1u;
+
+        // ԪصֵܶȡbsonDocument::Readͬ
+        const unsigned nRemain = m_nBufLen - m_nPos;
+        unsigned nSkip = 0u;
+        unsigned nLen  = 0u;
+        switch(nType)
+        {
+        case bson::bsonNULLType:
+            break;
+        case bson::bsonBoolType:
+            nLen = 1u;
+            break;
+        case bson::bsonInt32Type:
+            nLen = 4u;
+            break;
+        case bson::bsonDoubleType:
+        case bson::bsonInt64Type:
+            nLen = 8u;
+            break;
+        case bson::bsonStringType:
+        case bson::bsonBinType:
+        case bson::bsonDocType:
+        case bson::bsonArrayType:
+            if(nRemain < sizeof(nLen))
+            {
+                m_bBroken = true;
+                return false;
+            }
+            memcpy(&nLen, m_pBuffer + m_nPos, sizeof(nLen));
+            if(nType == bson::bsonStringType)
+            {
+                // ֮0βַȰβ0
+                nSkip = sizeof(nLen);
+            }
+            else if(nType == bson::bsonBinType)
+            {
+                // ֮1ֽڵ֮ͣ
+                nSkip = sizeof(nLen) + 1u;
+            }
+            // Ƕ׵ĵĳȰȱݴӳȿʼ
+            break;
+        default:
+            m_bBroken = true;
+            return false;
+        }
+
+        if(nSkip > nRemain || nLen > nRemain - nSkip)
+        {
+            m_bBroken = true;
+            return false;
+        }
+
+        m_nType    = nType;
+        m_pName    = pName;
+        m_pData    = m_pBuffer + m_nPos + nSkip;
+        m_nDataLen = nLen;
+        if(nType == bson::bsonStringType && nLen > 0u)
+        {
+            m_nDataLen = nLen - 1u;
+        }
+        m_nPos += nSkip + nLen;
+        return true;
+    }
+
+    int DEUBsonReader::getInt32(void) const
+    {
+        if(m_nType == bson::bsonInt32Type)
+        {
+            int nValue = 0;
+            memcpy(&nValue, m_pData, sizeof(nValue));
+            return nValue;
+        }
+        if(m_nType == bson::bsonInt64Type)
+        {
+            __int64 nValue = 0;
+            memcpy(&nValue, m_pData, sizeof(nValue));
+            return (int)nValue;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _DEUBSONREADER_H_
+#define _DEUBSONREADER_H_
+
+namespace deunw
+{
+    // ˳ȡһbsonĵĶԪأbsonDocumentҲԪصݣ
+    // ơַԪصֱָԭڶȡڼһֱЧ
+    class DEUBsonReader
+    {
+    public:
+        DEUBsonReader(const void *pBuffer, unsigned nBufLen);
+        ~DEUBsonReader(void);
+
+    public:
+        // һԪأĵʽʱfalse
+        bool            next(void);
+        // ĵʽ֮Ԫ޷
+        bool            isBroken(void) const    {   return m_bBroken;   }
+
+        // ǰԪ
+        int             getType(void) const     {   return m_nType;     }
+        const char     *getName(void) const     {   return m_pName;     }
+        const char     *getData(void) const     {   return m_pData;     }
+        unsigned        getDataLen(void) const  {   return m_nDataLen;  }
+        // Ԫصֵͷ0
+        int             getInt32(void) const;
+
+    private:
+        const char     *m_pBuffer;
+        unsigned        m_nBufLen;
+        unsigned        m_nPos;
+        bool            m_bBroken;
+
+        int             m_nType;
+        const char     *m_pName;
+        const char     *m_pData;
+        unsigned        m_nDataLen;
+    };
+}
+
+#endif //_DEUBSONREADER_H_
@@ -13,6 +13,8 @@ enum DEU_ERROR_TYPE
     DEU_FAIL_RESPONSE_LENGTH  = 6,      //  õresponseʧ
     DEU_FAIL_RESPONSE_CONTENT = 7,      //  õresponseʧ
     DEU_ERROR_RESPONSE_STATE  = 8,      //  ķ״̬
+    DEU_REQUEST_CANCELED      = 9,      //  ȡ
+    DEU_REQUEST_TIMEOUT       = 10,     //  󳬹
     
 
     DEU_FAIL_GET_RCD          = 101,    //  ȡɢϢʧ
@@ -10,10 +10,12 @@
 #include  <stdlib.h>
 #include <sstream>
 #include "DEUDefine.h"
+#include "DEUBsonReader.h"
 #include <map>
 #include <algorithm>
 #include <iostream>
 #include <assert.h>
+#include <math.h>
 #include <IDProvider/Definer.h>
 
 #include "DEUCheck.h"
@@ -49,6 +51,8 @@ namespace deunw
         MapErr.insert(std::make_pair<int, std::string>(5, "󵽷ʧ"));
         MapErr.insert(std::make_pair<int, std::string>(6, "õresponseʧ"));
         MapErr.insert(std::make_pair<int, std::string>(7, "õresponseʧ"));
+        MapErr.insert(std::make_pair<int, std::string>(9, "ȡ"));
+        MapErr.insert(std::make_pair<int, std::string>(10, "󳬹"));
 
         MapErr.insert(std::make_pair<int, std::string>(101, "ȡɢϢʧ"));
         MapErr.insert(std::make_pair<int, std::string>(102, "ӷ˻ȡϢûҪĲ"));
@@ -897,18 +901,40 @@ namespace deunw
         }
     }
 
-    unsigned DEUNetwork::putRequestIntoList(const ID &id)
+    unsigned DEUNetwork::putRequestIntoList(const ID &id, int nPriority, bool &bAttached)
     {
+        // IDأȴͬһأظ
+        m_mtxDownloadResult.lock();
+        std::map<ID, unsigned>::const_iterator itorInFlight = m_mapInFlight.find(id);
+        if(itorInFlight != m_mapInFlight.end())
+        {
+            const unsigned nInFlightID = itorInFlight->second;
+            OpenSP::sp<DownloadResult> &pInFlight = m_mapDownloadResult[nInFlightID];
+            pInFlight->m_nWaiters++;
+            if(nPriority > pInFlight->m_nPriority)
+            {
+                pInFlight->m_nPriority = nPriority;
+            }
+            m_mtxDownloadResult.unlock();
+            bAttached = true;
+            return nInFlightID;
+        }
+
         const unsigned nReqID = genUniqueID();
 
         OpenSP::sp<DownloadResult>  pResultItem = new DownloadResult;
         pResultItem->m_bSuccess = false;
+        pResultItem->m_nErrorCode = DEU_FAIL_READ_BLOCK;
+        pResultItem->m_nPriority = nPriority;
+        pResultItem->m_bFinished = false;
+        pResultItem->m_nWaiters = 1u;
         pResultItem->m_blockFinished.set(false);
 
         // ڳɹпһռ
-        m_mtxDownloadResult.lock();
         m_mapDownloadResult[nReqID] = pResultItem;
+        m_mapInFlight[id] = nReqID;
         m_mtxDownloadResult.unlock();
+        bAttached = false;
 
         // 
         m_mtxRequestQueue.lock();
@@ -921,7 +947,52 @@ namespace deunw
         return nReqID;
     }
 
+    // ʱסm_mtxDownloadResultIDѿʼµʱɾ
+    void DEUNetwork::removeInFlight(const ID &id, unsigned nReqID)
+    {
+        std::map<ID, unsigned>::iterator itorInFlight = m_mapInFlight.find(id);
+        if(itorInFlight != m_mapInFlight.end() && itorInFlight->second == nReqID)
+        {
+            m_mapInFlight.erase(itorInFlight);
+        }
+    }
+
+    void DEUNetwork::setQueryPriority(const ID& id, int nPriority)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDownloadResult);
+        std::map<ID, unsigned>::const_iterator itorInFlight = m_mapInFlight.find(id);
+        if(itorInFlight == m_mapInFlight.end())
+        {
+            return;
+        }
+        // ߳ȡʱµȼ
+        m_mapDownloadResult[itorInFlight->second]->m_nPriority = nPriority;
+    }
+
+    void DEUNetwork::cancelQuery(const ID& id)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxDownloadResult);
+        std::map<ID, unsigned>::iterator itorInFlight = m_mapInFlight.find(id);
+        if(itorInFlight == m_mapInFlight.end())
+        {
+            return;
+        }
+
+        // زѵȴĵãŶе̶߳
+        OpenSP::sp<DownloadResult> &pItem = m_mapDownloadResult[itorInFlight->second];
+        m_mapInFlight.erase(itorInFlight);
+        pItem->m_bFinished = true;
+        pItem->m_bSuccess = false;
+        pItem->m_nErrorCode = DEU_REQUEST_CANCELED;
+        pItem->m_blockFinished.release();
+    }
+
     bool DEUNetwork::queryData(const ID &id, void* &pBuffer, unsigned &nBufLen,OpenSP::sp<cmm::IDEUException> pOutExcep, unsigned nVersion)
+    {
+        return queryData(id, pBuffer, nBufLen, 0, ~0u, pOutExcep);
+    }
+
+    bool DEUNetwork::queryData(const ID& id, void* &pBuffer, unsigned &nBufLen, int nPriority, unsigned nTimeout, OpenSP::sp<cmm::IDEUException> pOutExcep)
     {
         if(!id.isValid())
         {
@@ -953,23 +1024,76 @@ namespace deunw
                 int nError = DEU_SUCCESS;
                 bool bRetValue = false;
                 // Уһк
-                const unsigned nReqID = putRequestIntoList(id);
-                // ȴ
+                bool bAttached = false;
+                const unsigned nReqID = putRequestIntoList(id,nPriority,bAttached);
+                // ȴɣ
                 m_mtxDownloadResult.lock();
-                OpenSP::sp<DownloadResult> &pItem = m_mapDownloadResult[nReqID];
+                OpenSP::sp<DownloadResult> pItem = m_mapDownloadResult[nReqID];
+                m_mtxDownloadResult.unlock();
+                // Block::blockٻʱٵȣѭȵɻ߳
+                const unsigned nBegin = GetTickCount();
+                for(;;)
+                {
+                    m_mtxDownloadResult.lock();
+                    const bool bDone = pItem->m_bFinished;
+                    m_mtxDownloadResult.unlock();
+                    if(bDone)
+                    {
+                        break;
+                    }
+                    if(nTimeout == ~0u)
+                    {
+                        pItem->m_blockFinished.block();
+                        continue;
+                    }
+                    const unsigned nWaited = GetTickCount() - nBegin;
+                    if(nWaited >= nTimeout)
+                    {
+                        break;
+                    }
+                    pItem->m_blockFinished.block(nTimeout - nWaited);
+                }
+
+                // ӳɹɾûеٵȴʱδɵҲ
+                // һֱصݣñصøһ
+                m_mtxDownloadResult.lock();
+                const bool bFinished = pItem->m_bFinished;
+                const bool bLastWaiter = (--pItem->m_nWaiters == 0u);
+                if(bLastWaiter)
+                {
+                    if(!bFinished)
+                    {
+                        removeInFlight(id,nReqID);
+                    }
+                    m_mapDownloadResult.erase(nReqID);
+                }
+                if(bFinished && pItem->m_bSuccess)
+                {
+                    nBufLen = pItem->m_nBufLen;
+                    if(bLastWaiter)
+                    {
+                        pBuffer = pItem->m_pBuffer;
+                        pItem->m_pBuffer = NULL;
+                    }
+                    else
+                    {
+                        pBuffer = malloc(nBufLen);
+                        memcpy(pBuffer,pItem->m_pBuffer,nBufLen);
+                    }
+                }
                 m_mtxDownloadResult.unlock();
-                pItem->m_blockFinished.block();
 
-                // ӳɹɾ
                 // ȡصĽ
-                if(pItem->m_bSuccess)
+                if(!bFinished)
+                {
+                    nError = DEU_REQUEST_TIMEOUT;
+                }
+                else if(pItem->m_bSuccess)
                 {
-                    nBufLen = pItem->m_vecBuffer.size();
-                    pBuffer = malloc(nBufLen);
-                    memcpy(pBuffer,pItem->m_vecBuffer.data(),nBufLen);
                     bRetValue = true;
 
-                    if(m_pDBProxy != NULL)
+                    // ֻɷصĵд뻺
+                    if(m_pDBProxy != NULL && !bAttached)
                     {
                         m_pDBProxy->replaceBlock(id,pBuffer,nBufLen);
                     }
@@ -979,10 +1103,6 @@ namespace deunw
                     nError = pItem->m_nErrorCode;
                 }
 
-                m_mtxDownloadResult.lock();
-                m_mapDownloadResult.erase(nReqID);
-                m_mtxDownloadResult.unlock();
-
                 if(pOutExcep.valid())
                 {
                     pOutExcep->setReturnCode(EC_NET_WORK+nError);
@@ -1824,6 +1944,95 @@ namespace deunw
         return 5u;
     }
 
+    // һص󰴶IDɢб(Ѱַ)ӦеÿԪֻתIDһΣ
+    // ضÿʽIDַĵȽ
+    class RequestIndex
+    {
+    public:
+        typedef std::pair<ID, unsigned>     Item;
+
+        explicit RequestIndex(const std::list<Item> &listReqs)
+        {
+            unsigned nSize = 16u;
+            while(nSize < listReqs.size() * 2u)
+            {
+                nSize *= 2u;
+            }
+            m_nMask = nSize - 1u;
+
+            const Slot empty = {NULL, false};
+            m_vecSlots.assign(nSize, empty);
+            for(std::list<Item>::const_iterator itor = listReqs.begin(); itor != listReqs.end(); ++itor)
+            {
+                unsigned nSlot = hashID(itor->first) & m_nMask;
+                while(m_vecSlots[nSlot].m_pItem != NULL)
+                {
+                    nSlot = (nSlot + 1u) & m_nMask;
+                }
+                m_vecSlots[nSlot].m_pItem = &*itor;
+            }
+        }
+
+        // ȡһIDΪidδȡûʱNULL
+        const Item *take(const ID &id)
+        {
+            unsigned nSlot = hashID(id) & m_nMask;
+            while(m_vecSlots[nSlot].m_pItem != NULL)
+            {
+                Slot &slot = m_vecSlots[nSlot];
+                if(!slot.m_bTaken && slot.m_pItem->first == id)
+                {
+                    slot.m_bTaken = true;
+                    return slot.m_pItem;
+                }
+                nSlot = (nSlot + 1u) & m_nMask;
+            }
+            return NULL;
+        }
+
+        // δȡ
+        void getRemain(std::list<Item> &listRemain) const
+        {
+            listRemain.clear();
+            for(unsigned n = 0u; n < m_vecSlots.size(); n++)
+            {
+                if(m_vecSlots[n].m_pItem != NULL && !m_vecSlots[n].m_bTaken)
+                {
+                    listRemain.push_back(*m_vecSlots[n].m_pItem);
+                }
+            }
+        }
+
+    private:
+        static unsigned hashID(const ID &id)
+        {
+            UINT_64 nHash = id.m_nHighBit;
+            nHash ^= id.m_nMidBit * 0x9E3779B97F4A7C15ui64;
+            nHash ^= id.m_nLowBit * 0xC2B2AE3D27D4EB4Fui64;
+            nHash ^= nHash >> 32;
+            return (unsigned)nHash;
+        }
+
+        struct Slot
+        {
+            const Item     *m_pItem;
+            bool            m_bTaken;
+        };
+        std::vector<Slot>   m_vecSlots;
+        unsigned            m_nMask;
+    };
+
+    // кŶӦȼӸߵ
+    struct PriorityGreater
+    {
+        explicit PriorityGreater(const std::map<unsigned, int> &mapPriority) : m_mapPriority(mapPriority) {}
+        bool operator()(const std::pair<ID, unsigned> &left, const std::pair<ID, unsigned> &right) const
+        {
+            return m_mapPriority.find(left.second)->second > m_mapPriority.find(right.second)->second;
+        }
+        const std::map<unsigned, int> &m_mapPriority;
+    };
+
     void DEUNetwork::fetchRequest(std::list<RequestItem> &listRequests,std::string& strHost)
     {
         listRequests.clear();
@@ -1831,6 +2040,25 @@ namespace deunw
 
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxRequestQueue);
 
+        // ȡ˵ȴఴȼУͬȼȵ
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lockResult(m_mtxDownloadResult);
+            std::map<unsigned, int> mapPriority;
+            std::list<RequestItem>::iterator itorQueue = m_listRequestQueue.begin();
+            while(itorQueue != m_listRequestQueue.end())
+            {
+                std::map<unsigned, OpenSP::sp<DownloadResult> >::const_iterator itorResult = m_mapDownloadResult.find(itorQueue->second);
+                if(itorResult == m_mapDownloadResult.end() || itorResult->second->m_bFinished)
+                {
+                    itorQueue = m_listRequestQueue.erase(itorQueue);
+                    continue;
+                }
+                mapPriority[itorQueue->second] = itorResult->second->m_nPriority;
+                ++itorQueue;
+            }
+            m_listRequestQueue.sort(PriorityGreater(mapPriority));
+        }
+
         if(m_listRequestQueue.empty())
         {
             return;
@@ -1841,7 +2069,7 @@ namespace deunw
         // m_listRequestQueueȡص
         // ǣ
         // 1m_listRequestQueueȡһԴӼ
-        // 2ѡһselectedServer
+        // 2selectHostغʱڽеظѡһselectedServer
         // 3m_listRequestQueueе󣬷ܴselectedServerصȫзlistRequests
         // 4listRequests
         unsigned nTotalReqSize = 0u;
@@ -1868,8 +2096,7 @@ namespace deunw
 
             if(strHost.empty())
             {
-                const unsigned nServer = rand() % vecServers.size();
-                strHost = vecServers[nServer];
+                strHost = selectHost(vecServers);
 
                 listRequests.push_back(*itor);
                 itor = m_listRequestQueue.erase(itor);
@@ -1898,6 +2125,8 @@ namespace deunw
             return false;
         }
         bool bSucceeded = false;
+        beginHostRequest(strHost);
+        const unsigned nBegin = GetTickCount();
         try
         {
             bSucceeded = m_queryData.QueryDatum(strHost,idVec,m_strTicket,vecBuffer,nError);
@@ -1907,10 +2136,174 @@ namespace deunw
             std::cout << "Some exception occured in queryDatum of Network transporting.\n";
             bSucceeded = false;
         }
+        endHostRequest(strHost, bSucceeded, GetTickCount() - nBegin);
 
         return bSucceeded;
     }
 
+    const double   HOST_LATENCY_WEIGHT    = 0.2;       // µغʱƽֵռȨ
+    const double   HOST_FAILURE_WEIGHT    = 0.2;       // µؽʧռȨ
+    const double   HOST_FAILURE_PENALTY   = 1000.0;    // ʧΪ1ʱĺʱ()ʧܵҪһ
+    const unsigned HOST_FAILURE_HALF_LIFE = 10000u;    // ûµʱʧʼʱ()ָ˵ķ·ֵ
+    const unsigned HOST_EJECT_FAILURES    = 3u;        // ʧܼκ޳
+    const unsigned HOST_EJECT_TIME        = 1000u;     // һ޳ʱ()֮ÿ̽ʧܼӱ
+    const unsigned HOST_EJECT_MAX_TIME    = 32000u;
+
+    // ʧnFailuresκ޳ʱ
+    inline unsigned calcEjectTime(unsigned nFailures)
+    {
+        unsigned nEjectTime = HOST_EJECT_TIME;
+        for(unsigned n = HOST_EJECT_FAILURES; n < nFailures && nEjectTime < HOST_EJECT_MAX_TIME; n++)
+        {
+            nEjectTime *= 2u;
+        }
+        return nEjectTime < HOST_EJECT_MAX_TIME ? nEjectTime : HOST_EJECT_MAX_TIME;
+    }
+
+    // ʱnSinceʧ˥ʱnNowֵ
+    inline double decayFailureRate(double dFailureRate, unsigned nSince, unsigned nNow)
+    {
+        return dFailureRate * pow(0.5, (double)(nNow - nSince) / HOST_FAILURE_HALF_LIFE);
+    }
+
+    // ʱnTimeGetTickCountԼ49һ
+    inline bool isTimeReached(unsigned nNow, unsigned nTime)
+    {
+        return (int)(nNow - nTime) >= 0;
+    }
+
+    // vecServersѡ񱾴صķǣ
+    // 1ʧܵķ޳޳һعȥ̽̽ɹָ
+    // 2ȡѡ(ƽʱ + 1 + ʧ * HOST_FAILURE_PENALTY) * (ڽеظ + 1)
+    //    Сһĺͳʧܵķֵ٣ֲضӿͬһ
+    // 3з޳ʱѡһ
+    std::string DEUNetwork::selectHost(const std::vector<std::string> &vecServers)
+    {
+        if(vecServers.size() == 1u)
+        {
+            return vecServers[0];
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHostStatus);
+        const unsigned nNow = GetTickCount();
+
+        std::vector<unsigned> vecCandidates;
+        unsigned nEarliest = 0u;
+        for(unsigned n = 0u; n < vecServers.size(); n++)
+        {
+            std::map<std::string, HostStatus>::const_iterator itorHost = m_mapHostStatus.find(vecServers[n]);
+            if(itorHost == m_mapHostStatus.end() || itorHost->second.m_nFailures < HOST_EJECT_FAILURES)
+            {
+                vecCandidates.push_back(n);
+                continue;
+            }
+
+            const unsigned nEjectUntil = itorHost->second.m_nEjectUntil;
+            if(isTimeReached(nNow, nEjectUntil))
+            {
+                // ̽ڼ䲻أֱ̽˽
+                HostStatus &status = m_mapHostStatus[vecServers[n]];
+                status.m_nEjectUntil = nNow + calcEjectTime(status.m_nFailures);
+                return vecServers[n];
+            }
+
+            const std::map<std::string, HostStatus>::const_iterator itorEarliest = m_mapHostStatus.find(vecServers[nEarliest]);
+            if(itorEarliest == m_mapHostStatus.end() || (int)(nEjectUntil - itorEarliest->second.m_nEjectUntil) < 0)
+            {
+                nEarliest = n;
+            }
+        }
+
+        if(vecCandidates.empty())
+        {
+            return vecServers[nEarliest];
+        }
+        if(vecCandidates.size() == 1u)
+        {
+            return vecServers[vecCandidates[0]];
+        }
+
+        const unsigned nFirst = rand() % vecCandidates.size();
+        unsigned nSecond = rand() % (vecCandidates.size() - 1u);
+        if(nSecond >= nFirst)
+        {
+            ++nSecond;
+        }
+
+        double dScore[2] = {0.0, 0.0};
+        const unsigned nChoices[2] = {vecCandidates[nFirst], vecCandidates[nSecond]};
+        for(unsigned n = 0u; n < 2u; n++)
+        {
+            std::map<std::string, HostStatus>::const_iterator itorHost = m_mapHostStatus.find(vecServers[nChoices[n]]);
+            if(itorHost != m_mapHostStatus.end())
+            {
+                const HostStatus &status = itorHost->second;
+                const double dFailureRate = decayFailureRate(status.m_dFailureRate, status.m_nFailureTime, nNow);
+                dScore[n] = (status.m_dLatency + 1.0 + HOST_FAILURE_PENALTY * dFailureRate) * (status.m_nOutstanding + 1u);
+            }
+        }
+
+        return vecServers[dScore[1] < dScore[0] ? nChoices[1] : nChoices[0]];
+    }
+
+    void DEUNetwork::beginHostRequest(const std::string &strHost)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHostStatus);
+        std::map<std::string, HostStatus>::iterator itorHost = m_mapHostStatus.find(strHost);
+        if(itorHost == m_mapHostStatus.end())
+        {
+            HostStatus status;
+            status.m_dLatency = 0.0;
+            status.m_dFailureRate = 0.0;
+            status.m_nFailureTime = GetTickCount();
+            status.m_nOutstanding = 0u;
+            status.m_nFailures = 0u;
+            status.m_nEjectUntil = 0u;
+            itorHost = m_mapHostStatus.insert(std::make_pair(strHost, status)).first;
+        }
+        ++itorHost->second.m_nOutstanding;
+    }
+
+    void DEUNetwork::endHostRequest(const std::string &strHost, bool bSucceeded, unsigned nElapsed)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHostStatus);
+        std::map<std::string, HostStatus>::iterator itorHost = m_mapHostStatus.find(strHost);
+        if(itorHost == m_mapHostStatus.end())
+        {
+            return;
+        }
+
+        HostStatus &status = itorHost->second;
+        --status.m_nOutstanding;
+
+        // ÿضʧʣʧܵĴһγɹ㣬żɹķҪʧ
+        const unsigned nNow = GetTickCount();
+        status.m_dFailureRate = decayFailureRate(status.m_dFailureRate, status.m_nFailureTime, nNow);
+        status.m_dFailureRate += HOST_FAILURE_WEIGHT * ((bSucceeded ? 0.0 : 1.0) - status.m_dFailureRate);
+        status.m_nFailureTime = nNow;
+
+        // ֻгɹؼʱܿ;ܾصķԵø
+        if(bSucceeded)
+        {
+            if(status.m_dLatency <= 0.0)
+            {
+                status.m_dLatency = nElapsed;
+            }
+            else
+            {
+                status.m_dLatency += HOST_LATENCY_WEIGHT * (nElapsed - status.m_dLatency);
+            }
+            status.m_nFailures = 0u;
+            return;
+        }
+
+        ++status.m_nFailures;
+        if(status.m_nFailures >= HOST_EJECT_FAILURES)
+        {
+            status.m_nEjectUntil = nNow + calcEjectTime(status.m_nFailures);
+        }
+    }
+
     void DEUNetwork::DownloadingThread::run(void)
     {
         struct Transformer
@@ -1947,50 +2340,35 @@ namespace deunw
                 continue;
             }
 
-            // صĽɹ
-            bson::bsonDocument bDoc;
-            const bool bConv2Bson = bDoc.FromBsonStream(vecDownloadBuffer.data(), vecDownloadBuffer.size());
-            if(!bConv2Bson)
-            {
-                downloadingResultFailed(listCurrentReqs);
-                continue;
-            }
-
-            std::list<RequestItem>::const_iterator itor = listCurrentReqs.cbegin();
-            while(itor != listCurrentReqs.cend())
+            // ˳ȡصĽÿԪذIDҵֱӽȴĵ
+            RequestIndex index(listCurrentReqs);
+            DEUBsonReader reader(vecDownloadBuffer.data(), vecDownloadBuffer.size());
+            while(reader.next())
             {
-                m_pThis->m_mtxDownloadResult.lock();
-                OpenSP::sp<DownloadResult> &pItem = m_pThis->m_mapDownloadResult[itor->second];
-
-                bson::bsonElement* pChildElem = bDoc.GetElement(itor->first.toString().c_str());
-                if(pChildElem == NULL)
-                {
-                    pItem->m_bSuccess = false;
-                    pItem->m_nErrorCode = DEU_FAIL_READ_BLOCK;
-                }
-                else if(pChildElem->GetType() == bson::bsonBinType)
-                {
-                    bson::bsonBinaryEle* pBinElem = (bson::bsonBinaryEle*)pChildElem;
-                    pItem->m_bSuccess = true;
-                    pItem->m_nErrorCode = DEU_SUCCESS;
-                    const char *pBuffer = (const char *)pBinElem->BinData();
-                    pItem->m_vecBuffer.assign(pBuffer, pBuffer + pBinElem->BinDataLen());
-                }
-                else if(pChildElem->GetType() == bson::bsonInt32Type)
+                const ID id = ID::genIDfromString(reader.getName());
+                const RequestItem *pItem = index.take(id);
+                while(pItem != NULL)
                 {
-                    bson::bsonInt32Ele* pIntElem = (bson::bsonInt32Ele*)pChildElem;
-                    pItem->m_bSuccess = false;
-                    pItem->m_nErrorCode = pIntElem->Int32Value();
-                }
-                else
-                {
-                    pItem->m_bSuccess = false;
-                    pItem->m_nErrorCode = DEU_FAIL_READ_BLOCK;
+                    if(reader.getType() == bson::bsonBinType)
+                    {
+                        finishDownload(*pItem, true, DEU_SUCCESS, reader.getData(), reader.getDataLen());
+                    }
+                    else if(reader.getType() == bson::bsonInt32Type)
+                    {
+                        finishDownload(*pItem, false, reader.getInt32(), NULL, 0u);
+                    }
+                    else
+                    {
+                        finishDownload(*pItem, false, DEU_FAIL_READ_BLOCK, NULL, 0u);
+                    }
+                    pItem = index.take(id);
                 }
-                m_pThis->m_mtxDownloadResult.unlock();
-                pItem->m_blockFinished.release();
-                itor++;
             }
+
+            // ӦûеԼʽ֮δܶ󣬶ʧ
+            std::list<RequestItem> listRemain;
+            index.getRemain(listRemain);
+            downloadingResultFailed(listRemain);
         }
     }
 
@@ -1999,13 +2377,44 @@ namespace deunw
         std::list<RequestItem>::const_iterator itor = listCurrentReqs.cbegin();
         while(itor != listCurrentReqs.cend())
         {
-            m_pThis->m_mtxDownloadResult.lock();
-            OpenSP::sp<DownloadResult> &pItem = m_pThis->m_mapDownloadResult[itor->second];
-            pItem->m_bSuccess = false;
+            finishDownload(*itor, false, DEU_FAIL_READ_BLOCK, NULL, 0u);
+            itor++;
+        }
+    }
+
+    // һĽɹɹʱֻһΣ֮ɵȴĵֱ
+    void DEUNetwork::DownloadingThread::finishDownload(const RequestItem &item, bool bSuccess, int nErrorCode, const char *pData, unsigned nDataLen)
+    {
+        m_pThis->m_mtxDownloadResult.lock();
+        // ȡ˵ȴ󣬺ԳٵĽ
+        std::map<unsigned, OpenSP::sp<DownloadResult> >::const_iterator itorResult = m_pThis->m_mapDownloadResult.find(item.second);
+        if(itorResult == m_pThis->m_mapDownloadResult.end() || itorResult->second->m_bFinished)
+        {
             m_pThis->m_mtxDownloadResult.unlock();
+            return;
+        }
+        OpenSP::sp<DownloadResult> pItem = itorResult->second;
+        m_pThis->removeInFlight(item.first, item.second);
+        pItem->m_bFinished = true;
+        pItem->m_bSuccess = bSuccess;
+        pItem->m_nErrorCode = nErrorCode;
+        if(bSuccess)
+        {
+            pItem->m_pBuffer = malloc(nDataLen);
+            memcpy(pItem->m_pBuffer, pData, nDataLen);
+            pItem->m_nBufLen = nDataLen;
+        }
+        m_pThis->m_mtxDownloadResult.unlock();
 
-            pItem->m_blockFinished.release();
-            itor++;
+        pItem->m_blockFinished.release();
+    }
+
+    DEUNetwork::DownloadResult::~DownloadResult(void)
+    {
+        if(m_pBuffer != NULL)
+        {
+            free(m_pBuffer);
+            m_pBuffer = NULL;
         }
     }
 
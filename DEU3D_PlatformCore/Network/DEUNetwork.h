@@ -40,6 +40,10 @@ namespace deunw
         // ݼIDȡ 
         bool queryData(const ID &id, void* &pBuffer, unsigned &nBufLen,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL, unsigned nVersion = 0);
         bool queryData(const ID& id,const std::string &strHost,const std::string &strPort,void* &pBuffer, unsigned &nBufLen,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL, unsigned nVersion = 0);
+        bool queryData(const ID& id, void* &pBuffer, unsigned &nBufLen, int nPriority, unsigned nTimeout, OpenSP::sp<cmm::IDEUException> pOutExcep = NULL);
+        // ޸ȼȡ
+        void setQueryPriority(const ID& id, int nPriority);
+        void cancelQuery(const ID& id);
         // ȡݸ
         unsigned queryBlockCount(const std::string& strHost,const std::string& strPort, unsigned nDSCode,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL);
         bool queryVersion(const ID& id,std::vector<unsigned>& versionList,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL);
@@ -165,17 +169,46 @@ namespace deunw
 
         struct DownloadResult : public OpenSP::Ref
         {
-            std::vector<char>       m_vecBuffer;
+            DownloadResult(void) : m_pBuffer(NULL), m_nBufLen(0u) {}
+
+            void                   *m_pBuffer;          // ص(malloc)һȡ߽ĵֱߣٸ
+            unsigned                m_nBufLen;
             bool                    m_bSuccess;
             int                     m_nErrorCode;
+            int                     m_nPriority;        // ȴĵߵȼ
+            bool                    m_bFinished;        // ɻȡ֮Ľ
+            unsigned                m_nWaiters;         // ȴصĵøһȡ߽ĵɾ
             OpenThreads::Block      m_blockFinished;
+
+        protected:
+            virtual ~DownloadResult(void);
         };
         std::map<unsigned, OpenSP::sp<DownloadResult> >     m_mapDownloadResult;
+        std::map<ID, unsigned>                              m_mapInFlight;     // صIDкţͬһIDĵùһ
         OpenThreads::Mutex  m_mtxDownloadResult;
 
-        unsigned    putRequestIntoList(const ID &id);
+        unsigned    putRequestIntoList(const ID &id, int nPriority, bool &bAttached);
+        void        removeInFlight(const ID &id, unsigned nReqID);
         void        fetchRequest(std::list<RequestItem> &listRequests,std::string& strHost);
 
+    protected:
+        // ÿݷͳƣڶѡ
+        struct HostStatus
+        {
+            double                  m_dLatency;         // ɹغʱָȨƽֵ()0ʾδɹع
+            double                  m_dFailureRate;     // ʧʵָȨƽֵûµʱʱ˥
+            unsigned                m_nFailureTime;     // m_dFailureRateһθµʱ(GetTickCount)
+            unsigned                m_nOutstanding;     // ڽеظ
+            unsigned                m_nFailures;        // ʧܵĴ
+            unsigned                m_nEjectUntil;      // ʧܺ޳ʱ(GetTickCount)̽һ
+        };
+        std::map<std::string, HostStatus>   m_mapHostStatus;
+        OpenThreads::Mutex                  m_mtxHostStatus;
+
+        std::string selectHost(const std::vector<std::string> &vecServers);
+        void        beginHostRequest(const std::string &strHost);
+        void        endHostRequest(const std::string &strHost, bool bSucceeded, unsigned nElapsed);
+
     protected:
         class DownloadingThread : public OpenThreads::Thread
         {
@@ -191,12 +224,13 @@ namespace deunw
         public:
             void suspend(bool bSuspend)
             {
+                // finishMission⣬ְ߳̿ԼjoinԶȲ
+                OpenThreads::ScopedLock<OpenThreads::Mutex> scope(m_mtxSuspendCount);
                 if((unsigned)m_MissionFinished == 1u)
                 {
                     return;
                 }
 
-                OpenThreads::ScopedLock<OpenThreads::Mutex> scope(m_mtxSuspendCount);
                 if(bSuspend)
                 {
                     ++m_nSuspendCount;
@@ -211,8 +245,11 @@ namespace deunw
 
             void finishMission(void)
             {
-                m_MissionFinished.exchange(1u);
-                m_block.set(true);
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> scope(m_mtxSuspendCount);
+                    m_MissionFinished.exchange(1u);
+                    m_block.set(true);
+                }
                 join();
             }
 
@@ -221,6 +258,7 @@ namespace deunw
 
         protected:
             void    downloadingResultFailed(const std::list<RequestItem> &listCurrentReqs);
+            void    finishDownload(const RequestItem &item, bool bSuccess, int nErrorCode, const char *pData, unsigned nDataLen);
 
         protected:
             DEUNetwork             *m_pThis;
@@ -1,4 +1,5 @@
 #include "DEUQueryData.h"
+#include "DEUBsonReader.h"
 #include <common/DEUBson.h>
 #include <common/Common.h>
 #include <sstream>
@@ -1063,58 +1064,65 @@ namespace deunw
             bZip = false;
         }
 
-        bson::bsonStream bs;
-        bson::bsonDocument bsonDoc;
+        // ˳ӦĵĸԪأbsonDocumentDataֻһ
+        std::vector<char>   vecDest;
+        const char *pDoc = vecRespBuf.data() + sizeof(DEUTransHeader);
+        unsigned long nDocLen = vecRespBuf.size() - sizeof(DEUTransHeader);
         if(bZip)
         {
-            std::vector<char>   vecDest(header.m_nLength+1);
+            vecDest.resize(header.m_nLength+1);
             unsigned long nDestLen = vecDest.size();
-            int nRes = uncompress((Bytef*)vecDest.data(), &nDestLen,(Bytef*)(vecRespBuf.data()+sizeof(DEUTransHeader)),vecRespBuf.size()-sizeof(DEUTransHeader));
+            int nRes = uncompress((Bytef*)vecDest.data(), &nDestLen,(Bytef*)pDoc,nDocLen);
             if(nRes != Z_OK)
             {
                 nErrorCode = DEU_UNKNOWN;
                 return false;
             }
-
-            bsonDoc.FromBsonStream(vecDest.data(),nDestLen);
+            pDoc = vecDest.data();
+            nDocLen = nDestLen;
         }
-        else
+
+        bool bRetCode = false, bErrDisp = false;
+        int nRetCode = 0, nErrDisp = 0;
+        const char *pData = NULL;
+        unsigned nDataLen = 0u;
+        DEUBsonReader reader(pDoc, nDocLen);
+        while(reader.next())
         {
-            bsonDoc.FromBsonStream(vecRespBuf.data()+sizeof(DEUTransHeader),vecRespBuf.size()-sizeof(DEUTransHeader));
+            const char *pName = reader.getName();
+            if(!bRetCode && strcmp(pName, "RetCode") == 0)
+            {
+                bRetCode = true;
+                nRetCode = reader.getInt32();
+            }
+            else if(!bErrDisp && strcmp(pName, "ErrDisp") == 0)
+            {
+                bErrDisp = true;
+                nErrDisp = reader.getInt32();
+            }
+            else if(pData == NULL && strcmp(pName, "Data") == 0 && reader.getType() == bson::bsonBinType)
+            {
+                pData = reader.getData();
+                nDataLen = reader.getDataLen();
+            }
         }
 
         //get return code
-        bson::bsonElement* pElem = bsonDoc.GetElement("RetCode");
-        if(pElem == NULL)
+        if(!bRetCode)
         {
             nErrorCode = DEU_UNKNOWN;
             return false;
         }
 
-        const int nRetCode = pElem->Int32Value();
         if(nRetCode == 0)
         {
-            pElem = bsonDoc.GetElement("ErrDisp");
-            if(pElem == NULL)
-            {
-                nErrorCode = DEU_UNKNOWN;
-            }
-            else
-            {
-                nErrorCode = pElem->Int32Value();
-            }
+            nErrorCode = bErrDisp ? nErrDisp : DEU_UNKNOWN;
             return false;
         }
 
-        bson::bsonElement* pElemData = bsonDoc.GetElement("Data");
-        if(pElemData && pElemData->GetType() == bson::bsonBinType)
+        if(pData != NULL && nDataLen > 0u)
         {
-            const unsigned nSize = pElemData->BinDataLen();
-            if (nSize > 0u)
-            {
-                vecBuffer.resize(nSize);
-                memcpy(vecBuffer.data(),pElemData->BinData(),nSize);
-            }
+            vecBuffer.assign(pData, pData + nDataLen);
         }
         return true;
     }
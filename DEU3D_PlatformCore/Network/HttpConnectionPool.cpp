@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////
+//
+// HttpConnectionPool.cpp: implementation of the HttpConnectionPool class.
+//
+//////////////////////////////////////////////////////////////////////
+#include "CSimpleHttpClient.h"
+#include "HttpConnectionPool.h"
+#include <OpenThreads/ScopedLock>
+#ifdef  __LINUX__
+    #include <sys/select.h>
+    #include <unistd.h>
+#endif  //__LINUX__
+
+HttpConnectionPool g_ConnectionPool;
+
+HttpConnectionPool::HttpConnectionPool()
+#ifdef  __WINDOWS__
+    : SockInit_(false)
+#endif  //__WINDOWS__
+{
+}
+
+HttpConnectionPool::~HttpConnectionPool()
+{
+    std::map<std::string, HostConnections>::iterator itor = m_mapHosts.begin();
+    for (; itor != m_mapHosts.end(); ++itor)
+    {
+        std::list<IdleConnection>::iterator itorConn = itor->second.listIdle.begin();
+        for (; itorConn != itor->second.listIdle.end(); ++itorConn)
+        {
+            ::closesocket(itorConn->s);
+        }
+    }
+}
+
+SOCKET HttpConnectionPool::Take(const std::string &strHost)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHosts);
+    HostConnections &host = m_mapHosts[strHost];
+    while (host.nActive >= HTTP_MAX_CONNECTIONS_PER_HOST)
+    {
+        m_condHosts.wait(&m_mtxHosts);
+    }
+    host.nActive++;
+
+    //ŻصȻЧ
+    const time_t tNow = time(NULL);
+    while (!host.listIdle.empty())
+    {
+        const IdleConnection conn = host.listIdle.back();
+        host.listIdle.pop_back();
+        if (tNow - conn.tIdle < HTTP_IDLE_TIMEOUT && IsAlive(conn.s))
+        {
+            return conn.s;
+        }
+        ::closesocket(conn.s);
+    }
+    return INVALID_SOCKET;
+}
+
+void HttpConnectionPool::Give(const std::string &strHost, SOCKET s)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHosts);
+    HostConnections &host = m_mapHosts[strHost];
+    if (host.nActive > 0)
+    {
+        host.nActive--;
+    }
+    m_condHosts.broadcast();
+#ifdef  __WINDOWS__
+    //ӳԼʼһwinsockֵӲSimpleHttpClientWSACleanupʧЧ
+    if (!SockInit_)
+    {
+        WSADATA wsaData;
+        SockInit_ = (::WSAStartup(MAKEWORD(2, 2), &wsaData) == 0);
+    }
+    if (!SockInit_)
+    {
+        ::closesocket(s);
+        return;
+    }
+#endif  //__WINDOWS__
+    if (host.listIdle.size() >= HTTP_MAX_IDLE_PER_HOST)
+    {
+        ::closesocket(host.listIdle.front().s);
+        host.listIdle.pop_front();
+    }
+    IdleConnection conn;
+    conn.s = s;
+    conn.tIdle = time(NULL);
+    host.listIdle.push_back(conn);
+}
+
+void HttpConnectionPool::Drop(const std::string &strHost)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxHosts);
+    HostConnections &host = m_mapHosts[strHost];
+    if (host.nActive > 0)
+    {
+        host.nActive--;
+    }
+    m_condHosts.broadcast();
+}
+
+std::string HttpConnectionPool::GetKey(const char *pHost, unsigned short Port)
+{
+    char tmpstr[16] = "";
+    sprintf(tmpstr, ":%d", Port);
+    return std::string(pHost) + tmpstr;
+}
+
+bool HttpConnectionPool::IsAlive(SOCKET s)
+{
+    fd_set fdRead;
+    FD_ZERO(&fdRead);
+    FD_SET(s, &fdRead);
+    timeval tv = {0, 0};
+    return select((int)s + 1, &fdRead, NULL, NULL, &tv) == 0;
+}
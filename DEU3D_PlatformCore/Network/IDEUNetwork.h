@@ -24,6 +24,12 @@ namespace deunw
         // ݼIDȡ 
         virtual bool queryData(const ID& id, void* &pBuffer, unsigned &nBufLen,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL, unsigned nVersion = 0) = 0;
         virtual bool queryData(const ID& id,const std::string &strHost,const std::string &strPort,void* &pBuffer, unsigned &nBufLen,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL, unsigned nVersion = 0) = 0;
+        // ȼȡݣnPriorityԽԽأȴnTimeout룬~0uΪһֱȴ
+        virtual bool queryData(const ID& id, void* &pBuffer, unsigned &nBufLen, int nPriority, unsigned nTimeout, OpenSP::sp<cmm::IDEUException> pOutExcep = NULL) = 0;
+        // ޸Ŷеȼ
+        virtual void setQueryPriority(const ID& id, int nPriority) = 0;
+        // ȡŶӵ󱻶ٵĽԣȴĵ÷DEU_REQUEST_CANCELED
+        virtual void cancelQuery(const ID& id) = 0;
         // ȡݸ
         virtual unsigned queryBlockCount(const std::string& strHost,const std::string& strPort,unsigned nDSCode,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL) = 0;
         virtual bool     queryVersion(const ID& id,std::vector<unsigned>& versionList,OpenSP::sp<cmm::IDEUException> pOutExcep = NULL) = 0;
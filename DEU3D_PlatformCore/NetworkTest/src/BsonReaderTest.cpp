@@ -0,0 +1,219 @@
+#include "NetworkTest.h"
+#include <string.h>
+#include <algorithm>
+#include <Common/DEUBson.h>
+#include <Network/DEUBsonReader.h>
+
+namespace
+{
+    const bson::bsonInt32   g_nRetCode      = 1;
+    const char              g_szString[]    = "hello";
+    const bson::bsonInt64   g_nBigValue     = ((bson::bsonInt64)1 << 40) + 7;
+    const double            g_dblValue      = 0.5;
+    const bson::bsonInt32   g_nArrayValue   = 3;
+    const unsigned          g_nElements     = 8u;
+
+    // A document with an element of every type the reader knows, the binary one holds a test block.
+    // The test block has zeros in it, the reader must take its length and not look for an end.
+    void makeTestDoc(std::vector<char> &vecDoc, std::vector<char> &vecBlock)
+    {
+        makeTestBlock(makeTestID(7u), vecBlock);
+
+        bson::bsonDocument doc;
+        doc.AddInt32Element("RetCode", g_nRetCode);
+        doc.AddStringElement("Str", g_szString);
+        doc.AddBinElement("Data", &vecBlock[0], (unsigned)vecBlock.size());
+        doc.AddInt64Element("I64", g_nBigValue);
+        doc.AddBoolElement("Flag", true);
+        doc.AddDblElement("Dbl", g_dblValue);
+        bson::bsonArrayEle *pArray = dynamic_cast<bson::bsonArrayEle *>(doc.AddArrayElement("Arr"));
+        if(pArray != NULL)
+        {
+            pArray->AddInt32Element(g_nArrayValue);
+        }
+        doc.AddNullElement("Null");
+
+        vecDoc.clear();
+        writeBsonDoc(doc, vecDoc);
+    }
+
+
+    bool isData(const deunw::DEUBsonReader &reader, const void *pData, unsigned nLength)
+    {
+        return reader.getDataLen() == nLength && memcmp(reader.getData(), pData, nLength) == 0;
+    }
+
+
+    // the element the reader is on is the n-th one of the test document
+    bool checkElement(const deunw::DEUBsonReader &reader, unsigned n, const std::vector<char> &vecBlock)
+    {
+        switch(n)
+        {
+        case 0u:
+            TEST_CHECK(strcmp(reader.getName(), "RetCode") == 0 && reader.getType() == bson::bsonInt32Type);
+            TEST_CHECK(reader.getInt32() == g_nRetCode);
+            break;
+        case 1u:
+            TEST_CHECK(strcmp(reader.getName(), "Str") == 0 && reader.getType() == bson::bsonStringType);
+            TEST_CHECK(isData(reader, g_szString, (unsigned)strlen(g_szString)));
+            break;
+        case 2u:
+            TEST_CHECK(strcmp(reader.getName(), "Data") == 0 && reader.getType() == bson::bsonBinType);
+            TEST_CHECK(isData(reader, &vecBlock[0], (unsigned)vecBlock.size()));
+            break;
+        case 3u:
+            TEST_CHECK(strcmp(reader.getName(), "I64") == 0 && reader.getType() == bson::bsonInt64Type);
+            TEST_CHECK(isData(reader, &g_nBigValue, sizeof(g_nBigValue)));
+            TEST_CHECK(reader.getInt32() == (int)g_nBigValue);
+            break;
+        case 4u:
+            TEST_CHECK(strcmp(reader.getName(), "Flag") == 0 && reader.getType() == bson::bsonBoolType);
+            TEST_CHECK(reader.getDataLen() == 1u && reader.getData()[0] != 0);
+            break;
+        case 5u:
+            TEST_CHECK(strcmp(reader.getName(), "Dbl") == 0 && reader.getType() == bson::bsonDoubleType);
+            TEST_CHECK(isData(reader, &g_dblValue, sizeof(g_dblValue)));
+            break;
+        case 6u:
+        {
+            // the data of an array is the nested document, which a reader of its own can walk
+            TEST_CHECK(strcmp(reader.getName(), "Arr") == 0 && reader.getType() == bson::bsonArrayType);
+            deunw::DEUBsonReader readerArray(reader.getData(), reader.getDataLen());
+            TEST_CHECK(readerArray.next());
+            TEST_CHECK(strcmp(readerArray.getName(), "0") == 0 && readerArray.getInt32() == g_nArrayValue);
+            TEST_CHECK(!readerArray.next() && !readerArray.isBroken());
+            break;
+        }
+        case 7u:
+            TEST_CHECK(strcmp(reader.getName(), "Null") == 0 && reader.getType() == bson::bsonNULLType);
+            TEST_CHECK(reader.getDataLen() == 0u);
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+
+    // the offsets in the document at which the elements end
+    void getElementEnds(const std::vector<char> &vecDoc, std::vector<unsigned> &vecEnds)
+    {
+        vecEnds.clear();
+        deunw::DEUBsonReader reader(&vecDoc[0], (unsigned)vecDoc.size());
+        while(reader.next())
+        {
+            vecEnds.push_back(unsigned(reader.getData() - &vecDoc[0]) + reader.getDataLen());
+            if(reader.getType() == bson::bsonStringType)
+            {
+                ++vecEnds.back();       // the 0 after a string
+            }
+        }
+    }
+}
+
+
+// The reader walks every element of a document in place and ends cleanly after the last one.
+bool testBsonReader(void)
+{
+    std::vector<char> vecDoc, vecBlock;
+    makeTestDoc(vecDoc, vecBlock);
+
+    deunw::DEUBsonReader reader(&vecDoc[0], (unsigned)vecDoc.size());
+    for(unsigned n = 0u; n < g_nElements; n++)
+    {
+        TEST_CHECK(reader.next());
+        TEST_CHECK(checkElement(reader, n, vecBlock));
+        TEST_CHECK(reader.getData() >= &vecDoc[0] && reader.getData() + reader.getDataLen() <= &vecDoc[0] + vecDoc.size());
+    }
+    TEST_CHECK(!reader.next());
+    TEST_CHECK(!reader.isBroken());
+    TEST_CHECK(!reader.next());
+
+    // the buffer may be longer than the document, as the response buffers of the downloads are
+    vecDoc.resize(vecDoc.size() + 16u, 1);
+    deunw::DEUBsonReader readerLonger(&vecDoc[0], (unsigned)vecDoc.size());
+    unsigned nRead = 0u;
+    while(readerLonger.next())
+    {
+        TEST_CHECK(checkElement(readerLonger, nRead, vecBlock));
+        ++nRead;
+    }
+    TEST_CHECK(nRead == g_nElements && !readerLonger.isBroken());
+    return true;
+}
+
+
+// A document cut anywhere, with its length made to fit the cut, gives the elements before the cut
+// intact and is broken at the cut, unless the cut falls between two elements. A document whose
+// length is longer than the buffer is broken before its first element.
+bool testBsonReaderTruncated(void)
+{
+    std::vector<char> vecDoc, vecBlock;
+    makeTestDoc(vecDoc, vecBlock);
+    std::vector<unsigned> vecEnds;
+    getElementEnds(vecDoc, vecEnds);
+    TEST_CHECK(vecEnds.size() == g_nElements);
+
+    for(unsigned nCut = 0u; nCut < vecDoc.size(); nCut++)
+    {
+        // a buffer of just the cut, whatever the reader reads beyond it is outside of the buffer
+        std::vector<char> vecCut(vecDoc.begin(), vecDoc.begin() + nCut);
+        if(nCut >= sizeof(unsigned))
+        {
+            memcpy(&vecCut[0], &nCut, sizeof(unsigned));
+        }
+
+        deunw::DEUBsonReader reader(vecCut.empty() ? NULL : &vecCut[0], nCut);
+        unsigned nRead = 0u;
+        while(reader.next())
+        {
+            TEST_CHECK(checkElement(reader, nRead, vecBlock));
+            ++nRead;
+        }
+
+        const unsigned nWhole = (unsigned)(std::upper_bound(vecEnds.begin(), vecEnds.end(), nCut) - vecEnds.begin());
+        const bool bBetween = (nCut > sizeof(unsigned)) && std::binary_search(vecEnds.begin(), vecEnds.end(), nCut);
+        TEST_CHECK(nRead == nWhole);
+        TEST_CHECK(reader.isBroken() == !bBetween);
+    }
+
+    std::vector<char> vecShort(vecDoc.begin(), vecDoc.end() - 1);
+    deunw::DEUBsonReader reader(&vecShort[0], (unsigned)vecShort.size());
+    TEST_CHECK(!reader.next());
+    TEST_CHECK(reader.isBroken());
+    return true;
+}
+
+
+// An element of a type the reader does not know, or one longer than the rest of the document,
+// breaks the document there, the elements before it are still read.
+bool testBsonReaderCorrupt(void)
+{
+    std::vector<char> vecDoc, vecBlock;
+    makeTestDoc(vecDoc, vecBlock);
+    std::vector<unsigned> vecEnds;
+    getElementEnds(vecDoc, vecEnds);
+
+    // 1. the type of the first element
+    std::vector<char> vecBadType = vecDoc;
+    vecBadType[sizeof(unsigned)] = 0x7F;
+    deunw::DEUBsonReader readerBadType(&vecBadType[0], (unsigned)vecBadType.size());
+    TEST_CHECK(!readerBadType.next());
+    TEST_CHECK(readerBadType.isBroken());
+
+    // 2. the length of the binary element, which follows the type and the name "Data"
+    std::vector<char> vecBadLength = vecDoc;
+    const unsigned nLengthPos = vecEnds[1] + 1u + (unsigned)sizeof("Data");
+    const unsigned nBadLength = (unsigned)vecDoc.size();
+    memcpy(&vecBadLength[nLengthPos], &nBadLength, sizeof(nBadLength));
+    deunw::DEUBsonReader readerBadLength(&vecBadLength[0], (unsigned)vecBadLength.size());
+    for(unsigned n = 0u; n < 2u; n++)
+    {
+        TEST_CHECK(readerBadLength.next());
+        TEST_CHECK(checkElement(readerBadLength, n, vecBlock));
+    }
+    TEST_CHECK(!readerBadLength.next());
+    TEST_CHECK(readerBadLength.isBroken());
+    TEST_CHECK(!readerBadLength.next());
+    return true;
+}
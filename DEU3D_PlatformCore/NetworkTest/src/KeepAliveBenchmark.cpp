@@ -0,0 +1,99 @@
+#include "NetworkTest.h"
+#include <sstream>
+
+namespace
+{
+    // requests m_nRequests pages of m_strPath, each of them with a query of its own
+    class PageThread : public OpenThreads::Thread
+    {
+    public:
+        PageThread(const TestHttpServer &server, const std::string &strPath, unsigned nThread, unsigned nRequests)
+            : m_server(server), m_strPath(strPath), m_nThread(nThread), m_nRequests(nRequests), m_bFailed(false){}
+        ~PageThread(void){}
+
+    public:
+        virtual void run(void)
+        {
+            for(unsigned i = 0u; i < m_nRequests; i++)
+            {
+                std::ostringstream oss;
+                oss << m_strPath << "?t=" << m_nThread << "&n=" << i;
+                if(!requestTestPage(m_server, oss.str()))
+                {
+                    m_bFailed = true;
+                    return;
+                }
+            }
+        }
+
+    public:
+        const TestHttpServer   &m_server;
+        std::string             m_strPath;
+        unsigned                m_nThread;
+        unsigned                m_nRequests;
+        bool                    m_bFailed;
+    };
+
+
+    // the seconds nThreads threads take for nRequests requests in all, -1 if one of them has failed
+    double runPageRequests(const TestHttpServer &server, const std::string &strPath, unsigned nThreads, unsigned nRequests)
+    {
+        const double dblStart = getSeconds();
+        std::vector<PageThread *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads.push_back(new PageThread(server, strPath, i, nRequests / nThreads));
+            vecThreads.back()->startThread();
+        }
+
+        bool bFailed = false;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            bFailed = bFailed || vecThreads[i]->m_bFailed;
+            delete vecThreads[i];
+        }
+        const double dblSeconds = getSeconds() - dblStart;
+        return bFailed ? -1.0 : dblSeconds;
+    }
+}
+
+
+int runKeepAliveBenchmark(unsigned nThreads, unsigned nRequests)
+{
+    printf("%u page requests through kept connections and through a new connection for each\n", nRequests);
+
+    TestHttpServer server;
+    if(!server.start())
+    {
+        printf("    FAILED to start the test server\n");
+        return 1;
+    }
+
+    // /close makes the server close every connection after its response, the client has to open another
+    int nFailed = 0;
+    const char *szPaths[2] = { "/page", "/close" };
+    const char *szKinds[2] = { "kept", "new" };
+    const unsigned nThreadCounts[2] = { 1u, nThreads };
+    for(unsigned nKind = 0u; nKind < 2u; nKind++)
+    {
+        for(unsigned i = 0u; i < 2u; i++)
+        {
+            const unsigned nFirst = server.getConnections();
+            const double dblSeconds = runPageRequests(server, szPaths[nKind], nThreadCounts[i], nRequests);
+            if(dblSeconds < 0.0)
+            {
+                printf("    %-4s %2u threads FAILED\n", szKinds[nKind], nThreadCounts[i]);
+                ++nFailed;
+                continue;
+            }
+
+            const unsigned nDone = (nRequests / nThreadCounts[i]) * nThreadCounts[i];
+            printf("    %-4s %2u threads %.0f requests/s, %u connections\n", szKinds[nKind], nThreadCounts[i],
+                   nDone / dblSeconds, server.getConnections() - nFirst);
+        }
+    }
+
+    server.stop();
+    return nFailed;
+}
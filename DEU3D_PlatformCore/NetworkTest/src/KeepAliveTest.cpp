@@ -0,0 +1,202 @@
+#include "NetworkTest.h"
+#include <string.h>
+#include <sstream>
+#include <Network/CSimpleHttpClient.h>
+#include <Network/HttpConnectionPool.h>
+
+namespace
+{
+    const unsigned g_nRequests      = 50u;      // the requests which must share one connection
+    const unsigned g_nCloseWait     = 200u;     // the time a connection closed by the server is given to reach the client
+    const unsigned g_nIdleExpired   = 5000u;    // longer than HTTP_IDLE_TIMEOUT of SimpleHttpClient
+    const unsigned g_nBurst         = 2u * HTTP_MAX_CONNECTIONS_PER_HOST;  // the requests made at once
+    const unsigned g_nBurstWait     = 5000u;    // the time the first of them are given to open their connections
+
+
+    std::string makeTarget(const char *pPath, unsigned n)
+    {
+        std::ostringstream oss;
+        oss << pPath << "?n=" << n;
+        return oss.str();
+    }
+
+
+    // requestTestPage in a thread of its own
+    class PageRequester : public OpenThreads::Thread
+    {
+    public:
+        PageRequester(const TestHttpServer &server, const std::string &strTarget)
+            : m_server(server), m_strTarget(strTarget), m_bFetched(false){}
+
+    protected:
+        virtual void run(void)
+        {
+            m_bFetched = requestTestPage(m_server, m_strTarget);
+        }
+
+    public:
+        const TestHttpServer   &m_server;
+        std::string             m_strTarget;
+        volatile bool           m_bFetched;
+    };
+}
+
+
+// The requests to one server go over one kept connection, however many clients make them.
+bool testKeepAlive(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    for(unsigned n = 0u; n < g_nRequests; n++)
+    {
+        TEST_CHECK(requestTestPage(server, makeTarget("/page", n)));
+    }
+    TEST_CHECK(server.getConnections() == 1u);
+
+    server.stop();
+    return true;
+}
+
+
+// A chunked response is read to its end, trailer included, so its connection is kept.
+bool testKeepAliveChunked(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    TEST_CHECK(requestTestPage(server, makeTarget("/chunked", 0u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 1u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/chunked", 2u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 3u)));
+    TEST_CHECK(server.getConnections() == 1u);
+
+    server.stop();
+    return true;
+}
+
+
+// A connection the server closes is not used again, the next request opens a new one.
+bool testKeepAliveClosed(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    TEST_CHECK(requestTestPage(server, makeTarget("/close", 0u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 1u)));
+    TEST_CHECK(server.getConnections() == 2u);
+
+    // a connection the server has closed without saying so is found closed in the pool
+    TEST_CHECK(requestTestPage(server, makeTarget("/silent", 2u)));
+    sleepMilliseconds(g_nCloseWait);
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 3u)));
+    TEST_CHECK(server.getConnections() == 3u);
+
+    server.stop();
+    return true;
+}
+
+
+// A kept connection which the server closes when the request comes is replaced at once, the
+// request is sent again on a new connection and the caller does not see the failure.
+bool testKeepAliveDropped(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 0u)));
+    server.dropReused();
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 1u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 2u)));
+    TEST_CHECK(server.getConnections() == 2u);
+
+    server.stop();
+    return true;
+}
+
+
+// A connection idle for longer than the client keeps connections is not used again.
+bool testKeepAliveIdle(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 0u)));
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 1u)));
+    TEST_CHECK(server.getConnections() == 1u);
+    sleepMilliseconds(g_nIdleExpired);
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 2u)));
+    TEST_CHECK(server.getConnections() == 2u);
+
+    server.stop();
+    return true;
+}
+
+
+// However many requests to one server are made at once, no more than HTTP_MAX_CONNECTIONS_PER_HOST
+// connections are opened to it, the other requests wait for one of them to come back to the pool.
+bool testKeepAliveCapped(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    // 1. twice as many requests as connections, the server holds them all
+    server.hold(true);
+    std::vector<PageRequester *> vecRequesters;
+    for(unsigned n = 0u; n < g_nBurst; n++)
+    {
+        vecRequesters.push_back(new PageRequester(server, makeTarget("/held", n)));
+        vecRequesters.back()->startThread();
+    }
+    for(unsigned nWaited = 0u; nWaited < g_nBurstWait && server.getConnections() < HTTP_MAX_CONNECTIONS_PER_HOST; nWaited += 10u)
+    {
+        sleepMilliseconds(10u);
+    }
+    // a connection beyond the cap would be opened by now
+    sleepMilliseconds(g_nCloseWait);
+    const unsigned nHeld = server.getConnections();
+
+    // 2. the waiting requests are made once the first ones have been answered
+    server.hold(false);
+    bool bFetched = true;
+    for(size_t n = 0u; n < vecRequesters.size(); n++)
+    {
+        vecRequesters[n]->join();
+        bFetched = bFetched && vecRequesters[n]->m_bFetched;
+        delete vecRequesters[n];
+    }
+    TEST_CHECK(nHeld == HTTP_MAX_CONNECTIONS_PER_HOST);
+    TEST_CHECK(bFetched);
+
+    server.stop();
+    return true;
+}
+
+
+// A POST whose kept connection the server closes when it comes is not sent again, the server
+// may have applied it. The caller sees the failure, unlike that of a GET in KeepAliveDropped.
+bool testKeepAlivePostNotResent(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+
+    const std::vector<char> vecBody(16u, 'p');
+    std::vector<char> vecResponse;
+    {
+        SimpleHttpClient client;
+        TEST_CHECK(client.Request(PostMethod, makeTestURL(server, makeTarget("/page", 0u)), vecResponse, vecBody) == 0);
+    }
+    server.dropReused();
+    {
+        SimpleHttpClient client;
+        TEST_CHECK(client.Request(PostMethod, makeTestURL(server, makeTarget("/page", 1u)), vecResponse, vecBody) != 0);
+    }
+    TEST_CHECK(server.getConnections() == 1u);
+
+    // the next request opens a connection of its own
+    TEST_CHECK(requestTestPage(server, makeTarget("/page", 2u)));
+    TEST_CHECK(server.getConnections() == 2u);
+
+    server.stop();
+    return true;
+}
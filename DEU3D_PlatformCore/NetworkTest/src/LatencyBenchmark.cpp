@@ -0,0 +1,192 @@
+#include "NetworkTest.h"
+#include <algorithm>
+#include <Network/DEUDefine.h>
+
+namespace
+{
+    const unsigned g_nSharedIDs         = 8u;       // the IDs all the threads ask for in the shared runs
+    const unsigned g_nLatencyDeadline   = 2000u;    // the deadline of the calls of the timed runs
+    const unsigned g_nReplicaLatency    = 20u;      // the time the healthy server takes for a download
+
+
+    // makes m_nCalls calls of queryData and keeps the seconds each of them has taken, the failed
+    // calls are counted and taken too
+    class LatencyThread : public OpenThreads::Thread
+    {
+    public:
+        LatencyThread(deunw::IDEUNetwork *pNetwork, unsigned nThread, unsigned nCalls, bool bShared, unsigned nTimeout)
+            : m_pNetwork(pNetwork), m_nThread(nThread), m_nCalls(nCalls), m_bShared(bShared), m_nTimeout(nTimeout),
+              m_nTimeouts(0u), m_nFailures(0u){}
+        ~LatencyThread(void){}
+
+    public:
+        virtual void run(void)
+        {
+            for(unsigned i = 0u; i < m_nCalls; i++)
+            {
+                // the shared IDs are downloaded once for all the calls which wait on them at a time
+                const unsigned n = m_bShared ? (m_nThread + i) % g_nSharedIDs : 1000u + m_nThread * m_nCalls + i;
+                int nError = 0;
+                const double dblStart = getSeconds();
+                const bool bFetched = fetchTestBlock(m_pNetwork, makeTestID(n), nError, 0, m_nTimeout);
+                m_vecSeconds.push_back(getSeconds() - dblStart);
+                if(!bFetched && nError == DEU_REQUEST_TIMEOUT)
+                {
+                    ++m_nTimeouts;
+                }
+                else if(!bFetched)
+                {
+                    ++m_nFailures;
+                }
+            }
+        }
+
+    public:
+        deunw::IDEUNetwork     *m_pNetwork;
+        unsigned                m_nThread;
+        unsigned                m_nCalls;
+        bool                    m_bShared;
+        unsigned                m_nTimeout;
+        std::vector<double>     m_vecSeconds;
+        unsigned                m_nTimeouts;
+        unsigned                m_nFailures;
+    };
+
+
+    // the seconds of the calls of nThreads threads at once, sorted, and the calls which have timed
+    // out and which have failed otherwise
+    void runLatencyCalls(deunw::IDEUNetwork *pNetwork, unsigned nThreads, unsigned nCalls, bool bShared, unsigned nTimeout,
+                         std::vector<double> &vecSeconds, unsigned &nTimeouts, unsigned &nFailures)
+    {
+        std::vector<LatencyThread *> vecThreads;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads.push_back(new LatencyThread(pNetwork, i, nCalls / nThreads, bShared, nTimeout));
+            vecThreads.back()->startThread();
+        }
+
+        vecSeconds.clear();
+        nTimeouts = 0u;
+        nFailures = 0u;
+        for(unsigned i = 0u; i < nThreads; i++)
+        {
+            vecThreads[i]->join();
+            vecSeconds.insert(vecSeconds.end(), vecThreads[i]->m_vecSeconds.begin(), vecThreads[i]->m_vecSeconds.end());
+            nTimeouts += vecThreads[i]->m_nTimeouts;
+            nFailures += vecThreads[i]->m_nFailures;
+            delete vecThreads[i];
+        }
+        std::sort(vecSeconds.begin(), vecSeconds.end());
+    }
+
+
+    // the milliseconds below which dblShare of the calls have returned
+    double getPercentile(const std::vector<double> &vecSeconds, double dblShare)
+    {
+        const size_t n = std::min((size_t)(dblShare * vecSeconds.size()), vecSeconds.size() - 1u);
+        return vecSeconds[n] * 1000.0;
+    }
+}
+
+
+int runLatencyBenchmark(unsigned nThreads, unsigned nCalls)
+{
+    printf("%u calls of queryData from %u threads at once, IDs of their own and shared, without and with a deadline\n",
+           nCalls, nThreads);
+
+    TestHttpServer server;
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    if(!server.start() || !openTestNetwork(server, pNetwork))
+    {
+        printf("    FAILED to start the test server\n");
+        return 1;
+    }
+
+    // the calls with a deadline wait in steps until it has passed, the others until the block is released
+    int nFailed = 0;
+    const char *szKinds[2] = { "own", "shared" };
+    const unsigned nTimeouts[2] = { ~0u, g_nLatencyDeadline };
+    for(unsigned nKind = 0u; nKind < 2u; nKind++)
+    {
+        for(unsigned i = 0u; i < 2u; i++)
+        {
+            const char *szWait = (nTimeouts[i] == ~0u) ? "forever" : "deadline";
+            std::vector<double> vecSeconds;
+            unsigned nTimedOut = 0u, nErrors = 0u;
+            runLatencyCalls(pNetwork.get(), nThreads, nCalls, nKind == 1u, nTimeouts[i], vecSeconds, nTimedOut, nErrors);
+            if(nErrors > 0u || vecSeconds.empty())
+            {
+                printf("    %-6s %-8s FAILED\n", szKinds[nKind], szWait);
+                ++nFailed;
+                continue;
+            }
+
+            printf("    %-6s %-8s p50 %.2f ms, p99 %.2f ms, max %.2f ms, %u timeouts\n", szKinds[nKind], szWait,
+                   getPercentile(vecSeconds, 0.5), getPercentile(vecSeconds, 0.99), vecSeconds.back() * 1000.0, nTimedOut);
+        }
+    }
+
+    pNetwork = NULL;
+    server.stop();
+    return nFailed;
+}
+
+
+int runReplicaBenchmark(unsigned nThreads, unsigned nCalls)
+{
+    printf("%u calls of queryData from %u threads at once against a server alone and beside a failing and a slow replica\n",
+           nCalls, nThreads);
+
+    // the healthy server takes g_nReplicaLatency for a download, the failing replica refuses every
+    // other one at once and the slow one takes ten times as long
+    int nFailed = 0;
+    const char *szKinds[3] = { "alone", "failing", "slow" };
+    for(unsigned nKind = 0u; nKind < 3u; nKind++)
+    {
+        TestHttpServer healthy, replica;
+        OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+        healthy.setLatency(g_nReplicaLatency);
+        if(nKind == 1u)
+        {
+            replica.setFailures(2u);
+        }
+        else if(nKind == 2u)
+        {
+            replica.setLatency(10u * g_nReplicaLatency);
+        }
+        if(!healthy.start() || !replica.start())
+        {
+            printf("    %-8s FAILED to start the test servers\n", szKinds[nKind]);
+            ++nFailed;
+            continue;
+        }
+        if(nKind > 0u)
+        {
+            healthy.setReplica(replica);
+        }
+        if(!openTestNetwork(healthy, pNetwork))
+        {
+            printf("    %-8s FAILED to open the network\n", szKinds[nKind]);
+            ++nFailed;
+            continue;
+        }
+
+        std::vector<double> vecSeconds;
+        unsigned nTimedOut = 0u, nErrors = 0u;
+        runLatencyCalls(pNetwork.get(), nThreads, nCalls, false, ~0u, vecSeconds, nTimedOut, nErrors);
+        if(vecSeconds.empty())
+        {
+            printf("    %-8s FAILED\n", szKinds[nKind]);
+            ++nFailed;
+            continue;
+        }
+
+        std::vector<std::vector<ID> > vecBatches;
+        replica.getBatches(vecBatches);
+        printf("    %-8s p50 %.2f ms, p99 %.2f ms, max %.2f ms, %u failed calls, %u downloads from the replica\n", szKinds[nKind],
+               getPercentile(vecSeconds, 0.5), getPercentile(vecSeconds, 0.99), vecSeconds.back() * 1000.0, nErrors,
+               (unsigned)vecBatches.size());
+        pNetwork = NULL;
+    }
+    return nFailed;
+}
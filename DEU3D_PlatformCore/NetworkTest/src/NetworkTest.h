@@ -0,0 +1,205 @@
+#ifndef NETWORK_TEST_H_2C7A61E4_5B0D_4F8E_9A13_6D42B8E07F35_INCLUDE
+#define NETWORK_TEST_H_2C7A61E4_5B0D_4F8E_9A13_6D42B8E07F35_INCLUDE
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <IDProvider/ID.h>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <Network/IDEUNetwork.h>
+
+namespace bson
+{
+    class bsonDocument;
+}
+
+#if defined (WIN32) || defined (WIN64)
+#include <winsock2.h>
+#else
+typedef int SOCKET;
+#endif
+#include <Common/TestRunner.h>
+
+// The blocks the test server gives out tell by their content which ID they belong to. The IDs
+// from makeMissingID are not on the server, it answers them with DEU_READ_EMPTY_DATA.
+ID          makeTestID(unsigned n);
+ID          makeMissingID(unsigned n);
+bool        isMissingID(const ID &id);
+unsigned    getTestDataSet(void);
+void        makeTestBlock(const ID &id, std::vector<char> &vecBlock);
+bool        checkTestBlock(const ID &id, const void *pData, unsigned nLength);
+
+// appends the stream of doc to vecBuffer
+void        writeBsonDoc(const bson::bsonDocument &doc, std::vector<char> &vecBuffer);
+
+// the page the test server gives out for the plain requests, it tells which target it belongs to
+void        makeTestPage(const std::string &strTarget, std::vector<char> &vecPage);
+
+
+// A stand-in for the apache server of the data services on a free port of 127.0.0.1. It answers
+// the configuration requests of DEURcdInfo with one data service for the data set of the test IDs,
+// which is the server itself and its replica if it has one, and the batch downloads of DEUQueryData
+// with the test blocks.
+// Every connection is served by a thread of its own and kept open as long as the client wants.
+// Any other target is answered with its test page: /chunked sends it in chunks with a trailer,
+// /close closes the connection after it and says so, /silent closes it without saying so, /held
+// waits while the server is held.
+class TestHttpServer : public OpenThreads::Thread
+{
+public:
+    explicit TestHttpServer(void);
+    virtual ~TestHttpServer(void);
+
+public:
+    bool        start(void);
+    void        stop(void);
+    std::string getPort(void) const;
+
+    // while the server is held the batch downloads and the held pages wait before they are answered
+    void        hold(bool bHold);
+
+    // the configuration lists replica beside the server itself as a server of the data set
+    void        setReplica(const TestHttpServer &replica);
+    // the batch downloads are answered nMilliseconds late
+    void        setLatency(unsigned nMilliseconds);
+    // every nEvery-th batch download is refused at once with 503, none of them for 0
+    void        setFailures(unsigned nEvery);
+
+    // how often an ID has been asked for in the batch downloads
+    unsigned    getHits(const ID &id);
+    bool        waitForHits(const ID &id, unsigned nHits, unsigned nMilliseconds);
+
+    // the IDs of each batch download in the order they were asked for
+    void        getBatches(std::vector<std::vector<ID> > &vecBatches);
+
+    // how many connections have been accepted
+    unsigned    getConnections(void);
+
+    // the next request which comes on a connection that has already been used is not answered,
+    // its connection is closed instead, as a server does with a connection it no longer keeps
+    void        dropReused(void);
+
+protected:
+    virtual void run(void);
+
+private:
+    class Connection : public OpenThreads::Thread
+    {
+    public:
+        explicit Connection(TestHttpServer *pServer, SOCKET s) : m_pServer(pServer), m_socket(s){}
+
+    protected:
+        virtual void run(void);
+
+    private:
+        bool    recvRequest(std::string &strTarget, std::vector<char> &vecBody, bool &bClose);
+        bool    recvMore(std::vector<char> &vecInput);
+
+    private:
+        TestHttpServer         *m_pServer;
+        SOCKET                  m_socket;
+        std::vector<char>       m_vecPending;
+    };
+
+    // false if the request is refused
+    bool        respond(const std::string &strTarget, const std::vector<char> &vecBody, std::vector<char> &vecContent);
+    void        respondConfig(const std::string &strData, std::vector<char> &vecContent);
+    bool        respondBlocks(const std::vector<char> &vecBody, std::vector<char> &vecContent);
+    bool        isStopped(void) const;
+    bool        takeDropReused(void);
+
+private:
+    SOCKET                      m_socket;
+    unsigned short              m_nPort;
+    volatile bool               m_bStop;
+    volatile bool               m_bHold;
+    bool                        m_bDropReused;
+    std::string                 m_strReplica;
+    unsigned                    m_nLatency;
+    unsigned                    m_nFailEvery;
+
+    OpenThreads::Mutex          m_mtxState;
+    std::map<ID, unsigned>      m_mapHits;
+    std::vector<std::vector<ID> > m_vecBatches;
+    unsigned                    m_nConnections;
+    std::vector<Connection *>   m_vecConnections;
+};
+
+
+// a network initialized for fetching from the test server, without a local cache
+bool        openTestNetwork(const TestHttpServer &server, OpenSP::sp<deunw::IDEUNetwork> &pNetwork);
+
+// the URL of strTarget on the test server
+std::string makeTestURL(const TestHttpServer &server, const std::string &strTarget);
+
+// one GET of strTarget through a SimpleHttpClient of its own, as the callers of SimpleHttpClient
+// make them, true if the page has come back intact
+bool        requestTestPage(const TestHttpServer &server, const std::string &strTarget);
+
+// fetches id through queryData and checks the block, nErrorCode is the code the call has
+// reported without EC_NET_WORK
+bool        fetchTestBlock(deunw::IDEUNetwork *pNetwork, const ID &id, int &nErrorCode, int nPriority = 0, unsigned nTimeout = ~0u);
+
+// fetchTestBlock in a thread of its own
+class TestFetcher : public OpenThreads::Thread
+{
+public:
+    explicit TestFetcher(deunw::IDEUNetwork *pNetwork, const ID &id, int nPriority = 0, unsigned nTimeout = ~0u);
+
+public:
+    // starts the thread and returns once the call is about to be made
+    void        startFetch(void);
+    // false if the call has not returned within nMilliseconds
+    bool        waitFetched(unsigned nMilliseconds);
+
+protected:
+    virtual void run(void);
+
+public:
+    deunw::IDEUNetwork     *m_pNetwork;
+    ID                      m_id;
+    int                     m_nPriority;
+    unsigned                m_nTimeout;
+    volatile bool           m_bStarted;
+    volatile bool           m_bDone;
+    volatile bool           m_bFetched;
+    int                     m_nErrorCode;
+};
+
+using cmm::sleepMilliseconds;
+using cmm::getSeconds;
+
+// the tests, each of them starts a test server of its own
+bool        testSingleFlight(void);
+bool        testSingleFlightManyIDs(void);
+bool        testSingleFlightFailure(void);
+bool        testTimeout(void);
+bool        testTimeoutOfSharedDownload(void);
+bool        testCancel(void);
+bool        testQueuedRequests(void);
+bool        testKeepAlive(void);
+bool        testKeepAliveChunked(void);
+bool        testKeepAliveClosed(void);
+bool        testKeepAliveDropped(void);
+bool        testKeepAliveIdle(void);
+bool        testKeepAliveCapped(void);
+bool        testKeepAlivePostNotResent(void);
+bool        testReplicaFailingFast(void);
+bool        testReplicaSlow(void);
+bool        testBsonReader(void);
+bool        testBsonReaderTruncated(void);
+bool        testBsonReaderCorrupt(void);
+
+// nRequests page requests from one thread and from nThreads, through kept connections and through
+// a new connection for each, the exit code is the failed runs
+int         runKeepAliveBenchmark(unsigned nThreads, unsigned nRequests);
+// nCalls calls of queryData from nThreads threads at once, the percentiles of their latency, the
+// exit code is the failed runs
+int         runLatencyBenchmark(unsigned nThreads, unsigned nCalls);
+// the same calls against a healthy server alone and beside a failing and a slow replica, the
+// percentiles of their latency and the failed calls, the exit code is the failed runs
+int         runReplicaBenchmark(unsigned nThreads, unsigned nCalls);
+
+#endif
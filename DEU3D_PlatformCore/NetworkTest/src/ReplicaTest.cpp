@@ -0,0 +1,82 @@
+#include "NetworkTest.h"
+
+namespace
+{
+    const unsigned g_nReplicaCalls      = 100u;     // the calls one after another, each of them downloads a block of its own
+    const unsigned g_nHealthyLatency    = 20u;      // the time the healthy replica takes for a download
+    const unsigned g_nSlowLatency       = 200u;     // the time the slow replica takes
+
+
+    // fetches g_nReplicaCalls blocks from the first ID on, the number of calls which have failed
+    unsigned fetchReplicaBlocks(deunw::IDEUNetwork *pNetwork, unsigned nFirst)
+    {
+        unsigned nFailed = 0u;
+        for(unsigned n = 0u; n < g_nReplicaCalls; n++)
+        {
+            int nError = 0;
+            if(!fetchTestBlock(pNetwork, makeTestID(nFirst + n), nError))
+            {
+                ++nFailed;
+            }
+        }
+        return nFailed;
+    }
+
+
+    unsigned getDownloads(TestHttpServer &server)
+    {
+        std::vector<std::vector<ID> > vecBatches;
+        server.getBatches(vecBatches);
+        return (unsigned)vecBatches.size();
+    }
+}
+
+
+// A replica which refuses every other download at once is never three times in a row wrong and
+// answers faster than a healthy one, still it loses the downloads to the healthy replica.
+bool testReplicaFailingFast(void)
+{
+    TestHttpServer healthy, failing;
+    TEST_CHECK(healthy.start());
+    TEST_CHECK(failing.start());
+    healthy.setReplica(failing);
+    healthy.setLatency(g_nHealthyLatency);
+    failing.setFailures(2u);
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(healthy, pNetwork));
+
+    // 1. a failed download costs the caller its block, the failing replica may cost one or two
+    const unsigned nFailed = fetchReplicaBlocks(pNetwork.get(), 0u);
+    TEST_CHECK(nFailed <= g_nReplicaCalls / 20u);
+
+    // 2. it has been tried, but not given the downloads after it has failed
+    TEST_CHECK(getDownloads(failing) <= g_nReplicaCalls / 10u);
+    TEST_CHECK(getDownloads(healthy) >= g_nReplicaCalls - g_nReplicaCalls / 10u);
+
+    pNetwork = NULL;
+    healthy.stop();
+    failing.stop();
+    return true;
+}
+
+
+// A replica which answers every download, but ten times slower, gets few of them.
+bool testReplicaSlow(void)
+{
+    TestHttpServer healthy, slow;
+    TEST_CHECK(healthy.start());
+    TEST_CHECK(slow.start());
+    healthy.setReplica(slow);
+    healthy.setLatency(g_nHealthyLatency);
+    slow.setLatency(g_nSlowLatency);
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(healthy, pNetwork));
+
+    TEST_CHECK(fetchReplicaBlocks(pNetwork.get(), 0u) == 0u);
+    TEST_CHECK(getDownloads(slow) <= g_nReplicaCalls / 10u);
+
+    pNetwork = NULL;
+    healthy.stop();
+    slow.stop();
+    return true;
+}
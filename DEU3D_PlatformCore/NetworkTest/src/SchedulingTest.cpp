@@ -0,0 +1,217 @@
+#include "NetworkTest.h"
+#include <Network/DEUDefine.h>
+
+namespace
+{
+    const unsigned g_nDownloadThreads   = 3u;       // THREADCOUNT of DEUNetwork
+    const unsigned g_nTimeout           = 500u;     // the deadline of the calls which give up
+    const unsigned g_nTickSlack         = 20u;      // the resolution of GetTickCount, which the deadline is measured with
+    const unsigned g_nHitWait           = 10000u;   // the time a download is given to reach the server
+    const unsigned g_nAttachWait        = 200u;     // the time the calls are given to join a download or the queue
+    const unsigned g_nFetchWait         = 10000u;   // the time a call is given to return once it should
+    const unsigned g_nQueueGap          = 20u;      // keeps the calls which queue up in their order
+
+
+    // the last batch the server has been asked for
+    bool getLastBatch(TestHttpServer &server, std::vector<ID> &vecBatch)
+    {
+        std::vector<std::vector<ID> > vecBatches;
+        server.getBatches(vecBatches);
+        if(vecBatches.empty())
+        {
+            return false;
+        }
+        vecBatch = vecBatches.back();
+        return true;
+    }
+}
+
+
+// A call whose deadline passes while the server holds its download returns DEU_REQUEST_TIMEOUT.
+// The download is abandoned with it, its late result is dropped and a later call asks again.
+bool testTimeout(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(server, pNetwork));
+
+    const ID id = makeTestID(200u);
+    server.hold(true);
+    const double dblStart = getSeconds();
+    TestFetcher fetcher(pNetwork.get(), id, 0, g_nTimeout);
+    fetcher.startFetch();
+    const bool bReached = server.waitForHits(id, 1u, g_nHitWait);
+    const bool bReturned = fetcher.waitFetched(g_nFetchWait);
+    const double dblElapsed = getSeconds() - dblStart;
+    server.hold(false);
+    fetcher.join();
+
+    TEST_CHECK(bReached);
+    TEST_CHECK(bReturned);
+    TEST_CHECK(!fetcher.m_bFetched);
+    TEST_CHECK(fetcher.m_nErrorCode == DEU_REQUEST_TIMEOUT);
+    TEST_CHECK(dblElapsed >= (g_nTimeout - g_nTickSlack) / 1000.0);
+
+    int nError = 0;
+    TEST_CHECK(fetchTestBlock(pNetwork.get(), id, nError));
+    TEST_CHECK(nError == DEU_SUCCESS);
+    TEST_CHECK(server.getHits(id) == 2u);
+
+    pNetwork = NULL;
+    server.stop();
+    return true;
+}
+
+
+// The deadline belongs to the call, not to the download it shares: a call which gives up leaves
+// the download to the calls still waiting on it.
+bool testTimeoutOfSharedDownload(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(server, pNetwork));
+
+    const ID id = makeTestID(201u);
+    server.hold(true);
+    TestFetcher fetcherPatient(pNetwork.get(), id);
+    fetcherPatient.startFetch();
+    const bool bReached = server.waitForHits(id, 1u, g_nHitWait);
+    TestFetcher fetcherHasty(pNetwork.get(), id, 0, g_nTimeout);
+    fetcherHasty.startFetch();
+    const bool bHastyReturned = fetcherHasty.waitFetched(g_nFetchWait);
+    const bool bPatientWaiting = !fetcherPatient.m_bDone;
+    server.hold(false);
+    fetcherHasty.join();
+    fetcherPatient.join();
+
+    TEST_CHECK(bReached);
+    TEST_CHECK(bHastyReturned);
+    TEST_CHECK(fetcherHasty.m_nErrorCode == DEU_REQUEST_TIMEOUT);
+    TEST_CHECK(bPatientWaiting);
+    TEST_CHECK(fetcherPatient.m_bFetched);
+    TEST_CHECK(fetcherPatient.m_nErrorCode == DEU_SUCCESS);
+    TEST_CHECK(server.getHits(id) == 1u);
+
+    pNetwork = NULL;
+    server.stop();
+    return true;
+}
+
+
+// cancelQuery ends a running download at once for every call waiting on it, the result which
+// arrives later is dropped and a later call asks the server again.
+bool testCancel(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(server, pNetwork));
+
+    const ID id = makeTestID(202u);
+    server.hold(true);
+    TestFetcher fetcherFirst(pNetwork.get(), id);
+    fetcherFirst.startFetch();
+    const bool bReached = server.waitForHits(id, 1u, g_nHitWait);
+    TestFetcher fetcherSecond(pNetwork.get(), id);
+    fetcherSecond.startFetch();
+    sleepMilliseconds(g_nAttachWait);
+
+    pNetwork->cancelQuery(id);
+    const bool bReturned = fetcherFirst.waitFetched(g_nFetchWait) && fetcherSecond.waitFetched(g_nFetchWait);
+    server.hold(false);
+    fetcherFirst.join();
+    fetcherSecond.join();
+
+    TEST_CHECK(bReached);
+    TEST_CHECK(bReturned);
+    TEST_CHECK(!fetcherFirst.m_bFetched && fetcherFirst.m_nErrorCode == DEU_REQUEST_CANCELED);
+    TEST_CHECK(!fetcherSecond.m_bFetched && fetcherSecond.m_nErrorCode == DEU_REQUEST_CANCELED);
+
+    int nError = 0;
+    TEST_CHECK(fetchTestBlock(pNetwork.get(), id, nError));
+    TEST_CHECK(nError == DEU_SUCCESS);
+    TEST_CHECK(server.getHits(id) == 2u);
+
+    pNetwork = NULL;
+    server.stop();
+    return true;
+}
+
+
+// With every download thread busy the requests queue up. A queued request which is cancelled is
+// never sent, the others go out in one batch ordered by their priorities, including the one
+// raised by setQueryPriority while it was queued.
+bool testQueuedRequests(void)
+{
+    TestHttpServer server;
+    TEST_CHECK(server.start());
+    OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+    TEST_CHECK(openTestNetwork(server, pNetwork));
+
+    // 1. one held download for each download thread
+    server.hold(true);
+    std::vector<TestFetcher *> vecFetchers;
+    bool bReached = true;
+    for(unsigned n = 0u; n < g_nDownloadThreads; n++)
+    {
+        const ID id = makeTestID(210u + n);
+        vecFetchers.push_back(new TestFetcher(pNetwork.get(), id));
+        vecFetchers.back()->startFetch();
+        bReached = server.waitForHits(id, 1u, g_nHitWait) && bReached;
+    }
+
+    // 2. the queued requests, they arrive in the reverse order of their final priorities
+    const ID idLow      = makeTestID(220u);
+    const ID idHigh     = makeTestID(221u);
+    const ID idRaised   = makeTestID(222u);
+    const ID idCanceled = makeTestID(223u);
+    vecFetchers.push_back(new TestFetcher(pNetwork.get(), idLow, 3));
+    vecFetchers.push_back(new TestFetcher(pNetwork.get(), idHigh, 5));
+    vecFetchers.push_back(new TestFetcher(pNetwork.get(), idRaised, 1));
+    TestFetcher *pCanceled = new TestFetcher(pNetwork.get(), idCanceled, 10);
+    vecFetchers.push_back(pCanceled);
+    for(size_t n = g_nDownloadThreads; n < vecFetchers.size(); n++)
+    {
+        vecFetchers[n]->startFetch();
+        sleepMilliseconds(g_nQueueGap);
+    }
+    sleepMilliseconds(g_nAttachWait);
+
+    pNetwork->setQueryPriority(idRaised, 10);
+    pNetwork->cancelQuery(idCanceled);
+    const bool bCanceled = pCanceled->waitFetched(g_nFetchWait);
+
+    // 3. the threads are free again and take the queue
+    server.hold(false);
+    bool bFetched = true;
+    for(size_t n = 0u; n < vecFetchers.size(); n++)
+    {
+        vecFetchers[n]->join();
+        if(vecFetchers[n] != pCanceled)
+        {
+            bFetched = bFetched && vecFetchers[n]->m_bFetched && vecFetchers[n]->m_nErrorCode == DEU_SUCCESS;
+        }
+    }
+    const int nCanceledError = pCanceled->m_nErrorCode;
+    for(size_t n = 0u; n < vecFetchers.size(); n++)
+    {
+        delete vecFetchers[n];
+    }
+
+    TEST_CHECK(bReached);
+    TEST_CHECK(bCanceled);
+    TEST_CHECK(nCanceledError == DEU_REQUEST_CANCELED);
+    TEST_CHECK(bFetched);
+    TEST_CHECK(server.getHits(idCanceled) == 0u);
+
+    std::vector<ID> vecBatch;
+    TEST_CHECK(getLastBatch(server, vecBatch));
+    TEST_CHECK(vecBatch.size() == 3u);
+    TEST_CHECK(vecBatch[0] == idRaised && vecBatch[1] == idHigh && vecBatch[2] == idLow);
+
+    pNetwork = NULL;
+    server.stop();
+    return true;
+}
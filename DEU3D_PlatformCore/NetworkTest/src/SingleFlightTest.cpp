@@ -0,0 +1,117 @@
+#include "NetworkTest.h"
+#include <Network/DEUDefine.h>
+
+namespace
+{
+    const unsigned g_nFetchers      = 16u;      // the calls for one ID at once
+    const unsigned g_nManyIDs       = 8u;
+    const unsigned g_nFetchersPerID = 4u;
+    const unsigned g_nHitWait       = 10000u;   // the time a download is given to reach the server
+    const unsigned g_nAttachWait    = 200u;     // the time the calls are given to join the download
+
+    void startFetchers(deunw::IDEUNetwork *pNetwork, const std::vector<ID> &vecIDs, std::vector<TestFetcher *> &vecFetchers)
+    {
+        for(size_t n = 0u; n < vecIDs.size(); n++)
+        {
+            vecFetchers.push_back(new TestFetcher(pNetwork, vecIDs[n]));
+            vecFetchers.back()->startFetch();
+        }
+    }
+
+
+    // true if every call has ended as expected, the fetchers are deleted
+    bool joinFetchers(std::vector<TestFetcher *> &vecFetchers, bool bFetched, int nErrorCode)
+    {
+        bool bExpected = true;
+        for(size_t n = 0u; n < vecFetchers.size(); n++)
+        {
+            vecFetchers[n]->join();
+            bExpected = bExpected && vecFetchers[n]->m_bFetched == bFetched && vecFetchers[n]->m_nErrorCode == nErrorCode;
+            delete vecFetchers[n];
+        }
+        vecFetchers.clear();
+        return bExpected;
+    }
+
+
+    // every ID of vecIDs has been asked for nHits times
+    bool checkHits(TestHttpServer &server, const std::vector<ID> &vecIDs, unsigned nHits)
+    {
+        for(size_t n = 0u; n < vecIDs.size(); n++)
+        {
+            if(server.getHits(vecIDs[n]) != nHits)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    // Many calls for the IDs of vecIDs at once, while the server holds the downloads. The calls for
+    // one ID must all share one download and get the same result.
+    bool runSharedFetches(const std::vector<ID> &vecIDs, bool bFetched, int nErrorCode)
+    {
+        TestHttpServer server;
+        TEST_CHECK(server.start());
+        OpenSP::sp<deunw::IDEUNetwork> pNetwork;
+        TEST_CHECK(openTestNetwork(server, pNetwork));
+
+        // 1. the calls wait on the held downloads
+        server.hold(true);
+        std::vector<TestFetcher *> vecFetchers;
+        startFetchers(pNetwork.get(), vecIDs, vecFetchers);
+        // the IDs behind the busy download threads stay queued, their calls share the queued request
+        const bool bReached = server.waitForHits(vecIDs[0], 1u, g_nHitWait);
+        sleepMilliseconds(g_nAttachWait);
+
+        // 2. every call gets the result of the one download
+        server.hold(false);
+        TEST_CHECK(joinFetchers(vecFetchers, bFetched, nErrorCode));
+        TEST_CHECK(bReached);
+        TEST_CHECK(checkHits(server, vecIDs, 1u));
+
+        // 3. the download has ended, a later call asks the server again
+        int nLaterError = 0;
+        TEST_CHECK(fetchTestBlock(pNetwork.get(), vecIDs[0], nLaterError) == bFetched);
+        TEST_CHECK(nLaterError == nErrorCode);
+        TEST_CHECK(server.getHits(vecIDs[0]) == 2u);
+
+        pNetwork = NULL;
+        server.stop();
+        return true;
+    }
+}
+
+
+// Calls for an ID which is being downloaded wait on that download instead of asking the server
+// once more, and the ID is fetched anew once the download has ended.
+bool testSingleFlight(void)
+{
+    const std::vector<ID> vecIDs(g_nFetchers, makeTestID(1u));
+    return runSharedFetches(vecIDs, true, DEU_SUCCESS);
+}
+
+
+// The same with the calls for several IDs mixed, each ID is downloaded once.
+bool testSingleFlightManyIDs(void)
+{
+    std::vector<ID> vecIDs;
+    for(unsigned i = 0u; i < g_nFetchersPerID; i++)
+    {
+        for(unsigned n = 0u; n < g_nManyIDs; n++)
+        {
+            vecIDs.push_back(makeTestID(100u + n));
+        }
+    }
+    return runSharedFetches(vecIDs, true, DEU_SUCCESS);
+}
+
+
+// A failed download fails every call waiting on it with the error code of the server, and it is
+// not kept either, a later call asks the server again.
+bool testSingleFlightFailure(void)
+{
+    const std::vector<ID> vecIDs(g_nFetchers, makeMissingID(1u));
+    return runSharedFetches(vecIDs, false, DEU_READ_EMPTY_DATA);
+}
@@ -0,0 +1,525 @@
+#include "NetworkTest.h"
+#include <string.h>
+#include <ctype.h>
+#include <sstream>
+#include <algorithm>
+#include <OpenThreads/ScopedLock>
+#include <Common/DEUBson.h>
+#include <Network/DEUDefine.h>
+
+#if defined (WIN32) || defined (WIN64)
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define INVALID_SOCKET  (-1)
+#define closesocket(s)  close(s)
+#endif
+
+namespace
+{
+    // the time a thread of the server waits for a socket before it looks whether it is to stop
+    const unsigned g_nPollTime = 50u;
+
+    // the header DEUQueryData expects before a batch response, DEUDATA0 for one which is not zipped
+    struct TransHeader
+    {
+        unsigned char   m_szFlag[8];
+        UINT_64         m_nLength;
+    };
+
+    bool waitReadable(SOCKET s)
+    {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(s, &fds);
+        timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = g_nPollTime * 1000;
+        return select((int)s + 1, &fds, NULL, NULL, &tv) > 0;
+    }
+
+    bool sendAll(SOCKET s, const char *pData, size_t nLength)
+    {
+        while(nLength > 0u)
+        {
+            const int nSent = send(s, pData, (int)nLength, 0);
+            if(nSent <= 0)
+            {
+                return false;
+            }
+            pData += nSent;
+            nLength -= nSent;
+        }
+        return true;
+    }
+
+    // the value of a header field, empty when the header has no such field
+    std::string getHeaderField(const std::string &strHeader, const char *pName)
+    {
+        std::string strLower = strHeader;
+        std::transform(strLower.begin(), strLower.end(), strLower.begin(), ::tolower);
+        const std::string strName = std::string("\r\n") + pName + ":";
+        const size_t nPos = strLower.find(strName);
+        if(nPos == std::string::npos)
+        {
+            return "";
+        }
+
+        size_t nBegin = nPos + strName.size();
+        const size_t nEnd = strLower.find("\r\n", nBegin);
+        while(nBegin < nEnd && strLower[nBegin] == ' ')
+        {
+            ++nBegin;
+        }
+        return strLower.substr(nBegin, nEnd - nBegin);
+    }
+}
+
+
+TestHttpServer::TestHttpServer(void)
+    : m_socket(INVALID_SOCKET), m_nPort(0u), m_bStop(true), m_bHold(false), m_bDropReused(false), m_nLatency(0u),
+      m_nFailEvery(0u), m_nConnections(0u)
+{
+}
+
+
+TestHttpServer::~TestHttpServer(void)
+{
+    stop();
+}
+
+
+bool TestHttpServer::start(void)
+{
+#if defined (WIN32) || defined (WIN64)
+    WSADATA wsaData;
+    if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        return false;
+    }
+#endif
+
+    // 1. a free port of the loopback
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if(m_socket == INVALID_SOCKET)
+    {
+        return false;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t nAddrLen = sizeof(addr);
+    if(bind(m_socket, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(m_socket, 64) != 0 ||
+        getsockname(m_socket, (sockaddr *)&addr, &nAddrLen) != 0)
+    {
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+        return false;
+    }
+    m_nPort = ntohs(addr.sin_port);
+
+    // 2. the thread which accepts the connections
+    m_bStop = false;
+    startThread();
+    return true;
+}
+
+
+void TestHttpServer::stop(void)
+{
+    if(m_socket == INVALID_SOCKET)
+    {
+        return;
+    }
+
+    // the held downloads are answered and every connection is closed by its thread
+    m_bStop = true;
+    join();
+    closesocket(m_socket);
+    m_socket = INVALID_SOCKET;
+
+    for(size_t n = 0u; n < m_vecConnections.size(); n++)
+    {
+        m_vecConnections[n]->join();
+        delete m_vecConnections[n];
+    }
+    m_vecConnections.clear();
+
+#if defined (WIN32) || defined (WIN64)
+    WSACleanup();
+#endif
+}
+
+
+std::string TestHttpServer::getPort(void) const
+{
+    std::ostringstream oss;
+    oss << m_nPort;
+    return oss.str();
+}
+
+
+void TestHttpServer::hold(bool bHold)
+{
+    m_bHold = bHold;
+}
+
+
+void TestHttpServer::setReplica(const TestHttpServer &replica)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    m_strReplica = replica.getPort();
+}
+
+
+void TestHttpServer::setLatency(unsigned nMilliseconds)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    m_nLatency = nMilliseconds;
+}
+
+
+void TestHttpServer::setFailures(unsigned nEvery)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    m_nFailEvery = nEvery;
+}
+
+
+unsigned TestHttpServer::getHits(const ID &id)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    std::map<ID, unsigned>::const_iterator itor = m_mapHits.find(id);
+    return (itor == m_mapHits.end()) ? 0u : itor->second;
+}
+
+
+bool TestHttpServer::waitForHits(const ID &id, unsigned nHits, unsigned nMilliseconds)
+{
+    for(unsigned nWaited = 0u; nWaited < nMilliseconds; nWaited += 10u)
+    {
+        if(getHits(id) >= nHits)
+        {
+            return true;
+        }
+        sleepMilliseconds(10u);
+    }
+    return getHits(id) >= nHits;
+}
+
+
+void TestHttpServer::getBatches(std::vector<std::vector<ID> > &vecBatches)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    vecBatches = m_vecBatches;
+}
+
+
+unsigned TestHttpServer::getConnections(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    return m_nConnections;
+}
+
+
+void TestHttpServer::dropReused(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    m_bDropReused = true;
+}
+
+
+bool TestHttpServer::takeDropReused(void)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+    const bool bDrop = m_bDropReused;
+    m_bDropReused = false;
+    return bDrop;
+}
+
+
+bool TestHttpServer::isStopped(void) const
+{
+    return m_bStop;
+}
+
+
+void TestHttpServer::run(void)
+{
+    while(!m_bStop)
+    {
+        if(!waitReadable(m_socket))
+        {
+            continue;
+        }
+
+        const SOCKET s = accept(m_socket, NULL, NULL);
+        if(s == INVALID_SOCKET)
+        {
+            continue;
+        }
+        Connection *pConnection = new Connection(this, s);
+        m_vecConnections.push_back(pConnection);
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+            ++m_nConnections;
+        }
+        pConnection->startThread();
+    }
+}
+
+
+bool TestHttpServer::respond(const std::string &strTarget, const std::vector<char> &vecBody, std::vector<char> &vecContent)
+{
+    vecContent.clear();
+    if(strTarget.find("type=getRcdInfo") != std::string::npos)
+    {
+        // one range of the hash for all the IDs of the data set, served by this server and its replica
+        std::string strReplica;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+            strReplica = m_strReplica.empty() ? "" : ",\"" + m_strReplica + "\"";
+        }
+        std::ostringstream oss;
+        oss << "{\"" << getTestDataSet() << "\":{\"url\":[{\"si\":\"0\",\"ei\":\"100\",\"port\":{\"127.0.0.1\":[\"" << m_nPort << "\""
+            << strReplica << "]}}]}}";
+        respondConfig(oss.str(), vecContent);
+    }
+    else if(strTarget.find("type=getServerInfo") != std::string::npos)
+    {
+        respondConfig("{}", vecContent);
+    }
+    else if(strTarget.find("type=queryData3") != std::string::npos)
+    {
+        return respondBlocks(vecBody, vecContent);
+    }
+    else
+    {
+        // a held page waits like the batch downloads
+        while(strTarget.find("/held") == 0u && m_bHold && !m_bStop)
+        {
+            sleepMilliseconds(10u);
+        }
+        makeTestPage(strTarget, vecContent);
+    }
+    return true;
+}
+
+
+void TestHttpServer::respondConfig(const std::string &strData, std::vector<char> &vecContent)
+{
+    bson::bsonDocument doc;
+    doc.AddInt32Element("RetCode", 1);
+    doc.AddBinElement("Data", (void *)strData.data(), (unsigned)strData.size());
+    writeBsonDoc(doc, vecContent);
+}
+
+
+bool TestHttpServer::respondBlocks(const std::vector<char> &vecBody, std::vector<char> &vecContent)
+{
+    // 1. the IDs asked for
+    std::vector<std::string> vecIDs;
+    bson::bsonDocument docRequest;
+    if(!vecBody.empty() && docRequest.FromBsonStream(&vecBody[0], (unsigned)vecBody.size()))
+    {
+        const bson::bsonArrayEle *pArray = dynamic_cast<const bson::bsonArrayEle *>(docRequest.GetElement("ID"));
+        for(unsigned n = 0u; pArray != NULL && n < pArray->ChildCount(); n++)
+        {
+            std::string strID;
+            pArray->GetElement(n)->ValueString(strID, false);
+            vecIDs.push_back(strID);
+        }
+    }
+
+    unsigned nLatency = 0u;
+    bool bRefused = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_mtxState);
+        m_vecBatches.push_back(std::vector<ID>());
+        for(size_t n = 0u; n < vecIDs.size(); n++)
+        {
+            const ID id = ID::genIDfromString(vecIDs[n]);
+            ++m_mapHits[id];
+            m_vecBatches.back().push_back(id);
+        }
+        nLatency = m_nLatency;
+        bRefused = (m_nFailEvery > 0u && m_vecBatches.size() % m_nFailEvery == 0u);
+    }
+    if(bRefused)
+    {
+        return false;
+    }
+
+    // 2. the answer waits while the server is held and for the latency of the server
+    while(m_bHold && !m_bStop)
+    {
+        sleepMilliseconds(10u);
+    }
+    if(nLatency > 0u)
+    {
+        sleepMilliseconds(nLatency);
+    }
+
+    // 3. a block or an error code for each of them
+    bson::bsonDocument docBlocks;
+    for(size_t n = 0u; n < vecIDs.size(); n++)
+    {
+        const ID id = ID::genIDfromString(vecIDs[n]);
+        if(isMissingID(id))
+        {
+            docBlocks.AddInt32Element(vecIDs[n].c_str(), DEU_READ_EMPTY_DATA);
+            continue;
+        }
+        std::vector<char> vecBlock;
+        makeTestBlock(id, vecBlock);
+        docBlocks.AddBinElement(vecIDs[n].c_str(), &vecBlock[0], (unsigned)vecBlock.size());
+    }
+    std::vector<char> vecBlocks;
+    writeBsonDoc(docBlocks, vecBlocks);
+
+    bson::bsonDocument docResponse;
+    docResponse.AddInt32Element("RetCode", 1);
+    docResponse.AddBinElement("Data", &vecBlocks[0], (unsigned)vecBlocks.size());
+    std::vector<char> vecResponse;
+    writeBsonDoc(docResponse, vecResponse);
+
+    TransHeader header;
+    memcpy(header.m_szFlag, "DEUDATA0", sizeof(header.m_szFlag));
+    header.m_nLength = vecResponse.size();
+    vecContent.assign((const char *)&header, (const char *)&header + sizeof(header));
+    vecContent.insert(vecContent.end(), vecResponse.begin(), vecResponse.end());
+    return true;
+}
+
+
+void TestHttpServer::Connection::run(void)
+{
+    std::string strTarget;
+    std::vector<char> vecBody;
+    bool bClose = false;
+    for(unsigned nServed = 0u; !bClose && recvRequest(strTarget, vecBody, bClose); nServed++)
+    {
+        if(nServed > 0u && m_pServer->takeDropReused())
+        {
+            break;
+        }
+
+        std::vector<char> vecContent;
+        const bool bAnswered = m_pServer->respond(strTarget, vecBody, vecContent);
+        const bool bChunked = (strTarget.find("/chunked") == 0u);
+        const bool bSilentClose = (strTarget.find("/silent") == 0u);
+        bClose = bClose || (strTarget.find("/close") == 0u);
+
+        std::ostringstream oss;
+        oss << (bAnswered ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 503 Service Unavailable\r\n")
+            << "Content-Type: application/octet-stream\r\n";
+        if(bChunked)
+        {
+            oss << "Transfer-Encoding: chunked\r\n";
+        }
+        else
+        {
+            oss << "Content-Length: " << vecContent.size() << "\r\n";
+        }
+        if(bClose)
+        {
+            oss << "Connection: close\r\n";
+        }
+        oss << "\r\n";
+
+        // the chunks grow from 1 byte, the last chunk of 0 bytes is followed by a trailer
+        std::string strResponse = oss.str();
+        if(bChunked)
+        {
+            size_t nChunk = 1u;
+            for(size_t nPos = 0u; nPos < vecContent.size(); nPos += nChunk, nChunk *= 2u)
+            {
+                const size_t nLength = std::min(nChunk, vecContent.size() - nPos);
+                std::ostringstream ossChunk;
+                ossChunk << std::hex << nLength << "\r\n";
+                strResponse += ossChunk.str();
+                strResponse.append(&vecContent[nPos], nLength);
+                strResponse += "\r\n";
+            }
+            strResponse += "0\r\nX-Test-Trailer: 1\r\n\r\n";
+        }
+        else if(!vecContent.empty())
+        {
+            strResponse.append(&vecContent[0], vecContent.size());
+        }
+        if(!sendAll(m_socket, strResponse.data(), strResponse.size()) || bSilentClose)
+        {
+            break;
+        }
+    }
+    closesocket(m_socket);
+}
+
+
+bool TestHttpServer::Connection::recvRequest(std::string &strTarget, std::vector<char> &vecBody, bool &bClose)
+{
+    // 1. the header
+    const char szEnd[] = "\r\n\r\n";
+    std::vector<char>::iterator itorEnd;
+    while((itorEnd = std::search(m_vecPending.begin(), m_vecPending.end(), szEnd, szEnd + 4)) == m_vecPending.end())
+    {
+        if(!recvMore(m_vecPending))
+        {
+            return false;
+        }
+    }
+    const std::string strHeader(m_vecPending.begin(), itorEnd + 2);
+    const size_t nHeaderLength = (itorEnd - m_vecPending.begin()) + 4u;
+
+    // 2. the request line is "METHOD target HTTP/1.1"
+    const size_t nTargetBegin = strHeader.find(' ');
+    const size_t nTargetEnd = strHeader.find(' ', nTargetBegin + 1u);
+    if(nTargetBegin == std::string::npos || nTargetEnd == std::string::npos)
+    {
+        return false;
+    }
+    strTarget = strHeader.substr(nTargetBegin + 1u, nTargetEnd - nTargetBegin - 1u);
+    bClose = (getHeaderField(strHeader, "connection") == "close");
+
+    // 3. the body
+    const size_t nBodyLength = (size_t)atol(getHeaderField(strHeader, "content-length").c_str());
+    while(m_vecPending.size() < nHeaderLength + nBodyLength)
+    {
+        if(!recvMore(m_vecPending))
+        {
+            return false;
+        }
+    }
+    vecBody.assign(m_vecPending.begin() + nHeaderLength, m_vecPending.begin() + nHeaderLength + nBodyLength);
+    m_vecPending.erase(m_vecPending.begin(), m_vecPending.begin() + nHeaderLength + nBodyLength);
+    return true;
+}
+
+
+bool TestHttpServer::Connection::recvMore(std::vector<char> &vecInput)
+{
+    while(!waitReadable(m_socket))
+    {
+        if(m_pServer->isStopped())
+        {
+            return false;
+        }
+    }
+
+    char szBuffer[64 * 1024];
+    const int nRecv = recv(m_socket, szBuffer, sizeof(szBuffer), 0);
+    if(nRecv <= 0)
+    {
+        return false;
+    }
+    vecInput.insert(vecInput.end(), szBuffer, szBuffer + nRecv);
+    return true;
+}
@@ -0,0 +1,161 @@
+#include "NetworkTest.h"
+#include <string.h>
+#include <IDProvider/Definer.h>
+#include <Common/IDEUException.h>
+#include <Common/ErrorCode.h>
+#include <Common/DEUBson.h>
+#include <Network/CSimpleHttpClient.h>
+
+namespace
+{
+    // the data set the test server serves, the missing IDs lie in another row of it
+    const unsigned g_nTestDataSet   = 77u;
+    const unsigned g_nTestLevel     = 10u;
+    const unsigned g_nMissingRow    = 1u;
+}
+
+
+ID makeTestID(unsigned n)
+{
+    return ID(g_nTestDataSet, TERRAIN_TILE, g_nTestLevel, 0u, n, (UINT_64)0u);
+}
+
+
+ID makeMissingID(unsigned n)
+{
+    return ID(g_nTestDataSet, TERRAIN_TILE, g_nTestLevel, g_nMissingRow, n, (UINT_64)0u);
+}
+
+
+bool isMissingID(const ID &id)
+{
+    return id.TileID.m_nRow == g_nMissingRow;
+}
+
+
+unsigned getTestDataSet(void)
+{
+    return g_nTestDataSet;
+}
+
+
+void makeTestBlock(const ID &id, std::vector<char> &vecBlock)
+{
+    const unsigned n = id.TileID.m_nCol + id.TileID.m_nRow * 7919u;
+    vecBlock.resize(64u + (n * 37u) % 4096u);
+    for(unsigned i = 0u; i < vecBlock.size(); i++)
+    {
+        vecBlock[i] = (char)(n * 131u + i);
+    }
+}
+
+
+bool checkTestBlock(const ID &id, const void *pData, unsigned nLength)
+{
+    std::vector<char> vecBlock;
+    makeTestBlock(id, vecBlock);
+    return pData != NULL && nLength == vecBlock.size() && memcmp(pData, &vecBlock[0], nLength) == 0;
+}
+
+
+void makeTestPage(const std::string &strTarget, std::vector<char> &vecPage)
+{
+    vecPage.clear();
+    for(unsigned n = 0u; vecPage.size() < 3000u; n++)
+    {
+        vecPage.insert(vecPage.end(), strTarget.begin(), strTarget.end());
+        vecPage.push_back((char)('0' + n % 10u));
+    }
+}
+
+
+void writeBsonDoc(const bson::bsonDocument &doc, std::vector<char> &vecBuffer)
+{
+    bson::bsonStream stream;
+    doc.Write(&stream);
+    const char *pStream = (const char *)stream.Data();
+    vecBuffer.insert(vecBuffer.end(), pStream, pStream + stream.DataLen());
+}
+
+
+bool openTestNetwork(const TestHttpServer &server, OpenSP::sp<deunw::IDEUNetwork> &pNetwork)
+{
+    pNetwork = deunw::createDEUNetwork();
+    if(!pNetwork->initialize("127.0.0.1", server.getPort(), true, ""))
+    {
+        pNetwork = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+std::string makeTestURL(const TestHttpServer &server, const std::string &strTarget)
+{
+    return "http://127.0.0.1:" + server.getPort() + strTarget;
+}
+
+
+bool requestTestPage(const TestHttpServer &server, const std::string &strTarget)
+{
+    SimpleHttpClient client;
+    std::vector<char> vecResponse;
+    if(client.Request(GetMethod, makeTestURL(server, strTarget), vecResponse) != 0)
+    {
+        return false;
+    }
+
+    // the client puts a 0 after the content
+    std::vector<char> vecPage;
+    makeTestPage(strTarget, vecPage);
+    return vecResponse.size() == vecPage.size() + 1u && memcmp(&vecResponse[0], &vecPage[0], vecPage.size()) == 0;
+}
+
+
+bool fetchTestBlock(deunw::IDEUNetwork *pNetwork, const ID &id, int &nErrorCode, int nPriority, unsigned nTimeout)
+{
+    OpenSP::sp<cmm::IDEUException> pExcep = cmm::createDEUException();
+    void *pBuffer = NULL;
+    unsigned nLength = 0u;
+    const bool bFetched = pNetwork->queryData(id, pBuffer, nLength, nPriority, nTimeout, pExcep);
+    nErrorCode = (int)pExcep->getReturnCode() - EC_NET_WORK;
+
+    const bool bValid = bFetched && checkTestBlock(id, pBuffer, nLength);
+    deunw::freeMemory(pBuffer);
+    return bValid;
+}
+
+
+TestFetcher::TestFetcher(deunw::IDEUNetwork *pNetwork, const ID &id, int nPriority, unsigned nTimeout)
+    : m_pNetwork(pNetwork), m_id(id), m_nPriority(nPriority), m_nTimeout(nTimeout), m_bStarted(false), m_bDone(false), m_bFetched(false), m_nErrorCode(0)
+{
+}
+
+
+void TestFetcher::startFetch(void)
+{
+    startThread();
+    while(!m_bStarted)
+    {
+        sleepMilliseconds(1u);
+    }
+}
+
+
+bool TestFetcher::waitFetched(unsigned nMilliseconds)
+{
+    for(unsigned nWaited = 0u; nWaited < nMilliseconds && !m_bDone; nWaited += 10u)
+    {
+        sleepMilliseconds(10u);
+    }
+    return m_bDone;
+}
+
+
+void TestFetcher::run(void)
+{
+    m_bStarted = true;
+    m_bFetched = fetchTestBlock(m_pNetwork, m_id, m_nErrorCode, m_nPriority, m_nTimeout);
+    m_bDone = true;
+}
+
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "NetworkTest.h"
+
+// Runs the tests of the downloads, of the kept HTTP connections and of the bson reader of Network,
+// the exit code is the number of tests which have failed.
+// Each test of a download or a connection starts a stand-in for the data server on a free port of 127.0.0.1, no other server is
+// needed, but Network only downloads while the network of the machine is up.
+//
+//  NetworkTest
+//  NetworkTest -bench-keepalive [<threads> [<requests>]]
+//      the page requests a second through kept connections and through a new connection for each,
+//      8 threads and 10000 requests by default
+//  NetworkTest -bench-latency [<threads> [<calls>]]
+//      the latency of queryData from many threads at once, without and with a deadline, 32 threads
+//      and 8000 calls by default
+//  NetworkTest -bench-replicas [<threads> [<calls>]]
+//      the latency of the same calls against a healthy server alone, beside a replica which fails every
+//      other download at once and beside a slow one, 8 threads and 2000 calls by default
+
+static const cmm::TestCase<bool (*)(void)> g_testCases[] =
+{
+    { "SingleFlight",           testSingleFlight },
+    { "SingleFlightManyIDs",    testSingleFlightManyIDs },
+    { "SingleFlightFailure",    testSingleFlightFailure },
+    { "Timeout",                testTimeout },
+    { "TimeoutOfShared",        testTimeoutOfSharedDownload },
+    { "Cancel",                 testCancel },
+    { "QueuedRequests",         testQueuedRequests },
+    { "KeepAlive",              testKeepAlive },
+    { "KeepAliveChunked",       testKeepAliveChunked },
+    { "KeepAliveClosed",        testKeepAliveClosed },
+    { "KeepAliveDropped",       testKeepAliveDropped },
+    { "KeepAliveIdle",          testKeepAliveIdle },
+    { "KeepAliveCapped",        testKeepAliveCapped },
+    { "KeepAlivePostNotResent", testKeepAlivePostNotResent },
+    { "ReplicaFailingFast",     testReplicaFailingFast },
+    { "ReplicaSlow",            testReplicaSlow },
+    { "BsonReader",             testBsonReader },
+    { "BsonReaderTruncated",    testBsonReaderTruncated },
+    { "BsonReaderCorrupt",      testBsonReaderCorrupt },
+};
+
+
+int main(int argc, char *argv[])
+{
+    if(argc >= 2 && strcmp(argv[1], "-bench-keepalive") == 0)
+    {
+        const unsigned nThreads = (argc > 2) ? (unsigned)atoi(argv[2]) : 8u;
+        const unsigned nRequests = (argc > 3) ? (unsigned)atoi(argv[3]) : 10000u;
+        return runKeepAliveBenchmark(nThreads > 0u ? nThreads : 1u, nRequests);
+    }
+    if(argc >= 2 && strcmp(argv[1], "-bench-latency") == 0)
+    {
+        const unsigned nThreads = (argc > 2) ? (unsigned)atoi(argv[2]) : 32u;
+        const unsigned nCalls = (argc > 3) ? (unsigned)atoi(argv[3]) : 8000u;
+        return runLatencyBenchmark(nThreads > 0u ? nThreads : 1u, nCalls);
+    }
+    if(argc >= 2 && strcmp(argv[1], "-bench-replicas") == 0)
+    {
+        const unsigned nThreads = (argc > 2) ? (unsigned)atoi(argv[2]) : 8u;
+        const unsigned nCalls = (argc > 3) ? (unsigned)atoi(argv[3]) : 2000u;
+        return runReplicaBenchmark(nThreads > 0u ? nThreads : 1u, nCalls);
+    }
+
+    return cmm::runTests(g_testCases);
+}